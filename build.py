@@ -10,6 +10,19 @@ import sys
 import os
 
 
+def export_blog_table(project_dir):
+    """Extract the binary log (BLOG) format table next to the ELF."""
+    elf = project_dir / "build" / "esp32_p4_voice_assistant.elf"
+    decoder = project_dir / "help_scripts" / "blog_decode.py"
+    if not elf.exists() or not decoder.exists():
+        return
+    subprocess.run(
+        [sys.executable, str(decoder), "table", "--elf", str(elf),
+         "-o", str(project_dir / "build" / "blog_table.json")],
+        cwd=project_dir,
+    )
+
+
 def main():
     print("=" * 60)
     print("ESP32-P4 Voice Assistant Build")
@@ -49,6 +62,7 @@ def main():
         print("\n" + "=" * 60)
         if result.returncode == 0:
             print("BUILD SUCCESS!")
+            export_blog_table(project_dir)
             print("\nNext step: Flash to board")
             print("Run: python flash.py")
             print("  or: idf.py -p COM13 flash monitor")
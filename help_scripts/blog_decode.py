@@ -0,0 +1,232 @@
+#!/usr/bin/env python3
+"""Decode binary (BLOG) log records from the device.
+
+The firmware stores BLOGI/BLOGD calls as a format-string address plus raw
+arguments (see main/blog.c). This tool resolves the addresses with the
+firmware ELF and prints ESP_LOG style text.
+
+  # Export the format table once per build (build.py does this automatically)
+  python help_scripts/blog_decode.py table --elf build/esp32_p4_voice_assistant.elf \
+      -o build/blog_table.json
+
+  # Follow the device
+  python help_scripts/blog_decode.py follow --table build/blog_table.json \
+      --url http://<device-ip>/webserial/blog
+
+  # Decode a saved dump of /webserial/blog
+  python help_scripts/blog_decode.py decode --table build/blog_table.json dump.bin
+"""
+import argparse
+import json
+import re
+import struct
+import sys
+import time
+import urllib.request
+from pathlib import Path
+
+BLOG_MARKER = 0x00
+BLOG_RECORD_HDR = 12
+LEVELS = "NEWIDV"
+
+# Mirrors parse_spec() in main/blog.c
+SPEC_RE = re.compile(r"%(?:%|[-+ #0]*\d*(?:\.\d*)?(?P<len>[hlLjztq]*)(?P<conv>[diuoxXcpfFeEgGaAs]))")
+
+
+# ---------------------------------------------------------------------------
+# ELF -> format table
+# ---------------------------------------------------------------------------
+
+def _elf_sections(data):
+    if data[:4] != b"\x7fELF" or data[4] != 1:
+        raise ValueError("expected a 32-bit ELF")
+    shoff, = struct.unpack_from("<I", data, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+    sections = []
+    for i in range(shnum):
+        name, stype, flags, addr, offset, size, link, info, align, entsize = \
+            struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize)
+        sections.append(dict(name=name, type=stype, flags=flags, addr=addr,
+                             offset=offset, size=size, link=link, entsize=entsize))
+    strtab = sections[shstrndx]
+    for s in sections:
+        s["name"] = _cstr(data, strtab["offset"] + s["name"])
+    return sections
+
+
+def _cstr(data, offset):
+    end = data.index(b"\x00", offset)
+    return data[offset:end].decode("utf-8", errors="replace")
+
+
+def _read_string(data, sections, addr):
+    for s in sections:
+        if s["type"] == 1 and s["addr"] <= addr < s["addr"] + s["size"]:  # PROGBITS
+            return _cstr(data, s["offset"] + addr - s["addr"])
+    return None
+
+
+def build_table(elf_path):
+    """Map address -> text for every BLOG format string."""
+    data = Path(elf_path).read_bytes()
+    sections = _elf_sections(data)
+    table = {}
+    for symtab in (s for s in sections if s["type"] == 2):  # SHT_SYMTAB
+        strtab = sections[symtab["link"]]
+        for off in range(symtab["offset"], symtab["offset"] + symtab["size"], 16):
+            name, value, size, info, other, shndx = struct.unpack_from("<IIIBBH", data, off)
+            sym = _cstr(data, strtab["offset"] + name)
+            # BLOG call sites: static const char blog_fmt_[] (blog.h)
+            if sym.startswith("blog_fmt_"):
+                text = _read_string(data, sections, value)
+                if text is not None:
+                    table[value] = text
+    return table, data, sections
+
+
+def load_table(args):
+    if args.table:
+        raw = json.loads(Path(args.table).read_text(encoding="utf-8"))
+        return {int(k): v for k, v in raw.items()}, None, None
+    if args.elf:
+        return build_table(args.elf)
+    sys.exit("need --table or --elf")
+
+
+# ---------------------------------------------------------------------------
+# Record decoding
+# ---------------------------------------------------------------------------
+
+def decode_record(rec, table, elf_data=None, sections=None):
+    if len(rec) < BLOG_RECORD_HDR or rec[0] != BLOG_MARKER:
+        return None
+    level, nargs, tag_len = rec[1], rec[2], rec[3]
+    fmt_addr, ts = struct.unpack_from("<II", rec, 4)
+    tag = rec[BLOG_RECORD_HDR:BLOG_RECORD_HDR + tag_len].decode("utf-8", errors="replace")
+
+    def lookup(addr):
+        text = table.get(addr)
+        if text is None and elf_data is not None:
+            text = _read_string(elf_data, sections, addr)
+        return text
+
+    fmt = lookup(fmt_addr) or f"<fmt 0x{fmt_addr:08x}>"
+    pos = BLOG_RECORD_HDR + tag_len
+    left = nargs
+
+    def render(match):
+        nonlocal pos, left
+        spec = match.group(0)
+        if spec == "%%":
+            return "%"
+        if left <= 0:
+            return "?"
+        left -= 1
+        conv = match.group("conv")
+        longs = match.group("len").count("l") + 2 * sum(match.group("len").count(c) for c in "jLq")
+        py_spec = re.sub(r"[hlLjztq]", "", spec)
+        if conv == "s":
+            n = rec[pos]
+            value = rec[pos + 1:pos + 1 + n].decode("utf-8", errors="replace")
+            pos += 1 + n
+            return py_spec % value
+        if conv in "fFeEgGaA":
+            value, = struct.unpack_from("<d", rec, pos)
+            pos += 8
+            return py_spec.replace("a", "e").replace("A", "E") % value
+        if longs >= 2:
+            value, = struct.unpack_from("<Q", rec, pos)
+            pos += 8
+        else:
+            value, = struct.unpack_from("<I", rec, pos)
+            pos += 4
+        if conv in "di" and value & (1 << (63 if longs >= 2 else 31)):
+            value -= 1 << (64 if longs >= 2 else 32)
+        if conv == "p":
+            return f"0x{value:x}"
+        if conv == "c":
+            return chr(value & 0xFF)
+        return py_spec.replace("u", "d") % value
+
+    try:
+        message = SPEC_RE.sub(render, fmt)
+    except (struct.error, IndexError, TypeError, ValueError):
+        message = fmt + "  <truncated record>"
+    lvl = LEVELS[level] if level < len(LEVELS) else "?"
+    return f"{lvl} ({ts}) {tag}: {message}"
+
+
+def iter_records(blob):
+    """Split a /webserial/blog response into records."""
+    pos = 0
+    while pos + 2 <= len(blob):
+        n, = struct.unpack_from("<H", blob, pos)
+        yield blob[pos + 2:pos + 2 + n]
+        pos += 2 + n
+
+
+# ---------------------------------------------------------------------------
+# Commands
+# ---------------------------------------------------------------------------
+
+def cmd_table(args):
+    table, _, _ = build_table(args.elf)
+    out = json.dumps({str(k): v for k, v in sorted(table.items())}, indent=1)
+    if args.output:
+        Path(args.output).write_text(out, encoding="utf-8")
+        print(f"{len(table)} BLOG format strings -> {args.output}")
+    else:
+        print(out)
+
+
+def cmd_decode(args):
+    table, elf_data, sections = load_table(args)
+    for rec in iter_records(Path(args.dump).read_bytes()):
+        line = decode_record(rec, table, elf_data, sections)
+        if line:
+            print(line)
+
+
+def cmd_follow(args):
+    table, elf_data, sections = load_table(args)
+    since = 0
+    while True:
+        try:
+            with urllib.request.urlopen(f"{args.url}?since={since}", timeout=5) as resp:
+                if resp.headers.get("X-Log-Reset") == "1":
+                    print("--- log ring wrapped, some records were lost ---")
+                since = int(resp.headers.get("X-Log-Seq", since))
+                for rec in iter_records(resp.read()):
+                    line = decode_record(rec, table, elf_data, sections)
+                    if line:
+                        print(line, flush=True)
+        except OSError as exc:
+            print(f"--- {exc} ---", file=sys.stderr)
+        time.sleep(args.interval)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("table", help="extract the BLOG format table from the ELF")
+    p.add_argument("--elf", required=True)
+    p.add_argument("-o", "--output")
+    p.set_defaults(func=cmd_table)
+
+    for name, func in (("decode", cmd_decode), ("follow", cmd_follow)):
+        p = sub.add_parser(name)
+        p.add_argument("--table", help="JSON from the 'table' command")
+        p.add_argument("--elf", help="firmware ELF (used if no table is given)")
+        p.set_defaults(func=func)
+    sub.choices["decode"].add_argument("dump")
+    sub.choices["follow"].add_argument("--url", required=True)
+    sub.choices["follow"].add_argument("--interval", type=float, default=1.0)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+"""Build and check delta OTA patches (ESPDLT1, applied by main/ota_delta.c).
+
+A patch rebuilds the new image from ranges of the image the device runs
+(COPY) plus literal bytes (INSERT). Serve the patch instead of the .bin;
+the device recognises it by its magic and refuses it unless the running
+firmware is exactly the one the patch was made from.
+
+  # Patch from the firmware on the device to the fresh build
+  python help_scripts/ota_delta.py make old.bin build/esp32_p4_voice_assistant.bin \\
+      -o build/update.delta
+
+  # Rebuild the new image from old + patch and compare hashes
+  python help_scripts/ota_delta.py apply old.bin build/update.delta -o new.bin
+
+  # Patch size and apply time across successive builds (oldest first)
+  python help_scripts/ota_delta.py bench v1.bin v2.bin v3.bin
+"""
+import argparse
+import hashlib
+import struct
+import sys
+import time
+from pathlib import Path
+
+MAGIC = b"ESPDLT1\x00"
+HEADER = struct.Struct("<8sII32s32s")
+OP_COPY = b"C"
+OP_INSERT = b"I"
+OP_END = b"E"
+
+BLOCK = 16       # Source index granularity
+MIN_COPY = 32    # Shorter matches cost more as COPY (9 B) than they save
+EXTEND_STEP = 256
+
+
+# ---------------------------------------------------------------------------
+# Diff
+# ---------------------------------------------------------------------------
+
+def _index(old):
+    index = {}
+    for off in range(0, len(old) - BLOCK + 1, BLOCK):
+        index.setdefault(old[off:off + BLOCK], off)
+    return index
+
+
+def _extend(old, new, o, n):
+    """Length of the common run starting at old[o], new[n]."""
+    start = n
+    while (n + EXTEND_STEP <= len(new) and o + EXTEND_STEP <= len(old)
+           and old[o:o + EXTEND_STEP] == new[n:n + EXTEND_STEP]):
+        o += EXTEND_STEP
+        n += EXTEND_STEP
+    while n < len(new) and o < len(old) and old[o] == new[n]:
+        o += 1
+        n += 1
+    return n - start
+
+
+def diff(old, new):
+    """Yield ('C', offset, length) and ('I', bytes) ops rebuilding new."""
+    index = _index(old)
+    lit = 0
+    i = 0
+    while i <= len(new) - BLOCK:
+        off = index.get(new[i:i + BLOCK])
+        if off is None:
+            i += 1
+            continue
+        # Grow the match backwards into the pending literal run
+        n, o = i, off
+        while n > lit and o > 0 and new[n - 1] == old[o - 1]:
+            n -= 1
+            o -= 1
+        length = _extend(old, new, o, n)
+        if length < MIN_COPY:
+            i += 1
+            continue
+        if n > lit:
+            yield ("I", new[lit:n])
+        yield ("C", o, length)
+        i = lit = n + length
+    if lit < len(new):
+        yield ("I", new[lit:])
+
+
+def make_patch(old, new):
+    out = bytearray(HEADER.pack(MAGIC, len(old), len(new),
+                                hashlib.sha256(old).digest(),
+                                hashlib.sha256(new).digest()))
+    for op in diff(old, new):
+        if op[0] == "C":
+            out += OP_COPY + struct.pack("<II", op[1], op[2])
+        else:
+            out += OP_INSERT + struct.pack("<I", len(op[1])) + op[1]
+    out += OP_END
+    return bytes(out)
+
+
+# ---------------------------------------------------------------------------
+# Apply (same checks as the device)
+# ---------------------------------------------------------------------------
+
+def apply_patch(old, patch):
+    magic, src_size, dst_size, src_sha, dst_sha = HEADER.unpack_from(patch, 0)
+    if magic != MAGIC:
+        raise ValueError("not an ESPDLT1 patch")
+    if src_size > len(old) or hashlib.sha256(old[:src_size]).digest() != src_sha:
+        raise ValueError("patch was made for a different source image")
+    out = bytearray()
+    pos = HEADER.size
+    while True:
+        op = patch[pos:pos + 1]
+        pos += 1
+        if op == OP_COPY:
+            off, length = struct.unpack_from("<II", patch, pos)
+            pos += 8
+            if off + length > src_size:
+                raise ValueError(f"COPY {off}+{length} outside the source")
+            out += old[off:off + length]
+        elif op == OP_INSERT:
+            length, = struct.unpack_from("<I", patch, pos)
+            pos += 4
+            out += patch[pos:pos + length]
+            pos += length
+        elif op == OP_END:
+            break
+        else:
+            raise ValueError(f"bad op {op!r} at {pos - 1}")
+        if len(out) > dst_size:
+            raise ValueError("patch produces too many bytes")
+    if pos != len(patch):
+        raise ValueError(f"{len(patch) - pos} bytes after the end op")
+    if len(out) != dst_size or hashlib.sha256(out).digest() != dst_sha:
+        raise ValueError("result does not match the target hash")
+    return bytes(out)
+
+
+def _stats(patch):
+    copied = inserted = ops = 0
+    pos = HEADER.size
+    while patch[pos:pos + 1] != OP_END:
+        ops += 1
+        if patch[pos:pos + 1] == OP_COPY:
+            copied += struct.unpack_from("<I", patch, pos + 5)[0]
+            pos += 9
+        else:
+            length, = struct.unpack_from("<I", patch, pos + 1)
+            inserted += length
+            pos += 5 + length
+    return copied, inserted, ops
+
+
+# ---------------------------------------------------------------------------
+# CLI
+# ---------------------------------------------------------------------------
+
+def cmd_make(args):
+    old = Path(args.old).read_bytes()
+    new = Path(args.new).read_bytes()
+    t0 = time.perf_counter()
+    patch = make_patch(old, new)
+    t1 = time.perf_counter()
+    apply_patch(old, patch)  # Never ship a patch that does not round-trip
+    Path(args.output).write_bytes(patch)
+    copied, inserted, ops = _stats(patch)
+    print(f"{args.output}: {len(patch)} B for a {len(new)} B image "
+          f"({100 * len(patch) / len(new):.1f}%), {ops} ops, "
+          f"{copied} B copied, {inserted} B literal, {t1 - t0:.1f}s")
+
+
+def cmd_apply(args):
+    old = Path(args.old).read_bytes()
+    patch = Path(args.patch).read_bytes()
+    new = apply_patch(old, patch)
+    if args.output:
+        Path(args.output).write_bytes(new)
+    print(f"OK: {len(new)} B, sha256 {hashlib.sha256(new).hexdigest()}")
+
+
+def cmd_bench(args):
+    images = [Path(p) for p in args.images]
+    if len(images) < 2:
+        sys.exit("bench needs at least two images")
+    print(f"{'from':<24} {'to':<24} {'image':>9} {'patch':>9} {'ratio':>6} "
+          f"{'diff_s':>7} {'apply_s':>7}")
+    for a, b in zip(images, images[1:]):
+        old, new = a.read_bytes(), b.read_bytes()
+        t0 = time.perf_counter()
+        patch = make_patch(old, new)
+        t1 = time.perf_counter()
+        if apply_patch(old, patch) != new:
+            sys.exit(f"{a} -> {b}: round trip failed")
+        t2 = time.perf_counter()
+        print(f"{a.name:<24} {b.name:<24} {len(new):>9} {len(patch):>9} "
+              f"{100 * len(patch) / len(new):>5.1f}% {t1 - t0:>7.2f} "
+              f"{t2 - t1:>7.2f}")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = ap.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("make", help="build a patch from old to new")
+    p.add_argument("old")
+    p.add_argument("new")
+    p.add_argument("-o", "--output", required=True)
+    p.set_defaults(func=cmd_make)
+
+    p = sub.add_parser("apply", help="apply a patch and verify the result")
+    p.add_argument("old")
+    p.add_argument("patch")
+    p.add_argument("-o", "--output")
+    p.set_defaults(func=cmd_apply)
+
+    p = sub.add_parser("bench", help="patch size and time across builds")
+    p.add_argument("images", nargs="+")
+    p.set_defaults(func=cmd_bench)
+
+    args = ap.parse_args()
+    try:
+        args.func(args)
+    except ValueError as e:
+        sys.exit(f"error: {e}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,391 @@
+/**
+ * @file alloc_trace.c
+ * @brief Opt-in heap allocation tracer with per-module attribution
+ *
+ * Live pointers are kept in an open-addressing table (linear probing,
+ * backward-shift deletion) so the tracer never allocates itself. Sizes are
+ * the requested sizes, not heap block sizes, which keeps host and device
+ * numbers comparable. Each entry also keeps the return address of the
+ * TRACE_* call, so a dump can name the code holding the bytes.
+ *
+ * With ALLOC_TRACE_ENABLE=0 only the query functions remain, reporting
+ * nothing; the table and the hooks are not built.
+ */
+
+#include "alloc_trace.h"
+#include <stdio.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#else
+#define ESP_LOGI(tag, fmt, ...) printf("I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#endif
+
+static const char *TAG = "alloc_trace";
+
+static const char *const tag_names[ALLOC_TAG_COUNT] = {
+    [ALLOC_TAG_AUDIO_CAPTURE] = "audio_capture",
+    [ALLOC_TAG_BEEP] = "beep_tone",
+    [ALLOC_TAG_HA_CLIENT] = "ha_client",
+    [ALLOC_TAG_OTA] = "ota_update",
+    [ALLOC_TAG_PIPELINE] = "voice_pipeline",
+    [ALLOC_TAG_TTS] = "tts_player",
+};
+
+const char *alloc_trace_tag_name(alloc_tag_t tag) {
+  return tag < ALLOC_TAG_COUNT ? tag_names[tag] : "?";
+}
+
+#if ALLOC_TRACE_ENABLE
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+#define TRACE_LOCK() portENTER_CRITICAL_SAFE(&trace_mux)
+#define TRACE_UNLOCK() portEXIT_CRITICAL_SAFE(&trace_mux)
+#define TRACE_NOW_MS() ((uint32_t)(esp_timer_get_time() / 1000))
+#else
+#include <pthread.h>
+#include <time.h>
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+#define TRACE_LOCK() pthread_mutex_lock(&trace_lock)
+#define TRACE_UNLOCK() pthread_mutex_unlock(&trace_lock)
+static uint32_t host_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+#define TRACE_NOW_MS() host_now_ms()
+#endif
+
+// The hooks are only entered from the TRACE_* macros, so this is the module
+// code that allocated (look it up with addr2line against the ELF)
+#define CALL_SITE() __builtin_return_address(0)
+#define DUMP_SITES 16 ///< Distinct call sites summed per dump
+
+#define SLOT_MASK (ALLOC_TRACE_SLOTS - 1)
+#define SLOT_SIZE_MAX 0x00FFFFFFu
+
+_Static_assert((ALLOC_TRACE_SLOTS & SLOT_MASK) == 0,
+               "ALLOC_TRACE_SLOTS must be a power of two");
+
+typedef struct {
+  void *ptr;
+  uint32_t size_tag; ///< size in bits 0..23, tag in bits 24..31
+  const void *site;  ///< Return address of the allocating call
+} trace_slot_t;
+
+typedef struct {
+  const void *site;
+  alloc_tag_t tag;
+  uint32_t bytes;
+  uint32_t count;
+} site_sum_t;
+
+static trace_slot_t slots[ALLOC_TRACE_SLOTS];
+static alloc_trace_stats_t stats[ALLOC_TAG_COUNT];
+static uint32_t untracked = 0;
+
+// Rate baseline, only touched by alloc_trace_dump()
+static uint32_t dump_allocs[ALLOC_TAG_COUNT];
+static uint32_t dump_bytes[ALLOC_TAG_COUNT];
+static uint32_t dump_ms = 0;
+
+static inline uint32_t slot_hash(const void *ptr) {
+  uint32_t h = (uint32_t)(uintptr_t)ptr >> 3; // Heap blocks are 8-aligned
+  return (h * 2654435761u) & SLOT_MASK;
+}
+
+static void slot_insert(void *ptr, alloc_tag_t tag, size_t size,
+                        const void *site) {
+  uint32_t i = slot_hash(ptr);
+  for (int n = 0; n < ALLOC_TRACE_SLOTS; n++, i = (i + 1) & SLOT_MASK) {
+    if (slots[i].ptr == NULL) {
+      slots[i].ptr = ptr;
+      slots[i].site = site;
+      slots[i].size_tag = ((uint32_t)tag << 24) |
+                          (size > SLOT_SIZE_MAX ? SLOT_SIZE_MAX : (uint32_t)size);
+      return;
+    }
+  }
+  untracked++;
+}
+
+/**
+ * Remove ptr from the table; returns false if it was never traced
+ */
+static bool slot_remove(void *ptr, alloc_tag_t *tag, uint32_t *size) {
+  uint32_t i = slot_hash(ptr);
+  int n;
+  for (n = 0; n < ALLOC_TRACE_SLOTS; n++, i = (i + 1) & SLOT_MASK) {
+    if (slots[i].ptr == ptr) {
+      break;
+    }
+    if (slots[i].ptr == NULL) {
+      return false;
+    }
+  }
+  if (n == ALLOC_TRACE_SLOTS) {
+    return false;
+  }
+
+  *tag = (alloc_tag_t)(slots[i].size_tag >> 24);
+  *size = slots[i].size_tag & SLOT_SIZE_MAX;
+
+  // Backward-shift the rest of the cluster so lookups never need tombstones.
+  // A full table has no empty slot to stop at, so visit each slot once.
+  uint32_t hole = i;
+  uint32_t j = (i + 1) & SLOT_MASK;
+  for (n = 1; n < ALLOC_TRACE_SLOTS && slots[j].ptr != NULL;
+       n++, j = (j + 1) & SLOT_MASK) {
+    uint32_t home = slot_hash(slots[j].ptr);
+    // Move j into the hole unless its home lies cyclically in (hole, j]
+    bool stays = (hole < j) ? (home > hole && home <= j)
+                            : (home > hole || home <= j);
+    if (!stays) {
+      slots[hole] = slots[j];
+      hole = j;
+    }
+  }
+  slots[hole].ptr = NULL;
+  slots[hole].size_tag = 0;
+  slots[hole].site = NULL;
+  return true;
+}
+
+static void record_at(alloc_tag_t tag, void *ptr, size_t size,
+                      const void *site) {
+  if (tag >= ALLOC_TAG_COUNT) {
+    return;
+  }
+  TRACE_LOCK();
+  alloc_trace_stats_t *s = &stats[tag];
+  if (ptr == NULL) {
+    s->failures++;
+  } else {
+    slot_insert(ptr, tag, size, site);
+    s->allocs++;
+    s->alloc_bytes += (uint32_t)size;
+    s->live_count++;
+    s->live_bytes += (uint32_t)size;
+    if (s->live_bytes > s->peak_bytes) {
+      s->peak_bytes = s->live_bytes;
+    }
+  }
+  TRACE_UNLOCK();
+}
+
+void alloc_trace_record(alloc_tag_t tag, void *ptr, size_t size) {
+  record_at(tag, ptr, size, CALL_SITE());
+}
+
+void alloc_trace_forget(void *ptr) {
+  alloc_tag_t tag;
+  uint32_t size;
+
+  if (ptr == NULL) {
+    return;
+  }
+  TRACE_LOCK();
+  if (slot_remove(ptr, &tag, &size)) {
+    alloc_trace_stats_t *s = &stats[tag];
+    s->frees++;
+    s->live_count--;
+    s->live_bytes -= size;
+  }
+  TRACE_UNLOCK();
+}
+
+void *alloc_trace_malloc(alloc_tag_t tag, size_t size) {
+  void *p = malloc(size);
+  record_at(tag, p, size, CALL_SITE());
+  return p;
+}
+
+void *alloc_trace_calloc(alloc_tag_t tag, size_t n, size_t size) {
+  void *p = calloc(n, size);
+  record_at(tag, p, n * size, CALL_SITE());
+  return p;
+}
+
+void *alloc_trace_realloc(alloc_tag_t tag, void *ptr, size_t size) {
+  uintptr_t old = (uintptr_t)ptr; // Only used as a table key afterwards
+  void *p = realloc(ptr, size);
+  if (p != NULL || size == 0) {
+    alloc_trace_forget((void *)old);
+  }
+  if (size > 0) {
+    record_at(tag, p, size, CALL_SITE());
+  }
+  return p;
+}
+
+char *alloc_trace_strdup(alloc_tag_t tag, const char *s) {
+  size_t n = strlen(s) + 1;
+  char *p = malloc(n);
+  record_at(tag, p, n, CALL_SITE());
+  if (p != NULL) {
+    memcpy(p, s, n);
+  }
+  return p;
+}
+
+void alloc_trace_free(void *ptr) {
+  alloc_trace_forget(ptr);
+  free(ptr); // heap_caps_free() is free() on ESP-IDF
+}
+
+#ifdef ESP_PLATFORM
+void *alloc_trace_heap_caps_malloc(alloc_tag_t tag, size_t size,
+                                   uint32_t caps) {
+  void *p = heap_caps_malloc(size, caps);
+  record_at(tag, p, size, CALL_SITE());
+  return p;
+}
+#endif
+
+void alloc_trace_get(alloc_tag_t tag, alloc_trace_stats_t *out) {
+  if (tag >= ALLOC_TAG_COUNT) {
+    memset(out, 0, sizeof(*out));
+    return;
+  }
+  TRACE_LOCK();
+  *out = stats[tag];
+  TRACE_UNLOCK();
+}
+
+uint32_t alloc_trace_untracked(void) { return untracked; }
+
+void alloc_trace_reset(void) {
+  TRACE_LOCK();
+  for (int t = 0; t < ALLOC_TAG_COUNT; t++) {
+    stats[t].peak_bytes = stats[t].live_bytes;
+    stats[t].allocs = 0;
+    stats[t].frees = 0;
+    stats[t].alloc_bytes = 0;
+    stats[t].failures = 0;
+    dump_allocs[t] = 0;
+    dump_bytes[t] = 0;
+  }
+  untracked = 0;
+  TRACE_UNLOCK();
+}
+
+/**
+ * Sum live bytes per call site, largest first; sites past DUMP_SITES
+ * distinct ones are left out. Returns the number of sites filled.
+ */
+static int sum_sites(site_sum_t sums[DUMP_SITES]) {
+  int n = 0;
+  TRACE_LOCK();
+  for (int i = 0; i < ALLOC_TRACE_SLOTS; i++) {
+    if (slots[i].ptr == NULL) {
+      continue;
+    }
+    int k = 0;
+    while (k < n && sums[k].site != slots[i].site) {
+      k++;
+    }
+    if (k == n) {
+      if (n == DUMP_SITES) {
+        continue;
+      }
+      sums[n++] = (site_sum_t){.site = slots[i].site,
+                               .tag = (alloc_tag_t)(slots[i].size_tag >> 24)};
+    }
+    sums[k].bytes += slots[i].size_tag & SLOT_SIZE_MAX;
+    sums[k].count++;
+  }
+  TRACE_UNLOCK();
+
+  for (int i = 1; i < n; i++) {
+    site_sum_t s = sums[i];
+    int j = i;
+    while (j > 0 && sums[j - 1].bytes < s.bytes) {
+      sums[j] = sums[j - 1];
+      j--;
+    }
+    sums[j] = s;
+  }
+  return n;
+}
+
+void alloc_trace_dump(int top) {
+  alloc_trace_stats_t snap[ALLOC_TAG_COUNT];
+  int order[ALLOC_TAG_COUNT];
+  site_sum_t sites[DUMP_SITES];
+
+  TRACE_LOCK();
+  memcpy(snap, stats, sizeof(snap));
+  TRACE_UNLOCK();
+
+  uint32_t now = TRACE_NOW_MS();
+  uint32_t window_ms = dump_ms ? now - dump_ms : 0;
+  dump_ms = now;
+
+  // Insertion sort by live bytes, largest first
+  for (int i = 0; i < ALLOC_TAG_COUNT; i++) {
+    int j = i;
+    while (j > 0 && snap[order[j - 1]].live_bytes < snap[i].live_bytes) {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = i;
+  }
+
+  int top_sites = top > 0 ? top : DUMP_SITES;
+  if (top <= 0 || top > ALLOC_TAG_COUNT) {
+    top = ALLOC_TAG_COUNT;
+  }
+  ESP_LOGI(TAG, "%-15s %9s %9s %6s %8s %8s", "tag", "live_B", "peak_B",
+           "live_n", "alloc/s", "B/s");
+  for (int k = 0; k < top; k++) {
+    int t = order[k];
+    uint32_t d_allocs = snap[t].allocs - dump_allocs[t];
+    uint32_t d_bytes = snap[t].alloc_bytes - dump_bytes[t];
+    dump_allocs[t] = snap[t].allocs;
+    dump_bytes[t] = snap[t].alloc_bytes;
+    uint32_t rate = window_ms ? (uint32_t)((uint64_t)d_allocs * 1000 / window_ms) : 0;
+    uint32_t brate = window_ms ? (uint32_t)((uint64_t)d_bytes * 1000 / window_ms) : 0;
+    ESP_LOGI(TAG, "%-15s %9lu %9lu %6lu %8lu %8lu", tag_names[t],
+             (unsigned long)snap[t].live_bytes, (unsigned long)snap[t].peak_bytes,
+             (unsigned long)snap[t].live_count, (unsigned long)rate,
+             (unsigned long)brate);
+  }
+  if (untracked) {
+    ESP_LOGI(TAG, "%lu allocations did not fit in the live table",
+             (unsigned long)untracked);
+  }
+
+  int n = sum_sites(sites);
+  if (n > 0) {
+    ESP_LOGI(TAG, "%-10s %-15s %9s %6s", "site", "tag", "live_B", "live_n");
+  }
+  for (int k = 0; k < n && k < top_sites; k++) {
+    ESP_LOGI(TAG, "%-10p %-15s %9lu %6lu", sites[k].site,
+             alloc_trace_tag_name(sites[k].tag), (unsigned long)sites[k].bytes,
+             (unsigned long)sites[k].count);
+  }
+}
+
+#else // !ALLOC_TRACE_ENABLE
+
+// The TRACE_* macros bypass the tracer; only the queries are left
+
+void alloc_trace_get(alloc_tag_t tag, alloc_trace_stats_t *out) {
+  (void)tag;
+  memset(out, 0, sizeof(*out));
+}
+
+uint32_t alloc_trace_untracked(void) { return 0; }
+
+void alloc_trace_reset(void) {}
+
+void alloc_trace_dump(int top) {
+  (void)top;
+  ESP_LOGI(TAG, "Allocation tracing is off (build with "
+                "-DALLOC_TRACE_ENABLE=1)");
+}
+
+#endif // ALLOC_TRACE_ENABLE
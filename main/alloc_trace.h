@@ -0,0 +1,129 @@
+/**
+ * @file alloc_trace.h
+ * @brief Opt-in heap allocation tracer with per-module attribution
+ *
+ * Project modules allocate through the TRACE_* macros below with a module
+ * tag. With ALLOC_TRACE_ENABLE=0 (default) the macros are the plain libc /
+ * heap_caps calls. Build with -DALLOC_TRACE_ENABLE=1 to record live bytes,
+ * peak and allocation counts per tag; `cmd=alloc_dump` on /api/action logs
+ * the top consumers to WebSerial.
+ *
+ * Frees are matched through a fixed table of live pointers, so a buffer may
+ * be released by a different module than the one that allocated it, and
+ * frees of untraced pointers (cJSON output, ...) are simply passed through.
+ *
+ * The tracer core has no ESP-IDF dependency and builds on a host.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef ALLOC_TRACE_ENABLE
+#define ALLOC_TRACE_ENABLE 0
+#endif
+
+#define ALLOC_TRACE_SLOTS 512 ///< Live allocations tracked at once
+
+typedef enum {
+  ALLOC_TAG_AUDIO_CAPTURE,
+  ALLOC_TAG_BEEP,
+  ALLOC_TAG_HA_CLIENT,
+  ALLOC_TAG_OTA,
+  ALLOC_TAG_PIPELINE,
+  ALLOC_TAG_TTS,
+  ALLOC_TAG_COUNT
+} alloc_tag_t;
+
+typedef struct {
+  uint32_t live_bytes;
+  uint32_t peak_bytes;
+  uint32_t live_count;
+  uint32_t allocs;      ///< Successful allocations since boot / reset
+  uint32_t frees;
+  uint32_t alloc_bytes; ///< Bytes allocated since boot / reset
+  uint32_t failures;
+} alloc_trace_stats_t;
+
+#if ALLOC_TRACE_ENABLE
+// Hooks behind the TRACE_* macros; each records its caller as the call site
+void *alloc_trace_malloc(alloc_tag_t tag, size_t size);
+void *alloc_trace_calloc(alloc_tag_t tag, size_t n, size_t size);
+void *alloc_trace_realloc(alloc_tag_t tag, void *ptr, size_t size);
+char *alloc_trace_strdup(alloc_tag_t tag, const char *s);
+void alloc_trace_free(void *ptr);
+#ifdef ESP_PLATFORM
+void *alloc_trace_heap_caps_malloc(alloc_tag_t tag, size_t size,
+                                   uint32_t caps);
+#endif
+
+/**
+ * @brief Account for an allocation made elsewhere (and its later free)
+ */
+void alloc_trace_record(alloc_tag_t tag, void *ptr, size_t size);
+void alloc_trace_forget(void *ptr);
+#endif
+
+const char *alloc_trace_tag_name(alloc_tag_t tag);
+
+/**
+ * @brief Copy the counters of one tag
+ */
+void alloc_trace_get(alloc_tag_t tag, alloc_trace_stats_t *out);
+
+/**
+ * @brief Pointers that did not fit in the live table (stats are incomplete)
+ */
+uint32_t alloc_trace_untracked(void);
+
+/**
+ * @brief Reset peaks and cumulative counters to the current live values
+ *
+ * Call at the start of a conversation to measure that conversation alone.
+ */
+void alloc_trace_reset(void);
+
+/**
+ * @brief Log tags sorted by live bytes, with allocation rate since last dump,
+ * then the call sites holding the most live bytes
+ *
+ * Sites are return addresses; resolve them with addr2line against the ELF.
+ *
+ * @param top Number of tags and of sites to print (0 = all)
+ */
+void alloc_trace_dump(int top);
+
+#if ALLOC_TRACE_ENABLE
+#define TRACE_MALLOC(tag, size) alloc_trace_malloc((tag), (size))
+#define TRACE_CALLOC(tag, n, size) alloc_trace_calloc((tag), (n), (size))
+#define TRACE_REALLOC(tag, ptr, size) alloc_trace_realloc((tag), (ptr), (size))
+#define TRACE_STRDUP(tag, s) alloc_trace_strdup((tag), (s))
+#define TRACE_FREE(ptr) alloc_trace_free(ptr)
+#define TRACE_HEAP_CAPS_MALLOC(tag, size, caps)                                \
+  alloc_trace_heap_caps_malloc((tag), (size), (caps))
+#define TRACE_HEAP_CAPS_FREE(ptr) alloc_trace_free(ptr)
+#else
+#define TRACE_MALLOC(tag, size) malloc(size)
+#define TRACE_CALLOC(tag, n, size) calloc((n), (size))
+#define TRACE_REALLOC(tag, ptr, size) realloc((ptr), (size))
+#define TRACE_STRDUP(tag, s) strdup(s)
+#define TRACE_FREE(ptr) free(ptr)
+#define TRACE_HEAP_CAPS_MALLOC(tag, size, caps) heap_caps_malloc((size), (caps))
+#define TRACE_HEAP_CAPS_FREE(ptr) heap_caps_free(ptr)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,7 +5,9 @@
  */
 
 #include "audio_capture.h"
+#include "alloc_trace.h"
 #include "audio_ref_buffer.h"
+#include "blog.h"
 #include "bsp_board_extra.h"
 #include "driver/i2s_types.h"
 #include "esp_afe_sr_iface.h"
@@ -14,12 +16,16 @@
 #include "esp_log.h"
 #include "esp_mn_iface.h"
 #include "esp_mn_models.h"
+#include "esp_timer.h"
 #include "esp_vad.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "mem_budget.h"
+#include "metrics.h"
 #include "model_path.h"
 #include "sys_diag.h" // Phase 9
+#include <string.h>
 
 static const char *TAG = "audio_capture";
 
@@ -29,6 +35,7 @@ static const char *TAG = "audio_capture";
 #define CAPTURE_TASK_PRIORITY 6
 #define CAPTURE_TASK_CORE 0
 #define I2S_READ_LEN 512
+#define FEED_FRAME_US (I2S_READ_LEN * 1000000LL / 16000) // 32 ms at 16 kHz
 
 #define FETCH_STACK_DEFAULT 16384
 #define FEED_STACK_DEFAULT 8192
@@ -82,14 +89,16 @@ static bool create_pinned_task_static(TaskFunction_t task, const char *name,
                                       BaseType_t core_id) {
   size_t stack_bytes = (size_t)stack_words * sizeof(StackType_t);
   StackType_t *stack =
-      heap_caps_malloc(stack_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-  StaticTask_t *tcb = heap_caps_malloc(sizeof(StaticTask_t),
-                                       MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+      TRACE_HEAP_CAPS_MALLOC(ALLOC_TAG_AUDIO_CAPTURE, stack_bytes,
+                             MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  StaticTask_t *tcb =
+      TRACE_HEAP_CAPS_MALLOC(ALLOC_TAG_AUDIO_CAPTURE, sizeof(StaticTask_t),
+                             MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
   if (!stack || !tcb) {
     ESP_LOGW(TAG, "Static task alloc failed (stack=%d) stack=%p tcb=%p",
              stack_words, stack, tcb);
-    free(stack);
-    free(tcb);
+    TRACE_FREE(stack);
+    TRACE_FREE(tcb);
     return false;
   }
 
@@ -97,8 +106,8 @@ static bool create_pinned_task_static(TaskFunction_t task, const char *name,
       task, name, stack_words, arg, priority, stack, tcb, core_id);
   if (!created) {
     ESP_LOGW(TAG, "Static task create failed (stack=%d)", stack_words);
-    free(stack);
-    free(tcb);
+    TRACE_FREE(stack);
+    TRACE_FREE(tcb);
     return false;
   }
 
@@ -177,35 +186,50 @@ static audio_capture_cmd_callback_t cmd_callback = NULL;
 
 static void feed_task(void *arg) {
   sys_diag_wdt_add(); // Monitor
-  int16_t *mic_buff = (int16_t *)malloc(I2S_READ_LEN * sizeof(int16_t));
-  int16_t *ref_buff = (int16_t *)malloc(I2S_READ_LEN * sizeof(int16_t));
-  int16_t *afe_buff = (int16_t *)malloc(
+  int16_t *mic_buff = (int16_t *)mem_budget_acquire(
+      MEM_BLOCK_FEED_MIC, I2S_READ_LEN * sizeof(int16_t));
+  int16_t *ref_buff = (int16_t *)mem_budget_acquire(
+      MEM_BLOCK_FEED_REF, I2S_READ_LEN * sizeof(int16_t));
+  int16_t *afe_buff = (int16_t *)mem_budget_acquire(
+      MEM_BLOCK_FEED_AFE,
       I2S_READ_LEN * 2 * sizeof(int16_t)); // 2 Channels (Mic+Ref)
   size_t bytes_read;
+  int64_t last_frame_us = 0;
 
   ESP_LOGI(TAG, "Feed Task Started (AEC Enabled)");
 
   if (mic_buff == NULL || ref_buff == NULL || afe_buff == NULL) {
     ESP_LOGE(TAG, "Feed task OOM (mic=%p, ref=%p, afe=%p)", mic_buff, ref_buff,
              afe_buff);
-    free(mic_buff);
-    free(ref_buff);
-    free(afe_buff);
+    mem_budget_release(MEM_BLOCK_FEED_MIC, mic_buff);
+    mem_budget_release(MEM_BLOCK_FEED_REF, ref_buff);
+    mem_budget_release(MEM_BLOCK_FEED_AFE, afe_buff);
+    feed_task_handle = NULL;
     if (capture_event_group)
       xEventGroupSetBits(capture_event_group, CAPTURE_FEED_DONE_BIT);
-    feed_task_handle = NULL;
     sys_diag_wdt_remove();
     vTaskDelete(NULL);
   }
 
   while (is_running_get()) {
-    sys_diag_wdt_feed(); // Reset WDT
+    sys_diag_activity("i2s_read"); // Reset WDT
 
     // Read from I2S (Mic)
     esp_err_t ret = bsp_extra_i2s_read(mic_buff, I2S_READ_LEN * sizeof(int16_t),
                                        &bytes_read, 100);
 
     if (ret == ESP_OK && bytes_read > 0) {
+      // Reads block for one frame; a longer gap means the loop fell behind
+      // real time and the I2S DMA ring dropped audio
+      int64_t now_us = esp_timer_get_time();
+      if (last_frame_us != 0 && now_us - last_frame_us > 2 * FEED_FRAME_US) {
+        BLOGD(TAG, "Feed late: %lld us since last frame",
+              now_us - last_frame_us);
+        metrics_add(METRIC_AFE_DROPS_LATE,
+                    (uint32_t)((now_us - last_frame_us) / FEED_FRAME_US - 1));
+      }
+      last_frame_us = now_us;
+
       // Read Reference (Playback Loopback)
       audio_ref_buffer_read(ref_buff, I2S_READ_LEN * sizeof(int16_t));
 
@@ -216,18 +240,22 @@ static void feed_task(void *arg) {
       }
 
       // Feed to AFE (2 channels)
+      sys_diag_activity("afe_feed");
       afe_handle->feed(afe_data, afe_buff);
+      metrics_inc(METRIC_AFE_FRAMES_FED);
     } else {
+      last_frame_us = 0;
       vTaskDelay(pdMS_TO_TICKS(10));
     }
   }
 
-  free(mic_buff);
-  free(ref_buff);
-  free(afe_buff);
+  mem_budget_release(MEM_BLOCK_FEED_MIC, mic_buff);
+  mem_budget_release(MEM_BLOCK_FEED_REF, ref_buff);
+  mem_budget_release(MEM_BLOCK_FEED_AFE, afe_buff);
+  // Handle first: a start woken by the done bit must see the task gone
+  feed_task_handle = NULL;
   if (capture_event_group)
     xEventGroupSetBits(capture_event_group, CAPTURE_FEED_DONE_BIT);
-  feed_task_handle = NULL;
   sys_diag_wdt_remove();
   vTaskDelete(NULL);
 }
@@ -239,14 +267,20 @@ static void fetch_task(void *arg) {
   int vad_state_prev = -1;
 
   while (is_running_get()) {
-    sys_diag_wdt_feed(); // Reset WDT
+    sys_diag_activity("afe_fetch"); // Reset WDT
 
     // Fetch processed data from AFE
     afe_fetch_result_t *res = afe_handle->fetch(afe_data);
 
     if (!res || res->ret_value == ESP_FAIL) {
+      metrics_inc(METRIC_AFE_FETCH_ERRORS);
       continue;
     }
+    BLOGD(TAG, "Fetch: %d bytes, vad=%d, ring free %.2f", res->data_size,
+          res->vad_state, res->ringbuff_free_pct);
+    if (res->ringbuff_free_pct <= 0.0f) {
+      metrics_inc(METRIC_AFE_DROPS_RING); // feed() will discard frames
+    }
 
     // 1. Handle Wake Word
     if (res->wakeup_state == WAKENET_DETECTED) {
@@ -280,6 +314,7 @@ static void fetch_task(void *arg) {
       // 3. MultiNet (Offline Commands)
       if (mn_handle && mn_data) {
         // Feed MultiNet
+        sys_diag_activity("mn_detect");
         esp_mn_state_t mn_state = mn_handle->detect(mn_data, res->data);
 
         if (mn_state == ESP_MN_STATE_DETECTED) {
@@ -297,9 +332,9 @@ static void fetch_task(void *arg) {
       }
     }
   }
+  fetch_task_handle = NULL;
   if (capture_event_group)
     xEventGroupSetBits(capture_event_group, CAPTURE_FETCH_DONE_BIT);
-  fetch_task_handle = NULL;
   // NOTE: Static memory cleanup moved to audio_capture_stop_wait() to avoid
   // use-after-free (can't free stack while still running on it!)
   sys_diag_wdt_remove();
@@ -322,6 +357,9 @@ esp_err_t audio_capture_init(void) {
       ESP_LOGE(TAG, "Failed to create capture event group");
       return ESP_ERR_NO_MEM;
     }
+    // Set while no capture task runs, so a join never waits on one
+    xEventGroupSetBits(capture_event_group,
+                       CAPTURE_FEED_DONE_BIT | CAPTURE_FETCH_DONE_BIT);
   }
 
   // Init Reference Buffer (16KB ~ 0.5s)
@@ -384,6 +422,11 @@ void audio_capture_register_cmd_callback(
 esp_err_t audio_capture_start(audio_capture_callback_t callback) {
   if (is_running_get())
     return ESP_OK;
+  if (feed_task_handle != NULL || fetch_task_handle != NULL) {
+    // A stopped task is still stuck in a driver call; don't start a second
+    ESP_LOGE(TAG, "Previous capture tasks have not exited");
+    return ESP_ERR_INVALID_STATE;
+  }
 
   extern esp_err_t bsp_extra_codec_set_fs(uint32_t rate, uint32_t bits_cfg,
                                           i2s_slot_mode_t ch);
@@ -404,12 +447,17 @@ esp_err_t audio_capture_start(audio_capture_callback_t callback) {
     ESP_LOGE(TAG, "Failed to create feed task");
     is_running_set(false);
     current_mode = CAPTURE_MODE_IDLE;
+    if (capture_event_group)
+      xEventGroupSetBits(capture_event_group,
+                         CAPTURE_FEED_DONE_BIT | CAPTURE_FETCH_DONE_BIT);
     return ESP_FAIL;
   }
   if (!create_fetch_task(&fetch_task_handle)) {
     ESP_LOGE(TAG, "Failed to create fetch task");
-    is_running_set(false);
+    is_running_set(false); // The feed task sees this and exits
     current_mode = CAPTURE_MODE_IDLE;
+    if (capture_event_group)
+      xEventGroupSetBits(capture_event_group, CAPTURE_FETCH_DONE_BIT);
     return ESP_FAIL;
   }
 
@@ -420,6 +468,11 @@ esp_err_t
 audio_capture_start_wake_word_mode(audio_capture_wwd_callback_t callback) {
   if (is_running_get())
     return ESP_OK;
+  if (feed_task_handle != NULL || fetch_task_handle != NULL) {
+    // A stopped task is still stuck in a driver call; don't start a second
+    ESP_LOGE(TAG, "Previous capture tasks have not exited");
+    return ESP_ERR_INVALID_STATE;
+  }
 
   extern esp_err_t bsp_extra_codec_set_fs(uint32_t rate, uint32_t bits_cfg,
                                           i2s_slot_mode_t ch);
@@ -440,12 +493,17 @@ audio_capture_start_wake_word_mode(audio_capture_wwd_callback_t callback) {
     ESP_LOGE(TAG, "Failed to create feed task");
     is_running_set(false);
     current_mode = CAPTURE_MODE_IDLE;
+    if (capture_event_group)
+      xEventGroupSetBits(capture_event_group,
+                         CAPTURE_FEED_DONE_BIT | CAPTURE_FETCH_DONE_BIT);
     return ESP_FAIL;
   }
   if (!create_fetch_task(&fetch_task_handle)) {
     ESP_LOGE(TAG, "Failed to create fetch task");
-    is_running_set(false);
+    is_running_set(false); // The feed task sees this and exits
     current_mode = CAPTURE_MODE_IDLE;
+    if (capture_event_group)
+      xEventGroupSetBits(capture_event_group, CAPTURE_FETCH_DONE_BIT);
     return ESP_FAIL;
   }
 
@@ -461,6 +519,29 @@ void audio_capture_stop(void) {
   ESP_LOGI(TAG, "Capture Stopped");
 }
 
+/**
+ * Wait for both capture tasks to exit, then free the fetch task's static
+ * stack and TCB (only safe once nothing runs on them)
+ */
+static esp_err_t join_tasks(uint32_t timeout_ms) {
+  EventBits_t bits = xEventGroupWaitBits(
+      capture_event_group, CAPTURE_FEED_DONE_BIT | CAPTURE_FETCH_DONE_BIT,
+      pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms));
+
+  if ((bits & (CAPTURE_FEED_DONE_BIT | CAPTURE_FETCH_DONE_BIT)) !=
+      (CAPTURE_FEED_DONE_BIT | CAPTURE_FETCH_DONE_BIT)) {
+    return ESP_ERR_TIMEOUT;
+  }
+  if (fetch_stack_mem || fetch_tcb_mem) {
+    ESP_LOGI(TAG, "Freeing fetch task static memory (after task exit)");
+    TRACE_FREE(fetch_stack_mem);
+    TRACE_FREE(fetch_tcb_mem);
+    fetch_stack_mem = NULL;
+    fetch_tcb_mem = NULL;
+  }
+  return ESP_OK;
+}
+
 esp_err_t audio_capture_stop_wait(uint32_t timeout_ms) {
   if (!is_running_get()) {
     return ESP_OK;
@@ -477,24 +558,29 @@ esp_err_t audio_capture_stop_wait(uint32_t timeout_ms) {
   if (timeout_ms == 0 || capture_event_group == NULL) {
     return ESP_OK;
   }
+  return join_tasks(timeout_ms);
+}
 
-  EventBits_t bits = xEventGroupWaitBits(
-      capture_event_group, CAPTURE_FEED_DONE_BIT | CAPTURE_FETCH_DONE_BIT,
-      pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms));
+esp_err_t audio_capture_teardown(uint32_t timeout_ms) {
+  if (capture_event_group == NULL)
+    return ESP_OK;
 
-  if ((bits & (CAPTURE_FEED_DONE_BIT | CAPTURE_FETCH_DONE_BIT)) ==
-      (CAPTURE_FEED_DONE_BIT | CAPTURE_FETCH_DONE_BIT)) {
-    // Tasks have exited - now safe to free static memory (was allocated for
-    // fetch_task)
-    if (fetch_stack_mem || fetch_tcb_mem) {
-      ESP_LOGI(TAG, "Freeing fetch task static memory (after task exit)");
-      free(fetch_stack_mem);
-      free(fetch_tcb_mem);
-      fetch_stack_mem = NULL;
-      fetch_tcb_mem = NULL;
-    }
+  // Also joins tasks that an earlier stop_wait() gave up on
+  audio_capture_stop();
+  if (join_tasks(timeout_ms) == ESP_OK) {
+    if (afe_handle && afe_data)
+      afe_handle->reset_buffer(afe_data); // Drop the half-fed frames
     return ESP_OK;
   }
+
+  // A task is stuck in a driver or AFE call and did not see the stop.
+  // Deleting it would leave the driver's mutexes held, and its stack and TCB
+  // stay in use until it exits, so only a reboot gets capture back
+  EventBits_t bits = xEventGroupGetBits(capture_event_group);
+  const char *task =
+      (bits & CAPTURE_FEED_DONE_BIT) == 0 ? "afe_feed" : "afe_fetch";
+  ESP_LOGE(TAG, "Capture task %s did not exit", task);
+  sys_diag_reboot(task, "capture_stop", timeout_ms);
   return ESP_ERR_TIMEOUT;
 }
 
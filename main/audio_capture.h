@@ -106,6 +106,19 @@ void audio_capture_stop(void);
  */
 esp_err_t audio_capture_stop_wait(uint32_t timeout_ms);
 
+/**
+ * @brief Stop capture even if a capture task is stuck
+ *
+ * Like audio_capture_stop_wait(), but also joins tasks left over from an
+ * earlier stop that timed out. A task still running after @p timeout_ms is
+ * stuck in a driver call and cannot be deleted safely, so the device
+ * reboots through sys_diag_reboot(). For soft watchdog recovery, not from a
+ * capture task.
+ *
+ * @return ESP_OK once the tasks exited (does not return otherwise)
+ */
+esp_err_t audio_capture_teardown(uint32_t timeout_ms);
+
 /**
  * @brief Deinitialize audio capture
  */
@@ -0,0 +1,52 @@
+/**
+ * @file audio_level.c
+ * @brief TTS output envelope for the SPEAKING LED
+ *
+ * Mailbox word: bits 0-7 level, bits 8-31 post counter. With a single
+ * producer a load and a store are enough; the counter only has to change
+ * on every post.
+ */
+
+#include "audio_level.h"
+#include <stdatomic.h>
+
+static _Atomic uint32_t mailbox = 0;
+
+uint8_t audio_level_update(int32_t *envelope, const int16_t *pcm,
+                           int samples) {
+  int32_t peak = 0;
+  for (int i = 0; i < samples; i += AUDIO_LEVEL_DECIMATE) {
+    int32_t v = pcm[i];
+    if (v < 0) {
+      v = -v;
+    }
+    if (v > peak) {
+      peak = v;
+    }
+  }
+
+  if (peak > *envelope) {
+    *envelope = peak;
+  } else {
+    *envelope -= (*envelope - peak) >> AUDIO_LEVEL_RELEASE_SHIFT;
+  }
+
+  int32_t level = *envelope >> AUDIO_LEVEL_SHIFT;
+  return (uint8_t)(level > 255 ? 255 : level);
+}
+
+void audio_level_post(uint8_t level) {
+  uint32_t prev = atomic_load_explicit(&mailbox, memory_order_relaxed);
+  uint32_t next = ((prev + 0x100) & ~0xFFu) | level;
+  atomic_store_explicit(&mailbox, next, memory_order_release);
+}
+
+bool audio_level_poll(uint32_t *last_post, uint8_t *level) {
+  uint32_t mail = atomic_load_explicit(&mailbox, memory_order_acquire);
+  *level = (uint8_t)(mail & 0xFF);
+  if ((mail >> 8) == *last_post) {
+    return false;
+  }
+  *last_post = mail >> 8;
+  return true;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file audio_level.h
+ * @brief TTS output envelope for the SPEAKING LED
+ *
+ * The TTS player runs a peak follower over each decoded frame (instant
+ * attack, geometric release, every 4th sample inspected) and posts the
+ * 0-255 level to a single-word mailbox that the LED effect task polls. The
+ * word carries a post counter beside the level, so the reader tells a fresh
+ * level from a stale one without a timestamp. No queue, no lock, no
+ * allocation.
+ *
+ * One producer (the TTS playback task) and one consumer (the LED effect
+ * task).
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUDIO_LEVEL_DECIMATE 4      ///< Inspect every 4th sample
+#define AUDIO_LEVEL_RELEASE_SHIFT 2 ///< Release closes 1/4 of the gap a frame
+#define AUDIO_LEVEL_SHIFT 6         ///< 16-bit peak -> 0-255, ~6 dB headroom
+
+/**
+ * @brief Follow the envelope over one decoded frame
+ *
+ * @param envelope Follower state, 0 at the start of a response
+ * @param pcm Interleaved samples as decoded
+ * @param samples Number of samples in @p pcm
+ * @return Level for the LED, 0 = silence, 255 = full scale
+ */
+uint8_t audio_level_update(int32_t *envelope, const int16_t *pcm,
+                           int samples);
+
+/**
+ * @brief Publish @p level to the LED effect task
+ */
+void audio_level_post(uint8_t level);
+
+/**
+ * @brief Read the latest level
+ *
+ * @param last_post Post counter the caller saw last, updated on a new post
+ * @param level Receives the latest level (also when nothing new was posted)
+ * @return true if a level was posted since @p last_post
+ */
+bool audio_level_poll(uint32_t *last_post, uint8_t *level);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,6 +5,7 @@
 #include "beep_tone.h"
 #include "bsp_board_extra.h"
 #include "esp_log.h"
+#include "mem_budget.h"
 #include <math.h>
 #include <string.h>
 
@@ -39,8 +40,9 @@ esp_err_t beep_tone_play(uint16_t frequency, uint16_t duration,
   // Calculate number of samples
   uint32_t num_samples = (BEEP_SAMPLE_RATE * duration) / 1000;
 
-  // Allocate buffer for mono PCM samples (16-bit)
-  int16_t *pcm_buffer = (int16_t *)malloc(num_samples * sizeof(int16_t));
+  // Mono PCM samples (16-bit), preallocated at boot for the longest beep
+  int16_t *pcm_buffer = (int16_t *)mem_budget_acquire(
+      MEM_BLOCK_BEEP_PCM, num_samples * sizeof(int16_t));
   if (pcm_buffer == NULL) {
     ESP_LOGE(TAG, "Failed to allocate PCM buffer");
     return ESP_ERR_NO_MEM;
@@ -75,7 +77,7 @@ esp_err_t beep_tone_play(uint16_t frequency, uint16_t duration,
       bsp_extra_codec_set_fs(BEEP_SAMPLE_RATE, 16, I2S_SLOT_MODE_MONO);
   if (ret != ESP_OK) {
     ESP_LOGE(TAG, "Failed to configure codec: %s", esp_err_to_name(ret));
-    free(pcm_buffer);
+    mem_budget_release(MEM_BLOCK_BEEP_PCM, pcm_buffer);
     return ret;
   }
 
@@ -89,13 +91,13 @@ esp_err_t beep_tone_play(uint16_t frequency, uint16_t duration,
 
   if (ret != ESP_OK) {
     ESP_LOGE(TAG, "I2S write failed: %s", esp_err_to_name(ret));
-    free(pcm_buffer);
+    mem_budget_release(MEM_BLOCK_BEEP_PCM, pcm_buffer);
     return ret;
   }
 
   ESP_LOGD(TAG, "Beep playback complete: %d samples, %d bytes written",
            num_samples, bytes_written);
 
-  free(pcm_buffer);
+  mem_budget_release(MEM_BLOCK_BEEP_PCM, pcm_buffer);
   return ESP_OK;
 }
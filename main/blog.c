@@ -0,0 +1,409 @@
+/**
+ * @file blog.c
+ * @brief Binary structured logging
+ *
+ * Record layout (little endian, stored as one log ring record):
+ *   u8  marker (BLOG_MARKER)
+ *   u8  level (esp_log_level_t)
+ *   u8  nargs
+ *   u8  tag length
+ *   u32 format string address (in the firmware image)
+ *   u32 timestamp (ms, esp_log_timestamp)
+ *   tag bytes (not NUL-terminated; TAG is often a macro, so no address)
+ *   args: u32 | u64 | f64 | u8 len + bytes (for %s)
+ *
+ * help_scripts/blog_decode.py implements the same layout on the host.
+ */
+
+#include "blog.h"
+#include "esp_cpu.h"
+#include "esp_memory_utils.h"
+#include "log_ring.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "blog";
+
+#define BLOG_LINE_MAX 256 // Same line limit as the WebSerial log hook
+
+esp_log_level_t blog_level = ESP_LOG_INFO;
+static volatile bool uart_echo = false;
+
+// Argument kinds, 2 bits each in blog_site_t.kinds
+#define BLOG_ARG_U32 0
+#define BLOG_ARG_U64 1
+#define BLOG_ARG_F64 2
+#define BLOG_ARG_STR 3
+
+#define BLOG_MAX_TAG 24
+#define BLOG_FMT_MAX 256 // Longest format string blog_render will walk
+#define BLOG_RECORD_MAX                                                        \
+  (BLOG_RECORD_HDR + BLOG_MAX_TAG + BLOG_MAX_ARGS * (1 + BLOG_MAX_STR))
+
+_Static_assert(BLOG_RECORD_MAX <= LOG_RING_MAX_PAYLOAD,
+               "binary record must fit in one log ring record");
+
+/**
+ * Parse one conversion spec starting at '%'.
+ *
+ * @param p Points at '%'
+ * @param spec Optional copy of the spec (for snprintf), NUL-terminated
+ * @param kind Argument kind, or -1 if the spec takes no argument ("%%")
+ * @return Characters consumed, 0 if the spec is not supported
+ */
+static int parse_spec(const char *p, char *spec, size_t spec_len, int *kind) {
+  const char *s = p + 1;
+  int longs = 0;
+
+  if (*s == '%') {
+    *kind = -1;
+    if (spec && spec_len >= 2) {
+      spec[0] = '%';
+      spec[1] = '\0';
+    }
+    return 2;
+  }
+  while (*s && strchr("-+ #0", *s)) {
+    s++;
+  }
+  while (*s >= '0' && *s <= '9') {
+    s++;
+  }
+  if (*s == '.') {
+    s++;
+    while (*s >= '0' && *s <= '9') {
+      s++;
+    }
+  }
+  while (*s && strchr("hlLjztq", *s)) {
+    if (*s == 'l' || *s == 'j' || *s == 'L' || *s == 'q') {
+      longs += (*s == 'l') ? 1 : 2;
+    }
+    s++;
+  }
+
+  switch (*s) {
+  case 'd':
+  case 'i':
+  case 'u':
+  case 'o':
+  case 'x':
+  case 'X':
+  case 'c':
+  case 'p':
+    *kind = (longs >= 2) ? BLOG_ARG_U64 : BLOG_ARG_U32;
+    break;
+  case 'f':
+  case 'F':
+  case 'e':
+  case 'E':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':
+    *kind = BLOG_ARG_F64;
+    break;
+  case 's':
+    *kind = BLOG_ARG_STR;
+    break;
+  default:
+    return 0; // '*' width, %n, truncated spec...
+  }
+
+  int consumed = (int)(s - p) + 1;
+  if (spec) {
+    if ((size_t)consumed >= spec_len) {
+      return 0;
+    }
+    memcpy(spec, p, consumed);
+    spec[consumed] = '\0';
+  }
+  return consumed;
+}
+
+static void site_prepare(blog_site_t *site) {
+  uint16_t kinds = 0;
+  uint8_t nargs = 0;
+
+  for (const char *p = site->fmt; *p; p++) {
+    if (*p != '%') {
+      continue;
+    }
+    int kind;
+    int n = parse_spec(p, NULL, 0, &kind);
+    if (n == 0) {
+      break; // Unsupported - arguments after this point are not recorded
+    }
+    p += n - 1;
+    if (kind < 0) {
+      continue;
+    }
+    if (nargs == BLOG_MAX_ARGS) {
+      break;
+    }
+    kinds |= (uint16_t)(kind << (nargs * 2));
+    nargs++;
+  }
+
+  // Racing first calls compute the same values; publish them last
+  site->kinds = kinds;
+  site->nargs = nargs;
+  __atomic_store_n(&site->ready, 1, __ATOMIC_RELEASE);
+}
+
+// Kept out of line so the line buffer is only on the stack while echoing
+static void __attribute__((noinline)) echo_uart(const uint8_t *rec,
+                                                size_t len) {
+  char line[BLOG_LINE_MAX];
+  blog_render(rec, len, line, sizeof(line));
+  // Straight to stdout: the ESP_LOG hook would put the line in the ring twice
+  fputs(line, stdout);
+}
+
+void blog_write(blog_site_t *site, esp_log_level_t level, const char *tag,
+                ...) {
+  if (!__atomic_load_n(&site->ready, __ATOMIC_ACQUIRE)) {
+    site_prepare(site);
+  }
+
+  uint8_t rec[BLOG_RECORD_MAX];
+  uint32_t fmt_addr = (uint32_t)(uintptr_t)site->fmt;
+  uint32_t ts = esp_log_timestamp();
+  size_t tag_len = strnlen(tag, BLOG_MAX_TAG);
+  size_t pos = BLOG_RECORD_HDR;
+
+  rec[0] = BLOG_MARKER;
+  rec[1] = (uint8_t)level;
+  rec[2] = site->nargs;
+  rec[3] = (uint8_t)tag_len;
+  memcpy(&rec[4], &fmt_addr, 4);
+  memcpy(&rec[8], &ts, 4);
+  memcpy(&rec[pos], tag, tag_len);
+  pos += tag_len;
+
+  va_list ap;
+  va_start(ap, tag);
+  for (int i = 0; i < site->nargs; i++) {
+    switch ((site->kinds >> (i * 2)) & 3) {
+    case BLOG_ARG_U32: {
+      uint32_t v = va_arg(ap, uint32_t);
+      memcpy(&rec[pos], &v, 4);
+      pos += 4;
+      break;
+    }
+    case BLOG_ARG_U64: {
+      uint64_t v = va_arg(ap, uint64_t);
+      memcpy(&rec[pos], &v, 8);
+      pos += 8;
+      break;
+    }
+    case BLOG_ARG_F64: {
+      double v = va_arg(ap, double);
+      memcpy(&rec[pos], &v, 8);
+      pos += 8;
+      break;
+    }
+    case BLOG_ARG_STR: {
+      // Strings may not outlive the call, so copy them
+      const char *str = va_arg(ap, const char *);
+      if (str == NULL) {
+        str = "(null)";
+      }
+      size_t len = strnlen(str, BLOG_MAX_STR);
+      rec[pos++] = (uint8_t)len;
+      memcpy(&rec[pos], str, len);
+      pos += len;
+      break;
+    }
+    }
+  }
+  va_end(ap);
+
+  log_ring_write(rec, pos);
+  if (uart_echo) {
+    echo_uart(rec, pos);
+  }
+}
+
+void blog_set_level(esp_log_level_t level) { blog_level = level; }
+
+void blog_set_uart(bool on) { uart_echo = on; }
+
+/**
+ * Check that a format address read back from the ring is a string in flash.
+ *
+ * Records come out of a lock-free ring, so the address is only as good as
+ * the record. Every byte up to the NUL must be in DROM, within BLOG_FMT_MAX.
+ */
+static bool fmt_valid(const char *fmt) {
+  for (size_t i = 0; i < BLOG_FMT_MAX; i++) {
+    if (!esp_ptr_in_drom(fmt + i)) {
+      return false;
+    }
+    if (fmt[i] == '\0') {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t blog_render(const void *rec_ptr, size_t len, char *out,
+                   size_t out_len) {
+  static const char level_chars[] = "NEWIDV";
+  const uint8_t *rec = (const uint8_t *)rec_ptr;
+  uint32_t fmt_addr, ts;
+  size_t o = 0;
+
+  if (out_len == 0) {
+    return 0;
+  }
+  out[0] = '\0';
+  if (!blog_is_record(rec, len)) {
+    return 0;
+  }
+
+  memcpy(&fmt_addr, &rec[4], 4);
+  memcpy(&ts, &rec[8], 4);
+  const char *fmt = (const char *)(uintptr_t)fmt_addr;
+  size_t tag_len = rec[3];
+  char lvl = rec[1] < sizeof(level_chars) - 1 ? level_chars[rec[1]] : '?';
+  if (BLOG_RECORD_HDR + tag_len > len) {
+    return 0;
+  }
+
+  int n = snprintf(out, out_len, "%c (%lu) %.*s: ", lvl, (unsigned long)ts,
+                   (int)tag_len, (const char *)&rec[BLOG_RECORD_HDR]);
+  o = (n > 0) ? ((size_t)n < out_len ? (size_t)n : out_len - 1) : 0;
+
+  if (!fmt_valid(fmt)) {
+    n = snprintf(out + o, out_len - o, "<bad format 0x%08lx>\n",
+                 (unsigned long)fmt_addr);
+    o += (n > 0) ? ((size_t)n < out_len - o ? (size_t)n : out_len - o - 1) : 0;
+    return o;
+  }
+
+  size_t pos = BLOG_RECORD_HDR + tag_len;
+  int args_left = rec[2];
+
+  for (const char *p = fmt; *p && o < out_len - 1; p++) {
+    if (*p != '%') {
+      out[o++] = *p;
+      continue;
+    }
+
+    char spec[16];
+    int kind;
+    int consumed = parse_spec(p, spec, sizeof(spec), &kind);
+    if (consumed == 0) {
+      out[o++] = *p; // Print unsupported specs literally
+      continue;
+    }
+    p += consumed - 1;
+
+    int w = 0;
+    if (kind < 0) {
+      w = snprintf(out + o, out_len - o, "%%");
+    } else if (args_left-- <= 0) {
+      w = snprintf(out + o, out_len - o, "?");
+    } else if (kind == BLOG_ARG_U32 && pos + 4 <= len) {
+      uint32_t v;
+      memcpy(&v, &rec[pos], 4);
+      pos += 4;
+      if (spec[strlen(spec) - 1] == 'p') {
+        w = snprintf(out + o, out_len - o, spec, (void *)(uintptr_t)v);
+      } else {
+        w = snprintf(out + o, out_len - o, spec, v);
+      }
+    } else if (kind == BLOG_ARG_U64 && pos + 8 <= len) {
+      uint64_t v;
+      memcpy(&v, &rec[pos], 8);
+      pos += 8;
+      w = snprintf(out + o, out_len - o, spec, v);
+    } else if (kind == BLOG_ARG_F64 && pos + 8 <= len) {
+      double v;
+      memcpy(&v, &rec[pos], 8);
+      pos += 8;
+      w = snprintf(out + o, out_len - o, spec, v);
+    } else if (kind == BLOG_ARG_STR && pos + 1 <= len &&
+               pos + 1 + rec[pos] <= len) {
+      char str[BLOG_MAX_STR + 1];
+      size_t slen = rec[pos];
+      memcpy(str, &rec[pos + 1], slen);
+      str[slen] = '\0';
+      pos += 1 + slen;
+      w = snprintf(out + o, out_len - o, spec, str);
+    } else {
+      break; // Truncated record
+    }
+
+    if (w > 0) {
+      o += ((size_t)w < out_len - o) ? (size_t)w : out_len - o - 1;
+    }
+  }
+
+  if (o < out_len - 1) {
+    out[o++] = '\n';
+  }
+  out[o] = '\0';
+  return o;
+}
+
+/**
+ * What the WebSerial log hook does with an ESP_LOG line, minus the UART:
+ * format it and store it as one ring record
+ */
+static void __attribute__((format(printf, 1, 2))) text_to_ring(const char *fmt,
+                                                               ...) {
+  char line[BLOG_LINE_MAX];
+  int len = snprintf(line, sizeof(line), "I (%lu) blog_bench: ",
+                     (unsigned long)esp_log_timestamp());
+  va_list ap;
+  va_start(ap, fmt);
+  len += vsnprintf(line + len, sizeof(line) - len, fmt, ap);
+  va_end(ap);
+  if (len >= (int)sizeof(line)) {
+    len = sizeof(line) - 1;
+  }
+  log_ring_write(line, (size_t)len);
+}
+
+void blog_benchmark(int iterations) {
+  if (iterations <= 0) {
+    iterations = 32;
+  }
+  // Measure the record path even if BLOGI is filtered out right now
+  esp_log_level_t level = blog_level;
+  bool echo = uart_echo;
+  blog_level = ESP_LOG_INFO;
+  uart_echo = false;
+
+  uint32_t start = esp_cpu_get_cycle_count();
+  for (int i = 0; i < iterations; i++) {
+    text_to_ring("bench frame=%d samples=%u prob=%.2f\n", i,
+                 (unsigned)(i * 512), 0.5f);
+  }
+  uint32_t text_cycles = esp_cpu_get_cycle_count() - start;
+
+  start = esp_cpu_get_cycle_count();
+  for (int i = 0; i < iterations; i++) {
+    BLOGI("blog_bench", "bench frame=%d samples=%u prob=%.2f", i,
+          (unsigned)(i * 512), 0.5f);
+  }
+  uint32_t binary_cycles = esp_cpu_get_cycle_count() - start;
+
+  start = esp_cpu_get_cycle_count();
+  for (int i = 0; i < iterations; i++) {
+    ESP_LOGI("blog_bench", "bench frame=%d samples=%u prob=%.2f", i,
+             (unsigned)(i * 512), 0.5f);
+  }
+  uint32_t uart_cycles = esp_cpu_get_cycle_count() - start;
+
+  blog_level = level;
+  uart_echo = echo;
+  ESP_LOGI(TAG, "Log cost over %d calls into the ring: text %lu cycles/call, "
+                "binary %lu cycles/call (ESP_LOGI incl. UART: %lu)",
+           iterations, (unsigned long)(text_cycles / iterations),
+           (unsigned long)(binary_cycles / iterations),
+           (unsigned long)(uart_cycles / iterations));
+}
@@ -0,0 +1,125 @@
+/**
+ * @file blog.h
+ * @brief Binary structured logging for hot paths
+ *
+ * BLOGI/BLOGD store a pointer to the format string plus the raw arguments in
+ * the log ring instead of formatting on the device. WebSerial renders these
+ * records lazily when a viewer actually reads them, and the host tool
+ * help_scripts/blog_decode.py decodes the raw stream from /webserial/blog
+ * using the format table in the firmware ELF.
+ *
+ * Meant for per-frame and per-chunk logs. Event-level logs, warnings and
+ * errors keep going through ESP_LOG so they show up on the UART.
+ *
+ * BLOG calls up to BLOG_MAX_LEVEL are compiled in whatever the ESP_LOG
+ * maximum level, and filtered at run time by blog_set_level() (INFO by
+ * default, so BLOGD sites cost one compare until debug is switched on).
+ * blog_set_uart() also prints the records on the UART, formatted there.
+ * Build with -DBLOG_ENABLE=0 to turn every BLOG call back into plain
+ * ESP_LOG text.
+ */
+
+#pragma once
+
+#include "esp_log.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef BLOG_ENABLE
+#define BLOG_ENABLE 1
+#endif
+
+#ifndef BLOG_MAX_LEVEL
+#define BLOG_MAX_LEVEL ESP_LOG_DEBUG
+#endif
+
+#define BLOG_MAX_ARGS 8
+#define BLOG_MAX_STR 32    ///< %s arguments are copied inline, truncated
+#define BLOG_MARKER 0x00   ///< First byte of a binary record (never text)
+#define BLOG_RECORD_HDR 12 ///< marker, level, nargs, tag_len, fmt, ts
+
+/**
+ * @brief Per call-site descriptor (one static instance per BLOG call)
+ *
+ * The argument layout is derived from the format string on first use and
+ * cached here, so later calls only copy raw words.
+ */
+typedef struct {
+  const char *fmt;
+  volatile uint8_t ready; ///< kinds/nargs valid
+  uint8_t nargs;
+  uint16_t kinds; ///< 2 bits per argument, see blog.c
+} blog_site_t;
+
+/** Run-time level, read by the BLOG* macros; set with blog_set_level() */
+extern esp_log_level_t blog_level;
+
+/**
+ * @brief Append one binary record (use the BLOG* macros instead)
+ */
+void blog_write(blog_site_t *site, esp_log_level_t level, const char *tag,
+                ...);
+
+/**
+ * @brief Record BLOG calls up to @p level (ESP_LOG_NONE records none)
+ */
+void blog_set_level(esp_log_level_t level);
+
+/**
+ * @brief Also print each record on the UART (off by default)
+ *
+ * Formats on the device again, so it costs what ESP_LOG costs; meant for a
+ * serial console session, not for normal operation.
+ */
+void blog_set_uart(bool on);
+
+/**
+ * @brief Check whether a log ring record is a binary record
+ */
+static inline bool blog_is_record(const void *rec, size_t len) {
+  return len >= BLOG_RECORD_HDR && ((const uint8_t *)rec)[0] == BLOG_MARKER;
+}
+
+/**
+ * @brief Render a binary record as an ESP_LOG style text line
+ *
+ * @return Number of characters written (always NUL-terminated)
+ */
+size_t blog_render(const void *rec, size_t len, char *out, size_t out_len);
+
+/**
+ * @brief Measure cycles per log call and log the result
+ *
+ * Text and binary both end as one log ring record, so the two figures
+ * compare formatting against copying raw arguments. A third figure is a
+ * plain ESP_LOGI, which also waits for the UART.
+ *
+ * @param iterations Calls per variant
+ */
+void blog_benchmark(int iterations);
+
+#if BLOG_ENABLE
+#define BLOG_AT(level, tag, format, ...)                                       \
+  do {                                                                         \
+    if (BLOG_MAX_LEVEL >= (level) && blog_level >= (level)) {                  \
+      static const char blog_fmt_[] = format;                                  \
+      static blog_site_t blog_site_ = {.fmt = blog_fmt_};                      \
+      blog_write(&blog_site_, (level), (tag), ##__VA_ARGS__);                  \
+    }                                                                          \
+  } while (0)
+
+#define BLOGI(tag, format, ...) BLOG_AT(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define BLOGD(tag, format, ...) BLOG_AT(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#else
+#define BLOGI(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#define BLOGD(tag, format, ...) ESP_LOGD(tag, format, ##__VA_ARGS__)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
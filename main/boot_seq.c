@@ -0,0 +1,190 @@
+/**
+ * @file boot_seq.c
+ * @brief Boot orchestrator: init steps with dependencies, run concurrently
+ */
+
+#include "boot_seq.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "sys_diag.h"
+
+static const char *TAG = "boot_seq";
+
+// The caller (app_main) is on the TWDT: wait in slices and feed it
+#define WAIT_SLICE_MS 1000
+
+typedef struct {
+  esp_err_t err;     ///< ESP_ERR_INVALID_STATE if a dependency failed
+  bool ran;
+  uint32_t start_ms; ///< Since boot
+  uint32_t duration_ms;
+} boot_step_timing_t;
+
+static const boot_step_t *run_steps = NULL;
+static size_t run_count = 0;
+static void *run_ctx = NULL;
+static EventGroupHandle_t done_group = NULL;
+static uint32_t failed_mask = 0;
+static portMUX_TYPE failed_mux = portMUX_INITIALIZER_UNLOCKED;
+static boot_step_timing_t timings[BOOT_SEQ_MAX_STEPS];
+
+static uint32_t now_ms(void) {
+  return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/**
+ * Every dependency names an existing step and resolving them terminates
+ */
+static bool table_valid(const boot_step_t *steps, size_t count) {
+  uint32_t all = BOOT_STEP(count) - 1;
+  uint32_t resolved = 0;
+  bool progress = true;
+
+  for (size_t i = 0; i < count; i++) {
+    if (steps[i].fn == NULL || (steps[i].deps & ~all) != 0) {
+      ESP_LOGE(TAG, "Step %u (%s) has no function or an unknown dependency",
+               (unsigned)i, steps[i].name ? steps[i].name : "?");
+      return false;
+    }
+  }
+  while (resolved != all && progress) {
+    progress = false;
+    for (size_t i = 0; i < count; i++) {
+      if (!(resolved & BOOT_STEP(i)) && (steps[i].deps & ~resolved) == 0) {
+        resolved |= BOOT_STEP(i);
+        progress = true;
+      }
+    }
+  }
+  if (resolved != all) {
+    ESP_LOGE(TAG, "Dependency cycle among steps 0x%04lx",
+             (unsigned long)(all & ~resolved));
+    return false;
+  }
+  return true;
+}
+
+static void step_task(void *arg) {
+  size_t i = (size_t)(uintptr_t)arg;
+  const boot_step_t *s = &run_steps[i];
+  boot_step_timing_t *t = &timings[i];
+
+  if (s->deps) {
+    xEventGroupWaitBits(done_group, s->deps, pdFALSE, pdTRUE, portMAX_DELAY);
+  }
+
+  portENTER_CRITICAL(&failed_mux);
+  uint32_t failed_deps = s->deps & failed_mask;
+  portEXIT_CRITICAL(&failed_mux);
+
+  t->start_ms = now_ms();
+  if (failed_deps) {
+    ESP_LOGW(TAG, "%s: not started, dependency failed", s->name);
+    t->err = ESP_ERR_INVALID_STATE;
+  } else if (!s->skip) {
+    t->ran = true;
+    t->err = s->fn(run_ctx);
+    t->duration_ms = now_ms() - t->start_ms;
+    if (t->err != ESP_OK) {
+      ESP_LOGW(TAG, "%s: %s after %lu ms", s->name, esp_err_to_name(t->err),
+               (unsigned long)t->duration_ms);
+    }
+  }
+
+  if (t->err != ESP_OK) {
+    portENTER_CRITICAL(&failed_mux);
+    failed_mask |= BOOT_STEP(i);
+    portEXIT_CRITICAL(&failed_mux);
+  }
+  xEventGroupSetBits(done_group, BOOT_STEP(i));
+  vTaskDelete(NULL);
+}
+
+static void log_timings(uint32_t started_ms) {
+  ESP_LOGI(TAG, "%-12s %8s %8s  %s", "step", "start", "took", "result");
+  for (size_t i = 0; i < run_count; i++) {
+    const boot_step_timing_t *t = &timings[i];
+    if (!t->ran && t->err == ESP_OK) {
+      ESP_LOGI(TAG, "%-12s %8s %8s  skipped", run_steps[i].name, "-", "-");
+      continue;
+    }
+    ESP_LOGI(TAG, "%-12s %5lu ms %5lu ms  %s", run_steps[i].name,
+             (unsigned long)(t->start_ms - started_ms),
+             (unsigned long)t->duration_ms, esp_err_to_name(t->err));
+  }
+}
+
+esp_err_t boot_seq_run(const boot_step_t *steps, size_t count, void *ctx,
+                       uint32_t timeout_ms) {
+  if (steps == NULL || count == 0 || count > BOOT_SEQ_MAX_STEPS ||
+      done_group != NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!table_valid(steps, count)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  done_group = xEventGroupCreate();
+  if (done_group == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  run_steps = steps;
+  run_count = count;
+  run_ctx = ctx;
+  uint32_t started_ms = now_ms();
+  uint32_t all = BOOT_STEP(count) - 1;
+
+  for (size_t i = 0; i < count; i++) {
+    timings[i] = (boot_step_timing_t){.err = ESP_OK};
+    uint32_t stack = steps[i].stack_size ? steps[i].stack_size
+                                         : BOOT_SEQ_DEFAULT_STACK;
+    if (xTaskCreate(step_task, steps[i].name, stack, (void *)(uintptr_t)i,
+                    BOOT_SEQ_TASK_PRIORITY, NULL) != pdPASS) {
+      ESP_LOGE(TAG, "%s: no memory for its task", steps[i].name);
+      timings[i].err = ESP_ERR_NO_MEM;
+      portENTER_CRITICAL(&failed_mux);
+      failed_mask |= BOOT_STEP(i);
+      portEXIT_CRITICAL(&failed_mux);
+      xEventGroupSetBits(done_group, BOOT_STEP(i));
+    }
+  }
+
+  EventBits_t done = 0;
+  for (uint32_t waited = 0; (done & all) != all && waited < timeout_ms;) {
+    uint32_t slice = timeout_ms - waited < WAIT_SLICE_MS ? timeout_ms - waited
+                                                         : WAIT_SLICE_MS;
+    sys_diag_wdt_feed();
+    done = xEventGroupWaitBits(done_group, all, pdFALSE, pdTRUE,
+                               pdMS_TO_TICKS(slice));
+    waited += slice;
+  }
+  sys_diag_wdt_feed();
+  if ((done & all) != all) {
+    for (size_t i = 0; i < count; i++) {
+      if (!(done & BOOT_STEP(i))) {
+        ESP_LOGE(TAG, "%s still running after %lu ms", steps[i].name,
+                 (unsigned long)timeout_ms);
+      }
+    }
+    return ESP_ERR_TIMEOUT;
+  }
+
+  uint32_t total_ms = now_ms() - started_ms;
+  log_timings(started_ms);
+  ESP_LOGI(TAG, "%u boot steps done in %lu ms (%lu ms since boot)",
+           (unsigned)count, (unsigned long)total_ms,
+           (unsigned long)now_ms());
+  metrics_gauge_set(METRIC_GAUGE_BOOT_STEPS_MS, (int32_t)total_ms);
+  return failed_mask ? ESP_FAIL : ESP_OK;
+}
+
+void boot_seq_mark_wake_ready(void) {
+  uint32_t ms = now_ms();
+  ESP_LOGI(TAG, "Wake word detection ready %lu ms after boot",
+           (unsigned long)ms);
+  metrics_gauge_set(METRIC_GAUGE_BOOT_WAKE_READY_MS, (int32_t)ms);
+}
@@ -0,0 +1,69 @@
+/**
+ * @file boot_seq.h
+ * @brief Boot orchestrator: init steps with dependencies, run concurrently
+ *
+ * app_main declares its subsystems as a table of steps. Each step waits
+ * only for the steps named in its dependency mask, so independent work
+ * (AFE model load, network bring-up, the HA handshake) overlaps instead of
+ * queueing behind the slowest one. Every step runs on its own short-lived
+ * task; start offset and duration are logged once all have finished.
+ *
+ * A step that fails (or is never reached because one of its dependencies
+ * failed) does not stop unrelated steps.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOOT_SEQ_MAX_STEPS 16
+#define BOOT_SEQ_DEFAULT_STACK 4096
+#define BOOT_SEQ_TASK_PRIORITY 5
+
+/** Dependency mask entry for the step at index @p i of the table */
+#define BOOT_STEP(i) (1u << (i))
+
+typedef esp_err_t (*boot_step_fn_t)(void *ctx);
+
+typedef struct {
+  const char *name;    ///< Also the worker task name
+  boot_step_fn_t fn;
+  uint32_t deps;       ///< BOOT_STEP() bits of steps that must finish first
+  bool skip;           ///< Complete at once without running (e.g. safe mode)
+  uint32_t stack_size; ///< 0 = BOOT_SEQ_DEFAULT_STACK
+} boot_step_t;
+
+/**
+ * @brief Run all steps and wait for them
+ *
+ * @param steps Table; it and @p ctx must outlive the steps, which keep
+ *              running after a timeout
+ * @param count At most BOOT_SEQ_MAX_STEPS
+ * @param ctx Passed to every step
+ * @param timeout_ms Give up waiting after this long (steps keep running).
+ *                   The calling task's watchdog is fed while it waits.
+ * @return ESP_OK if every step succeeded or was skipped, ESP_FAIL if one
+ *         failed, ESP_ERR_TIMEOUT, or ESP_ERR_INVALID_ARG for a bad table
+ *         (unknown dependency or a cycle)
+ */
+esp_err_t boot_seq_run(const boot_step_t *steps, size_t count, void *ctx,
+                       uint32_t timeout_ms);
+
+/**
+ * @brief Record that wake word detection is listening
+ *
+ * Called once by the step that starts the voice pipeline; publishes the time
+ * since boot as va_boot_milliseconds{phase="wake_ready"}.
+ */
+void boot_seq_mark_wake_ready(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,289 @@
+/**
+ * @file dns_cache.c
+ * @brief Host name cache shared by the HA WebSocket, TTS, OTA and MQTT
+ */
+
+#include "dns_cache.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "lwip/inet.h"
+#include "lwip/netdb.h"
+#include "metrics.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "dns_cache";
+
+#define REFRESH_QUEUE_LEN 4
+#define REFRESH_TASK_STACK 4096
+#define REFRESH_TASK_PRIORITY 3
+
+typedef struct {
+  char host[DNS_CACHE_HOST_LEN];
+  char ip[DNS_CACHE_IP_LEN];
+  int64_t resolved_us; ///< 0 = free slot
+  int64_t used_us;     ///< For eviction
+  bool refreshing;     ///< Queued for the refresh task
+} dns_entry_t;
+
+typedef struct {
+  char host[DNS_CACHE_HOST_LEN];
+} refresh_req_t;
+
+static dns_entry_t entries[DNS_CACHE_MAX_ENTRIES];
+static SemaphoreHandle_t lock = NULL;
+static QueueHandle_t refresh_queue = NULL;
+
+static bool is_literal(const char *host) {
+  struct in_addr addr;
+  return inet_aton(host, &addr) != 0;
+}
+
+/** Blocking lookup through lwIP (which also asks mDNS for .local names) */
+static esp_err_t resolve_now(const char *host, char *ip, size_t ip_len) {
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+  struct addrinfo *res = NULL;
+  int64_t start = esp_timer_get_time();
+
+  int rc = getaddrinfo(host, NULL, &hints, &res);
+  metrics_observe(METRIC_HIST_DNS_RESOLVE,
+                  (uint32_t)(esp_timer_get_time() - start));
+  if (rc != 0 || res == NULL) {
+    metrics_inc(METRIC_DNS_FAILURES);
+    ESP_LOGW(TAG, "Could not resolve %s (%d)", host, rc);
+    return ESP_ERR_NOT_FOUND;
+  }
+  const struct sockaddr_in *sin = (const struct sockaddr_in *)res->ai_addr;
+  inet_ntoa_r(sin->sin_addr, ip, ip_len);
+  freeaddrinfo(res);
+  ESP_LOGI(TAG, "%s is %s (%lld ms)", host, ip,
+           (esp_timer_get_time() - start) / 1000);
+  return ESP_OK;
+}
+
+// Callers hold the lock
+static dns_entry_t *find(const char *host) {
+  for (int i = 0; i < DNS_CACHE_MAX_ENTRIES; i++) {
+    if (entries[i].resolved_us != 0 && strcmp(entries[i].host, host) == 0) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+static void store(const char *host, const char *ip) {
+  int64_t now = esp_timer_get_time();
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  dns_entry_t *e = find(host);
+  if (e == NULL) {
+    e = &entries[0];
+    for (int i = 0; i < DNS_CACHE_MAX_ENTRIES; i++) {
+      if (entries[i].resolved_us == 0) {
+        e = &entries[i];
+        break;
+      }
+      if (entries[i].used_us < e->used_us) {
+        e = &entries[i];
+      }
+    }
+    strlcpy(e->host, host, sizeof(e->host));
+    e->used_us = now;
+  }
+  strlcpy(e->ip, ip, sizeof(e->ip));
+  e->resolved_us = now;
+  e->refreshing = false;
+  xSemaphoreGive(lock);
+}
+
+static void clear_refreshing(const char *host) {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  dns_entry_t *e = find(host);
+  if (e != NULL) {
+    e->refreshing = false;
+  }
+  xSemaphoreGive(lock);
+}
+
+static void queue_refresh(const char *host) {
+  refresh_req_t req;
+  strlcpy(req.host, host, sizeof(req.host));
+  if (xQueueSend(refresh_queue, &req, 0) != pdTRUE) {
+    clear_refreshing(host); // Retried by the next lookup
+  }
+}
+
+static void refresh_task(void *arg) {
+  (void)arg;
+  refresh_req_t req;
+  char ip[DNS_CACHE_IP_LEN];
+
+  for (;;) {
+    if (xQueueReceive(refresh_queue, &req, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    if (resolve_now(req.host, ip, sizeof(ip)) == ESP_OK) {
+      store(req.host, ip);
+    } else {
+      // Keep serving the old address; the connection attempt will tell
+      clear_refreshing(req.host);
+    }
+  }
+}
+
+esp_err_t dns_cache_init(void) {
+  if (lock != NULL) {
+    return ESP_OK;
+  }
+  lock = xSemaphoreCreateMutex();
+  refresh_queue = xQueueCreate(REFRESH_QUEUE_LEN, sizeof(refresh_req_t));
+  if (lock == NULL || refresh_queue == NULL ||
+      xTaskCreate(refresh_task, "dns_refresh", REFRESH_TASK_STACK, NULL,
+                  REFRESH_TASK_PRIORITY, NULL) != pdPASS) {
+    ESP_LOGE(TAG, "Init failed, resolving without cache");
+    if (lock != NULL) {
+      vSemaphoreDelete(lock);
+      lock = NULL;
+    }
+    if (refresh_queue != NULL) {
+      vQueueDelete(refresh_queue);
+      refresh_queue = NULL;
+    }
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+esp_err_t dns_cache_resolve(const char *host, char *ip, size_t ip_len) {
+  if (host == NULL || host[0] == '\0' || ip == NULL || ip_len == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (is_literal(host)) {
+    strlcpy(ip, host, ip_len);
+    return ESP_OK;
+  }
+  if (lock == NULL || strlen(host) >= DNS_CACHE_HOST_LEN) {
+    return resolve_now(host, ip, ip_len);
+  }
+
+  int64_t now = esp_timer_get_time();
+  bool refresh = false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  dns_entry_t *e = find(host);
+  int64_t age_ms = e ? (now - e->resolved_us) / 1000 : INT64_MAX;
+  if (e != NULL && age_ms < DNS_CACHE_MAX_STALE_MS) {
+    strlcpy(ip, e->ip, ip_len);
+    e->used_us = now;
+    if (age_ms < DNS_CACHE_TTL_MS) {
+      metrics_inc(METRIC_DNS_HITS);
+    } else {
+      metrics_inc(METRIC_DNS_STALE);
+      refresh = !e->refreshing;
+      e->refreshing = true;
+    }
+    xSemaphoreGive(lock);
+    if (refresh) {
+      queue_refresh(host);
+    }
+    return ESP_OK;
+  }
+  xSemaphoreGive(lock);
+
+  metrics_inc(METRIC_DNS_MISSES);
+  esp_err_t err = resolve_now(host, ip, ip_len);
+  if (err == ESP_OK) {
+    store(host, ip);
+  }
+  return err;
+}
+
+void dns_cache_prefetch(const char *host) {
+  if (lock == NULL || host == NULL || host[0] == '\0' || is_literal(host) ||
+      strlen(host) >= DNS_CACHE_HOST_LEN) {
+    return;
+  }
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  dns_entry_t *e = find(host);
+  bool queued = e != NULL && e->refreshing;
+  if (e != NULL) {
+    e->refreshing = true;
+  }
+  xSemaphoreGive(lock);
+
+  if (!queued) {
+    queue_refresh(host);
+  }
+}
+
+void dns_cache_invalidate(const char *host) {
+  if (lock == NULL || host == NULL) {
+    return;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  dns_entry_t *e = find(host);
+  if (e != NULL) {
+    memset(e, 0, sizeof(*e));
+  }
+  xSemaphoreGive(lock);
+}
+
+esp_err_t dns_cache_rewrite_url(const char *url, char *out, size_t out_len) {
+  static const char *const plain[] = {"http://", "ws://", "mqtt://"};
+  const char *host = NULL;
+
+  if (url == NULL || out == NULL || out_len == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (strlcpy(out, url, out_len) >= out_len) {
+    out[0] = '\0';
+    return ESP_ERR_INVALID_SIZE;
+  }
+  for (size_t i = 0; i < sizeof(plain) / sizeof(plain[0]); i++) {
+    if (strncmp(url, plain[i], strlen(plain[i])) == 0) {
+      host = url + strlen(plain[i]);
+      break;
+    }
+  }
+  if (host == NULL) {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+
+  // [user[:pass]@]host[:port][/path]
+  const char *end = host + strcspn(host, "/?#");
+  const char *at = memchr(host, '@', end - host);
+  if (at != NULL) {
+    host = at + 1;
+  }
+  size_t host_len = strcspn(host, ":/?#");
+  if (host_len == 0 || host_len >= DNS_CACHE_HOST_LEN || host[0] == '[') {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+
+  char name[DNS_CACHE_HOST_LEN];
+  char ip[DNS_CACHE_IP_LEN];
+  memcpy(name, host, host_len);
+  name[host_len] = '\0';
+  if (is_literal(name)) {
+    return ESP_OK;
+  }
+  esp_err_t err = dns_cache_resolve(name, ip, sizeof(ip));
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  int n = snprintf(out, out_len, "%.*s%s%s", (int)(host - url), url, ip,
+                   host + host_len);
+  if (n < 0 || (size_t)n >= out_len) {
+    strlcpy(out, url, out_len);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return ESP_OK;
+}
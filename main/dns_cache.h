@@ -0,0 +1,74 @@
+/**
+ * @file dns_cache.h
+ * @brief Host name cache shared by the HA WebSocket, TTS, OTA and MQTT
+ *
+ * Resolving the HA host (usually a .local name answered over mDNS) can take
+ * hundreds of milliseconds, and it used to happen on every connect and
+ * every TTS download. Entries are kept for DNS_CACHE_TTL_MS; after that a
+ * lookup still returns the old address at once and a background task
+ * refreshes it. Only a miss (or an entry stale for longer than
+ * DNS_CACHE_MAX_STALE_MS) blocks the caller on the resolver.
+ *
+ * IPv4 only, like the rest of the firmware. Literal addresses pass through
+ * without touching the cache.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DNS_CACHE_MAX_ENTRIES 4
+#define DNS_CACHE_HOST_LEN 64
+#define DNS_CACHE_IP_LEN 16
+#define DNS_CACHE_TTL_MS (120 * 1000)            // mDNS default A record TTL
+#define DNS_CACHE_MAX_STALE_MS (30 * 60 * 1000)
+
+/**
+ * @brief Create the cache and its refresh task
+ *
+ * Until this is called every lookup goes straight to the resolver.
+ */
+esp_err_t dns_cache_init(void);
+
+/**
+ * @brief Address of @p host as a dotted IPv4 string
+ *
+ * @param ip Receives the address, at least DNS_CACHE_IP_LEN bytes
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if a blocking lookup failed
+ */
+esp_err_t dns_cache_resolve(const char *host, char *ip, size_t ip_len);
+
+/**
+ * @brief Resolve @p host in the background (e.g. when a network comes up)
+ *
+ * Replaces the cached address when the lookup succeeds; never blocks.
+ */
+void dns_cache_prefetch(const char *host);
+
+/**
+ * @brief Forget @p host, e.g. after connecting to its address failed
+ */
+void dns_cache_invalidate(const char *host);
+
+/**
+ * @brief Copy @p url with its host replaced by the cached address
+ *
+ * Only plain schemes (http, ws, mqtt) are rewritten. TLS URLs keep the
+ * name for SNI and certificate checks. @p out always receives a usable
+ * URL: the original one if nothing was rewritten.
+ *
+ * @return ESP_OK if @p out names the host by address (replaced, or a
+ *         literal already), ESP_ERR_NOT_SUPPORTED for TLS
+ *         or unparsable URLs, ESP_ERR_INVALID_SIZE if @p out is too small,
+ *         or the dns_cache_resolve() error
+ */
+esp_err_t dns_cache_rewrite_url(const char *url, char *out, size_t out_len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,295 @@
+/**
+ * @file flight_recorder.c
+ * @brief Crash-persistent flight recorder
+ *
+ * The store is never zeroed by the C runtime; a magic word tells a
+ * surviving store from power-on garbage. Records carry their global
+ * sequence number, written after the payload, so a slot is only trusted
+ * when its sequence matches the position the head says it should hold.
+ *
+ * Writers on either core claim a slot by swapping its sequence for
+ * FR_SEQ_BUSY, so a writer the ring lapped while it was preempted can
+ * neither interleave with the slot's newer owner nor publish over it.
+ * Readers check the sequence before and after copying a record, with
+ * acquire ordering, and drop it if a writer claimed the slot meanwhile.
+ */
+
+#include "flight_recorder.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "sys_diag.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "flight_rec";
+
+#define FR_MAGIC 0x46524543u // "FREC"
+#define FR_MASK (FLIGHT_RECORDER_ENTRIES - 1)
+#define FR_SEQ_NONE 0xFFFFFFFFu ///< Slot never written this boot
+#define FR_SEQ_BUSY 0xFFFFFFFEu ///< A writer owns the slot
+
+_Static_assert((FLIGHT_RECORDER_ENTRIES & FR_MASK) == 0,
+               "FLIGHT_RECORDER_ENTRIES must be a power of two");
+_Static_assert(sizeof(fr_record_t) == 16, "fr_record_t layout changed");
+
+typedef struct {
+  uint32_t magic;
+  uint32_t boot_id;
+  _Atomic uint32_t head; ///< Next sequence number
+  uint32_t tasks_ms;
+  uint32_t task_count;
+  fr_record_t ring[FLIGHT_RECORDER_ENTRIES];
+  fr_task_t tasks[FLIGHT_RECORDER_TASKS];
+} fr_store_t;
+
+typedef struct {
+  fr_boot_info_t info;
+  fr_record_t records[FLIGHT_RECORDER_ENTRIES];
+  fr_task_t tasks[FLIGHT_RECORDER_TASKS];
+} fr_previous_t;
+
+static __NOINIT_ATTR fr_store_t store;
+static fr_previous_t *previous = NULL;
+static esp_timer_handle_t heap_timer = NULL;
+
+static const char *const event_names[FR_EV_COUNT] = {
+    [FR_EV_BOOT] = "boot",
+    [FR_EV_HEAP] = "heap",
+    [FR_EV_PIPE_CMD] = "pipe_cmd",
+    [FR_EV_PIPE_STREAM] = "pipe_stream",
+    [FR_EV_PIPE_SPEECH_END] = "pipe_speech_end",
+    [FR_EV_PIPE_STT] = "pipe_stt",
+    [FR_EV_PIPE_INTENT] = "pipe_intent",
+    [FR_EV_PIPE_TTS_START] = "pipe_tts_start",
+    [FR_EV_PIPE_TTS_DONE] = "pipe_tts_done",
+    [FR_EV_PIPE_ERROR] = "pipe_error",
+    [FR_EV_PIPE_TIMEOUT] = "pipe_timeout",
+    [FR_EV_HA_WS_UP] = "ha_ws_up",
+    [FR_EV_HA_WS_DOWN] = "ha_ws_down",
+    [FR_EV_HA_AUTH_OK] = "ha_auth_ok",
+    [FR_EV_HA_AUTH_BAD] = "ha_auth_bad",
+    [FR_EV_HA_RUN_START] = "ha_run_start",
+    [FR_EV_HA_STT_END] = "ha_stt_end",
+    [FR_EV_HA_INTENT_END] = "ha_intent_end",
+    [FR_EV_HA_TTS_END] = "ha_tts_end",
+    [FR_EV_HA_RUN_END] = "ha_run_end",
+    [FR_EV_HA_ERROR] = "ha_error",
+    [FR_EV_HA_RECONNECT] = "ha_reconnect",
+    [FR_EV_STALL] = "stall",
+    [FR_EV_SOFT_REBOOT] = "soft_reboot",
+};
+
+/**
+ * Copy the valid records of @p s, oldest first
+ */
+static size_t copy_records(const fr_store_t *s, uint32_t head,
+                           fr_record_t *out, size_t max) {
+  uint32_t count =
+      head < FLIGHT_RECORDER_ENTRIES ? head : FLIGHT_RECORDER_ENTRIES;
+  size_t n = 0;
+  for (uint32_t seq = head - count; seq != head && n < max; seq++) {
+    const fr_record_t *r = &s->ring[seq & FR_MASK];
+    if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != seq) {
+      continue; // Being written, or not written yet
+    }
+    out[n].ts_ms = r->ts_ms;
+    out[n].event = r->event;
+    out[n].b = r->b;
+    out[n].a = r->a;
+    // Drop the copy if a writer claimed the slot while we read it
+    atomic_thread_fence(memory_order_acquire);
+    if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) == seq &&
+        out[n].event < FR_EV_COUNT) {
+      out[n++].seq = seq;
+    }
+  }
+  return n;
+}
+
+static void heap_timer_cb(void *arg) {
+  (void)arg;
+  size_t psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 1024;
+  flight_recorder_log(FR_EV_HEAP,
+                      (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                      (uint16_t)(psram > UINT16_MAX ? UINT16_MAX : psram));
+}
+
+esp_err_t flight_recorder_init(void) {
+  if (store.magic == FR_MAGIC && store.task_count <= FLIGHT_RECORDER_TASKS &&
+      previous == NULL) {
+    previous = heap_caps_malloc(sizeof(*previous),
+                                MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (previous == NULL) {
+      previous = malloc(sizeof(*previous));
+    }
+  }
+
+  if (previous != NULL) {
+    fr_boot_info_t *info = &previous->info;
+    uint32_t head = atomic_load(&store.head);
+    info->boot_id = store.boot_id;
+    info->reset_reason = (int)esp_reset_reason();
+    info->records = copy_records(&store, head, previous->records,
+                                 FLIGHT_RECORDER_ENTRIES);
+    info->uptime_ms =
+        info->records ? previous->records[info->records - 1].ts_ms : 0;
+    info->tasks = store.task_count;
+    info->tasks_ms = store.tasks_ms;
+    memcpy(previous->tasks, store.tasks, info->tasks * sizeof(fr_task_t));
+    ESP_LOGI(TAG, "Recovered %u records and %u tasks from boot %lu",
+             (unsigned)info->records, (unsigned)info->tasks,
+             (unsigned long)info->boot_id);
+    store.boot_id++;
+  } else {
+    store.boot_id = 0;
+  }
+
+  // 0xFF sequence numbers never match a live position
+  memset(store.ring, 0xFF, sizeof(store.ring));
+  store.task_count = 0;
+  store.tasks_ms = 0;
+  atomic_store(&store.head, 0);
+  store.magic = FR_MAGIC;
+
+  flight_recorder_log(FR_EV_BOOT, (uint32_t)esp_reset_reason(), 0);
+  return ESP_OK;
+}
+
+esp_err_t flight_recorder_start(uint32_t period_ms) {
+  if (heap_timer != NULL) {
+    return ESP_OK;
+  }
+  const esp_timer_create_args_t args = {
+      .callback = heap_timer_cb,
+      .name = "fr_heap",
+  };
+  esp_err_t err = esp_timer_create(&args, &heap_timer);
+  if (err != ESP_OK) {
+    return err;
+  }
+  heap_timer_cb(NULL);
+  return esp_timer_start_periodic(heap_timer, (uint64_t)period_ms * 1000);
+}
+
+void flight_recorder_log(fr_event_t event, uint32_t a, uint16_t b) {
+  uint32_t seq =
+      atomic_fetch_add_explicit(&store.head, 1, memory_order_relaxed);
+  fr_record_t *r = &store.ring[seq & FR_MASK];
+
+  // Claim the slot. If its owner is still writing, or already holds a newer
+  // record, the ring lapped us: drop this record rather than tear that one.
+  uint32_t prev = __atomic_load_n(&r->seq, __ATOMIC_RELAXED);
+  do {
+    if (prev == FR_SEQ_BUSY ||
+        (prev != FR_SEQ_NONE && (int32_t)(prev - seq) > 0)) {
+      return;
+    }
+  } while (!__atomic_compare_exchange_n(&r->seq, &prev, FR_SEQ_BUSY, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  // Readers that saw the old sequence must see the claim before new payload
+  atomic_thread_fence(memory_order_release);
+
+  r->ts_ms = (uint32_t)(esp_timer_get_time() / 1000);
+  r->event = (uint16_t)event;
+  r->b = b;
+  r->a = a;
+  // Payload before sequence: a record cut short by a reset stays invalid
+  __atomic_store_n(&r->seq, seq, __ATOMIC_RELEASE);
+}
+
+void flight_recorder_set_tasks(const fr_task_t *tasks, size_t count) {
+  if (count > FLIGHT_RECORDER_TASKS) {
+    count = FLIGHT_RECORDER_TASKS;
+  }
+  memcpy(store.tasks, tasks, count * sizeof(fr_task_t));
+  store.task_count = count;
+  store.tasks_ms = (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+bool flight_recorder_previous(fr_boot_info_t *info) {
+  if (previous == NULL) {
+    return false;
+  }
+  if (info) {
+    *info = previous->info;
+  }
+  return true;
+}
+
+size_t flight_recorder_read(bool prev, fr_record_t *out, size_t max) {
+  if (!prev) {
+    return copy_records(&store, atomic_load(&store.head), out, max);
+  }
+  if (previous == NULL) {
+    return 0;
+  }
+  size_t n = previous->info.records < max ? previous->info.records : max;
+  memcpy(out, previous->records, n * sizeof(fr_record_t));
+  return n;
+}
+
+size_t flight_recorder_read_tasks(bool prev, fr_task_t *out, size_t max) {
+  const fr_task_t *src = store.tasks;
+  size_t n = store.task_count;
+  if (prev) {
+    if (previous == NULL) {
+      return 0;
+    }
+    src = previous->tasks;
+    n = previous->info.tasks;
+  }
+  if (n > max) {
+    n = max;
+  }
+  memcpy(out, src, n * sizeof(fr_task_t));
+  return n;
+}
+
+const char *flight_recorder_event_name(uint16_t event) {
+  return event < FR_EV_COUNT ? event_names[event] : "?";
+}
+
+void flight_recorder_summary(char *buf, size_t len) {
+  if (previous == NULL) {
+    snprintf(buf, len, "%s: no flight record", sys_diag_get_reset_reason());
+    return;
+  }
+
+  const fr_boot_info_t *info = &previous->info;
+  int pos = snprintf(buf, len, "%s after %lus:", sys_diag_get_reset_reason(),
+                     (unsigned long)(info->uptime_ms / 1000));
+
+  // Last few transitions, newest last, then the latest heap sample
+  const fr_record_t *heap = NULL;
+  size_t first = info->records;
+  int shown = 0;
+  for (size_t i = info->records; i > 0 && heap == NULL; i--) {
+    if (previous->records[i - 1].event == FR_EV_HEAP) {
+      heap = &previous->records[i - 1];
+    }
+  }
+  while (first > 0 && shown < 4) {
+    if (previous->records[--first].event != FR_EV_HEAP) {
+      shown++;
+    }
+  }
+  for (size_t i = first; i < info->records && pos > 0 && (size_t)pos < len;
+       i++) {
+    const fr_record_t *r = &previous->records[i];
+    if (r->event == FR_EV_PIPE_CMD) {
+      pos += snprintf(buf + pos, len - pos, " pipe_cmd:%u", (unsigned)r->b);
+    } else if (r->event != FR_EV_HEAP) {
+      pos += snprintf(buf + pos, len - pos, " %s",
+                      flight_recorder_event_name(r->event));
+    }
+  }
+  if (heap != NULL && pos > 0 && (size_t)pos < len) {
+    snprintf(buf + pos, len - pos, ", heap %luK/%uK",
+             (unsigned long)(heap->a / 1024), (unsigned)heap->b);
+  }
+}
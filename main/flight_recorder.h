@@ -0,0 +1,141 @@
+/**
+ * @file flight_recorder.h
+ * @brief Crash-persistent flight recorder
+ *
+ * A small ring of fixed-size records (pipeline transitions, HA events, heap
+ * levels) plus the latest task table lives in .noinit RAM, which the
+ * bootloader does not clear on panic, watchdog or software resets. On the
+ * next boot flight_recorder_init() moves the previous boot's contents aside
+ * so they can be read over /api/flight and summarised to MQTT, then starts
+ * a fresh ring.
+ *
+ * flight_recorder_log() is lock-free (one atomic add, one compare-exchange
+ * to claim the slot, five stores) and safe from any task or ISR, so it stays
+ * enabled in production. A record whose write was cut short by the reset is
+ * detected by its sequence number and dropped, as is a record from a writer
+ * the ring lapped while it was preempted.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLIGHT_RECORDER_ENTRIES 128 ///< Power of two
+#define FLIGHT_RECORDER_TASKS 24
+
+// Codes are persisted across a reset: only ever append new events
+
+typedef enum {
+  FR_EV_BOOT,           ///< a = reset reason of this boot
+  FR_EV_HEAP,           ///< a = internal free bytes, b = PSRAM free KiB
+  FR_EV_PIPE_CMD,       ///< a = command data, b = pipeline command
+  FR_EV_PIPE_STREAM,    ///< a = 1 if capture started, b = 1 if HA run sent
+  FR_EV_PIPE_SPEECH_END,
+  FR_EV_PIPE_STT,
+  FR_EV_PIPE_INTENT,
+  FR_EV_PIPE_TTS_START,
+  FR_EV_PIPE_TTS_DONE,
+  FR_EV_PIPE_ERROR,
+  FR_EV_PIPE_TIMEOUT,
+  FR_EV_HA_WS_UP,
+  FR_EV_HA_WS_DOWN,
+  FR_EV_HA_AUTH_OK,
+  FR_EV_HA_AUTH_BAD,
+  FR_EV_HA_RUN_START,
+  FR_EV_HA_STT_END,
+  FR_EV_HA_INTENT_END,
+  FR_EV_HA_TTS_END,
+  FR_EV_HA_RUN_END,
+  FR_EV_HA_ERROR,
+  FR_EV_HA_RECONNECT,
+  FR_EV_STALL,          ///< a = ms since heartbeat, b = soft watchdog slot
+  FR_EV_SOFT_REBOOT,    ///< a = ms since heartbeat
+  FR_EV_COUNT
+} fr_event_t;
+
+typedef struct {
+  uint32_t seq;   ///< Global record number, written last
+  uint32_t ts_ms; ///< Milliseconds since that boot
+  uint16_t event; ///< fr_event_t
+  uint16_t b;
+  uint32_t a;
+} fr_record_t;
+
+typedef struct {
+  char name[16];
+  char state;           ///< R(unning) r(eady) B(locked) S(uspended) D(eleted)
+  int8_t core;          ///< -1 if unpinned
+  uint16_t cpu_permille;
+  uint32_t stack_free;
+} fr_task_t;
+
+typedef struct {
+  uint32_t boot_id;     ///< Boots recorded since the RAM was last lost
+  int reset_reason;     ///< esp_reset_reason_t that ended that boot
+  uint32_t uptime_ms;   ///< Last record time, roughly the boot's uptime
+  uint32_t tasks_ms;    ///< When the task table was taken
+  size_t records;
+  size_t tasks;
+} fr_boot_info_t;
+
+/**
+ * @brief Adopt the previous boot's contents and start a fresh ring
+ *
+ * Call right after sys_diag_init(), before anything logs.
+ */
+esp_err_t flight_recorder_init(void);
+
+/**
+ * @brief Sample heap levels into the ring every @p period_ms
+ */
+esp_err_t flight_recorder_start(uint32_t period_ms);
+
+/**
+ * @brief Append one record (lock-free, ISR safe)
+ */
+void flight_recorder_log(fr_event_t event, uint32_t a, uint16_t b);
+
+/**
+ * @brief Replace the task table (called by the task profiler)
+ */
+void flight_recorder_set_tasks(const fr_task_t *tasks, size_t count);
+
+/**
+ * @brief Info about the previous boot
+ *
+ * @return false if nothing survived the reset (power-on, first boot)
+ */
+bool flight_recorder_previous(fr_boot_info_t *info);
+
+/**
+ * @brief Copy records, oldest first
+ *
+ * @param previous true for the previous boot, false for this one
+ * @return Number of records written to @p out
+ */
+size_t flight_recorder_read(bool previous, fr_record_t *out, size_t max);
+
+/**
+ * @brief Copy the task table
+ */
+size_t flight_recorder_read_tasks(bool previous, fr_task_t *out, size_t max);
+
+const char *flight_recorder_event_name(uint16_t event);
+
+/**
+ * @brief One-line summary of the previous boot for MQTT
+ *
+ * e.g. "Task WDT (Hang) after 812s: ha_run_start, pipe_stream, heap 41K"
+ */
+void flight_recorder_summary(char *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
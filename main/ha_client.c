@@ -5,22 +5,36 @@
 
 #include "cJSON.h"
 #include "esp_event.h"
-#include "esp_http_client.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_tls.h"
 #include "esp_websocket_client.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "mdns.h"
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc_trace.h"
 #include "audio_capture.h"
+#include "blog.h"
 #include "config.h" // For fallback/defaults if needed
+#include "dns_cache.h"
+#include "flight_recorder.h"
 #include "ha_client.h"
+#include "ha_entities.h"
+#include "ha_events.h"
+#include "ha_failover.h"
+#include "ha_rtt.h"
+#include "mem_budget.h"
+#include "metrics.h"
 #include "oled_status.h"
+#include "sys_diag.h"
+#include "tts_fetch.h"
+#include "work_queue.h"
 
 static const char *TAG = "ha_client";
 
@@ -28,7 +42,7 @@ static esp_websocket_client_handle_t ws_client = NULL;
 static bool ws_connected = false;
 static bool ws_authenticated = false;
 static int message_id = 1;
-static TaskHandle_t reconnect_task_handle = NULL;
+static work_handle_t reconnect_item = WORK_HANDLE_NONE;
 
 // Internal Config Storage
 static ha_client_config_t client_config;
@@ -51,6 +65,33 @@ static bool speech_text_sent_this_run = false;
 static uint8_t *audio_frame_buf = NULL;
 static size_t audio_frame_buf_cap = 0;
 
+// STT audio of the current run. If the connection drops before stt-end the
+// reconnect starts a new run and replays it (ha_failover).
+#define HA_REPLAY_READY_WORK_MS 2000 // Plus one RTO for the round trip
+static uint8_t *replay_buf = NULL;
+
+// Text messages are copied off the websocket client task and handled on
+// ha_events, so a slow callback does not hold up pings and further frames.
+// TTS downloads run on the work_queue media lane (tts_fetch).
+#define HA_EVENT_MAX_LEN (32 * 1024) // Larger messages are dropped
+
+static volatile uint32_t ws_session = 0; // Bumped on connect and disconnect
+
+// Liveness pings run on ha_events between messages (ha_rtt); their round
+// trips set the timeouts of ha_client_timeout_ms().
+
+static portMUX_TYPE message_id_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Entity mirror. After auth_ok ha_events subscribes to subscribe_entities;
+// HA answers with every entity, then diffs. Those events are recognised by
+// their prefix and scanned by ha_entities without a cJSON tree. The first
+// one can be far larger than HA_EVENT_MAX_LEN.
+#define HA_ENTITIES_MAX_LEN (512 * 1024)
+
+static bool entities_enabled = false;     // Table allocated
+static volatile int entities_sub_id = -1; // Read on the websocket task
+static bool entities_fresh = false; // Clear before the next event applies
+
 static EventGroupHandle_t ha_event_group;
 #define HA_CONNECTED_BIT BIT0
 #define HA_AUTHENTICATED_BIT BIT1
@@ -60,7 +101,6 @@ static EventGroupHandle_t ha_event_group;
 #define HA_SEND_AUDIO_TIMEOUT_MS 2000
 
 // Forward declarations
-static void download_tts_audio(const char *url);
 static bool ha_find_stt_handler_id(const cJSON *node, int depth, int *out_id);
 static void ha_clear_audio_ready(void);
 static void ha_set_audio_ready(int handler_id, const char *source);
@@ -68,6 +108,62 @@ static const char *ha_extract_intent_json(const cJSON *data_obj);
 static bool ha_intent_name_is_timer(const char *intent_name);
 static const char *ha_extract_stt_text(const cJSON *data_obj);
 
+// Pings come from ha_events, runs from the pipeline task
+static int next_message_id(void) {
+  portENTER_CRITICAL(&message_id_mux);
+  int id = message_id++;
+  portEXIT_CRITICAL(&message_id_mux);
+  return id;
+}
+
+// HA writes these events as {"id":N,"type":"event","event":{...}}
+static const char *entities_event(const char *msg, size_t len) {
+  int id = entities_sub_id;
+  if (id < 0)
+    return NULL;
+  char prefix[48];
+  int n = snprintf(prefix, sizeof(prefix),
+                   "{\"id\":%d,\"type\":\"event\",\"event\":", id);
+  if (len < (size_t)n || memcmp(msg, prefix, n) != 0)
+    return NULL;
+  return msg + n;
+}
+
+// Runs on ha_events after auth_ok
+static void entities_subscribe(void) {
+  if (!entities_enabled)
+    return;
+  char msg[64];
+  int id = next_message_id();
+  snprintf(msg, sizeof(msg), "{\"id\":%d,\"type\":\"subscribe_entities\"}",
+           id);
+  entities_sub_id = id; // Before the send: the answer can beat us back
+  entities_fresh = true;
+  if (esp_websocket_client_send_text(ws_client, msg, strlen(msg),
+                                     pdMS_TO_TICKS(HA_SEND_TEXT_TIMEOUT_MS)) <
+      0) {
+    ESP_LOGW(TAG, "subscribe_entities not sent, no entity mirror");
+    entities_sub_id = -1;
+  }
+}
+
+static void entities_apply(const char *event, size_t len) {
+  if (entities_fresh) {
+    ha_entities_clear();
+    entities_fresh = false;
+  }
+  (void)ha_entities_apply(event, len);
+
+  ha_entities_stats_t stats;
+  ha_entity_t last;
+  ha_entities_get_stats(&stats);
+  bool have = ha_entities_last_changed(&last);
+  oled_status_set_ha_entities(
+      stats.entities, stats.lights_on,
+      have ? (last.name[0] ? last.name : last.entity_id) : NULL,
+      have ? last.state : NULL);
+}
+
 static void trim_ascii_whitespace_inplace(char *s) {
   if (s == NULL)
     return;
@@ -247,6 +343,271 @@ static void ha_set_audio_ready(int handler_id, const char *source) {
   oled_status_set_last_event("stt-bin");
 }
 
+// Runs on ha_events; @p payload is one complete text message
+static void handle_ws_message(const char *payload, size_t len, int64_t rx_us,
+                              uint32_t session) {
+  const char *entities = entities_event(payload, len);
+  if (entities) {
+    entities_apply(entities, len - (entities - payload));
+    return;
+  }
+  if (len > HA_EVENT_MAX_LEN)
+    return; // Entity event of a subscription replaced meanwhile
+
+  cJSON *json = cJSON_ParseWithLength(payload, len);
+  if (!json) {
+    ESP_LOGE(TAG, "Failed to parse JSON");
+    return;
+  }
+
+  cJSON *type = cJSON_GetObjectItem(json, "type");
+  if (!type || !cJSON_IsString(type) || !type->valuestring) {
+    ESP_LOGW(TAG, "JSON missing type or not string");
+    cJSON_Delete(json);
+    return;
+  }
+
+  if (strcmp(type->valuestring, "auth_ok") == 0 && session != ws_session) {
+    ESP_LOGW(TAG, "Ignoring auth_ok of a closed connection");
+  } else if (strcmp(type->valuestring, "auth_ok") == 0) {
+    ESP_LOGI(TAG, "Auth successful");
+    flight_recorder_log(FR_EV_HA_AUTH_OK, 0, 0);
+    ws_authenticated = true;
+    metrics_gauge_set(METRIC_GAUGE_HA_CONNECTED, 1);
+    xEventGroupSetBits(ha_event_group, HA_AUTHENTICATED_BIT);
+    oled_status_set_ha_connected(true);
+    oled_status_set_last_event("auth-ok");
+    int32_t down_ms = ha_failover_outage_end();
+    if (down_ms >= 0) {
+      ESP_LOGI(TAG, "Home Assistant unavailable for %ld ms", (long)down_ms);
+      metrics_gauge_set(METRIC_GAUGE_HA_UNAVAILABLE_MS, down_ms);
+    }
+    entities_subscribe();
+  } else if (type && strcmp(type->valuestring, "auth_invalid") == 0) {
+    ESP_LOGE(TAG, "Auth failed");
+    flight_recorder_log(FR_EV_HA_AUTH_BAD, 0, 0);
+    ws_authenticated = false;
+    oled_status_set_ha_connected(false);
+    oled_status_set_last_event("auth-bad");
+  } else if (type && strcmp(type->valuestring, "event") == 0) {
+    cJSON *event = cJSON_GetObjectItem(json, "event");
+    if (event) {
+      cJSON *evt_type = cJSON_GetObjectItem(event, "type");
+      cJSON *data_obj = cJSON_GetObjectItem(event, "data");
+
+      if (evt_type && evt_type->valuestring) {
+        if (strcmp(evt_type->valuestring, "run-start") == 0) {
+          flight_recorder_log(FR_EV_HA_RUN_START, 0, 0);
+          timer_started_this_conversation = false;
+          speech_text_sent_this_run = false;
+          int hid = -1;
+          if (data_obj && ha_find_stt_handler_id(data_obj, 6, &hid)) {
+            ha_set_audio_ready(hid, "run-start");
+          }
+
+          // Newer HA streams the response: its URL comes before the intent
+          cJSON *tts_out =
+              data_obj ? cJSON_GetObjectItem(data_obj, "tts_output") : NULL;
+          cJSON *stream =
+              tts_out ? cJSON_GetObjectItem(tts_out, "stream_response") : NULL;
+          cJSON *url = tts_out ? cJSON_GetObjectItem(tts_out, "url") : NULL;
+          bool early = cJSON_IsTrue(stream) && cJSON_IsString(url) &&
+                       url->valuestring;
+          tts_fetch_run_start(early ? url->valuestring : NULL);
+        } else if (strcmp(evt_type->valuestring, "intent-end") == 0) {
+          flight_recorder_log(FR_EV_HA_INTENT_END, 0, 0);
+          const cJSON *intent = NULL;
+          const cJSON *intent_output = NULL;
+          const cJSON *intent_name = NULL;
+          const char *intent_data = NULL;
+
+          if (data_obj) {
+            intent =
+                cJSON_GetObjectItemCaseSensitive((cJSON *)data_obj, "intent");
+            if (!intent) {
+              intent_output = cJSON_GetObjectItemCaseSensitive(
+                  (cJSON *)data_obj, "intent_output");
+              if (intent_output) {
+                intent = cJSON_GetObjectItemCaseSensitive(
+                    (cJSON *)intent_output, "intent");
+              }
+            }
+            if (intent) {
+              intent_name =
+                  cJSON_GetObjectItemCaseSensitive((cJSON *)intent, "name");
+            }
+            intent_data = ha_extract_intent_json(data_obj);
+          }
+
+          if (intent_name && cJSON_IsString(intent_name) &&
+              intent_name->valuestring && intent_callback) {
+            if (ha_intent_name_is_timer(intent_name->valuestring)) {
+              timer_started_this_conversation = true;
+              tts_fetch_skip(); // TTS is skipped for timers
+            }
+            intent_callback(intent_name->valuestring, intent_data, NULL);
+          }
+
+          const char *speech =
+              ha_extract_response_speech_plain_speech(data_obj);
+          if (speech && conversation_callback) {
+            conversation_callback(speech, NULL);
+            speech_text_sent_this_run = true;
+          }
+        } else if (strcmp(evt_type->valuestring, "stt-end") == 0) {
+          flight_recorder_log(FR_EV_HA_STT_END, 0, 0);
+          // STT is done - stop accepting audio immediately to prevent
+          // "non-existing handler" errors
+          ha_clear_audio_ready();
+          ha_failover_run_stop();
+          const char *stt_text = ha_extract_stt_text(data_obj);
+          if (stt_text && stt_callback) {
+            stt_callback(stt_text, NULL);
+          }
+        } else if (strcmp(evt_type->valuestring, "tts-end") == 0) {
+          flight_recorder_log(FR_EV_HA_TTS_END, 0, 0);
+          if (timer_started_this_conversation) {
+            ESP_LOGI(TAG, "Skipping TTS (timer started)");
+          } else if (data_obj) {
+            cJSON *tts_out = cJSON_GetObjectItem(data_obj, "tts_output");
+            if (tts_out) {
+              cJSON *text = cJSON_GetObjectItem(tts_out, "text");
+              if (!speech_text_sent_this_run && text && text->valuestring &&
+                  conversation_callback) {
+                conversation_callback(text->valuestring, NULL);
+                // run-end may now arrive before the download finishes; its
+                // "no speech" fallback must not resume wake word mode
+                speech_text_sent_this_run = true;
+              }
+              cJSON *url = cJSON_GetObjectItem(tts_out, "url");
+              if (url && url->valuestring) {
+                if (tts_fetch_tts_end(url->valuestring) != ESP_OK) {
+                  ESP_LOGE(TAG, "TTS download not queued");
+                  if (tts_audio_callback)
+                    tts_audio_callback(NULL, 0);
+                }
+              }
+            }
+          }
+        } else if (strcmp(evt_type->valuestring, "run-end") == 0) {
+          flight_recorder_log(FR_EV_HA_RUN_END, 0, 0);
+          if (timer_started_this_conversation && conversation_callback) {
+            conversation_callback("", NULL);
+          }
+          if (!timer_started_this_conversation &&
+              !speech_text_sent_this_run && conversation_callback) {
+            // Ensure the client can return to idle if HA ends the run without
+            // any speech.
+            conversation_callback("", NULL);
+          }
+          tts_fetch_run_end();
+          ha_clear_audio_ready();
+          ha_failover_run_stop();
+        } else if (strcmp(evt_type->valuestring, "error") == 0) {
+          flight_recorder_log(FR_EV_HA_ERROR, 0, 0);
+          const char *err_code = "error";
+          const char *err_msg = "Pipeline Error";
+
+          if (data_obj) {
+            cJSON *code_item =
+                cJSON_GetObjectItemCaseSensitive((cJSON *)data_obj, "code");
+            cJSON *msg_item = cJSON_GetObjectItemCaseSensitive(
+                (cJSON *)data_obj, "message");
+            if (code_item && cJSON_IsString(code_item) &&
+                code_item->valuestring) {
+              err_code = code_item->valuestring;
+            }
+            if (msg_item && cJSON_IsString(msg_item) &&
+                msg_item->valuestring) {
+              err_msg = msg_item->valuestring;
+            }
+
+            cJSON *err_obj =
+                cJSON_GetObjectItemCaseSensitive((cJSON *)data_obj, "error");
+            if (err_obj && cJSON_IsObject(err_obj)) {
+              cJSON *code2 =
+                  cJSON_GetObjectItemCaseSensitive(err_obj, "code");
+              cJSON *msg2 =
+                  cJSON_GetObjectItemCaseSensitive(err_obj, "message");
+              if (code2 && cJSON_IsString(code2) && code2->valuestring) {
+                err_code = code2->valuestring;
+              }
+              if (msg2 && cJSON_IsString(msg2) && msg2->valuestring) {
+                err_msg = msg2->valuestring;
+              }
+            }
+          }
+
+          ESP_LOGE(TAG, "HA pipeline error: %s: %s", err_code, err_msg);
+          if (error_callback)
+            error_callback(err_code, err_msg);
+          tts_fetch_run_end();
+          audio_capture_stop_wait(500);
+          ha_clear_audio_ready();
+          ha_failover_run_stop();
+        }
+        // ... (Other event types: intent-end, stt-end - simplified for now,
+        // logic remains similar)
+      }
+    }
+  } else if (strcmp(type->valuestring, "pong") == 0) {
+    cJSON *msg_id = cJSON_GetObjectItem(json, "id");
+    if (cJSON_IsNumber(msg_id))
+      ha_rtt_on_pong((int)msg_id->valuedouble, rx_us, session);
+  } else if (type && strcmp(type->valuestring, "result") == 0) {
+    // Result handling (late handler_id)
+    cJSON *msg_id = cJSON_GetObjectItem(json, "id");
+    cJSON *res = cJSON_GetObjectItem(json, "result");
+    if (msg_id && cJSON_IsNumber(msg_id) && res &&
+        (int)msg_id->valuedouble == last_run_message_id &&
+        !ha_client_is_audio_ready()) {
+      int hid = -1;
+      if (ha_find_stt_handler_id(res, 6, &hid))
+        ha_set_audio_ready(hid, "result");
+    }
+    if (msg_id && cJSON_IsNumber(msg_id) &&
+        (int)msg_id->valuedouble == entities_sub_id &&
+        cJSON_IsFalse(cJSON_GetObjectItem(json, "success"))) {
+      ESP_LOGW(TAG, "subscribe_entities refused, no entity mirror");
+      entities_sub_id = -1;
+    }
+  }
+  cJSON_Delete(json);
+}
+
+// On the websocket client task
+static void ws_receive_text(const esp_websocket_event_data_t *data) {
+  size_t limit = data->payload_offset == 0 &&
+                         entities_event(data->data_ptr, data->data_len)
+                     ? HA_ENTITIES_MAX_LEN
+                     : HA_EVENT_MAX_LEN;
+  ha_events_receive(data->data_ptr, data->data_len, data->payload_len,
+                    data->payload_offset, limit, ws_session);
+}
+
+static int ping_send(void) {
+  char ping[48];
+  int id = next_message_id();
+  snprintf(ping, sizeof(ping), "{\"id\":%d,\"type\":\"ping\"}", id);
+  int ret = esp_websocket_client_send_text(
+      ws_client, ping, strlen(ping), pdMS_TO_TICKS(HA_SEND_TEXT_TIMEOUT_MS));
+  return ret < 0 ? -1 : id;
+}
+
+static void ping_reconnect(const char *why) {
+  (void)ha_client_request_reconnect(why);
+}
+
+// Runs on ha_events between messages; returns how long it may block
+static TickType_t ping_poll(void) {
+  bool up = ha_client_is_connected() && ws_client != NULL;
+  return pdMS_TO_TICKS(ha_rtt_poll(ws_session, up)) + 1;
+}
+
+static void ha_event_handle(const ha_event_msg_t *msg) {
+  handle_ws_message(msg->json, msg->len, msg->rx_us, msg->session);
+}
+
 static void websocket_event_handler(void *handler_args, esp_event_base_t base,
                                     int32_t event_id, void *event_data) {
   esp_websocket_event_data_t *data = (esp_websocket_event_data_t *)event_data;
@@ -254,6 +615,8 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base,
   switch (event_id) {
   case WEBSOCKET_EVENT_CONNECTED:
     ESP_LOGI(TAG, "WebSocket connected");
+    flight_recorder_log(FR_EV_HA_WS_UP, 0, 0);
+    ws_session++;
     ws_connected = true;
     xEventGroupSetBits(ha_event_group, HA_CONNECTED_BIT);
     oled_status_set_last_event("ws-up");
@@ -274,14 +637,22 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base,
 
   case WEBSOCKET_EVENT_DISCONNECTED:
     ESP_LOGW(TAG, "WebSocket disconnected");
+    flight_recorder_log(FR_EV_HA_WS_DOWN, 0, 0);
+    ws_session++;
+    ha_events_discard();
     ws_connected = false;
     ws_authenticated = false;
+    metrics_inc(METRIC_HA_WS_DISCONNECTS);
+    metrics_gauge_set(METRIC_GAUGE_HA_CONNECTED, 0);
     ha_clear_audio_ready();
     xEventGroupClearBits(ha_event_group, HA_CONNECTED_BIT |
                                              HA_AUTHENTICATED_BIT |
                                              HA_AUDIO_READY_BIT);
     oled_status_set_ha_connected(false);
     oled_status_set_last_event("ws-down");
+    ha_failover_outage_begin();
+    if (ha_failover_mark_pending())
+      (void)ha_client_request_reconnect("run interrupted");
     break;
 
   case WEBSOCKET_EVENT_DATA:
@@ -290,243 +661,65 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base,
     if (data->data_len <= 0 || !data->data_ptr)
       break;
 
-    // Parse JSON
-    cJSON *json = cJSON_ParseWithLength((char *)data->data_ptr, data->data_len);
-    if (!json) {
-      ESP_LOGE(TAG, "Failed to parse JSON");
-      break;
-    }
-
-    cJSON *type = cJSON_GetObjectItem(json, "type");
-    if (!type || !cJSON_IsString(type) || !type->valuestring) {
-      ESP_LOGW(TAG, "JSON missing type or not string");
-      cJSON_Delete(json);
-      break;
-    }
-
-    if (strcmp(type->valuestring, "auth_ok") == 0) {
-      ESP_LOGI(TAG, "Auth successful");
-      ws_authenticated = true;
-      xEventGroupSetBits(ha_event_group, HA_AUTHENTICATED_BIT);
-      oled_status_set_ha_connected(true);
-      oled_status_set_last_event("auth-ok");
-    } else if (type && strcmp(type->valuestring, "auth_invalid") == 0) {
-      ESP_LOGE(TAG, "Auth failed");
-      ws_authenticated = false;
-      oled_status_set_ha_connected(false);
-      oled_status_set_last_event("auth-bad");
-    } else if (type && strcmp(type->valuestring, "event") == 0) {
-      cJSON *event = cJSON_GetObjectItem(json, "event");
-      if (event) {
-        cJSON *evt_type = cJSON_GetObjectItem(event, "type");
-        cJSON *data_obj = cJSON_GetObjectItem(event, "data");
-
-        if (evt_type && evt_type->valuestring) {
-          if (strcmp(evt_type->valuestring, "run-start") == 0) {
-            timer_started_this_conversation = false;
-            speech_text_sent_this_run = false;
-            int hid = -1;
-            if (data_obj && ha_find_stt_handler_id(data_obj, 6, &hid)) {
-              ha_set_audio_ready(hid, "run-start");
-            }
-          } else if (strcmp(evt_type->valuestring, "intent-end") == 0) {
-            const cJSON *intent = NULL;
-            const cJSON *intent_output = NULL;
-            const cJSON *intent_name = NULL;
-            const char *intent_data = NULL;
-
-            if (data_obj) {
-              intent =
-                  cJSON_GetObjectItemCaseSensitive((cJSON *)data_obj, "intent");
-              if (!intent) {
-                intent_output = cJSON_GetObjectItemCaseSensitive(
-                    (cJSON *)data_obj, "intent_output");
-                if (intent_output) {
-                  intent = cJSON_GetObjectItemCaseSensitive(
-                      (cJSON *)intent_output, "intent");
-                }
-              }
-              if (intent) {
-                intent_name =
-                    cJSON_GetObjectItemCaseSensitive((cJSON *)intent, "name");
-              }
-              intent_data = ha_extract_intent_json(data_obj);
-            }
-
-            if (intent_name && cJSON_IsString(intent_name) &&
-                intent_name->valuestring && intent_callback) {
-              if (ha_intent_name_is_timer(intent_name->valuestring)) {
-                timer_started_this_conversation = true;
-              }
-              intent_callback(intent_name->valuestring, intent_data, NULL);
-            }
-
-            const char *speech =
-                ha_extract_response_speech_plain_speech(data_obj);
-            if (speech && conversation_callback) {
-              conversation_callback(speech, NULL);
-              speech_text_sent_this_run = true;
-            }
-          } else if (strcmp(evt_type->valuestring, "stt-end") == 0) {
-            // STT is done - stop accepting audio immediately to prevent
-            // "non-existing handler" errors
-            ha_clear_audio_ready();
-            const char *stt_text = ha_extract_stt_text(data_obj);
-            if (stt_text && stt_callback) {
-              stt_callback(stt_text, NULL);
-            }
-          } else if (strcmp(evt_type->valuestring, "tts-end") == 0) {
-            if (timer_started_this_conversation) {
-              ESP_LOGI(TAG, "Skipping TTS (timer started)");
-            } else if (data_obj) {
-              cJSON *tts_out = cJSON_GetObjectItem(data_obj, "tts_output");
-              if (tts_out) {
-                cJSON *text = cJSON_GetObjectItem(tts_out, "text");
-                if (!speech_text_sent_this_run && text && text->valuestring &&
-                    conversation_callback) {
-                  conversation_callback(text->valuestring, NULL);
-                }
-                cJSON *url = cJSON_GetObjectItem(tts_out, "url");
-                if (url && url->valuestring) {
-                  download_tts_audio(url->valuestring);
-                }
-              }
-            }
-          } else if (strcmp(evt_type->valuestring, "run-end") == 0) {
-            if (timer_started_this_conversation && conversation_callback) {
-              conversation_callback("", NULL);
-            }
-            if (!timer_started_this_conversation &&
-                !speech_text_sent_this_run && conversation_callback) {
-              // Ensure the client can return to idle if HA ends the run without
-              // any speech.
-              conversation_callback("", NULL);
-            }
-            ha_clear_audio_ready();
-          } else if (strcmp(evt_type->valuestring, "error") == 0) {
-            const char *err_code = "error";
-            const char *err_msg = "Pipeline Error";
-
-            if (data_obj) {
-              cJSON *code_item =
-                  cJSON_GetObjectItemCaseSensitive((cJSON *)data_obj, "code");
-              cJSON *msg_item = cJSON_GetObjectItemCaseSensitive(
-                  (cJSON *)data_obj, "message");
-              if (code_item && cJSON_IsString(code_item) &&
-                  code_item->valuestring) {
-                err_code = code_item->valuestring;
-              }
-              if (msg_item && cJSON_IsString(msg_item) &&
-                  msg_item->valuestring) {
-                err_msg = msg_item->valuestring;
-              }
-
-              cJSON *err_obj =
-                  cJSON_GetObjectItemCaseSensitive((cJSON *)data_obj, "error");
-              if (err_obj && cJSON_IsObject(err_obj)) {
-                cJSON *code2 =
-                    cJSON_GetObjectItemCaseSensitive(err_obj, "code");
-                cJSON *msg2 =
-                    cJSON_GetObjectItemCaseSensitive(err_obj, "message");
-                if (code2 && cJSON_IsString(code2) && code2->valuestring) {
-                  err_code = code2->valuestring;
-                }
-                if (msg2 && cJSON_IsString(msg2) && msg2->valuestring) {
-                  err_msg = msg2->valuestring;
-                }
-              }
-            }
-
-            ESP_LOGE(TAG, "HA pipeline error: %s: %s", err_code, err_msg);
-            if (error_callback)
-              error_callback(err_code, err_msg);
-            audio_capture_stop_wait(500);
-            ha_clear_audio_ready();
-          }
-          // ... (Other event types: intent-end, stt-end - simplified for now,
-          // logic remains similar)
-        }
-      }
-    } else if (type && strcmp(type->valuestring, "result") == 0) {
-      // Result handling (late handler_id)
-      cJSON *msg_id = cJSON_GetObjectItem(json, "id");
-      cJSON *res = cJSON_GetObjectItem(json, "result");
-      if (msg_id && cJSON_IsNumber(msg_id) && res &&
-          (int)msg_id->valuedouble == last_run_message_id &&
-          !ha_client_is_audio_ready()) {
-        int hid = -1;
-        if (ha_find_stt_handler_id(res, 6, &hid))
-          ha_set_audio_ready(hid, "result");
-      }
-    }
-    cJSON_Delete(json);
+    ws_receive_text(data);
     break;
   default:
     break;
   }
 }
 
-static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
-  if (evt->event_id == HTTP_EVENT_ON_DATA && tts_audio_callback &&
-      evt->data_len > 0) {
-    tts_audio_callback((const uint8_t *)evt->data, evt->data_len);
-  }
-  return ESP_OK;
+/**
+ * Host to connect to: the cached address for plain ws/http, the configured
+ * name with TLS, which needs it for SNI and the certificate check (and a
+ * proxy would route on it).
+ */
+static const char *client_host(char *ip, size_t ip_len) {
+  if (!client_config.use_ssl &&
+      dns_cache_resolve(client_config.hostname, ip, ip_len) == ESP_OK)
+    return ip;
+  return client_config.hostname;
 }
 
-static void download_tts_audio(const char *url) {
-  if (!url || !strlen(url))
-    return;
-
-  char full_url[1024];
-  // Construct URL using configured hostname
-  if (client_config.use_ssl) {
-    snprintf(full_url, sizeof(full_url), "https://%s:%d%s",
-             client_config.hostname, client_config.port, url);
-  } else {
-    snprintf(full_url, sizeof(full_url), "http://%s:%d%s",
-             client_config.hostname, client_config.port, url);
-  }
-  ESP_LOGI(TAG, "Downloading TTS: %s", full_url);
-
-  esp_http_client_config_t config = {
-      .url = full_url,
-      .event_handler = http_event_handler,
-      .timeout_ms = 10000,
-  };
-  if (client_config.use_ssl)
-    config.skip_cert_common_name_check = true;
-
-  esp_http_client_handle_t client = esp_http_client_init(&config);
-  if (!client) {
-    if (tts_audio_callback)
-      tts_audio_callback(NULL, 0);
-    return;
-  }
-
-  esp_err_t err = esp_http_client_perform(client);
-  if (err == ESP_OK && esp_http_client_get_status_code(client) == 200) {
-    if (tts_audio_callback)
-      tts_audio_callback(NULL, 0); // End
-  } else {
-    ESP_LOGE(TAG, "TTS download failed: %s", esp_err_to_name(err));
-    if (tts_audio_callback)
-      tts_audio_callback(NULL, 0);
-  }
-  esp_http_client_cleanup(client);
+// On the media worker (tts_fetch)
+static void tts_audio_out(const uint8_t *data, size_t len) {
+  if (tts_audio_callback)
+    tts_audio_callback(data, len);
 }
 
 static esp_err_t init_mdns(void) {
+  static bool mdns_ready = false;
+  if (mdns_ready)
+    return ESP_OK;
   if (mdns_init() != ESP_OK)
     return ESP_FAIL;
   mdns_hostname_set("esp32-p4-voice-assistant");
+  mdns_ready = true;
   return ESP_OK;
 }
 
+static void ws_send_stall_recovery(const char *task, uint32_t stalled_ms) {
+  (void)task;
+  (void)stalled_ms;
+  // Tearing the client down makes the blocked send return
+  (void)ha_client_request_reconnect("ws_send stalled");
+}
+
 esp_err_t ha_client_init(const ha_client_config_t *config) {
   if (!config)
     return ESP_ERR_INVALID_ARG;
 
+  sys_diag_register_recovery("ws_send", ws_send_stall_recovery);
+
+  if (ha_failover_init() != ESP_OK)
+    return ESP_ERR_NO_MEM;
+  ha_rtt_init(&(ha_rtt_link_t){.send_ping = ping_send,
+                               .reconnect = ping_reconnect});
+  if (ha_events_start(ha_event_handle, ping_poll) != ESP_OK)
+    return ESP_ERR_NO_MEM;
+  entities_enabled = ha_entities_init() == ESP_OK;
+  if (!entities_enabled)
+    ESP_LOGW(TAG, "Entity mirror disabled");
+
   // Copy config
   strncpy(config_hostname, config->hostname, sizeof(config_hostname) - 1);
   config_hostname[sizeof(config_hostname) - 1] = '\0';
@@ -538,15 +731,27 @@ esp_err_t ha_client_init(const ha_client_config_t *config) {
   client_config.access_token = config_token;
   client_config.port = config->port;
   client_config.use_ssl = config->use_ssl;
+  tts_fetch_configure(&(tts_fetch_config_t){
+      .hostname = client_config.hostname,
+      .port = client_config.port,
+      .use_ssl = client_config.use_ssl,
+      .on_audio = tts_audio_out,
+  });
 
   ha_client_stop();
-  ha_event_group = xEventGroupCreate();
+  // Kept across reconnects: ha_events may still be handling a message
+  if (ha_event_group == NULL)
+    ha_event_group = xEventGroupCreate();
   init_mdns();
 
+  // Cached address: a reconnect after a failover does not wait for mDNS
+  char host_ip[DNS_CACHE_IP_LEN];
+  const char *host = client_host(host_ip, sizeof(host_ip));
+
   char ws_uri[256];
   snprintf(ws_uri, sizeof(ws_uri), "%s://%s:%d%s",
-           client_config.use_ssl ? "wss" : "ws", client_config.hostname,
-           client_config.port, HA_WEBSOCKET_PATH);
+           client_config.use_ssl ? "wss" : "ws", host, client_config.port,
+           HA_WEBSOCKET_PATH);
 
   esp_websocket_client_config_t ws_cfg = {
       .uri = ws_uri,
@@ -574,7 +779,12 @@ esp_err_t ha_client_init(const ha_client_config_t *config) {
 
   xEventGroupWaitBits(ha_event_group, HA_AUTHENTICATED_BIT, pdFALSE, pdFALSE,
                       pdMS_TO_TICKS(10000));
-  return ha_client_is_connected() ? ESP_OK : ESP_ERR_TIMEOUT;
+  if (!ha_client_is_connected()) {
+    // HA may have moved; resolve again on the next attempt
+    dns_cache_invalidate(client_config.hostname);
+    return ESP_ERR_TIMEOUT;
+  }
+  return ESP_OK;
 }
 
 // ... (Rest of Public API: is_connected, request_tts, start_conversation, etc.
@@ -595,7 +805,7 @@ esp_err_t ha_client_request_tts(const char *text) {
   if (!ha_client_is_connected())
     return ESP_FAIL;
   cJSON *root = cJSON_CreateObject();
-  cJSON_AddNumberToObject(root, "id", message_id++);
+  cJSON_AddNumberToObject(root, "id", next_message_id());
   cJSON_AddStringToObject(root, "type", "assist_pipeline/run");
   cJSON_AddStringToObject(root, "start_stage", "intent");
   cJSON_AddStringToObject(root, "end_stage", "tts");
@@ -619,13 +829,11 @@ esp_err_t ha_client_request_tts(const char *text) {
   return ESP_OK;
 }
 
-char *ha_client_start_conversation(void) {
-  if (!ha_client_is_connected())
-    return NULL;
+static esp_err_t send_run_start(void) {
   ha_clear_audio_ready();
 
   cJSON *root = cJSON_CreateObject();
-  last_run_message_id = message_id++;
+  last_run_message_id = next_message_id();
   cJSON_AddNumberToObject(root, "id", last_run_message_id);
   cJSON_AddStringToObject(root, "type", "assist_pipeline/run");
   cJSON_AddStringToObject(root, "start_stage", "stt");
@@ -637,18 +845,33 @@ char *ha_client_start_conversation(void) {
   char *str = cJSON_PrintUnformatted(root);
   if (!str) {
     cJSON_Delete(root);
-    return NULL;
+    return ESP_ERR_NO_MEM;
   }
   int ret = esp_websocket_client_send_text(ws_client, str, strlen(str),
                                            pdMS_TO_TICKS(2000));
   free(str);
   cJSON_Delete(root);
-  if (ret < 0) {
-    (void)ha_client_request_reconnect("start_conversation send failed");
+  return ret < 0 ? ESP_FAIL : ESP_OK;
+}
+
+char *ha_client_start_conversation(void) {
+  if (!ha_client_is_connected())
+    return NULL;
+
+  if (replay_buf == NULL)
+    replay_buf =
+        mem_budget_acquire(MEM_BLOCK_HA_REPLAY, HA_FAILOVER_MAX_BYTES);
+  ha_failover_run_begin(replay_buf);
+
+  esp_err_t err = send_run_start();
+  if (err != ESP_OK) {
+    ha_failover_run_stop();
+    if (err == ESP_FAIL)
+      (void)ha_client_request_reconnect("start_conversation send failed");
     return NULL;
   }
 
-  char *hid = malloc(32);
+  char *hid = TRACE_MALLOC(ALLOC_TAG_HA_CLIENT, 32);
   if (!hid) {
     ESP_LOGE(TAG, "Failed to allocate handler ID");
     return NULL;
@@ -657,35 +880,52 @@ char *ha_client_start_conversation(void) {
   return hid;
 }
 
-esp_err_t ha_client_stream_audio(const uint8_t *audio_data, size_t length,
-                                 const char *conversation_id) {
-  if (!ha_client_is_connected() || stt_binary_handler_id < 0)
-    return ESP_FAIL;
-
+static esp_err_t send_audio_frame(const uint8_t *audio_data, size_t length) {
   size_t needed = 1 + length;
   if (!audio_frame_buf || audio_frame_buf_cap < needed) {
-    uint8_t *new_buf = realloc(audio_frame_buf, needed);
-    if (!new_buf) {
-      ESP_LOGE(TAG, "Failed to realloc audio buffer (OOM)");
+    mem_budget_release(MEM_BLOCK_HA_AUDIO_FRAME, audio_frame_buf);
+    audio_frame_buf_cap = 0;
+    audio_frame_buf = mem_budget_acquire(MEM_BLOCK_HA_AUDIO_FRAME, needed);
+    if (!audio_frame_buf) {
+      ESP_LOGE(TAG, "Failed to allocate audio buffer (OOM)");
       return ESP_ERR_NO_MEM;
     }
-    audio_frame_buf = new_buf;
     audio_frame_buf_cap = needed;
   }
   audio_frame_buf[0] = (uint8_t)stt_binary_handler_id;
   memcpy(audio_frame_buf + 1, audio_data, length);
 
+  int64_t send_start = esp_timer_get_time();
+  sys_diag_activity("ws_send");
   int ret = esp_websocket_client_send_bin(
       ws_client, (const char *)audio_frame_buf, needed,
       pdMS_TO_TICKS(HA_SEND_AUDIO_TIMEOUT_MS));
-  if (ret < 0) {
-    (void)ha_client_request_reconnect("stream_audio send failed");
+  int64_t send_us = esp_timer_get_time() - send_start;
+  metrics_observe(METRIC_HIST_WS_SEND, (uint32_t)send_us);
+  BLOGD(TAG, "Audio frame: %u bytes, sent in %lld us (ret %d)",
+        (unsigned)needed, send_us, ret);
+  return ret < 0 ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t ha_client_stream_audio(const uint8_t *audio_data, size_t length,
+                                 const char *conversation_id) {
+  (void)conversation_id;
+  if (ha_failover_capture(audio_data, length))
+    return ESP_OK; // Sent by the replay after the reconnect
+  if (!ha_client_is_connected() || stt_binary_handler_id < 0)
     return ESP_FAIL;
+
+  esp_err_t err = send_audio_frame(audio_data, length);
+  if (err == ESP_FAIL) {
+    (void)ha_failover_mark_pending();
+    (void)ha_client_request_reconnect("stream_audio send failed");
   }
-  return ESP_OK;
+  return err;
 }
 
 esp_err_t ha_client_end_audio_stream(void) {
+  if (ha_failover_end_audio())
+    return ESP_OK; // The replay sends the end marker
   if (!ha_client_is_connected() || stt_binary_handler_id < 0)
     return ESP_ERR_INVALID_STATE;
   uint8_t b = (uint8_t)stt_binary_handler_id;
@@ -693,8 +933,9 @@ esp_err_t ha_client_end_audio_stream(void) {
       ws_client, (const char *)&b, 1, pdMS_TO_TICKS(HA_SEND_AUDIO_TIMEOUT_MS));
   ha_clear_audio_ready();
   if (ret < 0) {
+    bool pending = ha_failover_mark_pending();
     (void)ha_client_request_reconnect("end_audio_stream send failed");
-    return ESP_FAIL;
+    return pending ? ESP_OK : ESP_FAIL;
   }
   return ESP_OK;
 }
@@ -732,55 +973,146 @@ void ha_client_stop(void) {
     ws_client = NULL;
   }
   if (ha_event_group)
-    vEventGroupDelete(ha_event_group);
-  ha_event_group = NULL;
+    xEventGroupClearBits(ha_event_group, HA_CONNECTED_BIT |
+                                             HA_AUTHENTICATED_BIT |
+                                             HA_AUDIO_READY_BIT);
+  ws_session++; // Messages still queued belong to the old connection
+  ha_events_discard();
   ws_connected = false;
   ws_authenticated = false;
+  metrics_gauge_set(METRIC_GAUGE_HA_CONNECTED, 0);
 
   // Cleanup audio buffer to prevent memory leak on reinit
   if (audio_frame_buf) {
-    free(audio_frame_buf);
+    mem_budget_release(MEM_BLOCK_HA_AUDIO_FRAME, audio_frame_buf);
     audio_frame_buf = NULL;
     audio_frame_buf_cap = 0;
   }
 }
 
-static void ha_reconnect_task(void *arg) {
+bool ha_client_run_is_resuming(void) { return ha_failover_pending(); }
+
+void ha_client_get_rtt(ha_rtt_stats_t *out) { ha_rtt_get(out); }
+
+uint32_t ha_client_timeout_ms(uint32_t work_ms, uint32_t round_trips) {
+  return work_ms + round_trips * ha_rtt_rto_ms();
+}
+
+static void replay_abandon(const char *why) {
+  ESP_LOGW(TAG, "Interrupted run not replayed: %s", why);
+  ha_failover_run_stop();
+  if (error_callback)
+    error_callback("connection-lost", "Connection lost during the request");
+}
+
+static esp_err_t replay_send(void *ctx, const uint8_t *data, size_t len) {
+  (void)ctx;
+  return send_audio_frame(data, len);
+}
+
+/**
+ * Start a new run on the fresh connection and send the buffered audio.
+ * Live streaming resumes once the replay has caught up with capture.
+ */
+static void replay_run(void) {
+  if (!ha_failover_pending())
+    return;
+  if (ha_failover_stale()) {
+    ESP_LOGW(TAG, "Interrupted run too old to replay");
+    ha_failover_run_stop();
+    return;
+  }
+  if (!ha_client_is_connected()) {
+    replay_abandon("not connected");
+    return;
+  }
+  if (send_run_start() != ESP_OK) {
+    replay_abandon("run start failed");
+    return;
+  }
+  uint32_t ready_ms = ha_client_timeout_ms(HA_REPLAY_READY_WORK_MS, 1);
+  EventBits_t bits =
+      xEventGroupWaitBits(ha_event_group, HA_AUDIO_READY_BIT, pdFALSE, pdFALSE,
+                          pdMS_TO_TICKS(ready_ms));
+  if (!(bits & HA_AUDIO_READY_BIT)) {
+    replay_abandon("no STT handler");
+    return;
+  }
+
+  size_t offset = 0;
+  bool send_end = false;
+  switch (ha_failover_replay(replay_send, NULL, &offset, &send_end)) {
+  case HA_FAILOVER_CANCELLED:
+    return; // Run ended (stt-end or error) while catching up
+  case HA_FAILOVER_SEND_FAILED:
+    replay_abandon("send failed");
+    return;
+  case HA_FAILOVER_REPLAYED:
+    break;
+  }
+
+  metrics_inc(METRIC_HA_RUNS_REPLAYED);
+  ESP_LOGI(TAG, "Replayed %u bytes of interrupted run", (unsigned)offset);
+  if (send_end && ha_client_end_audio_stream() != ESP_OK)
+    ESP_LOGW(TAG, "End of replayed audio not sent");
+}
+
+static esp_err_t ha_reconnect_work(void *arg) {
   char *reason = (char *)arg;
   if (reason && reason[0] != '\0') {
     ESP_LOGW(TAG, "Reconnecting to Home Assistant: %s", reason);
   } else {
     ESP_LOGW(TAG, "Reconnecting to Home Assistant");
   }
-  free(reason);
-
-  (void)ha_client_init(&client_config);
+  TRACE_FREE(reason);
 
-  reconnect_task_handle = NULL;
-  vTaskDelete(NULL);
+  esp_err_t err = ha_client_init(&client_config);
+  if (err == ESP_OK) {
+    replay_run();
+  } else if (ha_failover_pending()) {
+    replay_abandon("reconnect failed");
+  }
+  return err;
 }
 
 esp_err_t ha_client_request_reconnect(const char *reason) {
-  if (reconnect_task_handle != NULL)
+  if (work_busy(reconnect_item))
     return ESP_OK;
 
   char *reason_copy = NULL;
   if (reason) {
     size_t n = strlen(reason) + 1;
-    reason_copy = malloc(n);
+    reason_copy = TRACE_MALLOC(ALLOC_TAG_HA_CLIENT, n);
     if (!reason_copy)
       return ESP_ERR_NO_MEM;
     memcpy(reason_copy, reason, n);
   }
 
-  TaskHandle_t task = NULL;
-  BaseType_t ok = xTaskCreate(ha_reconnect_task, "ha_reconnect", 6144,
-                              reason_copy, 4, &task);
-  if (ok != pdPASS) {
-    free(reason_copy);
-    return ESP_FAIL;
+  esp_err_t err = work_submit_once(&reconnect_item, WORK_LANE_NETWORK,
+                                   "ha_reconnect", ha_reconnect_work,
+                                   reason_copy);
+  if (err != ESP_OK) {
+    TRACE_FREE(reason_copy);
+    // Raced with another caller: a reconnect is pending either way
+    return err == ESP_ERR_INVALID_STATE ? ESP_OK : ESP_FAIL;
   }
 
-  reconnect_task_handle = task;
+  ha_failover_outage_begin();
+  metrics_inc(METRIC_HA_RECONNECTS);
+  flight_recorder_log(FR_EV_HA_RECONNECT, 0, 0);
   return ESP_OK;
 }
+
+void ha_client_on_netif_change(bool up) {
+  if (ws_client == NULL && !work_busy(reconnect_item))
+    return; // Never started (safe mode)
+
+  if (!up) {
+    // The socket is bound to the old address; it would only notice after
+    // the network timeout
+    ha_failover_outage_begin();
+    (void)ha_failover_mark_pending();
+    return;
+  }
+  (void)ha_client_request_reconnect("network changed");
+}
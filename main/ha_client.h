@@ -7,7 +7,9 @@
 #define HA_CLIENT_H
 
 #include "esp_err.h"
+#include "ha_rtt.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -107,6 +109,44 @@ esp_err_t ha_client_end_audio_stream(void);
  */
 esp_err_t ha_client_request_reconnect(const char *reason);
 
+/**
+ * @brief Tell the client the active network interface changed
+ *
+ * Down: the WebSocket is bound to the old address, so a run in progress is
+ * buffered from now on. Up (a new IP, possibly on the other interface):
+ * reconnect at once, to the cached HA address, instead of waiting for the
+ * socket to time out. A run cut off before stt-end is started again on the
+ * new connection with its audio replayed.
+ *
+ * @param up true when an interface got an IP, false when the active one
+ *           was lost
+ */
+void ha_client_on_netif_change(bool up);
+
+/**
+ * @brief True while an interrupted run waits for its replay
+ *
+ * Audio passed to ha_client_stream_audio() meanwhile is buffered, and
+ * ha_client_end_audio_stream() is deferred to the end of the replay.
+ */
+bool ha_client_run_is_resuming(void);
+
+/**
+ * @brief Round trip to Home Assistant, measured with WebSocket pings
+ */
+void ha_client_get_rtt(ha_rtt_stats_t *out);
+
+/**
+ * @brief Timeout for an exchange with Home Assistant
+ *
+ * @param work_ms Time HA itself needs (STT, intent, ...)
+ * @param round_trips Network round trips in the exchange
+ * @return @p work_ms plus @p round_trips retransmission timeouts
+ *         (smoothed RTT + 4 x jitter, clamped; a fixed guess before the
+ *         first pong)
+ */
+uint32_t ha_client_timeout_ms(uint32_t work_ms, uint32_t round_trips);
+
 /**
  * @brief Callback for conversation responses from HA
  *
@@ -0,0 +1,848 @@
+/**
+ * @file ha_entities.c
+ * @brief Local mirror of Home Assistant entity states
+ */
+
+#include "ha_entities.h"
+#include "alloc_trace.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "metrics.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "ha_entities";
+
+#define INDEX_SIZE (2 * HA_ENTITIES_MAX) // Power of two, at most half full
+#define INDEX_MASK (INDEX_SIZE - 1)
+#define POOL_SIZE (96 * 1024)            // ~45 bytes per id + name
+#define STATE_MAX 256                    // HA caps states at 255 characters
+#define KEY_MAX 16                       // Longest key compared is 13
+
+typedef struct {
+  uint32_t id;      ///< Pool offset of the entity id; 0 = free slot
+  uint32_t name;    ///< Pool offset of the friendly name; 0 = none
+  uint32_t hash;    ///< FNV-1a of the id
+  uint32_t changed; ///< last_changed, Unix s
+  uint8_t code;     ///< ha_state_t
+  char text[HA_ENTITY_STATE_LEN]; ///< State when code is HA_STATE_TEXT
+} entry_t;
+
+/** What one "a" entry or "c" diff says about an entity */
+typedef struct {
+  bool has_state;
+  bool has_name; ///< Set, or removed when name is ""
+  bool has_changed;
+  uint32_t changed;
+  char state[STATE_MAX];
+  char name[HA_ENTITY_NAME_LEN];
+} update_t;
+
+typedef struct {
+  const char *p;
+  const char *end;
+} scan_t;
+
+static const char *const state_names[HA_STATE_COUNT] = {
+    [HA_STATE_TEXT] = "",
+    [HA_STATE_UNKNOWN] = "unknown",
+    [HA_STATE_UNAVAILABLE] = "unavailable",
+    [HA_STATE_ON] = "on",
+    [HA_STATE_OFF] = "off",
+    [HA_STATE_OPEN] = "open",
+    [HA_STATE_CLOSED] = "closed",
+    [HA_STATE_OPENING] = "opening",
+    [HA_STATE_CLOSING] = "closing",
+    [HA_STATE_LOCKED] = "locked",
+    [HA_STATE_UNLOCKED] = "unlocked",
+    [HA_STATE_HOME] = "home",
+    [HA_STATE_NOT_HOME] = "not_home",
+    [HA_STATE_PLAYING] = "playing",
+    [HA_STATE_PAUSED] = "paused",
+    [HA_STATE_IDLE] = "idle",
+    [HA_STATE_STANDBY] = "standby",
+    [HA_STATE_HEAT] = "heat",
+    [HA_STATE_COOL] = "cool",
+    [HA_STATE_AUTO] = "auto",
+};
+
+// All of the below is guarded by lock
+static SemaphoreHandle_t lock = NULL;
+static entry_t *entries = NULL;
+static uint16_t *index_tab = NULL; ///< Slot + 1; 0 = empty
+static uint16_t *free_slots = NULL;
+static uint32_t free_count = 0;
+static char *pool = NULL;
+static uint32_t pool_used = 0;
+static uint32_t pool_garbage = 0; ///< Bytes of released strings
+static int32_t last_slot = -1;
+static update_t upd; ///< Too big for the ha_events stack
+static ha_entities_stats_t stats;
+
+static uint32_t fnv1a(const char *s, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (uint8_t)s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/** @p len cut to at most @p max bytes without splitting a UTF-8 character */
+static size_t utf8_cut(const char *s, size_t len, size_t max) {
+  if (len <= max)
+    return len;
+  while (max > 0 && ((uint8_t)s[max] & 0xC0) == 0x80)
+    max--;
+  return max;
+}
+
+// ---------------------------------------------------------------------------
+// String pool
+// ---------------------------------------------------------------------------
+
+static void pool_release(uint32_t off) {
+  if (off != 0)
+    pool_garbage += strlen(pool + off) + 1;
+}
+
+static uint32_t pool_move(char *to, uint32_t *used, uint32_t off) {
+  if (off == 0)
+    return 0;
+  size_t len = strlen(pool + off) + 1;
+  memcpy(to + *used, pool + off, len);
+  uint32_t moved = *used;
+  *used += len;
+  return moved;
+}
+
+/** Rebuild the pool without released strings; offsets of live entries change */
+static bool pool_compact(void) {
+  if (pool_garbage == 0)
+    return false;
+  char *fresh = TRACE_HEAP_CAPS_MALLOC(ALLOC_TAG_HA_CLIENT, POOL_SIZE,
+                                       MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!fresh) {
+    ESP_LOGW(TAG, "No PSRAM to compact the string pool");
+    return false;
+  }
+  uint32_t used = 1; // Offset 0 means "none"
+  fresh[0] = '\0';
+  for (int i = 0; i < HA_ENTITIES_MAX; i++) {
+    entry_t *e = &entries[i];
+    if (e->id == 0)
+      continue;
+    e->id = pool_move(fresh, &used, e->id);
+    e->name = pool_move(fresh, &used, e->name);
+  }
+  TRACE_HEAP_CAPS_FREE(pool);
+  pool = fresh;
+  pool_used = used;
+  pool_garbage = 0;
+  stats.compactions++;
+  return true;
+}
+
+/**
+ * @brief Intern @p len bytes of @p s
+ *
+ * May compact, so offsets held outside entries are stale afterwards.
+ * @return Pool offset, 0 if the pool is full
+ */
+static uint32_t pool_add(const char *s, size_t len) {
+  if (pool_used + len + 1 > POOL_SIZE &&
+      (!pool_compact() || pool_used + len + 1 > POOL_SIZE))
+    return 0;
+  uint32_t off = pool_used;
+  memcpy(pool + off, s, len);
+  pool[off + len] = '\0';
+  pool_used += len + 1;
+  return off;
+}
+
+// ---------------------------------------------------------------------------
+// Table
+// ---------------------------------------------------------------------------
+
+/**
+ * @return Slot of the entity, or -1 with *pos at the empty index position
+ *         where it would go
+ */
+static int find_slot(const char *id, size_t len, uint32_t hash,
+                     uint32_t *pos) {
+  for (uint32_t i = hash & INDEX_MASK;; i = (i + 1) & INDEX_MASK) {
+    uint16_t v = index_tab[i];
+    if (v == 0) {
+      if (pos)
+        *pos = i;
+      return -1;
+    }
+    const entry_t *e = &entries[v - 1];
+    if (e->hash == hash && strncmp(pool + e->id, id, len) == 0 &&
+        pool[e->id + len] == '\0')
+      return v - 1;
+  }
+}
+
+/** Linear probing delete: pull later entries of the cluster into the hole */
+static void index_remove(uint32_t hole) {
+  index_tab[hole] = 0;
+  for (uint32_t i = (hole + 1) & INDEX_MASK; index_tab[i] != 0;
+       i = (i + 1) & INDEX_MASK) {
+    uint32_t home = entries[index_tab[i] - 1].hash & INDEX_MASK;
+    // Movable unless its home lies between the hole and i
+    if (((i - home) & INDEX_MASK) >= ((i - hole) & INDEX_MASK)) {
+      index_tab[hole] = index_tab[i];
+      index_tab[i] = 0;
+      hole = i;
+    }
+  }
+}
+
+static void remove_entity(const char *id, size_t len) {
+  uint32_t hash = fnv1a(id, len);
+  int slot = find_slot(id, len, hash, NULL);
+  if (slot < 0)
+    return;
+  uint32_t pos = hash & INDEX_MASK;
+  while (index_tab[pos] != slot + 1)
+    pos = (pos + 1) & INDEX_MASK;
+  index_remove(pos);
+
+  entry_t *e = &entries[slot];
+  pool_release(e->id);
+  pool_release(e->name);
+  e->id = 0;
+  e->name = 0;
+  free_slots[free_count++] = slot;
+  stats.entities--;
+  if (last_slot == slot)
+    last_slot = -1;
+}
+
+/** @return true if the state differs from the stored one */
+static bool set_state(entry_t *e, const char *state) {
+  uint8_t code = HA_STATE_TEXT;
+  for (int i = HA_STATE_TEXT + 1; i < HA_STATE_COUNT; i++) {
+    if (strcmp(state, state_names[i]) == 0) {
+      code = i;
+      break;
+    }
+  }
+  if (code != HA_STATE_TEXT) {
+    bool changed = e->code != code;
+    e->code = code;
+    return changed;
+  }
+  size_t len = utf8_cut(state, strlen(state), sizeof(e->text) - 1);
+  bool changed = e->code != HA_STATE_TEXT ||
+                 strncmp(e->text, state, len) != 0 || e->text[len] != '\0';
+  e->code = HA_STATE_TEXT;
+  memcpy(e->text, state, len);
+  e->text[len] = '\0';
+  return changed;
+}
+
+/**
+ * @param full An "a" entry: attributes it lacks are gone, and it is not a
+ *             change worth showing as the last one
+ */
+static void apply_update(const char *id, size_t len, const update_t *u,
+                         bool full) {
+  if (len == 0 || len >= HA_ENTITY_ID_LEN) {
+    stats.dropped++;
+    return;
+  }
+  uint32_t hash = fnv1a(id, len);
+  uint32_t pos;
+  int slot = find_slot(id, len, hash, &pos);
+  entry_t *e;
+  if (slot < 0) {
+    if (free_count == 0) {
+      stats.dropped++;
+      return;
+    }
+    uint32_t off = pool_add(id, len);
+    if (off == 0) {
+      stats.dropped++;
+      return;
+    }
+    slot = free_slots[--free_count];
+    e = &entries[slot];
+    memset(e, 0, sizeof(*e));
+    e->id = off;
+    e->hash = hash;
+    e->code = HA_STATE_UNKNOWN;
+    index_tab[pos] = slot + 1;
+    stats.entities++;
+  } else {
+    e = &entries[slot];
+  }
+
+  if (u->has_name || (full && e->name != 0)) {
+    const char *name = u->has_name ? u->name : "";
+    if (e->name == 0 || strcmp(pool + e->name, name) != 0) {
+      // Released first so that a compaction in pool_add can reclaim it
+      pool_release(e->name);
+      e->name = 0;
+      if (name[0] != '\0')
+        e->name = pool_add(name, strlen(name));
+    }
+  }
+  if (u->has_state && set_state(e, u->state) && !full)
+    last_slot = slot;
+  if (u->has_changed)
+    e->changed = u->changed;
+}
+
+// ---------------------------------------------------------------------------
+// JSON scanner
+//
+// Only what subscribe_entities sends: the message is walked in place and
+// values that are not needed are skipped without being decoded.
+// ---------------------------------------------------------------------------
+
+static void skip_ws(scan_t *s) {
+  while (s->p < s->end &&
+         (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r'))
+    s->p++;
+}
+
+static bool peek(scan_t *s, char c) {
+  skip_ws(s);
+  return s->p < s->end && *s->p == c;
+}
+
+static int hex4(const char *p) {
+  int v = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    v <<= 4;
+    if (c >= '0' && c <= '9')
+      v |= c - '0';
+    else if (c >= 'a' && c <= 'f')
+      v |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      v |= c - 'A' + 10;
+    else
+      return -1;
+  }
+  return v;
+}
+
+/** Append @p cp as UTF-8; once something does not fit nothing more is added */
+static void put_utf8(char *out, size_t cap, size_t *n, bool *full,
+                     uint32_t cp) {
+  char b[4];
+  size_t len;
+  if (cp < 0x80) {
+    b[0] = cp;
+    len = 1;
+  } else if (cp < 0x800) {
+    b[0] = 0xC0 | (cp >> 6);
+    b[1] = 0x80 | (cp & 0x3F);
+    len = 2;
+  } else if (cp < 0x10000) {
+    b[0] = 0xE0 | (cp >> 12);
+    b[1] = 0x80 | ((cp >> 6) & 0x3F);
+    b[2] = 0x80 | (cp & 0x3F);
+    len = 3;
+  } else {
+    b[0] = 0xF0 | (cp >> 18);
+    b[1] = 0x80 | ((cp >> 12) & 0x3F);
+    b[2] = 0x80 | ((cp >> 6) & 0x3F);
+    b[3] = 0x80 | (cp & 0x3F);
+    len = 4;
+  }
+  if (*full || *n + len >= cap) {
+    *full = true;
+    return;
+  }
+  memcpy(out + *n, b, len);
+  *n += len;
+}
+
+/**
+ * @brief Decode a string into @p out, cut to @p cap - 1 bytes on a character
+ *        boundary; @p out NULL only skips it
+ */
+static bool scan_string(scan_t *s, char *out, size_t cap, size_t *out_len) {
+  if (!peek(s, '"'))
+    return false;
+  s->p++;
+  size_t n = 0;
+  bool full = out == NULL;
+  const char *run = s->p; // Unescaped bytes not yet copied
+  while (s->p < s->end) {
+    char c = *s->p;
+    if (c != '"' && c != '\\') {
+      s->p++;
+      continue;
+    }
+    if (!full) {
+      size_t len = s->p - run;
+      size_t fit = utf8_cut(run, len, cap - 1 - n);
+      memcpy(out + n, run, fit);
+      n += fit;
+      full = fit < len;
+    }
+    s->p++;
+    if (c == '"') {
+      if (out) {
+        out[n] = '\0';
+        if (out_len)
+          *out_len = n;
+      }
+      return true;
+    }
+    if (s->p >= s->end)
+      return false;
+    uint32_t cp;
+    switch (*s->p++) {
+    case 'b': cp = '\b'; break;
+    case 'f': cp = '\f'; break;
+    case 'n': cp = '\n'; break;
+    case 'r': cp = '\r'; break;
+    case 't': cp = '\t'; break;
+    case 'u': {
+      int v = s->end - s->p >= 4 ? hex4(s->p) : -1;
+      if (v < 0)
+        return false;
+      s->p += 4;
+      cp = v;
+      if (v >= 0xD800 && v < 0xDC00 && s->end - s->p >= 6 && s->p[0] == '\\' &&
+          s->p[1] == 'u') {
+        int lo = hex4(s->p + 2);
+        if (lo >= 0xDC00 && lo < 0xE000) {
+          cp = 0x10000 + ((v - 0xD800) << 10) + (lo - 0xDC00);
+          s->p += 6;
+        }
+      }
+      break;
+    }
+    default: cp = (uint8_t)s->p[-1]; break; // \" \\ \/
+    }
+    if (out)
+      put_utf8(out, cap, &n, &full, cp);
+    run = s->p;
+  }
+  return false;
+}
+
+/** Integer part of a number: HA times are float seconds */
+static bool scan_seconds(scan_t *s, uint32_t *out) {
+  skip_ws(s);
+  uint64_t v = 0;
+  bool digits = false;
+  while (s->p < s->end && *s->p >= '0' && *s->p <= '9') {
+    v = v * 10 + (*s->p++ - '0');
+    digits = true;
+  }
+  while (s->p < s->end && ((*s->p >= '0' && *s->p <= '9') || *s->p == '.' ||
+                           *s->p == 'e' || *s->p == 'E' || *s->p == '+' ||
+                           *s->p == '-'))
+    s->p++;
+  if (digits)
+    *out = (uint32_t)v;
+  return digits;
+}
+
+static bool scan_skip(scan_t *s) {
+  skip_ws(s);
+  if (s->p >= s->end)
+    return false;
+  if (*s->p == '"')
+    return scan_string(s, NULL, 0, NULL);
+  if (*s->p == '{' || *s->p == '[') {
+    int depth = 0;
+    while (s->p < s->end) {
+      char c = *s->p;
+      if (c == '"') {
+        if (!scan_string(s, NULL, 0, NULL))
+          return false;
+        continue;
+      }
+      s->p++;
+      if (c == '{' || c == '[')
+        depth++;
+      else if ((c == '}' || c == ']') && --depth == 0)
+        return true;
+    }
+    return false;
+  }
+  // Number, true, false or null
+  const char *start = s->p;
+  while (s->p < s->end && *s->p != ',' && *s->p != '}' && *s->p != ']' &&
+         *s->p != ' ' && *s->p != '\n' && *s->p != '\r' && *s->p != '\t')
+    s->p++;
+  return s->p > start;
+}
+
+/**
+ * @brief Next member of an object whose '{' was consumed
+ *
+ * @return 1 with the key read and the scanner at its value, 0 at the end of
+ *         the object, -1 on malformed input
+ */
+static int scan_member(scan_t *s, char *key, size_t cap) {
+  if (peek(s, ','))
+    s->p++;
+  if (peek(s, '}')) {
+    s->p++;
+    return 0;
+  }
+  if (!scan_string(s, key, cap, NULL) || !peek(s, ':'))
+    return -1;
+  s->p++;
+  return 1;
+}
+
+/** Like scan_member for an array whose '[' was consumed */
+static int scan_element(scan_t *s) {
+  if (peek(s, ','))
+    s->p++;
+  if (peek(s, ']')) {
+    s->p++;
+    return 0;
+  }
+  skip_ws(s);
+  return s->p < s->end ? 1 : -1;
+}
+
+static bool scan_open(scan_t *s, char c) {
+  if (!peek(s, c))
+    return false;
+  s->p++;
+  return true;
+}
+
+/** Attributes: only friendly_name is kept */
+static bool scan_attrs(scan_t *s, update_t *u) {
+  char key[KEY_MAX];
+  int r;
+  if (!scan_open(s, '{'))
+    return false;
+  while ((r = scan_member(s, key, sizeof(key))) == 1) {
+    bool ok;
+    if (strcmp(key, "friendly_name") == 0 && peek(s, '"')) {
+      ok = scan_string(s, u->name, sizeof(u->name), NULL);
+      u->has_name = true;
+    } else if (strcmp(key, "friendly_name") == 0) {
+      ok = scan_skip(s); // null
+      u->name[0] = '\0';
+      u->has_name = true;
+    } else {
+      ok = scan_skip(s);
+    }
+    if (!ok)
+      return false;
+  }
+  return r == 0;
+}
+
+/** {"s":..,"a":{..},"c":..,"lc":..,"lu":..}: an "a" entry or a diff's "+" */
+static bool scan_state(scan_t *s, update_t *u) {
+  char key[KEY_MAX];
+  int r;
+  if (!scan_open(s, '{'))
+    return false;
+  while ((r = scan_member(s, key, sizeof(key))) == 1) {
+    bool ok;
+    if (strcmp(key, "s") == 0) {
+      ok = u->has_state = scan_string(s, u->state, sizeof(u->state), NULL);
+    } else if (strcmp(key, "a") == 0) {
+      ok = scan_attrs(s, u);
+    } else if (strcmp(key, "lc") == 0) {
+      ok = u->has_changed = scan_seconds(s, &u->changed);
+    } else {
+      ok = scan_skip(s);
+    }
+    if (!ok)
+      return false;
+  }
+  return r == 0;
+}
+
+/** A diff's "-": {"a":["attribute", ...]} */
+static bool scan_removed(scan_t *s, update_t *u) {
+  char key[KEY_MAX];
+  int r;
+  if (!scan_open(s, '{'))
+    return false;
+  while ((r = scan_member(s, key, sizeof(key))) == 1) {
+    if (strcmp(key, "a") != 0 || !peek(s, '[')) {
+      if (!scan_skip(s))
+        return false;
+      continue;
+    }
+    s->p++;
+    int e;
+    while ((e = scan_element(s)) == 1) {
+      char attr[KEY_MAX];
+      if (!peek(s, '"')) {
+        if (!scan_skip(s))
+          return false;
+        continue;
+      }
+      if (!scan_string(s, attr, sizeof(attr), NULL))
+        return false;
+      if (strcmp(attr, "friendly_name") == 0) {
+        u->name[0] = '\0';
+        u->has_name = true;
+      }
+    }
+    if (e < 0)
+      return false;
+  }
+  return r == 0;
+}
+
+/** {"+":{..},"-":{..}} */
+static bool scan_diff(scan_t *s, update_t *u) {
+  char key[KEY_MAX];
+  int r;
+  if (!scan_open(s, '{'))
+    return false;
+  while ((r = scan_member(s, key, sizeof(key))) == 1) {
+    bool ok;
+    if (strcmp(key, "+") == 0)
+      ok = scan_state(s, u);
+    else if (strcmp(key, "-") == 0)
+      ok = scan_removed(s, u);
+    else
+      ok = scan_skip(s);
+    if (!ok)
+      return false;
+  }
+  return r == 0;
+}
+
+/** "a" or "c": {"light.kitchen": {..}, ...} */
+static bool scan_entities(scan_t *s, bool full) {
+  char id[HA_ENTITY_ID_LEN + 1]; // One more to tell a long id from a fit
+  int r;
+  if (!scan_open(s, '{'))
+    return false;
+  while ((r = scan_member(s, id, sizeof(id))) == 1) {
+    upd.has_state = upd.has_name = upd.has_changed = false;
+    upd.state[0] = upd.name[0] = '\0';
+    if (!(full ? scan_state(s, &upd) : scan_diff(s, &upd)))
+      return false;
+    apply_update(id, strlen(id), &upd, full);
+  }
+  return r == 0;
+}
+
+/** "r": ["light.kitchen", ...] */
+static bool scan_removals(scan_t *s) {
+  char id[HA_ENTITY_ID_LEN + 1];
+  int r;
+  if (!scan_open(s, '['))
+    return false;
+  while ((r = scan_element(s)) == 1) {
+    size_t len;
+    if (!scan_string(s, id, sizeof(id), &len))
+      return false;
+    if (len < HA_ENTITY_ID_LEN)
+      remove_entity(id, len);
+  }
+  return r == 0;
+}
+
+// ---------------------------------------------------------------------------
+// API
+// ---------------------------------------------------------------------------
+
+// Callers hold the lock
+static void reset(void) {
+  memset(index_tab, 0, INDEX_SIZE * sizeof(index_tab[0]));
+  memset(entries, 0, HA_ENTITIES_MAX * sizeof(entries[0]));
+  for (int i = 0; i < HA_ENTITIES_MAX; i++)
+    free_slots[i] = HA_ENTITIES_MAX - 1 - i; // Slot 0 is handed out first
+  free_count = HA_ENTITIES_MAX;
+  pool[0] = '\0';
+  pool_used = 1;
+  pool_garbage = 0;
+  last_slot = -1;
+  stats.entities = 0;
+}
+
+esp_err_t ha_entities_init(void) {
+  if (lock)
+    return ESP_OK;
+  const uint32_t caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+  entries = TRACE_HEAP_CAPS_MALLOC(ALLOC_TAG_HA_CLIENT,
+                                   HA_ENTITIES_MAX * sizeof(entries[0]), caps);
+  index_tab = TRACE_HEAP_CAPS_MALLOC(
+      ALLOC_TAG_HA_CLIENT, INDEX_SIZE * sizeof(index_tab[0]), caps);
+  free_slots = TRACE_HEAP_CAPS_MALLOC(
+      ALLOC_TAG_HA_CLIENT, HA_ENTITIES_MAX * sizeof(free_slots[0]), caps);
+  pool = TRACE_HEAP_CAPS_MALLOC(ALLOC_TAG_HA_CLIENT, POOL_SIZE, caps);
+  SemaphoreHandle_t mux = xSemaphoreCreateMutex();
+  if (!entries || !index_tab || !free_slots || !pool || !mux) {
+    ESP_LOGE(TAG, "No memory for the entity table");
+    TRACE_HEAP_CAPS_FREE(entries);
+    TRACE_HEAP_CAPS_FREE(index_tab);
+    TRACE_HEAP_CAPS_FREE(free_slots);
+    TRACE_HEAP_CAPS_FREE(pool);
+    entries = NULL;
+    index_tab = NULL;
+    free_slots = NULL;
+    pool = NULL;
+    if (mux)
+      vSemaphoreDelete(mux);
+    return ESP_ERR_NO_MEM;
+  }
+  reset();
+  stats.pool_size = POOL_SIZE;
+  lock = mux;
+  ESP_LOGI(TAG, "Entity table ready (%d entities, %u KB pool)",
+           HA_ENTITIES_MAX, POOL_SIZE / 1024);
+  return ESP_OK;
+}
+
+void ha_entities_clear(void) {
+  if (!lock)
+    return;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  reset();
+  xSemaphoreGive(lock);
+  metrics_gauge_set(METRIC_GAUGE_HA_ENTITIES, 0);
+}
+
+esp_err_t ha_entities_apply(const char *json, size_t len) {
+  if (!lock)
+    return ESP_ERR_INVALID_STATE;
+  int64_t start = esp_timer_get_time();
+  scan_t s = {json, json + len};
+  char key[KEY_MAX];
+  int r = -1;
+  bool ok;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  uint32_t dropped = stats.dropped;
+  ok = scan_open(&s, '{');
+  while (ok && (r = scan_member(&s, key, sizeof(key))) == 1) {
+    if (strcmp(key, "a") == 0 || strcmp(key, "c") == 0)
+      ok = scan_entities(&s, key[0] == 'a');
+    else if (strcmp(key, "r") == 0)
+      ok = scan_removals(&s);
+    else
+      ok = scan_skip(&s);
+  }
+  ok = ok && r == 0;
+  if (ok)
+    stats.messages++;
+  else
+    stats.errors++;
+  dropped = stats.dropped - dropped;
+  uint32_t count = stats.entities;
+  xSemaphoreGive(lock);
+
+  metrics_observe(METRIC_HIST_HA_ENTITIES_APPLY,
+                  (uint32_t)(esp_timer_get_time() - start));
+  metrics_gauge_set(METRIC_GAUGE_HA_ENTITIES, count);
+  if (dropped > 0)
+    ESP_LOGW(TAG, "%lu entities not mirrored (long id or table full)",
+             (unsigned long)dropped);
+  if (!ok) {
+    ESP_LOGW(TAG, "Malformed entity update at byte %u of %u",
+             (unsigned)(s.p - json), (unsigned)len);
+    return ESP_ERR_INVALID_ARG;
+  }
+  return ESP_OK;
+}
+
+// Callers hold the lock
+static void copy_out(const entry_t *e, ha_entity_t *out) {
+  snprintf(out->entity_id, sizeof(out->entity_id), "%s", pool + e->id);
+  snprintf(out->name, sizeof(out->name), "%s", e->name ? pool + e->name : "");
+  snprintf(out->state, sizeof(out->state), "%s",
+           e->code == HA_STATE_TEXT ? e->text : state_names[e->code]);
+  out->code = e->code;
+  out->last_changed = e->changed;
+}
+
+bool ha_entities_get(const char *entity_id, ha_entity_t *out) {
+  if (!lock || !entity_id)
+    return false;
+  size_t len = strlen(entity_id);
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int slot = find_slot(entity_id, len, fnv1a(entity_id, len), NULL);
+  if (slot >= 0 && out)
+    copy_out(&entries[slot], out);
+  xSemaphoreGive(lock);
+  return slot >= 0;
+}
+
+static char lower(char c) { return c >= 'A' && c <= 'Z' ? c + 32 : c; }
+
+static bool contains_nocase(const char *hay, const char *needle) {
+  for (; *hay; hay++) {
+    size_t i = 0;
+    while (needle[i] && lower(hay[i]) == lower(needle[i]))
+      i++;
+    if (needle[i] == '\0')
+      return true;
+  }
+  return needle[0] == '\0';
+}
+
+size_t ha_entities_find(const char *domain, const char *name, ha_entity_t *out,
+                        size_t max) {
+  if (!lock)
+    return 0;
+  size_t domain_len = domain ? strlen(domain) : 0;
+  size_t found = 0;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  for (int i = 0; i < HA_ENTITIES_MAX; i++) {
+    const entry_t *e = &entries[i];
+    if (e->id == 0)
+      continue;
+    const char *id = pool + e->id;
+    if (domain && (strncmp(id, domain, domain_len) != 0 ||
+                   id[domain_len] != '.'))
+      continue;
+    if (name && !contains_nocase(e->name ? pool + e->name : id, name))
+      continue;
+    if (out && found < max)
+      copy_out(e, &out[found]);
+    found++;
+  }
+  xSemaphoreGive(lock);
+  return found;
+}
+
+bool ha_entities_last_changed(ha_entity_t *out) {
+  if (!lock)
+    return false;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool have = last_slot >= 0;
+  if (have && out)
+    copy_out(&entries[last_slot], out);
+  xSemaphoreGive(lock);
+  return have;
+}
+
+void ha_entities_get_stats(ha_entities_stats_t *out) {
+  if (!out)
+    return;
+  memset(out, 0, sizeof(*out));
+  if (!lock)
+    return;
+  xSemaphoreTake(lock, portMAX_DELAY);
+  *out = stats;
+  out->pool_used = pool_used;
+  for (int i = 0; i < HA_ENTITIES_MAX; i++) {
+    const entry_t *e = &entries[i];
+    if (e->id != 0 && e->code == HA_STATE_ON &&
+        strncmp(pool + e->id, "light.", 6) == 0)
+      out->lights_on++;
+  }
+  xSemaphoreGive(lock);
+}
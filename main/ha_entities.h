@@ -0,0 +1,120 @@
+/**
+ * @file ha_entities.h
+ * @brief Local mirror of Home Assistant entity states
+ *
+ * ha_client subscribes to HA's subscribe_entities stream: one message with
+ * every entity in compressed form ("a"), then diffs of what changed ("c")
+ * and removals ("r"). The mirror keeps what the device needs to answer
+ * "is the kitchen light on" or to draw a status page without a round trip:
+ * entity id, friendly name, state and when it last changed. Other
+ * attributes are skipped.
+ *
+ * Ids and names are interned once in a PSRAM string pool. Common states
+ * ("on", "off", "unavailable", ...) are stored as a code, others inline,
+ * truncated to HA_ENTITY_STATE_LEN - 1 bytes. Messages are scanned in
+ * place: the first one of a large install runs to hundreds of KB, far too
+ * big for a cJSON tree in internal RAM.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HA_ENTITIES_MAX 2048
+#define HA_ENTITY_ID_LEN 64 // Longer ids are not mirrored
+#define HA_ENTITY_NAME_LEN 48
+#define HA_ENTITY_STATE_LEN 24
+
+typedef enum {
+  HA_STATE_TEXT, ///< None of the below; the text is in ha_entity_t.state
+  HA_STATE_UNKNOWN,
+  HA_STATE_UNAVAILABLE,
+  HA_STATE_ON,
+  HA_STATE_OFF,
+  HA_STATE_OPEN,
+  HA_STATE_CLOSED,
+  HA_STATE_OPENING,
+  HA_STATE_CLOSING,
+  HA_STATE_LOCKED,
+  HA_STATE_UNLOCKED,
+  HA_STATE_HOME,
+  HA_STATE_NOT_HOME,
+  HA_STATE_PLAYING,
+  HA_STATE_PAUSED,
+  HA_STATE_IDLE,
+  HA_STATE_STANDBY,
+  HA_STATE_HEAT,
+  HA_STATE_COOL,
+  HA_STATE_AUTO,
+  HA_STATE_COUNT
+} ha_state_t;
+
+/** Copy of one entity; strings are always terminated */
+typedef struct {
+  char entity_id[HA_ENTITY_ID_LEN];
+  char name[HA_ENTITY_NAME_LEN]; ///< friendly_name, "" if none
+  char state[HA_ENTITY_STATE_LEN];
+  ha_state_t code;
+  uint32_t last_changed; ///< Unix time, s
+} ha_entity_t;
+
+typedef struct {
+  uint32_t entities;
+  uint32_t lights_on;   ///< light.* entities that are on
+  uint32_t pool_used;   ///< String pool bytes, including garbage
+  uint32_t pool_size;
+  uint32_t messages;    ///< Messages applied
+  uint32_t errors;      ///< Messages that did not parse (partly applied)
+  uint32_t dropped;     ///< Entities not stored (id too long, table full)
+  uint32_t compactions; ///< String pool rebuilds
+} ha_entities_stats_t;
+
+/**
+ * @brief Allocate the table in PSRAM
+ *
+ * Safe to call again; later calls do nothing.
+ */
+esp_err_t ha_entities_init(void);
+
+/** Forget every entity, e.g. before the snapshot of a new subscription */
+void ha_entities_clear(void);
+
+/**
+ * @brief Apply one subscribe_entities event
+ *
+ * @param json The "event" object of the message ({"a":..}, {"c":..} or
+ *             {"r":..}); anything after the object is ignored
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if it did not parse (the entities
+ *         before the error are applied), ESP_ERR_INVALID_STATE before init
+ */
+esp_err_t ha_entities_apply(const char *json, size_t len);
+
+/** Look up @p entity_id; false if it is not mirrored */
+bool ha_entities_get(const char *entity_id, ha_entity_t *out);
+
+/**
+ * @brief Entities of @p domain whose name contains @p name
+ *
+ * @param domain "light", "switch", ... or NULL for any
+ * @param name Case-insensitive (ASCII) substring of the friendly name, or
+ *             of the id for entities without one; NULL matches all
+ * @return Number of matches, of which the first @p max are copied
+ */
+size_t ha_entities_find(const char *domain, const char *name, ha_entity_t *out,
+                        size_t max);
+
+/** The entity whose state changed last in a diff; false if none yet */
+bool ha_entities_last_changed(ha_entity_t *out);
+
+void ha_entities_get_stats(ha_entities_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
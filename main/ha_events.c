@@ -0,0 +1,133 @@
+/**
+ * @file ha_events.c
+ * @brief Home Assistant WebSocket messages, off the receive task
+ */
+
+#include "ha_events.h"
+#include "alloc_trace.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include <string.h>
+
+static const char *TAG = "ha_events";
+
+#define HA_EVENTS_TASK_STACK 8192
+#define HA_EVENTS_TASK_PRIORITY 5
+
+static QueueHandle_t queue = NULL;
+static ha_events_handler_t handler = NULL;
+static ha_events_idle_t idle = NULL;
+static int32_t queue_peak = 0;
+
+// Message being reassembled, websocket client task only
+static char *rx_buf = NULL;
+static size_t rx_len = 0;
+static size_t rx_total = 0;
+
+void ha_events_discard(void) {
+  if (rx_buf)
+    TRACE_HEAP_CAPS_FREE(rx_buf);
+  rx_buf = NULL;
+  rx_len = 0;
+  rx_total = 0;
+}
+
+static void queue_depth_update(void) {
+  int32_t depth = (int32_t)uxQueueMessagesWaiting(queue);
+  metrics_gauge_set(METRIC_GAUGE_HA_EVENT_QUEUE_DEPTH, depth);
+  if (depth > queue_peak) {
+    queue_peak = depth;
+    metrics_gauge_set(METRIC_GAUGE_HA_EVENT_QUEUE_PEAK, depth);
+  }
+}
+
+void ha_events_receive(const char *data, size_t len, int payload_len,
+                       int payload_offset, size_t limit, uint32_t session) {
+  if (queue == NULL)
+    return;
+  if (payload_offset == 0) {
+    ha_events_discard();
+    size_t total = payload_len > 0 ? (size_t)payload_len : len;
+    if (total > limit) {
+      ESP_LOGW(TAG, "Dropping %u byte message", (unsigned)total);
+      metrics_inc(METRIC_HA_EVENTS_DROPPED);
+      return;
+    }
+    rx_total = total;
+    rx_buf = TRACE_HEAP_CAPS_MALLOC(ALLOC_TAG_HA_CLIENT, rx_total + 1,
+                                    MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!rx_buf) {
+      metrics_inc(METRIC_HA_EVENTS_DROPPED);
+      return;
+    }
+  }
+  // Rest of a dropped message
+  if (!rx_buf || payload_offset != (int)rx_len || rx_len + len > rx_total)
+    return;
+
+  memcpy(rx_buf + rx_len, data, len);
+  rx_len += len;
+  if (rx_len < rx_total)
+    return;
+  rx_buf[rx_len] = '\0';
+
+  ha_event_msg_t msg = {
+      .json = rx_buf,
+      .len = rx_len,
+      .rx_us = esp_timer_get_time(),
+      .session = session,
+  };
+  rx_buf = NULL;
+  ha_events_discard();
+  if (xQueueSend(queue, &msg, pdMS_TO_TICKS(HA_EVENTS_ENQUEUE_TIMEOUT_MS)) !=
+      pdTRUE) {
+    ESP_LOGW(TAG, "Event queue full, dropping message");
+    metrics_inc(METRIC_HA_EVENTS_DROPPED);
+    TRACE_HEAP_CAPS_FREE(msg.json);
+    return;
+  }
+  queue_depth_update();
+}
+
+static void ha_events_task(void *arg) {
+  (void)arg;
+  ha_event_msg_t msg;
+
+  for (;;) {
+    TickType_t wait = idle ? idle() : portMAX_DELAY;
+    if (xQueueReceive(queue, &msg, wait) != pdTRUE)
+      continue;
+    metrics_gauge_set(METRIC_GAUGE_HA_EVENT_QUEUE_DEPTH,
+                      (int32_t)uxQueueMessagesWaiting(queue));
+    metrics_observe(METRIC_HIST_HA_EVENT_DISPATCH,
+                    (uint32_t)(esp_timer_get_time() - msg.rx_us));
+    handler(&msg);
+    TRACE_HEAP_CAPS_FREE(msg.json);
+  }
+}
+
+esp_err_t ha_events_start(ha_events_handler_t on_message,
+                          ha_events_idle_t on_idle) {
+  if (on_message == NULL)
+    return ESP_ERR_INVALID_ARG;
+  if (queue != NULL)
+    return ESP_OK;
+  handler = on_message;
+  idle = on_idle;
+  queue = xQueueCreate(HA_EVENTS_QUEUE_LEN, sizeof(ha_event_msg_t));
+  if (queue == NULL)
+    return ESP_ERR_NO_MEM;
+  if (xTaskCreatePinnedToCoreWithCaps(
+          ha_events_task, "ha_events", HA_EVENTS_TASK_STACK, NULL,
+          HA_EVENTS_TASK_PRIORITY, NULL, tskNO_AFFINITY,
+          MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT) != pdPASS) {
+    vQueueDelete(queue);
+    queue = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
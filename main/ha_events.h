@@ -0,0 +1,82 @@
+/**
+ * @file ha_events.h
+ * @brief Home Assistant WebSocket messages, off the receive task
+ *
+ * The esp_websocket_client task hands over text frames as they arrive.
+ * Frames larger than the client's buffer come in chunks; they are
+ * reassembled into one PSRAM copy and the complete message is queued on a
+ * bounded queue. The ha_events task takes them in arrival order and runs
+ * the handler, so a slow callback never holds up pings and later frames.
+ *
+ * A message over its size limit, or one the queue has no room for within
+ * HA_EVENTS_ENQUEUE_TIMEOUT_MS, is dropped and counted. Queue depth and
+ * receive-to-handle latency are exported.
+ *
+ * ha_events_receive() and ha_events_discard() run on the websocket client
+ * task (or with it stopped); the handler runs on ha_events.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HA_EVENTS_QUEUE_LEN 16
+#define HA_EVENTS_ENQUEUE_TIMEOUT_MS 200
+
+/**
+ * @brief One complete text message
+ */
+typedef struct {
+  char *json; ///< NUL-terminated PSRAM copy, freed after the handler
+  size_t len;
+  int64_t rx_us;    ///< Last chunk received
+  uint32_t session; ///< Caller's connection number when received
+} ha_event_msg_t;
+
+/**
+ * @brief Handles one message on ha_events
+ */
+typedef void (*ha_events_handler_t)(const ha_event_msg_t *msg);
+
+/**
+ * @brief Runs on ha_events between messages
+ *
+ * @return How long to wait for the next message before calling again
+ */
+typedef TickType_t (*ha_events_idle_t)(void);
+
+/**
+ * @brief Create the queue and the ha_events task; once
+ *
+ * @param idle NULL to only wake for messages
+ */
+esp_err_t ha_events_start(ha_events_handler_t handler, ha_events_idle_t idle);
+
+/**
+ * @brief Take one chunk of a text message
+ *
+ * @param data Chunk
+ * @param len Bytes in @p data
+ * @param payload_len Size of the whole message, 0 if unknown (one chunk)
+ * @param payload_offset Where @p data starts in the message
+ * @param limit Largest message accepted; read on the first chunk only
+ * @param session Tagged onto the message for the handler
+ */
+void ha_events_receive(const char *data, size_t len, int payload_len,
+                       int payload_offset, size_t limit, uint32_t session);
+
+/**
+ * @brief Drop a partly received message (connection closed)
+ */
+void ha_events_discard(void);
+
+#ifdef __cplusplus
+}
+#endif
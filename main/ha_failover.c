@@ -0,0 +1,180 @@
+/**
+ * @file ha_failover.c
+ * @brief Keeps a voice run alive across a Home Assistant reconnect
+ */
+
+#include "ha_failover.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string.h>
+
+static const char *TAG = "ha_failover";
+
+static SemaphoreHandle_t lock = NULL;
+static uint8_t *buf = NULL;
+static size_t len = 0;
+static bool active = false;  // Run accepts audio, buffer is complete
+static bool pending = false; // Connection lost, buffer until replayed
+static bool ended = false;   // End of audio seen while pending
+static int64_t pending_us = 0;
+
+// Start of the current outage (0 = connected or never connected)
+static int64_t outage_start_us = 0;
+
+esp_err_t ha_failover_init(void) {
+  if (lock == NULL) {
+    lock = xSemaphoreCreateMutex();
+  }
+  return lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void ha_failover_run_begin(uint8_t *block) {
+  if (lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  buf = block;
+  len = 0;
+  active = block != NULL;
+  pending = false;
+  ended = false;
+  xSemaphoreGive(lock);
+}
+
+void ha_failover_run_stop(void) {
+  if (lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  active = false;
+  pending = false;
+  xSemaphoreGive(lock);
+}
+
+bool ha_failover_capture(const uint8_t *data, size_t n) {
+  if (lock == NULL) {
+    return false;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (active) {
+    if (len + n <= HA_FAILOVER_MAX_BYTES) {
+      memcpy(buf + len, data, n);
+      len += n;
+    } else if (!pending) {
+      // Too long to replay in full; a drop now ends the run as before
+      active = false;
+    }
+  }
+  bool wait = pending;
+  xSemaphoreGive(lock);
+  return wait;
+}
+
+bool ha_failover_mark_pending(void) {
+  if (lock == NULL) {
+    return false;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (active && !pending) {
+    pending = true;
+    pending_us = esp_timer_get_time();
+    ESP_LOGW(TAG, "Run interrupted after %u bytes of audio, will replay",
+             (unsigned)len);
+  }
+  bool wait = pending;
+  xSemaphoreGive(lock);
+  return wait;
+}
+
+bool ha_failover_end_audio(void) {
+  if (lock == NULL) {
+    return false;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  ended = true;
+  bool wait = pending;
+  xSemaphoreGive(lock);
+  return wait;
+}
+
+bool ha_failover_pending(void) {
+  if (lock == NULL) {
+    return false;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool wait = pending;
+  xSemaphoreGive(lock);
+  return wait;
+}
+
+bool ha_failover_stale(void) {
+  if (lock == NULL) {
+    return false;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  bool stale = pending && esp_timer_get_time() - pending_us >
+                              (int64_t)HA_FAILOVER_MAX_AGE_MS * 1000;
+  xSemaphoreGive(lock);
+  return stale;
+}
+
+ha_failover_result_t ha_failover_replay(ha_failover_send_fn send, void *ctx,
+                                        size_t *sent, bool *send_end) {
+  size_t offset = 0;
+  *sent = 0;
+  *send_end = false;
+  if (lock == NULL) {
+    return HA_FAILOVER_CANCELLED;
+  }
+
+  // Capture keeps appending while this catches up; the buffer only grows,
+  // so the bytes before len can be sent without the lock
+  for (;;) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (!pending) {
+      // Run ended (stt-end or error) while catching up
+      xSemaphoreGive(lock);
+      return HA_FAILOVER_CANCELLED;
+    }
+    size_t avail = len - offset;
+    if (avail == 0) {
+      pending = false;
+      *send_end = ended;
+      xSemaphoreGive(lock);
+      return HA_FAILOVER_REPLAYED;
+    }
+    const uint8_t *from = buf + offset;
+    xSemaphoreGive(lock);
+
+    size_t n = avail < HA_FAILOVER_CHUNK ? avail : HA_FAILOVER_CHUNK;
+    if (send(ctx, from, n) != ESP_OK) {
+      return HA_FAILOVER_SEND_FAILED;
+    }
+    offset += n;
+    *sent = offset;
+  }
+}
+
+void ha_failover_outage_begin(void) {
+  if (lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (outage_start_us == 0) {
+    outage_start_us = esp_timer_get_time();
+  }
+  xSemaphoreGive(lock);
+}
+
+int32_t ha_failover_outage_end(void) {
+  if (lock == NULL) {
+    return -1;
+  }
+  xSemaphoreTake(lock, portMAX_DELAY);
+  int64_t start = outage_start_us;
+  outage_start_us = 0;
+  xSemaphoreGive(lock);
+  return start ? (int32_t)((esp_timer_get_time() - start) / 1000) : -1;
+}
@@ -0,0 +1,124 @@
+/**
+ * @file ha_failover.h
+ * @brief Keeps a voice run alive across a Home Assistant reconnect
+ *
+ * The STT audio of the current run is copied into a block from the memory
+ * budget as it is streamed. When the connection drops before stt-end the
+ * run turns pending: capture keeps filling the block instead of sending,
+ * and the end-of-audio marker is deferred. After the reconnect ha_client
+ * starts a new run and drains the block into it, catching up with capture,
+ * then sends the deferred marker. A run pending for longer than
+ * HA_FAILOVER_MAX_AGE_MS is dropped; the user has moved on.
+ *
+ * The outage clock runs from the first sign of a lost connection to the
+ * next auth_ok: the window in which the device cannot take a request.
+ *
+ * Capture (the voice pipeline) and the reconnect worker call in from
+ * different tasks; all state is behind one mutex.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HA_FAILOVER_MAX_BYTES (8 * 16000 * sizeof(int16_t)) ///< 8 s of audio
+#define HA_FAILOVER_CHUNK 1024      ///< Bytes per replayed frame
+#define HA_FAILOVER_MAX_AGE_MS 20000
+
+/**
+ * @brief Sends one replayed audio frame on the new connection
+ */
+typedef esp_err_t (*ha_failover_send_fn)(void *ctx, const uint8_t *data,
+                                         size_t len);
+
+typedef enum {
+  HA_FAILOVER_REPLAYED,  ///< Caught up; live streaming continues
+  HA_FAILOVER_CANCELLED, ///< The run ended or was stopped meanwhile
+  HA_FAILOVER_SEND_FAILED,
+} ha_failover_result_t;
+
+/**
+ * @brief Create the lock; the other calls are no-ops until this succeeds
+ */
+esp_err_t ha_failover_init(void);
+
+/**
+ * @brief A new run starts: keep its audio in @p buf
+ *
+ * @param buf HA_FAILOVER_MAX_BYTES, or NULL to run without a replay
+ */
+void ha_failover_run_begin(uint8_t *buf);
+
+/**
+ * @brief The run ended (stt-end, run-end or error): nothing to replay
+ */
+void ha_failover_run_stop(void);
+
+/**
+ * @brief Keep @p len bytes of streamed audio
+ *
+ * A run that outgrows the block can no longer be replayed in full; a drop
+ * after that ends it as before.
+ *
+ * @return true while the run waits for a reconnect: do not send now
+ */
+bool ha_failover_capture(const uint8_t *data, size_t len);
+
+/**
+ * @brief The connection was lost
+ *
+ * @return true if a run was cut off and will be replayed
+ */
+bool ha_failover_mark_pending(void);
+
+/**
+ * @brief Capture finished the run's audio
+ *
+ * @return true if the replay sends the end marker instead of the caller
+ */
+bool ha_failover_end_audio(void);
+
+/**
+ * @brief A run is waiting for a reconnect
+ */
+bool ha_failover_pending(void);
+
+/**
+ * @brief The pending run is older than HA_FAILOVER_MAX_AGE_MS
+ */
+bool ha_failover_stale(void);
+
+/**
+ * @brief Send the kept audio into the new run, following capture
+ *
+ * Call once the new run's STT handler is ready. On HA_FAILOVER_REPLAYED
+ * the run is live again.
+ *
+ * @param sent Receives the bytes replayed
+ * @param send_end Receives whether the end marker is due now
+ */
+ha_failover_result_t ha_failover_replay(ha_failover_send_fn send, void *ctx,
+                                        size_t *sent, bool *send_end);
+
+/**
+ * @brief The connection is gone; no-op while an outage is running
+ */
+void ha_failover_outage_begin(void);
+
+/**
+ * @brief Authenticated again
+ *
+ * @return The outage in ms, -1 if none was running
+ */
+int32_t ha_failover_outage_end(void);
+
+#ifdef __cplusplus
+}
+#endif
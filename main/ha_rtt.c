@@ -0,0 +1,160 @@
+/**
+ * @file ha_rtt.c
+ * @brief Home Assistant liveness pings and the round trip they measure
+ */
+
+#include "ha_rtt.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "metrics.h"
+#include <string.h>
+
+static const char *TAG = "ha_rtt";
+
+typedef struct {
+  int id; ///< -1 if none
+  int64_t sent_us;
+} ping_t;
+
+static ha_rtt_link_t link_ops;
+
+// Owned by ha_events
+static ping_t ping_cur = {-1, 0};  // Waiting for its pong
+static ping_t ping_prev = {-1, 0}; // Missed; a late pong still counts
+static int64_t ping_due_us = 0;    // Next ping, or ping_cur's deadline
+static uint32_t ping_session = 0;
+static uint32_t pings_missed = 0;
+
+static portMUX_TYPE rtt_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t rtt_srtt_us = 0;
+static uint32_t rtt_var_us = 0;
+static uint32_t rtt_samples = 0;
+static uint32_t rtt_window[HA_RTT_WINDOW]; // Ring, rtt_samples % size
+
+void ha_rtt_init(const ha_rtt_link_t *link) { link_ops = *link; }
+
+static void rtt_sample(uint32_t rtt_us) {
+  portENTER_CRITICAL(&rtt_mux);
+  if (rtt_samples == 0) {
+    rtt_srtt_us = rtt_us;
+    rtt_var_us = rtt_us / 2;
+  } else {
+    uint32_t dev = rtt_us > rtt_srtt_us ? rtt_us - rtt_srtt_us
+                                        : rtt_srtt_us - rtt_us;
+    rtt_var_us = rtt_var_us - rtt_var_us / 4 + dev / 4;
+    rtt_srtt_us = rtt_srtt_us - rtt_srtt_us / 8 + rtt_us / 8;
+  }
+  rtt_window[rtt_samples % HA_RTT_WINDOW] = rtt_us;
+  rtt_samples++;
+  portEXIT_CRITICAL(&rtt_mux);
+  metrics_observe(METRIC_HIST_HA_RTT, rtt_us);
+}
+
+uint32_t ha_rtt_rto_ms(void) {
+  portENTER_CRITICAL(&rtt_mux);
+  uint32_t samples = rtt_samples;
+  uint64_t rto_us = (uint64_t)rtt_srtt_us + 4ULL * rtt_var_us;
+  portEXIT_CRITICAL(&rtt_mux);
+
+  if (samples == 0)
+    return HA_RTT_RTO_INITIAL_MS;
+  uint32_t rto = (uint32_t)((rto_us + 999) / 1000);
+  if (rto < HA_RTT_RTO_MIN_MS)
+    return HA_RTT_RTO_MIN_MS;
+  return rto > HA_RTT_RTO_MAX_MS ? HA_RTT_RTO_MAX_MS : rto;
+}
+
+void ha_rtt_on_pong(int id, int64_t rx_us, uint32_t session) {
+  if (session != ping_session)
+    return;
+  ping_t *p = NULL;
+  if (id == ping_cur.id)
+    p = &ping_cur;
+  else if (id == ping_prev.id)
+    p = &ping_prev;
+  if (p == NULL)
+    return;
+
+  rtt_sample((uint32_t)(rx_us - p->sent_us));
+  pings_missed = 0;
+  if (p == &ping_cur)
+    ping_due_us = p->sent_us + (int64_t)HA_RTT_PING_INTERVAL_MS * 1000;
+  p->id = -1;
+  ping_prev.id = -1;
+}
+
+uint32_t ha_rtt_poll(uint32_t session, bool up) {
+  int64_t now = esp_timer_get_time();
+  if (ping_session != session) {
+    ping_session = session;
+    ping_cur.id = -1;
+    ping_prev.id = -1;
+    pings_missed = 0;
+    ping_due_us = now; // First ping right after auth_ok
+  }
+  if (!up)
+    return HA_RTT_PING_INTERVAL_MS; // auth_ok wakes the caller
+  if (now < ping_due_us)
+    return (uint32_t)((ping_due_us - now + 999) / 1000);
+
+  if (ping_cur.id >= 0) {
+    metrics_inc(METRIC_HA_PONGS_MISSED);
+    ping_prev = ping_cur;
+    ping_cur.id = -1;
+    if (++pings_missed >= HA_RTT_MAX_MISSED) {
+      ESP_LOGW(TAG, "%u pings unanswered", (unsigned)pings_missed);
+      link_ops.reconnect("pong timeout");
+      ping_due_us = now + (int64_t)HA_RTT_PING_INTERVAL_MS * 1000;
+      return HA_RTT_PING_INTERVAL_MS;
+    }
+  }
+
+  uint32_t wait = 2 * ha_rtt_rto_ms();
+  if (wait < HA_RTT_PONG_WAIT_MIN_MS)
+    wait = HA_RTT_PONG_WAIT_MIN_MS;
+  if (wait > HA_RTT_PING_INTERVAL_MS)
+    wait = HA_RTT_PING_INTERVAL_MS;
+
+  int id = link_ops.send_ping();
+  if (id < 0) {
+    link_ops.reconnect("ping send failed");
+    ping_due_us = now + (int64_t)HA_RTT_PING_INTERVAL_MS * 1000;
+    return HA_RTT_PING_INTERVAL_MS;
+  }
+  // From before the send: a stalled socket shows up in the RTT
+  ping_cur.id = id;
+  ping_cur.sent_us = now;
+  ping_due_us = now + (int64_t)wait * 1000;
+  return wait;
+}
+
+void ha_rtt_get(ha_rtt_stats_t *out) {
+  if (!out)
+    return;
+  uint32_t win[HA_RTT_WINDOW];
+  memset(out, 0, sizeof(*out));
+
+  portENTER_CRITICAL(&rtt_mux);
+  out->samples = rtt_samples;
+  out->srtt_us = rtt_srtt_us;
+  out->jitter_us = rtt_var_us;
+  out->missed = pings_missed;
+  uint32_t n = rtt_samples < HA_RTT_WINDOW ? rtt_samples : HA_RTT_WINDOW;
+  memcpy(win, rtt_window, n * sizeof(win[0]));
+  portEXIT_CRITICAL(&rtt_mux);
+
+  if (n == 0)
+    return;
+  for (uint32_t i = 1; i < n; i++) {
+    uint32_t v = win[i];
+    uint32_t j = i;
+    for (; j > 0 && win[j - 1] > v; j--)
+      win[j] = win[j - 1];
+    win[j] = v;
+  }
+  // Nearest rank
+  out->p50_us = win[(50 * n + 99) / 100 - 1];
+  out->p90_us = win[(90 * n + 99) / 100 - 1];
+  out->p99_us = win[(99 * n + 99) / 100 - 1];
+}
@@ -0,0 +1,98 @@
+/**
+ * @file ha_rtt.h
+ * @brief Home Assistant liveness pings and the round trip they measure
+ *
+ * ha_rtt_poll() sends {"type":"ping"} every HA_RTT_PING_INTERVAL_MS while the
+ * link is up, and HA answers with a pong of the same id. The round trips
+ * feed a smoothed RTT and jitter (RFC 6298 gains: SRTT 1/8, RTTVAR 1/4)
+ * that ha_rtt_timeout_ms() turns into timeouts, plus a window of the last
+ * HA_RTT_WINDOW samples for percentiles.
+ *
+ * A ping unanswered within two RTOs is retried at once; a late pong for it
+ * still counts, so a slow link does not look dead. HA_RTT_MAX_MISSED in a
+ * row means the socket only looks up, so a reconnect is requested before
+ * the next run finds out.
+ *
+ * ha_rtt_poll() and ha_rtt_on_pong() run on one task (ha_events); the
+ * statistics and timeouts can be read from any task.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HA_RTT_PING_INTERVAL_MS 15000
+#define HA_RTT_MAX_MISSED 2
+#define HA_RTT_PONG_WAIT_MIN_MS 2000
+#define HA_RTT_RTO_INITIAL_MS 3000 ///< Before the first pong
+#define HA_RTT_RTO_MIN_MS 1000
+#define HA_RTT_RTO_MAX_MS 15000
+
+/**
+ * @brief Round trip statistics
+ *
+ * Times are in microseconds and 0 until the first pong.
+ */
+#define HA_RTT_WINDOW 32
+
+typedef struct {
+  uint32_t samples;   ///< Pongs since boot
+  uint32_t srtt_us;   ///< Smoothed RTT (EWMA, gain 1/8)
+  uint32_t jitter_us; ///< Mean deviation of the RTT (EWMA, gain 1/4)
+  uint32_t p50_us;    ///< Percentiles over the last HA_RTT_WINDOW pongs
+  uint32_t p90_us;
+  uint32_t p99_us;
+  uint32_t missed; ///< Pings in a row without a pong
+} ha_rtt_stats_t;
+
+typedef struct {
+  /** Send a ping; returns its message id, or -1 if the send failed */
+  int (*send_ping)(void);
+  /** The link is dead: replace it */
+  void (*reconnect)(const char *why);
+} ha_rtt_link_t;
+
+/**
+ * @brief Set how pings are sent and a dead link is reported
+ */
+void ha_rtt_init(const ha_rtt_link_t *link);
+
+/**
+ * @brief Send a ping if one is due and check the last one was answered
+ *
+ * @param session Connection number; a new one restarts the schedule with
+ *                a ping right away
+ * @param up Authenticated and able to send
+ * @return Milliseconds until the next call is needed
+ */
+uint32_t ha_rtt_poll(uint32_t session, bool up);
+
+/**
+ * @brief A pong arrived
+ *
+ * @param id Message id of the pong
+ * @param rx_us esp_timer time it was received
+ * @param session Connection it arrived on
+ */
+void ha_rtt_on_pong(int id, int64_t rx_us, uint32_t session);
+
+/**
+ * @brief Copy the current statistics
+ */
+void ha_rtt_get(ha_rtt_stats_t *out);
+
+/**
+ * @brief Retransmission timeout: SRTT + 4 x RTTVAR, clamped to
+ * HA_RTT_RTO_MIN_MS..HA_RTT_RTO_MAX_MS; HA_RTT_RTO_INITIAL_MS before the
+ * first pong
+ */
+uint32_t ha_rtt_rto_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
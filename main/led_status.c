@@ -6,11 +6,13 @@
  */
 
 #include "led_status.h"
+#include "audio_level.h"
 #include "driver/ledc.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "work_queue.h"
 #include <math.h>
 #include <string.h>
 
@@ -32,6 +34,8 @@ static const char *TAG = "led_status";
 #define BLINK_PERIOD_MS 500
 #define FAST_BLINK_MS 200
 #define EFFECT_STEP_MS 20
+#define AUDIO_LEVEL_STALE_MS 200 // Fall back to pulse if TTS stops posting
+#define AUDIO_LEVEL_FLOOR 40     // Keep cyan visible between words
 
 // Module state
 static bool led_initialized = false;
@@ -46,7 +50,7 @@ static uint8_t current_r = 0;
 static uint8_t current_g = 0;
 static uint8_t current_b = 0;
 
-static TaskHandle_t test_task_handle = NULL;
+static work_handle_t test_item = WORK_HANDLE_NONE;
 
 /**
  * @brief Apply RGB values to LEDs with brightness scaling
@@ -97,6 +101,9 @@ static void led_off(void) { apply_rgb(0, 0, 0); }
  */
 static void led_effect_task(void *arg) {
   uint32_t tick = 0;
+  uint32_t last_audio_post = 0;
+  uint32_t last_audio_tick = 0;
+  bool audio_level_seen = false;
 
   while (effect_running) {
     led_status_t status = current_status;
@@ -154,7 +161,21 @@ static void led_effect_task(void *arg) {
     }
 
     case LED_STATUS_SPEAKING: {
-      // Cyan fast pulsing during TTS playback
+      uint8_t level;
+      if (audio_level_poll(&last_audio_post, &level)) {
+        last_audio_tick = tick;
+        audio_level_seen = true;
+      }
+
+      if (audio_level_seen && tick - last_audio_tick <= AUDIO_LEVEL_STALE_MS) {
+        // Cyan following the speech envelope
+        uint8_t val = AUDIO_LEVEL_FLOOR +
+                      ((255 - AUDIO_LEVEL_FLOOR) * level) / 255;
+        apply_rgb(0, val, val);
+        break;
+      }
+
+      // Cyan fast pulsing when no level is available
       float phase = (float)(tick % FAST_PULSE_MS) / FAST_PULSE_MS;
       float intensity =
           0.3f + 0.7f * (0.5f + 0.5f * sinf(phase * 2 * 3.14159f));
@@ -369,7 +390,7 @@ void led_status_set_rgb(uint8_t r, uint8_t g, uint8_t b) {
   apply_rgb(r, g, b);
 }
 
-static void led_test_task(void *arg) {
+static esp_err_t led_test_work(void *arg) {
   led_status_t saved_status = led_status_get();
 
   led_status_set_rgb(255, 0, 0);
@@ -384,19 +405,16 @@ static void led_test_task(void *arg) {
 
   // Restore prior status
   led_status_set(saved_status);
-
-  test_task_handle = NULL;
-  vTaskDelete(NULL);
+  return ESP_OK;
 }
 
 void led_status_test_pattern(void) {
   if (!led_initialized) {
     return;
   }
-  if (test_task_handle != NULL) {
-    return;
-  }
-  xTaskCreate(led_test_task, "led_test", 2048, NULL, 2, &test_task_handle);
+  // Ignored while a previous pattern is still showing
+  work_submit_once(&test_item, WORK_LANE_BACKGROUND, "led_test", led_test_work,
+                   NULL);
 }
 
 void led_status_deinit(void) {
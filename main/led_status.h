@@ -41,7 +41,7 @@ typedef enum {
   LED_STATUS_IDLE,       ///< Green (dim) - Ready for wake word
   LED_STATUS_LISTENING,  ///< Blue (pulsing) - Wake word detected, listening
   LED_STATUS_PROCESSING, ///< Yellow (blinking) - Processing STT/Intent
-  LED_STATUS_SPEAKING,   ///< Cyan (static) - TTS playback
+  LED_STATUS_SPEAKING,   ///< Cyan (follows speech level) - TTS playback
   LED_STATUS_ERROR,      ///< Red (fast blinking) - Error state
   LED_STATUS_CONNECTING, ///< Purple (slow pulse) - Connecting to network
   LED_STATUS_OTA,        ///< White (breathing) - OTA update in progress
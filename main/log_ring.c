@@ -0,0 +1,279 @@
+/**
+ * @file log_ring.c
+ * @brief Lock-free multi-producer log ring
+ *
+ * Record layout (8-byte aligned, header never wraps):
+ *   word 0: stamp  - sequence number of the record, stored last (release)
+ *   word 1: check << 16 | LOG_RING_MAGIC | payload length
+ *   payload, padded to 8 bytes, may wrap around the end of the ring
+ *
+ * A record is readable when its stamp equals its own sequence number. A
+ * record is intact as long as the head has not advanced more than
+ * LOG_RING_SIZE past its start, with one exception: a writer preempted
+ * between reserving and publishing for a whole ring's worth of writes
+ * finishes its copy on top of newer records. It notices afterwards and does
+ * not publish, but the records it hit are already out. Readers catch those
+ * by the check, a hash of sequence number and payload, and skip them.
+ */
+
+#include "log_ring.h"
+#include <stdatomic.h>
+#include <string.h>
+
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+#define LOG_RING_ALIGN 8
+#define LOG_RING_HDR 8
+#define LOG_RING_MAGIC 0x0000A000u
+#define LOG_RING_MAGIC_MASK 0x0000F000u
+#define LOG_RING_LEN_MASK 0x00000FFFu
+#define LOG_RING_CHECK_SHIFT 16
+
+_Static_assert((LOG_RING_SIZE & LOG_RING_MASK) == 0,
+               "LOG_RING_SIZE must be a power of two");
+_Static_assert(LOG_RING_MAX_PAYLOAD <= LOG_RING_LEN_MASK,
+               "LOG_RING_MAX_PAYLOAD does not fit the length field");
+
+static uint32_t ring[LOG_RING_SIZE / 4];
+static _Atomic uint32_t ring_head = 0;  // Next sequence number to reserve
+static _Atomic uint32_t ring_clear = 0; // Readers never go below this
+static _Atomic uint32_t ring_torn = 0;  // Head when a lapped writer gave up
+
+static inline uint32_t record_total(uint32_t len) {
+    return (LOG_RING_HDR + len + LOG_RING_ALIGN - 1) & ~(uint32_t)(LOG_RING_ALIGN - 1);
+}
+
+static inline uint32_t *record_hdr(uint32_t seq) {
+    return &ring[(seq & LOG_RING_MASK) / 4];
+}
+
+static void ring_copy_in(uint32_t seq, const void *src, size_t len) {
+    uint8_t *bytes = (uint8_t *)ring;
+    size_t off = seq & LOG_RING_MASK;
+    size_t first = LOG_RING_SIZE - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(bytes + off, src, first);
+    if (len > first) {
+        memcpy(bytes, (const uint8_t *)src + first, len - first);
+    }
+}
+
+static void ring_copy_out(uint32_t seq, void *dst, size_t len) {
+    const uint8_t *bytes = (const uint8_t *)ring;
+    size_t off = seq & LOG_RING_MASK;
+    size_t first = LOG_RING_SIZE - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(dst, bytes + off, first);
+    if (len > first) {
+        memcpy((uint8_t *)dst + first, bytes, len - first);
+    }
+}
+
+/** FNV-1a of the sequence number and payload, folded to 16 bits */
+static uint32_t record_check(uint32_t seq, const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 4; i++) {
+        h ^= (seq >> (8 * i)) & 0xFF;
+        h *= 16777619u;
+    }
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return (h ^ (h >> 16)) & 0xFFFF;
+}
+
+/**
+ * Return true (and the length word) if a complete record starts at seq
+ */
+static bool record_word(uint32_t seq, uint32_t *word_out) {
+    uint32_t *hdr = record_hdr(seq);
+    if (__atomic_load_n(&hdr[0], __ATOMIC_ACQUIRE) != seq) {
+        return false; // Still being written, or already recycled
+    }
+    uint32_t len_word = __atomic_load_n(&hdr[1], __ATOMIC_RELAXED);
+    if ((len_word & LOG_RING_MAGIC_MASK) != LOG_RING_MAGIC ||
+        (len_word & LOG_RING_LEN_MASK) > LOG_RING_MAX_PAYLOAD) {
+        return false;
+    }
+    *word_out = len_word;
+    return true;
+}
+
+/**
+ * Return true (and the payload length) if a complete record starts at seq
+ */
+static bool record_at(uint32_t seq, uint32_t *len_out) {
+    uint32_t len_word;
+    if (!record_word(seq, &len_word)) {
+        return false;
+    }
+    *len_out = len_word & LOG_RING_LEN_MASK;
+    return true;
+}
+
+/** True if seq was reserved before the last lapped writer gave up */
+static bool torn_since(uint32_t seq) {
+    uint32_t torn = atomic_load_explicit(&ring_torn, memory_order_acquire);
+    return (uint32_t)(torn - seq - 1) < LOG_RING_SIZE;
+}
+
+/** Remember the head at which a lapped writer gave up, keeping the newest */
+static void mark_torn(void) {
+    uint32_t head = log_ring_head();
+    uint32_t torn = atomic_load_explicit(&ring_torn, memory_order_relaxed);
+    while ((int32_t)(head - torn) > 0 &&
+           !atomic_compare_exchange_weak_explicit(&ring_torn, &torn, head,
+                                                  memory_order_release,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+void log_ring_write(const void *data, size_t len) {
+    if (data == NULL || len == 0) {
+        return;
+    }
+    if (len > LOG_RING_MAX_PAYLOAD) {
+        len = LOG_RING_MAX_PAYLOAD;
+    }
+
+    uint32_t seq = atomic_fetch_add_explicit(&ring_head, record_total(len),
+                                             memory_order_relaxed);
+    uint32_t *hdr = record_hdr(seq);
+    uint32_t check = record_check(seq, data, len);
+    uint32_t prev = __atomic_load_n(&hdr[0], __ATOMIC_RELAXED);
+
+    __atomic_store_n(&hdr[1],
+                     check << LOG_RING_CHECK_SHIFT | LOG_RING_MAGIC |
+                         (uint32_t)len,
+                     __ATOMIC_RELAXED);
+    ring_copy_in(seq + LOG_RING_HDR, data, len);
+
+    // Publish: readers only trust the payload once the stamp matches. Not if
+    // the ring lapped us meanwhile: the slot belongs to a newer record, and
+    // one that stamped it first makes the exchange fail.
+    if ((uint32_t)(log_ring_head() - seq) > LOG_RING_SIZE ||
+        !__atomic_compare_exchange_n(&hdr[0], &prev, seq, false,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        mark_torn();
+    }
+}
+
+uint32_t log_ring_head(void) {
+    return atomic_load_explicit(&ring_head, memory_order_acquire);
+}
+
+uint32_t log_ring_oldest(void) {
+    uint32_t head = log_ring_head();
+    uint32_t clear = atomic_load_explicit(&ring_clear, memory_order_acquire);
+
+    if ((uint32_t)(head - clear) <= LOG_RING_SIZE) {
+        return clear; // Nothing overwritten since the last clear
+    }
+
+    // Wrapped: find the first complete record inside the window. Anything
+    // starting inside the window is intact by construction.
+    uint32_t len;
+    for (uint32_t seq = head - LOG_RING_SIZE; seq != head; seq += LOG_RING_ALIGN) {
+        if (record_at(seq, &len)) {
+            return seq;
+        }
+    }
+    return head;
+}
+
+uint32_t log_ring_sync(uint32_t seq, bool *reset) {
+    uint32_t head = log_ring_head();
+    uint32_t clear = atomic_load_explicit(&ring_clear, memory_order_acquire);
+    uint32_t len;
+
+    *reset = false;
+    if ((uint32_t)(head - seq) > LOG_RING_SIZE ||            // overtaken / ahead
+        (uint32_t)(seq - clear) > (uint32_t)(head - clear) || // before clear
+        (seq & (LOG_RING_ALIGN - 1)) != 0) {
+        *reset = true;
+        return log_ring_oldest();
+    }
+
+    if (seq == head || record_at(seq, &len) ||
+        ((uint32_t)(head - seq) < LOG_RING_SIZE / 2 && !torn_since(seq))) {
+        return seq; // Complete, or most likely still being written
+    }
+
+    // A writer that was preempted long enough to be lapped finished late and
+    // scribbled over this slot. Skip to the next intact record.
+    for (uint32_t next = seq + LOG_RING_ALIGN; next != head; next += LOG_RING_ALIGN) {
+        if (record_at(next, &len)) {
+            return next;
+        }
+    }
+    return head;
+}
+
+uint32_t log_ring_readable_end(uint32_t from) {
+    uint32_t head = log_ring_head();
+    uint32_t seq = from;
+    uint32_t len;
+
+    while (seq != head && record_at(seq, &len)) {
+        seq += record_total(len);
+    }
+    return seq;
+}
+
+size_t log_ring_read(uint32_t *cursor, uint32_t end, void *dst,
+                     size_t dst_len) {
+    uint32_t seq = *cursor;
+    size_t out = 0;
+    uint32_t word;
+
+    while ((int32_t)(end - seq) > 0 && record_word(seq, &word)) {
+        uint32_t len = word & LOG_RING_LEN_MASK;
+        if (out + len > dst_len) {
+            break;
+        }
+        uint8_t *copy = (uint8_t *)dst + out;
+        ring_copy_out(seq + LOG_RING_HDR, copy, len);
+
+        // Discard the copy if a writer recycled this record meanwhile
+        atomic_thread_fence(memory_order_acquire);
+        if ((uint32_t)(log_ring_head() - seq) > LOG_RING_SIZE) {
+            break;
+        }
+        uint32_t at = seq;
+        uint32_t now;
+        seq += record_total(len);
+        if (!record_word(at, &now) || now != word ||
+            record_check(at, copy, len) != word >> LOG_RING_CHECK_SHIFT) {
+            continue; // A lapped writer wrote into it: skip
+        }
+        out += len;
+    }
+
+    *cursor = seq;
+    return out;
+}
+
+size_t log_ring_read_record(uint32_t *cursor, uint32_t end, void *dst,
+                            size_t dst_len) {
+    uint32_t len;
+
+    for (;;) {
+        if ((int32_t)(end - *cursor) <= 0 || !record_at(*cursor, &len) || len > dst_len) {
+            return 0;
+        }
+        uint32_t at = *cursor;
+        size_t n = log_ring_read(cursor, at + record_total(len), dst, len);
+        if (n > 0 || *cursor == at) {
+            return n; // Read, or overwritten; a skipped torn record moved on
+        }
+    }
+}
+
+void log_ring_clear(void) {
+    atomic_store_explicit(&ring_clear, log_ring_head(), memory_order_release);
+}
@@ -0,0 +1,98 @@
+/**
+ * @file log_ring.h
+ * @brief Lock-free multi-producer log ring
+ *
+ * Fixed-size byte ring addressed by monotonically increasing 32-bit sequence
+ * numbers. Writers reserve space with a single atomic add and never block or
+ * drop because of contention, so logging is safe from any task or core.
+ * Readers keep their own cursor and copy records out without a lock; a record
+ * that was overwritten while being read, or written into by a writer the ring
+ * had lapped, is detected and discarded.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_RING_SIZE 8192        ///< Ring capacity in bytes (power of two)
+#define LOG_RING_MAX_PAYLOAD 480  ///< Longer records are truncated
+
+/**
+ * @brief Append one record (wait-free)
+ *
+ * @param data Record bytes (usually one formatted log line)
+ * @param len Number of bytes
+ */
+void log_ring_write(const void *data, size_t len);
+
+/**
+ * @brief Sequence number one past the newest reserved record
+ */
+uint32_t log_ring_head(void);
+
+/**
+ * @brief Sequence number of the oldest record still readable
+ */
+uint32_t log_ring_oldest(void);
+
+/**
+ * @brief Turn a reader cursor into a safe place to resume reading
+ *
+ * Cursors that were overtaken by writers, predate the last clear, or are
+ * ahead of the ring (e.g. a client that survived a device reboot) are moved
+ * to the oldest record and @p reset is set. A cursor stuck behind a record
+ * that will never complete is moved past it.
+ *
+ * @param seq Cursor from a previous read (or 0)
+ * @param[out] reset true if the reader has to start over
+ * @return Cursor to pass to log_ring_readable_end() / log_ring_read()
+ */
+uint32_t log_ring_sync(uint32_t seq, bool *reset);
+
+/**
+ * @brief Walk complete records starting at @p from
+ *
+ * @return Sequence number just past the last contiguous complete record
+ */
+uint32_t log_ring_readable_end(uint32_t from);
+
+/**
+ * @brief Copy whole records between @p *cursor and @p end into @p dst
+ *
+ * Records are never split. The cursor is advanced past every record copied.
+ *
+ * @param cursor Reader cursor (in/out)
+ * @param end Stop position, usually from log_ring_readable_end()
+ * @param dst Destination buffer (at least LOG_RING_MAX_PAYLOAD bytes)
+ * @param dst_len Destination size
+ * @return Number of bytes copied (0 when nothing more is available)
+ */
+size_t log_ring_read(uint32_t *cursor, uint32_t end, void *dst,
+                     size_t dst_len);
+
+/**
+ * @brief Copy exactly one record at @p *cursor into @p dst
+ *
+ * Same rules as log_ring_read(), but the caller sees record boundaries
+ * (needed to tell binary records from text lines).
+ *
+ * @return Record length, 0 if no complete record is available or it does
+ *         not fit into @p dst
+ */
+size_t log_ring_read_record(uint32_t *cursor, uint32_t end, void *dst,
+                            size_t dst_len);
+
+/**
+ * @brief Hide everything written so far from readers
+ */
+void log_ring_clear(void);
+
+#ifdef __cplusplus
+}
+#endif
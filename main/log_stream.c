@@ -0,0 +1,116 @@
+/**
+ * @file log_stream.c
+ * @brief Server-Sent Events framing of the log ring for live viewers
+ */
+
+#include "log_stream.h"
+#include "blog.h"
+#include "log_ring.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+// Only the servicing task touches these: raw ring bytes and the SSE framing
+static char stream_raw[LOG_STREAM_CHUNK_SIZE];
+static char stream_frame[LOG_STREAM_CHUNK_SIZE * 2 + 64];
+
+size_t log_stream_read_text(uint32_t *cursor, uint32_t end, char *dst,
+                            size_t dst_len) {
+  uint8_t rec[LOG_RING_MAX_PAYLOAD];
+  size_t out = 0;
+
+  while (dst_len - out > LOG_RING_MAX_PAYLOAD) {
+    size_t n = log_ring_read_record(cursor, end, rec, sizeof(rec));
+    if (n == 0) {
+      break;
+    }
+    if (blog_is_record(rec, n)) {
+      out += blog_render(rec, n, dst + out, dst_len - out);
+    } else {
+      memcpy(dst + out, rec, n);
+      out += n;
+    }
+  }
+  return out;
+}
+
+/**
+ * Frame raw log text as one SSE event: every line becomes a "data:" line.
+ * Whole lines that do not fit stream_frame (short lines cost 6 bytes each
+ * in framing) are left for the next event; @p used gets the bytes framed.
+ * The event that ends the chunk carries the ring cursor as its id, so
+ * EventSource can resume where it left off.
+ */
+static size_t frame_event(uint32_t cursor, const char *raw, size_t raw_len,
+                          size_t *used) {
+  const size_t room = sizeof(stream_frame) - 32; // id line and terminator
+  size_t out = 0;
+  size_t i = 0;
+  while (i < raw_len) {
+    const char *nl = memchr(raw + i, '\n', raw_len - i);
+    size_t line = nl ? (size_t)(nl - (raw + i)) : raw_len - i;
+    // A single line always fits: raw is at most LOG_STREAM_CHUNK_SIZE
+    if (out > 0 && out + 6 + line + 1 > room) {
+      break;
+    }
+    memcpy(stream_frame + out, "data: ", 6);
+    out += 6;
+    for (size_t k = 0; k < line; k++) {
+      if (raw[i + k] != '\r') {
+        stream_frame[out++] = raw[i + k];
+      }
+    }
+    stream_frame[out++] = '\n';
+    i += line + (nl ? 1 : 0);
+  }
+  if (i == raw_len) {
+    out += (size_t)snprintf(stream_frame + out, sizeof(stream_frame) - out,
+                            "id: %" PRIu32 "\n", cursor);
+  }
+  stream_frame[out++] = '\n';
+  *used = i;
+  return out;
+}
+
+void log_stream_open(log_stream_pos_t *pos, uint32_t since) {
+  bool reset = false;
+  pos->cursor = log_ring_sync(since, &reset);
+  pos->reset = reset && since != 0; // A first connect has nothing to reset
+}
+
+bool log_stream_service(log_stream_pos_t *pos, bool keepalive,
+                        log_stream_send_t send, void *ctx) {
+  bool lapped = false;
+  pos->cursor = log_ring_sync(pos->cursor, &lapped);
+  if (lapped && !pos->reset) {
+    return false; // Fell a whole ring behind - it will reconnect and reset
+  }
+  if (pos->reset) {
+    static const char ev[] = "event: reset\ndata: 1\n\n";
+    if (send(ctx, ev, sizeof(ev) - 1) != ESP_OK) {
+      return false;
+    }
+    pos->reset = false;
+  }
+
+  uint32_t end = log_ring_readable_end(pos->cursor);
+  size_t n;
+  bool sent = false;
+  while ((n = log_stream_read_text(&pos->cursor, end, stream_raw,
+                                   sizeof(stream_raw))) > 0) {
+    for (size_t off = 0; off < n;) {
+      size_t used;
+      size_t len = frame_event(pos->cursor, stream_raw + off, n - off, &used);
+      if (send(ctx, stream_frame, len) != ESP_OK) {
+        return false;
+      }
+      off += used;
+    }
+    sent = true;
+  }
+
+  if (!sent && keepalive) {
+    return send(ctx, ": ping\n\n", 8) == ESP_OK;
+  }
+  return true;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file log_stream.h
+ * @brief Server-Sent Events framing of the log ring for live viewers
+ *
+ * Each viewer keeps its own cursor into the log ring; servicing it copies
+ * the new records straight out of the ring (BLOG records rendered as text)
+ * and frames them as SSE events whose id is the ring cursor, so an
+ * EventSource reconnect resumes where it stopped. The transport is a send
+ * callback: webserial passes httpd_resp_send_chunk() on the detached
+ * request, whose socket has a short send timeout.
+ *
+ * Backpressure never reaches the writers: a viewer whose send fails or
+ * times out, or that fell a whole ring behind, is reported as lost and the
+ * caller drops it.
+ *
+ * log_stream_service() uses static framing buffers; call it from one task.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_STREAM_CHUNK_SIZE 1024 ///< Ring bytes copied out per pass
+
+typedef struct {
+  uint32_t cursor; ///< Position in the log ring
+  bool reset;      ///< Viewer has to clear its view first
+} log_stream_pos_t;
+
+/**
+ * @brief Transport for one viewer; anything but ESP_OK loses it
+ */
+typedef esp_err_t (*log_stream_send_t)(void *ctx, const char *data,
+                                       size_t len);
+
+/**
+ * @brief Position a new viewer
+ *
+ * @param since Last event id the viewer saw, 0 for the whole ring
+ */
+void log_stream_open(log_stream_pos_t *pos, uint32_t since);
+
+/**
+ * @brief Send everything new to one viewer
+ *
+ * @param keepalive Send an SSE comment if there is nothing new
+ * @return false if the viewer is lost (send failed, or lapped by writers)
+ */
+bool log_stream_service(log_stream_pos_t *pos, bool keepalive,
+                        log_stream_send_t send, void *ctx);
+
+/**
+ * @brief Copy log text out of the ring, rendering BLOG records
+ *
+ * Stops while fewer than LOG_RING_MAX_PAYLOAD bytes of room are left.
+ *
+ * @return Bytes written to @p dst (not NUL-terminated)
+ */
+size_t log_stream_read_text(uint32_t *cursor, uint32_t end, char *dst,
+                            size_t dst_len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,6 +5,7 @@
 #include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "nvs_flash.h"
 #include <math.h>
@@ -21,27 +22,41 @@
 // Modules
 #include "alarm_manager.h"
 #include "audio_capture.h"
+#include "boot_seq.h"
 #include "config.h"
+#include "dns_cache.h"
+#include "flight_recorder.h"
 #include "ha_client.h"
 #include "led_status.h"
 #include "local_music_player.h"
+#include "mem_budget.h"
 #include "mqtt_ha.h"
 #include "network_manager.h"
 #include "oled_status.h"
 #include "ota_update.h"
 #include "settings_manager.h"
 #include "sys_diag.h" // Phase 9
+#include "task_profiler.h"
 #include "va_control.h"
 #include "voice_pipeline.h"
 #include "webserial.h"
 #include "wifi_manager.h"
+#include "work_queue.h"
 
 #define TAG "main"
+// Longest boot step is the HA handshake (10 s auth wait). boot_seq_run()
+// feeds the watchdog while it waits, so this may exceed the TWDT period.
+#define BOOT_TIMEOUT_MS 60000
 
 static bool sd_init_done = false;
-static TaskHandle_t post_connect_task_handle = NULL;
+static SemaphoreHandle_t sd_mutex = NULL;
+// Loaded in app_main before the boot graph runs, read by the steps
+static app_settings_t settings;
+static work_handle_t post_connect_item = WORK_HANDLE_NONE;
+static bool network_was_up = false;  // An IP before the current one
+static bool mqtt_reconnect_pending = false;
 static char ota_url_value[256] = {0};
-static TaskHandle_t music_control_task_handle = NULL;
+static work_handle_t music_item = WORK_HANDLE_NONE;
 static bool audio_hw_ready = false;
 static TaskHandle_t metrics_task_handle = NULL;
 static TaskHandle_t led_ready_task_handle = NULL;
@@ -58,6 +73,7 @@ static void ota_progress_handler(ota_state_t state, int progress,
 static void led_ready_task(void *arg);
 static void led_ready_task(void *arg);
 static void sdcard_release_for_wifi_fallback(void);
+static void sdcard_mount_music(void);
 static void music_state_callback(music_state_t state, int current_track,
                                  int total_tracks);
 
@@ -66,8 +82,9 @@ typedef enum {
   MUSIC_CMD_STOP = 1,
 } music_cmd_t;
 
-static void music_control_task(void *arg) {
+static esp_err_t music_control_work(void *arg) {
   music_cmd_t cmd = (music_cmd_t)(uintptr_t)arg;
+  esp_err_t err = ESP_OK;
 
   if (cmd == MUSIC_CMD_PLAY) {
     ESP_LOGI(TAG, "Music play requested (stopping voice pipeline first)");
@@ -77,6 +94,10 @@ static void music_control_task(void *arg) {
     // Increased wait time to ensure pipeline task processes the STOP command
     bool stopped = false;
     for (int i = 0; i < 40; i++) {
+      if (work_cancelled()) {
+        // A stop came in meanwhile; it restarts the pipeline
+        return ESP_ERR_INVALID_STATE;
+      }
       if (!voice_pipeline_is_running()) {
         stopped = true;
         break;
@@ -99,13 +120,15 @@ static void music_control_task(void *arg) {
     }
 
     if (local_music_player_is_initialized()) {
-      if (local_music_player_play() != ESP_OK) {
+      err = local_music_player_play();
+      if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to start music player");
         // Optional: Play error beep here if we had access to beep_tone
       }
     } else {
       ESP_LOGE(TAG,
                "Cannot play music: Player not initialized (SD not mounted?)");
+      err = ESP_ERR_INVALID_STATE;
     }
   } else if (cmd == MUSIC_CMD_STOP) {
     ESP_LOGI(TAG, "Music stop requested");
@@ -115,9 +138,16 @@ static void music_control_task(void *arg) {
     vTaskDelay(pdMS_TO_TICKS(150));
     voice_pipeline_start();
   }
+  return err;
+}
 
-  music_control_task_handle = NULL;
-  vTaskDelete(NULL);
+// Commands run in arrival order on the control lane; a new one drops the
+// previous one if it has not started, or cuts short its wait if it has
+static void music_submit(music_cmd_t cmd) {
+  work_cancel(music_item);
+  work_release(music_item);
+  work_submit(WORK_LANE_CONTROL, "music", music_control_work,
+              (void *)(uintptr_t)cmd, &music_item);
 }
 
 static const char *ota_state_to_string(ota_state_t state) {
@@ -253,6 +283,32 @@ static void mqtt_publish_telemetry(void) {
 
   mqtt_ha_update_switch("led_status_indicator", led_status_is_enabled());
   mqtt_ha_update_switch("wwd_enabled", voice_pipeline_is_running());
+
+  task_profile_summary_t prof;
+  task_profiler_get(NULL, 0, &prof);
+  if (prof.samples > 0) {
+    for (int c = 0; c < portNUM_PROCESSORS && c < 2; c++) {
+      snprintf(buf, sizeof(buf), "%u.%u", prof.core_load_permille[c] / 10,
+               prof.core_load_permille[c] % 10);
+      mqtt_ha_update_sensor(c == 0 ? "cpu_load_core0" : "cpu_load_core1", buf);
+    }
+    snprintf(buf, sizeof(buf), "%lu", (unsigned long)prof.tightest_free);
+    mqtt_ha_update_sensor("stack_min_free", buf);
+    mqtt_ha_update_sensor("stack_min_task", prof.tightest_task);
+  }
+
+  ha_rtt_stats_t rtt;
+  ha_client_get_rtt(&rtt);
+  if (rtt.samples > 0) {
+    const uint32_t us[] = {rtt.p50_us, rtt.p90_us, rtt.p99_us, rtt.jitter_us};
+    const char *ids[] = {"ha_rtt_p50", "ha_rtt_p90", "ha_rtt_p99",
+                         "ha_rtt_jitter"};
+    for (int i = 0; i < 4; i++) {
+      snprintf(buf, sizeof(buf), "%lu.%lu", (unsigned long)(us[i] / 1000),
+               (unsigned long)(us[i] % 1000 / 100));
+      mqtt_ha_update_sensor(ids[i], buf);
+    }
+  }
 }
 
 static void mqtt_metrics_task(void *arg) {
@@ -276,7 +332,7 @@ static void ota_progress_handler(ota_state_t state, int progress,
   mqtt_ha_update_sensor("ota_progress", buf);
 }
 
-static void post_connect_task(void *arg) {
+static esp_err_t post_connect_work(void *arg) {
   network_type_t type = (network_type_t)(uintptr_t)arg;
 
   char ip_str[16];
@@ -288,6 +344,15 @@ static void post_connect_task(void *arg) {
   ESP_LOGI(TAG, "Network Connected: %s (IP: %s)",
            network_manager_type_to_string(type), ip_str);
 
+  if (mqtt_reconnect_pending) {
+    // Blocks until the MQTT task has stopped, so not in the event callback
+    mqtt_reconnect_pending = false;
+    if (mqtt_ha_on_netif_change() == ESP_OK) {
+      for (int i = 0; i < 50 && !mqtt_ha_is_connected(); i++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+      }
+    }
+  }
   if (mqtt_ha_is_connected()) {
     mqtt_ha_update_sensor("ip_address", ip_str);
   }
@@ -297,18 +362,10 @@ static void post_connect_task(void *arg) {
   webserial_init();
 
   // SD/music init can be slow; keep it out of the network event loop task.
-  if (!sys_diag_is_safe_mode() && !sd_init_done &&
-      type == NETWORK_TYPE_ETHERNET) {
-    if (bsp_sdcard_mount() == ESP_OK) {
-      ESP_LOGI(TAG, "SD Card mounted");
-      local_music_player_init();
-      local_music_player_register_callback(NULL); // Or proper callback
-      sd_init_done = true;
-    }
+  if (!sys_diag_is_safe_mode() && type == NETWORK_TYPE_ETHERNET) {
+    sdcard_mount_music();
   }
-
-  post_connect_task_handle = NULL;
-  vTaskDelete(NULL);
+  return ESP_OK;
 }
 
 // MQTT Callbacks (Keep implementation same)
@@ -343,22 +400,14 @@ static void mqtt_music_play_callback(const char *entity_id,
                                      const char *payload) {
   (void)entity_id;
   (void)payload;
-  if (music_control_task_handle == NULL) {
-    xTaskCreate(music_control_task, "music_ctl", 4096,
-                (void *)(uintptr_t)MUSIC_CMD_PLAY, 5,
-                &music_control_task_handle);
-  }
+  music_submit(MUSIC_CMD_PLAY);
 }
 
 static void mqtt_music_stop_callback(const char *entity_id,
                                      const char *payload) {
   (void)entity_id;
   (void)payload;
-  if (music_control_task_handle == NULL) {
-    xTaskCreate(music_control_task, "music_ctl", 4096,
-                (void *)(uintptr_t)MUSIC_CMD_STOP, 5,
-                &music_control_task_handle);
-  }
+  music_submit(MUSIC_CMD_STOP);
 }
 
 static void mqtt_led_test_callback(const char *entity_id, const char *payload) {
@@ -388,6 +437,7 @@ static void mqtt_led_brightness_callback(const char *entity_id,
   uint8_t b = (uint8_t)lroundf(v);
   led_status_set_brightness(b);
   (void)mqtt_ha_update_number("led_brightness", (float)b);
+  (void)settings_manager_set_int(SETTING_LED_BRIGHTNESS, b);
 }
 
 static void mqtt_output_volume_callback(const char *entity_id,
@@ -418,12 +468,8 @@ static void mqtt_output_volume_callback(const char *entity_id,
   bsp_extra_codec_volume_set(vol, NULL);
   (void)mqtt_ha_update_number("output_volume", (float)vol);
 
-  // Persist to NVS
-  app_settings_t s;
-  if (settings_manager_load(&s) == ESP_OK) {
-    s.output_volume = vol;
-    (void)settings_manager_save(&s);
-  }
+  // Persist (coalesced: a slider drag ends up as one NVS write)
+  (void)settings_manager_set_int(SETTING_OUTPUT_VOLUME, vol);
 }
 
 static void mqtt_wwd_threshold_callback(const char *entity_id,
@@ -508,12 +554,7 @@ static void mqtt_ota_url_callback(const char *entity_id, const char *payload) {
   oled_status_set_ota_url_present(ota_url_value[0] != '\0');
 
   // Save to settings
-  app_settings_t s;
-  if (settings_manager_load(&s) == ESP_OK) {
-    strncpy(s.ota_url, ota_url_value, sizeof(s.ota_url) - 1);
-    s.ota_url[sizeof(s.ota_url) - 1] = '\0';
-    settings_manager_save(&s);
-  }
+  (void)settings_manager_set_str(SETTING_OTA_URL, ota_url_value);
 }
 
 static void mqtt_ota_trigger_callback(const char *entity_id,
@@ -629,6 +670,18 @@ static void mqtt_setup_task(void *arg) {
   mqtt_ha_register_sensor("ota_status", "OTA Status", NULL, NULL);
   mqtt_ha_register_sensor("ota_progress", "OTA Progress", "%", NULL);
   mqtt_ha_register_sensor("ota_update_url", "OTA Update URL", NULL, NULL);
+  mqtt_ha_register_sensor("cpu_load_core0", "CPU Load Core 0", "%", NULL);
+  mqtt_ha_register_sensor("cpu_load_core1", "CPU Load Core 1", "%", NULL);
+  mqtt_ha_register_sensor("stack_min_free", "Lowest Stack Headroom", "B",
+                          "data_size");
+  mqtt_ha_register_sensor("stack_min_task", "Lowest Stack Task", NULL, NULL);
+  mqtt_ha_register_sensor("ha_rtt_p50", "HA Round Trip p50", "ms", "duration");
+  mqtt_ha_register_sensor("ha_rtt_p90", "HA Round Trip p90", "ms", "duration");
+  mqtt_ha_register_sensor("ha_rtt_p99", "HA Round Trip p99", "ms", "duration");
+  mqtt_ha_register_sensor("ha_rtt_jitter", "HA Round Trip Jitter", "ms",
+                          "duration");
+  mqtt_ha_register_sensor("last_reset_context", "Last Reset Context", NULL,
+                          NULL);
 
   mqtt_ha_register_number("led_brightness", "LED Brightness", 0, 100, 1, "%",
                           mqtt_led_brightness_callback);
@@ -709,16 +762,25 @@ static void mqtt_setup_task(void *arg) {
 
 static void network_event_callback(network_type_t type, bool connected) {
   if (connected) {
-    if (post_connect_task_handle == NULL) {
-      xTaskCreate(post_connect_task, "net_post", 4096, (void *)(uintptr_t)type,
-                  5, &post_connect_task_handle);
+    if (network_was_up) {
+      // Failover or handover: the old sockets are dead, do not wait for
+      // their timeouts
+      ha_client_on_netif_change(true);
+      mqtt_reconnect_pending = true;
     }
+    network_was_up = true;
+    // Fresh address for the new network before TTS/OTA need it
+    dns_cache_prefetch(settings.ha_hostname);
+    // Skipped if the previous one is still running, as before
+    work_submit_once(&post_connect_item, WORK_LANE_NETWORK, "net_post",
+                     post_connect_work, (void *)(uintptr_t)type);
     if (type == NETWORK_TYPE_ETHERNET) {
       oled_status_set_last_event("eth-up");
     } else if (type == NETWORK_TYPE_WIFI) {
       oled_status_set_last_event("wifi-up");
     }
   } else {
+    ha_client_on_netif_change(false);
     if (type == NETWORK_TYPE_ETHERNET) {
       sdcard_release_for_wifi_fallback();
       oled_status_set_last_event("eth-down");
@@ -774,11 +836,25 @@ static void led_ready_task(void *arg) {
   }
 }
 
+// The card shares its slot with the ESP-Hosted WiFi link, so it is only
+// mounted once Ethernet has an IP (post_connect_task), after a reconnect too.
+static void sdcard_mount_music(void) {
+  xSemaphoreTake(sd_mutex, portMAX_DELAY);
+  if (!sd_init_done && bsp_sdcard_mount() == ESP_OK) {
+    ESP_LOGI(TAG, "SD Card mounted");
+    local_music_player_init();
+    local_music_player_register_callback(music_state_callback);
+    sd_init_done = true;
+  }
+  xSemaphoreGive(sd_mutex);
+}
+
 static void sdcard_release_for_wifi_fallback(void) {
   if (bsp_sdcard == NULL) {
     return;
   }
 
+  xSemaphoreTake(sd_mutex, portMAX_DELAY);
   ESP_LOGI(TAG, "Releasing SD card for WiFi fallback");
   if (local_music_player_is_initialized()) {
     local_music_player_deinit();
@@ -789,8 +865,104 @@ static void sdcard_release_for_wifi_fallback(void) {
     ESP_LOGW(TAG, "SD card unmount failed: %s", esp_err_to_name(ret));
   }
   sd_init_done = false;
+  xSemaphoreGive(sd_mutex);
 }
 
+// Boot graph (boot_seq). Steps without a path between them run concurrently:
+// the AFE model loads while Ethernet negotiates, and HA authenticates while
+// wake word detection is already listening.
+enum {
+  BOOT_CODEC,
+  BOOT_NET,
+  BOOT_MQTT,
+  BOOT_HA,
+  BOOT_VOICE,
+  BOOT_WAKE,
+  BOOT_STEP_COUNT
+};
+
+static esp_err_t boot_codec(void *arg) {
+  (void)arg;
+  esp_err_t err = bsp_extra_codec_init();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Codec init failed: %s", esp_err_to_name(err));
+    return err; // Voice and wake word are skipped, network still comes up
+  }
+  // Persisted output volume (default 60)
+  bsp_extra_codec_volume_set(settings.output_volume, NULL);
+  bsp_extra_player_init();
+  audio_hw_ready = true;
+  return ESP_OK;
+}
+
+static esp_err_t boot_net(void *arg) {
+  (void)arg;
+  network_manager_register_callback(network_event_callback);
+  return network_manager_init();
+}
+
+static esp_err_t boot_mqtt(void *arg) {
+  (void)arg;
+  mqtt_ha_config_t mqtt_conf = {
+      .broker_uri = settings.mqtt_broker_uri,
+      // Treat empty strings as "not set" so MQTT auth is truly optional.
+      .username =
+          (settings.mqtt_username[0] != '\0') ? settings.mqtt_username : NULL,
+      .password =
+          (settings.mqtt_password[0] != '\0') ? settings.mqtt_password : NULL,
+      .client_id = settings.mqtt_client_id};
+  esp_err_t err = mqtt_ha_init(&mqtt_conf);
+  return err == ESP_OK ? mqtt_ha_start() : err;
+}
+
+static esp_err_t boot_ha(void *arg) {
+  (void)arg;
+  ha_client_config_t ha_conf = {.hostname = settings.ha_hostname,
+                                .port = settings.ha_port,
+                                .access_token = settings.ha_token,
+                                .use_ssl = settings.ha_use_ssl};
+  // Waits up to 10 s for authentication; the client keeps reconnecting after
+  esp_err_t err = ha_client_init(&ha_conf);
+  return err == ESP_ERR_TIMEOUT ? ESP_OK : err;
+}
+
+static esp_err_t boot_voice(void *arg) {
+  (void)arg;
+  ESP_LOGI(TAG, "Initializing Voice Pipeline...");
+  esp_err_t err = voice_pipeline_init(); // Loads the AFE/WakeNet models
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Voice pipeline init failed: %s", esp_err_to_name(err));
+  }
+  return err;
+}
+
+static esp_err_t boot_wake(void *arg) {
+  (void)arg;
+  alarm_manager_init();
+
+  ESP_LOGI(TAG, "System Ready. Waiting for Wake Word...");
+  led_status_set(LED_STATUS_IDLE);
+  esp_err_t err = voice_pipeline_start();
+  if (err == ESP_OK) {
+    boot_seq_mark_wake_ready();
+  }
+  if (led_ready_task_handle == NULL) {
+    xTaskCreate(led_ready_task, "led_ready", 2048, NULL, 2,
+                &led_ready_task_handle);
+  }
+  return err;
+}
+
+static boot_step_t boot_steps[BOOT_STEP_COUNT] = {
+    [BOOT_CODEC] = {"boot_codec", boot_codec, 0, false, 6144},
+    [BOOT_NET] = {"boot_net", boot_net, 0, false, 8192},
+    [BOOT_MQTT] = {"boot_mqtt", boot_mqtt, BOOT_STEP(BOOT_NET), false, 0},
+    [BOOT_HA] = {"boot_ha", boot_ha, BOOT_STEP(BOOT_NET), false, 6144},
+    [BOOT_VOICE] = {"boot_voice", boot_voice, BOOT_STEP(BOOT_CODEC), false,
+                    12288},
+    [BOOT_WAKE] = {"boot_wake", boot_wake, BOOT_STEP(BOOT_VOICE), false, 0},
+};
+
 void app_main(void) {
   // 1. NVS Init
   esp_err_t ret = nvs_flash_init();
@@ -800,9 +972,11 @@ void app_main(void) {
     ret = nvs_flash_init();
   }
   ESP_ERROR_CHECK(ret);
+  settings_manager_init(); // Migrate the settings schema, fill the RAM cache
 
   // 2. System Diagnostics (Boot Loop Protection)
   bool safe_mode = (sys_diag_init() != ESP_OK);
+  flight_recorder_init(); // Adopt the previous boot's record before logging
 
   if (safe_mode) {
     ESP_LOGE(TAG, "STARTING IN SAFE MODE (Audio disabled)");
@@ -811,21 +985,27 @@ void app_main(void) {
     led_status_set(LED_STATUS_ERROR); // Red Blink
   } else {
     ESP_LOGI(TAG, "Starting ESP32-P4 Voice Assistant (Normal Mode)");
-    // 3. Hardware Init (Codec, LED)
-    ESP_LOGI(TAG, "Initializing Hardware...");
-    ESP_ERROR_CHECK(bsp_extra_codec_init());
-    bsp_extra_codec_volume_set(60, NULL);
-    bsp_extra_player_init();
-    audio_hw_ready = true;
+    // Carve the audio buffers before anything else fragments the heap
+    if (mem_budget_init() != ESP_OK) {
+      ESP_LOGW(TAG, "Audio memory budget does not fit, using heap fallback");
+    }
 
+    // 3. LED (the codec comes up in the boot graph)
     led_status_init();
     led_status_set(LED_STATUS_BOOTING);
   }
+  sd_mutex = xSemaphoreCreateMutex();
 
   oled_status_init();
   oled_status_set_safe_mode(safe_mode);
   oled_status_set_last_event(safe_mode ? "safe-on" : "boot");
 
+  // Workers for MQTT/HA commands and reconnects; before anything submits
+  work_queue_init();
+
+  // Shared by HA, TTS, OTA and MQTT; before anything connects
+  dns_cache_init();
+
   // OTA module (available in both normal and safe mode)
   ota_update_init();
   ota_update_register_callback(ota_progress_handler);
@@ -833,16 +1013,15 @@ void app_main(void) {
   // 4. Watchdog Init (30 seconds timeout)
   sys_diag_wdt_init(30);
 
-  // 5. Load Settings
-  app_settings_t settings;
+  // Per-task CPU/stack sampling (/api/tasks + MQTT), same cadence as telemetry
+  task_profiler_start(5000);
+  flight_recorder_start(1000);
+
+  // 5. Load Settings (read by the boot steps below)
   if (settings_manager_load(&settings) != ESP_OK) {
     ESP_LOGE(TAG, "Failed to load settings!");
   }
-
-  // Apply persisted output volume (default 60)
-  if (!safe_mode) {
-    bsp_extra_codec_volume_set(settings.output_volume, NULL);
-  }
+  led_status_set_brightness((uint8_t)settings.led_brightness);
 
   // Load persisted OTA URL
   if (settings.ota_url[0] != '\0') {
@@ -852,50 +1031,26 @@ void app_main(void) {
   }
   oled_status_set_ota_url_present(ota_url_value[0] != '\0');
 
-  // 6. Network Init
-  network_manager_register_callback(network_event_callback);
-  network_manager_init();
-
-  mqtt_ha_config_t mqtt_conf = {
-      .broker_uri = settings.mqtt_broker_uri,
-      // Treat empty strings as "not set" so MQTT auth is truly optional.
-      .username =
-          (settings.mqtt_username[0] != '\0') ? settings.mqtt_username : NULL,
-      .password =
-          (settings.mqtt_password[0] != '\0') ? settings.mqtt_password : NULL,
-      .client_id = settings.mqtt_client_id};
-  mqtt_ha_init(&mqtt_conf);
-  mqtt_ha_start();
-
-  // 7. Core Systems (Skip in Safe Mode)
-  if (!safe_mode) {
-    ha_client_config_t ha_conf = {.hostname = settings.ha_hostname,
-                                  .port = settings.ha_port,
-                                  .access_token = settings.ha_token,
-                                  .use_ssl = settings.ha_use_ssl};
-    ha_client_init(&ha_conf);
-
-    ESP_LOGI(TAG, "Initializing Voice Pipeline...");
-    ESP_ERROR_CHECK(voice_pipeline_init());
-
-    alarm_manager_init();
-    local_music_player_register_callback(music_state_callback);
+  // 6. Network, audio and HA bring-up (Safe Mode: network + MQTT only)
+  boot_steps[BOOT_CODEC].skip = safe_mode;
+  boot_steps[BOOT_HA].skip = safe_mode;
+  boot_steps[BOOT_VOICE].skip = safe_mode;
+  boot_steps[BOOT_WAKE].skip = safe_mode;
+  esp_err_t boot_err =
+      boot_seq_run(boot_steps, BOOT_STEP_COUNT, NULL, BOOT_TIMEOUT_MS);
+  if (boot_err != ESP_OK) {
+    ESP_LOGW(TAG, "Boot finished with errors: %s", esp_err_to_name(boot_err));
+  }
 
-    ESP_LOGI(TAG, "System Ready. Waiting for Wake Word...");
-    led_status_set(LED_STATUS_IDLE);
-    voice_pipeline_start();
-    if (led_ready_task_handle == NULL) {
-      xTaskCreate(led_ready_task, "led_ready", 2048, NULL, 2,
-                  &led_ready_task_handle);
-    }
-  } else {
-    // Safe Mode Loop
+  if (safe_mode) {
     ESP_LOGW(TAG, "Safe Mode: Use Web/OTA to fix issues.");
   }
 
   xTaskCreate(mqtt_setup_task, "mqtt_setup", 4096, NULL, 5, NULL);
 
-  // Main Loop - Keep main task alive to feed watchdog
+  // Main Loop - Keep main task alive to feed watchdog. Stall-checked from
+  // here on; boot waits were idle for the soft watchdog
+  sys_diag_activity("main_loop");
   while (1) {
     sys_diag_wdt_feed();
     vTaskDelay(pdMS_TO_TICKS(1000));
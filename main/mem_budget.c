@@ -0,0 +1,172 @@
+/**
+ * @file mem_budget.c
+ * @brief Boot-time arena for steady-state audio buffers
+ *
+ * Sizes mirror the owners' worst cases. A request larger than its block
+ * falls back to a plain heap allocation, so a stale entry here degrades to
+ * the old behaviour instead of corrupting memory.
+ */
+
+#include "mem_budget.h"
+#include "alloc_trace.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "mp3dec.h"
+
+static const char *TAG = "mem_budget";
+
+// Blocks start on a cache line so PSRAM buffers never share one
+#define BLOCK_ALIGN 64
+#define ALIGN_UP(n) (((n) + BLOCK_ALIGN - 1) & ~(size_t)(BLOCK_ALIGN - 1))
+
+// Internal RAM that must stay free after carving (Wi-Fi, lwIP, TLS)
+#define INTERNAL_HEADROOM_MIN (48 * 1024)
+
+#define FEED_FRAME_SAMPLES 512 // audio_capture I2S_READ_LEN
+#define AFE_CHUNK_MAX 2048     // Largest AFE fetch chunk streamed to HA
+#define BEEP_MAX_SAMPLES 16000 // beep_tone: 1000 ms at 16 kHz
+#define HA_REPLAY_BYTES (8 * 16000 * sizeof(int16_t)) // ha_failover: 8 s
+
+typedef struct {
+  const char *name;
+  alloc_tag_t owner;
+  size_t size;
+  mem_region_t region;
+} budget_entry_t;
+
+static const budget_entry_t budget[MEM_BLOCK_COUNT] = {
+    [MEM_BLOCK_FEED_MIC] = {"feed_mic", ALLOC_TAG_AUDIO_CAPTURE,
+                            FEED_FRAME_SAMPLES * sizeof(int16_t),
+                            MEM_REGION_INTERNAL},
+    [MEM_BLOCK_FEED_REF] = {"feed_ref", ALLOC_TAG_AUDIO_CAPTURE,
+                            FEED_FRAME_SAMPLES * sizeof(int16_t),
+                            MEM_REGION_INTERNAL},
+    [MEM_BLOCK_FEED_AFE] = {"feed_afe", ALLOC_TAG_AUDIO_CAPTURE,
+                            FEED_FRAME_SAMPLES * 2 * sizeof(int16_t),
+                            MEM_REGION_INTERNAL},
+    [MEM_BLOCK_HA_AUDIO_FRAME] = {"audio_frame", ALLOC_TAG_HA_CLIENT,
+                                  1 + AFE_CHUNK_MAX, MEM_REGION_INTERNAL},
+    [MEM_BLOCK_BEEP_PCM] = {"beep_pcm", ALLOC_TAG_BEEP,
+                            BEEP_MAX_SAMPLES * sizeof(int16_t),
+                            MEM_REGION_PSRAM},
+    [MEM_BLOCK_TTS_PCM] = {"tts_pcm", ALLOC_TAG_TTS,
+                           MAX_NCHAN * MAX_NSAMP * sizeof(int16_t),
+                           MEM_REGION_INTERNAL},
+    [MEM_BLOCK_TTS_MP3] = {"tts_mp3", ALLOC_TAG_TTS, 128 * 1024,
+                           MEM_REGION_PSRAM},
+    [MEM_BLOCK_HA_REPLAY] = {"stt_replay", ALLOC_TAG_HA_CLIENT,
+                             HA_REPLAY_BYTES, MEM_REGION_PSRAM},
+};
+
+static const char *const region_names[MEM_REGION_COUNT] = {
+    [MEM_REGION_INTERNAL] = "internal",
+    [MEM_REGION_PSRAM] = "psram",
+};
+
+static const uint32_t region_caps[MEM_REGION_COUNT] = {
+    [MEM_REGION_INTERNAL] = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+    [MEM_REGION_PSRAM] = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+};
+
+static uint8_t *arena[MEM_REGION_COUNT];
+static size_t arena_size[MEM_REGION_COUNT];
+static void *blocks[MEM_BLOCK_COUNT];
+static bool initialized = false;
+static uint32_t fallbacks = 0;
+
+esp_err_t mem_budget_init(void) {
+  if (initialized) {
+    return mem_budget_fits() ? ESP_OK : ESP_ERR_NO_MEM;
+  }
+
+  for (int b = 0; b < MEM_BLOCK_COUNT; b++) {
+    arena_size[budget[b].region] += ALIGN_UP(budget[b].size);
+  }
+
+  for (int r = 0; r < MEM_REGION_COUNT; r++) {
+    if (arena_size[r] == 0) {
+      continue;
+    }
+    arena[r] = heap_caps_aligned_alloc(BLOCK_ALIGN, arena_size[r],
+                                       region_caps[r]);
+    if (arena[r] == NULL) {
+      ESP_LOGE(TAG, "%s arena of %u B does not fit (largest free block %u B)",
+               region_names[r], (unsigned)arena_size[r],
+               (unsigned)heap_caps_get_largest_free_block(region_caps[r]));
+    }
+  }
+
+  size_t offset[MEM_REGION_COUNT] = {0};
+  for (int b = 0; b < MEM_BLOCK_COUNT; b++) {
+    mem_region_t r = budget[b].region;
+    if (arena[r] != NULL) {
+      blocks[b] = arena[r] + offset[r];
+      offset[r] += ALIGN_UP(budget[b].size);
+    }
+  }
+  initialized = true;
+
+  mem_budget_report();
+  return mem_budget_fits() ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void *mem_budget_acquire(mem_block_t block, size_t len) {
+  if (block >= MEM_BLOCK_COUNT) {
+    return NULL;
+  }
+  if (blocks[block] != NULL && len <= budget[block].size) {
+    return blocks[block];
+  }
+
+  // Counted once per owner acquire, not per frame, so it stays readable
+  fallbacks++;
+  if (blocks[block] != NULL) {
+    ESP_LOGW(TAG, "%s: %u B requested, budget is %u B - using heap",
+             budget[block].name, (unsigned)len, (unsigned)budget[block].size);
+  }
+  return TRACE_MALLOC(budget[block].owner, len);
+}
+
+void mem_budget_release(mem_block_t block, void *ptr) {
+  if (ptr == NULL || block >= MEM_BLOCK_COUNT || ptr == blocks[block]) {
+    return;
+  }
+  TRACE_FREE(ptr);
+}
+
+uint32_t mem_budget_fallbacks(void) { return fallbacks; }
+
+bool mem_budget_fits(void) {
+  for (int r = 0; r < MEM_REGION_COUNT; r++) {
+    if (arena_size[r] > 0 && arena[r] == NULL) {
+      return false;
+    }
+  }
+  return initialized;
+}
+
+void mem_budget_report(void) {
+  ESP_LOGI(TAG, "%-12s %-14s %-8s %7s", "block", "module", "region",
+           "bytes");
+  for (int b = 0; b < MEM_BLOCK_COUNT; b++) {
+    ESP_LOGI(TAG, "%-12s %-14s %-8s %7u%s", budget[b].name,
+             alloc_trace_tag_name(budget[b].owner),
+             region_names[budget[b].region], (unsigned)budget[b].size,
+             blocks[b] ? "" : "  (heap fallback)");
+  }
+
+  for (int r = 0; r < MEM_REGION_COUNT; r++) {
+    size_t free_bytes = heap_caps_get_free_size(region_caps[r]);
+    ESP_LOGI(TAG, "%-8s budget %7u B %-12s free after %7u B", region_names[r],
+             (unsigned)arena_size[r],
+             arena[r] || arena_size[r] == 0 ? "fits," : "DOES NOT FIT,",
+             (unsigned)free_bytes);
+    if (r == MEM_REGION_INTERNAL && free_bytes < INTERNAL_HEADROOM_MIN) {
+      ESP_LOGW(TAG, "Internal headroom below %u B - network stack may starve",
+               (unsigned)INTERNAL_HEADROOM_MIN);
+    }
+  }
+  if (fallbacks) {
+    ESP_LOGW(TAG, "%lu heap fallbacks since boot", (unsigned long)fallbacks);
+  }
+}
@@ -0,0 +1,93 @@
+/**
+ * @file mem_budget.h
+ * @brief Boot-time arena for steady-state audio buffers
+ *
+ * Every buffer the audio path needs on each conversation is declared once
+ * in a budget table (size, internal RAM or PSRAM, owning module) and carved
+ * from one arena per region at boot. Owners take their block with
+ * mem_budget_acquire() instead of allocating, so a wake word -> TTS cycle
+ * does not touch the heap for audio. The boot log reports whether the
+ * budget fits and how much headroom each region keeps.
+ *
+ * Each block has exactly one owner and is used by one task at a time; the
+ * arena does no locking.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  MEM_BLOCK_FEED_MIC,       ///< audio_capture feed task: mic frame
+  MEM_BLOCK_FEED_REF,       ///< audio_capture feed task: playback reference
+  MEM_BLOCK_FEED_AFE,       ///< audio_capture feed task: interleaved mic+ref
+  MEM_BLOCK_HA_AUDIO_FRAME, ///< ha_client: handler id + one AFE chunk
+  MEM_BLOCK_BEEP_PCM,       ///< beep_tone: longest beep (1 s mono 16 kHz)
+  MEM_BLOCK_TTS_PCM,        ///< tts_player: one decoded MP3 frame
+  MEM_BLOCK_TTS_MP3,        ///< tts_player: accumulated MP3 response
+  MEM_BLOCK_HA_REPLAY,      ///< ha_client: STT audio of the current run
+  MEM_BLOCK_COUNT
+} mem_block_t;
+
+typedef enum {
+  MEM_REGION_INTERNAL,
+  MEM_REGION_PSRAM,
+  MEM_REGION_COUNT
+} mem_region_t;
+
+/**
+ * @brief Carve all blocks from their region arenas and log the budget report
+ *
+ * Call once early in app_main, before any owner starts. A region whose
+ * arena cannot be allocated leaves its blocks unset; owners then fall back
+ * to heap allocation and the report says the budget does not fit.
+ *
+ * @return ESP_OK if every region fits, ESP_ERR_NO_MEM otherwise
+ */
+esp_err_t mem_budget_init(void);
+
+/**
+ * @brief Take a block for @p len bytes
+ *
+ * Returns the preallocated block when it was carved and is large enough.
+ * Otherwise the memory comes from the heap (traced under the owner's
+ * alloc_trace tag) and is counted in mem_budget_fallbacks().
+ *
+ * @param block Block id
+ * @param len Bytes the caller needs
+ * @return Memory for @p len bytes, or NULL if the heap fallback failed
+ */
+void *mem_budget_acquire(mem_block_t block, size_t len);
+
+/**
+ * @brief Return memory from mem_budget_acquire()
+ *
+ * Arena blocks stay reserved; only heap fallbacks are freed.
+ */
+void mem_budget_release(mem_block_t block, void *ptr);
+
+/**
+ * @brief Heap fallbacks since boot (0 when the budget covers every use)
+ */
+uint32_t mem_budget_fallbacks(void);
+
+/**
+ * @brief True if every region's arena was allocated at boot
+ */
+bool mem_budget_fits(void);
+
+/**
+ * @brief Log the budget table and current headroom per region
+ */
+void mem_budget_report(void);
+
+#ifdef __cplusplus
+}
+#endif
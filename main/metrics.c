@@ -0,0 +1,524 @@
+/**
+ * @file metrics.c
+ * @brief Fixed metrics registry with Prometheus text exposition
+ *
+ * Rendering uses the caller's buffer, static task tables and integer printf
+ * conversions only (newlib's %f path can allocate), so a scrape never
+ * touches the heap.
+ */
+
+#include "metrics.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define METRICS_MAX_BUCKETS 10
+// Tasks one scrape can list; with more, the scrape lists none and counts it
+#define METRICS_MAX_TASKS 64
+
+typedef struct {
+  const char *name;
+  const char *labels; ///< Rendered verbatim inside {}, or NULL
+  const char *help;
+} metric_desc_t;
+
+typedef struct {
+  metric_desc_t desc;
+  const uint32_t *bounds_us; ///< Upper bucket bounds, ascending
+  uint8_t nbounds;
+} hist_desc_t;
+
+typedef struct {
+  uint32_t buckets[METRICS_MAX_BUCKETS + 1]; ///< Not cumulative; last is +Inf
+  uint32_t count;
+  uint64_t sum_us;
+} hist_data_t;
+
+// Entries of one family must be adjacent, HELP/TYPE is printed once per name
+static const metric_desc_t counter_desc[METRIC_COUNTER_COUNT] = {
+    [METRIC_HA_RECONNECTS] = {"va_ha_reconnects_total", NULL,
+                              "Home Assistant reconnects after send failures"},
+    [METRIC_HA_WS_DISCONNECTS] = {"va_ha_ws_disconnects_total", NULL,
+                                  "Home Assistant WebSocket disconnects"},
+    [METRIC_MQTT_DISCONNECTS] = {"va_mqtt_disconnects_total", NULL,
+                                 "MQTT broker disconnects"},
+    [METRIC_AFE_FRAMES_FED] = {"va_afe_frames_total", NULL,
+                               "Audio frames fed to the AFE"},
+    [METRIC_AFE_DROPS_LATE] = {"va_afe_dropped_frames_total",
+                               "reason=\"feed_late\"",
+                               "Audio frames lost before reaching the AFE"},
+    [METRIC_AFE_DROPS_RING] = {"va_afe_dropped_frames_total",
+                               "reason=\"ring_full\"", NULL},
+    [METRIC_AFE_FETCH_ERRORS] = {"va_afe_fetch_errors_total", NULL,
+                                 "AFE fetch calls without a result"},
+    [METRIC_PIPELINE_RUNS] = {"va_pipeline_runs_total", NULL,
+                              "Voice pipeline runs started"},
+    [METRIC_PIPELINE_ERRORS] = {"va_pipeline_errors_total", NULL,
+                                "Voice pipeline errors and HA timeouts"},
+    [METRIC_OTA_NET_BYTES] = {"va_ota_bytes_total", "stage=\"network\"",
+                              "OTA image bytes processed"},
+    [METRIC_OTA_FLASH_BYTES] = {"va_ota_bytes_total", "stage=\"flash\"",
+                                NULL},
+    [METRIC_NET_FAILOVERS] = {"va_network_failovers_total", NULL,
+                              "Active network path lost and an IP regained"},
+    [METRIC_HA_RUNS_REPLAYED] = {"va_ha_runs_replayed_total", NULL,
+                                 "Voice runs replayed after a reconnect"},
+    [METRIC_DNS_HITS] = {"va_dns_lookups_total", "result=\"hit\"",
+                         "Host name lookups by cache result"},
+    [METRIC_DNS_STALE] = {"va_dns_lookups_total", "result=\"stale\"", NULL},
+    [METRIC_DNS_MISSES] = {"va_dns_lookups_total", "result=\"miss\"", NULL},
+    [METRIC_DNS_FAILURES] = {"va_dns_resolve_failures_total", NULL,
+                             "Host name resolutions that failed"},
+    [METRIC_WORK_REJECTED] = {"va_work_rejected_total", NULL,
+                              "Work items rejected with the pool full"},
+    [METRIC_HA_EVENTS_DROPPED] = {"va_ha_events_dropped_total", NULL,
+                                  "HA messages dropped (too large or queue "
+                                  "full)"},
+    [METRIC_HA_TTS_EARLY] = {"va_ha_tts_fetches_total", "source=\"run_start\"",
+                             "TTS responses by where the audio came from"},
+    [METRIC_HA_TTS_END] = {"va_ha_tts_fetches_total", "source=\"tts_end\"",
+                           NULL},
+    [METRIC_HA_TTS_FALLBACK] = {"va_ha_tts_fetches_total",
+                                "source=\"tts_end_fallback\"", NULL},
+    [METRIC_HA_PONGS_MISSED] = {"va_ha_pongs_missed_total", NULL,
+                                "HA pings without a pong in time"},
+};
+
+static const metric_desc_t gauge_desc[METRIC_GAUGE_COUNT] = {
+    [METRIC_GAUGE_HA_CONNECTED] = {"va_ha_connected", NULL,
+                                   "Home Assistant API authenticated"},
+    [METRIC_GAUGE_MQTT_CONNECTED] = {"va_mqtt_connected", NULL,
+                                     "MQTT broker connected"},
+    [METRIC_GAUGE_OTA_NET_BPS] = {"va_ota_throughput_bytes_per_second",
+                                  "stage=\"network\"",
+                                  "Throughput of the current or last OTA"},
+    [METRIC_GAUGE_OTA_FLASH_BPS] = {"va_ota_throughput_bytes_per_second",
+                                    "stage=\"flash\"", NULL},
+    [METRIC_GAUGE_OTA_TOTAL_BPS] = {"va_ota_throughput_bytes_per_second",
+                                    "stage=\"end_to_end\"", NULL},
+    [METRIC_GAUGE_OTA_LAST_MS] = {"va_ota_last_update_milliseconds",
+                                  "part=\"total\"",
+                                  "Duration of the last OTA and time spent "
+                                  "yielding to the voice pipeline"},
+    [METRIC_GAUGE_OTA_THROTTLED_MS] = {"va_ota_last_update_milliseconds",
+                                       "part=\"throttled\"", NULL},
+    [METRIC_GAUGE_OTA_PAUSED_MS] = {"va_ota_last_update_milliseconds",
+                                    "part=\"flash_paused\"", NULL},
+    [METRIC_GAUGE_OTA_AFE_DROPS] = {"va_ota_last_update_afe_drops", NULL,
+                                    "AFE frames dropped during the last OTA"},
+    [METRIC_GAUGE_BOOT_WAKE_READY_MS] = {"va_boot_milliseconds",
+                                         "phase=\"wake_ready\"",
+                                         "Time from boot to wake word "
+                                         "detection and to all boot steps "
+                                         "done"},
+    [METRIC_GAUGE_BOOT_STEPS_MS] = {"va_boot_milliseconds",
+                                    "phase=\"steps_done\"", NULL},
+    [METRIC_GAUGE_NET_TIME_TO_IP_MS] = {"va_network_milliseconds",
+                                        "phase=\"time_to_ip\"",
+                                        "Time from network start to the first "
+                                        "IP and outage of the last failover"},
+    [METRIC_GAUGE_NET_FAILOVER_MS] = {"va_network_milliseconds",
+                                      "phase=\"last_failover\"", NULL},
+    [METRIC_GAUGE_HA_UNAVAILABLE_MS] = {"va_ha_unavailable_milliseconds", NULL,
+                                        "Last Home Assistant outage, from "
+                                        "connection loss to authenticated"},
+    [METRIC_GAUGE_HA_EVENT_QUEUE_DEPTH] = {"va_ha_event_queue_depth",
+                                           "kind=\"current\"",
+                                           "HA messages waiting to be handled"},
+    [METRIC_GAUGE_HA_EVENT_QUEUE_PEAK] = {"va_ha_event_queue_depth",
+                                          "kind=\"peak\"", NULL},
+    [METRIC_GAUGE_HA_ENTITIES] = {"va_ha_entities", NULL,
+                                  "Home Assistant entities mirrored locally"},
+};
+
+// 250 us .. 250 ms: a 32 ms audio frame should normally leave in < 1 ms
+static const uint32_t ws_send_bounds[] = {250,   500,   1000,   2000,   5000,
+                                          10000, 25000, 50000, 100000, 250000};
+// 1 ms .. 5 s: unicast DNS answers in ms, an unanswered mDNS query times out
+static const uint32_t dns_bounds[] = {1000,   5000,   10000,   25000,  50000,
+                                      100000, 250000, 1000000, 5000000};
+// 100 us .. 5 s: an idle lane starts at once, a busy one waits for its head
+static const uint32_t work_bounds[] = {100,    1000,    5000,    25000,
+                                       100000, 1000000, 5000000};
+// 1 ms .. 5 s: LAN answers in a few ms, a congested uplink in seconds
+static const uint32_t rtt_bounds[] = {1000,   2500,   5000,   10000,   25000,
+                                      50000,  100000, 250000, 1000000, 5000000};
+static const uint32_t stage_bounds[] = {50000,   100000,  250000,  500000,
+                                        1000000, 2000000, 5000000, 10000000};
+
+#define HIST(name_, labels_, help_, bounds_)                                   \
+  {{name_, labels_, help_},                                                    \
+   bounds_,                                                                    \
+   sizeof(bounds_) / sizeof(bounds_[0])}
+
+static const hist_desc_t hist_desc[METRIC_HIST_COUNT] = {
+    [METRIC_HIST_WS_SEND] = HIST("va_ws_send_seconds", NULL,
+                                 "Time to send one audio frame to HA",
+                                 ws_send_bounds),
+    [METRIC_HIST_STAGE_WAKE] = HIST("va_pipeline_stage_seconds",
+                                    "stage=\"wake_to_stream\"",
+                                    "Voice pipeline stage latency",
+                                    stage_bounds),
+    [METRIC_HIST_STAGE_STT] = HIST("va_pipeline_stage_seconds",
+                                   "stage=\"speech_end_to_stt\"", NULL,
+                                   stage_bounds),
+    [METRIC_HIST_STAGE_INTENT] = HIST("va_pipeline_stage_seconds",
+                                      "stage=\"stt_to_intent\"", NULL,
+                                      stage_bounds),
+    [METRIC_HIST_STAGE_TTS_FIRST] = HIST("va_pipeline_stage_seconds",
+                                         "stage=\"intent_to_tts\"", NULL,
+                                         stage_bounds),
+    [METRIC_HIST_STAGE_TTS_PLAY] = HIST("va_pipeline_stage_seconds",
+                                        "stage=\"tts_playback\"", NULL,
+                                        stage_bounds),
+    [METRIC_HIST_STAGE_RESPONSE] = HIST("va_pipeline_stage_seconds",
+                                        "stage=\"speech_end_to_tts\"", NULL,
+                                        stage_bounds),
+    [METRIC_HIST_DNS_RESOLVE] = HIST("va_dns_resolve_seconds", NULL,
+                                     "Time to resolve a host name",
+                                     dns_bounds),
+    [METRIC_HIST_WORK_DISPATCH] = HIST("va_work_dispatch_seconds", NULL,
+                                       "Time a work item waited for a worker",
+                                       work_bounds),
+    [METRIC_HIST_HA_EVENT_DISPATCH] = HIST("va_ha_event_dispatch_seconds", NULL,
+                                           "Time from receiving an HA message "
+                                           "to handling it",
+                                           work_bounds),
+    [METRIC_HIST_HA_RTT] = HIST("va_ha_rtt_seconds", NULL,
+                                "HA WebSocket ping round trip", rtt_bounds),
+    [METRIC_HIST_HA_ENTITIES_APPLY] = HIST(
+        "va_ha_entities_apply_seconds", NULL,
+        "Time to apply one entity state update to the local mirror",
+        work_bounds),
+};
+
+static _Atomic uint32_t counters[METRIC_COUNTER_COUNT];
+static _Atomic int32_t gauges[METRIC_GAUGE_COUNT];
+static hist_data_t hists[METRIC_HIST_COUNT];
+static portMUX_TYPE hist_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Task run-time counters are 32-bit microseconds and wrap every ~71 minutes;
+// accumulate them into 64 bits between scrapes.
+typedef struct {
+  TaskHandle_t handle;
+  uint32_t last;
+  uint64_t total;
+  bool seen;
+} task_runtime_t;
+
+// Only touched by metrics_render(), which has one caller at a time
+static TaskStatus_t task_status[METRICS_MAX_TASKS];
+static task_runtime_t task_runtime[METRICS_MAX_TASKS];
+static uint32_t task_list_truncated = 0;
+
+void metrics_inc(metric_counter_t id) { metrics_add(id, 1); }
+
+void metrics_add(metric_counter_t id, uint32_t n) {
+  if (id < METRIC_COUNTER_COUNT) {
+    atomic_fetch_add_explicit(&counters[id], n, memory_order_relaxed);
+  }
+}
+
+void metrics_gauge_set(metric_gauge_t id, int32_t value) {
+  if (id < METRIC_GAUGE_COUNT) {
+    atomic_store_explicit(&gauges[id], value, memory_order_relaxed);
+  }
+}
+
+uint32_t metrics_get(metric_counter_t id) {
+  if (id >= METRIC_COUNTER_COUNT) {
+    return 0;
+  }
+  return atomic_load_explicit(&counters[id], memory_order_relaxed);
+}
+
+void metrics_observe(metric_hist_t id, uint32_t value_us) {
+  if (id >= METRIC_HIST_COUNT) {
+    return;
+  }
+  const hist_desc_t *d = &hist_desc[id];
+  uint8_t b = 0;
+  while (b < d->nbounds && value_us > d->bounds_us[b]) {
+    b++;
+  }
+
+  portENTER_CRITICAL_SAFE(&hist_mux);
+  hists[id].buckets[b]++;
+  hists[id].count++;
+  hists[id].sum_us += value_us;
+  portEXIT_CRITICAL_SAFE(&hist_mux);
+}
+
+// -----------------------------------------------------------------------------
+// Rendering
+// -----------------------------------------------------------------------------
+
+typedef struct {
+  char *buf;
+  size_t cap;
+  size_t len;
+  metrics_sink_t sink;
+  void *ctx;
+  esp_err_t err;
+} metrics_out_t;
+
+static void out_flush(metrics_out_t *o) {
+  if (o->err == ESP_OK && o->len > 0) {
+    o->err = o->sink(o->ctx, o->buf, o->len);
+  }
+  o->len = 0;
+}
+
+static void out_printf(metrics_out_t *o, const char *fmt, ...) {
+  for (int attempt = 0; attempt < 2 && o->err == ESP_OK; attempt++) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+      return;
+    }
+    if ((size_t)n < o->cap - o->len) {
+      o->len += (size_t)n;
+      return;
+    }
+    if (o->len == 0) {
+      // Longer than the whole buffer: truncate, still ending the line
+      o->len = o->cap - 1;
+      o->buf[o->len - 1] = '\n';
+      return;
+    }
+    out_flush(o); // Retry the line in an empty buffer
+  }
+}
+
+/**
+ * Format microseconds as decimal seconds without trailing zeros
+ */
+static void format_seconds(char *out, size_t out_len, uint64_t us) {
+  uint32_t frac = (uint32_t)(us % 1000000);
+  int digits = 6;
+
+  if (frac == 0) {
+    snprintf(out, out_len, "%" PRIu64, us / 1000000);
+    return;
+  }
+  while (frac % 10 == 0) {
+    frac /= 10;
+    digits--;
+  }
+  snprintf(out, out_len, "%" PRIu64 ".%0*" PRIu32, us / 1000000, digits, frac);
+}
+
+static void out_header(metrics_out_t *o, const metric_desc_t *d,
+                       const metric_desc_t *prev, const char *type) {
+  if (prev && strcmp(prev->name, d->name) == 0) {
+    return;
+  }
+  // Separate lines: together they can exceed the smallest buffer
+  out_printf(o, "# HELP %s %s\n", d->name, d->help ? d->help : "");
+  out_printf(o, "# TYPE %s %s\n", d->name, type);
+}
+
+static void render_registry(metrics_out_t *o) {
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    const metric_desc_t *d = &counter_desc[i];
+    out_header(o, d, i > 0 ? &counter_desc[i - 1] : NULL, "counter");
+    out_printf(o, "%s%s%s%s %" PRIu32 "\n", d->name, d->labels ? "{" : "",
+               d->labels ? d->labels : "", d->labels ? "}" : "",
+               atomic_load_explicit(&counters[i], memory_order_relaxed));
+  }
+
+  for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+    const metric_desc_t *d = &gauge_desc[i];
+    out_header(o, d, i > 0 ? &gauge_desc[i - 1] : NULL, "gauge");
+    out_printf(o, "%s%s%s%s %" PRId32 "\n", d->name, d->labels ? "{" : "",
+               d->labels ? d->labels : "", d->labels ? "}" : "",
+               atomic_load_explicit(&gauges[i], memory_order_relaxed));
+  }
+
+  for (int i = 0; i < METRIC_HIST_COUNT; i++) {
+    const hist_desc_t *d = &hist_desc[i];
+    hist_data_t snap;
+    char num[24];
+
+    portENTER_CRITICAL(&hist_mux);
+    snap = hists[i];
+    portEXIT_CRITICAL(&hist_mux);
+
+    out_header(o, &d->desc, i > 0 ? &hist_desc[i - 1].desc : NULL,
+               "histogram");
+    const char *labels = d->desc.labels ? d->desc.labels : "";
+    const char *sep = d->desc.labels ? "," : "";
+    uint32_t cumulative = 0;
+    for (int b = 0; b < d->nbounds; b++) {
+      cumulative += snap.buckets[b];
+      format_seconds(num, sizeof(num), d->bounds_us[b]);
+      out_printf(o, "%s_bucket{%s%sle=\"%s\"} %" PRIu32 "\n", d->desc.name,
+                 labels, sep, num, cumulative);
+    }
+    out_printf(o, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu32 "\n", d->desc.name,
+               labels, sep, snap.count);
+    format_seconds(num, sizeof(num), snap.sum_us);
+    out_printf(o, "%s_sum%s%s%s %s\n%s_count%s%s%s %" PRIu32 "\n",
+               d->desc.name, d->desc.labels ? "{" : "", labels,
+               d->desc.labels ? "}" : "", num, d->desc.name,
+               d->desc.labels ? "{" : "", labels, d->desc.labels ? "}" : "",
+               snap.count);
+  }
+}
+
+static void render_heap(metrics_out_t *o) {
+  static const struct {
+    const char *region;
+    uint32_t caps;
+  } regions[] = {{"internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT},
+                 {"psram", MALLOC_CAP_SPIRAM}};
+  static const struct {
+    const char *name;
+    const char *help;
+  } families[] = {
+      {"esp_heap_free_bytes", "Free heap"},
+      {"esp_heap_min_free_bytes", "Lowest free heap since boot"},
+      {"esp_heap_largest_free_block_bytes", "Largest allocatable block"},
+  };
+
+  for (size_t f = 0; f < sizeof(families) / sizeof(families[0]); f++) {
+    out_printf(o, "# HELP %s %s\n# TYPE %s gauge\n", families[f].name,
+               families[f].help, families[f].name);
+    for (size_t r = 0; r < sizeof(regions) / sizeof(regions[0]); r++) {
+      size_t v = f == 0   ? heap_caps_get_free_size(regions[r].caps)
+                 : f == 1 ? heap_caps_get_minimum_free_size(regions[r].caps)
+                          : heap_caps_get_largest_free_block(regions[r].caps);
+      out_printf(o, "%s{region=\"%s\"} %u\n", families[f].name,
+                 regions[r].region, (unsigned)v);
+    }
+  }
+
+  int64_t now_us = esp_timer_get_time();
+  out_printf(o,
+             "# HELP esp_uptime_seconds Time since boot\n"
+             "# TYPE esp_uptime_seconds gauge\n"
+             "esp_uptime_seconds %" PRId64 "\n",
+             now_us / 1000000);
+}
+
+static task_runtime_t *task_runtime_slot(TaskHandle_t handle) {
+  task_runtime_t *free_slot = NULL;
+  for (size_t i = 0; i < METRICS_MAX_TASKS; i++) {
+    if (task_runtime[i].handle == handle) {
+      return &task_runtime[i];
+    }
+    if (free_slot == NULL && task_runtime[i].handle == NULL) {
+      free_slot = &task_runtime[i];
+    }
+  }
+  if (free_slot) {
+    memset(free_slot, 0, sizeof(*free_slot));
+    free_slot->handle = handle;
+  }
+  return free_slot;
+}
+
+static void render_tasks(metrics_out_t *o) {
+  uint32_t total_runtime = 0;
+  UBaseType_t count = uxTaskGetNumberOfTasks();
+  // Fails (returns 0) when the tasks do not all fit
+  UBaseType_t n =
+      uxTaskGetSystemState(task_status, METRICS_MAX_TASKS, &total_runtime);
+  if (n == 0 && count > 0) {
+    task_list_truncated++;
+  }
+
+  // One line per call: each must fit the smallest (128 byte) buffer
+  out_printf(o, "# HELP esp_tasks Tasks that exist and tasks listed\n"
+                "# TYPE esp_tasks gauge\n");
+  out_printf(o, "esp_tasks{state=\"total\"} %u\n", (unsigned)count);
+  out_printf(o, "esp_tasks{state=\"listed\"} %u\n", (unsigned)n);
+  out_printf(o, "# HELP esp_task_list_truncated_total Scrapes with more "
+                "than %d tasks, which list none\n",
+             METRICS_MAX_TASKS);
+  out_printf(o, "# TYPE esp_task_list_truncated_total counter\n"
+                "esp_task_list_truncated_total %" PRIu32 "\n",
+             task_list_truncated);
+  if (n == 0) {
+    return; // Keep the run-time totals for the next scrape that fits
+  }
+
+  // Forget deleted tasks before new ones take slots: with the list full,
+  // every slot is needed
+  for (size_t i = 0; i < METRICS_MAX_TASKS; i++) {
+    task_runtime[i].seen = false;
+  }
+  for (UBaseType_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < METRICS_MAX_TASKS; j++) {
+      if (task_runtime[j].handle == task_status[i].xHandle) {
+        task_runtime[j].seen = true;
+        break;
+      }
+    }
+  }
+  for (size_t i = 0; i < METRICS_MAX_TASKS; i++) {
+    if (!task_runtime[i].seen) {
+      task_runtime[i].handle = NULL;
+    }
+  }
+
+  out_printf(o, "# HELP esp_task_runtime_seconds_total CPU time used by a task\n"
+                "# TYPE esp_task_runtime_seconds_total counter\n");
+  for (UBaseType_t i = 0; i < n; i++) {
+    const TaskStatus_t *t = &task_status[i];
+    task_runtime_t *rt = task_runtime_slot(t->xHandle);
+    if (rt == NULL) {
+      continue;
+    }
+    rt->total += (uint32_t)(t->ulRunTimeCounter - rt->last);
+    rt->last = t->ulRunTimeCounter;
+
+    char name[configMAX_TASK_NAME_LEN + 1];
+    size_t len = strnlen(t->pcTaskName, configMAX_TASK_NAME_LEN);
+    for (size_t c = 0; c < len; c++) {
+      char ch = t->pcTaskName[c];
+      name[c] = (ch == '"' || ch == '\\' || ch == '\n') ? '_' : ch;
+    }
+    name[len] = '\0';
+
+    char core[8] = "any";
+#if configTASKLIST_INCLUDE_COREID
+    if (t->xCoreID != tskNO_AFFINITY) {
+      snprintf(core, sizeof(core), "%d", (int)t->xCoreID);
+    }
+#endif
+    char secs[24];
+    format_seconds(secs, sizeof(secs), rt->total);
+    // Names are not unique (several "httpd" or "wq_*" workers); the task
+    // number is
+    out_printf(o,
+               "esp_task_runtime_seconds_total{task=\"%s\",id=\"%u\","
+               "core=\"%s\"} %s\n",
+               name, (unsigned)t->xTaskNumber, core, secs);
+  }
+}
+
+esp_err_t metrics_render(char *buf, size_t buf_len, metrics_sink_t sink,
+                         void *ctx) {
+  if (buf == NULL || buf_len < 128 || sink == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  metrics_out_t o = {
+      .buf = buf, .cap = buf_len, .len = 0, .sink = sink, .ctx = ctx,
+      .err = ESP_OK};
+  render_registry(&o);
+  render_heap(&o);
+  render_tasks(&o);
+  out_flush(&o);
+  return o.err;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file metrics.h
+ * @brief Fixed metrics registry with Prometheus text exposition
+ *
+ * Every metric is a compile-time enum entry, so updating one is a single
+ * atomic add (counters, gauges) or a short critical section (histograms) and
+ * never allocates. metrics_render() streams the registry, plus heap and task
+ * run-time figures sampled at scrape time, through a caller supplied sink.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  METRIC_HA_RECONNECTS,     ///< Reconnects requested after send failures
+  METRIC_HA_WS_DISCONNECTS, ///< WebSocket disconnect events
+  METRIC_MQTT_DISCONNECTS,  ///< MQTT disconnect events
+  METRIC_AFE_FRAMES_FED,    ///< Frames handed to the AFE
+  METRIC_AFE_DROPS_LATE,    ///< Feed loop slower than real time (per frame)
+  METRIC_AFE_DROPS_RING,    ///< AFE ring buffer found full by fetch
+  METRIC_AFE_FETCH_ERRORS,  ///< fetch() returned nothing or ESP_FAIL
+  METRIC_PIPELINE_RUNS,     ///< Wake word or manual triggers
+  METRIC_PIPELINE_ERRORS,   ///< HA pipeline errors and response timeouts
+  METRIC_OTA_NET_BYTES,     ///< OTA bytes received
+  METRIC_OTA_FLASH_BYTES,   ///< OTA bytes written to flash
+  METRIC_NET_FAILOVERS,     ///< Active path lost and an IP regained
+  METRIC_HA_RUNS_REPLAYED,  ///< Interrupted runs resumed after a reconnect
+  METRIC_DNS_HITS,          ///< dns_cache lookups answered within the TTL
+  METRIC_DNS_STALE,         ///< Answered past the TTL, refresh queued
+  METRIC_DNS_MISSES,        ///< Lookups that had to wait for the resolver
+  METRIC_DNS_FAILURES,      ///< Resolver calls without an address
+  METRIC_WORK_REJECTED,     ///< work_queue submissions with the pool full
+  METRIC_HA_EVENTS_DROPPED, ///< HA messages too large or with the queue full
+  METRIC_HA_TTS_EARLY,      ///< TTS played from the run-start stream
+  METRIC_HA_TTS_END,        ///< TTS fetched at tts-end (no early stream)
+  METRIC_HA_TTS_FALLBACK,   ///< Early stream offered but silent, tts-end used
+  METRIC_HA_PONGS_MISSED,   ///< HA pings not answered in time
+  METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+typedef enum {
+  METRIC_GAUGE_HA_CONNECTED,
+  METRIC_GAUGE_MQTT_CONNECTED,
+  METRIC_GAUGE_OTA_NET_BPS,   ///< OTA receive rate while receiving
+  METRIC_GAUGE_OTA_FLASH_BPS, ///< OTA flash rate while writing
+  METRIC_GAUGE_OTA_TOTAL_BPS, ///< OTA bytes written over wall time
+  METRIC_GAUGE_OTA_LAST_MS,      ///< Duration of the last OTA
+  METRIC_GAUGE_OTA_THROTTLED_MS, ///< Of which the download was throttled
+  METRIC_GAUGE_OTA_PAUSED_MS,    ///< Of which flash writes were paused
+  METRIC_GAUGE_OTA_AFE_DROPS,    ///< AFE frames dropped during the last OTA
+  METRIC_GAUGE_BOOT_WAKE_READY_MS, ///< Boot to wake word detection running
+  METRIC_GAUGE_BOOT_STEPS_MS,      ///< Wall time of the boot step graph
+  METRIC_GAUGE_NET_TIME_TO_IP_MS,  ///< Network start to the first IP
+  METRIC_GAUGE_NET_FAILOVER_MS,    ///< Outage of the last failover
+  METRIC_GAUGE_HA_UNAVAILABLE_MS,  ///< Last HA outage, lost to authenticated
+  METRIC_GAUGE_HA_EVENT_QUEUE_DEPTH, ///< HA messages waiting for ha_events
+  METRIC_GAUGE_HA_EVENT_QUEUE_PEAK,  ///< Highest depth since boot
+  METRIC_GAUGE_HA_ENTITIES,          ///< Entities in the local state mirror
+  METRIC_GAUGE_COUNT
+} metric_gauge_t;
+
+typedef enum {
+  METRIC_HIST_WS_SEND,           ///< One audio frame esp_websocket_client_send_bin
+  METRIC_HIST_STAGE_WAKE,        ///< Wake detected -> streaming started
+  METRIC_HIST_STAGE_STT,         ///< Speech end -> STT text
+  METRIC_HIST_STAGE_INTENT,      ///< STT text -> intent end
+  METRIC_HIST_STAGE_TTS_FIRST,   ///< Intent end -> first TTS audio
+  METRIC_HIST_STAGE_TTS_PLAY,    ///< First TTS audio -> playback finished
+  METRIC_HIST_STAGE_RESPONSE,    ///< Speech end -> first TTS audio
+  METRIC_HIST_DNS_RESOLVE,       ///< One getaddrinfo() call in dns_cache
+  METRIC_HIST_WORK_DISPATCH,     ///< work_queue item submitted -> started
+  METRIC_HIST_HA_EVENT_DISPATCH, ///< HA message received -> handled
+  METRIC_HIST_HA_RTT,            ///< HA ping sent -> pong received
+  METRIC_HIST_HA_ENTITIES_APPLY, ///< One subscribe_entities message applied
+  METRIC_HIST_COUNT
+} metric_hist_t;
+
+/**
+ * @brief Output sink for metrics_render()
+ *
+ * @return ESP_OK to continue, anything else aborts rendering
+ */
+typedef esp_err_t (*metrics_sink_t)(void *ctx, const char *data, size_t len);
+
+void metrics_inc(metric_counter_t id);
+void metrics_add(metric_counter_t id, uint32_t n);
+void metrics_gauge_set(metric_gauge_t id, int32_t value);
+
+/**
+ * @brief Current value of a counter (for deltas over an interval)
+ */
+uint32_t metrics_get(metric_counter_t id);
+
+/**
+ * @brief Record one histogram sample
+ *
+ * @param value_us Observed duration in microseconds
+ */
+void metrics_observe(metric_hist_t id, uint32_t value_us);
+
+/**
+ * @brief Render all metrics in the Prometheus text format (version 0.0.4)
+ *
+ * Output is produced in chunks of at most @p buf_len bytes from @p buf.
+ * Must not be called from more than one task at a time.
+ *
+ * @param buf Scratch buffer (at least 128 bytes)
+ */
+esp_err_t metrics_render(char *buf, size_t buf_len, metrics_sink_t sink,
+                         void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,8 +4,10 @@
 
 #include "mqtt_ha.h"
 #include "cJSON.h"
+#include "dns_cache.h"
 #include "esp_app_desc.h"
 #include "esp_log.h"
+#include "metrics.h"
 #include "mqtt_client.h"
 #include "oled_status.h"
 #include <stdio.h>
@@ -14,6 +16,8 @@
 
 static const char *TAG = "mqtt_ha";
 
+static void update_broker_address(void);
+
 static void build_discovery_topic(const char *component, const char *entity_id,
                                   char *topic, size_t topic_len);
 
@@ -28,7 +32,7 @@ static void build_discovery_topic(const char *component, const char *entity_id,
 #define STATE_PREFIX "esp32p4"
 
 // Entity tracking
-#define MAX_ENTITIES 40
+#define MAX_ENTITIES 56
 
 typedef struct {
   char entity_id[32];
@@ -41,6 +45,8 @@ typedef struct {
 // Global state
 static esp_mqtt_client_handle_t mqtt_client = NULL;
 static bool mqtt_connected = false;
+static char broker_uri[128];    // As configured
+static char broker_direct[128]; // Host replaced by its cached address
 static mqtt_entity_t entities[MAX_ENTITIES];
 static int entity_count = 0;
 static bool legacy_cleanup_done = false;
@@ -227,6 +233,7 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
   case MQTT_EVENT_CONNECTED:
     ESP_LOGI(TAG, "MQTT connected to Home Assistant");
     mqtt_connected = true;
+    metrics_gauge_set(METRIC_GAUGE_MQTT_CONNECTED, 1);
     oled_status_set_mqtt_connected(true);
     oled_status_set_last_event("mqtt-up");
 
@@ -254,6 +261,9 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
   case MQTT_EVENT_DISCONNECTED:
     ESP_LOGW(TAG, "MQTT disconnected");
     mqtt_connected = false;
+    update_broker_address(); // Picks up a refreshed address on the retry
+    metrics_inc(METRIC_MQTT_DISCONNECTS);
+    metrics_gauge_set(METRIC_GAUGE_MQTT_CONNECTED, 0);
     oled_status_set_mqtt_connected(false);
     oled_status_set_last_event("mqtt-down");
     break;
@@ -297,6 +307,23 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
   }
 }
 
+/**
+ * Point the client at the broker's current cached address. A stale entry is
+ * still used and refreshed in the background, so the next attempt gets the
+ * new address if the broker moved.
+ */
+static void update_broker_address(void) {
+  char direct[sizeof(broker_direct)];
+  if (!mqtt_client ||
+      dns_cache_rewrite_url(broker_uri, direct, sizeof(direct)) != ESP_OK ||
+      strcmp(direct, broker_direct) == 0) {
+    return;
+  }
+  ESP_LOGI(TAG, "Broker address now %s", direct);
+  strcpy(broker_direct, direct);
+  esp_mqtt_client_set_uri(mqtt_client, broker_direct);
+}
+
 esp_err_t mqtt_ha_init(const mqtt_ha_config_t *config) {
   if (!config || !config->broker_uri) {
     ESP_LOGE(TAG, "Invalid MQTT configuration");
@@ -306,8 +333,16 @@ esp_err_t mqtt_ha_init(const mqtt_ha_config_t *config) {
   ESP_LOGI(TAG, "Initializing MQTT Home Assistant client");
   ESP_LOGI(TAG, "Broker: %s", config->broker_uri);
 
+  strncpy(broker_uri, config->broker_uri, sizeof(broker_uri) - 1);
+  broker_uri[sizeof(broker_uri) - 1] = '\0';
+  // Falls back to the configured URI (mqtts://, or not resolvable yet)
+  if (dns_cache_rewrite_url(broker_uri, broker_direct,
+                            sizeof(broker_direct)) == ESP_ERR_INVALID_SIZE) {
+    strcpy(broker_direct, broker_uri);
+  }
+
   esp_mqtt_client_config_t mqtt_cfg = {
-      .broker.address.uri = config->broker_uri,
+      .broker.address.uri = broker_direct,
       .credentials.client_id =
           config->client_id ? config->client_id : DEVICE_ID,
   };
@@ -356,6 +391,20 @@ esp_err_t mqtt_ha_stop(void) {
   return ESP_OK;
 }
 
+esp_err_t mqtt_ha_on_netif_change(void) {
+  if (!mqtt_client) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  ESP_LOGI(TAG, "Network changed, reconnecting to broker");
+  esp_mqtt_client_stop(mqtt_client);
+  mqtt_connected = false;
+  metrics_gauge_set(METRIC_GAUGE_MQTT_CONNECTED, 0);
+
+  update_broker_address();
+  return esp_mqtt_client_start(mqtt_client);
+}
+
 esp_err_t mqtt_ha_register_sensor(const char *entity_id, const char *name,
                                   const char *unit, const char *device_class) {
   if (entity_count >= MAX_ENTITIES) {
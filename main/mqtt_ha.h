@@ -64,6 +64,17 @@ esp_err_t mqtt_ha_start(void);
  */
 esp_err_t mqtt_ha_stop(void);
 
+/**
+ * Reconnect to the broker after the active network interface changed
+ *
+ * The old TCP connection is bound to an address that no longer routes;
+ * restarting the client now avoids waiting for the keepalive to expire.
+ * Discovery and subscriptions are restored by the connect handler.
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t mqtt_ha_on_netif_change(void);
+
 /**
  * Register a sensor entity with Home Assistant
  *
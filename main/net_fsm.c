@@ -0,0 +1,185 @@
+/**
+ * @file net_fsm.c
+ * @brief Ethernet/Wi-Fi selection state machine behind network_manager
+ */
+
+#include "net_fsm.h"
+#include <string.h>
+
+static void arm(net_fsm_t *f, uint32_t ms, uint32_t *acts) {
+  f->timer_ms = ms;
+  *acts |= NET_ACT_TIMER;
+}
+
+static void start_wifi(net_fsm_t *f, uint32_t *acts) {
+  if (f->cfg.wifi_allowed && !f->wifi_running) {
+    f->wifi_running = true;
+    *acts |= NET_ACT_START_WIFI;
+  }
+}
+
+static void stop_wifi(net_fsm_t *f, uint32_t *acts) {
+  f->wifi_running = false;
+  *acts |= NET_ACT_STOP_WIFI;
+}
+
+static void online(net_fsm_t *f, network_type_t type, uint32_t now_ms,
+                   uint32_t *acts) {
+  if (f->state == NET_FSM_WIFI && type == NETWORK_TYPE_ETHERNET) {
+    f->handovers++;
+  }
+  if (f->state == NET_FSM_CONNECTING) {
+    if (f->down_ms) {
+      f->failover_ms = now_ms - f->down_ms;
+      f->failovers++;
+      f->down_ms = 0;
+    } else if (f->time_to_ip_ms == 0) {
+      f->time_to_ip_ms = now_ms - f->start_ms;
+      if (f->time_to_ip_ms == 0) {
+        f->time_to_ip_ms = 1; // 0 means "not yet"
+      }
+    }
+  }
+  f->state = type == NETWORK_TYPE_ETHERNET ? NET_FSM_ETHERNET : NET_FSM_WIFI;
+  f->active = type;
+  *acts |= NET_ACT_NOTIFY_UP;
+  arm(f, 0, acts);
+}
+
+static void offline(net_fsm_t *f, uint32_t now_ms, uint32_t *acts) {
+  f->lost = f->active;
+  f->active = NETWORK_TYPE_NONE;
+  f->state = NET_FSM_CONNECTING;
+  f->down_ms = now_ms ? now_ms : 1;
+  *acts |= NET_ACT_NOTIFY_DOWN;
+}
+
+void net_fsm_init(net_fsm_t *fsm, const net_fsm_config_t *cfg) {
+  memset(fsm, 0, sizeof(*fsm));
+  fsm->cfg = *cfg;
+  fsm->state = NET_FSM_IDLE;
+}
+
+uint32_t net_fsm_handle(net_fsm_t *f, net_fsm_event_t ev, uint32_t now_ms) {
+  uint32_t acts = 0;
+
+  switch (ev) {
+  case NET_EV_START:
+    if (f->state != NET_FSM_IDLE) {
+      break;
+    }
+    f->state = NET_FSM_CONNECTING;
+    f->start_ms = now_ms;
+    if (f->cfg.race_delay_ms == 0) {
+      start_wifi(f, &acts);
+    } else {
+      arm(f, f->cfg.race_delay_ms, &acts);
+    }
+    break;
+
+  case NET_EV_ETH_ABSENT:
+    if (f->state == NET_FSM_IDLE) {
+      f->state = NET_FSM_CONNECTING;
+      f->start_ms = now_ms;
+    }
+    f->eth_link = false;
+    if (f->state == NET_FSM_CONNECTING) {
+      arm(f, 0, &acts);
+      start_wifi(f, &acts);
+    }
+    break;
+
+  case NET_EV_ETH_LINK_UP:
+    f->eth_link = true;
+    if (f->state == NET_FSM_CONNECTING && !f->wifi_running) {
+      // Link is there: give DHCP its own window before racing Wi-Fi
+      arm(f, f->cfg.dhcp_timeout_ms, &acts);
+    }
+    break;
+
+  case NET_EV_ETH_LINK_DOWN:
+    f->eth_link = false;
+    if (f->state == NET_FSM_ETHERNET) {
+      offline(f, now_ms, &acts);
+      start_wifi(f, &acts);
+    } else if (f->state == NET_FSM_CONNECTING && !f->wifi_running) {
+      arm(f, 0, &acts);
+      start_wifi(f, &acts);
+    }
+    break;
+
+  case NET_EV_ETH_GOT_IP:
+    f->eth_link = true;
+    if (f->state == NET_FSM_ETHERNET || f->state == NET_FSM_IDLE) {
+      break;
+    }
+    if (f->wifi_running) {
+      stop_wifi(f, &acts);
+    }
+    online(f, NETWORK_TYPE_ETHERNET, now_ms, &acts);
+    break;
+
+  case NET_EV_ETH_LOST_IP:
+    // Same as a pulled cable for the path; DHCP keeps retrying on the link
+    if (f->state == NET_FSM_ETHERNET) {
+      offline(f, now_ms, &acts);
+      start_wifi(f, &acts);
+    }
+    break;
+
+  case NET_EV_WIFI_GOT_IP:
+    if (f->state == NET_FSM_CONNECTING) {
+      online(f, NETWORK_TYPE_WIFI, now_ms, &acts);
+    } else if (f->state == NET_FSM_ETHERNET) {
+      // Lost the race (or a stop was still queued): not needed
+      stop_wifi(f, &acts);
+    }
+    break;
+
+  case NET_EV_WIFI_LOST:
+    f->wifi_running = false;
+    if (f->state == NET_FSM_WIFI) {
+      offline(f, now_ms, &acts);
+    }
+    if (f->state == NET_FSM_CONNECTING && f->cfg.wifi_allowed) {
+      arm(f, f->cfg.wifi_retry_ms, &acts);
+    }
+    break;
+
+  case NET_EV_TIMEOUT:
+    if (f->state == NET_FSM_CONNECTING) {
+      start_wifi(f, &acts);
+    }
+    break;
+  }
+  return acts;
+}
+
+const char *net_fsm_state_name(net_fsm_state_t state) {
+  switch (state) {
+  case NET_FSM_IDLE:
+    return "idle";
+  case NET_FSM_CONNECTING:
+    return "connecting";
+  case NET_FSM_ETHERNET:
+    return "ethernet";
+  case NET_FSM_WIFI:
+    return "wifi";
+  }
+  return "?";
+}
+
+const char *net_fsm_event_name(net_fsm_event_t ev) {
+  static const char *const names[] = {
+      [NET_EV_START] = "start",
+      [NET_EV_ETH_ABSENT] = "eth_absent",
+      [NET_EV_ETH_LINK_UP] = "eth_link_up",
+      [NET_EV_ETH_LINK_DOWN] = "eth_link_down",
+      [NET_EV_ETH_GOT_IP] = "eth_got_ip",
+      [NET_EV_ETH_LOST_IP] = "eth_lost_ip",
+      [NET_EV_WIFI_GOT_IP] = "wifi_got_ip",
+      [NET_EV_WIFI_LOST] = "wifi_lost",
+      [NET_EV_TIMEOUT] = "timeout",
+  };
+  return (unsigned)ev < sizeof(names) / sizeof(names[0]) ? names[ev] : "?";
+}
@@ -0,0 +1,95 @@
+/**
+ * @file net_fsm.h
+ * @brief Ethernet/Wi-Fi selection state machine behind network_manager
+ *
+ * Pure logic, no ESP-IDF headers or calls: network_manager feeds it link,
+ * IP and timer events and carries out the returned actions, so the
+ * transitions can be replayed with simulated events (test/test_net_fsm.c).
+ *
+ *   CONNECTING  no IP yet. Ethernet is given race_delay_ms to report a
+ *               link (and dhcp_timeout_ms from link-up to an IP); after
+ *               that Wi-Fi is started next to it and the first IP wins.
+ *   ETHERNET    Ethernet has an IP. Wi-Fi is stopped. Losing the link
+ *               or just the IP falls back to Wi-Fi.
+ *   WIFI        Wi-Fi has an IP. An Ethernet IP later takes over.
+ *
+ * Wi-Fi is never started before Ethernet had its chance on this board:
+ * ESP-Hosted Wi-Fi and the SD card share the SDIO lines.
+ */
+
+#pragma once
+
+#include "network_types.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  NET_FSM_IDLE,
+  NET_FSM_CONNECTING,
+  NET_FSM_ETHERNET,
+  NET_FSM_WIFI,
+} net_fsm_state_t;
+
+typedef enum {
+  NET_EV_START,        ///< Ethernet driver started
+  NET_EV_ETH_ABSENT,   ///< No Ethernet (driver failed to start)
+  NET_EV_ETH_LINK_UP,
+  NET_EV_ETH_LINK_DOWN,
+  NET_EV_ETH_GOT_IP,
+  NET_EV_ETH_LOST_IP,  ///< Link still up, but the lease ran out
+  NET_EV_WIFI_GOT_IP,
+  NET_EV_WIFI_LOST,    ///< Association failed or the Wi-Fi IP was lost
+  NET_EV_TIMEOUT,      ///< The timer armed by the last transition fired
+} net_fsm_event_t;
+
+/** Actions returned by net_fsm_handle(), carried out in this order */
+#define NET_ACT_NOTIFY_DOWN (1u << 0) ///< fsm->lost went away
+#define NET_ACT_STOP_WIFI (1u << 1)
+#define NET_ACT_START_WIFI (1u << 2)
+#define NET_ACT_NOTIFY_UP (1u << 3) ///< fsm->active is connected
+#define NET_ACT_TIMER (1u << 4)     ///< (Re)arm for fsm->timer_ms, 0 = cancel
+
+typedef struct {
+  uint32_t race_delay_ms;   ///< No link for this long: start Wi-Fi (0 = at once)
+  uint32_t dhcp_timeout_ms; ///< Link up but no IP for this long: start Wi-Fi
+  uint32_t wifi_retry_ms;   ///< Wait after a failed association
+  bool wifi_allowed;        ///< Wi-Fi credentials are configured
+} net_fsm_config_t;
+
+typedef struct {
+  net_fsm_config_t cfg;
+  net_fsm_state_t state;
+  network_type_t active;
+  network_type_t lost;
+  bool eth_link;
+  bool wifi_running;
+  uint32_t timer_ms;
+
+  uint32_t start_ms;       ///< NET_EV_START
+  uint32_t down_ms;        ///< Active path lost, 0 while online
+  uint32_t time_to_ip_ms;  ///< Start to the first IP, 0 until then
+  uint32_t failover_ms;    ///< Last loss of the active path to the next IP
+  uint32_t failovers;
+  uint32_t handovers;      ///< Wi-Fi to Ethernet without an outage
+} net_fsm_t;
+
+void net_fsm_init(net_fsm_t *fsm, const net_fsm_config_t *cfg);
+
+/**
+ * @brief Apply one event
+ *
+ * @param now_ms Monotonic time of the event
+ * @return NET_ACT_* bits
+ */
+uint32_t net_fsm_handle(net_fsm_t *fsm, net_fsm_event_t ev, uint32_t now_ms);
+
+const char *net_fsm_state_name(net_fsm_state_t state);
+const char *net_fsm_event_name(net_fsm_event_t ev);
+
+#ifdef __cplusplus
+}
+#endif
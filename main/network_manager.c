@@ -4,9 +4,12 @@
  */
 
 #include "network_manager.h"
+#include "net_fsm.h"
+#include "metrics.h"
 #include "wifi_manager.h"
 #include "settings_manager.h" // Added for WiFi credentials
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_event.h"
 #include "esp_netif.h"
 #include "esp_eth.h"
@@ -14,7 +17,9 @@
 #include "esp_eth_phy.h"
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -27,12 +32,28 @@ static const char *TAG = "network_manager";
 #define ETH_MDC_GPIO        31
 #define ETH_MDIO_GPIO       52
 
+// Path selection (net_fsm.h). The IP101 reports link well within the race
+// delay when a cable is plugged in; Wi-Fi only starts after it.
+#define NET_RACE_DELAY_MS   3000
+#define NET_DHCP_TIMEOUT_MS 5000
+#define NET_WIFI_RETRY_MS   15000
+#define NET_QUEUE_LEN       16
+
 // Network state
 static network_type_t active_network = NETWORK_TYPE_NONE;
-static bool ethernet_available = false;
-static bool wifi_fallback_active = false;
 static network_event_callback_t event_callback = NULL;
 
+typedef struct {
+    net_fsm_event_t ev;
+    uint32_t timer_gen; ///< NET_EV_TIMEOUT only: arm it belongs to
+} net_msg_t;
+
+static net_fsm_t fsm;
+static QueueHandle_t net_queue = NULL;
+static QueueHandle_t wifi_cmd_queue = NULL;
+static TimerHandle_t net_timer = NULL;
+static volatile uint32_t timer_gen = 0;
+
 static void esp_hosted_log_suppress(bool suppress) {
     esp_log_level_set("H_API", suppress ? ESP_LOG_NONE : ESP_LOG_ERROR);
 }
@@ -63,8 +84,6 @@ typedef enum {
     WIFI_FALLBACK_CMD_STOP = 1,
 } wifi_fallback_cmd_t;
 
-static TaskHandle_t wifi_fallback_task_handle = NULL;
-
 // Helper to start WiFi with stored credentials
 static esp_err_t start_wifi_fallback(void) {
     esp_hosted_log_suppress(false);
@@ -78,25 +97,117 @@ static esp_err_t start_wifi_fallback(void) {
     return wifi_manager_init(settings.wifi_ssid, settings.wifi_password);
 }
 
-static void wifi_fallback_task(void *arg) {
-    wifi_fallback_cmd_t cmd = (wifi_fallback_cmd_t)(uintptr_t)arg;
+static uint32_t now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void post_event(net_fsm_event_t ev) {
+    net_msg_t msg = { .ev = ev, .timer_gen = timer_gen };
+    if (net_queue == NULL || xQueueSend(net_queue, &msg, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Network event %s dropped", net_fsm_event_name(ev));
+    }
+}
+
+// Association blocks until connected or out of retries, so Wi-Fi start/stop
+// run in order on their own task, away from the event loop and the FSM.
+static void wifi_ctl_task(void *arg) {
+    wifi_fallback_cmd_t cmd;
 
-    if (cmd == WIFI_FALLBACK_CMD_START) {
-        (void)start_wifi_fallback();
-    } else if (cmd == WIFI_FALLBACK_CMD_STOP) {
-        (void)wifi_manager_stop();
+    for (;;) {
+        if (xQueueReceive(wifi_cmd_queue, &cmd, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (cmd == WIFI_FALLBACK_CMD_START) {
+            if (start_wifi_fallback() != ESP_OK) {
+                post_event(NET_EV_WIFI_LOST);
+            }
+        } else if (cmd == WIFI_FALLBACK_CMD_STOP) {
+            (void)wifi_manager_stop();
+        }
     }
+}
 
-    wifi_fallback_task_handle = NULL;
-    vTaskDelete(NULL);
+static void wifi_command(wifi_fallback_cmd_t cmd) {
+    if (xQueueSend(wifi_cmd_queue, &cmd, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "WiFi command queue full");
+    }
 }
 
-static void schedule_wifi_fallback_task(wifi_fallback_cmd_t cmd) {
-    if (wifi_fallback_task_handle != NULL) {
-        return;
+static void net_timer_cb(TimerHandle_t timer) {
+    (void)timer;
+    post_event(NET_EV_TIMEOUT);
+}
+
+static void arm_timer(uint32_t ms) {
+    timer_gen++;
+    if (ms == 0) {
+        xTimerStop(net_timer, 0);
+    } else {
+        xTimerChangePeriod(net_timer, pdMS_TO_TICKS(ms), 0);
+    }
+}
+
+static void report_connected(uint32_t failovers_before) {
+    static bool first_ip_reported = false;
+
+    if (fsm.failovers != failovers_before) {
+        ESP_LOGI(TAG, "Failover to %s took %lu ms",
+                 network_manager_type_to_string(fsm.active), (unsigned long)fsm.failover_ms);
+        metrics_gauge_set(METRIC_GAUGE_NET_FAILOVER_MS, (int32_t)fsm.failover_ms);
+        metrics_inc(METRIC_NET_FAILOVERS);
+    } else if (!first_ip_reported && fsm.time_to_ip_ms) {
+        first_ip_reported = true;
+        ESP_LOGI(TAG, "First IP via %s %lu ms after network start",
+                 network_manager_type_to_string(fsm.active), (unsigned long)fsm.time_to_ip_ms);
+        metrics_gauge_set(METRIC_GAUGE_NET_TIME_TO_IP_MS, (int32_t)fsm.time_to_ip_ms);
+    }
+}
+
+static void net_fsm_task(void *arg) {
+    net_msg_t msg;
+
+    for (;;) {
+        if (xQueueReceive(net_queue, &msg, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (msg.ev == NET_EV_TIMEOUT && msg.timer_gen != timer_gen) {
+            continue; // Re-armed or cancelled since it fired
+        }
+
+        net_fsm_state_t before = fsm.state;
+        uint32_t failovers_before = fsm.failovers;
+        uint32_t acts = net_fsm_handle(&fsm, msg.ev, now_ms());
+        if (fsm.state != before) {
+            ESP_LOGI(TAG, "%s: %s -> %s", net_fsm_event_name(msg.ev),
+                     net_fsm_state_name(before), net_fsm_state_name(fsm.state));
+        }
+
+        // Down first: the app releases the SD card before Wi-Fi takes SDIO
+        if (acts & NET_ACT_NOTIFY_DOWN) {
+            active_network = NETWORK_TYPE_NONE;
+            if (event_callback) {
+                event_callback(fsm.lost, false);
+            }
+        }
+        if (acts & NET_ACT_STOP_WIFI) {
+            ESP_LOGI(TAG, "Stopping WiFi - Ethernet has an IP");
+            wifi_command(WIFI_FALLBACK_CMD_STOP);
+        }
+        if (acts & NET_ACT_START_WIFI) {
+            ESP_LOGI(TAG, "Starting WiFi (%s)", fsm.eth_link ? "Ethernet has no IP yet" : "no Ethernet link");
+            wifi_command(WIFI_FALLBACK_CMD_START);
+        }
+        if (acts & NET_ACT_NOTIFY_UP) {
+            active_network = fsm.active;
+            report_connected(failovers_before);
+            if (event_callback) {
+                event_callback(fsm.active, true);
+            }
+        }
+        if (acts & NET_ACT_TIMER) {
+            arm_timer(fsm.timer_ms);
+        }
     }
-    xTaskCreate(wifi_fallback_task, "wifi_fallback", 4096, (void *)(uintptr_t)cmd, 4,
-                &wifi_fallback_task_handle);
 }
 
 /**
@@ -187,6 +298,10 @@ static esp_err_t ethernet_init(void)
 
     ret = esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP,
                                       ip_event_handler, NULL);
+    if (ret == ESP_OK) {
+        ret = esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_LOST_IP,
+                                          ip_event_handler, NULL);
+    }
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register IP event handler");
         return ret;
@@ -200,7 +315,6 @@ static esp_err_t ethernet_init(void)
     }
 
     ESP_LOGI(TAG, "Ethernet initialized - waiting for link...");
-    ethernet_available = true;
 
     return ESP_OK;
 }
@@ -215,36 +329,14 @@ static void ethernet_event_handler(void *arg, esp_event_base_t event_base,
     case ETHERNET_EVENT_CONNECTED:
         ESP_LOGI(TAG, "Ethernet cable connected");
         esp_hosted_log_suppress(true);
-
-        // If WiFi fallback was active, stop it
-        if (wifi_fallback_active && wifi_manager_is_active()) {
-            ESP_LOGI(TAG, "Stopping WiFi fallback - switching to Ethernet");
-            schedule_wifi_fallback_task(WIFI_FALLBACK_CMD_STOP);
-            wifi_fallback_active = false;
-        }
+        // WiFi (if running) is stopped once Ethernet also has an IP
+        post_event(NET_EV_ETH_LINK_UP);
         break;
 
     case ETHERNET_EVENT_DISCONNECTED:
         ESP_LOGW(TAG, "Ethernet cable disconnected");
         esp_hosted_log_suppress(false);
-
-        // Mark Ethernet as inactive
-        if (active_network == NETWORK_TYPE_ETHERNET) {
-            active_network = NETWORK_TYPE_NONE;
-
-            // Notify application
-            if (event_callback) {
-                event_callback(NETWORK_TYPE_ETHERNET, false);
-            }
-        }
-
-        // Activate WiFi fallback
-        if (!wifi_fallback_active) {
-            ESP_LOGI(TAG, "Activating WiFi fallback...");
-            wifi_fallback_active = true;
-            // Do NOT block the system event loop with a synchronous WiFi connect attempt.
-            schedule_wifi_fallback_task(WIFI_FALLBACK_CMD_START);
-        }
+        post_event(NET_EV_ETH_LINK_DOWN);
         break;
 
     case ETHERNET_EVENT_START:
@@ -271,30 +363,21 @@ static void ip_event_handler(void *arg, esp_event_base_t event_base,
         ESP_LOGI(TAG, "Ethernet IP: " IPSTR, IP2STR(&event->ip_info.ip));
         ESP_LOGI(TAG, "   Gateway: " IPSTR, IP2STR(&event->ip_info.gw));
         ESP_LOGI(TAG, "   Netmask: " IPSTR, IP2STR(&event->ip_info.netmask));
+        post_event(NET_EV_ETH_GOT_IP);
 
-        // Set Ethernet as active network
-        active_network = NETWORK_TYPE_ETHERNET;
-
-        // Notify application
-        if (event_callback) {
-            event_callback(NETWORK_TYPE_ETHERNET, true);
-        }
+    } else if (event_id == IP_EVENT_ETH_LOST_IP) {
+        ESP_LOGW(TAG, "Ethernet IP lost");
+        post_event(NET_EV_ETH_LOST_IP);
 
     } else if (event_id == IP_EVENT_STA_GOT_IP) {
-        // WiFi got IP - only use if Ethernet is not active
-        if (active_network != NETWORK_TYPE_ETHERNET) {
-            ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-            ESP_LOGI(TAG, "WiFi IP (fallback): " IPSTR, IP2STR(&event->ip_info.ip));
-
-            active_network = NETWORK_TYPE_WIFI;
+        // Used only if Ethernet has no IP yet (the FSM decides)
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        ESP_LOGI(TAG, "WiFi IP: " IPSTR, IP2STR(&event->ip_info.ip));
+        post_event(NET_EV_WIFI_GOT_IP);
 
-            // Notify application
-            if (event_callback) {
-                event_callback(NETWORK_TYPE_WIFI, true);
-            }
-        } else {
-            ESP_LOGI(TAG, "WiFi IP acquired but Ethernet is active - ignoring");
-        }
+    } else if (event_id == IP_EVENT_STA_LOST_IP) {
+        ESP_LOGW(TAG, "WiFi IP lost");
+        post_event(NET_EV_WIFI_LOST);
     }
 }
 
@@ -324,40 +407,50 @@ esp_err_t network_manager_init(void)
     }
     ESP_LOGI(TAG, "Event loop ready");
 
-    // Register WiFi IP event handler
+    // Register WiFi IP event handlers
     ret = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
                                       ip_event_handler, NULL);
+    if (ret == ESP_OK) {
+        ret = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_LOST_IP,
+                                          ip_event_handler, NULL);
+    }
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to register WiFi IP event handler");
     }
 
-    // Try to initialize Ethernet first (priority)
+    // WiFi only races Ethernet when there is something to connect to
+    app_settings_t settings;
+    bool wifi_allowed = settings_manager_load(&settings) == ESP_OK &&
+                        settings.wifi_ssid[0] != '\0';
+    net_fsm_config_t fsm_cfg = {
+        .race_delay_ms = NET_RACE_DELAY_MS,
+        .dhcp_timeout_ms = NET_DHCP_TIMEOUT_MS,
+        .wifi_retry_ms = NET_WIFI_RETRY_MS,
+        .wifi_allowed = wifi_allowed,
+    };
+    net_fsm_init(&fsm, &fsm_cfg);
+
+    net_queue = xQueueCreate(NET_QUEUE_LEN, sizeof(net_msg_t));
+    wifi_cmd_queue = xQueueCreate(4, sizeof(wifi_fallback_cmd_t));
+    net_timer = xTimerCreate("net_fsm", 1, pdFALSE, NULL, net_timer_cb);
+    if (net_queue == NULL || wifi_cmd_queue == NULL || net_timer == NULL ||
+        xTaskCreate(net_fsm_task, "net_fsm", 4096, NULL, 5, NULL) != pdPASS ||
+        xTaskCreate(wifi_ctl_task, "wifi_ctl", 4096, NULL, 4, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create network state machine");
+        return ESP_ERR_NO_MEM;
+    }
+    post_event(NET_EV_START);
+
+    // Ethernet first (priority); link and IP events drive the rest
     ret = ethernet_init();
     if (ret == ESP_OK) {
         ESP_LOGI(TAG, "Ethernet initialization successful");
-        // Wait for Ethernet link (timeout 5 seconds)
-        ESP_LOGI(TAG, "Waiting for Ethernet link... (5s timeout)");
-        vTaskDelay(pdMS_TO_TICKS(5000));
-
-        // Check if we got IP via Ethernet
-        if (active_network == NETWORK_TYPE_ETHERNET) {
-            ESP_LOGI(TAG, "Ethernet active - skipping WiFi");
-            return ESP_OK;
-        } else {
-            ESP_LOGW(TAG, "Ethernet initialized but no link detected");
-        }
     } else {
         ESP_LOGW(TAG, "Ethernet initialization failed: %s", esp_err_to_name(ret));
-        ethernet_available = false;
+        post_event(NET_EV_ETH_ABSENT);
     }
-
-    // Ethernet not available or no link - fall back to WiFi
-    ESP_LOGI(TAG, "Starting WiFi fallback...");
-    wifi_fallback_active = true;
-    ret = start_wifi_fallback();
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "WiFi fallback initialization failed!");
-        return ESP_FAIL;
+    if (!wifi_allowed) {
+        ESP_LOGW(TAG, "No WiFi SSID configured - Ethernet only");
     }
 
     return ESP_OK;
@@ -452,13 +545,8 @@ esp_err_t network_manager_force_wifi_fallback(void)
 
     if (eth_handle && active_network == NETWORK_TYPE_ETHERNET) {
         esp_eth_stop(eth_handle);
-        active_network = NETWORK_TYPE_NONE;
-    }
-
-    if (!wifi_fallback_active) {
-        wifi_fallback_active = true;
-        return start_wifi_fallback();
     }
+    post_event(NET_EV_ETH_LINK_DOWN);
 
     return ESP_OK;
 }
@@ -7,7 +7,7 @@
  * 2. WiFi - Fallback when Ethernet unavailable
  *
  * Features:
- * - Automatic network selection on boot
+ * - Event-driven network selection on boot (no fixed link wait)
  * - Runtime failover on Ethernet disconnect/reconnect
  * - Event callbacks for network state changes
  * - Unified API for application layer
@@ -18,37 +18,21 @@
 
 #include "esp_err.h"
 #include "esp_netif.h"
+#include "network_types.h"
 #include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/**
- * @brief Network interface types
- */
-typedef enum {
-    NETWORK_TYPE_NONE = 0,      ///< No network connected
-    NETWORK_TYPE_ETHERNET,       ///< Ethernet connected (priority)
-    NETWORK_TYPE_WIFI            ///< WiFi connected (fallback)
-} network_type_t;
-
-/**
- * @brief Network event callback function type
- *
- * Called when network state changes (connected/disconnected)
- *
- * @param type Network type that changed state
- * @param connected true if connected, false if disconnected
- */
-typedef void (*network_event_callback_t)(network_type_t type, bool connected);
-
 /**
  * @brief Initialize network manager
  *
- * Attempts to initialize Ethernet first (priority).
- * If Ethernet fails, falls back to WiFi.
- * Registers event handlers for automatic failover.
+ * Starts Ethernet (priority) and returns without waiting for a link.
+ * Link and IP events then drive the path selection (net_fsm.h): WiFi is
+ * started if Ethernet has no link or no IP in time, the first IP wins and
+ * an Ethernet IP later takes over from WiFi. Connect/disconnect reach the
+ * registered callback.
  *
  * @return ESP_OK on success
  */
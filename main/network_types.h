@@ -0,0 +1,40 @@
+/**
+ * @file network_types.h
+ * @brief Types shared by network_manager and its state machine
+ *
+ * Kept free of ESP-IDF headers so net_fsm builds and runs on a host.
+ */
+
+#ifndef NETWORK_TYPES_H
+#define NETWORK_TYPES_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Network interface types
+ */
+typedef enum {
+    NETWORK_TYPE_NONE = 0,      ///< No network connected
+    NETWORK_TYPE_ETHERNET,       ///< Ethernet connected (priority)
+    NETWORK_TYPE_WIFI            ///< WiFi connected (fallback)
+} network_type_t;
+
+/**
+ * @brief Network event callback function type
+ *
+ * Called when network state changes (connected/disconnected)
+ *
+ * @param type Network type that changed state
+ * @param connected true if connected, false if disconnected
+ */
+typedef void (*network_event_callback_t)(network_type_t type, bool connected);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NETWORK_TYPES_H
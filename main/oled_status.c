@@ -53,6 +53,10 @@ typedef struct {
     int music_total;
     char last_event[12];
     char response_preview[12];
+    uint32_t ha_entities;
+    uint32_t ha_lights_on;
+    char ha_last_name[17];
+    char ha_last_state[17];
     bool dirty;
 } oled_status_snapshot_t;
 
@@ -619,6 +623,30 @@ static void render_page_audio(const oled_status_snapshot_t *snap) {
     fb_draw_text(7, 0, line);
 }
 
+static void render_page_home(const oled_status_snapshot_t *snap) {
+    char line[64];
+
+    snprintf(line, sizeof(line), "HOME ENT:%lu", (unsigned long)snap->ha_entities);
+    format_line(line, sizeof(line), line);
+    fb_draw_text(0, 0, line);
+
+    snprintf(line, sizeof(line), "LIGHTS ON:%lu", (unsigned long)snap->ha_lights_on);
+    format_line(line, sizeof(line), line);
+    fb_draw_text(1, 0, line);
+
+    snprintf(line, sizeof(line), "LAST CHANGE:");
+    format_line(line, sizeof(line), line);
+    fb_draw_text(3, 0, line);
+
+    snprintf(line, sizeof(line), "%s", snap->ha_last_name[0] ? snap->ha_last_name : "-");
+    format_line(line, sizeof(line), line);
+    fb_draw_text(4, 0, line);
+
+    snprintf(line, sizeof(line), "= %s", snap->ha_last_state[0] ? snap->ha_last_state : "-");
+    format_line(line, sizeof(line), line);
+    fb_draw_text(5, 0, line);
+}
+
 static void render_page(uint8_t page, const oled_status_snapshot_t *snap) {
     fb_clear();
     switch (page) {
@@ -632,9 +660,12 @@ static void render_page(uint8_t page, const oled_status_snapshot_t *snap) {
             render_page_pipeline(snap);
             break;
         case 3:
-        default:
             render_page_audio(snap);
             break;
+        case 4:
+        default:
+            render_page_home(snap);
+            break;
     }
 }
 
@@ -672,7 +703,7 @@ static void oled_task(void *arg) {
         }
 
         if (now - last_page_switch >= (int64_t)OLED_PAGE_ROTATE_MS * 1000LL) {
-            page = (page + 1) % 4;
+            page = (page + 1) % 5;
             last_page_switch = now;
             refresh = true;
         }
@@ -846,3 +877,32 @@ void oled_status_set_ota_url_present(bool present) {
     }
     status_unlock();
 }
+
+static void copy_sanitized(char *dst, size_t dst_len, const char *src) {
+    size_t i = 0;
+    for (; src && src[i] && i + 1 < dst_len; i++) {
+        dst[i] = sanitize_ascii(src[i]);
+    }
+    dst[i] = '\0';
+}
+
+void oled_status_set_ha_entities(uint32_t entities, uint32_t lights_on, const char *last_name,
+                                 const char *last_state) {
+    char name[sizeof(status_snapshot.ha_last_name)];
+    char state[sizeof(status_snapshot.ha_last_state)];
+    copy_sanitized(name, sizeof(name), last_name);
+    copy_sanitized(state, sizeof(state), last_state);
+
+    status_lock();
+    if (status_snapshot.ha_entities != entities ||
+        status_snapshot.ha_lights_on != lights_on ||
+        strcmp(status_snapshot.ha_last_name, name) != 0 ||
+        strcmp(status_snapshot.ha_last_state, state) != 0) {
+        status_snapshot.ha_entities = entities;
+        status_snapshot.ha_lights_on = lights_on;
+        snprintf(status_snapshot.ha_last_name, sizeof(status_snapshot.ha_last_name), "%s", name);
+        snprintf(status_snapshot.ha_last_state, sizeof(status_snapshot.ha_last_state), "%s", state);
+        status_mark_dirty();
+    }
+    status_unlock();
+}
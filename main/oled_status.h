@@ -48,6 +48,9 @@ void oled_status_set_music_state(oled_music_state_t state, int current_track, in
 void oled_status_set_last_event(const char *code);
 void oled_status_set_response_preview(const char *text);
 void oled_status_set_ota_url_present(bool present);
+/** Home page: mirrored HA entities and the last state change (name may be NULL) */
+void oled_status_set_ha_entities(uint32_t entities, uint32_t lights_on, const char *last_name,
+                                 const char *last_state);
 
 #ifdef __cplusplus
 }
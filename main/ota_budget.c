@@ -0,0 +1,127 @@
+/**
+ * @file ota_budget.c
+ * @brief Bandwidth and flash budget for OTA next to the voice pipeline
+ */
+
+#include "ota_budget.h"
+#include "audio_capture.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "voice_pipeline.h"
+
+static const char *TAG = "ota_budget";
+
+// Receive rate per level in bytes/s, 0 = unlimited
+static const uint32_t level_bps[] = {
+    [OTA_BUDGET_IDLE] = 0,
+    [OTA_BUDGET_WAKE_WORD] = 256 * 1024,
+    [OTA_BUDGET_ACTIVE] = 32 * 1024,
+};
+
+// Burst the bucket may hold: a quarter second at the current rate
+#define BUCKET_BURST_DIV 4
+#define PAUSE_POLL_MS 50
+
+static int64_t start_us = 0;
+static int64_t refill_us = 0;
+static int64_t tokens = 0;
+static uint32_t pause_streak_ms = 0;
+static uint32_t throttled_ms = 0;
+static volatile uint32_t flash_paused_ms = 0;
+static uint32_t base_frames = 0;
+static uint32_t base_late = 0;
+static uint32_t base_ring = 0;
+
+void ota_budget_begin(void) {
+  start_us = esp_timer_get_time();
+  refill_us = start_us;
+  tokens = 0;
+  pause_streak_ms = 0;
+  throttled_ms = 0;
+  flash_paused_ms = 0;
+  base_frames = metrics_get(METRIC_AFE_FRAMES_FED);
+  base_late = metrics_get(METRIC_AFE_DROPS_LATE);
+  base_ring = metrics_get(METRIC_AFE_DROPS_RING);
+}
+
+ota_budget_level_t ota_budget_level(void) {
+  audio_capture_mode_t mode = audio_capture_get_mode();
+  if (mode == CAPTURE_MODE_RECORDING || voice_pipeline_is_active()) {
+    return OTA_BUDGET_ACTIVE;
+  }
+  return mode == CAPTURE_MODE_WAKE_WORD ? OTA_BUDGET_WAKE_WORD
+                                        : OTA_BUDGET_IDLE;
+}
+
+void ota_budget_take(size_t bytes) {
+  uint32_t bps = level_bps[ota_budget_level()];
+  int64_t now = esp_timer_get_time();
+
+  if (bps == 0) {
+    tokens = 0;
+    refill_us = now;
+    return;
+  }
+  int64_t burst = bps / BUCKET_BURST_DIV;
+  tokens += (now - refill_us) * bps / 1000000;
+  if (tokens > burst) {
+    tokens = burst;
+  }
+  refill_us = now;
+  tokens -= (int64_t)bytes;
+
+  if (tokens < 0) {
+    // The sleep refills the debt, credited on the next call
+    TickType_t ticks = pdMS_TO_TICKS(-tokens * 1000 / bps);
+    vTaskDelay(ticks ? ticks : 1);
+    throttled_ms += (uint32_t)((esp_timer_get_time() - now) / 1000);
+  }
+}
+
+void ota_budget_flash_gate(void) {
+  ota_budget_level_t level = ota_budget_level();
+
+  while (level == OTA_BUDGET_ACTIVE &&
+         pause_streak_ms < OTA_BUDGET_PAUSE_MAX_MS) {
+    vTaskDelay(pdMS_TO_TICKS(PAUSE_POLL_MS));
+    pause_streak_ms += PAUSE_POLL_MS;
+    flash_paused_ms += PAUSE_POLL_MS;
+    level = ota_budget_level();
+  }
+  if (level != OTA_BUDGET_ACTIVE) {
+    pause_streak_ms = 0;
+  }
+  if (level != OTA_BUDGET_IDLE) {
+    // Flash writes stall the cache: let the feed task catch up in between
+    vTaskDelay(1);
+  }
+}
+
+void ota_budget_end(ota_budget_report_t *report) {
+  ota_budget_report_t r = {
+      .elapsed_ms = (uint32_t)((esp_timer_get_time() - start_us) / 1000),
+      .throttled_ms = throttled_ms,
+      .flash_paused_ms = flash_paused_ms,
+      .afe_frames = metrics_get(METRIC_AFE_FRAMES_FED) - base_frames,
+      .afe_drops_late = metrics_get(METRIC_AFE_DROPS_LATE) - base_late,
+      .afe_drops_ring = metrics_get(METRIC_AFE_DROPS_RING) - base_ring,
+  };
+
+  ESP_LOGI(TAG,
+           "OTA took %lu ms (throttled %lu ms, flash paused %lu ms); AFE "
+           "during update: %lu frames, %lu late + %lu ring-full drops",
+           (unsigned long)r.elapsed_ms, (unsigned long)r.throttled_ms,
+           (unsigned long)r.flash_paused_ms, (unsigned long)r.afe_frames,
+           (unsigned long)r.afe_drops_late, (unsigned long)r.afe_drops_ring);
+  metrics_gauge_set(METRIC_GAUGE_OTA_LAST_MS, (int32_t)r.elapsed_ms);
+  metrics_gauge_set(METRIC_GAUGE_OTA_THROTTLED_MS, (int32_t)r.throttled_ms);
+  metrics_gauge_set(METRIC_GAUGE_OTA_PAUSED_MS, (int32_t)r.flash_paused_ms);
+  metrics_gauge_set(METRIC_GAUGE_OTA_AFE_DROPS,
+                    (int32_t)(r.afe_drops_late + r.afe_drops_ring));
+  if (report) {
+    *report = r;
+  }
+}
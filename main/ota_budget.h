@@ -0,0 +1,84 @@
+/**
+ * @file ota_budget.h
+ * @brief Bandwidth and flash budget for OTA next to the voice pipeline
+ *
+ * The download shares CPU, Wi-Fi and the flash cache with the AFE tasks.
+ * While an update runs, the budget follows what the voice side is doing:
+ *
+ *   idle        no capture: full speed
+ *   wake word   capture feeding WakeNet: download capped, flash written in
+ *               small chunks with a yield after each
+ *   active      recording a command or answering: download capped hard,
+ *               flash writes paused (for at most OTA_BUDGET_PAUSE_MAX_MS
+ *               per active period, so a stuck session cannot stall OTA)
+ *
+ * The receive side is a token bucket that may run into debt: the producer
+ * reads first and then sleeps the debt off, letting TCP flow control slow
+ * the server down.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Largest single network read, so the bucket is charged in small steps */
+#define OTA_BUDGET_READ_CHUNK 4096
+/** Flash is written in pieces of this size, each behind ota_budget_flash_gate() */
+#define OTA_BUDGET_FLASH_CHUNK 4096
+#define OTA_BUDGET_PAUSE_MAX_MS 10000
+
+typedef enum {
+  OTA_BUDGET_IDLE,
+  OTA_BUDGET_WAKE_WORD,
+  OTA_BUDGET_ACTIVE,
+} ota_budget_level_t;
+
+typedef struct {
+  uint32_t elapsed_ms;      ///< Since ota_budget_begin()
+  uint32_t throttled_ms;    ///< Producer sleeping off bucket debt
+  uint32_t flash_paused_ms; ///< Flash task held back for the pipeline
+  uint32_t afe_frames;      ///< Frames fed to the AFE during the update
+  uint32_t afe_drops_late;  ///< Feed loop behind real time
+  uint32_t afe_drops_ring;  ///< AFE ring found full
+} ota_budget_report_t;
+
+/**
+ * @brief Reset the bucket and snapshot the AFE counters
+ */
+void ota_budget_begin(void);
+
+/**
+ * @brief What the voice pipeline is doing right now
+ */
+ota_budget_level_t ota_budget_level(void);
+
+/**
+ * @brief Charge @p bytes just received; sleeps while the bucket is in debt
+ *
+ * Called by the OTA task only.
+ */
+void ota_budget_take(size_t bytes);
+
+/**
+ * @brief Called by the flash task before each flash chunk
+ *
+ * Blocks while the pipeline is active and yields while wake word detection
+ * runs.
+ */
+void ota_budget_flash_gate(void);
+
+/**
+ * @brief Log OTA duration against AFE frame drops and publish the gauges
+ *
+ * @param report Filled if not NULL
+ */
+void ota_budget_end(ota_budget_report_t *report);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,376 @@
+/**
+ * @file ota_delta.c
+ * @brief Streaming delta (patch) OTA applier
+ *
+ * Patch bytes arrive in arbitrary pieces, so the applier is a byte-driven
+ * state machine: fixed-size fields are gathered into a small buffer, INSERT
+ * payloads are forwarded straight from the caller's slot and COPY ranges
+ * are read from the source partition through the copy buffer.
+ */
+
+#include "ota_delta.h"
+#include "alloc_trace.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include <string.h>
+
+static const char *TAG = "ota_delta";
+
+#define DELTA_MAGIC "ESPDLT1"
+#define DELTA_MAGIC_LEN 8
+#define DELTA_HEADER_LEN (DELTA_MAGIC_LEN + 8 + 2 * OTA_SHA256_LEN)
+#define COPY_BUF_SIZE (16 * 1024)
+
+#define OP_COPY 'C'
+#define OP_INSERT 'I'
+#define OP_END 'E'
+
+typedef enum {
+  ST_MAGIC,       ///< Gathering the first bytes to tell patch from image
+  ST_HEADER,      ///< Rest of the patch header
+  ST_OP,          ///< Next op code
+  ST_COPY_ARGS,   ///< offset + len
+  ST_INSERT_LEN,
+  ST_INSERT_DATA, ///< Forwarding insert_left payload bytes
+  ST_END,         ///< 'E' seen, nothing may follow
+  ST_PASSTHROUGH, ///< Not a patch: forward everything
+} delta_state_t;
+
+static ota_sink_t out;
+static const esp_partition_t *source = NULL;
+static void (*flash_gate)(void) = NULL;
+static uint32_t flash_chunk = 0;
+static size_t image_size_hint = 0;
+static delta_state_t state = ST_MAGIC;
+static uint8_t field[DELTA_HEADER_LEN];
+static size_t field_len = 0;
+static uint32_t source_size = 0;
+static uint32_t target_size = 0;
+static uint8_t target_sha[OTA_SHA256_LEN];
+static uint32_t insert_left = 0;
+static uint8_t *copy_buf = NULL;
+static bool out_begun = false;
+static mbedtls_sha256_context sha;
+static ota_delta_stats_t stats;
+
+static inline uint32_t get_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+/**
+ * Gather up to @p need bytes of a field; true once it is complete
+ */
+static bool gather(const uint8_t **p, size_t *len, size_t need) {
+  size_t n = need - field_len;
+  if (n > *len) {
+    n = *len;
+  }
+  memcpy(field + field_len, *p, n);
+  field_len += n;
+  *p += n;
+  *len -= n;
+  return field_len == need;
+}
+
+static esp_err_t begin_out(size_t size) {
+  esp_err_t err = out.begin ? out.begin(out.ctx, size) : ESP_OK;
+  out_begun = (err == ESP_OK);
+  return err;
+}
+
+/**
+ * Forward to the output in flash_chunk pieces, each behind the gate: a
+ * single COPY op can produce megabytes from a few patch bytes.
+ */
+static esp_err_t out_write(const uint8_t *data, size_t len) {
+  size_t chunk = flash_chunk ? flash_chunk : len;
+  for (size_t off = 0; off < len; off += chunk) {
+    size_t n = len - off < chunk ? len - off : chunk;
+    if (flash_gate) {
+      flash_gate();
+    }
+    esp_err_t err = out.write(out.ctx, data + off, n);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  return ESP_OK;
+}
+
+static esp_err_t emit(const uint8_t *data, size_t len) {
+  if (stats.target_bytes + len > target_size) {
+    ESP_LOGE(TAG, "Patch produces more than %lu bytes",
+             (unsigned long)target_size);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  esp_err_t err = out_write(data, len);
+  if (err == ESP_OK) {
+    mbedtls_sha256_update(&sha, data, len);
+    stats.target_bytes += len;
+  }
+  return err;
+}
+
+/**
+ * Hash the first source_size bytes of the running partition, a few MB read
+ * behind the gate so the voice pipeline keeps the cache and the CPU
+ */
+static esp_err_t check_source(const uint8_t expected[OTA_SHA256_LEN]) {
+  uint8_t digest[OTA_SHA256_LEN];
+
+  if (source_size > source->size) {
+    ESP_LOGE(TAG, "Patch source of %lu bytes exceeds partition %s",
+             (unsigned long)source_size, source->label);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  for (uint32_t off = 0; off < source_size; off += COPY_BUF_SIZE) {
+    uint32_t n = source_size - off;
+    if (n > COPY_BUF_SIZE) {
+      n = COPY_BUF_SIZE;
+    }
+    if (flash_gate) {
+      flash_gate();
+    }
+    esp_err_t err = esp_partition_read(source, off, copy_buf, n);
+    if (err != ESP_OK) {
+      mbedtls_sha256_free(&sha);
+      return err;
+    }
+    mbedtls_sha256_update(&sha, copy_buf, n);
+  }
+  mbedtls_sha256_finish(&sha, digest);
+  mbedtls_sha256_free(&sha);
+
+  if (memcmp(digest, expected, OTA_SHA256_LEN) != 0) {
+    ESP_LOGE(TAG, "Patch was made for a different firmware than %s holds",
+             source->label);
+    return ESP_ERR_INVALID_CRC;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t start_patch(void) {
+  source_size = get_u32(field + DELTA_MAGIC_LEN);
+  target_size = get_u32(field + DELTA_MAGIC_LEN + 4);
+  memcpy(target_sha, field + DELTA_MAGIC_LEN + 8 + OTA_SHA256_LEN,
+         OTA_SHA256_LEN);
+  ESP_LOGI(TAG, "Delta patch: %lu -> %lu bytes", (unsigned long)source_size,
+           (unsigned long)target_size);
+
+  if (target_size == 0) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  esp_err_t err = check_source(field + DELTA_MAGIC_LEN + 8);
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = begin_out(target_size);
+  if (err != ESP_OK) {
+    return err;
+  }
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  return ESP_OK;
+}
+
+static esp_err_t copy_range(uint32_t offset, uint32_t len) {
+  if (offset > source_size || len > source_size - offset) {
+    ESP_LOGE(TAG, "COPY %lu+%lu outside the source image",
+             (unsigned long)offset, (unsigned long)len);
+    return ESP_ERR_INVALID_ARG;
+  }
+  while (len > 0) {
+    uint32_t n = len > COPY_BUF_SIZE ? COPY_BUF_SIZE : len;
+    esp_err_t err = esp_partition_read(source, offset, copy_buf, n);
+    if (err == ESP_OK) {
+      err = emit(copy_buf, n);
+    }
+    if (err != ESP_OK) {
+      return err;
+    }
+    stats.copied_bytes += n;
+    offset += n;
+    len -= n;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t delta_begin(void *ctx, size_t image_size) {
+  (void)ctx;
+  // The output is started once the first bytes tell what the stream is
+  image_size_hint = image_size;
+  state = ST_MAGIC;
+  field_len = 0;
+  out_begun = false;
+  memset(&stats, 0, sizeof(stats));
+  copy_buf = TRACE_HEAP_CAPS_MALLOC(ALLOC_TAG_OTA, COPY_BUF_SIZE,
+                                    MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return copy_buf ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t delta_write(void *ctx, const void *data, size_t len) {
+  (void)ctx;
+  const uint8_t *p = (const uint8_t *)data;
+  esp_err_t err = ESP_OK;
+  int64_t t0 = esp_timer_get_time();
+
+  stats.patch_bytes += len;
+  while (len > 0 && err == ESP_OK) {
+    switch (state) {
+    case ST_MAGIC:
+      if (!gather(&p, &len, DELTA_MAGIC_LEN)) {
+        break;
+      }
+      if (memcmp(field, DELTA_MAGIC, DELTA_MAGIC_LEN) == 0) {
+        stats.is_delta = true;
+        state = ST_HEADER;
+        break;
+      }
+      // A full image: replay what was held back and forward the rest
+      state = ST_PASSTHROUGH;
+      err = begin_out(image_size_hint);
+      if (err == ESP_OK) {
+        err = out_write(field, field_len);
+      }
+      stats.target_bytes += field_len;
+      break;
+
+    case ST_HEADER:
+      if (gather(&p, &len, DELTA_HEADER_LEN)) {
+        err = start_patch();
+        field_len = 0;
+        state = ST_OP;
+      }
+      break;
+
+    case ST_OP:
+      field_len = 0;
+      switch (*p) {
+      case OP_COPY:
+        state = ST_COPY_ARGS;
+        break;
+      case OP_INSERT:
+        state = ST_INSERT_LEN;
+        break;
+      case OP_END:
+        state = ST_END;
+        break;
+      default:
+        ESP_LOGE(TAG, "Unknown op 0x%02x after %lu patch bytes", *p,
+                 (unsigned long)(stats.patch_bytes - len));
+        err = ESP_ERR_INVALID_ARG;
+        break;
+      }
+      p++;
+      len--;
+      break;
+
+    case ST_COPY_ARGS:
+      if (gather(&p, &len, 8)) {
+        err = copy_range(get_u32(field), get_u32(field + 4));
+        state = ST_OP;
+      }
+      break;
+
+    case ST_INSERT_LEN:
+      if (gather(&p, &len, 4)) {
+        insert_left = get_u32(field);
+        state = insert_left ? ST_INSERT_DATA : ST_OP;
+      }
+      break;
+
+    case ST_INSERT_DATA: {
+      size_t n = len < insert_left ? len : insert_left;
+      err = emit(p, n);
+      p += n;
+      len -= n;
+      insert_left -= n;
+      if (insert_left == 0) {
+        state = ST_OP;
+      }
+      break;
+    }
+
+    case ST_END:
+      ESP_LOGE(TAG, "%u bytes after the end of the patch", (unsigned)len);
+      err = ESP_ERR_INVALID_SIZE;
+      break;
+
+    case ST_PASSTHROUGH:
+      err = out_write(p, len);
+      stats.target_bytes += len;
+      len = 0;
+      break;
+    }
+  }
+
+  stats.apply_ms += (uint32_t)((esp_timer_get_time() - t0) / 1000);
+  return err;
+}
+
+static esp_err_t delta_end(void *ctx, bool commit) {
+  (void)ctx;
+  esp_err_t err = ESP_OK;
+  uint8_t digest[OTA_SHA256_LEN];
+
+  if (stats.is_delta && out_begun) {
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    if (commit) {
+      if (state != ST_END || stats.target_bytes != target_size) {
+        ESP_LOGE(TAG, "Patch ended early: %lu of %lu bytes",
+                 (unsigned long)stats.target_bytes,
+                 (unsigned long)target_size);
+        err = ESP_ERR_INVALID_SIZE;
+      } else if (memcmp(digest, target_sha, OTA_SHA256_LEN) != 0) {
+        ESP_LOGE(TAG, "Patched image does not match the target hash");
+        err = ESP_ERR_INVALID_CRC;
+      } else {
+        ESP_LOGI(TAG,
+                 "Applied %lu B patch -> %lu B image (%lu B copied) in %lu ms",
+                 (unsigned long)stats.patch_bytes,
+                 (unsigned long)stats.target_bytes,
+                 (unsigned long)stats.copied_bytes,
+                 (unsigned long)stats.apply_ms);
+      }
+    }
+  } else if (commit && state == ST_HEADER) {
+    err = ESP_ERR_INVALID_SIZE; // Truncated header
+  }
+
+  if (out.end) {
+    esp_err_t out_err = out.end(out.ctx, commit && err == ESP_OK);
+    if (err == ESP_OK) {
+      err = out_err;
+    }
+  }
+  if (copy_buf) {
+    TRACE_HEAP_CAPS_FREE(copy_buf);
+    copy_buf = NULL;
+  }
+  return err;
+}
+
+esp_err_t ota_delta_sink(const ota_sink_t *o, const esp_partition_t *src,
+                         void (*gate)(void), uint32_t chunk, ota_sink_t *sink) {
+  if (o == NULL || o->write == NULL || src == NULL || sink == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  out = *o;
+  source = src;
+  flash_gate = gate;
+  flash_chunk = chunk;
+  memset(&stats, 0, sizeof(stats));
+  sink->begin = delta_begin;
+  sink->write = delta_write;
+  sink->end = delta_end;
+  sink->ctx = NULL;
+  return ESP_OK;
+}
+
+void ota_delta_get_stats(ota_delta_stats_t *o) { *o = stats; }
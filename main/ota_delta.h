@@ -0,0 +1,65 @@
+/**
+ * @file ota_delta.h
+ * @brief Streaming delta (patch) OTA applier
+ *
+ * A delta is produced on the host by help_scripts/ota_delta.py from the
+ * image the device runs and the new one. On the device it is applied as
+ * it downloads: COPY ops read from the running partition, INSERT ops carry
+ * new bytes, and the reconstructed image goes to the usual OTA sink. Only
+ * a fixed 16 KB copy buffer is needed, whatever the image size.
+ *
+ * Format (little endian):
+ *
+ *   "ESPDLT1\0"  u32 source_size  u32 target_size
+ *   u8 source_sha256[32]  u8 target_sha256[32]
+ *   ops: 'C' u32 offset u32 len | 'I' u32 len bytes[len] | 'E'
+ *
+ * The patch is refused unless the first source_size bytes of the running
+ * partition hash to source_sha256, and the result must hash to
+ * target_sha256 before the update can be committed.
+ *
+ * A stream that does not start with the magic is passed through
+ * unchanged, so one URL setting serves full images and deltas alike.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "ota_pipeline.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  bool is_delta;         ///< Stream was a patch (not a full image)
+  uint32_t patch_bytes;  ///< Patch bytes consumed
+  uint32_t target_bytes; ///< Image bytes produced
+  uint32_t copied_bytes; ///< Of those, read from the running partition
+  uint32_t apply_ms;     ///< Time inside the applier, including flash writes
+} ota_delta_stats_t;
+
+/**
+ * @brief Build a pipeline sink that applies deltas into @p out
+ *
+ * @param out Sink receiving the full image; its begin() gets the target size
+ * @param source Partition the patch was made against (the running one)
+ * @param flash_gate Optional: called before each @p flash_chunk bytes
+ *                   written to @p out and each source read; may block.
+ *                   Replaces the pipeline's gate, whose chunks count patch
+ *                   bytes rather than the image bytes a COPY produces.
+ * @param flash_chunk 0 writes what each op produces in one call
+ * @param sink Filled with the applier's callbacks
+ */
+esp_err_t ota_delta_sink(const ota_sink_t *out, const esp_partition_t *source,
+                         void (*flash_gate)(void), uint32_t flash_chunk,
+                         ota_sink_t *sink);
+
+void ota_delta_get_stats(ota_delta_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
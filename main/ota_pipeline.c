@@ -0,0 +1,318 @@
+/**
+ * @file ota_pipeline.c
+ * @brief Producer/consumer pipeline between the OTA download and flash
+ *
+ * Slots circulate between two queues: free_q (empty, owned by the producer)
+ * and full_q (filled, owned by the flash task). A NULL slot on full_q ends
+ * the stream. After a sink error the flash task keeps recycling slots
+ * without writing them, so the producer never blocks on a dead consumer.
+ */
+
+#include "ota_pipeline.h"
+#include "alloc_trace.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+#include "metrics.h"
+#include <string.h>
+
+static const char *TAG = "ota_pipeline";
+
+// Internal stack: the sink writes flash, which disables the PSRAM cache
+#define FLASH_TASK_STACK 4096
+// One above the OTA task so filled slots are drained before more arrive
+#define FLASH_TASK_PRIORITY 2
+
+typedef struct {
+  uint8_t *data; ///< NULL ends the stream
+  uint32_t len;
+} slot_msg_t;
+
+static uint8_t *slots[OTA_PIPELINE_SLOTS];
+static QueueHandle_t free_q = NULL;
+static QueueHandle_t full_q = NULL;
+static SemaphoreHandle_t done_sem = NULL;
+static TaskHandle_t flash_task_handle = NULL;
+static ota_sink_t sink;
+static ota_pipeline_config_t config;
+static uint32_t next_checkpoint = 0;
+static volatile esp_err_t sink_err = ESP_OK;
+static volatile bool abort_requested = false;
+static mbedtls_sha256_context sha;
+static uint8_t digest[OTA_SHA256_LEN];
+static ota_pipeline_stats_t stats;
+static int64_t start_us = 0;
+static int64_t gate_us = 0; // flash_gate_ms before rounding: waits are short
+
+static inline uint32_t elapsed_ms(int64_t since_us) {
+  return (uint32_t)((esp_timer_get_time() - since_us) / 1000);
+}
+
+static int32_t rate(uint32_t bytes, uint32_t ms) {
+  return ms ? (int32_t)((uint64_t)bytes * 1000 / ms) : 0;
+}
+
+static void update_gauges(void) {
+  metrics_gauge_set(METRIC_GAUGE_OTA_NET_BPS,
+                    rate(stats.net_bytes, stats.net_ms));
+  metrics_gauge_set(METRIC_GAUGE_OTA_FLASH_BPS,
+                    rate(stats.flash_bytes, stats.flash_ms));
+  metrics_gauge_set(METRIC_GAUGE_OTA_TOTAL_BPS,
+                    rate(stats.flash_bytes, elapsed_ms(start_us)));
+}
+
+static void maybe_checkpoint(void) {
+  uint32_t pos = config.offset + stats.flash_bytes;
+  if (config.checkpoint == NULL || pos < next_checkpoint) {
+    return;
+  }
+  mbedtls_sha256_context snap;
+  uint8_t prefix[OTA_SHA256_LEN];
+  mbedtls_sha256_init(&snap);
+  mbedtls_sha256_clone(&snap, &sha);
+  mbedtls_sha256_finish(&snap, prefix);
+  mbedtls_sha256_free(&snap);
+  config.checkpoint(config.checkpoint_ctx, pos, prefix);
+  next_checkpoint = pos + config.checkpoint_bytes;
+}
+
+/**
+ * Write one slot, in flash_chunk pieces behind the gate if configured
+ */
+static esp_err_t write_slot(const uint8_t *data, uint32_t len) {
+  uint32_t chunk = config.flash_chunk ? config.flash_chunk : len;
+  for (uint32_t off = 0; off < len; off += chunk) {
+    uint32_t n = len - off < chunk ? len - off : chunk;
+    if (config.flash_gate) {
+      int64_t t0 = esp_timer_get_time();
+      config.flash_gate();
+      gate_us += esp_timer_get_time() - t0;
+      stats.flash_gate_ms = (uint32_t)(gate_us / 1000);
+    }
+    esp_err_t err = sink.write(sink.ctx, data + off, n);
+    if (err != ESP_OK) {
+      return err;
+    }
+    mbedtls_sha256_update(&sha, data + off, n);
+  }
+  return ESP_OK;
+}
+
+static void flash_task(void *arg) {
+  (void)arg;
+  slot_msg_t msg;
+
+  int64_t t0 = esp_timer_get_time();
+  esp_err_t err =
+      sink.begin ? sink.begin(sink.ctx, config.image_size) : ESP_OK;
+  stats.flash_ms += elapsed_ms(t0);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Sink begin failed: %s", esp_err_to_name(err));
+    sink_err = err;
+  }
+
+  while (1) {
+    t0 = esp_timer_get_time();
+    xQueueReceive(full_q, &msg, portMAX_DELAY);
+    stats.flash_wait_ms += elapsed_ms(t0);
+    if (msg.data == NULL) {
+      break;
+    }
+
+    if (sink_err == ESP_OK && !abort_requested) {
+      t0 = esp_timer_get_time();
+      int64_t gated = gate_us;
+      err = write_slot(msg.data, msg.len);
+      if (err == ESP_OK) {
+        stats.flash_bytes += msg.len;
+        metrics_add(METRIC_OTA_FLASH_BYTES, msg.len);
+        maybe_checkpoint();
+      } else {
+        ESP_LOGE(TAG, "Sink write at %lu failed: %s",
+                 (unsigned long)stats.flash_bytes, esp_err_to_name(err));
+        sink_err = err;
+      }
+      stats.flash_ms += elapsed_ms(t0 + (gate_us - gated));
+      update_gauges();
+    }
+    xQueueSend(free_q, &msg.data, portMAX_DELAY);
+  }
+
+  if (sink.end) {
+    bool commit = sink_err == ESP_OK && !abort_requested;
+    t0 = esp_timer_get_time();
+    err = sink.end(sink.ctx, commit);
+    stats.flash_ms += elapsed_ms(t0);
+    if (commit && err != ESP_OK) {
+      ESP_LOGE(TAG, "Sink end failed: %s", esp_err_to_name(err));
+      sink_err = err;
+    }
+  }
+
+  mbedtls_sha256_finish(&sha, digest);
+  mbedtls_sha256_free(&sha);
+  // Before the give: the producer may start the next pipeline right away
+  flash_task_handle = NULL;
+  xSemaphoreGive(done_sem);
+  vTaskDelete(NULL);
+}
+
+static void release_all(void) {
+  for (int i = 0; i < OTA_PIPELINE_SLOTS; i++) {
+    if (slots[i]) {
+      TRACE_HEAP_CAPS_FREE(slots[i]);
+      slots[i] = NULL;
+    }
+  }
+  if (free_q) {
+    vQueueDelete(free_q);
+    free_q = NULL;
+  }
+  if (full_q) {
+    vQueueDelete(full_q);
+    full_q = NULL;
+  }
+  if (done_sem) {
+    vSemaphoreDelete(done_sem);
+    done_sem = NULL;
+  }
+}
+
+esp_err_t ota_pipeline_start(const ota_sink_t *s,
+                             const ota_pipeline_config_t *cfg) {
+  if (s == NULL || s->write == NULL || cfg == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (flash_task_handle != NULL || free_q != NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // +1 so the end marker always fits
+  free_q = xQueueCreate(OTA_PIPELINE_SLOTS, sizeof(uint8_t *));
+  full_q = xQueueCreate(OTA_PIPELINE_SLOTS + 1, sizeof(slot_msg_t));
+  done_sem = xSemaphoreCreateBinary();
+  if (!free_q || !full_q || !done_sem) {
+    release_all();
+    return ESP_ERR_NO_MEM;
+  }
+  for (int i = 0; i < OTA_PIPELINE_SLOTS; i++) {
+    slots[i] = TRACE_HEAP_CAPS_MALLOC(ALLOC_TAG_OTA, OTA_PIPELINE_SLOT_SIZE,
+                                      MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (slots[i] == NULL) {
+      ESP_LOGE(TAG, "Failed to allocate %d x %d B slot ring",
+               OTA_PIPELINE_SLOTS, OTA_PIPELINE_SLOT_SIZE);
+      release_all();
+      return ESP_ERR_NO_MEM;
+    }
+    xQueueSend(free_q, &slots[i], 0);
+  }
+
+  sink = *s;
+  config = *cfg;
+  next_checkpoint = config.offset + config.checkpoint_bytes;
+  mbedtls_sha256_init(&sha);
+  if (config.prefix_sha != NULL) {
+    mbedtls_sha256_clone(&sha, config.prefix_sha);
+  } else {
+    mbedtls_sha256_starts(&sha, 0);
+  }
+  config.prefix_sha = NULL; // Only valid during this call
+  sink_err = ESP_OK;
+  abort_requested = false;
+  memset(&stats, 0, sizeof(stats));
+  gate_us = 0;
+  stats.offset = config.offset;
+  memset(digest, 0, sizeof(digest));
+  start_us = esp_timer_get_time();
+
+  if (xTaskCreatePinnedToCore(flash_task, "ota_flash", FLASH_TASK_STACK, NULL,
+                              FLASH_TASK_PRIORITY, &flash_task_handle,
+                              tskNO_AFFINITY) != pdPASS) {
+    flash_task_handle = NULL;
+    mbedtls_sha256_free(&sha);
+    release_all();
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+uint8_t *ota_pipeline_acquire(uint32_t timeout_ms) {
+  uint8_t *slot = NULL;
+  if (free_q == NULL || sink_err != ESP_OK) {
+    return NULL;
+  }
+  int64_t t0 = esp_timer_get_time();
+  if (xQueueReceive(free_q, &slot, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+    ESP_LOGE(TAG, "No free slot after %lu ms", (unsigned long)timeout_ms);
+    slot = NULL;
+  }
+  stats.net_wait_ms += elapsed_ms(t0);
+  return slot;
+}
+
+esp_err_t ota_pipeline_submit(uint8_t *slot, size_t len) {
+  if (slot == NULL || full_q == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (len == 0) {
+    xQueueSend(free_q, &slot, portMAX_DELAY);
+    return sink_err;
+  }
+  slot_msg_t msg = {.data = slot, .len = (uint32_t)len};
+  xQueueSend(full_q, &msg, portMAX_DELAY);
+  stats.net_bytes += len;
+  metrics_add(METRIC_OTA_NET_BYTES, len);
+  return sink_err;
+}
+
+void ota_pipeline_note_net_time(uint32_t ms) { stats.net_ms += ms; }
+
+esp_err_t ota_pipeline_finish(uint8_t out[OTA_SHA256_LEN]) {
+  if (full_q == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  slot_msg_t end = {0};
+  xQueueSend(full_q, &end, portMAX_DELAY);
+  xSemaphoreTake(done_sem, portMAX_DELAY);
+
+  stats.elapsed_ms = elapsed_ms(start_us);
+  update_gauges();
+  ESP_LOGI(TAG,
+           "%lu B in %lu ms: network %ld B/s (waited %lu ms for flash), "
+           "flash %ld B/s (waited %lu ms for data, %lu ms gated), "
+           "end-to-end %ld B/s",
+           (unsigned long)stats.flash_bytes, (unsigned long)stats.elapsed_ms,
+           (long)rate(stats.net_bytes, stats.net_ms),
+           (unsigned long)stats.net_wait_ms,
+           (long)rate(stats.flash_bytes, stats.flash_ms),
+           (unsigned long)stats.flash_wait_ms,
+           (unsigned long)stats.flash_gate_ms,
+           (long)rate(stats.flash_bytes, stats.elapsed_ms));
+
+  if (out) {
+    memcpy(out, digest, OTA_SHA256_LEN);
+  }
+  esp_err_t err = sink_err;
+  release_all();
+  return err;
+}
+
+void ota_pipeline_abort(void) {
+  if (full_q == NULL) {
+    return;
+  }
+  abort_requested = true;
+  (void)ota_pipeline_finish(NULL);
+}
+
+void ota_pipeline_get_stats(ota_pipeline_stats_t *out) {
+  *out = stats;
+  if (free_q != NULL) {
+    out->elapsed_ms = elapsed_ms(start_us);
+  }
+}
@@ -0,0 +1,136 @@
+/**
+ * @file ota_pipeline.h
+ * @brief Producer/consumer pipeline between the OTA download and flash
+ *
+ * The OTA task (producer) fills large PSRAM slots from the network while a
+ * dedicated flash task (consumer) erases, writes and hashes the slots it
+ * has been handed, so the two never wait on each other as long as the ring
+ * has a free slot. The flash side goes through an ota_sink_t, which keeps
+ * the pipeline independent of what is being written.
+ *
+ * Only one pipeline exists at a time; all calls except
+ * ota_pipeline_get_stats() belong to the producer task.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "mbedtls/sha256.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OTA_PIPELINE_SLOTS 4
+#define OTA_PIPELINE_SLOT_SIZE (32 * 1024)
+#define OTA_SHA256_LEN 32
+
+/**
+ * @brief Destination of the pipeline, called from the flash task
+ */
+typedef struct {
+  /**
+   * Prepare the destination (e.g. esp_ota_begin, which erases ahead)
+   * @param image_size Stream size if known, 0 otherwise
+   */
+  esp_err_t (*begin)(void *ctx, size_t image_size);
+  /** Consume the next @p len bytes of the stream */
+  esp_err_t (*write)(void *ctx, const void *data, size_t len);
+  /**
+   * Optional: the stream ended (@p commit) or was abandoned. Called once
+   * after begin(); a commit may still fail verification.
+   */
+  esp_err_t (*end)(void *ctx, bool commit);
+  void *ctx;
+} ota_sink_t;
+
+typedef struct {
+  size_t image_size; ///< Whole stream including a resumed prefix, 0 if unknown
+  uint32_t offset;   ///< Stream position of the first submitted byte
+  /** Hash state of the bytes before @p offset (cloned), NULL when 0 */
+  const mbedtls_sha256_context *prefix_sha;
+  /**
+   * Optional: called on the flash task each time another checkpoint_bytes
+   * are safely written, with the stream position and the SHA-256 up to it
+   */
+  void (*checkpoint)(void *ctx, uint32_t offset,
+                     const uint8_t digest[OTA_SHA256_LEN]);
+  void *checkpoint_ctx;
+  uint32_t checkpoint_bytes;
+  /**
+   * Optional: called on the flash task before each flash_chunk bytes are
+   * written; may block to hold flash writes back
+   */
+  void (*flash_gate)(void);
+  uint32_t flash_chunk; ///< 0 writes whole slots
+} ota_pipeline_config_t;
+
+typedef struct {
+  uint32_t offset;        ///< Stream position this run started at
+  uint32_t net_bytes;     ///< Handed to the pipeline by the producer
+  uint32_t flash_bytes;   ///< Written by the sink; offset + this resumes
+  uint32_t net_ms;        ///< Producer time spent receiving
+  uint32_t net_wait_ms;   ///< Producer time spent waiting for a free slot
+  uint32_t flash_ms;      ///< Flash task time spent in the sink and hash
+  uint32_t flash_wait_ms; ///< Flash task time spent waiting for data
+  uint32_t flash_gate_ms; ///< Flash task time held back by flash_gate
+  uint32_t elapsed_ms;    ///< Since ota_pipeline_start()
+} ota_pipeline_stats_t;
+
+/**
+ * @brief Allocate the slot ring and start the flash task
+ *
+ * The sink's begin() runs on the flash task while the producer already
+ * downloads into the free slots.
+ */
+esp_err_t ota_pipeline_start(const ota_sink_t *sink,
+                             const ota_pipeline_config_t *config);
+
+/**
+ * @brief Take an empty slot of OTA_PIPELINE_SLOT_SIZE bytes
+ *
+ * Blocks while every slot is queued for flash.
+ *
+ * @param timeout_ms How long to wait for the flash task
+ * @return NULL on timeout or once the flash side has failed
+ */
+uint8_t *ota_pipeline_acquire(uint32_t timeout_ms);
+
+/**
+ * @brief Queue a slot from ota_pipeline_acquire() for flash
+ *
+ * @param len Bytes filled; 0 just returns the slot
+ * @return The sink's error once it has failed, otherwise ESP_OK
+ */
+esp_err_t ota_pipeline_submit(uint8_t *slot, size_t len);
+
+/**
+ * @brief Account producer time spent receiving (for the throughput figures)
+ */
+void ota_pipeline_note_net_time(uint32_t ms);
+
+/**
+ * @brief Drain the queue, stop the flash task and free the ring
+ *
+ * @param digest Receives the SHA-256 of the whole stream, including a
+ *               resumed prefix (may be NULL)
+ * @return ESP_OK if the sink accepted and verified the whole stream
+ */
+esp_err_t ota_pipeline_finish(uint8_t digest[OTA_SHA256_LEN]);
+
+/**
+ * @brief Stop without waiting for the queued slots to be written
+ */
+void ota_pipeline_abort(void);
+
+/**
+ * @brief Counters of the running or last pipeline
+ */
+void ota_pipeline_get_stats(ota_pipeline_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
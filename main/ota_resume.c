@@ -0,0 +1,124 @@
+/**
+ * @file ota_resume.c
+ * @brief Resume checkpoints of an interrupted OTA download
+ */
+
+#include "ota_resume.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "spi_flash_mmap.h"
+#include <string.h>
+#include <strings.h>
+
+static const char *TAG = "ota_resume";
+
+#define OTA_NVS_NAMESPACE "ota_resume"
+#define OTA_NVS_KEY "checkpoint"
+
+void ota_resume_init(ota_checkpoint_t *cp, const char *url,
+                     const char *label) {
+  memset(cp, 0, sizeof(*cp));
+  cp->version = OTA_RESUME_VERSION;
+  mbedtls_sha256((const unsigned char *)url, strlen(url), cp->url_sha, 0);
+  strlcpy(cp->label, label, sizeof(cp->label));
+}
+
+bool ota_resume_load(const ota_checkpoint_t *cp, ota_checkpoint_t *saved) {
+  nvs_handle_t handle;
+  size_t len = sizeof(*saved);
+  memset(saved, 0, sizeof(*saved));
+  if (nvs_open(OTA_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return false;
+  }
+  esp_err_t err = nvs_get_blob(handle, OTA_NVS_KEY, saved, &len);
+  nvs_close(handle);
+  if (err != ESP_OK || len != sizeof(*saved) ||
+      saved->version != OTA_RESUME_VERSION) {
+    memset(saved, 0, sizeof(*saved));
+    return false;
+  }
+  return memcmp(saved->url_sha, cp->url_sha, OTA_SHA256_LEN) == 0 &&
+         strcmp(saved->label, cp->label) == 0 && saved->offset > 0 &&
+         saved->offset < saved->total && saved->validator[0] != '\0';
+}
+
+bool ota_resume_verify(const esp_partition_t *partition,
+                       const ota_checkpoint_t *saved,
+                       mbedtls_sha256_context *sha) {
+  const void *map = NULL;
+  esp_partition_mmap_handle_t map_handle;
+  uint8_t digest[OTA_SHA256_LEN];
+
+  // Read through a mapping, so the OTA task (whose stack may be in PSRAM)
+  // never disables the cache
+  if (saved->offset > partition->size ||
+      esp_partition_mmap(partition, 0, saved->offset, ESP_PARTITION_MMAP_DATA,
+                         &map, &map_handle) != ESP_OK) {
+    return false;
+  }
+  mbedtls_sha256_starts(sha, 0);
+  mbedtls_sha256_update(sha, (const uint8_t *)map, saved->offset);
+  esp_partition_munmap(map_handle);
+
+  mbedtls_sha256_context snap;
+  mbedtls_sha256_init(&snap);
+  mbedtls_sha256_clone(&snap, sha);
+  mbedtls_sha256_finish(&snap, digest);
+  mbedtls_sha256_free(&snap);
+  return memcmp(digest, saved->prefix_sha, OTA_SHA256_LEN) == 0;
+}
+
+bool ota_resume_save(ota_checkpoint_t *cp, uint32_t offset,
+                     const uint8_t digest[OTA_SHA256_LEN]) {
+  nvs_handle_t handle;
+  bool stored = false;
+
+  if (offset % SPI_FLASH_SEC_SIZE != 0) {
+    return false;
+  }
+  cp->offset = offset;
+  memcpy(cp->prefix_sha, digest, OTA_SHA256_LEN);
+  if (nvs_open(OTA_NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+    if (nvs_set_blob(handle, OTA_NVS_KEY, cp, sizeof(*cp)) == ESP_OK) {
+      stored = nvs_commit(handle) == ESP_OK;
+    }
+    nvs_close(handle);
+  }
+  ESP_LOGD(TAG, "Checkpoint at %lu bytes", (unsigned long)offset);
+  return stored;
+}
+
+void ota_resume_clear(void) {
+  nvs_handle_t handle;
+  if (nvs_open(OTA_NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK) {
+    if (nvs_erase_key(handle, OTA_NVS_KEY) == ESP_OK) {
+      nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+}
+
+void ota_resume_note_header(char validator[OTA_RESUME_VALIDATOR_LEN],
+                            const char *key, const char *value) {
+  if (validator[0] == '"') {
+    return; // Already have a strong ETag
+  }
+  if (strcasecmp(key, "ETag") == 0 ? value[0] == '"'
+                                   : strcasecmp(key, "Last-Modified") == 0) {
+    // A cut validator would never match: keep none instead
+    if (strlcpy(validator, value, OTA_RESUME_VALIDATOR_LEN) >=
+        OTA_RESUME_VALIDATOR_LEN) {
+      validator[0] = '\0';
+    }
+  }
+}
+
+bool ota_resume_continues(const ota_checkpoint_t *cp, uint32_t at,
+                          bool ranged, uint32_t total, const char *validator) {
+  // A 200 to a Range is the whole image again, not its rest
+  if (!ranged && at > 0) {
+    return false;
+  }
+  return total == cp->total &&
+         (validator == NULL || strcmp(validator, cp->validator) == 0);
+}
@@ -0,0 +1,105 @@
+/**
+ * @file ota_resume.h
+ * @brief Resume checkpoints of an interrupted OTA download
+ *
+ * The pipeline's flash task reports a checkpoint every few hundred KB: the
+ * stream offset and the SHA-256 of everything before it. Stored in NVS
+ * with a hash of the URL, the target partition and the image's validator
+ * (strong ETag or Last-Modified), it lets an update to the same URL
+ * continue after a drop or a reboot. Before continuing, the prefix on
+ * flash is hashed again and has to match.
+ *
+ * Ranges go out with If-Range carrying the validator: a server whose image
+ * changed answers 200 with the new one instead of the rest of the old one.
+ */
+
+#pragma once
+
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+#include "ota_pipeline.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OTA_RESUME_VERSION 2
+/// ETag or Last-Modified sent back as If-Range; longer ones are not kept
+#define OTA_RESUME_VALIDATOR_LEN 80
+
+/**
+ * @brief Resume checkpoint, stored in NVS as one blob
+ */
+typedef struct {
+  uint32_t version;
+  uint8_t url_sha[OTA_SHA256_LEN];
+  char label[17];          ///< Target partition
+  uint32_t total;          ///< Image size; resume needs a known size
+  uint32_t offset;         ///< Bytes safely on flash, sector aligned
+  uint8_t prefix_sha[OTA_SHA256_LEN]; ///< SHA-256 of those bytes
+  char validator[OTA_RESUME_VALIDATOR_LEN]; ///< ETag or date, "" if none
+} ota_checkpoint_t;
+
+/**
+ * @brief Start a checkpoint for downloading @p url into @p label
+ */
+void ota_resume_init(ota_checkpoint_t *cp, const char *url,
+                     const char *label);
+
+/**
+ * @brief Load the stored checkpoint if it can continue @p cp
+ *
+ * Same URL and partition, a known size not yet reached, and a validator
+ * to send as If-Range.
+ */
+bool ota_resume_load(const ota_checkpoint_t *cp, ota_checkpoint_t *saved);
+
+/**
+ * @brief Hash the first saved->offset bytes of @p partition and compare
+ *
+ * On success @p sha holds the prefix state to continue hashing from.
+ */
+bool ota_resume_verify(const esp_partition_t *partition,
+                       const ota_checkpoint_t *saved,
+                       mbedtls_sha256_context *sha);
+
+/**
+ * @brief Store @p cp at @p offset with the prefix hash @p digest
+ *
+ * Offsets inside a flash sector are skipped: esp_ota_resume() erases from
+ * the sector holding the offset.
+ *
+ * @return true if stored
+ */
+bool ota_resume_save(ota_checkpoint_t *cp, uint32_t offset,
+                     const uint8_t digest[OTA_SHA256_LEN]);
+
+/**
+ * @brief Forget the stored checkpoint
+ */
+void ota_resume_clear(void);
+
+/**
+ * @brief Keep a response header if it can be sent back as If-Range
+ *
+ * A strong ETag wins over Last-Modified; a weak ETag is never kept, and
+ * neither is one that does not fit.
+ */
+void ota_resume_note_header(char validator[OTA_RESUME_VALIDATOR_LEN],
+                            const char *key, const char *value);
+
+/**
+ * @brief Whether a response to a request from @p at continues @p cp
+ *
+ * @param ranged The server answered 206
+ * @param total Image size the response implies
+ * @param validator The response's validator, NULL to not compare
+ */
+bool ota_resume_continues(const ota_checkpoint_t *cp, uint32_t at,
+                          bool ranged, uint32_t total, const char *validator);
+
+#ifdef __cplusplus
+}
+#endif
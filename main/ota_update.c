@@ -4,22 +4,40 @@
  */
 
 #include "ota_update.h"
+#include "alloc_trace.h"
+#include "dns_cache.h"
 #include "esp_app_format.h"
 #include "esp_http_client.h"
 #include "esp_https_ota.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "led_status.h"
+#include "mbedtls/sha256.h"
 #include "oled_status.h"
+#include "ota_budget.h"
+#include "ota_delta.h"
+#include "ota_pipeline.h"
+#include "ota_resume.h"
+#include <stdio.h>
 #include <string.h>
 
 static const char *TAG = "ota_update";
 
 #define OTA_TASK_STACK_WORDS 4096
-#define OTA_TASK_PRIORITY 2
+// Lowest application priority: the download only uses what audio leaves
+#define OTA_TASK_PRIORITY 1
+// Longest the download waits for a free slot (covers the up-front erase)
+#define OTA_SLOT_WAIT_MS 60000
+
+// Resume: checkpoint interval and reconnects per download
+#define OTA_CHECKPOINT_BYTES (256 * 1024)
+#define OTA_MAX_RETRIES 5
+#define OTA_RETRY_DELAY_MS 2000
 
 // OTA state
 static ota_state_t ota_state = OTA_STATE_IDLE;
@@ -51,168 +69,475 @@ static void notify_progress(ota_state_t state, int progress,
   ESP_LOGI(TAG, "[%d%%] %s", progress, message);
 }
 
+typedef struct {
+  const esp_partition_t *partition;
+  esp_ota_handle_t handle;
+  uint32_t resume_offset; ///< Bytes already on flash from an earlier run
+} ota_flash_sink_t;
+
 /**
- * @brief OTA update task - Uses direct HTTP client + OTA ops for HTTP support
+ * @brief Pipeline sink begin: runs on the flash task, so erasing the image
+ * area overlaps with the first downloads
  */
-static void ota_update_task(void *pvParameter) {
-  ota_task_ctx_t *ctx = (ota_task_ctx_t *)pvParameter;
-  const char *url = ctx ? ctx->url : NULL;
-  esp_err_t ret = ESP_FAIL;
-  esp_ota_handle_t ota_handle = 0;
-  const esp_partition_t *update_partition = NULL;
-  char *buffer = NULL;
-  const int buffer_size = 4096;
-  int total_read = 0;
-  int content_length = 0;
-
-  if (!url) {
-    ESP_LOGE(TAG, "OTA URL is NULL");
-    goto ota_end;
+static esp_err_t flash_sink_begin(void *arg, size_t image_size) {
+  ota_flash_sink_t *fs = (ota_flash_sink_t *)arg;
+  if (fs->resume_offset > 0) {
+    // Keep the verified prefix; erase sector by sector from there on
+    return esp_ota_resume(fs->partition, OTA_WITH_SEQUENTIAL_WRITES,
+                          fs->resume_offset, &fs->handle);
   }
+  // A known size erases exactly the image up front; otherwise sector by sector
+  return esp_ota_begin(fs->partition,
+                       image_size > 0 ? image_size : OTA_WITH_SEQUENTIAL_WRITES,
+                       &fs->handle);
+}
 
-  ESP_LOGI(TAG, "Starting OTA update from: %s", url);
-  notify_progress(OTA_STATE_DOWNLOADING, 0, "Starting OTA update");
-  oled_status_set_ota_state(OLED_OTA_RUNNING);
-  oled_status_set_last_event("ota-start");
+static esp_err_t flash_sink_write(void *arg, const void *data, size_t len) {
+  ota_flash_sink_t *fs = (ota_flash_sink_t *)arg;
+  return esp_ota_write(fs->handle, data, len);
+}
 
-  // Set LED to OTA mode (white breathing)
-  led_status_set(LED_STATUS_OTA);
+/**
+ * @brief Pipeline checkpoint callback (flash task)
+ */
+static void checkpoint_save(void *arg, uint32_t offset,
+                            const uint8_t digest[OTA_SHA256_LEN]) {
+  ota_delta_stats_t delta;
+
+  // Patches are small and their applier state is not persisted
+  ota_delta_get_stats(&delta);
+  if (!delta.is_delta) {
+    ota_resume_save((ota_checkpoint_t *)arg, offset, digest);
+  }
+}
 
-  // Allocate download buffer
-  buffer = malloc(buffer_size);
-  if (buffer == NULL) {
-    ESP_LOGE(TAG, "Failed to allocate buffer");
-    notify_progress(OTA_STATE_FAILED, 0, "Memory allocation failed");
-    goto ota_end;
+/**
+ * @brief Keep the response's strong ETag, or else its Last-Modified
+ *
+ * Either can go back as If-Range; a weak ETag cannot.
+ */
+static esp_err_t on_http_event(esp_http_client_event_t *evt) {
+  if (evt->event_id == HTTP_EVENT_ON_HEADER) {
+    ota_resume_note_header((char *)evt->user_data, evt->header_key,
+                           evt->header_value);
   }
+  return ESP_OK;
+}
 
-  // Configure HTTP client for plain HTTP
+/**
+ * @brief Open the image URL, from @p offset on if non-zero
+ *
+ * @param if_range Validator of the bytes already received; the server then
+ *                 answers 206 only if the image is unchanged, and 200 with
+ *                 the whole new image otherwise. "" sends a plain Range.
+ * @param validator Receives the response's ETag or Last-Modified, "" if none
+ * @param total Image size, 0 if the server did not say
+ * @param ranged true if the server answered the Range request (206)
+ */
+static esp_err_t open_stream(const char *url, uint32_t offset,
+                             const char *if_range,
+                             char validator[OTA_RESUME_VALIDATOR_LEN],
+                             esp_http_client_handle_t *out, int *total,
+                             bool *ranged) {
+  // Range retries reconnect several times; connect by the cached address
+  char direct[320];
+  bool by_addr = dns_cache_rewrite_url(url, direct, sizeof(direct)) == ESP_OK &&
+                 strcmp(direct, url) != 0;
   esp_http_client_config_t config = {
-      .url = url,
+      .url = by_addr ? direct : url,
       .timeout_ms = 30000,
       .keep_alive_enable = true,
+      .event_handler = on_http_event,
+      .user_data = validator,
   };
 
+  *out = NULL;
   esp_http_client_handle_t client = esp_http_client_init(&config);
   if (client == NULL) {
     ESP_LOGE(TAG, "Failed to init HTTP client");
-    notify_progress(OTA_STATE_FAILED, 0, "HTTP client init failed");
-    goto ota_end;
+    return ESP_ERR_NO_MEM;
   }
+  if (by_addr) {
+    // Virtual hosts still need the name from the URL
+    const char *authority = strstr(url, "://") + 3;
+    size_t len = strcspn(authority, "/?#");
+    const char *at = memchr(authority, '@', len);
+    if (at != NULL) {
+      len -= (size_t)(at + 1 - authority);
+      authority = at + 1;
+    }
+    char host[DNS_CACHE_HOST_LEN + 8];
+    snprintf(host, sizeof(host), "%.*s", (int)len, authority);
+    esp_http_client_set_header(client, "Host", host);
+  }
+  if (offset > 0) {
+    char range[32];
+    snprintf(range, sizeof(range), "bytes=%lu-", (unsigned long)offset);
+    esp_http_client_set_header(client, "Range", range);
+    if (if_range[0] != '\0') {
+      esp_http_client_set_header(client, "If-Range", if_range);
+    }
+  }
+  validator[0] = '\0';
 
-  // Open HTTP connection
-  ret = esp_http_client_open(client, 0);
+  esp_err_t ret = esp_http_client_open(client, 0);
   if (ret != ESP_OK) {
     ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(ret));
-    notify_progress(OTA_STATE_FAILED, 0, "HTTP connection failed");
     esp_http_client_cleanup(client);
-    goto ota_end;
+    return ret;
   }
 
-  // Fetch headers
-  content_length = esp_http_client_fetch_headers(client);
+  int content_length = esp_http_client_fetch_headers(client);
   int status = esp_http_client_get_status_code(client);
-  if (status != 200) {
+  *ranged = (offset > 0 && status == 206);
+  if (status != 200 && !*ranged) {
     ESP_LOGE(TAG, "HTTP status %d", status);
-    notify_progress(OTA_STATE_FAILED, 0, "HTTP status not OK");
     esp_http_client_close(client);
     esp_http_client_cleanup(client);
-    goto ota_end;
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  // A 206 body is the rest of the image
+  *total = content_length > 0 ? content_length + (*ranged ? (int)offset : 0)
+                              : 0;
+  *out = client;
+  return ESP_OK;
+}
+
+static void close_stream(esp_http_client_handle_t client) {
+  if (client) {
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
   }
+}
 
-  bool length_known = (content_length > 0);
-  if (length_known) {
-    ESP_LOGI(TAG, "Image size: %d bytes", content_length);
-  } else {
-    ESP_LOGW(TAG, "Image size unknown (no Content-Length)");
+/**
+ * @brief Fill the rest of one pipeline slot from the HTTP stream
+ *
+ * Reads in OTA_BUDGET_READ_CHUNK pieces, each charged to the budget.
+ *
+ * @param fill Bytes already in the slot, updated
+ * @return 1 when the slot is full, 0 at end of stream, -1 on a read error
+ */
+static int read_slot(esp_http_client_handle_t client, uint8_t *slot,
+                     int *fill) {
+  int result = 1;
+  int64_t net_us = 0; // Excludes time throttled by the budget
+  while (*fill < OTA_PIPELINE_SLOT_SIZE) {
+    int want = OTA_PIPELINE_SLOT_SIZE - *fill;
+    if (want > OTA_BUDGET_READ_CHUNK) {
+      want = OTA_BUDGET_READ_CHUNK;
+    }
+    int64_t t0 = esp_timer_get_time();
+    int n = esp_http_client_read(client, (char *)slot + *fill, want);
+    net_us += esp_timer_get_time() - t0;
+    if (n <= 0) {
+      result = n < 0 ? -1 : 0; // 0: connection closed
+      break;
+    }
+    *fill += n;
+    ota_budget_take(n);
   }
+  ota_pipeline_note_net_time((uint32_t)(net_us / 1000));
+  return result;
+}
+
+/**
+ * @brief OTA update task - HTTP download pipelined into a flash task
+ *
+ * A dropped connection is reopened with a Range request from the first
+ * byte not yet received, up to OTA_MAX_RETRIES times in a row without
+ * progress. Every OTA_CHECKPOINT_BYTES written, the offset, the SHA-256 of
+ * the prefix and the image's ETag (or Last-Modified) go to NVS, so an
+ * update to the same URL continues after a reboot once the prefix on flash
+ * still matches. Ranges carry If-Range with that validator: a server whose
+ * image changed answers 200 with the new one, and the download starts over.
+ */
+static void ota_update_task(void *pvParameter) {
+  ota_task_ctx_t *ctx = (ota_task_ctx_t *)pvParameter;
+  const char *url = ctx ? ctx->url : NULL;
+  esp_err_t ret = ESP_FAIL;
+  esp_http_client_handle_t client = NULL;
+  ota_flash_sink_t flash_sink = {0};
+  ota_checkpoint_t cp = {0};
+  ota_checkpoint_t saved = {0};
+  mbedtls_sha256_context prefix_sha;
+  uint8_t digest[OTA_SHA256_LEN];
+  uint32_t offset = 0;
+  int total = 0;
+  bool ranged = false;
+  bool restarted = false;
+  int retries = 0;
+  uint32_t last_drop = 0;
+
+  mbedtls_sha256_init(&prefix_sha);
+
+  if (!url) {
+    ESP_LOGE(TAG, "OTA URL is NULL");
+    goto ota_end;
+  }
+
+  ESP_LOGI(TAG, "Starting OTA update from: %s", url);
+  notify_progress(OTA_STATE_DOWNLOADING, 0, "Starting OTA update");
+  oled_status_set_ota_state(OLED_OTA_RUNNING);
+  oled_status_set_last_event("ota-start");
+
+  // Set LED to OTA mode (white breathing)
+  led_status_set(LED_STATUS_OTA);
+  ota_budget_begin();
 
   // Get update partition
-  update_partition = esp_ota_get_next_update_partition(NULL);
-  if (update_partition == NULL) {
+  flash_sink.partition = esp_ota_get_next_update_partition(NULL);
+  if (flash_sink.partition == NULL) {
     ESP_LOGE(TAG, "No OTA partition found");
     notify_progress(OTA_STATE_FAILED, 0, "No OTA partition");
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
     goto ota_end;
   }
 
-  ESP_LOGI(TAG, "Writing to partition: %s at 0x%lx", update_partition->label,
-           update_partition->address);
+  // Continue an interrupted download of the same URL into the same slot
+  ota_resume_init(&cp, url, flash_sink.partition->label);
+  if (ota_resume_load(&cp, &saved)) {
+    if (ota_resume_verify(flash_sink.partition, &saved, &prefix_sha)) {
+      offset = saved.offset;
+      ESP_LOGI(TAG, "Resuming at %lu of %lu bytes", (unsigned long)offset,
+               (unsigned long)saved.total);
+    } else {
+      ESP_LOGW(TAG, "Flash no longer matches the checkpoint; starting over");
+    }
+  }
+  if (offset == 0) {
+    ota_resume_clear();
+  }
 
-  // Begin OTA
-  ret =
-      esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &ota_handle);
+  ret = open_stream(url, offset, saved.validator, cp.validator, &client,
+                    &total, &ranged);
+  if (ret == ESP_OK && offset > 0 &&
+      !ota_resume_continues(&saved, offset, ranged, (uint32_t)total,
+                            cp.validator)) {
+    // A 200 is the whole (new) image: use it as a fresh download
+    ESP_LOGW(TAG, "Cannot resume (%s); downloading from the start",
+             ranged ? "image changed" : "server sent the whole image");
+    ota_resume_clear();
+    offset = 0;
+    if (ranged) {
+      close_stream(client);
+      ret = open_stream(url, 0, "", cp.validator, &client, &total, &ranged);
+    }
+  }
   if (ret != ESP_OK) {
-    ESP_LOGE(TAG, "OTA begin failed: %s", esp_err_to_name(ret));
-    notify_progress(OTA_STATE_FAILED, 0, "OTA begin failed");
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
+    notify_progress(OTA_STATE_FAILED, 0,
+                    ret == ESP_ERR_INVALID_RESPONSE ? "HTTP status not OK"
+                                                    : "HTTP connection failed");
     goto ota_end;
   }
 
-  // Download and write firmware
-  while (1) {
-    int read_len = esp_http_client_read(client, buffer, buffer_size);
-    if (read_len < 0) {
-      ESP_LOGE(TAG, "HTTP read error");
+fresh_start:;
+  bool length_known = (total > 0);
+  if (length_known) {
+    ESP_LOGI(TAG, "Image size: %d bytes", total);
+  } else {
+    ESP_LOGW(TAG, "Image size unknown (no Content-Length)");
+  }
+  if (length_known && total > (int)flash_sink.partition->size) {
+    ESP_LOGE(TAG, "Image of %d bytes does not fit %s (%lu bytes)", total,
+             flash_sink.partition->label,
+             (unsigned long)flash_sink.partition->size);
+    notify_progress(OTA_STATE_FAILED, 0, "Image too large");
+    goto ota_abort;
+  }
+
+  ESP_LOGI(TAG, "Writing to partition: %s at 0x%lx",
+           flash_sink.partition->label, flash_sink.partition->address);
+
+  // Begin OTA: the flash task erases while the first slots download. The
+  // delta applier passes full images straight through; a resumed download
+  // is always a full image.
+  flash_sink.resume_offset = offset;
+  const ota_sink_t image_sink = {
+      .begin = flash_sink_begin,
+      .write = flash_sink_write,
+      .ctx = &flash_sink,
+  };
+  ota_sink_t sink;
+  ret = ota_delta_sink(&image_sink, esp_ota_get_running_partition(),
+                       ota_budget_flash_gate, OTA_BUDGET_FLASH_CHUNK, &sink);
+  bool via_delta = offset == 0;
+  if (!via_delta) {
+    sink = image_sink;
+  }
+  cp.total = length_known ? total : 0;
+  const ota_pipeline_config_t pipe_cfg = {
+      .image_size = cp.total,
+      .offset = offset,
+      .prefix_sha = offset > 0 ? &prefix_sha : NULL,
+      // Without a size a resumed download could not tell it is complete
+      .checkpoint = length_known ? checkpoint_save : NULL,
+      .checkpoint_ctx = &cp,
+      .checkpoint_bytes = OTA_CHECKPOINT_BYTES,
+      // Hold flash writes back while the voice pipeline needs the cache;
+      // the applier gates its own output (COPY ops outgrow the patch)
+      .flash_gate = via_delta ? NULL : ota_budget_flash_gate,
+      .flash_chunk = OTA_BUDGET_FLASH_CHUNK,
+  };
+  if (ret == ESP_OK) {
+    ret = ota_pipeline_start(&sink, &pipe_cfg);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "OTA pipeline start failed: %s", esp_err_to_name(ret));
+    notify_progress(OTA_STATE_FAILED, 0, "OTA begin failed");
+    goto ota_abort;
+  }
+
+  // Download into pipeline slots; the flash task writes them behind us
+  uint32_t received = offset;
+  bool eof = false;
+  while (!eof) {
+    uint8_t *slot = ota_pipeline_acquire(OTA_SLOT_WAIT_MS);
+    if (slot == NULL) {
+      ESP_LOGE(TAG, "OTA flash stage failed or stalled");
+      notify_progress(OTA_STATE_FAILED, ota_progress, "Flash write failed");
+      goto ota_stop;
+    }
+
+    int fill = 0;
+    bool start_over = false;
+    while (1) {
+      if (client != NULL) {
+        int r = read_slot(client, slot, &fill);
+        if (r > 0) {
+          break;
+        }
+        if (r == 0 && (!length_known || received + fill >= (uint32_t)total)) {
+          eof = true;
+          break;
+        }
+        close_stream(client);
+        client = NULL;
+      }
+
+      // Read error, early close or failed reconnect: continue where it stopped
+      uint32_t at = received + fill;
+      if (at > last_drop) {
+        // Progress since the last drop: a flaky link gets a fresh budget
+        retries = 0;
+        last_drop = at;
+      }
+      if (!length_known || ++retries > OTA_MAX_RETRIES) {
+        ESP_LOGE(TAG, "HTTP read error at %lu bytes", (unsigned long)at);
+        break;
+      }
+      ESP_LOGW(TAG, "Download dropped at %lu bytes, retry %d/%d",
+               (unsigned long)at, retries, OTA_MAX_RETRIES);
+      vTaskDelay(pdMS_TO_TICKS(OTA_RETRY_DELAY_MS * retries));
+      int again = 0;
+      char validator[OTA_RESUME_VALIDATOR_LEN];
+      if (open_stream(url, at, cp.validator, validator, &client, &again,
+                      &ranged) != ESP_OK) {
+        continue;
+      }
+      if (!ranged && at > 0 && !restarted) {
+        // If-Range failed or Range is unsupported: this is a whole image
+        ESP_LOGW(TAG, "Server sent the whole image again; starting over");
+        restarted = start_over = true;
+        total = again;
+        strlcpy(cp.validator, validator, sizeof(cp.validator));
+        break;
+      }
+      if (!ota_resume_continues(&cp, at, ranged, (uint32_t)again, NULL)) {
+        ESP_LOGE(TAG, "Server cannot continue the download");
+        close_stream(client);
+        client = NULL;
+        retries = OTA_MAX_RETRIES;
+      }
+    }
+    if (start_over) {
+      // Drop what was written; the open 200 response is the new stream
+      ota_pipeline_submit(slot, 0);
+      ota_pipeline_abort();
+      if (flash_sink.handle) {
+        esp_ota_abort(flash_sink.handle);
+        flash_sink.handle = 0;
+      }
+      ota_resume_clear();
+      offset = 0;
+      retries = 0;
+      last_drop = 0;
+      notify_progress(OTA_STATE_DOWNLOADING, 0, "Image changed, restarting");
+      goto fresh_start;
+    }
+    if (client == NULL && !eof) {
+      ota_pipeline_submit(slot, 0);
       notify_progress(OTA_STATE_FAILED, ota_progress, "Download error");
-      esp_ota_abort(ota_handle);
-      esp_http_client_close(client);
-      esp_http_client_cleanup(client);
-      goto ota_end;
-    } else if (read_len == 0) {
-      // Connection closed
-      break;
+      goto ota_stop;
     }
 
-    // Write to flash
-    ret = esp_ota_write(ota_handle, buffer, read_len);
+    ret = ota_pipeline_submit(slot, fill);
     if (ret != ESP_OK) {
       ESP_LOGE(TAG, "OTA write failed: %s", esp_err_to_name(ret));
       notify_progress(OTA_STATE_FAILED, ota_progress, "Flash write failed");
-      esp_ota_abort(ota_handle);
-      esp_http_client_close(client);
-      esp_http_client_cleanup(client);
-      goto ota_end;
+      goto ota_stop;
     }
+    received += fill;
 
-    total_read += read_len;
     char msg[64];
     int progress = 0;
     if (length_known) {
-      progress = (total_read * 100) / content_length;
-      snprintf(msg, sizeof(msg), "Downloading: %d/%d bytes", total_read,
-               content_length);
+      progress = (int)(((int64_t)received * 100) / total);
+      snprintf(msg, sizeof(msg), "Downloading: %lu/%d bytes",
+               (unsigned long)received, total);
     } else {
-      snprintf(msg, sizeof(msg), "Downloading: %d bytes", total_read);
+      snprintf(msg, sizeof(msg), "Downloading: %lu bytes",
+               (unsigned long)received);
     }
     notify_progress(OTA_STATE_DOWNLOADING, progress, msg);
   }
 
   // Close HTTP
-  esp_http_client_close(client);
-  esp_http_client_cleanup(client);
+  close_stream(client);
+  client = NULL;
+
+  // Wait for the flash task to write everything still queued
+  ret = ota_pipeline_finish(digest);
+  ota_delta_stats_t delta;
+  ota_delta_get_stats(&delta);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "OTA write failed: %s", esp_err_to_name(ret));
+    notify_progress(OTA_STATE_FAILED, ota_progress,
+                    ret == ESP_ERR_INVALID_CRC ? "Delta does not match firmware"
+                                               : "Flash write failed");
+    ota_resume_clear();
+    if (flash_sink.handle) {
+      esp_ota_abort(flash_sink.handle);
+    }
+    goto ota_end;
+  }
 
   // Verify complete download
-  if (total_read == 0) {
+  if (received == 0) {
     ESP_LOGE(TAG, "Download failed: no data received");
     notify_progress(OTA_STATE_FAILED, ota_progress, "No data received");
-    esp_ota_abort(ota_handle);
+    esp_ota_abort(flash_sink.handle);
     goto ota_end;
   }
 
-  if (length_known && total_read != content_length) {
-    ESP_LOGE(TAG, "Incomplete download: %d/%d", total_read, content_length);
+  if (length_known && received != (uint32_t)total) {
+    ESP_LOGE(TAG, "Incomplete download: %lu/%d", (unsigned long)received,
+             total);
     notify_progress(OTA_STATE_FAILED, ota_progress, "Incomplete download");
-    esp_ota_abort(ota_handle);
+    esp_ota_abort(flash_sink.handle);
     goto ota_end;
   }
+  ota_resume_clear();
+
+  char hex[OTA_SHA256_LEN * 2 + 1];
+  for (int i = 0; i < OTA_SHA256_LEN; i++) {
+    snprintf(hex + i * 2, 3, "%02x", digest[i]);
+  }
+  ESP_LOGI(TAG, "%s SHA-256: %s", delta.is_delta ? "Patch" : "Image", hex);
 
   notify_progress(OTA_STATE_VERIFYING, 100, "Verifying firmware");
 
   // Finish OTA
-  ret = esp_ota_end(ota_handle);
+  ret = esp_ota_end(flash_sink.handle);
   if (ret != ESP_OK) {
     if (ret == ESP_ERR_OTA_VALIDATE_FAILED) {
       ESP_LOGE(TAG, "Image validation failed");
@@ -225,7 +550,7 @@ static void ota_update_task(void *pvParameter) {
   }
 
   // Set boot partition
-  ret = esp_ota_set_boot_partition(update_partition);
+  ret = esp_ota_set_boot_partition(flash_sink.partition);
   if (ret != ESP_OK) {
     ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(ret));
     notify_progress(OTA_STATE_FAILED, 100, "Set boot partition failed");
@@ -236,11 +561,27 @@ static void ota_update_task(void *pvParameter) {
   notify_progress(OTA_STATE_SUCCESS, 100, "Update successful - Rebooting...");
   oled_status_set_ota_state(OLED_OTA_OK);
   oled_status_set_last_event("ota-ok");
+  ota_budget_end(NULL);
 
   vTaskDelay(pdMS_TO_TICKS(2000));
   esp_restart();
 
+ota_stop:
+  // The checkpoint stays: a later start with the same URL continues from it
+  ota_pipeline_abort();
+  if (flash_sink.handle) {
+    esp_ota_abort(flash_sink.handle);
+  }
+
+ota_abort:
+  close_stream(client);
+
 ota_end:
+  mbedtls_sha256_free(&prefix_sha);
+  if (url) {
+    ota_budget_end(NULL);
+  }
+
   // Restore LED to IDLE on failure (success path restarts, so this only runs on
   // failure)
   if (ota_state == OTA_STATE_FAILED) {
@@ -249,23 +590,18 @@ ota_end:
     oled_status_set_last_event("ota-fail");
   }
 
-  // Free buffer
-  if (buffer) {
-    free(buffer);
-  }
-
   // Free URL string
   if (ctx) {
     if (ctx->url) {
-      free(ctx->url);
+      TRACE_FREE(ctx->url);
     }
     if (ctx->stack) {
-      heap_caps_free(ctx->stack);
+      TRACE_HEAP_CAPS_FREE(ctx->stack);
     }
     if (ctx->tcb) {
-      heap_caps_free(ctx->tcb);
+      TRACE_HEAP_CAPS_FREE(ctx->tcb);
     }
-    free(ctx);
+    TRACE_FREE(ctx);
   }
 
   ota_running = false;
@@ -305,16 +641,17 @@ esp_err_t ota_update_start(const char *url) {
   ESP_LOGI(TAG, "Starting OTA update task");
 
   // Duplicate URL string (task will free it)
-  ota_task_ctx_t *ctx = (ota_task_ctx_t *)calloc(1, sizeof(*ctx));
+  ota_task_ctx_t *ctx =
+      (ota_task_ctx_t *)TRACE_CALLOC(ALLOC_TAG_OTA, 1, sizeof(*ctx));
   if (!ctx) {
     ESP_LOGE(TAG, "Failed to allocate OTA context");
     return ESP_ERR_NO_MEM;
   }
 
-  ctx->url = strdup(url);
+  ctx->url = TRACE_STRDUP(ALLOC_TAG_OTA, url);
   if (!ctx->url) {
     ESP_LOGE(TAG, "Failed to allocate URL string");
-    free(ctx);
+    TRACE_FREE(ctx);
     return ESP_ERR_NO_MEM;
   }
 
@@ -332,21 +669,22 @@ esp_err_t ota_update_start(const char *url) {
     ESP_LOGW(TAG, "OTA task create failed; internal free=%u",
              (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
 
-    ctx->stack = (StackType_t *)heap_caps_malloc(
-        OTA_TASK_STACK_WORDS * sizeof(StackType_t),
+    ctx->stack = (StackType_t *)TRACE_HEAP_CAPS_MALLOC(
+        ALLOC_TAG_OTA, OTA_TASK_STACK_WORDS * sizeof(StackType_t),
         MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    ctx->tcb = (StaticTask_t *)heap_caps_malloc(sizeof(StaticTask_t),
-                                                MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    ctx->tcb = (StaticTask_t *)TRACE_HEAP_CAPS_MALLOC(
+        ALLOC_TAG_OTA, sizeof(StaticTask_t),
+        MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
     if (!ctx->stack || !ctx->tcb) {
       ESP_LOGE(TAG, "Failed to allocate OTA task stack/TCB");
       if (ctx->stack) {
-        heap_caps_free(ctx->stack);
+        TRACE_HEAP_CAPS_FREE(ctx->stack);
       }
       if (ctx->tcb) {
-        heap_caps_free(ctx->tcb);
+        TRACE_HEAP_CAPS_FREE(ctx->tcb);
       }
-      free(ctx->url);
-      free(ctx);
+      TRACE_FREE(ctx->url);
+      TRACE_FREE(ctx);
       ota_running = false;
       return ESP_FAIL;
     }
@@ -356,10 +694,10 @@ esp_err_t ota_update_start(const char *url) {
         OTA_TASK_PRIORITY, ctx->stack, ctx->tcb, tskNO_AFFINITY);
     if (ota_task_handle == NULL) {
       ESP_LOGE(TAG, "Failed to create OTA task (static)");
-      heap_caps_free(ctx->stack);
-      heap_caps_free(ctx->tcb);
-      free(ctx->url);
-      free(ctx);
+      TRACE_HEAP_CAPS_FREE(ctx->stack);
+      TRACE_HEAP_CAPS_FREE(ctx->tcb);
+      TRACE_FREE(ctx->url);
+      TRACE_FREE(ctx);
       ota_running = false;
       return ESP_FAIL;
     }
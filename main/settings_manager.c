@@ -2,149 +2,444 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include <stddef.h>
 #include "string.h"
 #include "config.h" // Fallback defaults
+#include "voice_pipeline.h" // Tuning defaults
+#include <math.h>
 
 #define TAG "settings"
 #define NVS_NAMESPACE "sys_config"
+#define NVS_VERSION_KEY "schema_ver"
 #define DEFAULT_OUTPUT_VOLUME 60
+#define DEFAULT_LED_BRIGHTNESS 100
 
-esp_err_t settings_manager_init(void) {
-    // NVS init is usually done in main, but we can double check here
-    return ESP_OK;
+typedef enum {
+    SETTING_TYPE_STR,  // char[size], nvs str
+    SETTING_TYPE_INT,  // int, nvs i32
+    SETTING_TYPE_BOOL, // bool, nvs u8
+    SETTING_TYPE_MILLI, // float, nvs i32 in thousandths
+} setting_type_t;
+
+typedef struct {
+    const char *key;   // NVS key: never rename, add a migration instead
+    setting_type_t type;
+    size_t offset;     // In app_settings_t
+    size_t size;
+    const char *def_str; // NULL = empty
+    int32_t def_int;
+    int32_t min;
+    int32_t max;
+} setting_desc_t;
+
+#define FIELD_SIZE(f) sizeof(((app_settings_t *)0)->f)
+#define S_STR(key, f, def) \
+    {key, SETTING_TYPE_STR, offsetof(app_settings_t, f), FIELD_SIZE(f), def, 0, 0, 0}
+#define S_INT(key, f, def, lo, hi) \
+    {key, SETTING_TYPE_INT, offsetof(app_settings_t, f), FIELD_SIZE(f), NULL, def, lo, hi}
+#define S_BOOL(key, f, def) \
+    {key, SETTING_TYPE_BOOL, offsetof(app_settings_t, f), FIELD_SIZE(f), NULL, def, 0, 1}
+#define S_MILLI(key, f, def, lo, hi) \
+    {key, SETTING_TYPE_MILLI, offsetof(app_settings_t, f), FIELD_SIZE(f), NULL, \
+     (int32_t)((def) * 1000), lo, hi}
+
+static const setting_desc_t schema[SETTING_COUNT] = {
+    [SETTING_WIFI_SSID]       = S_STR("wifi_ssid", wifi_ssid, WIFI_SSID),
+    [SETTING_WIFI_PASSWORD]   = S_STR("wifi_pass", wifi_password, WIFI_PASSWORD),
+    [SETTING_HA_HOSTNAME]     = S_STR("ha_host", ha_hostname, HA_HOSTNAME),
+    [SETTING_HA_PORT]         = S_INT("ha_port", ha_port, HA_PORT, 1, 65535),
+    [SETTING_HA_TOKEN]        = S_STR("ha_token", ha_token, HA_TOKEN),
+    [SETTING_HA_USE_SSL]      = S_BOOL("ha_ssl", ha_use_ssl, HA_USE_SSL),
+    [SETTING_MQTT_BROKER_URI] = S_STR("mqtt_uri", mqtt_broker_uri, MQTT_BROKER_URI),
+    [SETTING_MQTT_USERNAME]   = S_STR("mqtt_user", mqtt_username, MQTT_USERNAME),
+    [SETTING_MQTT_PASSWORD]   = S_STR("mqtt_pass", mqtt_password, MQTT_PASSWORD),
+    [SETTING_MQTT_CLIENT_ID]  = S_STR("mqtt_id", mqtt_client_id, MQTT_CLIENT_ID),
+    [SETTING_OUTPUT_VOLUME]   = S_INT("out_vol", output_volume, DEFAULT_OUTPUT_VOLUME, 0, 100),
+    [SETTING_OTA_URL]         = S_STR("ota_url", ota_url, ""),
+    [SETTING_WWD_THRESHOLD]   = S_MILLI("wwd_thr", wwd_threshold, VOICE_PIPELINE_DEFAULT_WWD_THRESHOLD, 0, 1000),
+    [SETTING_VAD_SPEECH_THRESHOLD] =
+        S_INT("vad_thr", vad_speech_threshold, VOICE_PIPELINE_DEFAULT_VAD_THRESHOLD, 0, 1000),
+    [SETTING_VAD_SILENCE_MS]  = S_INT("vad_sil", vad_silence_ms, VOICE_PIPELINE_DEFAULT_VAD_SILENCE_MS, 100, 5000),
+    [SETTING_VAD_MIN_SPEECH_MS] =
+        S_INT("vad_min", vad_min_speech_ms, VOICE_PIPELINE_DEFAULT_VAD_MIN_SPEECH_MS, 100, 2000),
+    [SETTING_VAD_MAX_RECORDING_MS] =
+        S_INT("vad_max", vad_max_recording_ms, VOICE_PIPELINE_DEFAULT_VAD_MAX_RECORDING_MS, 1000, 15000),
+    [SETTING_AGC_ENABLED]     = S_BOOL("agc_en", agc_enabled, VOICE_PIPELINE_DEFAULT_AGC_ENABLED),
+    [SETTING_AGC_TARGET_LEVEL] =
+        S_INT("agc_tgt", agc_target_level, VOICE_PIPELINE_DEFAULT_AGC_TARGET, 0, 10000),
+    [SETTING_LED_BRIGHTNESS]  = S_INT("led_bri", led_brightness, DEFAULT_LED_BRIGHTNESS, 0, 100),
+};
+
+_Static_assert(SETTING_COUNT <= 32, "dirty mask is 32 bits");
+
+// migrations[v] upgrades the namespace from schema v to v + 1
+typedef esp_err_t (*settings_migration_t)(nvs_handle_t handle);
+static esp_err_t migrate_v1(nvs_handle_t handle);
+static const settings_migration_t migrations[SETTINGS_SCHEMA_VERSION] = {
+    [1] = migrate_v1,
+};
+
+static app_settings_t cache;
+static bool cache_ready = false;
+static uint32_t dirty = 0;          // Bit per setting_id_t not yet in NVS
+static uint32_t dirty_since_ms = 0;
+static SemaphoreHandle_t settings_mutex = NULL;
+static TimerHandle_t commit_timer = NULL;
+static TaskHandle_t commit_task_handle = NULL;
+
+static inline uint32_t now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static inline void *field_ptr(const app_settings_t *s, setting_id_t id) {
+    return (uint8_t *)s + schema[id].offset;
 }
 
-static esp_err_t nvs_get_str_safe(nvs_handle_t handle, const char* key, char* out_buffer, size_t max_len, const char* default_val) {
-    size_t required_size = 0;
-    esp_err_t err = nvs_get_str(handle, key, NULL, &required_size);
-    
-    if (err == ESP_OK && required_size <= max_len) {
-        return nvs_get_str(handle, key, out_buffer, &max_len);
+static int32_t get_int(const app_settings_t *s, setting_id_t id) {
+    switch (schema[id].type) {
+    case SETTING_TYPE_BOOL:
+        return *(const bool *)field_ptr(s, id) ? 1 : 0;
+    case SETTING_TYPE_MILLI:
+        return (int32_t)lroundf(*(const float *)field_ptr(s, id) * 1000.0f);
+    default:
+        return *(const int *)field_ptr(s, id);
     }
-    
-    // If not found or too big, use default
-    if (default_val) {
-        strncpy(out_buffer, default_val, max_len - 1);
-        out_buffer[max_len - 1] = '\0';
+}
+
+static void put_int(app_settings_t *s, setting_id_t id, int32_t value) {
+    const setting_desc_t *d = &schema[id];
+    if (value < d->min) value = d->min;
+    if (value > d->max) value = d->max;
+    if (d->type == SETTING_TYPE_BOOL) {
+        *(bool *)field_ptr(s, id) = (value != 0);
+    } else if (d->type == SETTING_TYPE_MILLI) {
+        *(float *)field_ptr(s, id) = (float)value / 1000.0f;
     } else {
-        out_buffer[0] = '\0';
+        *(int *)field_ptr(s, id) = (int)value;
     }
-    
-    return (err == ESP_ERR_NVS_NOT_FOUND) ? ESP_OK : err;
 }
 
-esp_err_t settings_manager_load(app_settings_t *settings) {
-    if (!settings) return ESP_ERR_INVALID_ARG;
-    
-    nvs_handle_t my_handle;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &my_handle);
-    
-    if (err != ESP_OK) {
-        ESP_LOGW(TAG, "NVS config not found, loading defaults from config.h");
-        settings_manager_reset_defaults();
-        // Recurse once? No, just load defaults manually to struct
-        strncpy(settings->wifi_ssid, WIFI_SSID, sizeof(settings->wifi_ssid)-1);
-        settings->wifi_ssid[sizeof(settings->wifi_ssid)-1] = '\0';
-        strncpy(settings->wifi_password, WIFI_PASSWORD, sizeof(settings->wifi_password)-1);
-        settings->wifi_password[sizeof(settings->wifi_password)-1] = '\0';
-        strncpy(settings->ha_hostname, HA_HOSTNAME, sizeof(settings->ha_hostname)-1);
-        settings->ha_hostname[sizeof(settings->ha_hostname)-1] = '\0';
-        settings->ha_port = HA_PORT;
-        strncpy(settings->ha_token, HA_TOKEN, sizeof(settings->ha_token)-1);
-        settings->ha_token[sizeof(settings->ha_token)-1] = '\0';
-        settings->ha_use_ssl = HA_USE_SSL;
-        strncpy(settings->mqtt_broker_uri, MQTT_BROKER_URI, sizeof(settings->mqtt_broker_uri)-1);
-        settings->mqtt_broker_uri[sizeof(settings->mqtt_broker_uri)-1] = '\0';
-        if (MQTT_USERNAME) {
-            strncpy(settings->mqtt_username, MQTT_USERNAME, sizeof(settings->mqtt_username)-1);
-            settings->mqtt_username[sizeof(settings->mqtt_username)-1] = '\0';
+static void put_str(app_settings_t *s, setting_id_t id, const char *value) {
+    char *buf = field_ptr(s, id);
+    strncpy(buf, value ? value : "", schema[id].size - 1);
+    buf[schema[id].size - 1] = '\0';
+}
+
+static bool field_differs(const app_settings_t *a, const app_settings_t *b, setting_id_t id) {
+    if (schema[id].type == SETTING_TYPE_STR) {
+        return strncmp(field_ptr(a, id), field_ptr(b, id), schema[id].size) != 0;
+    }
+    return get_int(a, id) != get_int(b, id);
+}
+
+static void set_defaults(app_settings_t *s) {
+    for (int id = 0; id < SETTING_COUNT; id++) {
+        if (schema[id].type == SETTING_TYPE_STR) {
+            put_str(s, id, schema[id].def_str);
         } else {
-            settings->mqtt_username[0] = '\0';
+            put_int(s, id, schema[id].def_int);
         }
-        if (MQTT_PASSWORD) {
-            strncpy(settings->mqtt_password, MQTT_PASSWORD, sizeof(settings->mqtt_password)-1);
-            settings->mqtt_password[sizeof(settings->mqtt_password)-1] = '\0';
+    }
+}
+
+// Fields missing from NVS (or too long for their buffer) keep their defaults
+static void read_all(nvs_handle_t handle, app_settings_t *s) {
+    for (int id = 0; id < SETTING_COUNT; id++) {
+        const setting_desc_t *d = &schema[id];
+        if (d->type == SETTING_TYPE_STR) {
+            size_t len = 0;
+            if (nvs_get_str(handle, d->key, NULL, &len) == ESP_OK && len <= d->size) {
+                nvs_get_str(handle, d->key, field_ptr(s, id), &len);
+            }
+        } else if (d->type == SETTING_TYPE_INT || d->type == SETTING_TYPE_MILLI) {
+            int32_t v;
+            if (nvs_get_i32(handle, d->key, &v) == ESP_OK) {
+                put_int(s, id, v);
+            }
         } else {
-            settings->mqtt_password[0] = '\0';
+            uint8_t v;
+            if (nvs_get_u8(handle, d->key, &v) == ESP_OK) {
+                put_int(s, id, v);
+            }
         }
-        strncpy(settings->mqtt_client_id, MQTT_CLIENT_ID, sizeof(settings->mqtt_client_id)-1);
-        settings->mqtt_client_id[sizeof(settings->mqtt_client_id)-1] = '\0';
-        settings->output_volume = DEFAULT_OUTPUT_VOLUME;
-        settings->ota_url[0] = '\0';
-        return ESP_OK;
     }
+}
 
-    // Load from NVS
-    nvs_get_str_safe(my_handle, "wifi_ssid", settings->wifi_ssid, sizeof(settings->wifi_ssid), WIFI_SSID);
-    nvs_get_str_safe(my_handle, "wifi_pass", settings->wifi_password, sizeof(settings->wifi_password), WIFI_PASSWORD);
-    
-    nvs_get_str_safe(my_handle, "ha_host", settings->ha_hostname, sizeof(settings->ha_hostname), HA_HOSTNAME);
-    nvs_get_str_safe(my_handle, "ha_token", settings->ha_token, sizeof(settings->ha_token), HA_TOKEN);
-    
-    int32_t port = HA_PORT;
-    nvs_get_i32(my_handle, "ha_port", &port);
-    settings->ha_port = port;
+static esp_err_t write_one(nvs_handle_t handle, const app_settings_t *s, setting_id_t id) {
+    const setting_desc_t *d = &schema[id];
+    switch (d->type) {
+    case SETTING_TYPE_STR:
+        return nvs_set_str(handle, d->key, field_ptr(s, id));
+    case SETTING_TYPE_INT:
+    case SETTING_TYPE_MILLI:
+        return nvs_set_i32(handle, d->key, get_int(s, id));
+    default:
+        return nvs_set_u8(handle, d->key, (uint8_t)get_int(s, id));
+    }
+}
 
-    uint8_t ssl = HA_USE_SSL;
-    nvs_get_u8(my_handle, "ha_ssl", &ssl);
-    settings->ha_use_ssl = (bool)ssl;
+// v1 stored integers unchecked and clamped them on every load; v2 keeps
+// them in range in NVS so a load is a plain read
+static esp_err_t migrate_v1(nvs_handle_t handle) {
+    for (int id = 0; id < SETTING_COUNT; id++) {
+        const setting_desc_t *d = &schema[id];
+        int32_t v;
+        if (d->type != SETTING_TYPE_INT || nvs_get_i32(handle, d->key, &v) != ESP_OK) {
+            continue;
+        }
+        if (v < d->min || v > d->max) {
+            int32_t clamped = v < d->min ? d->min : d->max;
+            ESP_LOGI(TAG, "Migrating %s: %ld -> %ld", d->key, (long)v, (long)clamped);
+            esp_err_t err = nvs_set_i32(handle, d->key, clamped);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+    return ESP_OK;
+}
 
-    nvs_get_str_safe(my_handle, "mqtt_uri", settings->mqtt_broker_uri, sizeof(settings->mqtt_broker_uri), MQTT_BROKER_URI);
-    nvs_get_str_safe(my_handle, "mqtt_user", settings->mqtt_username, sizeof(settings->mqtt_username), MQTT_USERNAME);
-    nvs_get_str_safe(my_handle, "mqtt_pass", settings->mqtt_password, sizeof(settings->mqtt_password), MQTT_PASSWORD);
-    nvs_get_str_safe(my_handle, "mqtt_id", settings->mqtt_client_id, sizeof(settings->mqtt_client_id), MQTT_CLIENT_ID);
+static void migrate(nvs_handle_t handle) {
+    uint8_t stored = 0;
+    uint8_t version;
+    if (nvs_get_u8(handle, NVS_VERSION_KEY, &stored) == ESP_OK) {
+        version = stored;
+    } else {
+        // Unversioned: v1 firmware wrote every key on its first save
+        size_t len = 0;
+        version = (nvs_get_str(handle, "wifi_ssid", NULL, &len) == ESP_OK) ? 1 : SETTINGS_SCHEMA_VERSION;
+    }
 
-    int32_t out_vol = DEFAULT_OUTPUT_VOLUME;
-    (void)nvs_get_i32(my_handle, "out_vol", &out_vol);
-    if (out_vol < 0) out_vol = 0;
-    if (out_vol > 100) out_vol = 100;
-    settings->output_volume = (int)out_vol;
+    if (version > SETTINGS_SCHEMA_VERSION) {
+        ESP_LOGW(TAG, "Settings schema %u is newer than %u, reading known keys only",
+                 version, SETTINGS_SCHEMA_VERSION);
+        return;
+    }
+    uint8_t from = version;
+    while (version < SETTINGS_SCHEMA_VERSION && migrations[version] != NULL) {
+        esp_err_t err = migrations[version](handle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Settings migration %u -> %u failed: %s", version, version + 1,
+                     esp_err_to_name(err));
+            break;
+        }
+        version++;
+    }
+    if (version != stored) {
+        nvs_set_u8(handle, NVS_VERSION_KEY, version);
+        nvs_commit(handle);
+        if (from != version) {
+            ESP_LOGI(TAG, "Settings schema migrated %u -> %u", from, version);
+        }
+    }
+}
 
-    nvs_get_str_safe(my_handle, "ota_url", settings->ota_url, sizeof(settings->ota_url), "");
+// Caller holds settings_mutex
+static void mark_dirty(setting_id_t id) {
+    uint32_t now = now_ms();
+    if (dirty == 0) {
+        dirty_since_ms = now;
+    }
+    dirty |= 1u << id;
+    // Restarting the timer debounces bursts; past the max delay it is left
+    // to expire so a steady stream of changes still gets committed
+    if (commit_timer &&
+        (now - dirty_since_ms < SETTINGS_COMMIT_MAX_DELAY_MS || !xTimerIsTimerActive(commit_timer))) {
+        xTimerReset(commit_timer, 0);
+    }
+}
 
-    nvs_close(my_handle);
+static void commit_timer_callback(TimerHandle_t xTimer) {
+    (void)xTimer;
+    if (commit_task_handle) {
+        xTaskNotifyGive(commit_task_handle);
+    }
+}
+
+static void commit_task(void *arg) {
+    (void)arg;
+    while (1) {
+        // NVS writes stay out of the timer service task
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        settings_manager_flush();
+    }
+}
+
+static void flush_on_shutdown(void) {
+    (void)settings_manager_flush();
+}
+
+esp_err_t settings_manager_init(void) {
+    if (cache_ready) {
+        return ESP_OK;
+    }
+    settings_mutex = xSemaphoreCreateMutex();
+    if (!settings_mutex) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    set_defaults(&cache);
+    nvs_handle_t my_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &my_handle);
+    if (err == ESP_OK) {
+        migrate(my_handle);
+        read_all(my_handle, &cache);
+        nvs_close(my_handle);
+    } else {
+        ESP_LOGW(TAG, "NVS config not available (%s), using defaults from config.h",
+                 esp_err_to_name(err));
+    }
+    cache_ready = true;
+
+    commit_timer = xTimerCreate("settings_commit", pdMS_TO_TICKS(SETTINGS_COMMIT_DELAY_MS), pdFALSE,
+                                NULL, commit_timer_callback);
+    xTaskCreate(commit_task, "settings_commit", 4096, NULL, 2, &commit_task_handle);
+    esp_register_shutdown_handler(flush_on_shutdown);
+    return ESP_OK;
+}
+
+esp_err_t settings_manager_load(app_settings_t *settings) {
+    if (!settings) return ESP_ERR_INVALID_ARG;
+    esp_err_t err = settings_manager_init();
+    if (err != ESP_OK) return err;
+
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    *settings = cache;
+    xSemaphoreGive(settings_mutex);
     return ESP_OK;
 }
 
 esp_err_t settings_manager_save(const app_settings_t *settings) {
     if (!settings) return ESP_ERR_INVALID_ARG;
+    esp_err_t err = settings_manager_init();
+    if (err != ESP_OK) return err;
 
-    nvs_handle_t my_handle;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &my_handle);
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    for (int id = 0; id < SETTING_COUNT; id++) {
+        if (!field_differs(settings, &cache, id)) {
+            continue;
+        }
+        if (schema[id].type == SETTING_TYPE_STR) {
+            put_str(&cache, id, field_ptr(settings, id));
+        } else {
+            put_int(&cache, id, get_int(settings, id));
+        }
+        mark_dirty(id);
+    }
+    xSemaphoreGive(settings_mutex);
+    return ESP_OK;
+}
+
+esp_err_t settings_manager_set_int(setting_id_t id, int32_t value) {
+    if (id >= SETTING_COUNT || schema[id].type == SETTING_TYPE_STR) return ESP_ERR_INVALID_ARG;
+    esp_err_t err = settings_manager_init();
+    if (err != ESP_OK) return err;
+
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    int32_t before = get_int(&cache, id);
+    put_int(&cache, id, value);
+    if (get_int(&cache, id) != before) {
+        mark_dirty(id);
+    }
+    xSemaphoreGive(settings_mutex);
+    return ESP_OK;
+}
+
+esp_err_t settings_manager_set_float(setting_id_t id, float value) {
+    if (id >= SETTING_COUNT || schema[id].type != SETTING_TYPE_MILLI) return ESP_ERR_INVALID_ARG;
+    return settings_manager_set_int(id, (int32_t)lroundf(value * 1000.0f));
+}
+
+esp_err_t settings_manager_set_str(setting_id_t id, const char *value) {
+    if (id >= SETTING_COUNT || schema[id].type != SETTING_TYPE_STR) return ESP_ERR_INVALID_ARG;
+    esp_err_t err = settings_manager_init();
     if (err != ESP_OK) return err;
 
-    nvs_set_str(my_handle, "wifi_ssid", settings->wifi_ssid);
-    nvs_set_str(my_handle, "wifi_pass", settings->wifi_password);
-    
-    nvs_set_str(my_handle, "ha_host", settings->ha_hostname);
-    nvs_set_str(my_handle, "ha_token", settings->ha_token);
-    nvs_set_i32(my_handle, "ha_port", settings->ha_port);
-    nvs_set_u8(my_handle, "ha_ssl", (uint8_t)settings->ha_use_ssl);
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    // Compares what put_str() would store, including truncation
+    if (strncmp(field_ptr(&cache, id), value ? value : "", schema[id].size - 1) != 0) {
+        put_str(&cache, id, value);
+        mark_dirty(id);
+    }
+    xSemaphoreGive(settings_mutex);
+    return ESP_OK;
+}
 
-    nvs_set_str(my_handle, "mqtt_uri", settings->mqtt_broker_uri);
-    nvs_set_str(my_handle, "mqtt_user", settings->mqtt_username);
-    nvs_set_str(my_handle, "mqtt_pass", settings->mqtt_password);
-    nvs_set_str(my_handle, "mqtt_id", settings->mqtt_client_id);
+esp_err_t settings_manager_flush(void) {
+    if (!cache_ready) return ESP_OK;
 
-    int32_t out_vol = settings->output_volume;
-    if (out_vol < 0) out_vol = 0;
-    if (out_vol > 100) out_vol = 100;
-    nvs_set_i32(my_handle, "out_vol", out_vol);
+    // Write from a snapshot so readers are not held up by flash
+    app_settings_t snapshot;
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    uint32_t mask = dirty;
+    snapshot = cache;
+    dirty = 0;
+    xSemaphoreGive(settings_mutex);
+    if (mask == 0) {
+        return ESP_OK;
+    }
 
-    nvs_set_str(my_handle, "ota_url", settings->ota_url);
+    nvs_handle_t my_handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &my_handle);
+    uint32_t failed = mask;
+    if (err == ESP_OK) {
+        for (int id = 0; id < SETTING_COUNT; id++) {
+            if (!(mask & (1u << id))) {
+                continue;
+            }
+            esp_err_t werr = write_one(my_handle, &snapshot, id);
+            if (werr == ESP_OK) {
+                failed &= ~(1u << id);
+            } else {
+                ESP_LOGE(TAG, "Failed to write %s: %s", schema[id].key, esp_err_to_name(werr));
+                err = werr;
+            }
+        }
+        esp_err_t cerr = nvs_commit(my_handle);
+        if (cerr != ESP_OK) {
+            failed = mask;
+            err = cerr;
+        }
+        nvs_close(my_handle);
+    }
 
-    err = nvs_commit(my_handle);
-    nvs_close(my_handle);
+    if (failed) {
+        ESP_LOGE(TAG, "Settings commit failed: %s", esp_err_to_name(err));
+        xSemaphoreTake(settings_mutex, portMAX_DELAY);
+        if (dirty == 0) {
+            dirty_since_ms = now_ms();
+        }
+        dirty |= failed; // Retried with the next change or flush
+        xSemaphoreGive(settings_mutex);
+    } else {
+        ESP_LOGI(TAG, "Committed %d setting(s)", __builtin_popcount(mask));
+    }
     return err;
 }
 
 esp_err_t settings_manager_reset_defaults(void) {
+    esp_err_t err = settings_manager_init();
+    if (err != ESP_OK) return err;
+
+    xSemaphoreTake(settings_mutex, portMAX_DELAY);
+    set_defaults(&cache);
+    dirty = 0;
+    if (commit_timer) {
+        xTimerStop(commit_timer, 0);
+    }
     nvs_handle_t my_handle;
-    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &my_handle);
-    if (err == ESP_OK) {
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &my_handle) == ESP_OK) {
         nvs_erase_all(my_handle);
+        nvs_set_u8(my_handle, NVS_VERSION_KEY, SETTINGS_SCHEMA_VERSION);
         nvs_commit(my_handle);
         nvs_close(my_handle);
     }
+    xSemaphoreGive(settings_mutex);
     return ESP_OK;
 }
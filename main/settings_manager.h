@@ -2,15 +2,24 @@
 
 #include "esp_err.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Bump together with a new entry in the migration table (settings_manager.c)
+#define SETTINGS_SCHEMA_VERSION 2
+
+// Changes are committed this long after the last one...
+#define SETTINGS_COMMIT_DELAY_MS 2000
+// ...but never later than this after the first uncommitted one
+#define SETTINGS_COMMIT_MAX_DELAY_MS 10000
+
 typedef struct {
     char wifi_ssid[32];
     char wifi_password[64];
-    
+
     char ha_hostname[64];
     int ha_port;
     char ha_token[512]; // Increased size for JWT
@@ -23,17 +32,64 @@ typedef struct {
 
     int output_volume; // 0-100
     char ota_url[256];
+
+    // Runtime tuning (voice_pipeline_config_t, LED)
+    float wwd_threshold;
+    int vad_speech_threshold;
+    int vad_silence_ms;
+    int vad_min_speech_ms;
+    int vad_max_recording_ms;
+    bool agc_enabled;
+    int agc_target_level;
+    int led_brightness; // 0-100
 } app_settings_t;
 
-// Initialize settings manager (mounts NVS)
+// One schema entry per persisted field of app_settings_t
+typedef enum {
+    SETTING_WIFI_SSID,
+    SETTING_WIFI_PASSWORD,
+    SETTING_HA_HOSTNAME,
+    SETTING_HA_PORT,
+    SETTING_HA_TOKEN,
+    SETTING_HA_USE_SSL,
+    SETTING_MQTT_BROKER_URI,
+    SETTING_MQTT_USERNAME,
+    SETTING_MQTT_PASSWORD,
+    SETTING_MQTT_CLIENT_ID,
+    SETTING_OUTPUT_VOLUME,
+    SETTING_OTA_URL,
+    SETTING_WWD_THRESHOLD,
+    SETTING_VAD_SPEECH_THRESHOLD,
+    SETTING_VAD_SILENCE_MS,
+    SETTING_VAD_MIN_SPEECH_MS,
+    SETTING_VAD_MAX_RECORDING_MS,
+    SETTING_AGC_ENABLED,
+    SETTING_AGC_TARGET_LEVEL,
+    SETTING_LED_BRIGHTNESS,
+    SETTING_COUNT
+} setting_id_t;
+
+// Initialize settings manager: migrates the NVS schema and fills the RAM
+// cache. Called once after nvs_flash_init(); load() also calls it lazily.
 esp_err_t settings_manager_init(void);
 
-// Load settings from NVS. If not found, loads defaults from config.h
+// Copy of the cached settings (NVS values, config.h defaults for the rest)
 esp_err_t settings_manager_load(app_settings_t *settings);
 
-// Save settings to NVS
+// Update the cache. Only fields that differ are marked dirty; they reach NVS
+// in one batched commit after SETTINGS_COMMIT_DELAY_MS.
 esp_err_t settings_manager_save(const app_settings_t *settings);
 
+// Typed single-field updates, same coalescing as save(). Float fields take
+// thousandths.
+esp_err_t settings_manager_set_int(setting_id_t id, int32_t value);
+esp_err_t settings_manager_set_str(setting_id_t id, const char *value);
+// Float (thousandths) fields only; rounds to the stored fixed point
+esp_err_t settings_manager_set_float(setting_id_t id, float value);
+
+// Write dirty fields now (also runs from the esp_restart() shutdown hook)
+esp_err_t settings_manager_flush(void);
+
 // Reset to defaults (from config.h)
 esp_err_t settings_manager_reset_defaults(void);
 
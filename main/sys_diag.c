@@ -1,6 +1,8 @@
 #include "sys_diag.h"
+#include "esp_attr.h"
 #include "esp_task_wdt.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_log.h"
@@ -8,6 +10,9 @@
 #include "freertos/task.h"
 #include "mqtt_ha.h"
 #include "led_status.h"
+#include "flight_recorder.h"
+#include <stdio.h>
+#include <string.h>
 
 static const char *TAG = "sys_diag";
 static const char *NVS_NAMESPACE = "diag";
@@ -21,6 +26,44 @@ static esp_reset_reason_t last_reset_reason = ESP_RST_UNKNOWN;
 static TimerHandle_t stable_timer = NULL;
 static TaskHandle_t diag_worker_task_handle = NULL;
 
+// Soft watchdog: per-task heartbeat + activity tag, checked by soft_wdt task
+#define SOFT_WDT_SLOTS 12
+#define SOFT_WDT_RECOVERIES 8
+#define SOFT_WDT_PERIOD_MS 500
+#define SOFT_WDT_MAGIC 0x53574454 // "SWDT"
+
+typedef struct {
+    TaskHandle_t task;
+    char name[configMAX_TASK_NAME_LEN]; // Copied at registration: the task
+                                        // may be gone when a stall is printed
+    const char *activity;    // NULL = idle, not stall-checked
+    volatile uint32_t beat_ms;
+    bool twdt;               // Also subscribed to the TWDT
+    bool reported;           // Stall logged, recovery attempted
+    uint32_t reported_beat;  // beat_ms when the stall was reported
+    const char *stalled_in;  // Activity at that time
+} soft_wdt_slot_t;
+
+typedef struct {
+    const char *activity;
+    sys_diag_recovery_cb_t cb;
+} soft_wdt_recovery_t;
+
+// Survives the controlled reboot so the next boot can say what was stuck
+typedef struct {
+    uint32_t magic;
+    char what[48];
+} soft_wdt_note_t;
+
+static soft_wdt_slot_t soft_slots[SOFT_WDT_SLOTS];
+static soft_wdt_recovery_t recoveries[SOFT_WDT_RECOVERIES];
+static portMUX_TYPE soft_wdt_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t soft_wdt_task_handle = NULL;
+static uint32_t soft_stall_ms = 7500;
+static uint32_t soft_reboot_ms = 20000;
+static __NOINIT_ATTR soft_wdt_note_t soft_wdt_note;
+static char soft_wdt_prev_stall[48] = ""; // What the previous boot rebooted on
+
 static void diag_worker_task(void *arg) {
     (void)arg;
 
@@ -55,6 +98,115 @@ static void stable_timer_callback(TimerHandle_t xTimer) {
     }
 }
 
+static inline uint32_t now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static soft_wdt_slot_t *soft_slot_find(TaskHandle_t task) {
+    for (int i = 0; i < SOFT_WDT_SLOTS; i++) {
+        if (soft_slots[i].task == task) {
+            return &soft_slots[i];
+        }
+    }
+    return NULL;
+}
+
+static void soft_slot_add(bool twdt, const char *activity) {
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    taskENTER_CRITICAL(&soft_wdt_mux);
+    soft_wdt_slot_t *s = soft_slot_find(self);
+    if (s == NULL) {
+        s = soft_slot_find(NULL);
+    }
+    if (s != NULL) {
+        s->activity = activity;
+        s->beat_ms = now_ms();
+        s->twdt = twdt;
+        s->reported = false;
+        strlcpy(s->name, pcTaskGetName(self), sizeof(s->name));
+        s->task = self;
+    }
+    taskEXIT_CRITICAL(&soft_wdt_mux);
+    if (s == NULL) {
+        ESP_LOGW(TAG, "Soft WDT full - %s not monitored", pcTaskGetName(NULL));
+    }
+}
+
+static sys_diag_recovery_cb_t recovery_for(const char *activity) {
+    for (int i = 0; i < SOFT_WDT_RECOVERIES && recoveries[i].activity; i++) {
+        if (strcmp(recoveries[i].activity, activity) == 0) {
+            return recoveries[i].cb;
+        }
+    }
+    return NULL;
+}
+
+void sys_diag_reboot(const char *task, const char *activity, uint32_t stalled_ms) {
+    ESP_LOGE(TAG, "Task %s stuck in '%s' for %lu ms - rebooting before TWDT",
+             task, activity, (unsigned long)stalled_ms);
+    flight_recorder_log(FR_EV_SOFT_REBOOT, stalled_ms, 0);
+    snprintf(soft_wdt_note.what, sizeof(soft_wdt_note.what), "%s/%s %lus",
+             task, activity, (unsigned long)(stalled_ms / 1000));
+    soft_wdt_note.magic = SOFT_WDT_MAGIC;
+    vTaskDelay(pdMS_TO_TICKS(100)); // Let the log reach WebSerial/UART
+    esp_restart();
+}
+
+static void soft_wdt_task(void *arg) {
+    (void)arg;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(SOFT_WDT_PERIOD_MS));
+        uint32_t now = now_ms();
+
+        for (int i = 0; i < SOFT_WDT_SLOTS; i++) {
+            taskENTER_CRITICAL(&soft_wdt_mux);
+            soft_wdt_slot_t snap = soft_slots[i];
+            taskEXIT_CRITICAL(&soft_wdt_mux);
+            if (snap.task == NULL) {
+                continue;
+            }
+
+            const char *name = snap.name;
+            uint32_t stalled = now - snap.beat_ms;
+            if (snap.reported && snap.beat_ms != snap.reported_beat) {
+                ESP_LOGW(TAG, "Task %s recovered (was stuck in '%s')", name,
+                         snap.stalled_in);
+                taskENTER_CRITICAL(&soft_wdt_mux);
+                if (soft_slots[i].task == snap.task) {
+                    soft_slots[i].reported = false;
+                }
+                taskEXIT_CRITICAL(&soft_wdt_mux);
+                continue;
+            }
+            if (snap.activity == NULL || stalled < soft_stall_ms) {
+                continue;
+            }
+
+            if (stalled >= soft_reboot_ms) {
+                sys_diag_reboot(name, snap.activity, stalled);
+            }
+            if (!snap.reported) {
+                ESP_LOGE(TAG, "Task %s stalled in '%s' for %lu ms", name,
+                         snap.activity, (unsigned long)stalled);
+                flight_recorder_log(FR_EV_STALL, stalled, (uint16_t)i);
+                taskENTER_CRITICAL(&soft_wdt_mux);
+                if (soft_slots[i].task == snap.task) {
+                    soft_slots[i].reported = true;
+                    soft_slots[i].reported_beat = snap.beat_ms;
+                    soft_slots[i].stalled_in = snap.activity;
+                }
+                taskEXIT_CRITICAL(&soft_wdt_mux);
+                sys_diag_recovery_cb_t cb = recovery_for(snap.activity);
+                if (cb) {
+                    ESP_LOGW(TAG, "Attempting recovery for '%s'", snap.activity);
+                    cb(name, stalled);
+                }
+            }
+        }
+    }
+}
+
 static void determine_reset_reason(void) {
     last_reset_reason = esp_reset_reason();
     switch (last_reset_reason) {
@@ -70,6 +222,14 @@ static void determine_reset_reason(void) {
         case ESP_RST_SDIO: reset_reason_str = "SDIO Reset"; break;
         default: reset_reason_str = "Unknown"; break;
     }
+    if (last_reset_reason == ESP_RST_SW && soft_wdt_note.magic == SOFT_WDT_MAGIC) {
+        reset_reason_str = "Soft WDT (Stall)";
+        soft_wdt_note.what[sizeof(soft_wdt_note.what) - 1] = '\0';
+        snprintf(soft_wdt_prev_stall, sizeof(soft_wdt_prev_stall), "%s",
+                 soft_wdt_note.what);
+        ESP_LOGW(TAG, "Previous boot stalled: %s", soft_wdt_prev_stall);
+    }
+    soft_wdt_note.magic = 0;
     ESP_LOGI(TAG, "Last Reset Reason: %s", reset_reason_str);
 }
 
@@ -90,7 +250,8 @@ esp_err_t sys_diag_init(void) {
     boot_count = (int)val;
     
     // Only count crash-like resets; avoid false safe-mode from flashing/manual reset.
-    bool should_count = (last_reset_reason == ESP_RST_PANIC ||
+    bool should_count = (soft_wdt_prev_stall[0] != '\0' ||
+                         last_reset_reason == ESP_RST_PANIC ||
                          last_reset_reason == ESP_RST_INT_WDT ||
                          last_reset_reason == ESP_RST_TASK_WDT ||
                          last_reset_reason == ESP_RST_WDT ||
@@ -154,18 +315,75 @@ void sys_diag_wdt_init(int timeout_sec) {
     }
     
     esp_task_wdt_add(NULL); // Add current task (main)
+    // Idle until its loop starts: boot blocks in long waits that feed the
+    // TWDT but are not stalls (see sys_diag_activity() in the main loop)
+    soft_slot_add(true, NULL);
+
+    // Soft watchdog acts well inside the TWDT window
+    soft_stall_ms = (uint32_t)timeout_sec * 1000 / 4;
+    soft_reboot_ms = (uint32_t)timeout_sec * 1000 * 2 / 3;
+    if (soft_wdt_task_handle == NULL) {
+        // Above the monitored tasks so a busy loop cannot starve the check
+        xTaskCreate(soft_wdt_task, "soft_wdt", 3072, NULL, configMAX_PRIORITIES - 2,
+                    &soft_wdt_task_handle);
+    }
 }
 
 void sys_diag_wdt_add(void) {
     esp_task_wdt_add(NULL); // Add calling task
+    soft_slot_add(true, "run");
+}
+
+void sys_diag_soft_wdt_add(void) {
+    soft_slot_add(false, "run");
 }
 
 void sys_diag_wdt_feed(void) {
     esp_task_wdt_reset();
+    soft_wdt_slot_t *s = soft_slot_find(xTaskGetCurrentTaskHandle());
+    if (s != NULL) {
+        s->beat_ms = now_ms();
+    }
+}
+
+void sys_diag_activity(const char *activity) {
+    soft_wdt_slot_t *s = soft_slot_find(xTaskGetCurrentTaskHandle());
+    if (s == NULL) {
+        return;
+    }
+    if (s->twdt) {
+        esp_task_wdt_reset();
+    }
+    s->activity = activity;
+    s->beat_ms = now_ms();
 }
 
 void sys_diag_wdt_remove(void) {
-    esp_task_wdt_delete(NULL);
+    bool twdt = true;
+    taskENTER_CRITICAL(&soft_wdt_mux);
+    soft_wdt_slot_t *s = soft_slot_find(xTaskGetCurrentTaskHandle());
+    if (s != NULL) {
+        twdt = s->twdt;
+        s->task = NULL;
+    }
+    taskEXIT_CRITICAL(&soft_wdt_mux);
+    if (twdt) {
+        esp_task_wdt_delete(NULL);
+    }
+}
+
+esp_err_t sys_diag_register_recovery(const char *activity, sys_diag_recovery_cb_t cb) {
+    if (activity == NULL || cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < SOFT_WDT_RECOVERIES; i++) {
+        if (recoveries[i].activity == NULL || strcmp(recoveries[i].activity, activity) == 0) {
+            recoveries[i].cb = cb;
+            recoveries[i].activity = activity;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
 }
 
 const char* sys_diag_get_reset_reason(void) {
@@ -184,8 +402,17 @@ void sys_diag_report_status(void) {
         if (safe_mode_active) {
             strncat(msg, " [SAFE MODE]", sizeof(msg) - strlen(msg) - 1);
         }
+        if (soft_wdt_prev_stall[0] != '\0') {
+            strncat(msg, " stall: ", sizeof(msg) - strlen(msg) - 1);
+            strncat(msg, soft_wdt_prev_stall, sizeof(msg) - strlen(msg) - 1);
+        }
         
         // Use va_response sensor for system messages
         mqtt_ha_update_sensor("va_response", msg);
+
+        // What the previous boot was doing when it ended (MQTT state <= 255)
+        char ctx[200];
+        flight_recorder_summary(ctx, sizeof(ctx));
+        mqtt_ha_update_sensor("last_reset_context", ctx);
     }
 }
@@ -1,7 +1,10 @@
 #pragma once
 
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,6 +23,10 @@ esp_err_t sys_diag_init(void);
 
 /**
  * @brief Initialize Task Watchdog Timer
+ * Also starts the soft watchdog: a monitored task that misses heartbeats for
+ * a quarter of the timeout is logged with its current activity and the
+ * matching recovery action runs; at two thirds of the timeout the system
+ * reboots in a controlled way, before the TWDT panics.
  * @param timeout_sec Seconds before panic/reset (e.g. 15)
  */
 void sys_diag_wdt_init(int timeout_sec);
@@ -41,6 +48,47 @@ void sys_diag_wdt_feed(void);
  */
 void sys_diag_wdt_remove(void);
 
+/**
+ * @brief Controlled reboot for a task that is stuck for good
+ * What the soft watchdog does at two thirds of the TWDT timeout; for owners
+ * whose recovery found the task would not exit. Does not return.
+ * @param task Name of the stuck task
+ * @param activity What it was doing, kept for the next boot's report
+ * @param stalled_ms How long it has been stuck
+ */
+void sys_diag_reboot(const char *task, const char *activity,
+                     uint32_t stalled_ms);
+
+/**
+ * @brief Monitor the current task with the soft watchdog only
+ * For tasks that block indefinitely while idle (e.g. TTS playback), which
+ * cannot be on the TWDT. Remove with sys_diag_wdt_remove().
+ */
+void sys_diag_soft_wdt_add(void);
+
+/**
+ * @brief Heartbeat that also tags what the current task is doing
+ * A later stall is attributed to this activity (e.g. "i2s_read", "ws_send").
+ * NULL marks the task idle (waiting for work), which is never a stall.
+ * No-op for tasks that are not monitored. Use string literals.
+ */
+void sys_diag_activity(const char *activity);
+
+/**
+ * @brief Recovery action for a stalled activity
+ * Runs on the soft watchdog task and must not block.
+ * @param task Name of the stalled task
+ * @param stalled_ms Time since its last heartbeat
+ */
+typedef void (*sys_diag_recovery_cb_t)(const char *task, uint32_t stalled_ms);
+
+/**
+ * @brief Register the recovery action for an activity tag
+ * Called once per stall, before falling back to a controlled reboot.
+ */
+esp_err_t sys_diag_register_recovery(const char *activity,
+                                     sys_diag_recovery_cb_t cb);
+
 /**
  * @brief Get the reason for the last reset as a string
  */
@@ -0,0 +1,315 @@
+/**
+ * @file task_profiler.c
+ * @brief Sampling per-task CPU and stack profiler
+ *
+ * Run-time counters come from esp_timer (CONFIG_FREERTOS_RUN_TIME_STATS_USING_
+ * ESP_TIMER), so they are compared against esp_timer time directly. Stack
+ * figures are in bytes (StackType_t is uint8_t on ESP-IDF).
+ */
+
+#include "task_profiler.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "flight_recorder.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "task_prof";
+
+#define PROFILER_TASK_STACK 3072
+#define PROFILER_TASK_PRIORITY 1
+// Headroom for tasks created between counting and listing them
+#define PROFILER_TASK_SLACK 4
+
+typedef struct {
+  TaskHandle_t handle;
+  uint32_t runtime;
+} runtime_mark_t;
+
+typedef struct {
+  char name[configMAX_TASK_NAME_LEN];
+  uint32_t min_free;
+} stack_min_t;
+
+// Only touched by the profiler task. The task list and run-time marks cover
+// every task, grown in PSRAM to the largest task count seen.
+static TaskStatus_t *status_buf = NULL;
+static runtime_mark_t *marks = NULL;
+static runtime_mark_t *next_marks = NULL;
+static size_t status_cap = 0;
+static size_t mark_count = 0;
+static uint32_t truncated_count = 0;
+static stack_min_t stack_min[TASK_PROFILER_MAX_TASKS];
+static size_t stack_min_count = 0;
+static fr_task_t fr_tasks[FLIGHT_RECORDER_TASKS];
+
+// Published sample, guarded by profile_lock
+static task_profile_t profile[TASK_PROFILER_MAX_TASKS];
+static size_t profile_count = 0;
+static task_profile_summary_t summary;
+static SemaphoreHandle_t profile_lock = NULL;
+
+static uint32_t sample_count = 0;
+
+static TaskHandle_t profiler_task_handle = NULL;
+static uint32_t profiler_period_ms = 5000;
+
+static char state_char(eTaskState state) {
+  switch (state) {
+  case eRunning:
+    return 'R';
+  case eReady:
+    return 'r';
+  case eBlocked:
+    return 'B';
+  case eSuspended:
+    return 'S';
+  default:
+    return 'D';
+  }
+}
+
+static uint32_t previous_runtime(TaskHandle_t handle, bool *found) {
+  for (size_t i = 0; i < mark_count; i++) {
+    if (marks[i].handle == handle) {
+      *found = true;
+      return marks[i].runtime;
+    }
+  }
+  *found = false;
+  return 0;
+}
+
+/**
+ * Record the headroom for a task name and return the lowest seen so far
+ */
+static uint32_t update_stack_min(const char *name, uint32_t free_bytes) {
+  for (size_t i = 0; i < stack_min_count; i++) {
+    if (strncmp(stack_min[i].name, name, configMAX_TASK_NAME_LEN) == 0) {
+      if (free_bytes < stack_min[i].min_free) {
+        if (free_bytes < TASK_PROFILER_STACK_WARN &&
+            stack_min[i].min_free >= TASK_PROFILER_STACK_WARN) {
+          ESP_LOGW(TAG, "Task %s is close to a stack overflow (%lu B free)",
+                   name, (unsigned long)free_bytes);
+        }
+        stack_min[i].min_free = free_bytes;
+      }
+      return stack_min[i].min_free;
+    }
+  }
+  if (stack_min_count < TASK_PROFILER_MAX_TASKS) {
+    stack_min_t *s = &stack_min[stack_min_count++];
+    strncpy(s->name, name, sizeof(s->name) - 1);
+    s->name[sizeof(s->name) - 1] = '\0';
+    s->min_free = free_bytes;
+    if (free_bytes < TASK_PROFILER_STACK_WARN) {
+      ESP_LOGW(TAG, "Task %s is close to a stack overflow (%lu B free)", name,
+               (unsigned long)free_bytes);
+    }
+  }
+  return free_bytes;
+}
+
+static bool status_reserve(size_t cap) {
+  if (cap <= status_cap) {
+    return true;
+  }
+  const uint32_t caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+  TaskStatus_t *status = heap_caps_realloc(status_buf, cap * sizeof(*status),
+                                           caps);
+  if (status == NULL) {
+    return false;
+  }
+  status_buf = status;
+  runtime_mark_t *m = heap_caps_realloc(marks, cap * sizeof(*m), caps);
+  if (m == NULL) {
+    return false;
+  }
+  marks = m;
+  m = heap_caps_realloc(next_marks, cap * sizeof(*m), caps);
+  if (m == NULL) {
+    return false;
+  }
+  next_marks = m;
+  status_cap = cap;
+  return true;
+}
+
+/**
+ * Returns false if the tasks could not be listed; the last sample stays
+ * published and its marks are the base of the next period
+ */
+static bool profiler_sample(int64_t elapsed_us) {
+  uint32_t total_runtime = 0;
+  UBaseType_t count = uxTaskGetNumberOfTasks();
+  UBaseType_t n = 0;
+  if (status_reserve(count + PROFILER_TASK_SLACK)) {
+    n = uxTaskGetSystemState(status_buf, status_cap, &total_runtime);
+  }
+  if (n == 0) {
+    // Out of PSRAM, or more than PROFILER_TASK_SLACK tasks just started
+    ESP_LOGW(TAG, "Could not list %u tasks", (unsigned)count);
+    xSemaphoreTake(profile_lock, portMAX_DELAY);
+    summary.tasks_total = (uint16_t)count;
+    summary.truncated = ++truncated_count;
+    xSemaphoreGive(profile_lock);
+    return false;
+  }
+  size_t listed = n < TASK_PROFILER_MAX_TASKS ? n : TASK_PROFILER_MAX_TASKS;
+  if (listed < n && summary.tasks_listed == summary.tasks_total) {
+    ESP_LOGW(TAG, "%u tasks, only %d listed - raise TASK_PROFILER_MAX_TASKS",
+             (unsigned)n, TASK_PROFILER_MAX_TASKS);
+  }
+  task_profile_t unlisted; // Counted in the summary only
+
+  uint32_t idle_permille[portNUM_PROCESSORS] = {0};
+  TaskHandle_t idle[portNUM_PROCESSORS];
+  for (int c = 0; c < portNUM_PROCESSORS; c++) {
+    idle[c] = xTaskGetIdleTaskHandleForCore(c);
+  }
+
+  xSemaphoreTake(profile_lock, portMAX_DELAY);
+  memset(&summary, 0, sizeof(summary));
+  summary.period_ms = (uint32_t)(elapsed_us / 1000);
+  summary.tightest_free = UINT32_MAX;
+
+  for (UBaseType_t i = 0; i < n; i++) {
+    const TaskStatus_t *t = &status_buf[i];
+    task_profile_t *p = i < listed ? &profile[i] : &unlisted;
+    bool found;
+    uint32_t prev = previous_runtime(t->xHandle, &found);
+    uint64_t delta = found ? (uint32_t)(t->ulRunTimeCounter - prev) : 0;
+    uint32_t permille =
+        elapsed_us > 0 ? (uint32_t)(delta * 1000 / (uint64_t)elapsed_us) : 0;
+
+    strncpy(p->name, t->pcTaskName, sizeof(p->name) - 1);
+    p->name[sizeof(p->name) - 1] = '\0';
+    p->core = -1;
+#if configTASKLIST_INCLUDE_COREID
+    if (t->xCoreID != tskNO_AFFINITY) {
+      p->core = (int8_t)t->xCoreID;
+    }
+#endif
+    p->priority = (uint8_t)t->uxCurrentPriority;
+    p->state = state_char(t->eCurrentState);
+    p->cpu_permille = (uint16_t)(permille > 1000 ? 1000 : permille);
+    p->stack_free = (uint32_t)t->usStackHighWaterMark;
+    p->stack_free_min = update_stack_min(p->name, p->stack_free);
+    p->low_stack = p->stack_free_min < TASK_PROFILER_STACK_WARN;
+
+    if (p->low_stack) {
+      summary.low_stack_count++;
+    }
+    if (p->stack_free_min < summary.tightest_free) {
+      summary.tightest_free = p->stack_free_min;
+      memcpy(summary.tightest_task, p->name, sizeof(summary.tightest_task));
+    }
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+      if (t->xHandle == idle[c]) {
+        idle_permille[c] = p->cpu_permille;
+      }
+    }
+
+    next_marks[i].handle = t->xHandle;
+    next_marks[i].runtime = t->ulRunTimeCounter;
+  }
+
+  if (elapsed_us > 0) {
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+      summary.core_load_permille[c] = (uint16_t)(1000 - idle_permille[c]);
+    }
+    sample_count++;
+  }
+  if (listed < n) {
+    truncated_count++;
+  }
+  summary.samples = sample_count;
+  summary.tasks_total = (uint16_t)n;
+  summary.tasks_listed = (uint16_t)listed;
+  summary.truncated = truncated_count;
+  profile_count = listed;
+  xSemaphoreGive(profile_lock);
+
+  memcpy(marks, next_marks, n * sizeof(marks[0]));
+  mark_count = n;
+
+  // Keep the last task table across a reset for post-mortems
+  size_t fr_count =
+      listed < FLIGHT_RECORDER_TASKS ? listed : FLIGHT_RECORDER_TASKS;
+  for (size_t i = 0; i < fr_count; i++) {
+    const task_profile_t *p = &profile[i];
+    fr_task_t *f = &fr_tasks[i];
+    strncpy(f->name, p->name, sizeof(f->name) - 1);
+    f->name[sizeof(f->name) - 1] = '\0';
+    f->state = p->state;
+    f->core = p->core;
+    f->cpu_permille = p->cpu_permille;
+    f->stack_free = p->stack_free;
+  }
+  flight_recorder_set_tasks(fr_tasks, fr_count);
+  return true;
+}
+
+static void profiler_task(void *arg) {
+  (void)arg;
+  int64_t last_us = esp_timer_get_time();
+
+  profiler_sample(0); // Baseline for the first period
+  while (1) {
+    vTaskDelay(pdMS_TO_TICKS(profiler_period_ms));
+    int64_t now_us = esp_timer_get_time();
+    // A period that could not be listed is folded into the next one
+    if (profiler_sample(now_us - last_us)) {
+      last_us = now_us;
+    }
+  }
+}
+
+esp_err_t task_profiler_start(uint32_t period_ms) {
+  if (profiler_task_handle != NULL) {
+    return ESP_OK;
+  }
+  if (profile_lock == NULL) {
+    profile_lock = xSemaphoreCreateMutex();
+    if (profile_lock == NULL) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  if (period_ms >= 1000) {
+    profiler_period_ms = period_ms;
+  }
+
+  if (xTaskCreate(profiler_task, "task_prof", PROFILER_TASK_STACK, NULL,
+                  PROFILER_TASK_PRIORITY, &profiler_task_handle) != pdPASS) {
+    profiler_task_handle = NULL;
+    ESP_LOGE(TAG, "Failed to create profiler task");
+    return ESP_FAIL;
+  }
+  ESP_LOGI(TAG, "Task profiler started (period %lu ms)",
+           (unsigned long)profiler_period_ms);
+  return ESP_OK;
+}
+
+size_t task_profiler_get(task_profile_t *out, size_t max,
+                         task_profile_summary_t *summary_out) {
+  if (profile_lock == NULL) {
+    if (summary_out) {
+      memset(summary_out, 0, sizeof(*summary_out));
+    }
+    return 0;
+  }
+
+  xSemaphoreTake(profile_lock, portMAX_DELAY);
+  size_t n = 0;
+  if (out != NULL) {
+    n = profile_count < max ? profile_count : max;
+    memcpy(out, profile, n * sizeof(out[0]));
+  }
+  if (summary_out) {
+    *summary_out = summary;
+  }
+  xSemaphoreGive(profile_lock);
+  return n;
+}
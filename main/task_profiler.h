@@ -0,0 +1,73 @@
+/**
+ * @file task_profiler.h
+ * @brief Sampling per-task CPU and stack profiler
+ *
+ * A low priority task diffs the FreeRTOS run-time counters every period and
+ * keeps per-task CPU usage, per-core load and stack high-water marks. The
+ * lowest stack headroom seen is remembered per task name, so tasks that are
+ * recreated (afe_feed/afe_fetch on every capture restart) keep their worst
+ * case for the whole boot.
+ *
+ * Every task is sampled, however many there are; the per-task table keeps
+ * the first TASK_PROFILER_MAX_TASKS and the summary counts the rest.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TASK_PROFILER_MAX_TASKS 40 ///< Per-task table size
+#define TASK_PROFILER_STACK_WARN 512 ///< Headroom (bytes) considered unsafe
+
+typedef struct {
+  char name[configMAX_TASK_NAME_LEN];
+  int8_t core;           ///< Pinned core, -1 if unpinned
+  uint8_t priority;
+  char state;            ///< R(unning) r(eady) B(locked) S(uspended) D(eleted)
+  uint16_t cpu_permille; ///< Share of one core over the last period
+  uint32_t stack_free;     ///< Current high-water mark (bytes never used)
+  uint32_t stack_free_min; ///< Lowest high-water mark seen for this name
+  bool low_stack;          ///< stack_free_min < TASK_PROFILER_STACK_WARN
+} task_profile_t;
+
+typedef struct {
+  uint32_t period_ms;         ///< Length of the last sample period
+  uint32_t samples;           ///< Periods sampled since start
+  uint16_t core_load_permille[portNUM_PROCESSORS];
+  uint8_t low_stack_count;    ///< Tasks flagged low_stack
+  char tightest_task[configMAX_TASK_NAME_LEN]; ///< Lowest stack headroom
+  uint32_t tightest_free;
+  uint16_t tasks_total;       ///< Tasks at the last sample
+  uint16_t tasks_listed;      ///< Of those, in the per-task table
+  uint32_t truncated;         ///< Samples that left tasks out of the table
+} task_profile_summary_t;
+
+/**
+ * @brief Start the profiler task
+ *
+ * @param period_ms Sample period (also the CPU% averaging window)
+ */
+esp_err_t task_profiler_start(uint32_t period_ms);
+
+/**
+ * @brief Copy the latest sample
+ *
+ * @param out Destination array (may be NULL to fetch only the summary)
+ * @param max Capacity of @p out
+ * @param summary Optional summary
+ * @return Number of tasks written to @p out
+ */
+size_t task_profiler_get(task_profile_t *out, size_t max,
+                         task_profile_summary_t *summary);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,227 @@
+/**
+ * @file tts_fetch.c
+ * @brief TTS audio of an Assist run, from the early stream or tts-end
+ */
+
+#include "tts_fetch.h"
+#include "alloc_trace.h"
+#include "blog.h"
+#include "dns_cache.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "work_queue.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "tts_fetch";
+
+typedef struct {
+  uint32_t run; ///< tts_run when queued
+  bool early;   ///< run-start stream, not tts-end
+  char url[];
+} tts_fetch_t;
+
+static char server_host[DNS_CACHE_HOST_LEN];
+static int server_port = 0;
+static bool server_ssl = false;
+static tts_fetch_audio_cb_t on_audio = NULL;
+
+static volatile uint32_t tts_run = 0; // Bumped at run-start
+static uint32_t early_offer_run = 0;
+static volatile uint32_t early_stop_run = 0;  // Early stream abandoned
+static volatile uint32_t early_audio_run = 0; // Early stream had audio
+static work_handle_t early_item = WORK_HANDLE_NONE;
+static tts_fetch_t *early_job = NULL; // Owned by the item once queued
+
+void tts_fetch_configure(const tts_fetch_config_t *config) {
+  strlcpy(server_host, config->hostname, sizeof(server_host));
+  server_port = config->port;
+  server_ssl = config->use_ssl;
+  on_audio = config->on_audio;
+}
+
+/**
+ * Host to connect to: the cached address for plain http, the configured
+ * name with TLS, which needs it for SNI and the certificate check.
+ */
+static const char *server_addr(char *ip, size_t ip_len) {
+  if (!server_ssl && dns_cache_resolve(server_host, ip, ip_len) == ESP_OK)
+    return ip;
+  return server_host;
+}
+
+// Once an early stream is playing only a new run stops it; tts-end then
+// skips its own download
+static bool abandoned(const tts_fetch_t *job) {
+  return job->early &&
+         (job->run != tts_run ||
+          (job->run == early_stop_run && job->run != early_audio_run));
+}
+
+// Reads in TTS_FETCH_POLL_MS socket timeouts so an abandoned early stream
+// is noticed while HA is still synthesising; gives up after @p idle_ms
+// without data. Returns the bytes passed to on_audio (no end marker).
+static size_t stream(const tts_fetch_t *job, uint32_t idle_ms) {
+  bool early = job->early;
+  char full_url[1024];
+  char host_ip[DNS_CACHE_IP_LEN];
+  const char *host = server_addr(host_ip, sizeof(host_ip));
+  // Same certificate handling as the WebSocket (no CN check)
+  snprintf(full_url, sizeof(full_url), "%s://%s:%d%s",
+           server_ssl ? "https" : "http", host, server_port, job->url);
+  ESP_LOGI(TAG, "%s TTS: %s", early ? "Streaming" : "Downloading", full_url);
+
+  esp_http_client_config_t config = {
+      .url = full_url,
+      .timeout_ms = TTS_FETCH_POLL_MS,
+  };
+  if (server_ssl)
+    config.skip_cert_common_name_check = true;
+
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+  if (!client)
+    return 0;
+  if (host == host_ip) {
+    // Proxies in front of HA route by name
+    char host_hdr[DNS_CACHE_HOST_LEN + 8];
+    snprintf(host_hdr, sizeof(host_hdr), "%s:%d", server_host, server_port);
+    esp_http_client_set_header(client, "Host", host_hdr);
+  }
+
+  size_t total = 0;
+  int64_t deadline = esp_timer_get_time() + (int64_t)idle_ms * 1000;
+  esp_err_t err = esp_http_client_open(client, 0);
+  if (err == ESP_OK) {
+    int hdr;
+    while ((hdr = esp_http_client_fetch_headers(client)) ==
+               -ESP_ERR_HTTP_EAGAIN &&
+           !abandoned(job) && esp_timer_get_time() < deadline) {
+    }
+    int status = esp_http_client_get_status_code(client);
+    if (abandoned(job)) {
+      err = ESP_ERR_INVALID_STATE;
+    } else if (hdr < 0 || status != 200) {
+      ESP_LOGE(TAG, "TTS request failed (status %d)", status);
+      err = ESP_FAIL;
+    }
+  }
+
+  char chunk[TTS_FETCH_READ_CHUNK];
+  while (err == ESP_OK && !abandoned(job)) {
+    int n = esp_http_client_read(client, chunk, sizeof(chunk));
+    if (n == -ESP_ERR_HTTP_EAGAIN) {
+      if (esp_timer_get_time() >= deadline) {
+        err = ESP_ERR_TIMEOUT;
+      }
+      continue;
+    }
+    if (n < 0) {
+      err = ESP_FAIL;
+    } else if (n == 0) {
+      // Closed; only a known length tells a truncated body apart
+      if (esp_http_client_get_content_length(client) > 0 &&
+          !esp_http_client_is_complete_data_received(client))
+        err = ESP_FAIL;
+      break;
+    } else {
+      if (total == 0 && early)
+        early_audio_run = job->run;
+      total += n;
+      BLOGD(TAG, "TTS chunk: %d bytes, %u total", n, (unsigned)total);
+      deadline = esp_timer_get_time() + (int64_t)TTS_FETCH_TIMEOUT_MS * 1000;
+      if (on_audio)
+        on_audio((const uint8_t *)chunk, n);
+    }
+  }
+  if (abandoned(job))
+    ESP_LOGI(TAG, "TTS stream abandoned after %u bytes", (unsigned)total);
+  else if (err != ESP_OK)
+    ESP_LOGE(TAG, "TTS %s failed after %u bytes: %s",
+             early ? "stream" : "download", (unsigned)total,
+             esp_err_to_name(err));
+  esp_http_client_close(client);
+  esp_http_client_cleanup(client);
+  return total;
+}
+
+static esp_err_t fetch_work(void *arg) {
+  tts_fetch_t *job = (tts_fetch_t *)arg;
+
+  if (!job->early && early_audio_run == job->run) {
+    // Already played from the run-start stream
+    TRACE_FREE(job);
+    return ESP_OK;
+  }
+  size_t n = stream(job, job->early ? TTS_FETCH_EARLY_WAIT_MS
+                                    : TTS_FETCH_TIMEOUT_MS);
+  if (job->early && n == 0) {
+    // Nothing reached the player: tts-end downloads it instead
+    ESP_LOGI(TAG, "Early TTS stream gave no audio, waiting for tts-end");
+  } else {
+    if (n > 0 && job->early)
+      metrics_inc(METRIC_HA_TTS_EARLY);
+    else if (n > 0 && job->run == early_offer_run)
+      metrics_inc(METRIC_HA_TTS_FALLBACK);
+    else if (n > 0)
+      metrics_inc(METRIC_HA_TTS_END);
+    if (on_audio)
+      on_audio(NULL, 0); // End
+  }
+  TRACE_FREE(job);
+  return n > 0 ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t queue_fetch(const char *url, bool early) {
+  size_t len = strlen(url);
+  tts_fetch_t *job =
+      TRACE_MALLOC(ALLOC_TAG_HA_CLIENT, sizeof(tts_fetch_t) + len + 1);
+  if (!job)
+    return ESP_ERR_NO_MEM;
+  job->run = tts_run;
+  job->early = early;
+  memcpy(job->url, url, len + 1);
+  if (early) {
+    work_release(early_item);
+    early_item = WORK_HANDLE_NONE;
+    early_job = job;
+  }
+  esp_err_t err =
+      work_submit(WORK_LANE_MEDIA, early ? "tts_early" : "tts_fetch",
+                  fetch_work, job, early ? &early_item : NULL);
+  if (err != ESP_OK) {
+    TRACE_FREE(job);
+    if (early)
+      early_job = NULL;
+  }
+  return err;
+}
+
+void tts_fetch_run_start(const char *stream_url) {
+  tts_run++; // Also ends an early stream of the previous run
+  if (stream_url && queue_fetch(stream_url, true) == ESP_OK)
+    early_offer_run = tts_run;
+}
+
+void tts_fetch_skip(void) { early_stop_run = tts_run; }
+
+esp_err_t tts_fetch_tts_end(const char *url) {
+  // An early stream still silent now is not going to play
+  if (early_offer_run == tts_run && early_audio_run != tts_run)
+    early_stop_run = tts_run;
+  return queue_fetch(url, false);
+}
+
+// A running stream sees abandoned() within TTS_FETCH_POLL_MS; a queued one
+// is dropped and its job freed here, since its function will not run.
+void tts_fetch_run_end(void) {
+  if (early_offer_run != tts_run || early_audio_run == tts_run)
+    return;
+  early_stop_run = tts_run;
+  if (work_cancel(early_item) == ESP_OK) {
+    ESP_LOGI(TAG, "Run ended, queued early TTS stream dropped");
+    TRACE_FREE(early_job);
+  }
+  early_job = NULL;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file tts_fetch.h
+ * @brief TTS audio of an Assist run, from the early stream or tts-end
+ *
+ * Newer HA versions announce a streaming URL in run-start (tts_output with
+ * stream_response) before the intent is done. It is opened right away on
+ * the work_queue media lane and fed to the player as synthesis proceeds.
+ * The tts-end URL is queued behind it on the same lane and only fetched if
+ * the early stream played nothing; without an early URL it is the only
+ * fetch, as before.
+ *
+ * Reads use a TTS_FETCH_POLL_MS socket timeout so an early stream that is
+ * abandoned while HA still runs STT and intent is noticed: a new run, a
+ * timer intent (TTS skipped), a tts-end before any audio, or the run's end.
+ * A queued early stream is dropped when its run ends. One that is already
+ * playing drains.
+ *
+ * The run calls come from one task (ha_events); fetches run on the media
+ * worker.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TTS_FETCH_READ_CHUNK 1024
+#define TTS_FETCH_POLL_MS 1000     ///< Socket timeout, abandonment checked
+#define TTS_FETCH_TIMEOUT_MS 10000 ///< No data for this long: give up
+#define TTS_FETCH_EARLY_WAIT_MS 60000 ///< Early stream: STT and intent come
+                                      ///< first (backstop, run end stops it)
+
+/**
+ * @brief Receives the audio; (NULL, 0) once the response is complete
+ */
+typedef void (*tts_fetch_audio_cb_t)(const uint8_t *data, size_t len);
+
+typedef struct {
+  const char *hostname; ///< HA host, copied
+  int port;
+  bool use_ssl;
+  tts_fetch_audio_cb_t on_audio;
+} tts_fetch_config_t;
+
+/**
+ * @brief Set the server the URLs are relative to
+ */
+void tts_fetch_configure(const tts_fetch_config_t *config);
+
+/**
+ * @brief run-start: a new run, ending any stream of the previous one
+ *
+ * @param stream_url Early stream URL, NULL if HA did not offer one
+ */
+void tts_fetch_run_start(const char *stream_url);
+
+/**
+ * @brief The run skips TTS (timer intent): drop its early stream
+ */
+void tts_fetch_skip(void);
+
+/**
+ * @brief tts-end: the finished response is at @p url
+ *
+ * Fetched unless the early stream already played.
+ *
+ * @return ESP_OK if queued; otherwise no audio and no end will follow
+ */
+esp_err_t tts_fetch_tts_end(const char *url);
+
+/**
+ * @brief run-end or error: an early stream that has not played yet never
+ * will
+ */
+void tts_fetch_run_end(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -3,15 +3,21 @@
  */
 
 #include "tts_player.h"
+#include "alloc_trace.h"
+#include "audio_level.h"
 #include "audio_capture.h"
 #include "audio_player.h"
+#include "blog.h"
 #include "bsp_board_extra.h"
 #include "driver/i2s_std.h"
+#include "esp_cpu.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
+#include "mem_budget.h"
 #include "mp3dec.h"
+#include "sys_diag.h"
 #include <string.h>
 
 static const char *TAG = "tts_player";
@@ -79,7 +85,8 @@ static esp_err_t play_mp3_buffer(uint8_t *mp3_data, size_t mp3_size) {
   codec_configured_flag = false;
 
   // PCM output buffer
-  pcm_buffer = (int16_t *)malloc(PCM_BUFFER_SIZE);
+  pcm_buffer =
+      (int16_t *)mem_budget_acquire(MEM_BLOCK_TTS_PCM, PCM_BUFFER_SIZE);
   if (pcm_buffer == NULL) {
     ESP_LOGE(TAG, "Failed to allocate PCM buffer");
     overall_ret = ESP_ERR_NO_MEM;
@@ -89,13 +96,16 @@ static esp_err_t play_mp3_buffer(uint8_t *mp3_data, size_t mp3_size) {
   uint8_t *read_ptr = mp3_data;
   int bytes_left = mp3_size;
   int total_samples = 0;
+  int32_t envelope = 0;
+  uint32_t env_cycles = 0;
+  uint32_t env_frames = 0;
 
   // Decode MP3 frames
   while (bytes_left > 0) {
     // Find sync word
     int offset = MP3FindSyncWord(read_ptr, bytes_left);
     if (offset < 0) {
-      ESP_LOGD(TAG, "No more MP3 frames found");
+      BLOGD(TAG, "No more MP3 frames found");
       break;
     }
 
@@ -103,6 +113,7 @@ static esp_err_t play_mp3_buffer(uint8_t *mp3_data, size_t mp3_size) {
     bytes_left -= offset;
 
     // Decode one MP3 frame
+    sys_diag_activity("mp3_decode");
     int err = MP3Decode(mp3_decoder, &read_ptr, &bytes_left, pcm_buffer, 0);
 
     if (err == ERR_MP3_NONE) {
@@ -110,8 +121,8 @@ static esp_err_t play_mp3_buffer(uint8_t *mp3_data, size_t mp3_size) {
       MP3FrameInfo frame_info;
       MP3GetLastFrameInfo(mp3_decoder, &frame_info);
 
-      ESP_LOGD(TAG, "Decoded frame: %d Hz, %d ch, %d samples",
-               frame_info.samprate, frame_info.nChans, frame_info.outputSamps);
+      BLOGD(TAG, "Decoded frame: %d Hz, %d ch, %d samples",
+            frame_info.samprate, frame_info.nChans, frame_info.outputSamps);
 
       // Configure I2S for this sample rate on first frame
       // Always reconfigure to handle cases where beep tone changed codec
@@ -126,10 +137,18 @@ static esp_err_t play_mp3_buffer(uint8_t *mp3_data, size_t mp3_size) {
         codec_configured_flag = true;
       }
 
+      // Drive the SPEAKING LED from what is about to be played
+      uint32_t env_start = esp_cpu_get_cycle_count();
+      audio_level_post(
+          audio_level_update(&envelope, pcm_buffer, frame_info.outputSamps));
+      env_cycles += esp_cpu_get_cycle_count() - env_start;
+      env_frames++;
+
       // Write PCM data to I2S
       size_t pcm_bytes = frame_info.outputSamps * sizeof(int16_t);
       size_t bytes_written = 0;
       // timeout_ms: 0 means block indefinitely
+      sys_diag_activity("i2s_write");
       esp_err_t ret =
           bsp_extra_i2s_write(pcm_buffer, pcm_bytes, &bytes_written, 0);
 
@@ -142,7 +161,7 @@ static esp_err_t play_mp3_buffer(uint8_t *mp3_data, size_t mp3_size) {
       total_samples += frame_info.outputSamps;
 
     } else if (err == ERR_MP3_INDATA_UNDERFLOW) {
-      ESP_LOGD(TAG, "MP3 data underflow, need more data");
+      BLOGD(TAG, "MP3 data underflow, need more data");
       break;
     } else {
       ESP_LOGW(TAG, "MP3 decode error: %d", err);
@@ -155,11 +174,13 @@ static esp_err_t play_mp3_buffer(uint8_t *mp3_data, size_t mp3_size) {
   }
 
   ESP_LOGI(TAG, "Playback complete: %d samples", total_samples);
+  if (env_frames > 0) {
+    ESP_LOGD(TAG, "LED envelope: %lu frames, avg %lu cycles/frame",
+             (unsigned long)env_frames, (unsigned long)(env_cycles / env_frames));
+  }
 
 out:
-  if (pcm_buffer) {
-    free(pcm_buffer);
-  }
+  mem_budget_release(MEM_BLOCK_TTS_PCM, pcm_buffer);
 
   // Always signal completion so the assistant can resume listening even on
   // errors
@@ -176,8 +197,12 @@ out:
 static void playback_task(void *arg) {
   audio_chunk_t chunk;
 
+  // Not on the TWDT: the queue wait below is unbounded by design
+  sys_diag_soft_wdt_add();
+
   while (1) {
     // Wait for audio chunk
+    sys_diag_activity(NULL);
     if (xQueueReceive(audio_queue, &chunk, portMAX_DELAY) == pdTRUE) {
       if (chunk.data == NULL || chunk.length == 0) {
         // Stop signal
@@ -189,6 +214,7 @@ static void playback_task(void *arg) {
           ESP_LOGI(TAG, "Playing TTS audio: %d bytes MP3", tts_buffer_pos);
 
           // Stop audio capture to free I2S channel for playback
+          sys_diag_activity("capture_stop");
           (void)audio_capture_stop_wait(1000);
           ESP_LOGI(TAG, "Audio capture stopped - I2S freed for TTS playback");
 
@@ -216,15 +242,15 @@ static void playback_task(void *arg) {
       if (tts_buffer_pos + chunk.length < TTS_BUFFER_SIZE) {
         memcpy(tts_buffer + tts_buffer_pos, chunk.data, chunk.length);
         tts_buffer_pos += chunk.length;
-        ESP_LOGD(TAG, "Buffered audio chunk: %d bytes (total: %d)",
-                 chunk.length, tts_buffer_pos);
+        BLOGD(TAG, "Buffered audio chunk: %d bytes (total: %d)",
+              chunk.length, tts_buffer_pos);
       } else {
         ESP_LOGW(TAG, "TTS buffer full (%d/%d), dropping %d bytes",
                  tts_buffer_pos, TTS_BUFFER_SIZE, chunk.length);
       }
 
       // Free chunk data
-      free(chunk.data);
+      TRACE_FREE(chunk.data);
     }
   }
 }
@@ -240,7 +266,8 @@ esp_err_t tts_player_init(void) {
   }
 
   // Allocate audio buffer
-  tts_buffer = (uint8_t *)malloc(TTS_BUFFER_SIZE);
+  tts_buffer =
+      (uint8_t *)mem_budget_acquire(MEM_BLOCK_TTS_MP3, TTS_BUFFER_SIZE);
   if (tts_buffer == NULL) {
     ESP_LOGE(TAG, "Failed to allocate TTS buffer");
     MP3FreeDecoder(mp3_decoder);
@@ -252,7 +279,7 @@ esp_err_t tts_player_init(void) {
   audio_queue = xQueueCreate(TTS_QUEUE_SIZE, sizeof(audio_chunk_t));
   if (audio_queue == NULL) {
     ESP_LOGE(TAG, "Failed to create audio queue");
-    free(tts_buffer);
+    mem_budget_release(MEM_BLOCK_TTS_MP3, tts_buffer);
     MP3FreeDecoder(mp3_decoder);
     return ESP_ERR_NO_MEM;
   }
@@ -263,7 +290,7 @@ esp_err_t tts_player_init(void) {
   if (ret != pdPASS) {
     ESP_LOGE(TAG, "Failed to create playback task");
     vQueueDelete(audio_queue);
-    free(tts_buffer);
+    mem_budget_release(MEM_BLOCK_TTS_MP3, tts_buffer);
     MP3FreeDecoder(mp3_decoder);
     return ESP_FAIL;
   }
@@ -286,7 +313,7 @@ esp_err_t tts_player_feed(const uint8_t *audio_data, size_t length) {
   }
 
   // Allocate chunk and copy data
-  uint8_t *chunk_data = (uint8_t *)malloc(length);
+  uint8_t *chunk_data = (uint8_t *)TRACE_MALLOC(ALLOC_TAG_TTS, length);
   if (chunk_data == NULL) {
     ESP_LOGE(TAG, "Failed to allocate chunk memory");
     return ESP_ERR_NO_MEM;
@@ -298,7 +325,7 @@ esp_err_t tts_player_feed(const uint8_t *audio_data, size_t length) {
 
   if (xQueueSend(audio_queue, &chunk, pdMS_TO_TICKS(100)) != pdTRUE) {
     ESP_LOGW(TAG, "Audio queue full, dropping chunk");
-    free(chunk_data);
+    TRACE_FREE(chunk_data);
     return ESP_FAIL;
   }
 
@@ -335,7 +362,7 @@ void tts_player_deinit(void) {
   }
 
   if (tts_buffer != NULL) {
-    free(tts_buffer);
+    mem_budget_release(MEM_BLOCK_TTS_MP3, tts_buffer);
     tts_buffer = NULL;
   }
 
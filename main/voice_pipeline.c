@@ -2,6 +2,7 @@
 #include "esp_check.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
@@ -13,18 +14,24 @@
 #include <string.h>
 #include <time.h>
 
+#include "alloc_trace.h"
 #include "audio_capture.h"
 #include "beep_tone.h"
+#include "blog.h"
 #include "bsp_board_extra.h"
 #include "cJSON.h"
+#include "flight_recorder.h"
 #include "ha_client.h"
 #include "led_status.h"
 #include "local_music_player.h"
+#include "metrics.h"
 #include "mqtt_ha.h"
 #include "oled_status.h"
 #include "ota_update.h"
+#include "settings_manager.h"
 #include "sys_diag.h"
 #include "tts_player.h"
+#include "work_queue.h"
 
 #define TAG "voice_pipeline"
 #define FOLLOWUP_RECORDING_MS 7000
@@ -86,7 +93,10 @@ static bool pending_timer_valid = false;
 static char last_stt_text[128];
 static bool timer_started_from_stt = false;
 
-#define HA_RESPONSE_TIMEOUT_MS 45000
+// Speech end -> response: HA's own work (STT, intent, TTS) plus a few round
+// trips at the measured RTT (end of audio, stt-end, intent-end, tts-end)
+#define HA_RESPONSE_WORK_MS 40000
+#define HA_RESPONSE_ROUND_TRIPS 4
 static TimerHandle_t ha_response_timeout_timer = NULL;
 static bool ha_response_waiting = false;
 
@@ -94,16 +104,26 @@ static char *current_pipeline_handler = NULL;
 static int warmup_chunks_skip = 0;
 static bool tts_stream_active = false;
 
+// Stage start times for the /metrics latency histograms (0 = not armed)
+static int64_t stage_wake_us = 0;
+static int64_t stage_speech_end_us = 0;
+static int64_t stage_stt_us = 0;
+static int64_t stage_intent_us = 0;
+static int64_t stage_tts_us = 0;
+static int64_t stage_response_us = 0; // Speech end, kept until the first TTS
+
 // Config
-static voice_pipeline_config_t current_config = {.wwd_threshold = 0.5f,
-                                                 .vad_speech_threshold = 180,
-                                                 .vad_silence_ms = 1800,
-                                                 .vad_min_speech_ms = 200,
-                                                 .vad_max_recording_ms = 7000,
-                                                 .agc_enabled = true,
-                                                 .agc_target_level = 4000};
+static voice_pipeline_config_t current_config = {
+    .wwd_threshold = VOICE_PIPELINE_DEFAULT_WWD_THRESHOLD,
+    .vad_speech_threshold = VOICE_PIPELINE_DEFAULT_VAD_THRESHOLD,
+    .vad_silence_ms = VOICE_PIPELINE_DEFAULT_VAD_SILENCE_MS,
+    .vad_min_speech_ms = VOICE_PIPELINE_DEFAULT_VAD_MIN_SPEECH_MS,
+    .vad_max_recording_ms = VOICE_PIPELINE_DEFAULT_VAD_MAX_RECORDING_MS,
+    .agc_enabled = VOICE_PIPELINE_DEFAULT_AGC_ENABLED,
+    .agc_target_level = VOICE_PIPELINE_DEFAULT_AGC_TARGET};
 
 // Forward decls
+static void restore_config(void);
 static void pipeline_task(void *arg);
 static void on_wake_word_detected(const int16_t *audio_data, size_t samples);
 static void on_offline_cmd_detected(int id, int index);
@@ -118,7 +138,7 @@ static esp_err_t start_audio_streaming(uint32_t max_recording_ms,
                                        const char *context_tag);
 static void tts_audio_handler(const uint8_t *audio_data, size_t length);
 static void on_tts_complete(void);
-static void restart_task(void *arg);
+static esp_err_t restart_work(void *arg);
 static void handle_local_music_play(void);
 static bool response_requests_music_selection(const char *response_text);
 static bool ascii_substr_case_insensitive(const char *haystack,
@@ -163,19 +183,37 @@ static void led_status_set_guarded(led_status_t status) {
   led_status_set(status);
 }
 
+static void stage_done(metric_hist_t hist, int64_t *since_us) {
+  if (*since_us == 0) {
+    return;
+  }
+  metrics_observe(hist, (uint32_t)(esp_timer_get_time() - *since_us));
+  *since_us = 0;
+}
+
 // =============================================================================
 // PUBLIC API
 // =============================================================================
 
+// Soft watchdog: a capture task stuck in a driver or AFE call. Restarting
+// wake word mode joins the capture tasks (rebooting if one stays stuck) and
+// starts fresh ones.
+static void capture_stall_recovery(const char *task, uint32_t stalled_ms) {
+  ESP_LOGW(TAG, "%s stalled for %lu ms, restarting wake word mode", task,
+           (unsigned long)stalled_ms);
+  pipeline_post_cmd(PIPELINE_CMD_RESTART_WWD, 0);
+}
+
 esp_err_t voice_pipeline_init(void) {
   ESP_LOGI(TAG, "Initializing Voice Pipeline...");
+  restore_config();
 
   pipeline_cmd_queue = xQueueCreate(10, sizeof(pipeline_cmd_t));
   if (!pipeline_cmd_queue)
     return ESP_ERR_NO_MEM;
 
   ha_response_timeout_timer =
-      xTimerCreate("ha_resp_to", pdMS_TO_TICKS(HA_RESPONSE_TIMEOUT_MS), pdFALSE,
+      xTimerCreate("ha_resp_to", pdMS_TO_TICKS(HA_RESPONSE_WORK_MS), pdFALSE,
                    NULL, ha_response_timeout_cb);
   if (!ha_response_timeout_timer)
     return ESP_ERR_NO_MEM;
@@ -191,6 +229,10 @@ esp_err_t voice_pipeline_init(void) {
 
   // Register callbacks
   audio_capture_register_cmd_callback(on_offline_cmd_detected);
+  sys_diag_register_recovery("i2s_read", capture_stall_recovery);
+  sys_diag_register_recovery("afe_feed", capture_stall_recovery);
+  sys_diag_register_recovery("afe_fetch", capture_stall_recovery);
+  sys_diag_register_recovery("mn_detect", capture_stall_recovery);
 
   // Register HA callbacks
   ha_client_register_intent_callback(intent_handler);
@@ -205,8 +247,9 @@ esp_err_t voice_pipeline_init(void) {
 
   // Allocate pipeline_task stack from PSRAM to save internal RAM
   if (!pipeline_task_stack) {
-    pipeline_task_stack = (StackType_t *)heap_caps_malloc(
-        PIPELINE_TASK_STACK_SIZE * sizeof(StackType_t), MALLOC_CAP_SPIRAM);
+    pipeline_task_stack = (StackType_t *)TRACE_HEAP_CAPS_MALLOC(
+        ALLOC_TAG_PIPELINE, PIPELINE_TASK_STACK_SIZE * sizeof(StackType_t),
+        MALLOC_CAP_SPIRAM);
     if (!pipeline_task_stack) {
       ESP_LOGE(TAG, "Failed to allocate pipeline_task stack from PSRAM");
       return ESP_ERR_NO_MEM;
@@ -247,12 +290,51 @@ void voice_pipeline_on_music_state_change(bool is_playing) {
   }
 }
 
+// Tuning persisted by voice_pipeline_update_config(), applied before the
+// first WWD start
+static void restore_config(void) {
+  app_settings_t s;
+  if (settings_manager_load(&s) != ESP_OK) {
+    return;
+  }
+  current_config.wwd_threshold = s.wwd_threshold;
+  current_config.vad_speech_threshold = (uint32_t)s.vad_speech_threshold;
+  current_config.vad_silence_ms = (uint32_t)s.vad_silence_ms;
+  current_config.vad_min_speech_ms = (uint32_t)s.vad_min_speech_ms;
+  current_config.vad_max_recording_ms = (uint32_t)s.vad_max_recording_ms;
+  current_config.agc_enabled = s.agc_enabled;
+  current_config.agc_target_level = (uint16_t)s.agc_target_level;
+  ESP_LOGI(TAG, "Tuning: WWD %.2f, VAD %lu (silence %lu ms), AGC %s/%u",
+           (double)current_config.wwd_threshold,
+           (unsigned long)current_config.vad_speech_threshold,
+           (unsigned long)current_config.vad_silence_ms,
+           current_config.agc_enabled ? "on" : "off",
+           current_config.agc_target_level);
+}
+
+// Field by field: a whole-struct save would write back stale copies of
+// settings other tasks change meanwhile (volume, LED brightness). Only
+// changed fields become dirty; settings_manager coalesces slider drags.
+static void persist_config(const voice_pipeline_config_t *c) {
+  settings_manager_set_float(SETTING_WWD_THRESHOLD, c->wwd_threshold);
+  settings_manager_set_int(SETTING_VAD_SPEECH_THRESHOLD,
+                           (int32_t)c->vad_speech_threshold);
+  settings_manager_set_int(SETTING_VAD_SILENCE_MS, (int32_t)c->vad_silence_ms);
+  settings_manager_set_int(SETTING_VAD_MIN_SPEECH_MS,
+                           (int32_t)c->vad_min_speech_ms);
+  settings_manager_set_int(SETTING_VAD_MAX_RECORDING_MS,
+                           (int32_t)c->vad_max_recording_ms);
+  settings_manager_set_int(SETTING_AGC_ENABLED, c->agc_enabled ? 1 : 0);
+  settings_manager_set_int(SETTING_AGC_TARGET_LEVEL, c->agc_target_level);
+}
+
 esp_err_t voice_pipeline_update_config(const voice_pipeline_config_t *config) {
   if (!config)
     return ESP_ERR_INVALID_ARG;
   bool wwd_changed =
       (fabs(config->wwd_threshold - current_config.wwd_threshold) > 0.01f);
   current_config = *config;
+  persist_config(&current_config);
   if (wwd_changed) {
     pipeline_post_cmd(PIPELINE_CMD_RESTART_WWD, 0);
   }
@@ -275,7 +357,7 @@ void voice_pipeline_test_tts(const char *text) {
 }
 
 void voice_pipeline_trigger_restart(void) {
-  xTaskCreate(restart_task, "restart", 2048, NULL, 3, NULL);
+  work_submit(WORK_LANE_CONTROL, "restart", restart_work, NULL, NULL);
 }
 
 void voice_pipeline_trigger_alarm(int alarm_id) {
@@ -294,7 +376,9 @@ static void pipeline_task(void *arg) {
     // Wait with timeout to allow WDT feeding
     if (xQueueReceive(pipeline_cmd_queue, &cmd, pdMS_TO_TICKS(1000)) ==
         pdTRUE) {
-      sys_diag_wdt_feed();
+      sys_diag_activity("pipeline_cmd");
+      flight_recorder_log(FR_EV_PIPE_CMD, (uint32_t)cmd.data,
+                          (uint16_t)cmd.type);
 
       switch (cmd.type) {
       case PIPELINE_CMD_WAKE_DETECTED:
@@ -385,7 +469,10 @@ static void pipeline_task(void *arg) {
         break;
 
       case PIPELINE_CMD_RESTART_WWD:
-        pipeline_post_cmd(PIPELINE_CMD_STOP_WWD, 0);
+        // Also joins tasks an earlier stop gave up on, which would otherwise
+        // leave their handles set and the start would be refused
+        audio_capture_teardown(500);
+        is_wwd_running = false;
         pipeline_post_cmd(PIPELINE_CMD_RESUME_WWD, 0);
         break;
 
@@ -412,7 +499,7 @@ static void pipeline_task(void *arg) {
         for (int i = 0; i < 5; i++) {
           beep_tone_play(1000, 500, 100);
           vTaskDelay(pdMS_TO_TICKS(500));
-          sys_diag_wdt_feed(); // Feed during long loops
+          sys_diag_activity("beep"); // Feed during long loops
         }
         bsp_extra_codec_volume_set(prev_volume, NULL);
         pipeline_post_cmd(PIPELINE_CMD_RESUME_WWD, 0);
@@ -439,7 +526,7 @@ static void pipeline_task(void *arg) {
 
       case PIPELINE_CMD_MUSIC_CONTROL:
         ESP_LOGI(TAG, "Pipeline Music Control: Stopping WWD/Mic first...");
-        sys_diag_wdt_feed(); // Feed before heavy operation
+        sys_diag_activity("music_ctl"); // Feed before heavy operation
 
         // 1. Stop Microphone / WWD
         audio_capture_stop_wait(500);
@@ -475,7 +562,7 @@ static void pipeline_task(void *arg) {
       }
     } else {
       // Idle loop - feed dog
-      sys_diag_wdt_feed();
+      sys_diag_activity(NULL);
     }
   }
   sys_diag_wdt_remove();
@@ -494,7 +581,7 @@ static void on_wake_word_detected(const int16_t *audio_data, size_t samples) {
 
   // Safety cleanup: free any leftover pipeline handler from interrupted session
   if (current_pipeline_handler) {
-    free(current_pipeline_handler);
+    TRACE_FREE(current_pipeline_handler);
     current_pipeline_handler = NULL;
   }
 
@@ -502,6 +589,10 @@ static void on_wake_word_detected(const int16_t *audio_data, size_t samples) {
   suppress_tts_audio = false;
   pending_timer_valid = false;
   timer_started_from_stt = false;
+  stage_wake_us = esp_timer_get_time();
+  stage_speech_end_us = stage_stt_us = stage_intent_us = stage_tts_us = 0;
+  stage_response_us = 0;
+  metrics_inc(METRIC_PIPELINE_RUNS);
   led_status_set_guarded(LED_STATUS_LISTENING);
   oled_status_set_va_state(OLED_VA_LISTENING);
   oled_status_set_last_event("wake");
@@ -521,10 +612,13 @@ static void vad_event_handler(audio_capture_vad_event_t event) {
     oled_status_set_last_event("vad-start");
   } else if (event == VAD_EVENT_SPEECH_END) {
     ESP_LOGI(TAG, "VAD: Speech End");
+    flight_recorder_log(FR_EV_PIPE_SPEECH_END, 0, 0);
+    stage_speech_end_us = esp_timer_get_time();
+    stage_response_us = stage_speech_end_us;
     is_pipeline_active = false;
     audio_capture_stop_wait(0);
 
-    if (ha_client_is_connected()) {
+    if (ha_client_is_connected() || ha_client_run_is_resuming()) {
       esp_err_t err = ha_client_end_audio_stream();
       if (err == ESP_OK) {
         led_status_set_guarded(LED_STATUS_PROCESSING);
@@ -548,7 +642,7 @@ static void vad_event_handler(audio_capture_vad_event_t event) {
     }
 
     if (current_pipeline_handler) {
-      free(current_pipeline_handler);
+      TRACE_FREE(current_pipeline_handler);
       current_pipeline_handler = NULL;
     }
   }
@@ -558,9 +652,12 @@ static void audio_capture_handler(const uint8_t *audio_data, size_t length) {
   if (!is_pipeline_active || !current_pipeline_handler)
     return;
 
-  if (ha_client_is_audio_ready()) {
+  // While resuming, ha_client buffers the audio for the replayed run
+  if (ha_client_is_audio_ready() || ha_client_run_is_resuming()) {
     if (warmup_chunks_skip > 0) {
       warmup_chunks_skip--;
+      BLOGD(TAG, "Warm-up chunk skipped (%u bytes, %d left)",
+            (unsigned)length, warmup_chunks_skip);
       return;
     }
     ha_client_stream_audio(audio_data, length, current_pipeline_handler);
@@ -574,6 +671,10 @@ static void stt_text_handler(const char *text, const char *conversation_id) {
     return;
   }
 
+  stage_done(METRIC_HIST_STAGE_STT, &stage_speech_end_us);
+  stage_stt_us = esp_timer_get_time();
+  flight_recorder_log(FR_EV_PIPE_STT, (uint32_t)strlen(text), 0);
+
   strncpy(last_stt_text, text, sizeof(last_stt_text) - 1);
   last_stt_text[sizeof(last_stt_text) - 1] = '\0';
   oled_status_set_last_event("stt");
@@ -612,10 +713,18 @@ static esp_err_t start_audio_streaming(uint32_t max_recording_ms,
   is_pipeline_active = true;
   oled_status_set_va_state(OLED_VA_LISTENING);
   warmup_chunks_skip = 2;
-  return audio_capture_start(audio_capture_handler);
+  esp_err_t err = audio_capture_start(audio_capture_handler);
+  if (err == ESP_OK) {
+    stage_done(METRIC_HIST_STAGE_WAKE, &stage_wake_us);
+  }
+  flight_recorder_log(FR_EV_PIPE_STREAM, err == ESP_OK,
+                      current_pipeline_handler != NULL);
+  return err;
 }
 
 static void on_tts_complete(void) {
+  stage_done(METRIC_HIST_STAGE_TTS_PLAY, &stage_tts_us);
+  flight_recorder_log(FR_EV_PIPE_TTS_DONE, 0, 0);
   tts_stream_active = false;
   ha_response_timeout_stop();
   oled_status_set_tts_state(OLED_TTS_IDLE);
@@ -657,10 +766,15 @@ static void tts_audio_handler(const uint8_t *audio_data, size_t length) {
   } else {
     if (!tts_stream_active) {
       tts_stream_active = true;
+      stage_done(METRIC_HIST_STAGE_TTS_FIRST, &stage_intent_us);
+      stage_done(METRIC_HIST_STAGE_RESPONSE, &stage_response_us);
+      stage_tts_us = esp_timer_get_time();
+      flight_recorder_log(FR_EV_PIPE_TTS_START, (uint32_t)length, 0);
       oled_status_set_tts_state(OLED_TTS_DOWNLOADING);
       oled_status_set_last_event("tts-start");
       oled_status_set_va_state(OLED_VA_SPEAKING);
     }
+    BLOGD(TAG, "TTS audio: %u bytes to the player", (unsigned)length);
     tts_player_feed(audio_data, length);
   }
 }
@@ -734,11 +848,13 @@ static void ha_pipeline_error_handler(const char *error_code,
                                       const char *error_message) {
   ESP_LOGE(TAG, "HA pipeline error: %s: %s", error_code ? error_code : "?",
            error_message ? error_message : "?");
+  metrics_inc(METRIC_PIPELINE_ERRORS);
+  flight_recorder_log(FR_EV_PIPE_ERROR, 0, 0);
   ha_response_timeout_stop();
 
   // Cleanup pipeline handler to prevent memory leak
   if (current_pipeline_handler) {
-    free(current_pipeline_handler);
+    TRACE_FREE(current_pipeline_handler);
     current_pipeline_handler = NULL;
   }
   is_pipeline_active = false;
@@ -761,10 +877,12 @@ static void ha_response_timeout_cb(TimerHandle_t timer) {
     return;
   ha_response_waiting = false;
   ESP_LOGW(TAG, "HA response timeout");
+  metrics_inc(METRIC_PIPELINE_ERRORS);
+  flight_recorder_log(FR_EV_PIPE_TIMEOUT, 0, 0);
 
   // Cleanup pipeline handler to prevent memory leak
   if (current_pipeline_handler) {
-    free(current_pipeline_handler);
+    TRACE_FREE(current_pipeline_handler);
     current_pipeline_handler = NULL;
   }
   is_pipeline_active = false;
@@ -781,9 +899,12 @@ static void ha_response_timeout_cb(TimerHandle_t timer) {
 static void ha_response_timeout_start(void) {
   if (!ha_response_timeout_timer)
     return;
+  uint32_t timeout_ms =
+      ha_client_timeout_ms(HA_RESPONSE_WORK_MS, HA_RESPONSE_ROUND_TRIPS);
   ha_response_waiting = true;
   xTimerStop(ha_response_timeout_timer, 0);
-  xTimerStart(ha_response_timeout_timer, 0);
+  // Also starts it
+  xTimerChangePeriod(ha_response_timeout_timer, pdMS_TO_TICKS(timeout_ms), 0);
 }
 
 static void ha_response_timeout_stop(void) {
@@ -802,6 +923,9 @@ static void intent_handler(const char *intent_name, const char *intent_data,
   }
 
   ESP_LOGI(TAG, "HA intent: %s", intent_name);
+  stage_done(METRIC_HIST_STAGE_INTENT, &stage_stt_us);
+  stage_intent_us = esp_timer_get_time();
+  flight_recorder_log(FR_EV_PIPE_INTENT, 0, 0);
   oled_status_set_last_event("intent-end");
 
   if (strstr(intent_name, "Timer") || strstr(intent_name, "timer")) {
@@ -1357,9 +1481,10 @@ static int ascii_tolower_int(int c) {
   return c;
 }
 
-static void restart_task(void *arg) {
+static esp_err_t restart_work(void *arg) {
   vTaskDelay(pdMS_TO_TICKS(2000));
   esp_restart();
+  return ESP_OK;
 }
 
 // =============================================================================
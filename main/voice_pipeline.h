@@ -20,6 +20,15 @@ typedef enum {
     VOICE_EVENT_ERROR
 } voice_pipeline_event_t;
 
+// Compiled defaults; persisted values from settings_manager override them
+#define VOICE_PIPELINE_DEFAULT_WWD_THRESHOLD 0.5f
+#define VOICE_PIPELINE_DEFAULT_VAD_THRESHOLD 180
+#define VOICE_PIPELINE_DEFAULT_VAD_SILENCE_MS 1800
+#define VOICE_PIPELINE_DEFAULT_VAD_MIN_SPEECH_MS 200
+#define VOICE_PIPELINE_DEFAULT_VAD_MAX_RECORDING_MS 7000
+#define VOICE_PIPELINE_DEFAULT_AGC_ENABLED true
+#define VOICE_PIPELINE_DEFAULT_AGC_TARGET 4000
+
 // Configuration structure
 typedef struct {
     float wwd_threshold;
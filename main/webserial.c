@@ -12,6 +12,15 @@
 #include "network_manager.h"
 #include "ota_update.h"
 #include "led_status.h"
+#include "log_ring.h"
+#include "log_stream.h"
+#include "metrics.h"
+#include "task_profiler.h"
+#include "flight_recorder.h"
+#include "sys_diag.h"
+#include "blog.h"
+#include "alloc_trace.h"
+#include "mem_budget.h"
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_http_server.h"
@@ -19,7 +28,9 @@
 #include "esp_system.h"
 #include <inttypes.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "lwip/sockets.h"
 #include <stdlib.h>
 #include <strings.h>
 #include <string.h>
@@ -29,15 +40,35 @@ static const char *TAG = "webserial";
 static httpd_handle_t server = NULL;
 static bool server_running = false;
 
-#define LOG_BUFFER_SIZE 8192
-static char log_buffer[LOG_BUFFER_SIZE];
-static size_t log_buffer_pos = 0;
-static uint32_t log_seq = 0;
-static uint32_t log_base_seq = 0;
-static SemaphoreHandle_t log_mutex = NULL;
+#define LOG_CHUNK_SIZE 1024 // Per-request copy-out buffer (lives on httpd stack)
 static vprintf_like_t original_log_func = NULL;
 static int client_count = 0;
 
+// SSE log streaming (/webserial/stream)
+#define LOG_STREAM_MAX_CLIENTS 2 // Each holds one of the server's 4 sockets
+#define LOG_STREAM_POLL_MS 250        // Upper bound if a wakeup is missed
+#define LOG_STREAM_SEND_TIMEOUT_MS 200 // Slower clients get dropped
+#define LOG_STREAM_KEEPALIVE_MS 15000
+#define LOG_STREAM_TASK_STACK 4096
+// Stop waits out one send timeout per client plus a poll
+#define LOG_STREAM_STOP_WAIT_MS \
+    (LOG_STREAM_MAX_CLIENTS * LOG_STREAM_SEND_TIMEOUT_MS + 2 * LOG_STREAM_POLL_MS)
+
+typedef struct {
+    httpd_req_t *req;     // Detached (async) request, NULL if slot free
+    log_stream_pos_t pos; // Per-client position in the log ring
+} log_stream_client_t;
+
+static log_stream_client_t stream_clients[LOG_STREAM_MAX_CLIENTS];
+static portMUX_TYPE stream_mux = portMUX_INITIALIZER_UNLOCKED;
+static volatile int stream_client_count = 0;
+// Created once and never deleted (parked while the server is stopped), so
+// producers can notify it without a lock
+static TaskHandle_t stream_task_handle = NULL;
+static volatile bool stream_stop = false;
+static bool stream_active = false; // Taking clients; under stream_mux
+static SemaphoreHandle_t stream_done = NULL; // Given by the task as it exits
+
 // Enhanced HTML for better control
 static const char *dashboard_html = 
     "<html><head><title>ESP32-P4 Control</title>"
@@ -69,20 +100,33 @@ static const char *webserial_html =
     "<script>"
     "const logEl=document.getElementById('c');"
     "let lastSeq=0;"
+    "let es=null,pollTimer=null;"
+    "function add(t,reset){"
+    "if(reset){logEl.innerText=t;}else{logEl.innerText+=t;}"
+    "if(logEl.innerText.length>20000){logEl.innerText=logEl.innerText.slice(-20000);}"
+    "logEl.scrollTop=logEl.scrollHeight;"
+    "}"
     "function poll(){"
     "fetch('/webserial/logs?since='+lastSeq,{cache:'no-store'}).then(r=>{"
     "const reset=r.headers.get('X-Log-Reset')==='1';"
     "const seq=parseInt(r.headers.get('X-Log-Seq')||'0');"
     "return r.text().then(t=>{"
-    "if(reset){logEl.innerText=t;}else{logEl.innerText+=t;}"
-    "if(logEl.innerText.length>20000){logEl.innerText=logEl.innerText.slice(-20000);}"
-    "logEl.scrollTop=logEl.scrollHeight;"
+    "add(t,reset);"
     "if(seq>0){lastSeq=seq;}"
     "});"
     "});"
     "}"
+    "function startPoll(){if(!pollTimer){poll();pollTimer=setInterval(poll,1000);}}"
+    "function stream(){"
+    "if(!window.EventSource){startPoll();return;}"
+    "es=new EventSource('/webserial/stream?since='+lastSeq);"
+    "es.onopen=()=>{if(pollTimer){clearInterval(pollTimer);pollTimer=null;}};"
+    "es.onmessage=e=>{add(e.data+'\\n',false);const s=parseInt(e.lastEventId);if(s>0){lastSeq=s;}};"
+    "es.addEventListener('reset',()=>add('',true));"
+    "es.onerror=()=>{es.close();startPoll();setTimeout(stream,5000);};"
+    "}"
     "function clearLogs(){fetch('/webserial/clear').then(()=>{logEl.innerText='';lastSeq=0;});}"
-    "poll();setInterval(poll,1000);"
+    "stream();"
     "</script></body></html>";
 
 static int webserial_log_func(const char *fmt, va_list args) {
@@ -98,25 +142,11 @@ static int webserial_log_func(const char *fmt, va_list args) {
     if (len > 0) {
         if (len >= (int)sizeof(message)) {
             len = sizeof(message) - 1;
-            message[len] = '\0';
         }
-        if (log_mutex && xSemaphoreTake(log_mutex, 0)) {
-            if (log_buffer_pos + len >= LOG_BUFFER_SIZE) {
-                size_t overflow = log_buffer_pos + len - (LOG_BUFFER_SIZE - 1);
-                if (overflow > log_buffer_pos) {
-                    overflow = log_buffer_pos;
-                }
-                if (overflow > 0 && overflow < log_buffer_pos) {
-                    memmove(log_buffer, log_buffer + overflow, log_buffer_pos - overflow);
-                }
-                log_buffer_pos -= overflow;
-                log_base_seq += (uint32_t)overflow;
-            }
-            memcpy(log_buffer + log_buffer_pos, message, len);
-            log_buffer_pos += (size_t)len;
-            log_buffer[log_buffer_pos] = '\0';
-            log_seq += (uint32_t)len;
-            xSemaphoreGive(log_mutex);
+        // Wait-free: never blocks the logging task, never drops on contention
+        log_ring_write(message, (size_t)len);
+        if (stream_client_count > 0 && stream_task_handle) {
+            xTaskNotifyGive(stream_task_handle);
         }
     }
     return ret;
@@ -136,51 +166,17 @@ static esp_err_t logs_handler(httpd_req_t *req) {
         }
     }
 
-    char *payload = NULL;
-    size_t payload_len = 0;
     bool reset = false;
-    uint32_t seq = 0;
-    uint32_t base = 0;
-
-    if (log_mutex && xSemaphoreTake(log_mutex, portMAX_DELAY)) {
-        seq = log_seq;
-        base = log_base_seq;
-
-        if (!have_since) {
-            payload_len = log_buffer_pos;
-            payload = (char *)malloc(payload_len + 1);
-            if (payload) {
-                memcpy(payload, log_buffer, payload_len);
-                payload[payload_len] = '\0';
-            }
-        } else {
-            if (since < base) {
-                reset = true;
-                payload_len = log_buffer_pos;
-                payload = (char *)malloc(payload_len + 1);
-                if (payload) {
-                    memcpy(payload, log_buffer, payload_len);
-                    payload[payload_len] = '\0';
-                }
-            } else if (since <= seq) {
-                size_t offset = (size_t)(since - base);
-                if (offset > log_buffer_pos) {
-                    offset = log_buffer_pos;
-                }
-                payload_len = log_buffer_pos - offset;
-                payload = (char *)malloc(payload_len + 1);
-                if (payload) {
-                    memcpy(payload, log_buffer + offset, payload_len);
-                    payload[payload_len] = '\0';
-                }
-            }
-        }
-        xSemaphoreGive(log_mutex);
+    uint32_t cursor = log_ring_sync(have_since ? since : 0, &reset);
+    if (!have_since) {
+        reset = false; // First poll: full buffer, nothing to reset
     }
+    uint32_t base = log_ring_oldest();
+    uint32_t end = log_ring_readable_end(cursor);
 
     httpd_resp_set_type(req, "text/plain");
     char header[16];
-    snprintf(header, sizeof(header), "%" PRIu32, seq);
+    snprintf(header, sizeof(header), "%" PRIu32, end);
     httpd_resp_set_hdr(req, "X-Log-Seq", header);
     snprintf(header, sizeof(header), "%" PRIu32, base);
     httpd_resp_set_hdr(req, "X-Log-Base", header);
@@ -188,22 +184,197 @@ static esp_err_t logs_handler(httpd_req_t *req) {
         httpd_resp_set_hdr(req, "X-Log-Reset", "1");
     }
 
-    if (payload) {
-        httpd_resp_send(req, payload, payload_len);
-        free(payload);
-    } else {
-        httpd_resp_send(req, "", 0);
+    // Copy straight out of the ring in chunks - writers are never held off
+    char chunk[LOG_CHUNK_SIZE];
+    size_t n;
+    while ((n = log_stream_read_text(&cursor, end, chunk, sizeof(chunk))) > 0) {
+        if (httpd_resp_send_chunk(req, chunk, n) != ESP_OK) {
+            return ESP_FAIL;
+        }
     }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/**
+ * Raw binary records for help_scripts/blog_decode.py: repeated
+ * [u16 length (LE)][record]. Text lines are skipped.
+ */
+static esp_err_t blog_handler(httpd_req_t *req) {
+    char query[64] = {0};
+    char since_str[16] = {0};
+    uint32_t since = 0;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "since", since_str, sizeof(since_str)) == ESP_OK) {
+        since = (uint32_t)strtoul(since_str, NULL, 10);
+    }
+
+    bool reset = false;
+    uint32_t cursor = log_ring_sync(since, &reset);
+    uint32_t end = log_ring_readable_end(cursor);
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    char header[16];
+    snprintf(header, sizeof(header), "%" PRIu32, end);
+    httpd_resp_set_hdr(req, "X-Log-Seq", header);
+    if (reset && since != 0) {
+        httpd_resp_set_hdr(req, "X-Log-Reset", "1");
+    }
+
+    uint8_t rec[2 + LOG_RING_MAX_PAYLOAD];
+    size_t n;
+    while ((n = log_ring_read_record(&cursor, end, rec + 2, LOG_RING_MAX_PAYLOAD)) > 0) {
+        if (!blog_is_record(rec + 2, n)) {
+            continue;
+        }
+        rec[0] = (uint8_t)(n & 0xFF);
+        rec[1] = (uint8_t)(n >> 8);
+        if (httpd_resp_send_chunk(req, (const char *)rec, n + 2) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static void stream_drop_client(int slot, const char *why) {
+    httpd_req_t *req;
+    portENTER_CRITICAL(&stream_mux);
+    req = stream_clients[slot].req;
+    stream_clients[slot].req = NULL;
+    stream_client_count--;
+    portEXIT_CRITICAL(&stream_mux);
+
+    if (req) {
+        httpd_sess_trigger_close(server, httpd_req_to_sockfd(req));
+        httpd_req_async_handler_complete(req);
+    }
+    ESP_LOGI(TAG, "Log stream client %d dropped (%s)", slot, why);
+}
+
+static esp_err_t stream_send(void *ctx, const char *data, size_t len) {
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, data, len);
+}
+
+static void log_stream_task(void *arg) {
+    while (1) {
+        TickType_t last_keepalive = xTaskGetTickCount();
+        portENTER_CRITICAL(&stream_mux);
+        stream_active = true;
+        portEXIT_CRITICAL(&stream_mux);
+
+        while (!stream_stop) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOG_STREAM_POLL_MS));
+
+            bool keepalive = (xTaskGetTickCount() - last_keepalive) >=
+                             pdMS_TO_TICKS(LOG_STREAM_KEEPALIVE_MS);
+            if (keepalive) {
+                last_keepalive = xTaskGetTickCount();
+            }
+
+            for (int i = 0; i < LOG_STREAM_MAX_CLIENTS; i++) {
+                if (stream_clients[i].req == NULL) {
+                    continue;
+                }
+                if (!log_stream_service(&stream_clients[i].pos, keepalive, stream_send,
+                                        stream_clients[i].req)) {
+                    stream_drop_client(i, "slow or disconnected");
+                }
+            }
+        }
+
+        // Turns new viewers away; only this task touches the clients, so it
+        // also lets them go
+        portENTER_CRITICAL(&stream_mux);
+        stream_active = false;
+        portEXIT_CRITICAL(&stream_mux);
+        for (int i = 0; i < LOG_STREAM_MAX_CLIENTS; i++) {
+            if (stream_clients[i].req) {
+                stream_drop_client(i, "server stopping");
+            }
+        }
+        xSemaphoreGive(stream_done);
+
+        // Parked rather than deleted: a log line racing the shutdown may
+        // still notify this handle
+        while (stream_stop) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
+static esp_err_t stream_handler(httpd_req_t *req) {
+    client_count++;
+    char query[64] = {0};
+    char value[16] = {0};
+    uint32_t since = 0;
+
+    // EventSource resends the last id on its own reconnects
+    if (httpd_req_get_hdr_value_str(req, "Last-Event-ID", value, sizeof(value)) == ESP_OK) {
+        since = (uint32_t)strtoul(value, NULL, 10);
+    } else if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+               httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK) {
+        since = (uint32_t)strtoul(value, NULL, 10);
+    }
+
+    int slot = -1;
+    portENTER_CRITICAL(&stream_mux);
+    for (int i = 0; i < LOG_STREAM_MAX_CLIENTS; i++) {
+        if (stream_clients[i].req == NULL) {
+            slot = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&stream_mux);
+
+    if (slot < 0 || !stream_active) {
+        // Page falls back to polling /webserial/logs
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, "busy", 4);
+    }
+
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    if (httpd_resp_send_chunk(req, "retry: 3000\n\n", 13) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    httpd_req_t *async_req = NULL;
+    if (httpd_req_async_handler_begin(req, &async_req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    // Bound how long one slow viewer can hold up the others
+    struct timeval tv = {
+        .tv_sec = 0,
+        .tv_usec = LOG_STREAM_SEND_TIMEOUT_MS * 1000,
+    };
+    setsockopt(httpd_req_to_sockfd(async_req), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    log_stream_pos_t pos;
+    log_stream_open(&pos, since);
+
+    // Checked again with the slot taken: the task may have stopped since
+    bool active;
+    portENTER_CRITICAL(&stream_mux);
+    active = stream_active;
+    if (active) {
+        stream_clients[slot].pos = pos;
+        stream_clients[slot].req = async_req;
+        stream_client_count++;
+    }
+    portEXIT_CRITICAL(&stream_mux);
+    if (!active) {
+        httpd_req_async_handler_complete(async_req);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Log stream client %d connected (since=%" PRIu32 ")", slot, pos.cursor);
+    xTaskNotifyGive(stream_task_handle);
     return ESP_OK;
 }
 
 static esp_err_t clear_handler(httpd_req_t *req) {
-    if (log_mutex && xSemaphoreTake(log_mutex, portMAX_DELAY)) {
-        log_buffer_pos = 0;
-        log_buffer[0] = 0;
-        log_base_seq = log_seq;
-        xSemaphoreGive(log_mutex);
-    }
+    log_ring_clear();
     httpd_resp_send(req, "OK", 2);
     return ESP_OK;
 }
@@ -248,6 +419,107 @@ static esp_err_t api_status_handler(httpd_req_t *req) {
     return httpd_resp_send(req, json, strlen(json));
 }
 
+static esp_err_t metrics_sink(void *ctx, const char *data, size_t len) {
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, data, len);
+}
+
+static esp_err_t metrics_handler(httpd_req_t *req) {
+    char buf[LOG_CHUNK_SIZE];
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    esp_err_t err = metrics_render(buf, sizeof(buf), metrics_sink, req);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t api_tasks_handler(httpd_req_t *req) {
+    static task_profile_t tasks[TASK_PROFILER_MAX_TASKS]; // httpd runs one handler at a time
+    task_profile_summary_t sum;
+    size_t n = task_profiler_get(tasks, TASK_PROFILER_MAX_TASKS, &sum);
+    char buf[256];
+    int len;
+
+    httpd_resp_set_type(req, "application/json");
+    len = snprintf(buf, sizeof(buf),
+                   "{\"period_ms\":%lu,\"samples\":%lu,\"low_stack\":%u,"
+                   "\"tasks_total\":%u,\"tasks_listed\":%u,\"truncated\":%lu,\"cores\":[",
+                   (unsigned long)sum.period_ms, (unsigned long)sum.samples,
+                   (unsigned)sum.low_stack_count, (unsigned)sum.tasks_total,
+                   (unsigned)sum.tasks_listed, (unsigned long)sum.truncated);
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%u.%u", c ? "," : "",
+                        sum.core_load_permille[c] / 10, sum.core_load_permille[c] % 10);
+    }
+    len += snprintf(buf + len, sizeof(buf) - len, "],\"tasks\":[");
+    if (httpd_resp_send_chunk(req, buf, len) != ESP_OK) return ESP_FAIL;
+
+    for (size_t i = 0; i < n; i++) {
+        const task_profile_t *t = &tasks[i];
+        len = snprintf(buf, sizeof(buf),
+                       "%s{\"name\":\"%s\",\"core\":%d,\"prio\":%u,\"cpu\":%u.%u,"
+                       "\"stack_free\":%lu,\"stack_free_min\":%lu,\"low_stack\":%s}",
+                       i ? "," : "", t->name, t->core, t->priority,
+                       t->cpu_permille / 10, t->cpu_permille % 10,
+                       (unsigned long)t->stack_free, (unsigned long)t->stack_free_min,
+                       t->low_stack ? "true" : "false");
+        if (httpd_resp_send_chunk(req, buf, len) != ESP_OK) return ESP_FAIL;
+    }
+    if (httpd_resp_send_chunk(req, "]}", 2) != ESP_OK) return ESP_FAIL;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t api_flight_handler(httpd_req_t *req) {
+    // httpd runs one handler at a time
+    static fr_record_t records[FLIGHT_RECORDER_ENTRIES];
+    static fr_task_t tasks[FLIGHT_RECORDER_TASKS];
+    char query[32] = {0};
+    char boot[16] = {0};
+    char buf[192];
+    int len;
+
+    // Default is the previous boot; ?boot=current shows the live ring
+    bool previous = !(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+                      httpd_query_key_value(query, "boot", boot, sizeof(boot)) == ESP_OK &&
+                      strcmp(boot, "current") == 0);
+    fr_boot_info_t info = {0};
+    bool available = previous ? flight_recorder_previous(&info) : true;
+    size_t n = flight_recorder_read(previous, records, FLIGHT_RECORDER_ENTRIES);
+    size_t nt = flight_recorder_read_tasks(previous, tasks, FLIGHT_RECORDER_TASKS);
+
+    httpd_resp_set_type(req, "application/json");
+    len = snprintf(buf, sizeof(buf),
+                   "{\"boot\":\"%s\",\"available\":%s,\"reset_reason\":\"%s\","
+                   "\"uptime_ms\":%lu,\"events\":[",
+                   previous ? "previous" : "current", available ? "true" : "false",
+                   previous ? sys_diag_get_reset_reason() : "",
+                   (unsigned long)(previous ? info.uptime_ms
+                                            : (uint32_t)(esp_timer_get_time() / 1000)));
+    if (httpd_resp_send_chunk(req, buf, len) != ESP_OK) return ESP_FAIL;
+
+    for (size_t i = 0; i < n; i++) {
+        const fr_record_t *r = &records[i];
+        len = snprintf(buf, sizeof(buf), "%s{\"t\":%lu,\"ev\":\"%s\",\"a\":%lu,\"b\":%u}",
+                       i ? "," : "", (unsigned long)r->ts_ms,
+                       flight_recorder_event_name(r->event), (unsigned long)r->a,
+                       (unsigned)r->b);
+        if (httpd_resp_send_chunk(req, buf, len) != ESP_OK) return ESP_FAIL;
+    }
+    if (httpd_resp_send_chunk(req, "],\"tasks\":[", 11) != ESP_OK) return ESP_FAIL;
+    for (size_t i = 0; i < nt; i++) {
+        const fr_task_t *t = &tasks[i];
+        len = snprintf(buf, sizeof(buf),
+                       "%s{\"name\":\"%.16s\",\"state\":\"%c\",\"core\":%d,"
+                       "\"cpu\":%u.%u,\"stack_free\":%lu}",
+                       i ? "," : "", t->name, t->state ? t->state : '?', t->core,
+                       t->cpu_permille / 10, t->cpu_permille % 10,
+                       (unsigned long)t->stack_free);
+        if (httpd_resp_send_chunk(req, buf, len) != ESP_OK) return ESP_FAIL;
+    }
+    if (httpd_resp_send_chunk(req, "]}", 2) != ESP_OK) return ESP_FAIL;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 static esp_err_t api_action_handler(httpd_req_t *req) {
     char body[128];
     if (recv_body(req, body, sizeof(body)) == ESP_OK) {
@@ -257,6 +529,14 @@ static esp_err_t api_action_handler(httpd_req_t *req) {
             else if (strcmp(cmd, "wwd_resume") == 0) voice_pipeline_start();
             else if (strcmp(cmd, "wwd_stop") == 0) voice_pipeline_stop();
             else if (strcmp(cmd, "led_test") == 0) led_status_test_pattern();
+            else if (strcmp(cmd, "blog_bench") == 0) blog_benchmark(32);
+            else if (strcmp(cmd, "blog_debug_on") == 0) blog_set_level(ESP_LOG_DEBUG);
+            else if (strcmp(cmd, "blog_debug_off") == 0) blog_set_level(ESP_LOG_INFO);
+            else if (strcmp(cmd, "blog_uart_on") == 0) blog_set_uart(true);
+            else if (strcmp(cmd, "blog_uart_off") == 0) blog_set_uart(false);
+            else if (strcmp(cmd, "alloc_dump") == 0) alloc_trace_dump(0);
+            else if (strcmp(cmd, "alloc_reset") == 0) alloc_trace_reset();
+            else if (strcmp(cmd, "mem_budget") == 0) mem_budget_report();
         }
     }
     httpd_resp_set_type(req, "application/json");
@@ -299,11 +579,13 @@ static esp_err_t webserial_page_handler(httpd_req_t *req) {
 
 esp_err_t webserial_init(void) {
     if (server_running) return ESP_OK;
-    log_mutex = xSemaphoreCreateMutex();
     
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.max_open_sockets = 5; // Increased for better stability
+    config.max_open_sockets = 4; // Two SSE log viewers plus page and API requests
+    config.lru_purge_enable = true; // Idle keep-alive sockets make room
     config.max_req_hdr_len = 8192;
+    config.stack_size = 6144; // Log handlers copy records out on the stack
+    config.max_uri_handlers = 16;
     
     if (httpd_start(&server, &config) == ESP_OK) {
         httpd_uri_t uris[] = {
@@ -312,13 +594,32 @@ esp_err_t webserial_init(void) {
             {"/api/action", HTTP_POST, api_action_handler, NULL},
             {"/api/config", HTTP_POST, api_config_handler, NULL},
             {"/api/ota", HTTP_POST, api_ota_handler, NULL},
+            {"/api/tasks", HTTP_GET, api_tasks_handler, NULL},
+            {"/api/flight", HTTP_GET, api_flight_handler, NULL},
+            {"/metrics", HTTP_GET, metrics_handler, NULL},
             {"/webserial", HTTP_GET, webserial_page_handler, NULL},
             {"/webserial/logs", HTTP_GET, logs_handler, NULL},
+            {"/webserial/stream", HTTP_GET, stream_handler, NULL},
+            {"/webserial/blog", HTTP_GET, blog_handler, NULL},
             {"/webserial/clear", HTTP_GET, clear_handler, NULL}
         };
         for (int i=0; i<sizeof(uris)/sizeof(uris[0]); i++) {
             httpd_register_uri_handler(server, &uris[i]);
         }
+        stream_stop = false;
+        if (stream_done == NULL) {
+            stream_done = xSemaphoreCreateBinary();
+        } else {
+            xSemaphoreTake(stream_done, 0); // From a stop that timed out
+        }
+        if (stream_task_handle != NULL) {
+            xTaskNotifyGive(stream_task_handle); // Unpark it
+        } else if (stream_done != NULL &&
+                   xTaskCreate(log_stream_task, "log_stream", LOG_STREAM_TASK_STACK, NULL, 2,
+                               &stream_task_handle) != pdPASS) {
+            ESP_LOGW(TAG, "Log stream task not started - /webserial/stream disabled");
+            stream_task_handle = NULL;
+        }
         original_log_func = esp_log_set_vprintf(webserial_log_func);
         server_running = true;
         ESP_LOGI(TAG, "Web Dashboard with OTA Support Started");
@@ -330,12 +631,31 @@ esp_err_t webserial_init(void) {
 esp_err_t webserial_deinit(void) {
     if (server_running) {
         if (original_log_func) esp_log_set_vprintf(original_log_func);
+        if (stream_task_handle) {
+            // Wait until it let its clients go: stopping it mid-send would
+            // leave a request the server is about to free half-sent
+            stream_stop = true;
+            xTaskNotifyGive(stream_task_handle);
+            if (xSemaphoreTake(stream_done, pdMS_TO_TICKS(LOG_STREAM_STOP_WAIT_MS)) != pdTRUE) {
+                ESP_LOGW(TAG, "Log stream task did not stop");
+            }
+        }
         httpd_stop(server);
-        vSemaphoreDelete(log_mutex);
         server_running = false;
     }
     return ESP_OK;
 }
 
+esp_err_t webserial_broadcast(const char *message, size_t length) {
+    if (message == NULL || length == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    log_ring_write(message, length);
+    if (stream_task_handle) {
+        xTaskNotifyGive(stream_task_handle);
+    }
+    return ESP_OK;
+}
+
 bool webserial_is_running(void) { return server_running; }
 int webserial_get_client_count(void) { return client_count; }
@@ -0,0 +1,335 @@
+/**
+ * @file work_queue.c
+ * @brief Shared executor for short commands (music, restart, reconnects)
+ */
+
+#include "work_queue.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include <stdio.h>
+
+static const char *TAG = "work_queue";
+
+#define MAX_WORKERS 5
+#define SLOT_BITS 8
+#define SLOT_MASK ((1u << SLOT_BITS) - 1)
+#define GEN_MAX (UINT32_MAX >> SLOT_BITS)
+
+typedef struct {
+  const char *name;
+  UBaseType_t priority;
+  uint8_t workers;
+  uint32_t stack_size; ///< Bytes
+  bool internal_stack;  ///< Internal RAM instead of PSRAM
+} lane_cfg_t;
+
+// Stacks match the tasks these lanes replace (ha_reconnect 6144, music 4096,
+// TTS download on the 8192 websocket task). Control items restart the
+// device, and esp_restart() runs the settings flush (NVS writes, cache
+// disabled) on the caller's stack, so that lane's stack is internal.
+static const lane_cfg_t lane_cfg[WORK_LANE_COUNT] = {
+    [WORK_LANE_CONTROL] = {"work_ctl", 5, 1, 6144, true},
+    [WORK_LANE_NETWORK] = {"work_net", 4, 2, 6144, false},
+    [WORK_LANE_BACKGROUND] = {"work_bg", 2, 1, 3072, false},
+    [WORK_LANE_MEDIA] = {"work_media", 5, 1, 8192, false},
+};
+
+typedef enum {
+  ITEM_FREE,
+  ITEM_QUEUED,
+  ITEM_RUNNING,
+  ITEM_DONE,
+} item_state_t;
+
+typedef struct {
+  work_fn_t fn;
+  void *arg;
+  const char *name;
+  int64_t submit_us;
+  uint32_t gen;
+  item_state_t state;
+  uint8_t refs; ///< Worker until done, plus the handle owner if any
+  bool cancel;
+  esp_err_t result;
+} work_item_t;
+
+typedef struct {
+  TaskHandle_t task;
+  work_lane_t lane;
+  int slot; ///< Item being run, -1 when idle
+} worker_t;
+
+static work_item_t items[WORK_QUEUE_MAX_ITEMS];
+static worker_t workers[MAX_WORKERS];
+static int worker_count = 0;
+static QueueHandle_t lanes[WORK_LANE_COUNT];
+static EventGroupHandle_t done_bits = NULL; // Bit per slot, set when done
+static uint32_t next_gen = 1;
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Callers hold mux
+static work_item_t *lookup(work_handle_t h) {
+  uint32_t slot = h & SLOT_MASK;
+  if (h == WORK_HANDLE_NONE || slot >= WORK_QUEUE_MAX_ITEMS) {
+    return NULL;
+  }
+  work_item_t *it = &items[slot];
+  return (it->state != ITEM_FREE && it->gen == (h >> SLOT_BITS)) ? it : NULL;
+}
+
+// Callers hold mux
+static void put(work_item_t *it) {
+  if (it->refs > 0 && --it->refs == 0) {
+    it->state = ITEM_FREE;
+  }
+}
+
+// Callers hold mux; returns the slot or -1
+static int reserve(work_fn_t fn, void *arg, const char *name, bool owned) {
+  for (int i = 0; i < WORK_QUEUE_MAX_ITEMS; i++) {
+    work_item_t *it = &items[i];
+    if (it->state != ITEM_FREE) {
+      continue;
+    }
+    it->fn = fn;
+    it->arg = arg;
+    it->name = name;
+    it->submit_us = esp_timer_get_time();
+    it->gen = next_gen;
+    next_gen = next_gen >= GEN_MAX ? 1 : next_gen + 1;
+    it->state = ITEM_QUEUED;
+    it->refs = owned ? 2 : 1;
+    it->cancel = false;
+    it->result = ESP_OK;
+    return i;
+  }
+  return -1;
+}
+
+static work_handle_t handle_of(int slot) {
+  return (items[slot].gen << SLOT_BITS) | (uint32_t)slot;
+}
+
+static esp_err_t enqueue(work_lane_t lane, int slot) {
+  uint8_t s = (uint8_t)slot;
+  // A stale bit from the slot's previous item; work_wait() re-checks state
+  xEventGroupClearBits(done_bits, BIT(slot));
+  // Each slot is in at most one queue and every queue holds all of them
+  xQueueSend(lanes[lane], &s, 0);
+  return ESP_OK;
+}
+
+static void worker_task(void *arg) {
+  worker_t *w = (worker_t *)arg;
+  uint8_t slot;
+
+  for (;;) {
+    if (xQueueReceive(lanes[w->lane], &slot, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    work_item_t *it = &items[slot];
+
+    portENTER_CRITICAL(&mux);
+    bool skip = it->cancel;
+    it->state = ITEM_RUNNING;
+    w->slot = slot;
+    portEXIT_CRITICAL(&mux);
+
+    int64_t start = esp_timer_get_time();
+    metrics_observe(METRIC_HIST_WORK_DISPATCH,
+                    (uint32_t)(start - it->submit_us));
+    esp_err_t res = ESP_ERR_INVALID_STATE;
+    if (skip) {
+      ESP_LOGD(TAG, "%s cancelled before start", it->name);
+    } else {
+      res = it->fn(it->arg);
+    }
+
+    portENTER_CRITICAL(&mux);
+    it->result = res;
+    it->state = ITEM_DONE;
+    w->slot = -1;
+    put(it);
+    portEXIT_CRITICAL(&mux);
+    xEventGroupSetBits(done_bits, BIT(slot));
+  }
+}
+
+esp_err_t work_queue_init(void) {
+  if (done_bits != NULL) {
+    return ESP_OK;
+  }
+  done_bits = xEventGroupCreate();
+  if (done_bits == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  for (int l = 0; l < WORK_LANE_COUNT; l++) {
+    lanes[l] = xQueueCreate(WORK_QUEUE_MAX_ITEMS, sizeof(uint8_t));
+    if (lanes[l] == NULL) {
+      return ESP_ERR_NO_MEM;
+    }
+    for (int n = 0; n < lane_cfg[l].workers && worker_count < MAX_WORKERS;
+         n++) {
+      worker_t *w = &workers[worker_count];
+      char name[16];
+      snprintf(name, sizeof(name), "%s%d", lane_cfg[l].name, n);
+      w->lane = (work_lane_t)l;
+      w->slot = -1;
+      uint32_t caps = lane_cfg[l].internal_stack
+                          ? MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT
+                          : MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+      if (xTaskCreatePinnedToCoreWithCaps(
+              worker_task, name, lane_cfg[l].stack_size, w,
+              lane_cfg[l].priority, &w->task, tskNO_AFFINITY,
+              caps) != pdPASS) {
+        ESP_LOGE(TAG, "Worker %s create failed", name);
+        return ESP_ERR_NO_MEM;
+      }
+      worker_count++;
+    }
+  }
+  ESP_LOGI(TAG, "%d workers, %d item slots", worker_count,
+           WORK_QUEUE_MAX_ITEMS);
+  return ESP_OK;
+}
+
+esp_err_t work_submit(work_lane_t lane, const char *name, work_fn_t fn,
+                      void *arg, work_handle_t *out) {
+  if (out != NULL) {
+    *out = WORK_HANDLE_NONE;
+  }
+  if (lane >= WORK_LANE_COUNT || fn == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (done_bits == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  portENTER_CRITICAL(&mux);
+  int slot = reserve(fn, arg, name, out != NULL);
+  if (slot >= 0 && out != NULL) {
+    *out = handle_of(slot);
+  }
+  portEXIT_CRITICAL(&mux);
+
+  if (slot < 0) {
+    metrics_inc(METRIC_WORK_REJECTED);
+    ESP_LOGW(TAG, "No free item for %s", name ? name : "?");
+    return ESP_ERR_NO_MEM;
+  }
+  return enqueue(lane, slot);
+}
+
+esp_err_t work_submit_once(work_handle_t *h, work_lane_t lane,
+                           const char *name, work_fn_t fn, void *arg) {
+  if (h == NULL || lane >= WORK_LANE_COUNT || fn == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (done_bits == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  portENTER_CRITICAL(&mux);
+  work_item_t *prev = lookup(*h);
+  if (prev != NULL && (prev->state == ITEM_RUNNING ||
+                       (prev->state == ITEM_QUEUED && !prev->cancel))) {
+    portEXIT_CRITICAL(&mux);
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (prev != NULL) {
+    put(prev);
+  }
+  int slot = reserve(fn, arg, name, true);
+  *h = slot >= 0 ? handle_of(slot) : WORK_HANDLE_NONE;
+  portEXIT_CRITICAL(&mux);
+
+  if (slot < 0) {
+    metrics_inc(METRIC_WORK_REJECTED);
+    ESP_LOGW(TAG, "No free item for %s", name ? name : "?");
+    return ESP_ERR_NO_MEM;
+  }
+  return enqueue(lane, slot);
+}
+
+bool work_busy(work_handle_t h) {
+  portENTER_CRITICAL(&mux);
+  work_item_t *it = lookup(h);
+  bool busy = it != NULL && (it->state == ITEM_RUNNING ||
+                             (it->state == ITEM_QUEUED && !it->cancel));
+  portEXIT_CRITICAL(&mux);
+  return busy;
+}
+
+esp_err_t work_wait(work_handle_t h, uint32_t timeout_ms) {
+  int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+  uint32_t slot = h & SLOT_MASK;
+  bool woken = false;
+
+  for (;;) {
+    portENTER_CRITICAL(&mux);
+    work_item_t *it = lookup(h);
+    item_state_t state = it ? it->state : ITEM_FREE;
+    esp_err_t result = it ? it->result : ESP_ERR_INVALID_ARG;
+    portEXIT_CRITICAL(&mux);
+
+    if (it == NULL || state == ITEM_DONE) {
+      return result;
+    }
+    if (woken) {
+      vTaskDelay(1); // Stale bit until the submitter clears it
+    }
+    int64_t left_us = deadline - esp_timer_get_time();
+    if (left_us <= 0) {
+      return ESP_ERR_TIMEOUT;
+    }
+    EventBits_t bits =
+        xEventGroupWaitBits(done_bits, BIT(slot), pdFALSE, pdTRUE,
+                            pdMS_TO_TICKS((left_us + 999) / 1000));
+    woken = (bits & BIT(slot)) != 0;
+  }
+}
+
+esp_err_t work_cancel(work_handle_t h) {
+  esp_err_t ret = ESP_ERR_INVALID_STATE;
+
+  portENTER_CRITICAL(&mux);
+  work_item_t *it = lookup(h);
+  if (it != NULL && (it->state == ITEM_QUEUED || it->state == ITEM_RUNNING)) {
+    ret = (it->state == ITEM_QUEUED && !it->cancel) ? ESP_OK
+                                                    : ESP_ERR_INVALID_STATE;
+    it->cancel = true;
+  }
+  portEXIT_CRITICAL(&mux);
+  return ret;
+}
+
+void work_release(work_handle_t h) {
+  portENTER_CRITICAL(&mux);
+  work_item_t *it = lookup(h);
+  if (it != NULL) {
+    put(it);
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+bool work_cancelled(void) {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  bool cancel = false;
+
+  portENTER_CRITICAL(&mux);
+  for (int i = 0; i < worker_count; i++) {
+    if (workers[i].task == self && workers[i].slot >= 0) {
+      cancel = items[workers[i].slot].cancel;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&mux);
+  return cancel;
+}
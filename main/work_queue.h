@@ -0,0 +1,105 @@
+/**
+ * @file work_queue.h
+ * @brief Shared executor for short commands (music, restart, reconnects)
+ *
+ * MQTT and HA callbacks used to create a FreeRTOS task per command. Work
+ * items now go to one of a few lanes, each served by a fixed set of worker
+ * tasks created once at boot with PSRAM stacks (internal RAM for the control
+ * lane, whose items may write flash). A lane with one worker runs its items
+ * in submission order.
+ *
+ * Items come from a fixed pool; submitting never allocates. A handle is
+ * the item's future: work_wait() returns its result, work_cancel() drops it
+ * while queued or flags it while running (see work_cancelled()). A handle
+ * whose item has been recycled is no longer busy.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WORK_QUEUE_MAX_ITEMS 16
+
+typedef enum {
+  WORK_LANE_CONTROL,    ///< User commands (music, restart): one worker, FIFO,
+                        ///< internal stack (safe for NVS/flash writes)
+  WORK_LANE_NETWORK,    ///< Reconnects and post-connect work, may block for s
+  WORK_LANE_BACKGROUND, ///< Cosmetic work (LED test), lowest priority
+  WORK_LANE_MEDIA,      ///< TTS downloads: one worker, FIFO, TLS-sized stack
+  WORK_LANE_COUNT
+} work_lane_t;
+
+typedef esp_err_t (*work_fn_t)(void *arg);
+
+/** Item handle; WORK_HANDLE_NONE never refers to an item */
+typedef uint32_t work_handle_t;
+#define WORK_HANDLE_NONE 0
+
+/**
+ * @brief Create the lanes and their workers
+ *
+ * Call once early in app_main, before anything submits.
+ */
+esp_err_t work_queue_init(void);
+
+/**
+ * @brief Queue @p fn(@p arg) on @p lane
+ *
+ * @param name Static string for logs
+ * @param out If not NULL, receives a handle the caller owns until
+ *            work_release(); with NULL the item is fire-and-forget
+ * @return ESP_OK, ESP_ERR_NO_MEM if the pool is exhausted,
+ *         ESP_ERR_INVALID_STATE before work_queue_init()
+ */
+esp_err_t work_submit(work_lane_t lane, const char *name, work_fn_t fn,
+                      void *arg, work_handle_t *out);
+
+/**
+ * @brief Submit unless the item in @p *h is still queued or running
+ *
+ * For commands that must not pile up (one reconnect at a time). The check
+ * and the new submission are atomic with respect to other callers using
+ * the same @p h. The previous handle is released.
+ *
+ * @return ESP_OK if submitted, ESP_ERR_INVALID_STATE if still pending,
+ *         or a work_submit() error
+ */
+esp_err_t work_submit_once(work_handle_t *h, work_lane_t lane,
+                           const char *name, work_fn_t fn, void *arg);
+
+/** True while the item is queued or running */
+bool work_busy(work_handle_t h);
+
+/**
+ * @brief Wait for the item and return its result
+ *
+ * @return The function's result, ESP_ERR_INVALID_STATE if it was cancelled
+ *         before starting, ESP_ERR_TIMEOUT, or ESP_ERR_INVALID_ARG for an
+ *         unknown handle
+ */
+esp_err_t work_wait(work_handle_t h, uint32_t timeout_ms);
+
+/**
+ * @brief Cancel the item
+ *
+ * @return ESP_OK if it had not started and will not run, ESP_ERR_INVALID_STATE
+ *         if it is running (work_cancelled() now returns true inside it) or
+ *         already finished
+ */
+esp_err_t work_cancel(work_handle_t h);
+
+/** Drop the caller's reference; the item is recycled once it is done */
+void work_release(work_handle_t h);
+
+/** Inside a work function: true if work_cancel() was called on it */
+bool work_cancelled(void);
+
+#ifdef __cplusplus
+}
+#endif
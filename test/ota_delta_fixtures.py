@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+"""Fixtures for test_ota_delta: two related images and the patch between them.
+
+The images are synthetic but shaped like consecutive builds: long unchanged
+runs (COPY ops longer than the applier's 16 KB buffer), a moved block, small
+edits, an inserted section and a grown tail. The patch is made by
+help_scripts/ota_delta.py, the same tool used for real updates.
+
+  python test/ota_delta_fixtures.py <out_dir>
+"""
+import random
+import subprocess
+import sys
+from pathlib import Path
+
+SCRIPT = Path(__file__).resolve().parent.parent / "help_scripts" / "ota_delta.py"
+
+
+def images():
+    rnd = random.Random(20240601)
+    old = bytearray(rnd.randbytes(160 * 1024))
+    new = bytearray(old)
+    new[1000:1004] = b"\x01\x02\x03\x04"  # Edited constant
+    new[40000:40000] = rnd.randbytes(3000)  # New code
+    moved = bytes(new[90000:94096])
+    del new[90000:94096]
+    new[20000:20000] = moved  # Relinked block
+    for off in range(100000, 110000, 997):  # Scattered edits
+        new[off] ^= 0x5A
+    new += rnd.randbytes(5000)  # Grown image
+    return bytes(old), bytes(new)
+
+
+def main():
+    out = Path(sys.argv[1])
+    out.mkdir(parents=True, exist_ok=True)
+    old, new = images()
+    (out / "old.bin").write_bytes(old)
+    (out / "new.bin").write_bytes(new)
+    subprocess.run([sys.executable, str(SCRIPT), "make", str(out / "old.bin"),
+                    str(out / "new.bin"), "-o", str(out / "update.delta")],
+                   check=True)
+
+
+if __name__ == "__main__":
+    main()
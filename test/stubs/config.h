@@ -0,0 +1,26 @@
+/**
+ * @file config.h
+ * @brief Fixed stand-in for main/config.h (local secrets, not in git)
+ *
+ * A local main/config.h still wins for the sources in main/, so the tests
+ * do not depend on these values.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#define WIFI_SSID "host-ssid"
+#define WIFI_PASSWORD "host-password"
+#define WIFI_MAX_RETRY 5
+
+#define HA_HOSTNAME "homeassistant.local"
+#define HA_PORT 8123
+#define HA_TOKEN "host-token"
+#define HA_USE_SSL false
+#define HA_WEBSOCKET_PATH "/api/websocket"
+
+#define MQTT_BROKER_URI "mqtt://homeassistant.local:1883"
+#define MQTT_USERNAME NULL
+#define MQTT_PASSWORD NULL
+#define MQTT_CLIENT_ID "esp32p4_voice_assistant"
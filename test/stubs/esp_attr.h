@@ -0,0 +1,10 @@
+/**
+ * @file esp_attr.h
+ * @brief Host stand-in for the section attributes: plain zeroed statics
+ */
+
+#pragma once
+
+#define __NOINIT_ATTR
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
@@ -0,0 +1,52 @@
+/**
+ * @file esp_http_client.h
+ * @brief Host stand-in for esp_http_client: plain HTTP/1.1 GET over a
+ * blocking socket
+ *
+ * Covers the streaming calls (open, fetch_headers, read) the firmware uses.
+ * URLs must carry a numeric IPv4 address; https is not supported. Reads
+ * time out after timeout_ms with -ESP_ERR_HTTP_EAGAIN, as with the IDF
+ * client.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP_ERR_HTTP_BASE 0x7000
+#define ESP_ERR_HTTP_CONNECT (ESP_ERR_HTTP_BASE + 2)
+#define ESP_ERR_HTTP_EAGAIN (ESP_ERR_HTTP_BASE + 11)
+
+typedef struct host_http_client *esp_http_client_handle_t;
+
+typedef struct {
+  const char *url;
+  int timeout_ms;
+  bool skip_cert_common_name_check;
+} esp_http_client_config_t;
+
+esp_http_client_handle_t
+esp_http_client_init(const esp_http_client_config_t *config);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client,
+                                     const char *key, const char *value);
+esp_err_t esp_http_client_open(esp_http_client_handle_t client,
+                               int write_len);
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client);
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer,
+                         int len);
+bool esp_http_client_is_complete_data_received(
+    esp_http_client_handle_t client);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+/**
+ * @file queue.h
+ * @brief Host stand-in for FreeRTOS queues
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_queue *QueueHandle_t;
+
+/** @p item_size 0 makes a counting semaphore (see semphr.h) */
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t q);
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q);
+
+#define xQueueSendToBack(q, item, ticks) xQueueSend((q), (item), (ticks))
+
+#ifdef __cplusplus
+}
+#endif
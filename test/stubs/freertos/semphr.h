@@ -0,0 +1,30 @@
+/**
+ * @file semphr.h
+ * @brief Host stand-in for FreeRTOS semaphores (queues without payload)
+ *
+ * Mutexes are plain binary semaphores here: no priority inheritance and no
+ * owner check.
+ */
+
+#pragma once
+
+#include "freertos/queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max,
+                                           UBaseType_t initial);
+
+#define vSemaphoreDelete(s) vQueueDelete(s)
+#define xSemaphoreTake(s, ticks) xQueueReceive((s), NULL, (ticks))
+#define xSemaphoreGive(s) xQueueSend((s), NULL, 0)
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @file task.h
+ * @brief Host stand-in for FreeRTOS tasks: one detached thread per task
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define tskIDLE_PRIORITY 0
+
+typedef enum { eRunning, eReady, eBlocked, eSuspended, eDeleted } eTaskState;
+
+typedef struct {
+  TaskHandle_t xHandle;
+  const char *pcTaskName;
+  UBaseType_t xTaskNumber;
+  eTaskState eCurrentState;
+  UBaseType_t uxCurrentPriority;
+  UBaseType_t uxBasePriority;
+  uint32_t ulRunTimeCounter;
+  uint32_t usStackHighWaterMark;
+  BaseType_t xCoreID;
+} TaskStatus_t;
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *arg, UBaseType_t priority, TaskHandle_t *out);
+
+#define xTaskCreatePinnedToCore(fn, name, stack, arg, prio, out, core)         \
+  xTaskCreate((fn), (name), (stack), (arg), (prio), (out))
+#define xTaskCreatePinnedToCoreWithCaps(fn, name, stack, arg, prio, out, core, \
+                                        caps)                                  \
+  ((void)(caps), xTaskCreate((fn), (name), (stack), (arg), (prio), (out)))
+
+/** Only NULL (the calling task) is supported */
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+const char *pcTaskGetName(TaskHandle_t task);
+/** Placeholder handles, never scheduled; put them in the task list */
+TaskHandle_t xTaskGetIdleTaskHandleForCore(BaseType_t core);
+
+void xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+
+/**
+ * The task list uxTaskGetSystemState() reports is set by the test, not
+ * taken from the shim's threads: host_task_list_set() (host only)
+ */
+UBaseType_t uxTaskGetNumberOfTasks(void);
+/** Fills nothing and returns 0 if @p size is below the task count */
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *out, UBaseType_t size,
+                                 uint32_t *total_runtime);
+
+/** Tasks started and not yet returned or deleted (host only) */
+int host_tasks_running(void);
+/** Replace the list uxTaskGetSystemState() reports (copied; host only) */
+void host_task_list_set(const TaskStatus_t *tasks, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
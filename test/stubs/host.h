@@ -0,0 +1,73 @@
+/**
+ * @file host.h
+ * @brief Controls the tests have over the host shims
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Clock ---------------------------------------------------------------------
+
+/** Move esp_timer_get_time() forward (FreeRTOS ticks are not affected) */
+void host_time_advance_ms(uint32_t ms);
+
+// ESP-IDF services ----------------------------------------------------------
+
+/** heap_caps_malloc/calloc/realloc() calls so far */
+uint32_t host_heap_allocs(void);
+
+/** Run the esp_register_shutdown_handler() handlers, as esp_restart() does */
+void host_shutdown(void);
+
+/** What esp_reset_reason() reports, as if the last boot ended that way */
+void host_set_reset_reason(esp_reset_reason_t reason);
+
+/** Successful nvs_set_*() calls on @p key (any namespace) since its erase */
+uint32_t host_nvs_writes(const char *key);
+/** Successful nvs_commit() calls */
+uint32_t host_nvs_commits(void);
+/** Make nvs_set_*() and nvs_commit() return @p err; ESP_OK to stop */
+void host_nvs_fail(esp_err_t err);
+
+// lwIP resolver -------------------------------------------------------------
+
+/** Answer lookups of @p host with @p ip; NULL makes them fail */
+void host_dns_set(const char *host, const char *ip);
+/** getaddrinfo() calls for @p host so far */
+uint32_t host_dns_lookups(const char *host);
+/** Make every lookup take @p ms (0 = instant) */
+void host_dns_set_delay_ms(uint32_t ms);
+
+// Stubbed firmware modules --------------------------------------------------
+
+/** Last value set on a metric_gauge_t */
+int32_t host_metrics_gauge(int gauge);
+/** Samples recorded on a metric_hist_t */
+uint32_t host_metrics_observations(int hist);
+/** Zero every counter, gauge and histogram */
+void host_metrics_reset(void);
+
+/** sys_diag_wdt_feed() calls so far */
+uint32_t host_wdt_feeds(void);
+
+// Shim internals ------------------------------------------------------------
+
+void host_cond_init(pthread_cond_t *cond);
+struct timespec host_deadline(TickType_t ticks);
+bool host_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock,
+                    TickType_t ticks, const struct timespec *deadline);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,14 @@
+/**
+ * @file host_compat.h
+ * @brief newlib extensions the firmware uses that the host libc may lack
+ *
+ * Force-included into every host test translation unit.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifndef HAVE_STRLCPY
+size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
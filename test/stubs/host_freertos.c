@@ -0,0 +1,428 @@
+/**
+ * @file host_freertos.c
+ * @brief FreeRTOS tasks, queues, semaphores and event groups on pthreads
+ *
+ * Just enough of the kernel API for the modules under test. Blocking calls
+ * wait on a condition variable against CLOCK_MONOTONIC; priorities and
+ * core affinity are ignored.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "host.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct host_task {
+  TaskFunction_t fn;
+  void *arg;
+  char name[16];
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint32_t notify;
+};
+
+struct host_queue {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t count;
+  UBaseType_t head;
+  uint8_t *items;
+};
+
+struct host_event_group {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  EventBits_t bits;
+};
+
+static pthread_mutex_t critical;
+static pthread_once_t critical_once = PTHREAD_ONCE_INIT;
+static _Thread_local struct host_task *current = NULL;
+static atomic_int tasks_running = 0;
+#define HOST_TASK_LIST_MAX 128
+static TaskStatus_t task_list[HOST_TASK_LIST_MAX];
+static size_t task_list_count = 0;
+
+static void critical_init(void) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&critical, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+void host_critical_enter(void) {
+  pthread_once(&critical_once, critical_init);
+  pthread_mutex_lock(&critical);
+}
+
+void host_critical_exit(void) { pthread_mutex_unlock(&critical); }
+
+void host_cond_init(pthread_cond_t *cond) {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+struct timespec host_deadline(TickType_t ticks) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ts.tv_sec += ticks / 1000;
+  ts.tv_nsec += (long)(ticks % 1000) * 1000000L;
+  if (ts.tv_nsec >= 1000000000L) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000L;
+  }
+  return ts;
+}
+
+/** Wait on @p cond; false once the deadline (if any) has passed */
+bool host_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock,
+                    TickType_t ticks, const struct timespec *deadline) {
+  if (ticks == portMAX_DELAY) {
+    pthread_cond_wait(cond, lock);
+    return true;
+  }
+  return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+// ---------------------------------------------------------------------------
+// Tasks
+// ---------------------------------------------------------------------------
+
+static struct host_task *task_new(const char *name) {
+  struct host_task *t = calloc(1, sizeof(*t));
+  if (t == NULL) {
+    return NULL;
+  }
+  snprintf(t->name, sizeof(t->name), "%s", name ? name : "");
+  pthread_mutex_init(&t->lock, NULL);
+  host_cond_init(&t->cond);
+  return t;
+}
+
+static void task_free(void *arg) {
+  struct host_task *t = arg;
+  atomic_fetch_sub(&tasks_running, 1);
+  pthread_mutex_destroy(&t->lock);
+  pthread_cond_destroy(&t->cond);
+  free(t);
+}
+
+static void *task_main(void *arg) {
+  struct host_task *t = arg;
+  current = t;
+  pthread_cleanup_push(task_free, t);
+  t->fn(t->arg);
+  pthread_cleanup_pop(1);
+  return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *arg, UBaseType_t priority, TaskHandle_t *out) {
+  (void)stack;
+  (void)priority;
+  struct host_task *t = task_new(name);
+  if (t == NULL) {
+    return pdFAIL;
+  }
+  t->fn = fn;
+  t->arg = arg;
+  if (out != NULL) {
+    *out = t;
+  }
+
+  pthread_t thread;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  atomic_fetch_add(&tasks_running, 1);
+  int rc = pthread_create(&thread, &attr, task_main, t);
+  pthread_attr_destroy(&attr);
+  if (rc != 0) {
+    atomic_fetch_sub(&tasks_running, 1);
+    free(t);
+    return pdFAIL;
+  }
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  if (task != NULL && task != current) {
+    fprintf(stderr, "vTaskDelete: only self-deletion is supported\n");
+    abort();
+  }
+  pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  struct timespec ts = {ticks / 1000, (long)(ticks % 1000) * 1000000L};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+  }
+}
+
+TickType_t xTaskGetTickCount(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  if (current == NULL) {
+    // A thread the shim did not start (main): give it a handle on demand
+    current = task_new("main");
+  }
+  return current;
+}
+
+const char *pcTaskGetName(TaskHandle_t task) {
+  return (task ? task : xTaskGetCurrentTaskHandle())->name;
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+  pthread_mutex_lock(&task->lock);
+  task->notify++;
+  pthread_cond_broadcast(&task->cond);
+  pthread_mutex_unlock(&task->lock);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+  struct host_task *t = xTaskGetCurrentTaskHandle();
+  struct timespec deadline = host_deadline(ticks);
+
+  pthread_mutex_lock(&t->lock);
+  while (t->notify == 0 &&
+         host_cond_wait(&t->cond, &t->lock, ticks, &deadline)) {
+  }
+  uint32_t value = t->notify;
+  if (value > 0) {
+    t->notify = clear_on_exit ? 0 : value - 1;
+  }
+  pthread_mutex_unlock(&t->lock);
+  return value;
+}
+
+int host_tasks_running(void) { return atomic_load(&tasks_running); }
+
+void host_task_list_set(const TaskStatus_t *tasks, size_t count) {
+  if (count > HOST_TASK_LIST_MAX) {
+    fprintf(stderr, "host_task_list_set: more than %d tasks\n",
+            HOST_TASK_LIST_MAX);
+    abort();
+  }
+  host_critical_enter();
+  memcpy(task_list, tasks, count * sizeof(*tasks));
+  task_list_count = count;
+  host_critical_exit();
+}
+
+TaskHandle_t xTaskGetIdleTaskHandleForCore(BaseType_t core) {
+  static struct host_task idle[portNUM_PROCESSORS];
+  return core >= 0 && core < portNUM_PROCESSORS ? &idle[core] : NULL;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void) {
+  host_critical_enter();
+  UBaseType_t n = task_list_count;
+  host_critical_exit();
+  return n;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *out, UBaseType_t size,
+                                 uint32_t *total_runtime) {
+  UBaseType_t n = 0;
+  host_critical_enter();
+  if (size >= task_list_count) {
+    n = task_list_count;
+    memcpy(out, task_list, n * sizeof(*out));
+  }
+  host_critical_exit();
+  if (total_runtime) {
+    *total_runtime = (uint32_t)esp_timer_get_time();
+  }
+  return n;
+}
+
+// ---------------------------------------------------------------------------
+// Queues and semaphores
+// ---------------------------------------------------------------------------
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  struct host_queue *q = calloc(1, sizeof(*q));
+  if (q == NULL || length == 0) {
+    free(q);
+    return NULL;
+  }
+  q->items = item_size ? calloc(length, item_size) : NULL;
+  if (item_size && q->items == NULL) {
+    free(q);
+    return NULL;
+  }
+  q->length = length;
+  q->item_size = item_size;
+  pthread_mutex_init(&q->lock, NULL);
+  host_cond_init(&q->cond);
+  return q;
+}
+
+void vQueueDelete(QueueHandle_t q) {
+  if (q == NULL) {
+    return;
+  }
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->cond);
+  free(q->items);
+  free(q);
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks) {
+  struct timespec deadline = host_deadline(ticks);
+  BaseType_t ret = pdFAIL;
+
+  pthread_mutex_lock(&q->lock);
+  while (q->count == q->length && ticks != 0 &&
+         host_cond_wait(&q->cond, &q->lock, ticks, &deadline)) {
+  }
+  if (q->count < q->length) {
+    if (q->item_size) {
+      UBaseType_t tail = (q->head + q->count) % q->length;
+      memcpy(q->items + tail * q->item_size, item, q->item_size);
+    }
+    q->count++;
+    pthread_cond_broadcast(&q->cond);
+    ret = pdPASS;
+  }
+  pthread_mutex_unlock(&q->lock);
+  return ret;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+  struct timespec deadline = host_deadline(ticks);
+  BaseType_t ret = pdFAIL;
+
+  pthread_mutex_lock(&q->lock);
+  while (q->count == 0 && ticks != 0 &&
+         host_cond_wait(&q->cond, &q->lock, ticks, &deadline)) {
+  }
+  if (q->count > 0) {
+    if (q->item_size) {
+      memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    }
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    pthread_cond_broadcast(&q->cond);
+    ret = pdPASS;
+  }
+  pthread_mutex_unlock(&q->lock);
+  return ret;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  pthread_mutex_lock(&q->lock);
+  UBaseType_t count = q->count;
+  pthread_mutex_unlock(&q->lock);
+  return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  SemaphoreHandle_t s = xQueueCreate(1, 0);
+  if (s != NULL) {
+    xSemaphoreGive(s);
+  }
+  return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) { return xQueueCreate(1, 0); }
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max,
+                                           UBaseType_t initial) {
+  SemaphoreHandle_t s = xQueueCreate(max, 0);
+  for (UBaseType_t i = 0; s != NULL && i < initial; i++) {
+    xSemaphoreGive(s);
+  }
+  return s;
+}
+
+// ---------------------------------------------------------------------------
+// Event groups
+// ---------------------------------------------------------------------------
+
+EventGroupHandle_t xEventGroupCreate(void) {
+  struct host_event_group *g = calloc(1, sizeof(*g));
+  if (g == NULL) {
+    return NULL;
+  }
+  pthread_mutex_init(&g->lock, NULL);
+  host_cond_init(&g->cond);
+  return g;
+}
+
+void vEventGroupDelete(EventGroupHandle_t g) {
+  if (g == NULL) {
+    return;
+  }
+  pthread_mutex_destroy(&g->lock);
+  pthread_cond_destroy(&g->cond);
+  free(g);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t g, EventBits_t bits) {
+  pthread_mutex_lock(&g->lock);
+  g->bits |= bits;
+  EventBits_t now = g->bits;
+  pthread_cond_broadcast(&g->cond);
+  pthread_mutex_unlock(&g->lock);
+  return now;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t g, EventBits_t bits) {
+  pthread_mutex_lock(&g->lock);
+  EventBits_t before = g->bits;
+  g->bits &= ~bits;
+  pthread_mutex_unlock(&g->lock);
+  return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t g) {
+  pthread_mutex_lock(&g->lock);
+  EventBits_t bits = g->bits;
+  pthread_mutex_unlock(&g->lock);
+  return bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t g, EventBits_t bits,
+                                BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks) {
+  struct timespec deadline = host_deadline(ticks);
+
+  pthread_mutex_lock(&g->lock);
+  for (;;) {
+    EventBits_t set = g->bits & bits;
+    bool met = wait_for_all ? set == bits : set != 0;
+    if (met || ticks == 0 ||
+        !host_cond_wait(&g->cond, &g->lock, ticks, &deadline)) {
+      break;
+    }
+  }
+  EventBits_t now = g->bits;
+  bool met = wait_for_all ? (now & bits) == bits : (now & bits) != 0;
+  if (met && clear_on_exit) {
+    g->bits &= ~bits;
+  }
+  pthread_mutex_unlock(&g->lock);
+  return now;
+}
@@ -0,0 +1,158 @@
+/**
+ * @file host_http.c
+ * @brief esp_http_client over a blocking POSIX socket
+ */
+
+#include "esp_http_client.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define HEAD_MAX 2048
+
+struct host_http_client {
+  char host[64];
+  int port;
+  char path[512];
+  char host_hdr[128];
+  int timeout_ms;
+  int fd;
+  char head[HEAD_MAX]; ///< Response head, then body bytes read with it
+  size_t head_len;
+  size_t body_at; ///< End of the head in head[], 0 until complete
+  size_t body_buffered;
+  int status;
+  int64_t content_length; ///< -1 = not given
+  int64_t received;
+};
+
+esp_http_client_handle_t
+esp_http_client_init(const esp_http_client_config_t *config) {
+  struct host_http_client *c = calloc(1, sizeof(*c));
+  if (c == NULL) {
+    return NULL;
+  }
+  c->fd = -1;
+  c->content_length = -1;
+  c->timeout_ms = config->timeout_ms ? config->timeout_ms : 5000;
+  if (sscanf(config->url, "http://%63[^:/]:%d%511s", c->host, &c->port,
+             c->path) != 3) {
+    free(c);
+    return NULL;
+  }
+  snprintf(c->host_hdr, sizeof(c->host_hdr), "%s:%d", c->host, c->port);
+  return c;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t c,
+                                     const char *key, const char *value) {
+  if (strcasecmp(key, "Host") == 0) {
+    snprintf(c->host_hdr, sizeof(c->host_hdr), "%s", value);
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t c, int write_len) {
+  (void)write_len;
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons((uint16_t)c->port)};
+  if (inet_pton(AF_INET, c->host, &addr.sin_addr) != 1) {
+    return ESP_ERR_HTTP_CONNECT;
+  }
+  c->fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct timeval tv = {.tv_sec = c->timeout_ms / 1000,
+                       .tv_usec = (c->timeout_ms % 1000) * 1000};
+  setsockopt(c->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    return ESP_ERR_HTTP_CONNECT;
+  }
+  char req[1024];
+  int n = snprintf(req, sizeof(req),
+                   "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                   c->path, c->host_hdr);
+  return send(c->fd, req, n, MSG_NOSIGNAL) == n ? ESP_OK : ESP_FAIL;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t c) {
+  while (c->body_at == 0) {
+    ssize_t n = recv(c->fd, c->head + c->head_len,
+                     sizeof(c->head) - 1 - c->head_len, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return -ESP_ERR_HTTP_EAGAIN;
+    }
+    if (n <= 0) {
+      return ESP_FAIL;
+    }
+    c->head_len += n;
+    c->head[c->head_len] = '\0';
+    char *end = strstr(c->head, "\r\n\r\n");
+    if (end) {
+      c->body_at = end + 4 - c->head;
+    } else if (c->head_len == sizeof(c->head) - 1) {
+      return ESP_FAIL; // Head too long
+    }
+  }
+  sscanf(c->head, "HTTP/1.%*d %d", &c->status);
+  for (char *line = strstr(c->head, "\r\n");
+       line != NULL && line < c->head + c->body_at;
+       line = strstr(line + 2, "\r\n")) {
+    if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+      c->content_length = strtoll(line + 17, NULL, 10);
+    }
+  }
+  c->body_buffered = c->head_len - c->body_at;
+  return c->content_length < 0 ? 0 : c->content_length;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t c) {
+  return c->status;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t c) {
+  return c->content_length;
+}
+
+int esp_http_client_read(esp_http_client_handle_t c, char *buffer, int len) {
+  if (c->content_length >= 0 && c->received >= c->content_length) {
+    return 0;
+  }
+  if (c->body_buffered > 0) {
+    size_t n = c->body_buffered < (size_t)len ? c->body_buffered : len;
+    memcpy(buffer, c->head + c->head_len - c->body_buffered, n);
+    c->body_buffered -= n;
+    c->received += n;
+    return (int)n;
+  }
+  ssize_t n = recv(c->fd, buffer, len, 0);
+  if (n < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK ? -ESP_ERR_HTTP_EAGAIN
+                                                   : ESP_FAIL;
+  }
+  c->received += n;
+  return (int)n;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t c) {
+  return c->content_length >= 0 && c->received >= c->content_length;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t c) {
+  if (c->fd >= 0) {
+    close(c->fd);
+    c->fd = -1;
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t c) {
+  esp_http_client_close(c);
+  free(c);
+  return ESP_OK;
+}
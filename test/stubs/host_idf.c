@@ -0,0 +1,197 @@
+/**
+ * @file host_idf.c
+ * @brief ESP-IDF services the modules under test call: errors, logging,
+ * time, heap, partition reads, shutdown handlers and the reset reason
+ */
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "host.h"
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SHUTDOWN_HANDLERS_MAX 5 // As in esp_system
+
+static atomic_int_least64_t time_offset_us = 0;
+static esp_log_level_t log_level = (esp_log_level_t)-1; // Not read yet
+static shutdown_handler_t shutdown_handlers[SHUTDOWN_HANDLERS_MAX];
+static atomic_uint heap_allocs = 0;
+static esp_reset_reason_t reset_reason = ESP_RST_POWERON;
+
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_NOT_SUPPORTED:
+    return "ESP_ERR_NOT_SUPPORTED";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  case ESP_ERR_INVALID_RESPONSE:
+    return "ESP_ERR_INVALID_RESPONSE";
+  case ESP_ERR_INVALID_CRC:
+    return "ESP_ERR_INVALID_CRC";
+  case ESP_ERR_INVALID_VERSION:
+    return "ESP_ERR_INVALID_VERSION";
+  case ESP_ERR_NOT_FINISHED:
+    return "ESP_ERR_NOT_FINISHED";
+  case ESP_ERR_NOT_ALLOWED:
+    return "ESP_ERR_NOT_ALLOWED";
+  }
+  return "UNKNOWN ERROR";
+}
+
+void host_log_set_level(esp_log_level_t level) { log_level = level; }
+
+void host_log(esp_log_level_t level, const char *tag, const char *fmt, ...) {
+  static const char letters[] = "NEWIDV";
+  if ((int)log_level < 0) {
+    const char *env = getenv("HOST_LOG_LEVEL");
+    log_level = env ? (esp_log_level_t)atoi(env) : ESP_LOG_WARN;
+  }
+  if (level > log_level) {
+    return;
+  }
+  char line[512];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  fprintf(stderr, "%c (%lld) %s: %s\n", letters[level],
+          (long long)(esp_timer_get_time() / 1000), tag, line);
+}
+
+int64_t esp_timer_get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 +
+         atomic_load(&time_offset_us);
+}
+
+void host_time_advance_ms(uint32_t ms) {
+  atomic_fetch_add(&time_offset_us, (int64_t)ms * 1000);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+  (void)caps;
+  atomic_fetch_add(&heap_allocs, 1);
+  return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+  (void)caps;
+  atomic_fetch_add(&heap_allocs, 1);
+  return calloc(n, size);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+  (void)caps;
+  atomic_fetch_add(&heap_allocs, 1);
+  return realloc(ptr, size);
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+  (void)caps;
+  atomic_fetch_add(&heap_allocs, 1);
+  return aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+}
+
+void heap_caps_free(void *ptr) { free(ptr); }
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+  return (caps & MALLOC_CAP_SPIRAM) ? 8 * 1024 * 1024 : 256 * 1024;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+  return heap_caps_get_free_size(caps) / 2;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  return heap_caps_get_free_size(caps) / 4;
+}
+
+uint32_t host_heap_allocs(void) { return atomic_load(&heap_allocs); }
+
+esp_err_t esp_partition_read(const esp_partition_t *partition,
+                             size_t src_offset, void *dst, size_t size) {
+  if (partition == NULL || dst == NULL || src_offset > partition->size ||
+      size > partition->size - src_offset) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  memcpy(dst, partition->host_data + src_offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset,
+                             size_t size, esp_partition_mmap_memory_t memory,
+                             const void **out_ptr,
+                             esp_partition_mmap_handle_t *out_handle) {
+  (void)memory;
+  if (partition == NULL || out_ptr == NULL || offset > partition->size ||
+      size > partition->size - offset) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  *out_ptr = partition->host_data + offset;
+  *out_handle = 0;
+  return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) { (void)handle; }
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler) {
+  for (int i = 0; i < SHUTDOWN_HANDLERS_MAX; i++) {
+    if (shutdown_handlers[i] == handler) {
+      return ESP_ERR_INVALID_STATE;
+    }
+    if (shutdown_handlers[i] == NULL) {
+      shutdown_handlers[i] = handler;
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_NO_MEM;
+}
+
+void host_shutdown(void) {
+  for (int i = SHUTDOWN_HANDLERS_MAX - 1; i >= 0; i--) {
+    if (shutdown_handlers[i] != NULL) {
+      shutdown_handlers[i]();
+    }
+  }
+}
+
+void host_set_reset_reason(esp_reset_reason_t reason) {
+  reset_reason = reason;
+}
+
+esp_reset_reason_t esp_reset_reason(void) { return reset_reason; }
+
+#ifndef HAVE_STRLCPY
+size_t strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size > 0) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+#endif
@@ -0,0 +1,97 @@
+/**
+ * @file host_modules.c
+ * @brief Recording stand-ins for the firmware modules the tested ones
+ * report to (metrics, sys_diag, blog)
+ */
+
+#include "blog.h"
+#include "host.h"
+#include "metrics.h"
+#include "sys_diag.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+static atomic_uint counters[METRIC_COUNTER_COUNT];
+static atomic_int gauges[METRIC_GAUGE_COUNT];
+static atomic_uint observations[METRIC_HIST_COUNT];
+static atomic_uint wdt_feeds = 0;
+
+void metrics_inc(metric_counter_t id) { atomic_fetch_add(&counters[id], 1); }
+
+void metrics_add(metric_counter_t id, uint32_t n) {
+  atomic_fetch_add(&counters[id], n);
+}
+
+void metrics_gauge_set(metric_gauge_t id, int32_t value) {
+  atomic_store(&gauges[id], value);
+}
+
+uint32_t metrics_get(metric_counter_t id) { return atomic_load(&counters[id]); }
+
+void metrics_observe(metric_hist_t id, uint32_t value_us) {
+  (void)value_us;
+  atomic_fetch_add(&observations[id], 1);
+}
+
+esp_err_t metrics_render(char *buf, size_t buf_len, metrics_sink_t sink,
+                         void *ctx) {
+  (void)buf;
+  (void)buf_len;
+  (void)sink;
+  (void)ctx;
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+int32_t host_metrics_gauge(int gauge) { return atomic_load(&gauges[gauge]); }
+
+uint32_t host_metrics_observations(int hist) {
+  return atomic_load(&observations[hist]);
+}
+
+void host_metrics_reset(void) {
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    atomic_store(&counters[i], 0);
+  }
+  for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+    atomic_store(&gauges[i], 0);
+  }
+  for (int i = 0; i < METRIC_HIST_COUNT; i++) {
+    atomic_store(&observations[i], 0);
+  }
+}
+
+void sys_diag_wdt_feed(void) { atomic_fetch_add(&wdt_feeds, 1); }
+
+uint32_t host_wdt_feeds(void) { return atomic_load(&wdt_feeds); }
+
+const char *sys_diag_get_reset_reason(void) {
+  switch (esp_reset_reason()) {
+  case ESP_RST_POWERON:
+    return "Power On";
+  case ESP_RST_SW:
+    return "Software Reset";
+  case ESP_RST_PANIC:
+    return "Crash/Panic";
+  case ESP_RST_TASK_WDT:
+    return "Task WDT (Hang)";
+  default:
+    return "Unknown";
+  }
+}
+
+// Records carry 32-bit format addresses, which a 64-bit host cannot follow
+size_t blog_render(const void *rec, size_t len, char *out, size_t out_len) {
+  int n = snprintf(out, out_len, "<blog %u bytes>\n", (unsigned)len);
+  return n < 0 ? 0 : ((size_t)n < out_len ? (size_t)n : out_len - 1);
+}
+
+// BLOGD/BLOGI in modules under test: no ring on the host, records dropped
+esp_log_level_t blog_level = ESP_LOG_INFO;
+
+void blog_write(blog_site_t *site, esp_log_level_t level, const char *tag,
+                ...) {
+  (void)site;
+  (void)level;
+  (void)tag;
+}
@@ -0,0 +1,329 @@
+/**
+ * @file host_nvs.c
+ * @brief In-memory NVS with per-key write counts and failure injection
+ */
+
+#include "host.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NVS_MAX_ENTRIES 128
+#define NVS_MAX_NAMESPACES 8
+#define NVS_KEY_MAX 15 // NVS_KEY_NAME_MAX_SIZE - 1
+
+typedef enum {
+  ENTRY_FREE,
+  ENTRY_I32,
+  ENTRY_U8,
+  ENTRY_STR,
+  ENTRY_BLOB,
+} entry_type_t;
+
+typedef struct {
+  entry_type_t type;
+  uint8_t ns;
+  char key[NVS_KEY_MAX + 1];
+  int32_t value;
+  char *str;      ///< String or blob contents
+  size_t len;     ///< Blob length
+  uint32_t writes;
+} entry_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static entry_t entries[NVS_MAX_ENTRIES];
+static char namespaces[NVS_MAX_NAMESPACES][NVS_KEY_MAX + 1];
+static uint32_t commits = 0;
+static esp_err_t fail_with = ESP_OK;
+
+// Handles are namespace index + 1; the mode is in bit 8
+#define HANDLE_NS(h) (((h) & 0xFF) - 1)
+#define HANDLE_RW 0x100
+
+static bool handle_ok(nvs_handle_t h) {
+  int ns = HANDLE_NS(h);
+  return ns >= 0 && ns < NVS_MAX_NAMESPACES && namespaces[ns][0] != '\0';
+}
+
+static entry_t *find(nvs_handle_t h, const char *key) {
+  for (int i = 0; i < NVS_MAX_ENTRIES; i++) {
+    if (entries[i].type != ENTRY_FREE && entries[i].ns == HANDLE_NS(h) &&
+        strcmp(entries[i].key, key) == 0) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+static void entry_clear(entry_t *e) {
+  free(e->str);
+  memset(e, 0, sizeof(*e));
+}
+
+/** Entry to overwrite with @p type; lock held */
+static esp_err_t prepare_write(nvs_handle_t h, const char *key,
+                               entry_type_t type, entry_t **out) {
+  if (!handle_ok(h)) {
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  }
+  if (!(h & HANDLE_RW)) {
+    return ESP_ERR_NVS_READ_ONLY;
+  }
+  if (key == NULL || strlen(key) > NVS_KEY_MAX) {
+    return ESP_ERR_NVS_INVALID_LENGTH;
+  }
+  if (fail_with != ESP_OK) {
+    return fail_with;
+  }
+  entry_t *e = find(h, key);
+  for (int i = 0; e == NULL && i < NVS_MAX_ENTRIES; i++) {
+    if (entries[i].type == ENTRY_FREE) {
+      e = &entries[i];
+      e->ns = (uint8_t)HANDLE_NS(h);
+      strcpy(e->key, key);
+    }
+  }
+  if (e == NULL) {
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+  }
+  free(e->str);
+  e->str = NULL;
+  e->type = type;
+  e->writes++;
+  *out = e;
+  return ESP_OK;
+}
+
+/** Existing entry of @p type; lock held */
+static esp_err_t prepare_read(nvs_handle_t h, const char *key,
+                              entry_type_t type, entry_t **out) {
+  if (!handle_ok(h)) {
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  }
+  entry_t *e = find(h, key);
+  if (e == NULL || e->type != type) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  *out = e;
+  return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+
+esp_err_t nvs_flash_erase(void) {
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < NVS_MAX_ENTRIES; i++) {
+    entry_clear(&entries[i]);
+  }
+  pthread_mutex_unlock(&lock);
+  return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode,
+                   nvs_handle_t *out_handle) {
+  if (name == NULL || strlen(name) > NVS_KEY_MAX || out_handle == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  esp_err_t err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < NVS_MAX_NAMESPACES; i++) {
+    if (namespaces[i][0] == '\0' && mode == NVS_READONLY) {
+      err = ESP_ERR_NVS_NOT_FOUND; // Read-only open does not create it
+      break;
+    }
+    if (namespaces[i][0] == '\0') {
+      strcpy(namespaces[i], name);
+    }
+    if (strcmp(namespaces[i], name) == 0) {
+      *out_handle = (nvs_handle_t)(i + 1);
+      if (mode == NVS_READWRITE) {
+        *out_handle |= HANDLE_RW;
+      }
+      err = ESP_OK;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+void nvs_close(nvs_handle_t handle) { (void)handle; }
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+  pthread_mutex_lock(&lock);
+  esp_err_t err = handle_ok(handle) ? fail_with : ESP_ERR_NVS_INVALID_HANDLE;
+  if (err == ESP_OK) {
+    commits++;
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+  pthread_mutex_lock(&lock);
+  entry_t *e = handle_ok(handle) ? find(handle, key) : NULL;
+  if (e != NULL) {
+    entry_clear(e);
+  }
+  pthread_mutex_unlock(&lock);
+  return e != NULL ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+  pthread_mutex_lock(&lock);
+  bool ok = handle_ok(handle);
+  for (int i = 0; ok && i < NVS_MAX_ENTRIES; i++) {
+    if (entries[i].type != ENTRY_FREE && entries[i].ns == HANDLE_NS(handle)) {
+      entry_clear(&entries[i]);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return ok ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value) {
+  entry_t *e;
+  pthread_mutex_lock(&lock);
+  esp_err_t err = prepare_write(handle, key, ENTRY_I32, &e);
+  if (err == ESP_OK) {
+    e->value = value;
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *out) {
+  entry_t *e;
+  pthread_mutex_lock(&lock);
+  esp_err_t err = prepare_read(handle, key, ENTRY_I32, &e);
+  if (err == ESP_OK) {
+    *out = e->value;
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value) {
+  entry_t *e;
+  pthread_mutex_lock(&lock);
+  esp_err_t err = prepare_write(handle, key, ENTRY_U8, &e);
+  if (err == ESP_OK) {
+    e->value = value;
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out) {
+  entry_t *e;
+  pthread_mutex_lock(&lock);
+  esp_err_t err = prepare_read(handle, key, ENTRY_U8, &e);
+  if (err == ESP_OK) {
+    *out = (uint8_t)e->value;
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value) {
+  if (value == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  char *copy = strdup(value);
+  entry_t *e;
+  pthread_mutex_lock(&lock);
+  esp_err_t err = prepare_write(handle, key, ENTRY_STR, &e);
+  if (err == ESP_OK) {
+    e->str = copy;
+    copy = NULL;
+  }
+  pthread_mutex_unlock(&lock);
+  free(copy);
+  return err;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out,
+                      size_t *length) {
+  entry_t *e;
+  pthread_mutex_lock(&lock);
+  esp_err_t err = prepare_read(handle, key, ENTRY_STR, &e);
+  if (err == ESP_OK) {
+    size_t need = strlen(e->str) + 1;
+    if (out == NULL) {
+      *length = need;
+    } else if (*length < need) {
+      err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+      memcpy(out, e->str, need);
+      *length = need;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value,
+                       size_t length) {
+  if (value == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  char *copy = malloc(length ? length : 1);
+  memcpy(copy, value, length);
+  entry_t *e;
+  pthread_mutex_lock(&lock);
+  esp_err_t err = prepare_write(handle, key, ENTRY_BLOB, &e);
+  if (err == ESP_OK) {
+    e->str = copy;
+    e->len = length;
+    copy = NULL;
+  }
+  pthread_mutex_unlock(&lock);
+  free(copy);
+  return err;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out,
+                       size_t *length) {
+  entry_t *e;
+  pthread_mutex_lock(&lock);
+  esp_err_t err = prepare_read(handle, key, ENTRY_BLOB, &e);
+  if (err == ESP_OK) {
+    if (out == NULL) {
+      *length = e->len;
+    } else if (*length < e->len) {
+      err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+      memcpy(out, e->str, e->len);
+      *length = e->len;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return err;
+}
+
+uint32_t host_nvs_writes(const char *key) {
+  uint32_t n = 0;
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < NVS_MAX_ENTRIES; i++) {
+    if (entries[i].type != ENTRY_FREE && strcmp(entries[i].key, key) == 0) {
+      n += entries[i].writes;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+uint32_t host_nvs_commits(void) {
+  pthread_mutex_lock(&lock);
+  uint32_t n = commits;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+void host_nvs_fail(esp_err_t err) {
+  pthread_mutex_lock(&lock);
+  fail_with = err;
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,217 @@
+/**
+ * @file host_timers.c
+ * @brief FreeRTOS software timers on one pthread service thread, and
+ * periodic esp_timers on top of them
+ *
+ * Expiry is kept in ticks (milliseconds of CLOCK_MONOTONIC), so
+ * host_time_advance_ms() does not fire timers.
+ */
+
+#include "freertos/timers.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "host.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct host_timer {
+  char name[16];
+  TickType_t period;
+  bool auto_reload;
+  void *id;
+  TimerCallbackFunction_t cb;
+  bool active;
+  TickType_t expiry;
+  struct host_timer *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond;
+static pthread_once_t service_once = PTHREAD_ONCE_INIT;
+static struct host_timer *timers = NULL;
+static struct host_timer *running = NULL; // Callback in progress
+
+static bool expired(const struct host_timer *t, TickType_t now) {
+  return (int32_t)(t->expiry - now) <= 0;
+}
+
+static void *service_main(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    struct host_timer *next = NULL;
+    for (struct host_timer *t = timers; t != NULL; t = t->next) {
+      if (t->active &&
+          (next == NULL || (int32_t)(t->expiry - next->expiry) < 0)) {
+        next = t;
+      }
+    }
+    if (next == NULL) {
+      pthread_cond_wait(&cond, &lock);
+      continue;
+    }
+    TickType_t now = xTaskGetTickCount();
+    if (!expired(next, now)) {
+      struct timespec deadline = host_deadline(next->expiry - now);
+      host_cond_wait(&cond, &lock, next->expiry - now, &deadline);
+      continue;
+    }
+
+    if (next->auto_reload) {
+      next->expiry += next->period;
+    } else {
+      next->active = false;
+    }
+    running = next;
+    pthread_mutex_unlock(&lock);
+    next->cb(next);
+    pthread_mutex_lock(&lock);
+    running = NULL;
+    pthread_cond_broadcast(&cond);
+  }
+  return NULL;
+}
+
+static void service_start(void) {
+  host_cond_init(&cond);
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, service_main, NULL) != 0) {
+    fprintf(stderr, "timers: cannot start the service thread\n");
+    abort();
+  }
+  pthread_detach(thread);
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period,
+                           UBaseType_t auto_reload, void *id,
+                           TimerCallbackFunction_t cb) {
+  if (period == 0 || cb == NULL) {
+    return NULL;
+  }
+  pthread_once(&service_once, service_start);
+  struct host_timer *t = calloc(1, sizeof(*t));
+  if (t == NULL) {
+    return NULL;
+  }
+  snprintf(t->name, sizeof(t->name), "%s", name ? name : "");
+  t->period = period;
+  t->auto_reload = auto_reload != pdFALSE;
+  t->id = id;
+  t->cb = cb;
+
+  pthread_mutex_lock(&lock);
+  t->next = timers;
+  timers = t;
+  pthread_mutex_unlock(&lock);
+  return t;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t t, TickType_t period,
+                              TickType_t ticks) {
+  (void)ticks;
+  if (period == 0) {
+    return pdFAIL;
+  }
+  pthread_mutex_lock(&lock);
+  t->period = period;
+  t->expiry = xTaskGetTickCount() + period;
+  t->active = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+  return pdPASS;
+}
+
+BaseType_t xTimerStart(TimerHandle_t t, TickType_t ticks) {
+  return xTimerChangePeriod(t, t->period, ticks);
+}
+
+BaseType_t xTimerReset(TimerHandle_t t, TickType_t ticks) {
+  return xTimerChangePeriod(t, t->period, ticks);
+}
+
+BaseType_t xTimerStop(TimerHandle_t t, TickType_t ticks) {
+  (void)ticks;
+  pthread_mutex_lock(&lock);
+  t->active = false;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+  return pdPASS;
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t t) {
+  pthread_mutex_lock(&lock);
+  bool active = t->active;
+  pthread_mutex_unlock(&lock);
+  return active ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t t, TickType_t ticks) {
+  (void)ticks;
+  pthread_mutex_lock(&lock);
+  while (running == t) {
+    pthread_cond_wait(&cond, &lock);
+  }
+  for (struct host_timer **p = &timers; *p != NULL; p = &(*p)->next) {
+    if (*p == t) {
+      *p = t->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  free(t);
+  return pdPASS;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t t) { return t->id; }
+
+// esp_timer -------------------------------------------------------------------
+
+struct esp_timer {
+  esp_timer_cb_t cb;
+  void *arg;
+  TimerHandle_t timer;
+};
+
+static void esp_timer_expired(TimerHandle_t t) {
+  struct esp_timer *e = pvTimerGetTimerID(t);
+  e->cb(e->arg);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args,
+                           esp_timer_handle_t *out) {
+  if (args == NULL || args->callback == NULL || out == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  struct esp_timer *e = calloc(1, sizeof(*e));
+  if (e == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  e->cb = args->callback;
+  e->arg = args->arg;
+  e->timer = xTimerCreate(args->name, 1, pdTRUE, e, esp_timer_expired);
+  if (e->timer == NULL) {
+    free(e);
+    return ESP_ERR_NO_MEM;
+  }
+  *out = e;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer,
+                                   uint64_t period_us) {
+  TickType_t ticks = period_us < 1000 ? 1 : (TickType_t)(period_us / 1000);
+  xTimerChangePeriod(timer->timer, ticks, 0);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  xTimerStop(timer->timer, 0);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  xTimerDelete(timer->timer, 0);
+  free(timer);
+  return ESP_OK;
+}
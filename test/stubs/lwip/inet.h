@@ -0,0 +1,21 @@
+/**
+ * @file inet.h
+ * @brief Host stand-in for lwIP's address helpers (libc underneath)
+ */
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline char *inet_ntoa_r(struct in_addr addr, char *buf, int buflen) {
+  return (char *)inet_ntop(AF_INET, &addr, buf, (socklen_t)buflen);
+}
+
+#ifdef __cplusplus
+}
+#endif
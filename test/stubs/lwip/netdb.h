@@ -0,0 +1,27 @@
+/**
+ * @file netdb.h
+ * @brief Host stand-in for lwIP's resolver: a table the test fills
+ *
+ * getaddrinfo() answers from host_dns_set() entries instead of the network,
+ * so lookups are counted and can be made slow or failing (host.h).
+ */
+
+#pragma once
+
+#include <netdb.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int host_getaddrinfo(const char *node, const char *service,
+                     const struct addrinfo *hints, struct addrinfo **res);
+void host_freeaddrinfo(struct addrinfo *res);
+
+#define getaddrinfo host_getaddrinfo
+#define freeaddrinfo host_freeaddrinfo
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,36 @@
+/**
+ * @file sha256.h
+ * @brief Host stand-in for the mbedTLS 3.x SHA-256 API (SHA-256 only)
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t total;
+  uint8_t buf[64];
+  size_t buf_len;
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx);
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx);
+void mbedtls_sha256_clone(mbedtls_sha256_context *dst,
+                          const mbedtls_sha256_context *src);
+/** @p is224 must be 0 */
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224);
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx,
+                          const unsigned char *input, size_t len);
+int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char out[32]);
+int mbedtls_sha256(const unsigned char *input, size_t len,
+                   unsigned char out[32], int is224);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,9 @@
+/**
+ * @file mp3dec.h
+ * @brief Host stand-in for the Helix MP3 decoder: only the frame limits
+ */
+
+#pragma once
+
+#define MAX_NCHAN 2
+#define MAX_NSAMP 576
@@ -0,0 +1,19 @@
+/**
+ * @file nvs_flash.h
+ * @brief Host stand-in for NVS partition init (always ready)
+ */
+
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,8 @@
+/**
+ * @file spi_flash_mmap.h
+ * @brief Host stand-in for the flash geometry constants
+ */
+
+#pragma once
+
+#define SPI_FLASH_SEC_SIZE 4096
@@ -0,0 +1,252 @@
+/**
+ * @file test_alloc_trace.c
+ * @brief alloc_trace: per-tag live/peak/count accounting, frees across
+ * modules, per-conversation counters after a reset, table overflow and
+ * concurrent callers
+ *
+ * Built with ALLOC_TRACE_ENABLE=1, so the TRACE_* macros go through the
+ * tracer exactly as in a traced firmware build.
+ */
+
+#include "alloc_trace.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <stdint.h>
+
+static alloc_trace_stats_t stats_of(alloc_tag_t tag) {
+  alloc_trace_stats_t s;
+  alloc_trace_get(tag, &s);
+  return s;
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_tag_names(void) {
+  CHECK_STR(alloc_trace_tag_name(ALLOC_TAG_TTS), "tts_player");
+  CHECK_STR(alloc_trace_tag_name(ALLOC_TAG_HA_CLIENT), "ha_client");
+  CHECK_STR(alloc_trace_tag_name(ALLOC_TAG_COUNT), "?");
+
+  alloc_trace_stats_t s;
+  memset(&s, 0xff, sizeof(s));
+  alloc_trace_get(ALLOC_TAG_COUNT, &s);
+  CHECK_EQ(s.allocs, 0);
+  CHECK_EQ(s.live_bytes, 0);
+}
+
+static void test_live_and_peak(void) {
+  alloc_trace_reset();
+  void *a = TRACE_MALLOC(ALLOC_TAG_BEEP, 100);
+  void *b = TRACE_CALLOC(ALLOC_TAG_BEEP, 4, 50);
+  char *c = TRACE_STRDUP(ALLOC_TAG_OTA, "firmware.bin");
+
+  alloc_trace_stats_t s = stats_of(ALLOC_TAG_BEEP);
+  CHECK_EQ(s.live_bytes, 300);
+  CHECK_EQ(s.peak_bytes, 300);
+  CHECK_EQ(s.live_count, 2);
+  CHECK_EQ(s.allocs, 2);
+  CHECK_EQ(s.alloc_bytes, 300);
+  CHECK_STR(c, "firmware.bin");
+  CHECK_EQ(stats_of(ALLOC_TAG_OTA).live_bytes, 13);
+
+  TRACE_FREE(a);
+  s = stats_of(ALLOC_TAG_BEEP);
+  CHECK_EQ(s.live_bytes, 200);
+  CHECK_EQ(s.peak_bytes, 300);
+  CHECK_EQ(s.live_count, 1);
+  CHECK_EQ(s.frees, 1);
+
+  TRACE_FREE(b);
+  TRACE_FREE(c);
+  CHECK_EQ(stats_of(ALLOC_TAG_BEEP).live_bytes, 0);
+  CHECK_EQ(stats_of(ALLOC_TAG_OTA).live_count, 0);
+  TRACE_FREE(NULL);
+}
+
+static void test_realloc_moves_accounting(void) {
+  alloc_trace_reset();
+  void *p = TRACE_REALLOC(ALLOC_TAG_HA_CLIENT, NULL, 64); // As malloc
+  p = TRACE_REALLOC(ALLOC_TAG_HA_CLIENT, p, 4096);
+  p = TRACE_REALLOC(ALLOC_TAG_HA_CLIENT, p, 1024);
+
+  alloc_trace_stats_t s = stats_of(ALLOC_TAG_HA_CLIENT);
+  CHECK_EQ(s.live_bytes, 1024);
+  CHECK_EQ(s.live_count, 1);
+  CHECK_EQ(s.peak_bytes, 4096);
+  CHECK_EQ(s.allocs, 3);
+  CHECK_EQ(s.frees, 2);
+
+  TRACE_FREE(p);
+  CHECK_EQ(stats_of(ALLOC_TAG_HA_CLIENT).live_bytes, 0);
+}
+
+static void test_free_by_other_module(void) {
+  alloc_trace_reset();
+  // Allocated by tts_player, released by the pipeline: charged to the owner
+  void *p = TRACE_MALLOC(ALLOC_TAG_TTS, 512);
+  CHECK_EQ(stats_of(ALLOC_TAG_TTS).live_bytes, 512);
+  TRACE_FREE(p);
+  CHECK_EQ(stats_of(ALLOC_TAG_TTS).live_bytes, 0);
+  CHECK_EQ(stats_of(ALLOC_TAG_PIPELINE).frees, 0);
+
+  // Untraced memory (cJSON output, ...) passes through untouched
+  alloc_trace_stats_t before = stats_of(ALLOC_TAG_TTS);
+  TRACE_FREE(malloc(32));
+  alloc_trace_stats_t after = stats_of(ALLOC_TAG_TTS);
+  CHECK_EQ(after.frees, before.frees);
+  CHECK_EQ(after.live_count, before.live_count);
+}
+
+static void test_record_and_forget(void) {
+  alloc_trace_reset();
+  static uint8_t external[256];
+  alloc_trace_record(ALLOC_TAG_AUDIO_CAPTURE, external, sizeof(external));
+  CHECK_EQ(stats_of(ALLOC_TAG_AUDIO_CAPTURE).live_bytes, 256);
+  alloc_trace_forget(external);
+  CHECK_EQ(stats_of(ALLOC_TAG_AUDIO_CAPTURE).live_bytes, 0);
+  alloc_trace_forget(external); // Twice is harmless
+
+  // A NULL result is a failed allocation
+  alloc_trace_record(ALLOC_TAG_AUDIO_CAPTURE, NULL, 1 << 20);
+  alloc_trace_stats_t s = stats_of(ALLOC_TAG_AUDIO_CAPTURE);
+  CHECK_EQ(s.failures, 1);
+  CHECK_EQ(s.allocs, 1);
+  CHECK_EQ(s.live_count, 0);
+
+  // Out of range tags are ignored
+  alloc_trace_record(ALLOC_TAG_COUNT, external, 8);
+  alloc_trace_forget(external);
+}
+
+/** What one wake word -> TTS cycle allocates, as seen by the tracer */
+static void conversation(void **keep) {
+  void *frame = TRACE_MALLOC(ALLOC_TAG_HA_CLIENT, 2049);
+  void *pcm = TRACE_MALLOC(ALLOC_TAG_TTS, 4608);
+  void *mp3 = TRACE_REALLOC(ALLOC_TAG_TTS, NULL, 8192);
+  mp3 = TRACE_REALLOC(ALLOC_TAG_TTS, mp3, 16384);
+  TRACE_FREE(frame);
+  TRACE_FREE(pcm);
+  *keep = mp3; // Left for the next conversation
+}
+
+static void test_per_conversation_counts(void) {
+  void *leftover = TRACE_MALLOC(ALLOC_TAG_TTS, 1000);
+
+  // The pipeline resets the counters as a conversation starts
+  alloc_trace_reset();
+  alloc_trace_stats_t s = stats_of(ALLOC_TAG_TTS);
+  CHECK_EQ(s.allocs, 0);
+  CHECK_EQ(s.frees, 0);
+  CHECK_EQ(s.alloc_bytes, 0);
+  CHECK_EQ(s.live_bytes, 1000); // Live memory is not forgotten
+  CHECK_EQ(s.peak_bytes, 1000); // Peak restarts from it
+
+  void *kept;
+  conversation(&kept);
+  s = stats_of(ALLOC_TAG_TTS);
+  CHECK_EQ(s.allocs, 3);
+  CHECK_EQ(s.frees, 2);
+  CHECK_EQ(s.alloc_bytes, 4608 + 8192 + 16384);
+  CHECK_EQ(s.live_bytes, 1000 + 16384);
+  CHECK_EQ(s.peak_bytes, 1000 + 4608 + 16384);
+  s = stats_of(ALLOC_TAG_HA_CLIENT);
+  CHECK_EQ(s.allocs, 1);
+  CHECK_EQ(s.live_bytes, 0);
+
+  // The next conversation is counted on its own
+  alloc_trace_reset();
+  void *kept2;
+  conversation(&kept2);
+  CHECK_EQ(stats_of(ALLOC_TAG_TTS).allocs, 3);
+  CHECK_EQ(stats_of(ALLOC_TAG_HA_CLIENT).allocs, 1);
+  CHECK_EQ(stats_of(ALLOC_TAG_BEEP).allocs, 0);
+
+  TRACE_FREE(kept);
+  TRACE_FREE(kept2);
+  TRACE_FREE(leftover);
+  CHECK_EQ(stats_of(ALLOC_TAG_TTS).live_bytes, 0);
+  alloc_trace_dump(3);
+}
+
+static void test_table_overflow(void) {
+  enum { N = ALLOC_TRACE_SLOTS + 8 };
+  static void *ptrs[N];
+
+  alloc_trace_reset();
+  for (int i = 0; i < N; i++) {
+    ptrs[i] = TRACE_MALLOC(ALLOC_TAG_PIPELINE, 16);
+  }
+  CHECK_EQ(alloc_trace_untracked(), 8);
+  CHECK_EQ(stats_of(ALLOC_TAG_PIPELINE).allocs, N);
+
+  // Untracked frees are not matched; tracked ones all are
+  for (int i = 0; i < N; i++) {
+    TRACE_FREE(ptrs[i]);
+  }
+  CHECK_EQ(stats_of(ALLOC_TAG_PIPELINE).frees, ALLOC_TRACE_SLOTS);
+  alloc_trace_reset();
+  CHECK_EQ(alloc_trace_untracked(), 0);
+
+  // Backward-shift deletion left no holes: the table is usable again
+  for (int i = 0; i < ALLOC_TRACE_SLOTS; i++) {
+    ptrs[i] = TRACE_MALLOC(ALLOC_TAG_PIPELINE, 16);
+  }
+  CHECK_EQ(alloc_trace_untracked(), 0);
+  for (int i = 0; i < ALLOC_TRACE_SLOTS; i++) {
+    TRACE_FREE(ptrs[i]);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Tasks on both cores allocate at once on the device
+
+#define THREADS 8
+#define ROUNDS 20000
+
+static void *churn_main(void *arg) {
+  alloc_tag_t tag = (alloc_tag_t)(uintptr_t)arg;
+  void *held[4] = {NULL};
+  for (int i = 0; i < ROUNDS; i++) {
+    int k = i & 3;
+    TRACE_FREE(held[k]);
+    held[k] = TRACE_MALLOC(tag, 24);
+  }
+  for (int k = 0; k < 4; k++) {
+    TRACE_FREE(held[k]);
+  }
+  return NULL;
+}
+
+static void test_concurrent_callers(void) {
+  alloc_trace_reset();
+  pthread_t threads[THREADS];
+  for (int i = 0; i < THREADS; i++) {
+    pthread_create(&threads[i], NULL, churn_main,
+                   (void *)(uintptr_t)(i % 2 ? ALLOC_TAG_TTS : ALLOC_TAG_BEEP));
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (alloc_tag_t t = ALLOC_TAG_BEEP; t <= ALLOC_TAG_TTS;
+       t = (t == ALLOC_TAG_BEEP) ? ALLOC_TAG_TTS : ALLOC_TAG_COUNT) {
+    alloc_trace_stats_t s = stats_of(t);
+    CHECK_EQ(s.allocs, THREADS / 2 * ROUNDS);
+    CHECK_EQ(s.frees, THREADS / 2 * ROUNDS);
+    CHECK_EQ(s.live_bytes, 0);
+    CHECK_EQ(s.live_count, 0);
+    CHECK(s.peak_bytes <= THREADS / 2 * 4 * 24);
+  }
+  CHECK_EQ(alloc_trace_untracked(), 0);
+}
+
+int main(void) {
+  RUN(test_tag_names);
+  RUN(test_live_and_peak);
+  RUN(test_realloc_moves_accounting);
+  RUN(test_free_by_other_module);
+  RUN(test_record_and_forget);
+  RUN(test_per_conversation_counts);
+  RUN(test_table_overflow);
+  RUN(test_concurrent_callers);
+  return TEST_RESULT();
+}
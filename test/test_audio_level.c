@@ -0,0 +1,216 @@
+/**
+ * @file test_audio_level.c
+ * @brief audio_level: envelope attack/release over a speech-like fixture,
+ * the LED mailbox, and the per-frame cost the follower adds to playback
+ */
+
+#include "audio_level.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// One decoded MP3 frame of 24 kHz stereo TTS: 576 samples per channel
+#define FRAME_SAMPLES 1152
+
+static int16_t frame[FRAME_SAMPLES];
+
+/** Fill the frame with a square-ish tone of peak @p amp (0 = silence) */
+static void fill(int16_t amp) {
+  for (int i = 0; i < FRAME_SAMPLES; i++) {
+    frame[i] = (i / 8) % 2 ? amp : (int16_t)-amp;
+  }
+}
+
+static uint8_t feed(int32_t *env, int16_t amp) {
+  fill(amp);
+  return audio_level_update(env, frame, FRAME_SAMPLES);
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_silence_and_full_scale(void) {
+  int32_t env = 0;
+  CHECK_EQ(feed(&env, 0), 0);
+  CHECK_EQ(env, 0);
+
+  CHECK_EQ(feed(&env, 8000), 8000 >> AUDIO_LEVEL_SHIFT);
+  CHECK_EQ(feed(&env, 32767), 255); // Clamped
+
+  // Negative full scale counts too
+  env = 0;
+  fill(0);
+  frame[0] = -32768;
+  CHECK_EQ(audio_level_update(&env, frame, FRAME_SAMPLES), 255);
+  CHECK_EQ(env, 32768);
+}
+
+static void test_attack_is_instant_release_is_geometric(void) {
+  int32_t env = 0;
+  CHECK_EQ(feed(&env, 16000), 16000 >> AUDIO_LEVEL_SHIFT);
+
+  // Each silent frame closes a quarter of the gap
+  int32_t expect = 16000;
+  uint8_t prev = 255;
+  for (int i = 0; i < 40; i++) {
+    uint8_t level = feed(&env, 0);
+    expect -= expect >> AUDIO_LEVEL_RELEASE_SHIFT;
+    CHECK_EQ(env, expect);
+    CHECK(level <= prev);
+    prev = level;
+  }
+  CHECK_EQ(prev, 0);
+
+  // Quieter input only lowers the envelope towards it
+  env = 0;
+  feed(&env, 16000);
+  feed(&env, 12000);
+  CHECK_EQ(env, 16000 - (4000 >> AUDIO_LEVEL_RELEASE_SHIFT));
+}
+
+static void test_decimation(void) {
+  int32_t env = 0;
+  fill(0);
+  frame[AUDIO_LEVEL_DECIMATE + 1] = 20000; // Between inspected samples
+  CHECK_EQ(audio_level_update(&env, frame, FRAME_SAMPLES), 0);
+  frame[AUDIO_LEVEL_DECIMATE * 3] = 12000;
+  CHECK_EQ(audio_level_update(&env, frame, FRAME_SAMPLES),
+           12000 >> AUDIO_LEVEL_SHIFT);
+
+  // A short tail frame is handled
+  env = 0;
+  CHECK_EQ(audio_level_update(&env, frame, 1), 0);
+  CHECK_EQ(audio_level_update(&env, frame, 0), 0);
+}
+
+/**
+ * Five syllables of different loudness separated by short pauses: the LED
+ * must track each syllable and visibly dip in each pause
+ */
+static void test_speech_fixture(void) {
+  static const int16_t syllables[] = {6000, 14000, 9000, 16000, 4000};
+  int32_t env = 0;
+
+  for (size_t s = 0; s < sizeof(syllables) / sizeof(syllables[0]); s++) {
+    uint8_t target = syllables[s] >> AUDIO_LEVEL_SHIFT;
+    uint8_t level = 0;
+    for (int f = 0; f < 8; f++) {
+      level = feed(&env, syllables[s]);
+    }
+    // Eight frames (~190 ms) settle within a level step of the syllable
+    CHECK(level >= target && level <= target + 1);
+
+    for (int f = 0; f < 6; f++) {
+      level = feed(&env, 0);
+    }
+    CHECK(level < target / 4 + 1); // ~145 ms pause: below a quarter
+  }
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_mailbox(void) {
+  uint32_t seen = 0;
+  uint8_t level = 0xAA;
+
+  audio_level_poll(&seen, &level); // Whatever an earlier test left
+  CHECK(!audio_level_poll(&seen, &level));
+
+  audio_level_post(10);
+  CHECK(audio_level_poll(&seen, &level));
+  CHECK_EQ(level, 10);
+  CHECK(!audio_level_poll(&seen, &level)); // Stale, level still reported
+  CHECK_EQ(level, 10);
+
+  // The same level posted again is still a fresh post
+  audio_level_post(10);
+  CHECK(audio_level_poll(&seen, &level));
+
+  // Posts between polls collapse into the latest
+  audio_level_post(1);
+  audio_level_post(2);
+  audio_level_post(200);
+  CHECK(audio_level_poll(&seen, &level));
+  CHECK_EQ(level, 200);
+  CHECK(!audio_level_poll(&seen, &level));
+}
+
+#define POSTS 200000
+
+static atomic_bool producer_done;
+
+static void *producer_main(void *arg) {
+  (void)arg;
+  for (uint32_t i = 1; i <= POSTS; i++) {
+    audio_level_post((uint8_t)i);
+  }
+  atomic_store(&producer_done, true);
+  return NULL;
+}
+
+static void test_mailbox_across_threads(void) {
+  uint32_t seen = 0;
+  uint8_t level;
+  audio_level_poll(&seen, &level);
+  uint32_t base = seen;
+
+  pthread_t producer;
+  atomic_store(&producer_done, false);
+  pthread_create(&producer, NULL, producer_main, NULL);
+
+  int bad = 0;
+  uint32_t prev = base;
+  bool done = false;
+  while (!done) {
+    done = atomic_load(&producer_done);
+    if (audio_level_poll(&seen, &level)) {
+      // Counter and level come from the same post, counters only move on
+      uint32_t n = (seen - base) & 0xFFFFFF;
+      bad += level != (uint8_t)n;
+      bad += ((seen - prev) & 0xFFFFFF) == 0;
+      prev = seen;
+    }
+  }
+  pthread_join(producer, NULL);
+  CHECK_EQ(bad, 0);
+  CHECK_EQ((seen - base) & 0xFFFFFF, POSTS);
+  CHECK_EQ(level, (uint8_t)POSTS);
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_cost_per_frame(void) {
+  enum { FRAMES = 20000 };
+  int32_t env = 0;
+  uint32_t sink = 0;
+
+  fill(12000);
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int i = 0; i < FRAMES; i++) {
+    frame[i % FRAME_SAMPLES] ^= 1; // Keep the loop honest
+    uint8_t level = audio_level_update(&env, frame, FRAME_SAMPLES);
+    audio_level_post(level);
+    sink += level;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  double ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) /
+              FRAMES;
+  // A frame plays for 24 ms; the follower must stay far below that even
+  // on the device's slower core
+  printf("envelope + post: %.0f ns per %d-sample frame (sink %u)\n", ns,
+         FRAME_SAMPLES, (unsigned)sink);
+  CHECK(ns < 50000);
+}
+
+int main(void) {
+  RUN(test_silence_and_full_scale);
+  RUN(test_attack_is_instant_release_is_geometric);
+  RUN(test_decimation);
+  RUN(test_speech_fixture);
+  RUN(test_mailbox);
+  RUN(test_mailbox_across_threads);
+  RUN(test_cost_per_frame);
+  return TEST_RESULT();
+}
@@ -0,0 +1,176 @@
+/**
+ * @file test_boot_seq.c
+ * @brief boot_seq: table validation, concurrent steps in dependency order,
+ * failure propagation and the watchdog-fed timeout
+ *
+ * boot_seq_run() works once per boot, so each case is its own process.
+ */
+
+#include "boot_seq.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host.h"
+#include "metrics.h"
+#include "test_util.h"
+#include <stdatomic.h>
+
+#define STEP_MS 200
+
+typedef struct {
+  atomic_int clock;     ///< Event counter shared by the steps
+  atomic_int running;   ///< Steps inside their function now
+  atomic_int max_running;
+  int started[8];       ///< clock value at start, per step
+  int finished[8];
+  atomic_int calls;
+} trace_t;
+
+static trace_t trace;
+
+/** Step body: record start/end order and overlap, sleep @p ms */
+static esp_err_t traced(int id, uint32_t ms, esp_err_t result) {
+  trace.started[id] = atomic_fetch_add(&trace.clock, 1);
+  int now = atomic_fetch_add(&trace.running, 1) + 1;
+  int max = atomic_load(&trace.max_running);
+  while (now > max &&
+         !atomic_compare_exchange_weak(&trace.max_running, &max, now)) {
+  }
+  atomic_fetch_add(&trace.calls, 1);
+  vTaskDelay(pdMS_TO_TICKS(ms));
+  atomic_fetch_sub(&trace.running, 1);
+  trace.finished[id] = atomic_fetch_add(&trace.clock, 1);
+  return result;
+}
+
+static esp_err_t step_a(void *ctx) { return traced(0, STEP_MS, ESP_OK); }
+static esp_err_t step_b(void *ctx) { return traced(1, STEP_MS, ESP_OK); }
+static esp_err_t step_c(void *ctx) {
+  CHECK(ctx == &trace);
+  return traced(2, STEP_MS, ESP_OK);
+}
+static esp_err_t step_d(void *ctx) { return traced(3, STEP_MS, ESP_OK); }
+static esp_err_t step_fail(void *ctx) { return traced(4, STEP_MS, ESP_FAIL); }
+static esp_err_t step_slow(void *ctx) { return traced(5, 3000, ESP_OK); }
+static esp_err_t step_never(void *ctx) {
+  CHECK(!"must not run");
+  return ESP_OK;
+}
+
+static void wait_idle(void) {
+  for (int i = 0; i < 100 && host_tasks_running() > 0; i++) {
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+  CHECK_EQ(host_tasks_running(), 0);
+}
+
+// ---------------------------------------------------------------------------
+
+static void test_rejects_bad_tables(void) {
+  const boot_step_t unknown_dep[] = {
+      {"a", step_a, 0, false, 0},
+      {"b", step_b, BOOT_STEP(2), false, 0},
+  };
+  const boot_step_t no_fn[] = {
+      {"a", NULL, 0, false, 0},
+  };
+  const boot_step_t cycle[] = {
+      {"a", step_a, 0, false, 0},
+      {"b", step_b, BOOT_STEP(2), false, 0},
+      {"c", step_c, BOOT_STEP(1), false, 0},
+  };
+  const boot_step_t self_dep[] = {
+      {"a", step_a, BOOT_STEP(0), false, 0},
+  };
+  boot_step_t too_many[BOOT_SEQ_MAX_STEPS + 1];
+  for (int i = 0; i < BOOT_SEQ_MAX_STEPS + 1; i++) {
+    too_many[i] = (boot_step_t){"n", step_never, 0, false, 0};
+  }
+
+  CHECK_EQ(boot_seq_run(NULL, 1, NULL, 1000), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(boot_seq_run(unknown_dep, 0, NULL, 1000), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(boot_seq_run(unknown_dep, 2, NULL, 1000), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(boot_seq_run(no_fn, 1, NULL, 1000), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(boot_seq_run(cycle, 3, NULL, 1000), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(boot_seq_run(self_dep, 1, NULL, 1000), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(boot_seq_run(too_many, BOOT_SEQ_MAX_STEPS + 1, NULL, 1000),
+           ESP_ERR_INVALID_ARG);
+  CHECK_EQ(atomic_load(&trace.calls), 0);
+
+  // None of that used up the one run
+  CHECK_EQ(boot_seq_run(unknown_dep, 1, NULL, 1000), ESP_OK);
+  CHECK_EQ(atomic_load(&trace.calls), 1);
+  CHECK_EQ(boot_seq_run(unknown_dep, 1, NULL, 1000), ESP_ERR_INVALID_ARG);
+  wait_idle();
+}
+
+static void test_runs_in_dependency_order(void) {
+  //   a ─┐
+  //      ├─ c ── d
+  //   b ─┘
+  //   skipped (never called)
+  const boot_step_t steps[] = {
+      {"a", step_a, 0, false, 0},
+      {"b", step_b, 0, false, 0},
+      {"c", step_c, BOOT_STEP(0) | BOOT_STEP(1), false, 0},
+      {"d", step_d, BOOT_STEP(2), false, 0},
+      {"skipped", step_never, 0, true, 0},
+  };
+  int64_t t0 = esp_timer_get_time();
+  CHECK_EQ(boot_seq_run(steps, 5, &trace, 5000), ESP_OK);
+  int64_t took_ms = (esp_timer_get_time() - t0) / 1000;
+
+  CHECK_EQ(atomic_load(&trace.calls), 4);
+  CHECK_EQ(atomic_load(&trace.max_running), 2); // a and b together
+  CHECK(trace.started[2] > trace.finished[0]);
+  CHECK(trace.started[2] > trace.finished[1]);
+  CHECK(trace.started[3] > trace.finished[2]);
+  // Three steps deep; whole milliseconds on both ends
+  int32_t gauge = host_metrics_gauge(METRIC_GAUGE_BOOT_STEPS_MS);
+  CHECK(gauge >= 3 * STEP_MS && gauge <= took_ms + 1);
+
+  boot_seq_mark_wake_ready();
+  CHECK(host_metrics_gauge(METRIC_GAUGE_BOOT_WAKE_READY_MS) > 0);
+  wait_idle();
+}
+
+static void test_failure_skips_dependents(void) {
+  const boot_step_t steps[] = {
+      {"fails", step_fail, 0, false, 0},
+      {"needs_it", step_never, BOOT_STEP(0), false, 0},
+      {"needs_that", step_never, BOOT_STEP(1), false, 0},
+      {"unrelated", step_a, 0, false, 0},
+      {"after", step_b, BOOT_STEP(3), false, 0},
+  };
+  CHECK_EQ(boot_seq_run(steps, 5, NULL, 5000), ESP_FAIL);
+  // Only the unrelated chain (step_a, then step_b) ran after it
+  CHECK_EQ(atomic_load(&trace.calls), 3);
+  CHECK(trace.started[1] > trace.finished[0]);
+  wait_idle();
+}
+
+static void test_timeout_feeds_watchdog(void) {
+  const boot_step_t steps[] = {
+      {"slow", step_slow, 0, false, 0},
+      {"after", step_a, BOOT_STEP(0), false, 0},
+  };
+  uint32_t feeds = host_wdt_feeds();
+  // Two and a half wait slices, each started with a feed, and one at the end
+  CHECK_EQ(boot_seq_run(steps, 2, NULL, 2500), ESP_ERR_TIMEOUT);
+  CHECK_EQ(host_wdt_feeds() - feeds, 4);
+  CHECK_EQ(atomic_load(&trace.calls), 1);
+
+  // The steps were left running and still finish
+  wait_idle();
+  CHECK_EQ(atomic_load(&trace.calls), 2);
+}
+
+int main(int argc, char **argv) {
+  static const test_case_t cases[] = {
+      {"bad_tables", test_rejects_bad_tables},
+      {"order", test_runs_in_dependency_order},
+      {"failure", test_failure_skips_dependents},
+      {"timeout", test_timeout_feeds_watchdog},
+  };
+  return run_case(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
@@ -0,0 +1,253 @@
+/**
+ * @file test_flight_recorder.c
+ * @brief flight_recorder: persisted record format, wraparound, adoption of
+ * the previous boot's ring and task table, the MQTT summary, and readers
+ * racing writers on other threads
+ *
+ * The store is a plain static on the host; calling flight_recorder_init()
+ * again is the next boot finding it intact.
+ */
+
+#include "flight_recorder.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+static fr_record_t records[FLIGHT_RECORDER_ENTRIES];
+
+// -----------------------------------------------------------------------------
+
+static void test_record_format(void) {
+  // Persisted across a reset: a layout change breaks the next boot's read
+  CHECK_EQ(sizeof(fr_record_t), 16);
+  CHECK_EQ(offsetof(fr_record_t, seq), 0);
+  CHECK_EQ(offsetof(fr_record_t, ts_ms), 4);
+  CHECK_EQ(offsetof(fr_record_t, event), 8);
+  CHECK_EQ(offsetof(fr_record_t, b), 10);
+  CHECK_EQ(offsetof(fr_record_t, a), 12);
+  CHECK_EQ(sizeof(fr_task_t), 24);
+
+  CHECK_EQ(FR_EV_BOOT, 0);
+  CHECK_EQ(FR_EV_SOFT_REBOOT, 23);
+  for (int e = 0; e < FR_EV_COUNT; e++) {
+    CHECK(flight_recorder_event_name(e) != NULL);
+    CHECK(strcmp(flight_recorder_event_name(e), "?") != 0);
+  }
+  CHECK_STR(flight_recorder_event_name(FR_EV_HA_RUN_START), "ha_run_start");
+  CHECK_STR(flight_recorder_event_name(FR_EV_COUNT), "?");
+}
+
+static void test_fresh_boot(void) {
+  host_set_reset_reason(ESP_RST_POWERON);
+  CHECK_EQ(flight_recorder_init(), ESP_OK);
+
+  fr_boot_info_t info;
+  CHECK(!flight_recorder_previous(&info));
+  CHECK_EQ(flight_recorder_read(true, records, FLIGHT_RECORDER_ENTRIES), 0);
+
+  CHECK_EQ(flight_recorder_read(false, records, FLIGHT_RECORDER_ENTRIES), 1);
+  CHECK_EQ(records[0].seq, 0);
+  CHECK_EQ(records[0].event, FR_EV_BOOT);
+  CHECK_EQ(records[0].a, ESP_RST_POWERON);
+
+  char summary[128];
+  flight_recorder_summary(summary, sizeof(summary));
+  CHECK_STR(summary, "Power On: no flight record");
+}
+
+static void test_wraparound(void) {
+  // Boot record plus 299: the ring keeps the newest 128
+  for (uint32_t i = 1; i < 300; i++) {
+    flight_recorder_log(FR_EV_PIPE_CMD, i, (uint16_t)(i * 7));
+  }
+  size_t n = flight_recorder_read(false, records, FLIGHT_RECORDER_ENTRIES);
+  CHECK_EQ(n, FLIGHT_RECORDER_ENTRIES);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t seq = 300 - FLIGHT_RECORDER_ENTRIES + i;
+    CHECK_EQ(records[i].seq, seq);
+    CHECK_EQ(records[i].event, FR_EV_PIPE_CMD);
+    CHECK_EQ(records[i].a, seq);
+    CHECK_EQ(records[i].b, (uint16_t)(seq * 7));
+  }
+  CHECK(records[0].ts_ms <= records[n - 1].ts_ms);
+
+  // A short buffer gets the oldest records
+  CHECK_EQ(flight_recorder_read(false, records, 3), 3);
+  CHECK_EQ(records[0].seq, 300 - FLIGHT_RECORDER_ENTRIES);
+  CHECK_EQ(records[2].seq, 300 - FLIGHT_RECORDER_ENTRIES + 2);
+}
+
+static void test_survives_reset(void) {
+  fr_task_t tasks[FLIGHT_RECORDER_TASKS + 4] = {
+      {"voice_pipe", 'B', 1, 120, 2048},
+      {"ha_ws", 'R', 0, 640, 812},
+  };
+  flight_recorder_set_tasks(tasks, 2);
+  flight_recorder_log(FR_EV_HEAP, 41 * 1024, 4096);
+  flight_recorder_log(FR_EV_HA_RUN_START, 0, 0);
+  flight_recorder_log(FR_EV_PIPE_STREAM, 1, 1);
+  flight_recorder_log(FR_EV_PIPE_CMD, 0, 3);
+  flight_recorder_log(FR_EV_HEAP, 40 * 1024, 4000);
+  flight_recorder_log(FR_EV_HA_STT_END, 0, 0);
+  flight_recorder_log(FR_EV_STALL, 9000, 2);
+
+  // The task watchdog resets the chip; the next boot adopts the store
+  host_time_advance_ms(812 * 1000);
+  host_set_reset_reason(ESP_RST_TASK_WDT);
+  CHECK_EQ(flight_recorder_init(), ESP_OK);
+
+  fr_boot_info_t info;
+  CHECK(flight_recorder_previous(&info));
+  CHECK_EQ(info.boot_id, 0);
+  CHECK_EQ(info.reset_reason, ESP_RST_TASK_WDT);
+  CHECK_EQ(info.records, FLIGHT_RECORDER_ENTRIES);
+  CHECK_EQ(info.tasks, 2);
+
+  CHECK_EQ(flight_recorder_read(true, records, FLIGHT_RECORDER_ENTRIES),
+           FLIGHT_RECORDER_ENTRIES);
+  fr_record_t *last = &records[FLIGHT_RECORDER_ENTRIES - 1];
+  CHECK_EQ(last->seq, 306);
+  CHECK_EQ(last->event, FR_EV_STALL);
+  CHECK_EQ(last->a, 9000);
+  CHECK_EQ(last->b, 2);
+  CHECK_EQ(info.uptime_ms, last->ts_ms);
+
+  fr_task_t out[FLIGHT_RECORDER_TASKS];
+  CHECK_EQ(flight_recorder_read_tasks(true, out, FLIGHT_RECORDER_TASKS), 2);
+  CHECK_STR(out[0].name, "voice_pipe");
+  CHECK_EQ(out[1].cpu_permille, 640);
+  CHECK_EQ(flight_recorder_read_tasks(false, out, FLIGHT_RECORDER_TASKS), 0);
+
+  // This boot starts over with its own boot record
+  CHECK_EQ(flight_recorder_read(false, records, FLIGHT_RECORDER_ENTRIES), 1);
+  CHECK_EQ(records[0].seq, 0);
+  CHECK_EQ(records[0].a, ESP_RST_TASK_WDT);
+
+  // Last four transitions and the latest heap sample
+  char expect[128];
+  snprintf(expect, sizeof(expect),
+           "Task WDT (Hang) after %lus: pipe_stream pipe_cmd:3 ha_stt_end "
+           "stall, heap 40K/4000K",
+           (unsigned long)(info.uptime_ms / 1000));
+  char summary[128];
+  flight_recorder_summary(summary, sizeof(summary));
+  CHECK_STR(summary, expect);
+
+  // Truncated, still terminated
+  flight_recorder_summary(summary, 20);
+  CHECK_EQ(strlen(summary), 19);
+
+  // More tasks than the table holds are cut
+  flight_recorder_set_tasks(tasks, FLIGHT_RECORDER_TASKS + 4);
+  CHECK_EQ(flight_recorder_read_tasks(false, out, FLIGHT_RECORDER_TASKS),
+           FLIGHT_RECORDER_TASKS);
+
+  // A second reset: boot ids count up
+  CHECK_EQ(flight_recorder_init(), ESP_OK);
+  CHECK(flight_recorder_previous(&info));
+  CHECK_EQ(info.boot_id, 1);
+  CHECK_EQ(info.records, 1);
+  CHECK_EQ(info.tasks, FLIGHT_RECORDER_TASKS);
+}
+
+// -----------------------------------------------------------------------------
+// Writers on both cores while /api/flight copies the ring
+
+#define WRITERS 4
+#define WRITES 50000
+
+static atomic_int writers_running;
+
+/** Derive the rest of a record from a, so a torn copy is visible */
+static uint16_t b_of(uint32_t a) {
+  return (uint16_t)((a * 2654435761u) >> 16);
+}
+static uint16_t event_of(uint32_t a) { return FR_EV_PIPE_CMD + a % 8; }
+
+static void *writer_main(void *arg) {
+  uint32_t base = (uint32_t)(uintptr_t)arg * WRITES;
+  for (uint32_t i = 0; i < WRITES; i++) {
+    uint32_t a = base + i;
+    flight_recorder_log(event_of(a), a, b_of(a));
+  }
+  atomic_fetch_sub(&writers_running, 1);
+  return NULL;
+}
+
+static bool record_whole(const fr_record_t *r) {
+  return r->event == event_of(r->a) && r->b == b_of(r->a);
+}
+
+static void test_readers_never_see_torn_records(void) {
+  static fr_record_t snap[FLIGHT_RECORDER_ENTRIES];
+  CHECK_EQ(flight_recorder_init(), ESP_OK);
+  flight_recorder_read(false, records, 1); // Boot record, not from a writer
+  uint32_t boot_a = records[0].a;
+
+  pthread_t threads[WRITERS];
+  atomic_store(&writers_running, WRITERS);
+  for (int i = 0; i < WRITERS; i++) {
+    pthread_create(&threads[i], NULL, writer_main, (void *)(uintptr_t)i);
+  }
+
+  int torn = 0;
+  int reads = 0;
+  bool done = false;
+  while (!done) {
+    done = atomic_load(&writers_running) == 0;
+    size_t n = flight_recorder_read(false, snap, FLIGHT_RECORDER_ENTRIES);
+    for (size_t i = 0; i < n; i++) {
+      if (i > 0 && snap[i].seq <= snap[i - 1].seq) {
+        torn++; // Oldest first, each sequence once
+      }
+      if (snap[i].seq == 0 ? snap[i].a != boot_a : !record_whole(&snap[i])) {
+        torn++;
+      }
+    }
+    reads++;
+  }
+  for (int i = 0; i < WRITERS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  CHECK_EQ(torn, 0);
+  CHECK(reads > 0);
+
+  // Once the writers are finished the ring is whole again
+  size_t n = flight_recorder_read(false, snap, FLIGHT_RECORDER_ENTRIES);
+  CHECK(n > 0);
+  CHECK(snap[n - 1].seq > WRITERS * WRITES - FLIGHT_RECORDER_ENTRIES);
+  for (size_t i = 0; i < n; i++) {
+    CHECK(record_whole(&snap[i]));
+  }
+}
+
+static void test_heap_sampler(void) {
+  CHECK_EQ(flight_recorder_start(10), ESP_OK);
+  CHECK_EQ(flight_recorder_start(10), ESP_OK); // Already running
+  vTaskDelay(pdMS_TO_TICKS(60));
+
+  size_t n = flight_recorder_read(false, records, FLIGHT_RECORDER_ENTRIES);
+  int heap = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (records[i].event == FR_EV_HEAP) {
+      CHECK_EQ(records[i].a, 256 * 1024); // Host heap figures
+      CHECK_EQ(records[i].b, 8 * 1024);
+      heap++;
+    }
+  }
+  CHECK(heap >= 2);
+}
+
+int main(void) {
+  RUN(test_record_format);
+  RUN(test_fresh_boot);
+  RUN(test_wraparound);
+  RUN(test_survives_reset);
+  RUN(test_readers_never_see_torn_records);
+  RUN(test_heap_sampler);
+  return TEST_RESULT();
+}
@@ -0,0 +1,397 @@
+/**
+ * @file test_ha_entities.c
+ * @brief ha_entities: snapshots, diffs and removals in HA's compressed
+ * subscribe_entities form, lookups, string escapes, limits and string pool
+ * compaction
+ */
+
+#include "ha_entities.h"
+#include "host.h"
+#include "metrics.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static esp_err_t apply(const char *json) {
+  return ha_entities_apply(json, strlen(json));
+}
+
+static ha_entities_stats_t stats(void) {
+  ha_entities_stats_t st;
+  ha_entities_get_stats(&st);
+  return st;
+}
+
+static void expect_entity(const char *id, const char *name, const char *state,
+                          ha_state_t code) {
+  ha_entity_t e;
+  CHECK(ha_entities_get(id, &e));
+  CHECK_STR(e.entity_id, id);
+  CHECK_STR(e.name, name);
+  CHECK_STR(e.state, state);
+  CHECK_EQ(e.code, code);
+}
+
+static const char snapshot[] =
+    "{\"a\":{"
+    "\"light.kitchen\":{\"s\":\"on\",\"a\":{\"friendly_name\":\"Kitchen\","
+    "\"brightness\":200,\"rgb\":[255,128,0]},\"c\":\"01HX\","
+    "\"lc\":1700000000.25,\"lu\":1700000001.5},"
+    "\"light.hall\":{\"s\":\"off\",\"a\":{\"friendly_name\":\"Hall\"},"
+    "\"lc\":1700000100},"
+    "\"light.desk\":{\"s\":\"on\",\"a\":{},\"lc\":1700000200},"
+    "\"sensor.outside\":{\"s\":\"12.5\",\"a\":{\"friendly_name\":"
+    "\"Outside temperature\",\"unit\":\"\\u00b0C\",\"extra\":null}},"
+    "\"switch.kitchen_fan\":{\"s\":\"unavailable\",\"a\":{\"friendly_name\":"
+    "\"Kitchen fan\"}}"
+    "}}";
+
+// ---------------------------------------------------------------------------
+
+static void test_before_init(void) {
+  CHECK_EQ(apply("{\"a\":{}}"), ESP_ERR_INVALID_STATE);
+  CHECK(!ha_entities_get("light.kitchen", NULL));
+  CHECK_EQ(ha_entities_find(NULL, NULL, NULL, 0), 0);
+  CHECK(!ha_entities_last_changed(NULL));
+  ha_entities_clear();
+  CHECK_EQ(stats().entities, 0);
+  CHECK_EQ(stats().pool_size, 0);
+}
+
+static void test_snapshot(void) {
+  ha_entity_t e;
+  CHECK_EQ(apply(snapshot), ESP_OK);
+
+  expect_entity("light.kitchen", "Kitchen", "on", HA_STATE_ON);
+  expect_entity("light.hall", "Hall", "off", HA_STATE_OFF);
+  expect_entity("light.desk", "", "on", HA_STATE_ON);
+  expect_entity("sensor.outside", "Outside temperature", "12.5",
+                HA_STATE_TEXT);
+  expect_entity("switch.kitchen_fan", "Kitchen fan", "unavailable",
+                HA_STATE_UNAVAILABLE);
+  CHECK(ha_entities_get("light.kitchen", &e));
+  CHECK_EQ(e.last_changed, 1700000000);
+  CHECK(!ha_entities_get("light.kitche", NULL));
+  CHECK(!ha_entities_get("light.kitchen2", NULL));
+  CHECK(!ha_entities_get(NULL, NULL));
+
+  ha_entities_stats_t st = stats();
+  CHECK_EQ(st.entities, 5);
+  CHECK_EQ(st.lights_on, 2);
+  CHECK_EQ(st.messages, 1);
+  CHECK_EQ(st.errors, 0);
+  CHECK_EQ(st.dropped, 0);
+  CHECK_EQ(host_metrics_gauge(METRIC_GAUGE_HA_ENTITIES), 5);
+  // A snapshot is not a change
+  CHECK(!ha_entities_last_changed(NULL));
+}
+
+static void test_diff(void) {
+  ha_entity_t e;
+  CHECK_EQ(apply("{\"c\":{\"light.hall\":{\"+\":{\"s\":\"on\","
+                 "\"lc\":1700000500.9}}}}"),
+           ESP_OK);
+  expect_entity("light.hall", "Hall", "on", HA_STATE_ON);
+  CHECK(ha_entities_last_changed(&e));
+  CHECK_STR(e.entity_id, "light.hall");
+  CHECK_EQ(e.last_changed, 1700000500);
+  CHECK_EQ(stats().lights_on, 3);
+
+  // Attribute-only diffs leave the state and the last change alone
+  CHECK_EQ(apply("{\"c\":{\"light.kitchen\":{\"+\":{\"a\":{\"brightness\":"
+                 "10,\"friendly_name\":\"Kitchen ceiling\"}}}}}"),
+           ESP_OK);
+  expect_entity("light.kitchen", "Kitchen ceiling", "on", HA_STATE_ON);
+  CHECK(ha_entities_last_changed(&e));
+  CHECK_STR(e.entity_id, "light.hall");
+
+  // Same state again is not a change either
+  CHECK_EQ(apply("{\"c\":{\"light.kitchen\":{\"+\":{\"s\":\"on\"}}}}"),
+           ESP_OK);
+  CHECK(ha_entities_last_changed(&e));
+  CHECK_STR(e.entity_id, "light.hall");
+
+  // A removed friendly_name falls back to the id for lookups
+  CHECK_EQ(apply("{\"c\":{\"switch.kitchen_fan\":{\"+\":{\"s\":\"off\"},"
+                 "\"-\":{\"a\":[\"icon\",\"friendly_name\"]}}}}"),
+           ESP_OK);
+  expect_entity("switch.kitchen_fan", "", "off", HA_STATE_OFF);
+  CHECK(ha_entities_last_changed(&e));
+  CHECK_STR(e.entity_id, "switch.kitchen_fan");
+
+  // friendly_name: null clears it as well
+  CHECK_EQ(apply("{\"c\":{\"light.hall\":{\"+\":{\"a\":{\"friendly_name\":"
+                 "null}}}}}"),
+           ESP_OK);
+  expect_entity("light.hall", "", "on", HA_STATE_ON);
+
+  // A diff for an unknown entity adds it
+  CHECK_EQ(apply("{\"c\":{\"lock.front\":{\"+\":{\"s\":\"locked\"}}}}"),
+           ESP_OK);
+  expect_entity("lock.front", "", "locked", HA_STATE_LOCKED);
+  CHECK_EQ(stats().entities, 6);
+}
+
+static void test_snapshot_replaces_attributes(void) {
+  // A snapshot entry without friendly_name means it is gone
+  CHECK_EQ(apply("{\"a\":{\"light.kitchen\":{\"s\":\"off\",\"a\":{}}}}"),
+           ESP_OK);
+  expect_entity("light.kitchen", "", "off", HA_STATE_OFF);
+  CHECK_EQ(stats().lights_on, 2);
+}
+
+static void test_remove(void) {
+  ha_entity_t e;
+  CHECK(ha_entities_last_changed(&e));
+  CHECK_STR(e.entity_id, "lock.front");
+
+  CHECK_EQ(apply("{\"r\":[\"lock.front\",\"light.desk\",\"light.none\"]}"),
+           ESP_OK);
+  CHECK(!ha_entities_get("lock.front", NULL));
+  CHECK(!ha_entities_get("light.desk", NULL));
+  CHECK(!ha_entities_last_changed(NULL));
+  CHECK_EQ(stats().entities, 4);
+  CHECK_EQ(host_metrics_gauge(METRIC_GAUGE_HA_ENTITIES), 4);
+
+  // The rest of the probe chains still resolve
+  expect_entity("light.hall", "", "on", HA_STATE_ON);
+  expect_entity("light.kitchen", "", "off", HA_STATE_OFF);
+  expect_entity("sensor.outside", "Outside temperature", "12.5",
+                HA_STATE_TEXT);
+  expect_entity("switch.kitchen_fan", "", "off", HA_STATE_OFF);
+
+  // And a removed id can come back
+  CHECK_EQ(apply("{\"a\":{\"light.desk\":{\"s\":\"off\"}}}"), ESP_OK);
+  expect_entity("light.desk", "", "off", HA_STATE_OFF);
+
+  ha_entities_clear();
+  CHECK_EQ(stats().entities, 0);
+  CHECK_EQ(stats().pool_used, 1);
+  CHECK(!ha_entities_get("light.desk", NULL));
+  CHECK_EQ(host_metrics_gauge(METRIC_GAUGE_HA_ENTITIES), 0);
+}
+
+static void test_find(void) {
+  ha_entity_t out[2];
+  ha_entities_clear();
+  CHECK_EQ(apply(snapshot), ESP_OK);
+
+  CHECK_EQ(ha_entities_find("light", NULL, NULL, 0), 3);
+  CHECK_EQ(ha_entities_find("light", "KITCH", out, 2), 1);
+  CHECK_STR(out[0].entity_id, "light.kitchen");
+  CHECK_STR(out[0].name, "Kitchen");
+  // Without a name the id is matched
+  CHECK_EQ(ha_entities_find("light", "desk", out, 2), 1);
+  CHECK_STR(out[0].entity_id, "light.desk");
+  CHECK_EQ(ha_entities_find(NULL, "kitchen", NULL, 0), 2);
+  CHECK_EQ(ha_entities_find("switch", "fan", out, 2), 1);
+  CHECK_EQ(out[0].code, HA_STATE_UNAVAILABLE);
+  // Whole domains only
+  CHECK_EQ(ha_entities_find("ligh", NULL, NULL, 0), 0);
+  CHECK_EQ(ha_entities_find("cover", NULL, NULL, 0), 0);
+  // More matches than room
+  CHECK_EQ(ha_entities_find(NULL, NULL, out, 2), 5);
+  CHECK(out[0].entity_id[0] != '\0' && out[1].entity_id[0] != '\0');
+}
+
+static void test_escapes_and_truncation(void) {
+  ha_entities_clear();
+  CHECK_EQ(apply("{\"a\":{\"sensor.cafe\":{\"s\":\"Caf\\u00e9 \\\"ok\\\"\","
+                 "\"a\":{\"friendly_name\":\"Bulb \\ud83d\\udca1\\t\\\\/"
+                 "\\/\"}}}}"),
+           ESP_OK);
+  expect_entity("sensor.cafe", "Bulb \xf0\x9f\x92\xa1\t\\//",
+                "Caf\xc3\xa9 \"ok\"", HA_STATE_TEXT);
+
+  // Long names and states are cut on a character boundary: 22 letters and
+  // an "é" are one byte more than a state holds
+  CHECK_EQ(apply("{\"c\":{\"sensor.cafe\":{\"+\":{\"s\":"
+                 "\"abcdefghijklmnopqrstuv\\u00e9xyz\","
+                 "\"a\":{\"friendly_name\":"
+                 "\"0123456789012345678901234567890123456789012345\xc3\xa9"
+                 "tail\"}}}}}"),
+           ESP_OK);
+  expect_entity("sensor.cafe", "0123456789012345678901234567890123456789012345",
+                "abcdefghijklmnopqrstuv", HA_STATE_TEXT);
+
+  // Raw UTF-8 in the input is cut the same way
+  CHECK_EQ(apply("{\"c\":{\"sensor.cafe\":{\"+\":{\"s\":"
+                 "\"abcdefghijklmnopqrstu\xc3\xa9\xc3\xa9\"}}}}"),
+           ESP_OK);
+  expect_entity("sensor.cafe", "0123456789012345678901234567890123456789012345",
+                "abcdefghijklmnopqrstu\xc3\xa9", HA_STATE_TEXT);
+}
+
+static void test_long_ids(void) {
+  char json[256], id[HA_ENTITY_ID_LEN + 1];
+  ha_entities_clear();
+  uint32_t dropped = stats().dropped;
+
+  memset(id, 'x', sizeof(id) - 1);
+  memcpy(id, "sensor.", 7);
+  id[HA_ENTITY_ID_LEN - 1] = '\0'; // Longest that fits
+  snprintf(json, sizeof(json), "{\"a\":{\"%s\":{\"s\":\"1\"}}}", id);
+  CHECK_EQ(apply(json), ESP_OK);
+  CHECK(ha_entities_get(id, NULL));
+
+  id[HA_ENTITY_ID_LEN - 1] = 'y';
+  id[HA_ENTITY_ID_LEN] = '\0';
+  snprintf(json, sizeof(json),
+           "{\"a\":{\"%s\":{\"s\":\"2\"},\"sensor.ok\":{\"s\":\"3\"}}}", id);
+  CHECK_EQ(apply(json), ESP_OK);
+  CHECK(!ha_entities_get(id, NULL));
+  CHECK(ha_entities_get("sensor.ok", NULL));
+  CHECK_EQ(stats().dropped - dropped, 1);
+
+  // Removing one is a no-op, not an error
+  snprintf(json, sizeof(json), "{\"r\":[\"%s\"]}", id);
+  CHECK_EQ(apply(json), ESP_OK);
+  CHECK_EQ(stats().entities, 2);
+  CHECK_EQ(apply("{\"a\":{\"\":{\"s\":\"on\"}}}"), ESP_OK);
+  CHECK_EQ(stats().dropped - dropped, 2);
+}
+
+static void test_malformed(void) {
+  static const char *const bad[] = {
+      "",
+      "[]",
+      "{\"a\":",
+      "{\"a\":{\"light.x\":{\"s\":\"on\"}",
+      "{\"a\":{\"light.x\":{\"s\":on}}}",
+      "{\"a\":{\"light.x\" {\"s\":\"on\"}}}",
+      "{\"c\":{\"light.x\":{\"+\":{\"s\":\"o\\u12\"}}}}",
+      "{\"c\":{\"light.x\":{\"-\":{\"a\":[\"friendly_name\"}}}}",
+      "{\"r\":[\"light.x\",]",
+      "{\"r\":[1]}",
+      "{\"x\":[1,{\"y\":\"}]}\"}",
+  };
+  ha_entities_clear();
+  uint32_t errors = stats().errors;
+  uint32_t messages = stats().messages;
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    if (apply(bad[i]) != ESP_ERR_INVALID_ARG) {
+      CHECK_STR(bad[i], "rejected");
+    }
+  }
+  CHECK_EQ(stats().errors - errors, sizeof(bad) / sizeof(bad[0]));
+  CHECK_EQ(stats().messages, messages);
+
+  // Entities ahead of the error are kept
+  CHECK_EQ(apply("{\"a\":{\"light.a\":{\"s\":\"on\"},\"light.b\":{\"s\":"),
+           ESP_ERR_INVALID_ARG);
+  CHECK(ha_entities_get("light.a", NULL));
+  CHECK(!ha_entities_get("light.b", NULL));
+
+  // The length bounds the scan, not the terminator
+  const char *msg = "{\"a\":{\"light.c\":{\"s\":\"on\"}}}";
+  CHECK_EQ(ha_entities_apply(msg, strlen(msg) - 1), ESP_ERR_INVALID_ARG);
+  // Unknown keys are skipped and trailing bytes ignored
+  CHECK_EQ(apply("{\"v\":{\"x\":[1,2,{\"y\":null}]},\"a\":{\"light.c\":"
+                 "{\"s\":\"off\",\"n\":true}}} trailing"),
+           ESP_OK);
+  expect_entity("light.c", "", "off", HA_STATE_OFF);
+}
+
+static void test_table_full(void) {
+  const size_t per = 40;
+  char *json = malloc((HA_ENTITIES_MAX + 1) * per + 16);
+  CHECK(json != NULL);
+  ha_entities_clear();
+  uint32_t dropped = stats().dropped;
+
+  size_t n = sprintf(json, "{\"a\":{");
+  for (int i = 0; i <= HA_ENTITIES_MAX; i++) {
+    n += sprintf(json + n, "%s\"switch.s%d\":{\"s\":\"%s\"}", i ? "," : "",
+                 i, i % 2 ? "on" : "off");
+  }
+  strcpy(json + n, "}}");
+  CHECK_EQ(apply(json), ESP_OK);
+  free(json);
+
+  CHECK_EQ(stats().entities, HA_ENTITIES_MAX);
+  CHECK_EQ(stats().dropped - dropped, 1);
+  expect_entity("switch.s0", "", "off", HA_STATE_OFF);
+  expect_entity("switch.s2047", "", "on", HA_STATE_ON);
+  CHECK(!ha_entities_get("switch.s2048", NULL));
+  CHECK_EQ(ha_entities_find("switch", "s204", NULL, 0), 9);
+
+  // A removal makes room again
+  CHECK_EQ(apply("{\"r\":[\"switch.s7\"]}"), ESP_OK);
+  CHECK_EQ(apply("{\"a\":{\"switch.s2048\":{\"s\":\"on\"}}}"), ESP_OK);
+  expect_entity("switch.s2048", "", "on", HA_STATE_ON);
+  int found = 0;
+  for (int i = 0; i < HA_ENTITIES_MAX; i++) {
+    char id[32];
+    snprintf(id, sizeof(id), "switch.s%d", i);
+    found += ha_entities_get(id, NULL);
+  }
+  CHECK_EQ(found, HA_ENTITIES_MAX - 1);
+  CHECK(!ha_entities_get("switch.s7", NULL));
+}
+
+static void test_pool_compaction(void) {
+  char json[256], id[HA_ENTITY_ID_LEN];
+  ha_entities_clear();
+  CHECK_EQ(apply(snapshot), ESP_OK);
+  ha_entities_stats_t st = stats();
+  uint32_t base = st.pool_used;
+  uint32_t compactions = st.compactions;
+  uint32_t dropped = st.dropped;
+
+  // Churn long ids through the pool until it has to be rebuilt
+  for (int i = 0; i < 4000 && stats().compactions == compactions; i++) {
+    snprintf(id, sizeof(id), "sensor.churn_%050d", i);
+    snprintf(json, sizeof(json),
+             "{\"a\":{\"%s\":{\"s\":\"on\",\"a\":{\"friendly_name\":"
+             "\"Churn %d\"}}}}",
+             id, i);
+    CHECK_EQ(apply(json), ESP_OK);
+    snprintf(json, sizeof(json), "{\"r\":[\"%s\"]}", id);
+    CHECK_EQ(apply(json), ESP_OK);
+  }
+  st = stats();
+  CHECK_EQ(st.compactions - compactions, 1);
+  CHECK(st.pool_used < st.pool_size / 2);
+  CHECK_EQ(st.entities, 5);
+  CHECK_EQ(st.dropped, dropped);
+
+  // Everything that lived through it moved intact
+  expect_entity("light.kitchen", "Kitchen", "on", HA_STATE_ON);
+  expect_entity("sensor.outside", "Outside temperature", "12.5",
+                HA_STATE_TEXT);
+  expect_entity("switch.kitchen_fan", "Kitchen fan", "unavailable",
+                HA_STATE_UNAVAILABLE);
+  CHECK_EQ(ha_entities_find(NULL, "kitchen", NULL, 0), 2);
+
+  // Renames churn the pool too
+  for (int i = 0; i < 3000 && stats().compactions == compactions + 1; i++) {
+    snprintf(json, sizeof(json),
+             "{\"c\":{\"light.hall\":{\"+\":{\"a\":{\"friendly_name\":"
+             "\"Hall %040d\"}}}}}",
+             i);
+    CHECK_EQ(apply(json), ESP_OK);
+  }
+  CHECK_EQ(stats().compactions - compactions, 2);
+  ha_entity_t e;
+  CHECK(ha_entities_get("light.hall", &e));
+  CHECK(strncmp(e.name, "Hall 000", 8) == 0);
+  CHECK(stats().pool_used - base < 256);
+}
+
+int main(void) {
+  RUN(test_before_init);
+  CHECK_EQ(ha_entities_init(), ESP_OK);
+  CHECK_EQ(ha_entities_init(), ESP_OK);
+  CHECK_EQ(stats().pool_size, 96 * 1024);
+  RUN(test_snapshot);
+  RUN(test_diff);
+  RUN(test_snapshot_replaces_attributes);
+  RUN(test_remove);
+  RUN(test_find);
+  RUN(test_escapes_and_truncation);
+  RUN(test_long_ids);
+  RUN(test_malformed);
+  RUN(test_table_full);
+  RUN(test_pool_compaction);
+  return TEST_RESULT();
+}
@@ -0,0 +1,252 @@
+/**
+ * @file test_ha_events.c
+ * @brief ha_events: reassembly of chunked frames, size limits and stray
+ * chunks, arrival order, a slow handler not holding up the receiver, and a
+ * full queue blocking the receiver for its bound before dropping
+ */
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "ha_events.h"
+#include "host.h"
+#include "metrics.h"
+#include "test_util.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LIMIT 4096
+#define MAX_SEEN 64
+
+typedef struct {
+  char json[256];
+  size_t len;
+  uint32_t session;
+  int64_t handled_us;
+} seen_t;
+
+static seen_t seen[MAX_SEEN];
+static atomic_int handled = 0;
+static atomic_int idle_calls = 0;
+static atomic_int handler_ms = 0; // Simulated callback time
+static SemaphoreHandle_t gate = NULL; // Taken by the handler when set
+static atomic_bool gated = false;
+
+static void handler(const ha_event_msg_t *msg) {
+  if (atomic_load(&gated)) {
+    xSemaphoreTake(gate, portMAX_DELAY);
+  }
+  if (atomic_load(&handler_ms)) {
+    vTaskDelay(pdMS_TO_TICKS(atomic_load(&handler_ms)));
+  }
+  int n = atomic_load(&handled);
+  if (n < MAX_SEEN) {
+    CHECK_EQ(strlen(msg->json), msg->len);
+    snprintf(seen[n].json, sizeof(seen[n].json), "%s", msg->json);
+    seen[n].len = msg->len;
+    seen[n].session = msg->session;
+    seen[n].handled_us = esp_timer_get_time();
+  }
+  atomic_store(&handled, n + 1);
+}
+
+static TickType_t idle(void) {
+  atomic_fetch_add(&idle_calls, 1);
+  return pdMS_TO_TICKS(10);
+}
+
+static void wait_handled(int n) {
+  for (int i = 0; i < 5000 && atomic_load(&handled) < n; i++) {
+    vTaskDelay(1);
+  }
+  CHECK_EQ(atomic_load(&handled), n);
+}
+
+/** One message in one frame */
+static void receive(const char *json, uint32_t session) {
+  ha_events_receive(json, strlen(json), (int)strlen(json), 0, LIMIT,
+                    session);
+}
+
+static void reset(void) {
+  wait_handled(atomic_load(&handled));
+  atomic_store(&handled, 0);
+  memset(seen, 0, sizeof(seen));
+  host_metrics_reset();
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_start(void) {
+  CHECK_EQ(ha_events_start(NULL, NULL), ESP_ERR_INVALID_ARG);
+  receive("{\"before\":1}", 1); // No queue yet: ignored
+  gate = xSemaphoreCreateCounting(64, 0);
+  CHECK(gate != NULL);
+  CHECK_EQ(ha_events_start(handler, idle), ESP_OK);
+  CHECK_EQ(ha_events_start(handler, idle), ESP_OK);
+  vTaskDelay(pdMS_TO_TICKS(50));
+  CHECK_EQ(atomic_load(&handled), 0);
+  // Between messages the handler task polls (pings)
+  CHECK(atomic_load(&idle_calls) >= 3);
+}
+
+static void test_single_frame(void) {
+  reset();
+  receive("{\"type\":\"auth_ok\"}", 7);
+  // esp_websocket_client reports 0 for a frame it did not split
+  ha_events_receive("{\"id\":2}", 8, 0, 0, LIMIT, 8);
+  wait_handled(2);
+  CHECK_STR(seen[0].json, "{\"type\":\"auth_ok\"}");
+  CHECK_EQ(seen[0].session, 7);
+  CHECK_STR(seen[1].json, "{\"id\":2}");
+  CHECK_EQ(seen[1].session, 8);
+  CHECK_EQ(host_metrics_observations(METRIC_HIST_HA_EVENT_DISPATCH), 2);
+}
+
+static void test_reassembly(void) {
+  char msg[200];
+  reset();
+  for (int i = 0; i < 199; i++) {
+    msg[i] = (char)('a' + i % 26);
+  }
+  msg[199] = '\0';
+  for (int off = 0; off < 199; off += 64) {
+    int n = 199 - off < 64 ? 199 - off : 64;
+    ha_events_receive(msg + off, n, 199, off, LIMIT, 3);
+    if (off + n < 199) {
+      vTaskDelay(pdMS_TO_TICKS(5));
+      CHECK_EQ(atomic_load(&handled), 0); // Not before the last chunk
+    }
+  }
+  wait_handled(1);
+  CHECK_EQ(seen[0].len, 199);
+  CHECK_STR(seen[0].json, msg);
+}
+
+static void test_too_large(void) {
+  static char big[LIMIT + 200];
+  reset();
+  memset(big, 'x', sizeof(big));
+  ha_events_receive(big, 1000, sizeof(big), 0, LIMIT, 1);
+  CHECK_EQ(metrics_get(METRIC_HA_EVENTS_DROPPED), 1);
+  // The rest of it must not start a message
+  ha_events_receive(big, 1000, sizeof(big), 1000, LIMIT, 1);
+  ha_events_receive(big, sizeof(big) - 2000, sizeof(big), 2000, LIMIT, 1);
+  receive("{\"after\":1}", 1);
+  wait_handled(1);
+  CHECK_STR(seen[0].json, "{\"after\":1}");
+
+  // A larger limit (the entity snapshot) takes it
+  big[sizeof(big) - 1] = '\0';
+  ha_events_receive(big, sizeof(big) - 1, 0, 0, sizeof(big), 1);
+  wait_handled(2);
+  CHECK_EQ(seen[1].len, sizeof(big) - 1);
+  CHECK_EQ(metrics_get(METRIC_HA_EVENTS_DROPPED), 1);
+}
+
+static void test_stray_chunks(void) {
+  const char *msg = "{\"type\":\"event\",\"event\":{}}";
+  size_t len = strlen(msg);
+  reset();
+
+  // A gap: the message is never complete
+  ha_events_receive(msg, 10, (int)len, 0, LIMIT, 1);
+  ha_events_receive(msg + 12, len - 12, (int)len, 12, LIMIT, 1);
+  // More than announced
+  ha_events_receive(msg, 10, 12, 0, LIMIT, 1);
+  ha_events_receive(msg + 10, 10, 12, 10, LIMIT, 1);
+  // Connection closed halfway
+  ha_events_receive(msg, 10, (int)len, 0, LIMIT, 1);
+  ha_events_discard();
+  ha_events_receive(msg + 10, len - 10, (int)len, 10, LIMIT, 1);
+  vTaskDelay(pdMS_TO_TICKS(30));
+  CHECK_EQ(atomic_load(&handled), 0);
+
+  // A new message replaces one left unfinished
+  ha_events_receive(msg, 10, (int)len, 0, LIMIT, 2);
+  ha_events_receive(msg, len, (int)len, 0, LIMIT, 3);
+  wait_handled(1);
+  CHECK_STR(seen[0].json, msg);
+  CHECK_EQ(seen[0].session, 3);
+}
+
+// HA sends run events back to back while a callback (TTS start, intent
+// handling) takes tens of ms; the receiver must keep reading meanwhile
+static void test_slow_handler(void) {
+  char msg[64];
+  reset();
+  atomic_store(&handler_ms, 50);
+  int64_t t0 = esp_timer_get_time();
+  for (int i = 0; i < 10; i++) {
+    snprintf(msg, sizeof(msg), "{\"id\":%d}", i);
+    receive(msg, 1);
+  }
+  int64_t enqueue_us = esp_timer_get_time() - t0;
+  wait_handled(10);
+  int64_t handle_us = seen[9].handled_us - t0;
+  atomic_store(&handler_ms, 0);
+
+  for (int i = 0; i < 10; i++) {
+    snprintf(msg, sizeof(msg), "{\"id\":%d}", i);
+    CHECK_STR(seen[i].json, msg);
+  }
+  CHECK(enqueue_us < 20000);
+  CHECK(handle_us >= 10 * 50000);
+  CHECK(host_metrics_gauge(METRIC_GAUGE_HA_EVENT_QUEUE_PEAK) >= 8);
+  CHECK_EQ(host_metrics_gauge(METRIC_GAUGE_HA_EVENT_QUEUE_DEPTH), 0);
+  fprintf(stderr,
+          "slow handler: 10 messages queued in %lld us, handled in %lld ms\n",
+          (long long)enqueue_us, (long long)(handle_us / 1000));
+}
+
+static void test_queue_full(void) {
+  char msg[64];
+  reset();
+  atomic_store(&gated, true);
+
+  // One held by the handler, then the queue fills
+  receive("{\"id\":0}", 1);
+  vTaskDelay(pdMS_TO_TICKS(20));
+  for (int i = 1; i <= HA_EVENTS_QUEUE_LEN; i++) {
+    snprintf(msg, sizeof(msg), "{\"id\":%d}", i);
+    int64_t t0 = esp_timer_get_time();
+    receive(msg, 1);
+    CHECK(esp_timer_get_time() - t0 < 20000);
+  }
+  CHECK_EQ(host_metrics_gauge(METRIC_GAUGE_HA_EVENT_QUEUE_DEPTH),
+           HA_EVENTS_QUEUE_LEN);
+
+  int64_t t0 = esp_timer_get_time();
+  receive("{\"id\":\"lost\"}", 1);
+  int64_t blocked_ms = (esp_timer_get_time() - t0) / 1000;
+  CHECK(blocked_ms >= HA_EVENTS_ENQUEUE_TIMEOUT_MS);
+  CHECK(blocked_ms < HA_EVENTS_ENQUEUE_TIMEOUT_MS + 100);
+  CHECK_EQ(metrics_get(METRIC_HA_EVENTS_DROPPED), 1);
+
+  atomic_store(&gated, false);
+  for (int i = 0; i <= HA_EVENTS_QUEUE_LEN; i++) {
+    xSemaphoreGive(gate);
+  }
+  wait_handled(HA_EVENTS_QUEUE_LEN + 1);
+  for (int i = 0; i <= HA_EVENTS_QUEUE_LEN; i++) {
+    snprintf(msg, sizeof(msg), "{\"id\":%d}", i);
+    CHECK_STR(seen[i].json, msg);
+  }
+  fprintf(stderr, "queue full: receiver blocked %lld ms, then dropped\n",
+          (long long)blocked_ms);
+}
+
+// -----------------------------------------------------------------------------
+
+int main(void) {
+  RUN(test_start);
+  RUN(test_single_frame);
+  RUN(test_reassembly);
+  RUN(test_too_large);
+  RUN(test_stray_chunks);
+  RUN(test_slow_handler);
+  RUN(test_queue_full);
+  return TEST_RESULT();
+}
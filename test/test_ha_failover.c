@@ -0,0 +1,390 @@
+/**
+ * @file test_ha_failover.c
+ * @brief ha_failover: buffering while disconnected, replay and the deferred
+ * end marker, stale and cancelled runs, the outage clock, and a failover
+ * against a local Home Assistant stand-in that measures the window in which
+ * voice is unavailable
+ */
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ha_failover.h"
+#include "host.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static uint8_t block[HA_FAILOVER_MAX_BYTES];
+
+typedef struct {
+  uint8_t data[HA_FAILOVER_MAX_BYTES];
+  size_t len;
+  int sends;
+  int fail_at; ///< Send number that fails, 0 = none
+} sink_t;
+
+static esp_err_t sink_send(void *ctx, const uint8_t *data, size_t len) {
+  sink_t *s = ctx;
+  if (++s->sends == s->fail_at) {
+    return ESP_FAIL;
+  }
+  CHECK(len <= HA_FAILOVER_CHUNK);
+  memcpy(s->data + s->len, data, len);
+  s->len += len;
+  return ESP_OK;
+}
+
+static void fill(uint8_t *buf, size_t len, size_t from) {
+  for (size_t i = 0; i < len; i++) {
+    buf[i] = (uint8_t)((from + i) * 7);
+  }
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_before_init(void) {
+  uint8_t frame[16] = {0};
+  ha_failover_run_begin(block);
+  CHECK(!ha_failover_capture(frame, sizeof(frame)));
+  CHECK(!ha_failover_mark_pending());
+  CHECK(!ha_failover_end_audio());
+  CHECK(!ha_failover_pending());
+  ha_failover_outage_begin();
+  CHECK_EQ(ha_failover_outage_end(), -1);
+  CHECK_EQ(ha_failover_init(), ESP_OK);
+  CHECK_EQ(ha_failover_init(), ESP_OK);
+}
+
+static void test_connected_run(void) {
+  uint8_t frame[640];
+  fill(frame, sizeof(frame), 0);
+  ha_failover_run_begin(block);
+  for (int i = 0; i < 10; i++) {
+    CHECK(!ha_failover_capture(frame, sizeof(frame)));
+  }
+  CHECK(!ha_failover_end_audio());
+  ha_failover_run_stop(); // stt-end
+  CHECK(!ha_failover_mark_pending());
+  CHECK(!ha_failover_pending());
+}
+
+static void test_drop_and_replay(void) {
+  static uint8_t audio[3 * HA_FAILOVER_CHUNK + 100];
+  static sink_t sink;
+  fill(audio, sizeof(audio), 0);
+  memset(&sink, 0, sizeof(sink));
+
+  ha_failover_run_begin(block);
+  CHECK(!ha_failover_capture(audio, 1000));
+  CHECK(ha_failover_mark_pending());
+  CHECK(ha_failover_mark_pending()); // Still the same drop
+  CHECK(ha_failover_pending());
+  CHECK(ha_failover_capture(audio + 1000, sizeof(audio) - 1000));
+  CHECK(ha_failover_end_audio()); // Deferred to the replay
+
+  size_t sent = 0;
+  bool send_end = false;
+  CHECK_EQ(ha_failover_replay(sink_send, &sink, &sent, &send_end),
+           HA_FAILOVER_REPLAYED);
+  CHECK_EQ(sent, sizeof(audio));
+  CHECK(send_end);
+  CHECK_EQ(sink.sends, 4);
+  CHECK_EQ(sink.len, sizeof(audio));
+  CHECK(memcmp(sink.data, audio, sizeof(audio)) == 0);
+  CHECK(!ha_failover_pending());
+  CHECK(!ha_failover_capture(audio, 10)); // Live again
+}
+
+static void test_replay_before_end(void) {
+  uint8_t frame[512];
+  static sink_t sink;
+  fill(frame, sizeof(frame), 0);
+  memset(&sink, 0, sizeof(sink));
+
+  ha_failover_run_begin(block);
+  CHECK(!ha_failover_capture(frame, sizeof(frame)));
+  CHECK(ha_failover_mark_pending());
+  size_t sent = 0;
+  bool send_end = true;
+  CHECK_EQ(ha_failover_replay(sink_send, &sink, &sent, &send_end),
+           HA_FAILOVER_REPLAYED);
+  CHECK(!send_end); // Capture is still going and sends it itself
+  CHECK(!ha_failover_end_audio());
+  ha_failover_run_stop();
+}
+
+static void test_no_block(void) {
+  uint8_t frame[64] = {0};
+  ha_failover_run_begin(NULL); // mem_budget had no block
+  CHECK(!ha_failover_capture(frame, sizeof(frame)));
+  CHECK(!ha_failover_mark_pending()); // A drop ends the run as before
+  CHECK(!ha_failover_pending());
+}
+
+static void test_too_long(void) {
+  static uint8_t frame[HA_FAILOVER_CHUNK];
+  fill(frame, sizeof(frame), 0);
+  ha_failover_run_begin(block);
+  for (size_t n = 0; n < HA_FAILOVER_MAX_BYTES; n += sizeof(frame)) {
+    CHECK(!ha_failover_capture(frame, sizeof(frame)));
+  }
+  CHECK(!ha_failover_capture(frame, 1)); // Outgrows the block
+  CHECK(!ha_failover_mark_pending());
+
+  // Already pending: keeps holding back the audio, the replay sends what
+  // fits
+  ha_failover_run_begin(block);
+  CHECK(ha_failover_mark_pending());
+  for (size_t n = 0; n <= HA_FAILOVER_MAX_BYTES; n += sizeof(frame)) {
+    CHECK(ha_failover_capture(frame, sizeof(frame)));
+  }
+  ha_failover_run_stop();
+}
+
+static void test_cancelled(void) {
+  uint8_t frame[64] = {0};
+  static sink_t sink;
+  memset(&sink, 0, sizeof(sink));
+
+  ha_failover_run_begin(block);
+  CHECK(!ha_failover_capture(frame, sizeof(frame)));
+  CHECK(ha_failover_mark_pending());
+  ha_failover_run_stop(); // run-end or error arrived first
+  size_t sent = 1;
+  bool send_end = true;
+  CHECK_EQ(ha_failover_replay(sink_send, &sink, &sent, &send_end),
+           HA_FAILOVER_CANCELLED);
+  CHECK_EQ(sent, 0);
+  CHECK(!send_end);
+  CHECK_EQ(sink.sends, 0);
+}
+
+static void test_send_failed(void) {
+  static uint8_t audio[3 * HA_FAILOVER_CHUNK];
+  static sink_t sink;
+  memset(&sink, 0, sizeof(sink));
+  sink.fail_at = 2;
+
+  ha_failover_run_begin(block);
+  CHECK(ha_failover_mark_pending());
+  CHECK(ha_failover_capture(audio, sizeof(audio)));
+  size_t sent = 0;
+  bool send_end = false;
+  CHECK_EQ(ha_failover_replay(sink_send, &sink, &sent, &send_end),
+           HA_FAILOVER_SEND_FAILED);
+  CHECK_EQ(sent, HA_FAILOVER_CHUNK);
+  ha_failover_run_stop();
+}
+
+static void test_stale(void) {
+  uint8_t frame[64] = {0};
+  ha_failover_run_begin(block);
+  CHECK(!ha_failover_stale()); // Not pending
+  CHECK(!ha_failover_capture(frame, sizeof(frame)));
+  CHECK(ha_failover_mark_pending());
+  host_time_advance_ms(HA_FAILOVER_MAX_AGE_MS - 100);
+  CHECK(!ha_failover_stale());
+  host_time_advance_ms(200);
+  CHECK(ha_failover_stale());
+  ha_failover_run_stop();
+  CHECK(!ha_failover_stale());
+}
+
+static void test_outage_clock(void) {
+  CHECK_EQ(ha_failover_outage_end(), -1); // Never lost
+  ha_failover_outage_begin();
+  host_time_advance_ms(150);
+  ha_failover_outage_begin(); // Reconnect requested: same outage
+  host_time_advance_ms(100);
+  int32_t ms = ha_failover_outage_end();
+  CHECK(ms >= 250 && ms < 300);
+  CHECK_EQ(ha_failover_outage_end(), -1);
+}
+
+// -----------------------------------------------------------------------------
+// Failover against a local stand-in for Home Assistant. Each connection is a
+// SEQPACKET socket pair, so a message is one WebSocket binary frame: the STT
+// handler id, then audio; the id alone ends the audio. Capture streams 20 ms
+// frames as voice_pipeline does. Mid-utterance the netif goes down, the old
+// connection dies, and the supervisor reconnects after the handshake time.
+// The new run must get the whole utterance, in order, then the end marker.
+
+#define FRAME_BYTES 640 // 20 ms at 16 kHz
+#define FRAMES 100
+#define DROP_AT_FRAME 25
+#define HANDSHAKE_MS 300
+
+static uint8_t utterance[FRAMES * FRAME_BYTES];
+static atomic_int conn_fd = -1; // Device side of the live connection
+static atomic_int frames_captured = 0;
+static atomic_bool capture_done = false;
+
+typedef struct {
+  int fd;
+  uint8_t handler_id;
+  uint8_t audio[FRAMES * FRAME_BYTES + 1];
+  size_t len;
+  bool ended;
+  int messages;
+} server_conn_t;
+
+static void *server_main(void *arg) {
+  server_conn_t *c = arg;
+  uint8_t msg[1 + 2 * FRAME_BYTES];
+  for (;;) {
+    ssize_t n = recv(c->fd, msg, sizeof(msg), 0);
+    if (n <= 0) {
+      break; // Connection gone
+    }
+    c->messages++;
+    CHECK_EQ(msg[0], c->handler_id);
+    if (n == 1) {
+      c->ended = true;
+      break;
+    }
+    CHECK(c->len + (size_t)(n - 1) <= sizeof(c->audio));
+    memcpy(c->audio + c->len, msg + 1, n - 1);
+    c->len += n - 1;
+  }
+  return NULL;
+}
+
+static esp_err_t ws_send(int fd, uint8_t handler_id, const uint8_t *data,
+                         size_t len) {
+  uint8_t msg[1 + HA_FAILOVER_CHUNK];
+  msg[0] = handler_id;
+  memcpy(msg + 1, data, len);
+  return send(fd, msg, 1 + len, MSG_NOSIGNAL) == (ssize_t)(1 + len)
+             ? ESP_OK
+             : ESP_FAIL;
+}
+
+static atomic_int conn_handler = 1;
+
+static esp_err_t replay_send(void *ctx, const uint8_t *data, size_t len) {
+  (void)ctx;
+  return ws_send(atomic_load(&conn_fd), (uint8_t)atomic_load(&conn_handler),
+                 data, len);
+}
+
+/** ha_client_stream_audio() and ha_client_end_audio_stream() */
+static void capture_task(void *arg) {
+  (void)arg;
+  for (int i = 0; i < FRAMES; i++) {
+    const uint8_t *frame = utterance + i * FRAME_BYTES;
+    if (!ha_failover_capture(frame, FRAME_BYTES) &&
+        ws_send(atomic_load(&conn_fd), (uint8_t)atomic_load(&conn_handler),
+                frame, FRAME_BYTES) != ESP_OK) {
+      (void)ha_failover_mark_pending(); // Already kept for the replay
+    }
+    atomic_fetch_add(&frames_captured, 1);
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+  if (!ha_failover_end_audio()) {
+    uint8_t id = (uint8_t)atomic_load(&conn_handler);
+    CHECK_EQ(send(atomic_load(&conn_fd), &id, 1, MSG_NOSIGNAL), 1);
+  }
+  atomic_store(&capture_done, true);
+  vTaskDelete(NULL);
+}
+
+static void connect_to(server_conn_t *server, pthread_t *thread,
+                       uint8_t handler_id) {
+  int sv[2];
+  CHECK_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv), 0);
+  memset(server, 0, sizeof(*server));
+  server->fd = sv[1];
+  server->handler_id = handler_id;
+  atomic_store(&conn_handler, handler_id);
+  atomic_store(&conn_fd, sv[0]);
+  pthread_create(thread, NULL, server_main, server);
+}
+
+static void test_failover(void) {
+  static server_conn_t first, second;
+  pthread_t first_thread, second_thread;
+  fill(utterance, sizeof(utterance), 0);
+
+  connect_to(&first, &first_thread, 1);
+  CHECK_EQ(ha_failover_outage_end(), -1);
+  ha_failover_run_begin(block);
+  CHECK(xTaskCreate(capture_task, "capture", 4096, NULL, 5, NULL) == pdPASS);
+
+  while (atomic_load(&frames_captured) < DROP_AT_FRAME) {
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+
+  // Netif down: ha_client_on_netif_change(false), then the socket dies
+  int64_t drop_us = esp_timer_get_time();
+  ha_failover_outage_begin();
+  CHECK(ha_failover_mark_pending());
+  int old_fd = atomic_load(&conn_fd);
+  shutdown(old_fd, SHUT_RDWR);
+  pthread_join(first_thread, NULL);
+
+  // New IP: reconnect to the cached address, TCP + TLS + auth
+  vTaskDelay(pdMS_TO_TICKS(HANDSHAKE_MS));
+  connect_to(&second, &second_thread, 2);
+  int32_t unavailable_ms = ha_failover_outage_end(); // auth_ok
+  close(old_fd);
+
+  size_t sent = 0;
+  bool send_end = false;
+  CHECK_EQ(ha_failover_replay(replay_send, NULL, &sent, &send_end),
+           HA_FAILOVER_REPLAYED);
+  int64_t caught_up_ms = (esp_timer_get_time() - drop_us) / 1000;
+  if (send_end) {
+    uint8_t id = 2;
+    CHECK_EQ(send(atomic_load(&conn_fd), &id, 1, MSG_NOSIGNAL), 1);
+  }
+
+  while (!atomic_load(&capture_done)) {
+    vTaskDelay(pdMS_TO_TICKS(5));
+  }
+  pthread_join(second_thread, NULL);
+  close(atomic_load(&conn_fd));
+  close(first.fd);
+  close(second.fd);
+
+  // The first run got the start of the utterance and nothing after it
+  CHECK(first.len >= (DROP_AT_FRAME - 1) * FRAME_BYTES);
+  CHECK(first.len < (DROP_AT_FRAME + 2) * FRAME_BYTES);
+  CHECK(memcmp(first.audio, utterance, first.len) == 0);
+  CHECK(!first.ended);
+
+  // The new run got all of it, in order, then the end marker
+  CHECK_EQ(second.len, sizeof(utterance));
+  CHECK(memcmp(second.audio, utterance, sizeof(utterance)) == 0);
+  CHECK(second.ended);
+  CHECK(sent >= (size_t)DROP_AT_FRAME * FRAME_BYTES);
+
+  CHECK(unavailable_ms >= HANDSHAKE_MS);
+  CHECK(unavailable_ms < HANDSHAKE_MS + 200);
+  CHECK(caught_up_ms < HANDSHAKE_MS + 200);
+  fprintf(stderr,
+          "failover: voice unavailable for %ld ms, %u bytes replayed, run "
+          "caught up %lld ms after the drop\n",
+          (long)unavailable_ms, (unsigned)sent, (long long)caught_up_ms);
+}
+
+// -----------------------------------------------------------------------------
+
+int main(void) {
+  RUN(test_before_init);
+  RUN(test_connected_run);
+  RUN(test_drop_and_replay);
+  RUN(test_replay_before_end);
+  RUN(test_no_block);
+  RUN(test_too_long);
+  RUN(test_cancelled);
+  RUN(test_send_failed);
+  RUN(test_stale);
+  RUN(test_outage_clock);
+  RUN(test_failover);
+  return TEST_RESULT();
+}
@@ -0,0 +1,252 @@
+/**
+ * @file test_ha_rtt.c
+ * @brief ha_rtt: the ping schedule, RTT smoothing, percentiles and RTO
+ * against a fake link with injected latency, late and dropped pongs, the
+ * reconnect after missed pongs, and recovery on the next session
+ */
+
+#include "esp_timer.h"
+#include "ha_rtt.h"
+#include "host.h"
+#include "metrics.h"
+#include "test_util.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// Fake link: records the ping, the test answers it
+static int next_id = 100;
+static int sent_id = -1;
+static int sends = 0;
+static bool send_fails = false;
+static int reconnects = 0;
+static const char *reconnect_why = "";
+
+static int link_send(void) {
+  if (send_fails) {
+    return -1;
+  }
+  sends++;
+  sent_id = next_id++;
+  return sent_id;
+}
+
+static void link_reconnect(const char *why) {
+  reconnects++;
+  reconnect_why = why;
+}
+
+static uint32_t session = 0;
+
+static void pong(int id) {
+  ha_rtt_on_pong(id, esp_timer_get_time(), session);
+}
+
+// One ping answered after latency_ms; leaves the clock at the next ping
+static void ping_answered(uint32_t latency_ms) {
+  int before = sends;
+  uint32_t wait = ha_rtt_poll(session, true);
+  CHECK_EQ(sends, before + 1);
+  CHECK(latency_ms < wait);
+  host_time_advance_ms(latency_ms);
+  pong(sent_id);
+  uint32_t next = ha_rtt_poll(session, true);
+  CHECK_EQ(sends, before + 1);
+  CHECK_EQ(next, HA_RTT_PING_INTERVAL_MS - latency_ms);
+  host_time_advance_ms(next);
+}
+
+// base +- spread in a fixed scrambled order
+static uint32_t latency(uint32_t base, uint32_t spread, int i) {
+  return base - spread + 2 * spread * (uint32_t)((i * 7) % 11) / 10;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentiles of the last HA_RTT_WINDOW of @p ms, in ms
+static void check_percentiles(const uint32_t *ms, int count) {
+  uint32_t win[HA_RTT_WINDOW];
+  int n = count < HA_RTT_WINDOW ? count : HA_RTT_WINDOW;
+  memcpy(win, ms + count - n, n * sizeof(win[0]));
+  qsort(win, n, sizeof(win[0]), cmp_u32);
+  ha_rtt_stats_t st;
+  ha_rtt_get(&st);
+  CHECK_EQ(st.p50_us / 1000, win[(50 * n + 99) / 100 - 1]);
+  CHECK_EQ(st.p90_us / 1000, win[(90 * n + 99) / 100 - 1]);
+  CHECK_EQ(st.p99_us / 1000, win[(99 * n + 99) / 100 - 1]);
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_before_first_pong(void) {
+  ha_rtt_stats_t st;
+  ha_rtt_get(&st);
+  CHECK_EQ(st.samples, 0);
+  CHECK_EQ(st.srtt_us, 0);
+  CHECK_EQ(st.p99_us, 0);
+  CHECK_EQ(ha_rtt_rto_ms(), HA_RTT_RTO_INITIAL_MS);
+  ha_rtt_get(NULL);
+}
+
+static void test_schedule(void) {
+  session++;
+  CHECK_EQ(ha_rtt_poll(session, false), HA_RTT_PING_INTERVAL_MS);
+  CHECK_EQ(sends, 0);
+
+  // Right after auth_ok, then wait two initial RTOs for the pong
+  CHECK_EQ(ha_rtt_poll(session, true), 2 * HA_RTT_RTO_INITIAL_MS);
+  CHECK_EQ(sends, 1);
+  host_time_advance_ms(1000);
+  uint32_t left = ha_rtt_poll(session, true);
+  CHECK(left <= 2 * HA_RTT_RTO_INITIAL_MS - 1000);
+  CHECK(left >= 2 * HA_RTT_RTO_INITIAL_MS - 1001);
+  CHECK_EQ(sends, 1);
+
+  pong(sent_id + 1); // Not ours
+  pong(sent_id);
+  pong(sent_id); // Duplicate
+  ha_rtt_stats_t st;
+  ha_rtt_get(&st);
+  CHECK_EQ(st.samples, 1);
+  CHECK_EQ(st.srtt_us / 1000, 1000);
+  CHECK_EQ(st.jitter_us / 1000, 500);
+  CHECK_EQ(host_metrics_observations(METRIC_HIST_HA_RTT), 1);
+  // Next ping an interval after the last one was sent
+  CHECK_EQ(ha_rtt_poll(session, true), HA_RTT_PING_INTERVAL_MS - 1000);
+  host_time_advance_ms(HA_RTT_PING_INTERVAL_MS - 1000);
+}
+
+// Starts from the 1 s sample above, so it takes a while to settle
+static void test_lan(void) {
+  uint32_t ms[80];
+  for (int i = 0; i < 80; i++) {
+    ms[i] = latency(20, 5, i);
+    ping_answered(ms[i]);
+  }
+  ha_rtt_stats_t st;
+  ha_rtt_get(&st);
+  CHECK_EQ(st.samples, 81);
+  CHECK(st.srtt_us >= 15000 && st.srtt_us <= 25000);
+  CHECK(st.jitter_us >= 1000 && st.jitter_us <= 6000);
+  CHECK_EQ(st.missed, 0);
+  check_percentiles(ms, 80);
+  CHECK_EQ(ha_rtt_rto_ms(), HA_RTT_RTO_MIN_MS);
+  CHECK_EQ(reconnects, 0);
+  CHECK_EQ(metrics_get(METRIC_HA_PONGS_MISSED), 0);
+  fprintf(stderr, "20 +- 5 ms: srtt %u us, jitter %u us, p99 %u us, rto %u\n",
+          (unsigned)st.srtt_us, (unsigned)st.jitter_us, (unsigned)st.p99_us,
+          (unsigned)ha_rtt_rto_ms());
+}
+
+static void test_slow_link(void) {
+  uint32_t ms[40];
+  for (int i = 0; i < 40; i++) {
+    ms[i] = latency(700, 300, i);
+    ping_answered(ms[i]);
+  }
+  ha_rtt_stats_t st;
+  ha_rtt_get(&st);
+  CHECK(st.srtt_us >= 400000 && st.srtt_us <= 1000000);
+  CHECK(st.jitter_us >= 60000 && st.jitter_us <= 300000);
+  check_percentiles(ms, 40);
+  uint32_t rto = ha_rtt_rto_ms();
+  CHECK(rto > HA_RTT_RTO_MIN_MS && rto < HA_RTT_RTO_MAX_MS);
+  CHECK_EQ(rto, (st.srtt_us + 4 * st.jitter_us + 999) / 1000);
+  // No spurious misses or reconnects on a slow but live link
+  CHECK_EQ(reconnects, 0);
+  CHECK_EQ(metrics_get(METRIC_HA_PONGS_MISSED), 0);
+  fprintf(stderr,
+          "700 +- 300 ms: srtt %u us, jitter %u us, p99 %u us, rto %u\n",
+          (unsigned)st.srtt_us, (unsigned)st.jitter_us, (unsigned)st.p99_us,
+          (unsigned)rto);
+}
+
+// Past two RTOs the ping is retried; its late pong still counts
+static void test_late_pong(void) {
+  uint32_t wait = ha_rtt_poll(session, true);
+  int late = sent_id;
+  host_time_advance_ms(wait);
+  CHECK(ha_rtt_poll(session, true) > 0); // Retry
+  int retry = sent_id;
+  CHECK(retry != late);
+  CHECK_EQ(metrics_get(METRIC_HA_PONGS_MISSED), 1);
+  ha_rtt_stats_t st;
+  ha_rtt_get(&st);
+  CHECK_EQ(st.missed, 1);
+
+  uint32_t samples = st.samples;
+  host_time_advance_ms(100);
+  pong(late);
+  ha_rtt_get(&st);
+  CHECK_EQ(st.samples, samples + 1);
+  CHECK_EQ(st.missed, 0);
+  pong(late); // Counted once
+  pong(retry);
+  ha_rtt_get(&st);
+  CHECK_EQ(st.samples, samples + 2);
+  CHECK_EQ(reconnects, 0);
+  host_time_advance_ms(ha_rtt_poll(session, true));
+}
+
+static void test_dead_link(void) {
+  uint32_t wait = ha_rtt_poll(session, true);
+  for (int i = 0; i < HA_RTT_MAX_MISSED - 1; i++) {
+    host_time_advance_ms(wait);
+    wait = ha_rtt_poll(session, true);
+    CHECK_EQ(reconnects, 0);
+  }
+  host_time_advance_ms(wait);
+  int before = sends;
+  CHECK_EQ(ha_rtt_poll(session, true), HA_RTT_PING_INTERVAL_MS);
+  CHECK_EQ(sends, before);
+  CHECK_EQ(reconnects, 1);
+  CHECK_STR(reconnect_why, "pong timeout");
+  ha_rtt_stats_t st;
+  ha_rtt_get(&st);
+  CHECK_EQ(st.missed, HA_RTT_MAX_MISSED);
+  CHECK_EQ(metrics_get(METRIC_HA_PONGS_MISSED), 1 + HA_RTT_MAX_MISSED);
+}
+
+static void test_recovery(void) {
+  int stale = sent_id;
+  session++; // Reconnected
+  CHECK_EQ(ha_rtt_poll(session, false), HA_RTT_PING_INTERVAL_MS);
+  ha_rtt_stats_t st;
+  ha_rtt_get(&st);
+  CHECK_EQ(st.missed, 0);
+  uint32_t samples = st.samples;
+
+  ha_rtt_on_pong(stale, esp_timer_get_time(), session - 1);
+  ping_answered(20);
+  ha_rtt_get(&st);
+  CHECK_EQ(st.samples, samples + 1);
+  CHECK_EQ(reconnects, 1);
+}
+
+static void test_send_failed(void) {
+  send_fails = true;
+  CHECK_EQ(ha_rtt_poll(session, true), HA_RTT_PING_INTERVAL_MS);
+  CHECK_EQ(reconnects, 2);
+  CHECK_STR(reconnect_why, "ping send failed");
+  send_fails = false;
+  host_time_advance_ms(HA_RTT_PING_INTERVAL_MS);
+  ping_answered(20);
+}
+
+// -----------------------------------------------------------------------------
+
+int main(void) {
+  ha_rtt_init(&(ha_rtt_link_t){.send_ping = link_send,
+                               .reconnect = link_reconnect});
+  RUN(test_before_first_pong);
+  RUN(test_schedule);
+  RUN(test_lan);
+  RUN(test_slow_link);
+  RUN(test_late_pong);
+  RUN(test_dead_link);
+  RUN(test_recovery);
+  RUN(test_send_failed);
+  return TEST_RESULT();
+}
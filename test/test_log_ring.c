@@ -0,0 +1,246 @@
+/**
+ * @file test_log_ring.c
+ * @brief log_ring: record boundaries, wrap-around, cursor recovery and
+ * concurrent writers against a lock-free reader
+ */
+
+#include "log_ring.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** Start every test on an empty ring; returns the reader cursor */
+static uint32_t fresh(void) {
+  log_ring_clear();
+  return log_ring_head();
+}
+
+static void write_str(const char *s) { log_ring_write(s, strlen(s)); }
+
+static void test_records_round_trip(void) {
+  uint32_t cursor = fresh();
+  char buf[LOG_RING_MAX_PAYLOAD];
+
+  write_str("one");
+  write_str("second record");
+  write_str("3");
+  log_ring_write(NULL, 5); // Ignored
+  log_ring_write("x", 0);
+
+  uint32_t end = log_ring_readable_end(cursor);
+  CHECK_EQ(end, log_ring_head());
+
+  size_t n = log_ring_read_record(&cursor, end, buf, sizeof(buf));
+  CHECK_EQ(n, 3);
+  CHECK(memcmp(buf, "one", 3) == 0);
+  n = log_ring_read_record(&cursor, end, buf, sizeof(buf));
+  CHECK_EQ(n, 13);
+  CHECK(memcmp(buf, "second record", 13) == 0);
+  n = log_ring_read_record(&cursor, end, buf, sizeof(buf));
+  CHECK_EQ(n, 1);
+  CHECK_EQ(buf[0], '3');
+  CHECK_EQ(log_ring_read_record(&cursor, end, buf, sizeof(buf)), 0);
+  CHECK_EQ(cursor, end);
+}
+
+static void test_truncation(void) {
+  uint32_t cursor = fresh();
+  char big[LOG_RING_MAX_PAYLOAD + 100];
+  char buf[LOG_RING_MAX_PAYLOAD];
+
+  memset(big, 'a', sizeof(big));
+  log_ring_write(big, sizeof(big));
+  uint32_t end = log_ring_readable_end(cursor);
+  CHECK_EQ(log_ring_read_record(&cursor, end, buf, sizeof(buf)),
+           LOG_RING_MAX_PAYLOAD);
+}
+
+static void test_read_never_splits(void) {
+  uint32_t cursor = fresh();
+  char buf[16];
+
+  write_str("0123456789"); // 10
+  write_str("abcdefgh");   // 8: does not fit behind the first
+  uint32_t end = log_ring_readable_end(cursor);
+
+  CHECK_EQ(log_ring_read(&cursor, end, buf, sizeof(buf)), 10);
+  CHECK(memcmp(buf, "0123456789", 10) == 0);
+  CHECK_EQ(log_ring_read(&cursor, end, buf, sizeof(buf)), 8);
+  CHECK_EQ(log_ring_read(&cursor, end, buf, sizeof(buf)), 0);
+
+  // A record larger than the buffer is left for read_record to refuse
+  cursor = fresh();
+  write_str("0123456789abcdefXYZ");
+  end = log_ring_readable_end(cursor);
+  CHECK_EQ(log_ring_read(&cursor, end, buf, sizeof(buf)), 0);
+  CHECK_EQ(log_ring_read_record(&cursor, end, buf, sizeof(buf)), 0);
+}
+
+static void test_wrap_resets_overtaken_reader(void) {
+  uint32_t cursor = fresh();
+  char line[64];
+  char buf[LOG_RING_MAX_PAYLOAD];
+  bool reset;
+
+  // Several times the ring: the reader is lapped
+  int total = 4 * LOG_RING_SIZE / 32;
+  for (int i = 0; i < total; i++) {
+    snprintf(line, sizeof(line), "line %06d", i);
+    write_str(line);
+  }
+
+  uint32_t seq = log_ring_sync(cursor, &reset);
+  CHECK(reset);
+  CHECK_EQ(seq, log_ring_oldest());
+  CHECK((uint32_t)(log_ring_head() - seq) <= LOG_RING_SIZE);
+
+  // What is left is an intact, gap-free tail ending with the last line
+  uint32_t end = log_ring_readable_end(seq);
+  CHECK_EQ(end, log_ring_head());
+  int prev = -1;
+  size_t n;
+  while ((n = log_ring_read_record(&seq, end, buf, sizeof(buf) - 1)) > 0) {
+    buf[n] = '\0';
+    int v = -1;
+    CHECK_EQ(sscanf(buf, "line %d", &v), 1);
+    if (prev >= 0) {
+      CHECK_EQ(v, prev + 1);
+    }
+    prev = v;
+  }
+  CHECK_EQ(prev, total - 1);
+
+  // An up-to-date cursor is left alone
+  CHECK_EQ(log_ring_sync(end, &reset), end);
+  CHECK(!reset);
+}
+
+static void test_sync_rejects_bad_cursors(void) {
+  uint32_t cursor = fresh();
+  bool reset;
+
+  write_str("before clear");
+  log_ring_clear();
+  write_str("after clear");
+
+  // Predates the clear
+  CHECK_EQ(log_ring_sync(cursor, &reset), log_ring_oldest());
+  CHECK(reset);
+  // Ahead of the ring, e.g. a client that outlived a reboot
+  log_ring_sync(log_ring_head() + 64, &reset);
+  CHECK(reset);
+  // Not on a record boundary
+  log_ring_sync(log_ring_oldest() + 4, &reset);
+  CHECK(reset);
+
+  char buf[32];
+  uint32_t seq = log_ring_oldest();
+  size_t n = log_ring_read_record(&seq, log_ring_readable_end(seq), buf,
+                                  sizeof(buf));
+  CHECK_EQ(n, 11);
+  CHECK(memcmp(buf, "after clear", 11) == 0);
+}
+
+// ---------------------------------------------------------------------------
+// Concurrency: writers race each other and a reader; every record the
+// reader accepts must be intact and each writer's records in order.
+// ---------------------------------------------------------------------------
+
+#define WRITERS 4
+#define RECORDS_PER_WRITER 20000
+
+typedef struct {
+  uint16_t writer;
+  uint16_t len;
+  uint32_t seq;
+  uint8_t fill[LOG_RING_MAX_PAYLOAD - 8];
+} rec_t;
+
+static atomic_int writers_running = 0;
+
+static void *writer_main(void *arg) {
+  uint16_t id = (uint16_t)(uintptr_t)arg;
+  rec_t r = {.writer = id};
+
+  for (uint32_t i = 0; i < RECORDS_PER_WRITER; i++) {
+    r.seq = i;
+    r.len = (uint16_t)(8 + (i * 37 + id * 11) % 200);
+    memset(r.fill, (uint8_t)(id * 31 + i), r.len - 8);
+    log_ring_write(&r, r.len);
+  }
+  atomic_fetch_sub(&writers_running, 1);
+  return NULL;
+}
+
+static bool record_intact(const rec_t *r, size_t n) {
+  if (n < 8 || r->len != n || r->writer >= WRITERS) {
+    return false;
+  }
+  uint8_t expect = (uint8_t)(r->writer * 31 + r->seq);
+  for (size_t i = 0; i < n - 8; i++) {
+    if (r->fill[i] != expect) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void test_concurrent_writers(void) {
+  uint32_t cursor = fresh();
+  pthread_t threads[WRITERS];
+  int64_t last[WRITERS];
+  uint32_t seen = 0;
+  uint32_t resets = 0;
+  uint32_t torn = 0;
+  rec_t r;
+
+  atomic_store(&writers_running, WRITERS);
+  for (int i = 0; i < WRITERS; i++) {
+    last[i] = -1;
+    pthread_create(&threads[i], NULL, writer_main, (void *)(uintptr_t)i);
+  }
+
+  bool done = false;
+  while (!done) {
+    // Once the writers are finished, passes drain the ring until one gets
+    // nowhere: a record torn by a lapped writer ends a pass early
+    bool finished = atomic_load(&writers_running) == 0;
+    uint32_t start = cursor;
+    bool reset;
+    cursor = log_ring_sync(cursor, &reset);
+    resets += reset;
+    uint32_t end = log_ring_readable_end(cursor);
+    size_t n;
+    while ((n = log_ring_read_record(&cursor, end, &r, sizeof(r))) > 0) {
+      if (!record_intact(&r, n)) {
+        torn++;
+        continue;
+      }
+      CHECK(r.seq > last[r.writer]);
+      last[r.writer] = r.seq;
+      seen++;
+    }
+    done = finished && cursor == start;
+  }
+
+  for (int i = 0; i < WRITERS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  fprintf(stderr, "  %u records read intact, %u reader resets\n", seen,
+          resets);
+  CHECK_EQ(torn, 0);
+  CHECK(seen > 0);
+  CHECK_EQ(cursor, log_ring_head());
+}
+
+int main(void) {
+  RUN(test_records_round_trip);
+  RUN(test_truncation);
+  RUN(test_read_never_splits);
+  RUN(test_wrap_resets_overtaken_reader);
+  RUN(test_sync_rejects_bad_cursors);
+  RUN(test_concurrent_writers);
+  return TEST_RESULT();
+}
@@ -0,0 +1,411 @@
+/**
+ * @file test_log_stream.c
+ * @brief log_stream: SSE framing, resume by event id, reset and lapped
+ * viewers, and local viewers on sockets checking order and latency while a
+ * stalled viewer is dropped without holding up the writers
+ */
+
+#include "blog.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "log_ring.h"
+#include "log_stream.h"
+#include "test_util.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+  char buf[64 * 1024];
+  size_t len;
+  int sends;
+  esp_err_t result;
+} capture_t;
+
+static capture_t cap;
+
+static esp_err_t capture_send(void *ctx, const char *data, size_t len) {
+  capture_t *c = ctx;
+  c->sends++;
+  if (c->result != ESP_OK) {
+    return c->result;
+  }
+  CHECK(c->len + len < sizeof(c->buf));
+  memcpy(c->buf + c->len, data, len);
+  c->len += len;
+  c->buf[c->len] = '\0';
+  return ESP_OK;
+}
+
+static void capture_reset(void) { memset(&cap, 0, sizeof(cap)); }
+
+static void write_str(const char *s) { log_ring_write(s, strlen(s)); }
+
+static int count_of(const char *hay, const char *needle) {
+  int n = 0;
+  for (const char *p = strstr(hay, needle); p; p = strstr(p + 1, needle)) {
+    n++;
+  }
+  return n;
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_frames_lines(void) {
+  log_ring_clear();
+  log_stream_pos_t pos;
+  log_stream_open(&pos, 0);
+  CHECK(!pos.reset);
+
+  write_str("I (1) app: one\n");
+  write_str("two\r\n");
+  write_str("three");
+  capture_reset();
+  CHECK(log_stream_service(&pos, false, capture_send, &cap));
+  CHECK_EQ(pos.cursor, log_ring_head());
+
+  char expect[128];
+  snprintf(expect, sizeof(expect),
+           "data: I (1) app: one\ndata: two\ndata: three\nid: %u\n\n",
+           (unsigned)log_ring_head());
+  CHECK_STR(cap.buf, expect);
+}
+
+static void test_keepalive(void) {
+  log_ring_clear();
+  log_stream_pos_t pos;
+  log_stream_open(&pos, 0);
+
+  capture_reset();
+  CHECK(log_stream_service(&pos, false, capture_send, &cap));
+  CHECK_EQ(cap.sends, 0);
+  CHECK(log_stream_service(&pos, true, capture_send, &cap));
+  CHECK_STR(cap.buf, ": ping\n\n");
+
+  // No ping when there was data
+  write_str("x\n");
+  capture_reset();
+  CHECK(log_stream_service(&pos, true, capture_send, &cap));
+  CHECK_EQ(count_of(cap.buf, ": ping"), 0);
+}
+
+static void test_resume_by_event_id(void) {
+  log_ring_clear();
+  write_str("before\n");
+  log_stream_pos_t pos;
+  log_stream_open(&pos, 0); // Whole ring
+  capture_reset();
+  CHECK(log_stream_service(&pos, false, capture_send, &cap));
+  CHECK(strstr(cap.buf, "data: before\n") != NULL);
+  const char *id = strstr(cap.buf, "id: ");
+  CHECK(id != NULL);
+  uint32_t last_id = (uint32_t)strtoul(id + 4, NULL, 10);
+
+  // EventSource reconnects with Last-Event-ID and only gets what is new
+  write_str("after\n");
+  log_stream_pos_t again;
+  log_stream_open(&again, last_id);
+  CHECK(!again.reset);
+  capture_reset();
+  CHECK(log_stream_service(&again, false, capture_send, &cap));
+  CHECK_EQ(count_of(cap.buf, "data: "), 1);
+  CHECK(strstr(cap.buf, "data: after\n") != NULL);
+}
+
+static void test_stale_id_resets_viewer(void) {
+  log_ring_clear();
+  uint32_t old = log_ring_head();
+  write_str("gone\n");
+  char line[64];
+  for (int i = 0; log_ring_oldest() <= old + 8; i++) {
+    snprintf(line, sizeof(line), "filler %d\n", i);
+    write_str(line);
+  }
+
+  log_stream_pos_t pos;
+  log_stream_open(&pos, old + 1);
+  CHECK(pos.reset);
+  capture_reset();
+  CHECK(log_stream_service(&pos, false, capture_send, &cap));
+  CHECK(strncmp(cap.buf, "event: reset\ndata: 1\n\n", 22) == 0);
+  CHECK(strstr(cap.buf, "gone") == NULL);
+  CHECK(strstr(cap.buf, "data: filler") != NULL);
+}
+
+static void test_lapped_viewer_is_dropped(void) {
+  log_ring_clear();
+  log_stream_pos_t pos;
+  log_stream_open(&pos, 0);
+
+  char line[64];
+  for (int i = 0; i < 2 * LOG_RING_SIZE / 16; i++) {
+    snprintf(line, sizeof(line), "lap %05d\n", i);
+    write_str(line);
+  }
+  capture_reset();
+  CHECK(!log_stream_service(&pos, false, capture_send, &cap));
+  CHECK_EQ(cap.sends, 0);
+}
+
+static void test_failed_send_drops(void) {
+  log_ring_clear();
+  log_stream_pos_t pos;
+  log_stream_open(&pos, 0);
+  write_str("x\n");
+  capture_reset();
+  cap.result = ESP_ERR_TIMEOUT;
+  CHECK(!log_stream_service(&pos, false, capture_send, &cap));
+  CHECK_EQ(cap.sends, 1);
+
+  // A keepalive that times out loses the viewer too
+  log_stream_open(&pos, 0);
+  CHECK(!log_stream_service(&pos, true, capture_send, &cap));
+}
+
+static void test_backlog_splits_into_events(void) {
+  enum { LINES = 300 };
+  log_ring_clear();
+  log_stream_pos_t pos;
+  log_stream_open(&pos, 0);
+  char line[64];
+  for (int i = 0; i < LINES; i++) {
+    snprintf(line, sizeof(line), "line %03d\n", i);
+    write_str(line);
+  }
+
+  capture_reset();
+  CHECK(log_stream_service(&pos, false, capture_send, &cap));
+  CHECK(cap.sends > 1);
+  CHECK_EQ(count_of(cap.buf, "data: "), LINES);
+
+  // Every line once, in order; ids increase and the last is the head
+  int next = 0;
+  uint32_t prev_id = 0;
+  int ids = 0;
+  for (char *p = cap.buf; *p;) {
+    char *nl = strchr(p, '\n');
+    CHECK(nl != NULL);
+    *nl = '\0';
+    if (strncmp(p, "data: line ", 11) == 0) {
+      CHECK_EQ(atoi(p + 11), next);
+      next++;
+    } else if (strncmp(p, "id: ", 4) == 0) {
+      uint32_t id = (uint32_t)strtoul(p + 4, NULL, 10);
+      CHECK(id > prev_id);
+      prev_id = id;
+      ids++;
+    } else {
+      CHECK_STR(p, ""); // Event terminator
+    }
+    p = nl + 1;
+  }
+  CHECK_EQ(next, LINES);
+  CHECK(ids >= 1);
+  CHECK_EQ(prev_id, log_ring_head());
+}
+
+static void test_blog_records_as_text(void) {
+  log_ring_clear();
+  log_stream_pos_t pos;
+  log_stream_open(&pos, 0);
+
+  uint8_t rec[16] = {BLOG_MARKER};
+  log_ring_write(rec, sizeof(rec));
+  write_str("text\n");
+  capture_reset();
+  CHECK(log_stream_service(&pos, false, capture_send, &cap));
+  CHECK(strstr(cap.buf, "data: <blog 16 bytes>\ndata: text\n") != NULL);
+}
+
+// -----------------------------------------------------------------------------
+// Viewers on local sockets, served by a task shaped like webserial's
+
+#define LINES 2000
+#define SEND_TIMEOUT_MS 50
+
+typedef struct {
+  int fd;               ///< Stream task side
+  int peer;             ///< Viewer side
+  log_stream_pos_t pos;
+  atomic_bool dropped;
+} viewer_t;
+
+static viewer_t viewers[2]; // [0] reads everything, [1] never reads
+static TaskHandle_t stream_task;
+static atomic_bool stream_stop;
+static SemaphoreHandle_t stream_done;
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static esp_err_t socket_send(void *ctx, const char *data, size_t len) {
+  int fd = *(int *)ctx;
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      return errno == EAGAIN ? ESP_ERR_TIMEOUT : ESP_FAIL;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  return ESP_OK;
+}
+
+static void stream_task_main(void *arg) {
+  (void)arg;
+  while (!atomic_load(&stream_stop)) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(250));
+    for (int i = 0; i < 2; i++) {
+      viewer_t *v = &viewers[i];
+      if (!atomic_load(&v->dropped) &&
+          !log_stream_service(&v->pos, false, socket_send, &v->fd)) {
+        shutdown(v->fd, SHUT_RDWR);
+        atomic_store(&v->dropped, true);
+      }
+    }
+  }
+  xSemaphoreGive(stream_done);
+  vTaskDelete(NULL);
+}
+
+static int64_t latency_us[LINES];
+static atomic_int received;
+static atomic_int out_of_order;
+
+static void *fast_viewer_main(void *arg) {
+  viewer_t *v = arg;
+  static char buf[8192];
+  size_t have = 0;
+  int next = 0;
+  for (;;) {
+    ssize_t n = recv(v->peer, buf + have, sizeof(buf) - have - 1, 0);
+    if (n <= 0) {
+      break;
+    }
+    have += (size_t)n;
+    buf[have] = '\0';
+    char *p = buf;
+    char *nl;
+    while ((nl = strchr(p, '\n')) != NULL) {
+      *nl = '\0';
+      int seq;
+      long long t;
+      if (sscanf(p, "data: seq=%d t=%lld", &seq, &t) == 2) {
+        if (seq != next) {
+          atomic_fetch_add(&out_of_order, 1);
+        }
+        next = seq + 1;
+        if (seq >= 0 && seq < LINES) {
+          latency_us[seq] = now_us() - t;
+        }
+        atomic_fetch_add(&received, 1);
+      }
+      p = nl + 1;
+    }
+    have -= (size_t)(p - buf);
+    memmove(buf, p, have);
+  }
+  return NULL;
+}
+
+static int cmp_i64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void test_local_viewers(void) {
+  log_ring_clear();
+  for (int i = 0; i < 2; i++) {
+    int sv[2];
+    CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    viewers[i].fd = sv[0];
+    viewers[i].peer = sv[1];
+    atomic_store(&viewers[i].dropped, false);
+    log_stream_open(&viewers[i].pos, 0);
+  }
+  // As webserial sets on the detached request's socket
+  struct timeval tv = {.tv_usec = SEND_TIMEOUT_MS * 1000};
+  int small = 4096;
+  setsockopt(viewers[1].fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  setsockopt(viewers[1].fd, SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+
+  atomic_store(&stream_stop, false);
+  atomic_store(&received, 0);
+  atomic_store(&out_of_order, 0);
+  stream_done = xSemaphoreCreateBinary();
+  CHECK(xTaskCreate(stream_task_main, "log_stream", 4096, NULL, 2,
+                    &stream_task) == pdPASS);
+  pthread_t fast;
+  pthread_create(&fast, NULL, fast_viewer_main, &viewers[0]);
+
+  // The logging side: write, then notify, as webserial_log_func does
+  int64_t worst_write = 0;
+  char line[64];
+  for (int i = 0; i < LINES; i++) {
+    snprintf(line, sizeof(line), "seq=%d t=%lld\n", i, (long long)now_us());
+    int64_t t0 = now_us();
+    log_ring_write(line, strlen(line));
+    xTaskNotifyGive(stream_task);
+    int64_t took = now_us() - t0;
+    worst_write = took > worst_write ? took : worst_write;
+    usleep(500);
+  }
+
+  for (int i = 0; i < 400 && atomic_load(&received) < LINES; i++) {
+    usleep(10 * 1000);
+  }
+  atomic_store(&stream_stop, true);
+  xTaskNotifyGive(stream_task);
+  CHECK(xSemaphoreTake(stream_done, pdMS_TO_TICKS(2000)) == pdTRUE);
+  for (int i = 0; i < 2; i++) {
+    shutdown(viewers[i].fd, SHUT_RDWR);
+  }
+  pthread_join(fast, NULL);
+
+  CHECK(atomic_load(&viewers[1].dropped));
+  CHECK(!atomic_load(&viewers[0].dropped));
+  CHECK_EQ(atomic_load(&received), LINES);
+  CHECK_EQ(atomic_load(&out_of_order), 0);
+
+  qsort(latency_us, LINES, sizeof(latency_us[0]), cmp_i64);
+  int64_t p50 = latency_us[LINES / 2];
+  int64_t p99 = latency_us[LINES * 99 / 100];
+  int64_t max = latency_us[LINES - 1];
+  printf("log to viewer: p50 %lld us, p99 %lld us, max %lld us; "
+         "slowest log write %lld us\n",
+         (long long)p50, (long long)p99, (long long)max,
+         (long long)worst_write);
+  CHECK(p50 < 20 * 1000);
+  // Only the dropped viewer's one send timeout may hold the stream up
+  CHECK(max < 1000 * 1000);
+  CHECK(worst_write < 20 * 1000);
+
+  for (int i = 0; i < 2; i++) {
+    close(viewers[i].fd);
+    close(viewers[i].peer);
+  }
+  vSemaphoreDelete(stream_done);
+}
+
+int main(void) {
+  RUN(test_frames_lines);
+  RUN(test_keepalive);
+  RUN(test_resume_by_event_id);
+  RUN(test_stale_id_resets_viewer);
+  RUN(test_lapped_viewer_is_dropped);
+  RUN(test_failed_send_drops);
+  RUN(test_backlog_splits_into_events);
+  RUN(test_blog_records_as_text);
+  RUN(test_local_viewers);
+  return TEST_RESULT();
+}
@@ -0,0 +1,184 @@
+/**
+ * @file test_mem_budget.c
+ * @brief mem_budget: carving at boot, block layout, and zero heap
+ * allocations per conversation once the owners have taken their blocks
+ *
+ * Built with ALLOC_TRACE_ENABLE=1, so a fallback to TRACE_MALLOC shows up
+ * in the tracer as well as in mem_budget_fallbacks().
+ */
+
+#include "alloc_trace.h"
+#include "host.h"
+#include "mem_budget.h"
+#include "mp3dec.h"
+#include "test_util.h"
+#include <stdint.h>
+
+// What the owners ask for (audio_capture, beep_tone, ha_client, tts_player)
+#define I2S_READ_LEN 512
+#define BEEP_SAMPLE_RATE 16000
+#define HA_REPLAY_MAX_BYTES (8 * 16000 * sizeof(int16_t))
+#define PCM_BUFFER_SIZE (MAX_NCHAN * MAX_NSAMP * 2)
+#define TTS_BUFFER_SIZE (128 * 1024)
+
+static const struct {
+  mem_block_t block;
+  size_t len;
+} owner_sizes[] = {
+    {MEM_BLOCK_FEED_MIC, I2S_READ_LEN * sizeof(int16_t)},
+    {MEM_BLOCK_FEED_REF, I2S_READ_LEN * sizeof(int16_t)},
+    {MEM_BLOCK_FEED_AFE, I2S_READ_LEN * 2 * sizeof(int16_t)},
+    {MEM_BLOCK_HA_AUDIO_FRAME, 1 + 2048},
+    {MEM_BLOCK_BEEP_PCM, BEEP_SAMPLE_RATE * sizeof(int16_t)}, // 1000 ms
+    {MEM_BLOCK_TTS_PCM, PCM_BUFFER_SIZE},
+    {MEM_BLOCK_TTS_MP3, TTS_BUFFER_SIZE},
+    {MEM_BLOCK_HA_REPLAY, HA_REPLAY_MAX_BYTES},
+};
+
+#define OWNERS (sizeof(owner_sizes) / sizeof(owner_sizes[0]))
+
+static uint32_t traced_allocs(void) {
+  uint32_t n = 0;
+  for (alloc_tag_t t = 0; t < ALLOC_TAG_COUNT; t++) {
+    alloc_trace_stats_t s;
+    alloc_trace_get(t, &s);
+    n += s.allocs;
+  }
+  return n;
+}
+
+/**
+ * One wake word -> TTS cycle, acquiring and releasing as the owners do:
+ * the feed task per capture start, ha_client per audio frame size, a beep
+ * of each length and one TTS response
+ */
+static void conversation(void) {
+  void *mic = mem_budget_acquire(MEM_BLOCK_FEED_MIC, I2S_READ_LEN * 2);
+  void *ref = mem_budget_acquire(MEM_BLOCK_FEED_REF, I2S_READ_LEN * 2);
+  void *afe = mem_budget_acquire(MEM_BLOCK_FEED_AFE, I2S_READ_LEN * 4);
+  CHECK(mic && ref && afe);
+
+  static const uint16_t beep_ms[] = {100, 150, 500, 1000};
+  for (size_t i = 0; i < sizeof(beep_ms) / sizeof(beep_ms[0]); i++) {
+    size_t len = BEEP_SAMPLE_RATE * beep_ms[i] / 1000 * sizeof(int16_t);
+    void *pcm = mem_budget_acquire(MEM_BLOCK_BEEP_PCM, len);
+    CHECK(pcm != NULL);
+    mem_budget_release(MEM_BLOCK_BEEP_PCM, pcm);
+  }
+
+  static const size_t chunks[] = {512, 1024, 2048};
+  for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    void *frame = mem_budget_acquire(MEM_BLOCK_HA_AUDIO_FRAME, 1 + chunks[i]);
+    CHECK(frame != NULL);
+    mem_budget_release(MEM_BLOCK_HA_AUDIO_FRAME, frame);
+  }
+
+  void *replay = mem_budget_acquire(MEM_BLOCK_HA_REPLAY, HA_REPLAY_MAX_BYTES);
+  void *mp3 = mem_budget_acquire(MEM_BLOCK_TTS_MP3, TTS_BUFFER_SIZE);
+  void *pcm = mem_budget_acquire(MEM_BLOCK_TTS_PCM, PCM_BUFFER_SIZE);
+  CHECK(replay && mp3 && pcm);
+  mem_budget_release(MEM_BLOCK_TTS_PCM, pcm);
+  mem_budget_release(MEM_BLOCK_TTS_MP3, mp3);
+  mem_budget_release(MEM_BLOCK_HA_REPLAY, replay);
+
+  mem_budget_release(MEM_BLOCK_FEED_MIC, mic);
+  mem_budget_release(MEM_BLOCK_FEED_REF, ref);
+  mem_budget_release(MEM_BLOCK_FEED_AFE, afe);
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_init_fits(void) {
+  CHECK(!mem_budget_fits());
+  uint32_t heap_before = host_heap_allocs();
+  CHECK_EQ(mem_budget_init(), ESP_OK);
+  CHECK(mem_budget_fits());
+  CHECK_EQ(host_heap_allocs() - heap_before, MEM_REGION_COUNT);
+
+  // Idempotent: no second arena
+  CHECK_EQ(mem_budget_init(), ESP_OK);
+  CHECK_EQ(host_heap_allocs() - heap_before, MEM_REGION_COUNT);
+  CHECK_EQ(mem_budget_fallbacks(), 0);
+}
+
+static void test_blocks_cover_owners(void) {
+  uint8_t *start[OWNERS];
+  for (size_t i = 0; i < OWNERS; i++) {
+    start[i] = mem_budget_acquire(owner_sizes[i].block, owner_sizes[i].len);
+    CHECK(start[i] != NULL);
+    CHECK_EQ((uintptr_t)start[i] % 64, 0); // Own cache line
+    memset(start[i], 0xa5, owner_sizes[i].len); // ASan: within the arena
+    // Same block every time
+    CHECK(mem_budget_acquire(owner_sizes[i].block, 1) == start[i]);
+  }
+
+  // No two blocks overlap
+  for (size_t i = 0; i < OWNERS; i++) {
+    for (size_t j = i + 1; j < OWNERS; j++) {
+      bool apart = start[i] + owner_sizes[i].len <= start[j] ||
+                   start[j] + owner_sizes[j].len <= start[i];
+      CHECK(apart);
+    }
+  }
+  for (size_t i = 0; i < OWNERS; i++) {
+    mem_budget_release(owner_sizes[i].block, start[i]);
+  }
+  CHECK_EQ(mem_budget_fallbacks(), 0);
+}
+
+static void test_conversations_do_not_allocate(void) {
+  conversation(); // Warm-up
+
+  uint32_t fallbacks = mem_budget_fallbacks();
+  uint32_t traced = traced_allocs();
+  uint32_t heap = host_heap_allocs();
+  for (int i = 0; i < 20; i++) {
+    conversation();
+  }
+  CHECK_EQ(mem_budget_fallbacks(), fallbacks);
+  CHECK_EQ(traced_allocs(), traced);
+  CHECK_EQ(host_heap_allocs(), heap);
+  CHECK_EQ(fallbacks, 0);
+}
+
+static void test_oversize_falls_back(void) {
+  alloc_trace_stats_t before;
+  alloc_trace_get(ALLOC_TAG_BEEP, &before);
+
+  // A 2 s beep does not fit the 1 s block: heap, traced under beep_tone
+  size_t len = 2 * BEEP_SAMPLE_RATE * sizeof(int16_t);
+  void *block = mem_budget_acquire(MEM_BLOCK_BEEP_PCM, 1);
+  void *pcm = mem_budget_acquire(MEM_BLOCK_BEEP_PCM, len);
+  CHECK(pcm != NULL && pcm != block);
+  memset(pcm, 0, len);
+  CHECK_EQ(mem_budget_fallbacks(), 1);
+
+  alloc_trace_stats_t s;
+  alloc_trace_get(ALLOC_TAG_BEEP, &s);
+  CHECK_EQ(s.allocs - before.allocs, 1);
+  CHECK_EQ(s.live_bytes - before.live_bytes, len);
+
+  mem_budget_release(MEM_BLOCK_BEEP_PCM, pcm);
+  alloc_trace_get(ALLOC_TAG_BEEP, &s);
+  CHECK_EQ(s.live_bytes, before.live_bytes);
+
+  // Releasing the arena block is a no-op
+  mem_budget_release(MEM_BLOCK_BEEP_PCM, block);
+  CHECK(mem_budget_acquire(MEM_BLOCK_BEEP_PCM, 1) == block);
+}
+
+static void test_bad_args(void) {
+  CHECK(mem_budget_acquire(MEM_BLOCK_COUNT, 16) == NULL);
+  mem_budget_release(MEM_BLOCK_COUNT, NULL);
+  mem_budget_release(MEM_BLOCK_TTS_PCM, NULL);
+  mem_budget_report();
+}
+
+int main(void) {
+  RUN(test_init_fits);
+  RUN(test_blocks_cover_owners);
+  RUN(test_conversations_do_not_allocate);
+  RUN(test_oversize_falls_back);
+  RUN(test_bad_args);
+  return TEST_RESULT();
+}
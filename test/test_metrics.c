@@ -0,0 +1,342 @@
+/**
+ * @file test_metrics.c
+ * @brief metrics: Prometheus exposition of the registry, histograms and the
+ * task list (format, label escaping, chunking, truncation, no heap use)
+ *
+ * The task list comes from host_task_list_set(), so task counts, names and
+ * run-time counters are whatever a test needs.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host.h"
+#include "metrics.h"
+#include "test_util.h"
+#include <ctype.h>
+#include <stdint.h>
+
+#define OUT_MAX 32768
+
+typedef struct {
+  char text[OUT_MAX];
+  size_t len;
+  int calls;
+  size_t largest;
+  int fail_after; ///< Sink calls that succeed before ESP_FAIL, -1 = never
+} capture_t;
+
+static esp_err_t capture_sink(void *ctx, const char *data, size_t len) {
+  capture_t *c = ctx;
+  if (c->fail_after >= 0 && c->calls >= c->fail_after) {
+    return ESP_FAIL;
+  }
+  c->calls++;
+  if (len > c->largest) {
+    c->largest = len;
+  }
+  if (c->len + len < sizeof(c->text)) {
+    memcpy(c->text + c->len, data, len);
+    c->len += len;
+    c->text[c->len] = '\0';
+  }
+  return ESP_OK;
+}
+
+static capture_t out;
+
+static esp_err_t render(size_t buf_len) {
+  static char buf[4096];
+  memset(&out, 0, sizeof(out));
+  out.fail_after = -1;
+  return metrics_render(buf, buf_len, capture_sink, &out);
+}
+
+static bool has_line(const char *line) {
+  size_t n = strlen(line);
+  for (const char *p = out.text; (p = strstr(p, line)) != NULL; p++) {
+    if ((p == out.text || p[-1] == '\n') && p[n] == '\n') {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int count_of(const char *needle) {
+  int n = 0;
+  for (const char *p = out.text; (p = strstr(p, needle)) != NULL; p++) {
+    n++;
+  }
+  return n;
+}
+
+static TaskStatus_t task(uintptr_t id, const char *name, uint32_t runtime) {
+  TaskStatus_t t = {
+      .xHandle = (TaskHandle_t)id,
+      .pcTaskName = name,
+      .xTaskNumber = (UBaseType_t)id,
+      .ulRunTimeCounter = runtime,
+  };
+  return t;
+}
+
+/** Every line a comment or `name[{labels}] value`, and labels well formed */
+static bool exposition_valid(void) {
+  const char *p = out.text;
+  int line = 1;
+  while (*p) {
+    const char *end = strchr(p, '\n');
+    if (end == NULL) {
+      fprintf(stderr, "line %d: no newline\n", line);
+      return false;
+    }
+    if (strncmp(p, "# HELP ", 7) != 0 && strncmp(p, "# TYPE ", 7) != 0) {
+      const char *c = p;
+      if (!(isalpha((unsigned char)*c) || *c == '_')) {
+        fprintf(stderr, "line %d: bad name: %.*s\n", line, (int)(end - p), p);
+        return false;
+      }
+      while (isalnum((unsigned char)*c) || *c == '_' || *c == ':') {
+        c++;
+      }
+      if (*c == '{') {
+        // name="value" pairs; values are quoted, with no raw newline
+        c++;
+        while (*c != '}') {
+          while (isalnum((unsigned char)*c) || *c == '_') {
+            c++;
+          }
+          if (c[0] != '=' || c[1] != '"') {
+            fprintf(stderr, "line %d: bad label: %.*s\n", line,
+                    (int)(end - p), p);
+            return false;
+          }
+          c += 2;
+          while (c < end && *c != '"') {
+            c += (*c == '\\') ? 2 : 1;
+          }
+          if (c >= end) {
+            fprintf(stderr, "line %d: open label: %.*s\n", line,
+                    (int)(end - p), p);
+            return false;
+          }
+          c++;
+          if (*c == ',') {
+            c++;
+          }
+        }
+        c++;
+      }
+      if (*c != ' ' || c + 1 >= end) {
+        fprintf(stderr, "line %d: no value: %.*s\n", line, (int)(end - p), p);
+        return false;
+      }
+      for (c++; c < end; c++) {
+        if (!isdigit((unsigned char)*c) && *c != '.' && *c != '-') {
+          fprintf(stderr, "line %d: bad value: %.*s\n", line,
+                  (int)(end - p), p);
+          return false;
+        }
+      }
+    }
+    p = end + 1;
+    line++;
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_bad_args(void) {
+  char buf[256];
+  CHECK_EQ(metrics_render(NULL, sizeof(buf), capture_sink, &out),
+           ESP_ERR_INVALID_ARG);
+  CHECK_EQ(metrics_render(buf, 127, capture_sink, &out), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(metrics_render(buf, sizeof(buf), NULL, &out), ESP_ERR_INVALID_ARG);
+}
+
+static void test_counters_and_gauges(void) {
+  metrics_inc(METRIC_HA_RECONNECTS);
+  metrics_add(METRIC_HA_RECONNECTS, 2);
+  metrics_add(METRIC_AFE_DROPS_LATE, 5);
+  metrics_inc(METRIC_AFE_DROPS_RING);
+  metrics_gauge_set(METRIC_GAUGE_HA_CONNECTED, 1);
+  metrics_gauge_set(METRIC_GAUGE_NET_FAILOVER_MS, -1);
+  CHECK_EQ(metrics_get(METRIC_HA_RECONNECTS), 3);
+  CHECK_EQ(metrics_get(METRIC_COUNTER_COUNT), 0);
+
+  CHECK_EQ(render(4096), ESP_OK);
+  CHECK(exposition_valid());
+  CHECK(has_line("va_ha_reconnects_total 3"));
+  CHECK(has_line("va_afe_dropped_frames_total{reason=\"feed_late\"} 5"));
+  CHECK(has_line("va_afe_dropped_frames_total{reason=\"ring_full\"} 1"));
+  CHECK(has_line("va_ha_connected 1"));
+  CHECK(has_line("va_network_milliseconds{phase=\"last_failover\"} -1"));
+
+  // HELP and TYPE once per family, ahead of its first sample
+  CHECK_EQ(count_of("# TYPE va_afe_dropped_frames_total counter\n"), 1);
+  CHECK_EQ(count_of("# HELP va_afe_dropped_frames_total "), 1);
+  CHECK_EQ(count_of("# TYPE va_network_milliseconds gauge\n"), 1);
+  CHECK(strstr(out.text, "# TYPE va_afe_dropped_frames_total counter\n") <
+        strstr(out.text, "va_afe_dropped_frames_total{"));
+  CHECK(has_line("# TYPE esp_heap_free_bytes gauge"));
+  CHECK(has_line("esp_heap_free_bytes{region=\"internal\"} 262144"));
+  CHECK(has_line("# TYPE esp_uptime_seconds gauge"));
+
+  // Out of range ids are ignored
+  metrics_inc(METRIC_COUNTER_COUNT);
+  metrics_gauge_set(METRIC_GAUGE_COUNT, 7);
+  metrics_observe(METRIC_HIST_COUNT, 7);
+}
+
+static void test_histogram(void) {
+  metrics_observe(METRIC_HIST_WS_SEND, 100);     // 250 us bucket
+  metrics_observe(METRIC_HIST_WS_SEND, 250);     // Bounds are inclusive
+  metrics_observe(METRIC_HIST_WS_SEND, 1500);    // 2 ms
+  metrics_observe(METRIC_HIST_WS_SEND, 9000000); // +Inf
+
+  CHECK_EQ(render(4096), ESP_OK);
+  CHECK(exposition_valid());
+  CHECK_EQ(count_of("# TYPE va_ws_send_seconds histogram\n"), 1);
+  CHECK(has_line("va_ws_send_seconds_bucket{le=\"0.00025\"} 2"));
+  CHECK(has_line("va_ws_send_seconds_bucket{le=\"0.0005\"} 2"));
+  CHECK(has_line("va_ws_send_seconds_bucket{le=\"0.002\"} 3"));
+  CHECK(has_line("va_ws_send_seconds_bucket{le=\"0.25\"} 3"));
+  CHECK(has_line("va_ws_send_seconds_bucket{le=\"+Inf\"} 4"));
+  CHECK(has_line("va_ws_send_seconds_sum 9.00185"));
+  CHECK(has_line("va_ws_send_seconds_count 4"));
+
+  // Labelled families put le after their own labels, once per family
+  CHECK(has_line("va_pipeline_stage_seconds_bucket{stage=\"wake_to_stream\","
+                 "le=\"0.05\"} 0"));
+  CHECK(has_line("va_pipeline_stage_seconds_sum{stage=\"tts_playback\"} 0"));
+  CHECK_EQ(count_of("# TYPE va_pipeline_stage_seconds histogram\n"), 1);
+}
+
+static void test_task_names_escaped(void) {
+  TaskStatus_t tasks[] = {
+      task(1, "IDLE0", 2000000),
+      task(2, "we\"ird\\na\nme", 1500),
+      task(3, "httpd", 0),
+      task(4, "httpd", 10),
+  };
+  host_task_list_set(tasks, 4);
+
+  CHECK_EQ(render(4096), ESP_OK);
+  CHECK(exposition_valid());
+  CHECK(has_line("esp_tasks{state=\"total\"} 4"));
+  CHECK(has_line("esp_tasks{state=\"listed\"} 4"));
+  CHECK(has_line("esp_task_runtime_seconds_total{task=\"IDLE0\",id=\"1\","
+                 "core=\"any\"} 2"));
+  CHECK(has_line("esp_task_runtime_seconds_total{task=\"we_ird_na_me\","
+                 "id=\"2\",core=\"any\"} 0.0015"));
+  // Same name, told apart by the task number
+  CHECK(has_line("esp_task_runtime_seconds_total{task=\"httpd\",id=\"3\","
+                 "core=\"any\"} 0"));
+  CHECK(has_line("esp_task_runtime_seconds_total{task=\"httpd\",id=\"4\","
+                 "core=\"any\"} 0.00001"));
+}
+
+static void test_task_runtime_wraps(void) {
+  TaskStatus_t tasks[] = {task(10, "afe_fetch", 4294000000u)};
+  host_task_list_set(tasks, 1);
+  CHECK_EQ(render(4096), ESP_OK);
+  CHECK(has_line("esp_task_runtime_seconds_total{task=\"afe_fetch\","
+                 "id=\"10\",core=\"any\"} 4294"));
+
+  // The 32-bit counter wrapped; the total keeps counting in 64 bits
+  tasks[0].ulRunTimeCounter = 1000000;
+  host_task_list_set(tasks, 1);
+  CHECK_EQ(render(4096), ESP_OK);
+  CHECK(has_line("esp_task_runtime_seconds_total{task=\"afe_fetch\","
+                 "id=\"10\",core=\"any\"} 4295.967296"));
+
+  // A task that went away frees its slot; seen again, it starts over from
+  // its counter
+  TaskStatus_t other[] = {task(11, "ota", 500000)};
+  host_task_list_set(other, 1);
+  CHECK_EQ(render(4096), ESP_OK);
+  CHECK_EQ(count_of("task=\"afe_fetch\""), 0);
+  tasks[0].ulRunTimeCounter = 3000000;
+  host_task_list_set(tasks, 1);
+  CHECK_EQ(render(4096), ESP_OK);
+  CHECK(has_line("esp_task_runtime_seconds_total{task=\"afe_fetch\","
+                 "id=\"10\",core=\"any\"} 3"));
+}
+
+static void test_task_list_truncated(void) {
+  static TaskStatus_t tasks[65];
+  static char names[65][8];
+  for (int i = 0; i < 65; i++) {
+    snprintf(names[i], sizeof(names[i]), "t%d", i);
+    tasks[i] = task(100 + i, names[i], 0);
+  }
+
+  host_task_list_set(tasks, 64);
+  CHECK_EQ(render(4096), ESP_OK);
+  CHECK(exposition_valid());
+  CHECK(has_line("esp_tasks{state=\"listed\"} 64"));
+  CHECK(has_line("esp_task_list_truncated_total 0"));
+  CHECK_EQ(count_of("esp_task_runtime_seconds_total{"), 64);
+
+  // One more than fits: counted, not listed, and the exposition stays valid
+  host_task_list_set(tasks, 65);
+  CHECK_EQ(render(4096), ESP_OK);
+  CHECK(exposition_valid());
+  CHECK(has_line("esp_tasks{state=\"total\"} 65"));
+  CHECK(has_line("esp_tasks{state=\"listed\"} 0"));
+  CHECK(has_line("esp_task_list_truncated_total 1"));
+  CHECK_EQ(count_of("esp_task_runtime_seconds_total{"), 0);
+
+  host_task_list_set(tasks, 3);
+  CHECK_EQ(render(4096), ESP_OK);
+  CHECK(has_line("esp_task_list_truncated_total 1"));
+  CHECK_EQ(count_of("esp_task_runtime_seconds_total{"), 3);
+}
+
+static void test_small_buffer_chunks(void) {
+  TaskStatus_t tasks[] = {task(1, "IDLE0", 2000000), task(2, "main", 99)};
+  host_task_list_set(tasks, 2);
+  CHECK_EQ(render(4096), ESP_OK);
+  static char whole[OUT_MAX];
+  memcpy(whole, out.text, out.len + 1);
+
+  // Same text from the smallest buffer, never split inside a line
+  CHECK_EQ(render(128), ESP_OK);
+  CHECK(out.calls > 1);
+  CHECK(out.largest <= 128);
+  CHECK_STR(out.text, whole);
+}
+
+static void test_sink_error_stops(void) {
+  static char buf[128];
+  memset(&out, 0, sizeof(out));
+  out.fail_after = 2;
+  CHECK_EQ(metrics_render(buf, sizeof(buf), capture_sink, &out), ESP_FAIL);
+  CHECK_EQ(out.calls, 2);
+}
+
+static void test_no_heap_on_scrape(void) {
+  static TaskStatus_t tasks[40];
+  for (int i = 0; i < 40; i++) {
+    tasks[i] = task(200 + i, "worker", (uint32_t)i * 1000);
+  }
+  host_task_list_set(tasks, 40);
+
+  uint32_t before = host_heap_allocs();
+  CHECK_EQ(render(4096), ESP_OK);
+  CHECK_EQ(render(128), ESP_OK);
+  CHECK_EQ(host_heap_allocs(), before);
+}
+
+int main(void) {
+  RUN(test_bad_args);
+  RUN(test_counters_and_gauges);
+  RUN(test_histogram);
+  RUN(test_task_names_escaped);
+  RUN(test_task_runtime_wraps);
+  RUN(test_task_list_truncated);
+  RUN(test_small_buffer_chunks);
+  RUN(test_sink_error_stops);
+  RUN(test_no_heap_on_scrape);
+  return TEST_RESULT();
+}
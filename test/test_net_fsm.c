@@ -0,0 +1,206 @@
+/**
+ * @file test_net_fsm.c
+ * @brief net_fsm: Ethernet priority, the Wi-Fi race, failover and handover
+ * replayed as event sequences, with the timing fields network_manager
+ * publishes
+ */
+
+#include "net_fsm.h"
+#include "test_util.h"
+
+#define RACE_MS 3000
+#define DHCP_MS 5000
+#define RETRY_MS 10000
+
+static net_fsm_t fsm;
+
+static void start(bool wifi_allowed, uint32_t race_delay_ms) {
+  net_fsm_config_t cfg = {
+      .race_delay_ms = race_delay_ms,
+      .dhcp_timeout_ms = DHCP_MS,
+      .wifi_retry_ms = RETRY_MS,
+      .wifi_allowed = wifi_allowed,
+  };
+  net_fsm_init(&fsm, &cfg);
+  CHECK_EQ(fsm.state, NET_FSM_IDLE);
+}
+
+#define EXPECT(ev, now, acts) CHECK_EQ(net_fsm_handle(&fsm, (ev), (now)), acts)
+
+/** Started at t=0 and online over Ethernet at t=900 */
+static void ethernet_online(void) {
+  start(true, RACE_MS);
+  EXPECT(NET_EV_START, 0, NET_ACT_TIMER);
+  EXPECT(NET_EV_ETH_LINK_UP, 100, NET_ACT_TIMER);
+  EXPECT(NET_EV_ETH_GOT_IP, 900, NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+}
+
+static void test_ethernet_first(void) {
+  start(true, RACE_MS);
+  EXPECT(NET_EV_START, 0, NET_ACT_TIMER);
+  CHECK_EQ(fsm.state, NET_FSM_CONNECTING);
+  CHECK_EQ(fsm.timer_ms, RACE_MS);
+
+  // Link-up gives DHCP its own window
+  EXPECT(NET_EV_ETH_LINK_UP, 100, NET_ACT_TIMER);
+  CHECK_EQ(fsm.timer_ms, DHCP_MS);
+  EXPECT(NET_EV_ETH_GOT_IP, 900, NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+  CHECK_EQ(fsm.timer_ms, 0);
+  CHECK_EQ(fsm.state, NET_FSM_ETHERNET);
+  CHECK_EQ(fsm.active, NETWORK_TYPE_ETHERNET);
+  CHECK(!fsm.wifi_running);
+  CHECK_EQ(fsm.time_to_ip_ms, 900);
+  CHECK_EQ(fsm.failovers, 0);
+
+  // Repeats change nothing
+  EXPECT(NET_EV_START, 1000, 0);
+  EXPECT(NET_EV_ETH_GOT_IP, 1000, 0);
+  EXPECT(NET_EV_TIMEOUT, 1000, 0);
+}
+
+static void test_no_link_races_wifi(void) {
+  start(true, RACE_MS);
+  EXPECT(NET_EV_START, 0, NET_ACT_TIMER);
+  EXPECT(NET_EV_TIMEOUT, RACE_MS, NET_ACT_START_WIFI);
+  CHECK(fsm.wifi_running);
+  EXPECT(NET_EV_WIFI_GOT_IP, 4500, NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+  CHECK_EQ(fsm.state, NET_FSM_WIFI);
+  CHECK_EQ(fsm.active, NETWORK_TYPE_WIFI);
+  CHECK_EQ(fsm.time_to_ip_ms, 4500);
+
+  // A cable plugged in later takes over without an outage
+  EXPECT(NET_EV_ETH_LINK_UP, 6000, 0);
+  EXPECT(NET_EV_ETH_GOT_IP, 7000,
+         NET_ACT_STOP_WIFI | NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+  CHECK_EQ(fsm.state, NET_FSM_ETHERNET);
+  CHECK_EQ(fsm.handovers, 1);
+  CHECK_EQ(fsm.failovers, 0);
+  CHECK_EQ(fsm.time_to_ip_ms, 4500);
+  CHECK(!fsm.wifi_running);
+}
+
+static void test_dhcp_timeout(void) {
+  start(true, RACE_MS);
+  EXPECT(NET_EV_START, 0, NET_ACT_TIMER);
+  EXPECT(NET_EV_ETH_LINK_UP, 500, NET_ACT_TIMER);
+  EXPECT(NET_EV_TIMEOUT, 500 + DHCP_MS, NET_ACT_START_WIFI);
+  // A link flap with Wi-Fi already trying does not re-arm
+  EXPECT(NET_EV_ETH_LINK_UP, 6000, 0);
+  // Ethernet still wins if its IP comes first
+  EXPECT(NET_EV_ETH_GOT_IP, 6500,
+         NET_ACT_STOP_WIFI | NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+  CHECK_EQ(fsm.time_to_ip_ms, 6500);
+  // The Wi-Fi IP that lost the race is dropped
+  EXPECT(NET_EV_WIFI_GOT_IP, 6600, NET_ACT_STOP_WIFI);
+  CHECK_EQ(fsm.state, NET_FSM_ETHERNET);
+}
+
+static void test_eth_lost_ip_fails_over(void) {
+  ethernet_online();
+  EXPECT(NET_EV_ETH_LOST_IP, 20000, NET_ACT_NOTIFY_DOWN | NET_ACT_START_WIFI);
+  CHECK_EQ(fsm.state, NET_FSM_CONNECTING);
+  CHECK_EQ(fsm.lost, NETWORK_TYPE_ETHERNET);
+  CHECK_EQ(fsm.active, NETWORK_TYPE_NONE);
+  CHECK(fsm.eth_link); // Only the lease is gone
+
+  EXPECT(NET_EV_WIFI_GOT_IP, 22500, NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+  CHECK_EQ(fsm.state, NET_FSM_WIFI);
+  CHECK_EQ(fsm.failover_ms, 2500);
+  CHECK_EQ(fsm.failovers, 1);
+  CHECK_EQ(fsm.down_ms, 0);
+  CHECK_EQ(fsm.time_to_ip_ms, 900); // Boot figure is kept
+
+  // Not the active path any more
+  EXPECT(NET_EV_ETH_LOST_IP, 25000, 0);
+  // DHCP renewed on the same link: back to Ethernet
+  EXPECT(NET_EV_ETH_GOT_IP, 30000,
+         NET_ACT_STOP_WIFI | NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+  CHECK_EQ(fsm.handovers, 1);
+  CHECK_EQ(fsm.failovers, 1);
+}
+
+static void test_link_down_and_wifi_retry(void) {
+  ethernet_online();
+  EXPECT(NET_EV_ETH_LINK_DOWN, 10000,
+         NET_ACT_NOTIFY_DOWN | NET_ACT_START_WIFI);
+  CHECK(!fsm.eth_link);
+
+  // Association fails: retry after a pause
+  EXPECT(NET_EV_WIFI_LOST, 12000, NET_ACT_TIMER);
+  CHECK(!fsm.wifi_running);
+  CHECK_EQ(fsm.timer_ms, RETRY_MS);
+  EXPECT(NET_EV_TIMEOUT, 22000, NET_ACT_START_WIFI);
+
+  // The cable comes back first
+  EXPECT(NET_EV_ETH_LINK_UP, 22500, 0);
+  EXPECT(NET_EV_ETH_GOT_IP, 23000,
+         NET_ACT_STOP_WIFI | NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+  CHECK_EQ(fsm.failover_ms, 13000);
+  CHECK_EQ(fsm.failovers, 1);
+  CHECK_EQ(fsm.handovers, 0);
+}
+
+static void test_wifi_lost_while_online(void) {
+  start(true, 0);
+  EXPECT(NET_EV_START, 0, NET_ACT_START_WIFI); // No race delay
+  EXPECT(NET_EV_WIFI_GOT_IP, 2000, NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+  EXPECT(NET_EV_WIFI_LOST, 5000, NET_ACT_NOTIFY_DOWN | NET_ACT_TIMER);
+  CHECK_EQ(fsm.lost, NETWORK_TYPE_WIFI);
+  CHECK_EQ(fsm.timer_ms, RETRY_MS);
+  EXPECT(NET_EV_TIMEOUT, 15000, NET_ACT_START_WIFI);
+  EXPECT(NET_EV_WIFI_GOT_IP, 16000, NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+  CHECK_EQ(fsm.failover_ms, 11000);
+  CHECK_EQ(fsm.failovers, 1);
+}
+
+static void test_no_ethernet(void) {
+  start(true, RACE_MS);
+  // Driver failed: Wi-Fi at once, from idle
+  EXPECT(NET_EV_ETH_ABSENT, 50, NET_ACT_TIMER | NET_ACT_START_WIFI);
+  CHECK_EQ(fsm.state, NET_FSM_CONNECTING);
+  CHECK_EQ(fsm.timer_ms, 0);
+  EXPECT(NET_EV_WIFI_GOT_IP, 1050, NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+  CHECK_EQ(fsm.time_to_ip_ms, 1000);
+}
+
+static void test_wifi_not_configured(void) {
+  start(false, RACE_MS);
+  EXPECT(NET_EV_START, 0, NET_ACT_TIMER);
+  EXPECT(NET_EV_TIMEOUT, RACE_MS, 0);
+  CHECK(!fsm.wifi_running);
+  EXPECT(NET_EV_WIFI_LOST, 4000, 0); // No retry timer either
+  EXPECT(NET_EV_ETH_GOT_IP, 60000, NET_ACT_NOTIFY_UP | NET_ACT_TIMER);
+  EXPECT(NET_EV_ETH_LINK_DOWN, 70000, NET_ACT_NOTIFY_DOWN);
+  CHECK_EQ(fsm.state, NET_FSM_CONNECTING);
+}
+
+static void test_idle_ignores_events(void) {
+  start(true, RACE_MS);
+  EXPECT(NET_EV_ETH_GOT_IP, 10, 0);
+  EXPECT(NET_EV_WIFI_GOT_IP, 10, 0);
+  EXPECT(NET_EV_ETH_LOST_IP, 10, 0);
+  EXPECT(NET_EV_TIMEOUT, 10, 0);
+  CHECK_EQ(fsm.state, NET_FSM_IDLE);
+}
+
+static void test_names(void) {
+  CHECK_STR(net_fsm_state_name(NET_FSM_ETHERNET), "ethernet");
+  CHECK_STR(net_fsm_state_name((net_fsm_state_t)42), "?");
+  CHECK_STR(net_fsm_event_name(NET_EV_ETH_LOST_IP), "eth_lost_ip");
+  CHECK_STR(net_fsm_event_name(NET_EV_TIMEOUT), "timeout");
+  CHECK_STR(net_fsm_event_name((net_fsm_event_t)42), "?");
+}
+
+int main(void) {
+  RUN(test_ethernet_first);
+  RUN(test_no_link_races_wifi);
+  RUN(test_dhcp_timeout);
+  RUN(test_eth_lost_ip_fails_over);
+  RUN(test_link_down_and_wifi_retry);
+  RUN(test_wifi_lost_while_online);
+  RUN(test_no_ethernet);
+  RUN(test_wifi_not_configured);
+  RUN(test_idle_ignores_events);
+  RUN(test_names);
+  return TEST_RESULT();
+}
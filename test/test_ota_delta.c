@@ -0,0 +1,296 @@
+/**
+ * @file test_ota_delta.c
+ * @brief ota_delta: patches from help_scripts/ota_delta.py applied in
+ * arbitrary pieces, flash gating, and the checks that refuse a bad patch
+ *
+ * The fixtures (old.bin, new.bin, update.delta) are written to
+ * OTA_DELTA_FIXTURES_DIR by ota_delta_fixtures.py before this runs.
+ */
+
+#include "mbedtls/sha256.h"
+#include "ota_delta.h"
+#include "test_util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+} blob_t;
+
+/** Output sink: collects the image and how it was written */
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+  size_t begin_size;
+  size_t max_write;
+  uint32_t writes;
+  int begins;
+  int ends;
+  bool committed;
+} out_t;
+
+static blob_t old_img;
+static blob_t new_img;
+static blob_t patch;
+static uint32_t gate_calls = 0;
+
+static blob_t load(const char *name) {
+  char path[512];
+  blob_t b = {0};
+  snprintf(path, sizeof(path), "%s/%s", OTA_DELTA_FIXTURES_DIR, name);
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Missing fixture %s (run ota_delta_fixtures.py)\n", path);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  b.len = (size_t)ftell(f);
+  fseek(f, 0, SEEK_SET);
+  b.data = malloc(b.len);
+  if (fread(b.data, 1, b.len, f) != b.len) {
+    exit(1);
+  }
+  fclose(f);
+  return b;
+}
+
+static esp_err_t out_begin(void *ctx, size_t image_size) {
+  out_t *o = ctx;
+  o->begins++;
+  o->begin_size = image_size;
+  return ESP_OK;
+}
+
+static esp_err_t out_write(void *ctx, const void *data, size_t len) {
+  out_t *o = ctx;
+  if (o->len + len > o->cap) {
+    o->cap = (o->len + len) * 2;
+    o->data = realloc(o->data, o->cap);
+  }
+  memcpy(o->data + o->len, data, len);
+  o->len += len;
+  o->writes++;
+  if (len > o->max_write) {
+    o->max_write = len;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t out_end(void *ctx, bool commit) {
+  out_t *o = ctx;
+  o->ends++;
+  o->committed = commit;
+  return ESP_OK;
+}
+
+static void gate(void) { gate_calls++; }
+
+/** The running partition: @p img followed by erased flash */
+static esp_partition_t partition_of(const blob_t *img) {
+  esp_partition_t p = {.address = 0x20000, .size = 2 * img->len};
+  uint8_t *data = malloc(p.size);
+  memcpy(data, img->data, img->len);
+  memset(data + img->len, 0xFF, p.size - img->len);
+  snprintf(p.label, sizeof(p.label), "ota_0");
+  p.host_data = data;
+  return p;
+}
+
+/**
+ * Feed @p in to a fresh applier in @p piece byte writes
+ *
+ * @return The first write error, else the end(commit) result
+ */
+static esp_err_t apply(const esp_partition_t *source, const uint8_t *in,
+                       size_t len, size_t piece, uint32_t flash_chunk,
+                       out_t *o) {
+  ota_sink_t out = {out_begin, out_write, out_end, o};
+  ota_sink_t sink;
+  memset(o, 0, sizeof(*o));
+  gate_calls = 0;
+  CHECK_EQ(ota_delta_sink(&out, source, flash_chunk ? gate : NULL,
+                          flash_chunk, &sink),
+           ESP_OK);
+
+  esp_err_t err = sink.begin(sink.ctx, len);
+  for (size_t off = 0; err == ESP_OK && off < len; off += piece) {
+    err = sink.write(sink.ctx, in + off, len - off < piece ? len - off : piece);
+  }
+  esp_err_t end = sink.end(sink.ctx, err == ESP_OK);
+  return err != ESP_OK ? err : end;
+}
+
+static void test_applies_in_any_pieces(void) {
+  static const size_t pieces[] = {1, 7, 509, 4096, 65536};
+  esp_partition_t src = partition_of(&old_img);
+  out_t o;
+
+  for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+    CHECK_EQ(apply(&src, patch.data, patch.len, pieces[i], 0, &o), ESP_OK);
+    CHECK_EQ(o.len, new_img.len);
+    CHECK(o.len == new_img.len && memcmp(o.data, new_img.data, o.len) == 0);
+    CHECK_EQ(o.begins, 1);
+    CHECK_EQ(o.begin_size, new_img.len); // Target size, not the patch size
+    CHECK_EQ(o.ends, 1);
+    CHECK(o.committed);
+
+    ota_delta_stats_t st;
+    ota_delta_get_stats(&st);
+    CHECK(st.is_delta);
+    CHECK_EQ(st.patch_bytes, patch.len);
+    CHECK_EQ(st.target_bytes, new_img.len);
+    CHECK(st.copied_bytes > new_img.len / 2);
+    free(o.data);
+  }
+  free((void *)src.host_data);
+}
+
+static void test_gates_every_flash_chunk(void) {
+  esp_partition_t src = partition_of(&old_img);
+  out_t o;
+
+  CHECK_EQ(apply(&src, patch.data, patch.len, 4096, 4096, &o), ESP_OK);
+  CHECK(o.len == new_img.len && memcmp(o.data, new_img.data, o.len) == 0);
+  // COPY ops of up to 16 KB are split; nothing reaches flash ungated
+  CHECK(o.max_write <= 4096);
+  uint32_t source_reads = (old_img.len + 16383) / 16384;
+  CHECK(gate_calls >= o.writes + source_reads);
+  CHECK(o.writes >= new_img.len / 4096);
+  free(o.data);
+  free((void *)src.host_data);
+}
+
+static void test_refuses_other_source(void) {
+  blob_t other = {malloc(old_img.len), old_img.len};
+  memcpy(other.data, old_img.data, old_img.len);
+  other.data[old_img.len / 2] ^= 1;
+  esp_partition_t src = partition_of(&other);
+  out_t o;
+
+  CHECK_EQ(apply(&src, patch.data, patch.len, 4096, 0, &o),
+           ESP_ERR_INVALID_CRC);
+  CHECK_EQ(o.len, 0);
+  CHECK(!o.committed);
+  free(o.data);
+  free((void *)src.host_data);
+  free(other.data);
+}
+
+static void test_truncated_patch(void) {
+  esp_partition_t src = partition_of(&old_img);
+  out_t o;
+
+  CHECK_EQ(apply(&src, patch.data, patch.len - 100, 4096, 0, &o),
+           ESP_ERR_INVALID_SIZE);
+  CHECK_EQ(o.ends, 1);
+  CHECK(!o.committed);
+  free(o.data);
+
+  // Cut inside the header: nothing was begun on the output
+  CHECK_EQ(apply(&src, patch.data, 20, 4096, 0, &o), ESP_ERR_INVALID_SIZE);
+  CHECK_EQ(o.begins, 0);
+  free(o.data);
+  free((void *)src.host_data);
+}
+
+/** Offset of the first INSERT payload byte in the patch */
+static size_t first_insert_byte(void) {
+  size_t pos = 8 + 8 + 64;
+  while (pos < patch.len && patch.data[pos] != 'E') {
+    if (patch.data[pos] == 'I') {
+      return pos + 5;
+    }
+    pos += 9; // COPY
+  }
+  return 0;
+}
+
+static void test_corrupt_payload(void) {
+  esp_partition_t src = partition_of(&old_img);
+  blob_t bad = {malloc(patch.len), patch.len};
+  memcpy(bad.data, patch.data, patch.len);
+  size_t at = first_insert_byte();
+  CHECK(at > 0);
+  bad.data[at] ^= 0xFF;
+  out_t o;
+
+  CHECK_EQ(apply(&src, bad.data, bad.len, 4096, 0, &o), ESP_ERR_INVALID_CRC);
+  CHECK(!o.committed);
+  free(o.data);
+
+  // Bytes after the end op
+  bad.data = realloc(bad.data, patch.len + 3);
+  memcpy(bad.data, patch.data, patch.len);
+  memcpy(bad.data + patch.len, "xyz", 3);
+  CHECK_EQ(apply(&src, bad.data, patch.len + 3, 4096, 0, &o),
+           ESP_ERR_INVALID_SIZE);
+  free(o.data);
+  free(bad.data);
+  free((void *)src.host_data);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static void test_copy_outside_source(void) {
+  esp_partition_t src = partition_of(&old_img);
+  uint8_t p[8 + 8 + 64 + 9 + 1];
+  memcpy(p, "ESPDLT1", 8);
+  put_u32(p + 8, (uint32_t)old_img.len);
+  put_u32(p + 12, 100);
+  mbedtls_sha256(old_img.data, old_img.len, p + 16, 0);
+  memset(p + 48, 0, 32);
+  p[80] = 'C';
+  put_u32(p + 81, (uint32_t)old_img.len - 4);
+  put_u32(p + 85, 100);
+  p[89] = 'E';
+  out_t o;
+
+  CHECK_EQ(apply(&src, p, sizeof(p), sizeof(p), 0, &o), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(o.len, 0);
+  free(o.data);
+  free((void *)src.host_data);
+}
+
+static void test_full_image_passes_through(void) {
+  esp_partition_t src = partition_of(&old_img);
+  out_t o;
+
+  CHECK_EQ(apply(&src, new_img.data, new_img.len, 3000, 4096, &o), ESP_OK);
+  CHECK(o.len == new_img.len && memcmp(o.data, new_img.data, o.len) == 0);
+  CHECK_EQ(o.begin_size, new_img.len);
+  CHECK(o.max_write <= 4096);
+  CHECK(o.committed);
+  ota_delta_stats_t st;
+  ota_delta_get_stats(&st);
+  CHECK(!st.is_delta);
+  CHECK_EQ(st.target_bytes, new_img.len);
+  free(o.data);
+  free((void *)src.host_data);
+}
+
+int main(void) {
+  old_img = load("old.bin");
+  new_img = load("new.bin");
+  patch = load("update.delta");
+
+  RUN(test_applies_in_any_pieces);
+  RUN(test_gates_every_flash_chunk);
+  RUN(test_refuses_other_source);
+  RUN(test_truncated_patch);
+  RUN(test_corrupt_payload);
+  RUN(test_copy_outside_source);
+  RUN(test_full_image_passes_through);
+
+  free(old_img.data);
+  free(new_img.data);
+  free(patch.data);
+  return TEST_RESULT();
+}
@@ -0,0 +1,452 @@
+/**
+ * @file test_ota_pipeline.c
+ * @brief ota_pipeline: stream integrity and SHA-256, checkpoints and a
+ * resumed stream, sink failures and aborts, the flash gate, and a download
+ * from a local HTTP server overlapping a slow fake flash
+ */
+
+#include "esp_timer.h"
+#include "host.h"
+#include "mbedtls/sha256.h"
+#include "metrics.h"
+#include "ota_pipeline.h"
+#include "test_util.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define IMAGE_SIZE (1024 * 1024 + 333) // Not a multiple of any slot
+
+static uint8_t image[IMAGE_SIZE];
+
+/** Flash partition stand-in */
+typedef struct {
+  uint8_t data[IMAGE_SIZE];
+  size_t len;
+  size_t begin_size;
+  int begins;
+  int ends;
+  bool committed;
+  uint32_t write_us_per_kb; ///< Simulated flash speed, 0 = instant
+  size_t fail_at;           ///< Fail the write crossing this offset, 0 = never
+} fake_flash_t;
+
+static fake_flash_t flash;
+
+static esp_err_t flash_begin(void *ctx, size_t image_size) {
+  fake_flash_t *f = ctx;
+  f->begins++;
+  f->begin_size = image_size;
+  return ESP_OK;
+}
+
+static esp_err_t flash_write(void *ctx, const void *data, size_t len) {
+  fake_flash_t *f = ctx;
+  if (f->fail_at && f->len + len > f->fail_at) {
+    return ESP_ERR_INVALID_CRC;
+  }
+  CHECK(f->len + len <= sizeof(f->data));
+  memcpy(f->data + f->len, data, len);
+  f->len += len;
+  if (f->write_us_per_kb) {
+    usleep(f->write_us_per_kb * len / 1024);
+  }
+  return ESP_OK;
+}
+
+static esp_err_t flash_end(void *ctx, bool commit) {
+  fake_flash_t *f = ctx;
+  f->ends++;
+  f->committed = commit;
+  return ESP_OK;
+}
+
+static const ota_sink_t sink = {
+    .begin = flash_begin,
+    .write = flash_write,
+    .end = flash_end,
+    .ctx = &flash,
+};
+
+static void flash_reset(void) { memset(&flash, 0, sizeof(flash)); }
+
+static void sha_of(const uint8_t *data, size_t len, uint8_t out[32]) {
+  mbedtls_sha256(data, len, out, 0);
+}
+
+/** Feed @p len bytes of the image from @p from in uneven pieces */
+static esp_err_t produce(size_t from, size_t len) {
+  size_t pos = from;
+  size_t step = 1;
+  while (pos < from + len) {
+    uint8_t *slot = ota_pipeline_acquire(1000);
+    if (slot == NULL) {
+      return ESP_FAIL;
+    }
+    // Partly filled slots, as a short read at the end of a connection gives
+    step = step * 7 % OTA_PIPELINE_SLOT_SIZE + 1000;
+    size_t n = from + len - pos < step ? from + len - pos : step;
+    memcpy(slot, image + pos, n);
+    pos += n;
+    esp_err_t err = ota_pipeline_submit(slot, n);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  return ESP_OK;
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_stream_and_hash(void) {
+  flash_reset();
+  host_metrics_reset();
+  ota_pipeline_config_t cfg = {.image_size = IMAGE_SIZE};
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_OK);
+  CHECK_EQ(produce(0, IMAGE_SIZE), ESP_OK);
+
+  uint8_t digest[OTA_SHA256_LEN], expect[32];
+  CHECK_EQ(ota_pipeline_finish(digest), ESP_OK);
+  sha_of(image, IMAGE_SIZE, expect);
+  CHECK(memcmp(digest, expect, 32) == 0);
+
+  CHECK_EQ(flash.begins, 1);
+  CHECK_EQ(flash.begin_size, IMAGE_SIZE);
+  CHECK_EQ(flash.ends, 1);
+  CHECK(flash.committed);
+  CHECK_EQ(flash.len, IMAGE_SIZE);
+  CHECK(memcmp(flash.data, image, IMAGE_SIZE) == 0);
+
+  ota_pipeline_stats_t st;
+  ota_pipeline_get_stats(&st);
+  CHECK_EQ(st.offset, 0);
+  CHECK_EQ(st.net_bytes, IMAGE_SIZE);
+  CHECK_EQ(st.flash_bytes, IMAGE_SIZE);
+  CHECK_EQ(metrics_get(METRIC_OTA_NET_BYTES), IMAGE_SIZE);
+  CHECK_EQ(metrics_get(METRIC_OTA_FLASH_BYTES), IMAGE_SIZE);
+
+  // The ring went back: another pipeline can start
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_OK);
+  CHECK_EQ(ota_pipeline_finish(NULL), ESP_OK);
+}
+
+static void test_empty_slot_returned(void) {
+  flash_reset();
+  ota_pipeline_config_t cfg = {0};
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_OK);
+  // A read that timed out hands its slot back; all of them stay usable
+  for (int i = 0; i < 3 * OTA_PIPELINE_SLOTS; i++) {
+    uint8_t *slot = ota_pipeline_acquire(100);
+    CHECK(slot != NULL);
+    CHECK_EQ(ota_pipeline_submit(slot, 0), ESP_OK);
+  }
+  uint8_t digest[OTA_SHA256_LEN], expect[32];
+  CHECK_EQ(ota_pipeline_finish(digest), ESP_OK);
+  sha_of(image, 0, expect);
+  CHECK(memcmp(digest, expect, 32) == 0);
+  CHECK_EQ(flash.len, 0);
+  CHECK(flash.committed);
+}
+
+// -----------------------------------------------------------------------------
+
+#define CHECKPOINT_BYTES (256 * 1024)
+
+typedef struct {
+  int count;
+  uint32_t offset[8];
+  uint8_t digest[8][OTA_SHA256_LEN];
+} checkpoints_t;
+
+static void on_checkpoint(void *ctx, uint32_t offset,
+                          const uint8_t digest[OTA_SHA256_LEN]) {
+  checkpoints_t *c = ctx;
+  CHECK(c->count < 8);
+  c->offset[c->count] = offset;
+  memcpy(c->digest[c->count], digest, OTA_SHA256_LEN);
+  c->count++;
+}
+
+static void test_checkpoints_and_resume(void) {
+  flash_reset();
+  checkpoints_t cps = {0};
+  ota_pipeline_config_t cfg = {
+      .image_size = IMAGE_SIZE,
+      .checkpoint = on_checkpoint,
+      .checkpoint_ctx = &cps,
+      .checkpoint_bytes = CHECKPOINT_BYTES,
+  };
+
+  // The connection drops after 600 KB
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_OK);
+  CHECK_EQ(produce(0, 600 * 1024), ESP_OK);
+  CHECK_EQ(ota_pipeline_finish(NULL), ESP_OK);
+
+  // Each checkpoint is on written data, at least an interval apart, with
+  // the hash of everything before it
+  CHECK_EQ(cps.count, 2);
+  uint32_t prev = 0;
+  for (int i = 0; i < cps.count; i++) {
+    uint8_t expect[32];
+    CHECK(cps.offset[i] >= prev + CHECKPOINT_BYTES);
+    CHECK(cps.offset[i] <= flash.len);
+    sha_of(image, cps.offset[i], expect);
+    CHECK(memcmp(cps.digest[i], expect, 32) == 0);
+    prev = cps.offset[i];
+  }
+
+  // Resume from the last checkpoint with the hash state of the prefix, as
+  // ota_update rebuilds it from flash after a reboot
+  uint32_t from = cps.offset[cps.count - 1];
+  mbedtls_sha256_context prefix;
+  mbedtls_sha256_init(&prefix);
+  mbedtls_sha256_starts(&prefix, 0);
+  mbedtls_sha256_update(&prefix, image, from);
+
+  flash.len = from;
+  cps.count = 0;
+  cfg.offset = from;
+  cfg.prefix_sha = &prefix;
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_OK);
+  mbedtls_sha256_free(&prefix);
+  CHECK_EQ(produce(from, IMAGE_SIZE - from), ESP_OK);
+  uint8_t digest[OTA_SHA256_LEN], expect[32];
+  CHECK_EQ(ota_pipeline_finish(digest), ESP_OK);
+
+  sha_of(image, IMAGE_SIZE, expect);
+  CHECK(memcmp(digest, expect, 32) == 0);
+  CHECK(memcmp(flash.data, image, IMAGE_SIZE) == 0);
+  ota_pipeline_stats_t st;
+  ota_pipeline_get_stats(&st);
+  CHECK_EQ(st.offset, from);
+  CHECK_EQ(st.flash_bytes, IMAGE_SIZE - from);
+  // Checkpoints carry on from the resumed position
+  CHECK(cps.count >= 1);
+  CHECK(cps.offset[0] >= from + CHECKPOINT_BYTES);
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_sink_failure(void) {
+  flash_reset();
+  flash.fail_at = 100 * 1024;
+  ota_pipeline_config_t cfg = {.image_size = IMAGE_SIZE};
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_OK);
+
+  // The producer learns of it from submit or acquire, and never blocks
+  CHECK(produce(0, IMAGE_SIZE) != ESP_OK);
+  CHECK(ota_pipeline_finish(NULL) == ESP_ERR_INVALID_CRC);
+  CHECK_EQ(flash.ends, 1);
+  CHECK(!flash.committed);
+  CHECK(flash.len < flash.fail_at);
+
+  ota_pipeline_stats_t st;
+  ota_pipeline_get_stats(&st);
+  CHECK_EQ(st.flash_bytes, flash.len);
+}
+
+static void test_abort(void) {
+  flash_reset();
+  flash.write_us_per_kb = 20;
+  ota_pipeline_config_t cfg = {.image_size = IMAGE_SIZE};
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_OK);
+  CHECK_EQ(produce(0, 256 * 1024), ESP_OK);
+  ota_pipeline_abort();
+  CHECK_EQ(flash.ends, 1);
+  CHECK(!flash.committed);
+  CHECK(flash.len < 256 * 1024); // Queued slots were not written
+
+  ota_pipeline_abort(); // Nothing running
+  CHECK_EQ(ota_pipeline_finish(NULL), ESP_ERR_INVALID_STATE);
+  CHECK(ota_pipeline_acquire(0) == NULL);
+}
+
+static atomic_int gate_calls;
+
+static void gate(void) {
+  atomic_fetch_add(&gate_calls, 1);
+  usleep(100);
+}
+
+static void test_flash_gate(void) {
+  flash_reset();
+  atomic_store(&gate_calls, 0);
+  ota_pipeline_config_t cfg = {
+      .image_size = IMAGE_SIZE, .flash_gate = gate, .flash_chunk = 4096};
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_OK);
+  CHECK_EQ(produce(0, IMAGE_SIZE), ESP_OK);
+  CHECK_EQ(ota_pipeline_finish(NULL), ESP_OK);
+
+  // Every chunk waited at the gate; a slot's tail is a chunk of its own
+  CHECK(atomic_load(&gate_calls) >= IMAGE_SIZE / 4096);
+  CHECK(memcmp(flash.data, image, IMAGE_SIZE) == 0);
+  ota_pipeline_stats_t st;
+  ota_pipeline_get_stats(&st);
+  CHECK(st.flash_gate_ms > 0);
+  CHECK(st.flash_ms < st.elapsed_ms); // Gate time is not flash time
+}
+
+static void test_bad_args(void) {
+  ota_pipeline_config_t cfg = {0};
+  ota_sink_t no_write = {.ctx = &flash};
+  CHECK_EQ(ota_pipeline_start(NULL, &cfg), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(ota_pipeline_start(&sink, NULL), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(ota_pipeline_start(&no_write, &cfg), ESP_ERR_INVALID_ARG);
+
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_OK);
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_ERR_INVALID_STATE);
+  CHECK_EQ(ota_pipeline_submit(NULL, 1), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(ota_pipeline_finish(NULL), ESP_OK);
+}
+
+// -----------------------------------------------------------------------------
+// A download from a local HTTP server: the network and a slow flash overlap
+
+#define NET_CHUNK 8192
+#define NET_US_PER_CHUNK 1000 // ~8 MB/s link
+#define FLASH_US_PER_KB 40    // ~25 MB/s flash, plus the hash
+
+static int listen_fd = -1;
+static uint32_t server_ms; // Time the server took to send the body
+
+static void *http_server_main(void *arg) {
+  (void)arg;
+  int fd = accept(listen_fd, NULL, NULL);
+  CHECK(fd >= 0);
+  char req[512];
+  ssize_t n = recv(fd, req, sizeof(req) - 1, 0);
+  CHECK(n > 0);
+  req[n > 0 ? n : 0] = '\0';
+  CHECK(strncmp(req, "GET /firmware.bin HTTP/1.1\r\n", 28) == 0);
+
+  char hdr[128];
+  int len = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n",
+                     IMAGE_SIZE);
+  send(fd, hdr, len, MSG_NOSIGNAL);
+  int64_t t0 = esp_timer_get_time();
+  for (size_t off = 0; off < IMAGE_SIZE; off += NET_CHUNK) {
+    size_t chunk = IMAGE_SIZE - off < NET_CHUNK ? IMAGE_SIZE - off : NET_CHUNK;
+    CHECK_EQ(send(fd, image + off, chunk, MSG_NOSIGNAL), (ssize_t)chunk);
+    usleep(NET_US_PER_CHUNK);
+  }
+  server_ms = (uint32_t)((esp_timer_get_time() - t0) / 1000);
+  close(fd);
+  return NULL;
+}
+
+/** GET the image and return the connection positioned at the body */
+static int http_get(uint16_t port, size_t *content_length) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(connect(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+  const char *req = "GET /firmware.bin HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  send(fd, req, strlen(req), MSG_NOSIGNAL);
+
+  // Headers byte by byte, so no body is consumed
+  char hdr[512];
+  size_t n = 0;
+  while (n < sizeof(hdr) - 1 && recv(fd, hdr + n, 1, 0) == 1) {
+    n++;
+    if (n >= 4 && memcmp(hdr + n - 4, "\r\n\r\n", 4) == 0) {
+      break;
+    }
+  }
+  hdr[n] = '\0';
+  CHECK(strncmp(hdr, "HTTP/1.1 200", 12) == 0);
+  const char *cl = strstr(hdr, "Content-Length: ");
+  CHECK(cl != NULL);
+  *content_length = cl ? strtoul(cl + 16, NULL, 10) : 0;
+  return fd;
+}
+
+static void test_download_overlaps_flash(void) {
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET};
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t alen = sizeof(addr);
+  CHECK_EQ(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+  CHECK_EQ(listen(listen_fd, 1), 0);
+  getsockname(listen_fd, (struct sockaddr *)&addr, &alen);
+  pthread_t server;
+  pthread_create(&server, NULL, http_server_main, NULL);
+
+  size_t total = 0;
+  int fd = http_get(ntohs(addr.sin_port), &total);
+  CHECK_EQ(total, IMAGE_SIZE);
+
+  flash_reset();
+  flash.write_us_per_kb = FLASH_US_PER_KB;
+  host_metrics_reset();
+  ota_pipeline_config_t cfg = {.image_size = total};
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_OK);
+
+  // What ota_update's read_slot does: fill a slot, timing only the reads
+  size_t got = 0;
+  while (got < total) {
+    uint8_t *slot = ota_pipeline_acquire(2000);
+    CHECK(slot != NULL);
+    size_t fill = 0;
+    while (fill < OTA_PIPELINE_SLOT_SIZE && got + fill < total) {
+      int64_t t0 = esp_timer_get_time();
+      ssize_t n = recv(fd, slot + fill, OTA_PIPELINE_SLOT_SIZE - fill, 0);
+      ota_pipeline_note_net_time(
+          (uint32_t)((esp_timer_get_time() - t0) / 1000));
+      CHECK(n > 0);
+      if (n <= 0) {
+        break;
+      }
+      fill += (size_t)n;
+    }
+    got += fill;
+    CHECK_EQ(ota_pipeline_submit(slot, fill), ESP_OK);
+  }
+  close(fd);
+  pthread_join(server, NULL);
+  close(listen_fd);
+
+  uint8_t digest[OTA_SHA256_LEN], expect[32];
+  CHECK_EQ(ota_pipeline_finish(digest), ESP_OK);
+  sha_of(image, IMAGE_SIZE, expect);
+  CHECK(memcmp(digest, expect, 32) == 0);
+  CHECK(memcmp(flash.data, image, IMAGE_SIZE) == 0);
+
+  ota_pipeline_stats_t st;
+  ota_pipeline_get_stats(&st);
+  printf("server %u ms; network %u ms (waited %u ms), flash %u ms "
+         "(waited %u ms), elapsed %u ms\n",
+         (unsigned)server_ms, (unsigned)st.net_ms, (unsigned)st.net_wait_ms,
+         (unsigned)st.flash_ms, (unsigned)st.flash_wait_ms,
+         (unsigned)st.elapsed_ms);
+  // Overlapped: well below the download and the flash back to back
+  CHECK(st.net_ms > 0 && st.flash_ms > 0);
+  CHECK(st.elapsed_ms < (server_ms + st.flash_ms) * 85 / 100);
+
+  // Throughput gauges for /metrics
+  CHECK(host_metrics_gauge(METRIC_GAUGE_OTA_NET_BPS) > 0);
+  CHECK(host_metrics_gauge(METRIC_GAUGE_OTA_FLASH_BPS) > 0);
+  CHECK(host_metrics_gauge(METRIC_GAUGE_OTA_TOTAL_BPS) > 0);
+  CHECK(host_metrics_gauge(METRIC_GAUGE_OTA_TOTAL_BPS) <=
+        host_metrics_gauge(METRIC_GAUGE_OTA_FLASH_BPS));
+}
+
+int main(void) {
+  srand(61);
+  for (size_t i = 0; i < IMAGE_SIZE; i++) {
+    image[i] = (uint8_t)rand();
+  }
+  RUN(test_stream_and_hash);
+  RUN(test_empty_slot_returned);
+  RUN(test_checkpoints_and_resume);
+  RUN(test_sink_failure);
+  RUN(test_abort);
+  RUN(test_flash_gate);
+  RUN(test_bad_args);
+  RUN(test_download_overlaps_flash);
+  return TEST_RESULT();
+}
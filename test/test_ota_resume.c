@@ -0,0 +1,600 @@
+/**
+ * @file test_ota_resume.c
+ * @brief ota_resume: checkpoint storage and matching, prefix verification,
+ * If-Range validators, and downloads through the pipeline from a local
+ * HTTP server that cuts connections at random offsets, across reboots and
+ * image changes
+ */
+
+#include "host.h"
+#include "nvs.h"
+#include "ota_pipeline.h"
+#include "ota_resume.h"
+#include "spi_flash_mmap.h"
+#include "test_util.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define URL "http://ota.local/firmware.bin"
+#define IMAGE_SIZE (900 * 1024 + 77)
+#define PART_SIZE (1024 * 1024)
+#define CHECKPOINT_BYTES (64 * 1024)
+
+static uint8_t image_a[IMAGE_SIZE];
+static uint8_t image_b[IMAGE_SIZE];
+static uint8_t part_data[PART_SIZE];
+static const esp_partition_t part = {
+    .address = 0x200000,
+    .size = PART_SIZE,
+    .label = "ota_0",
+    .host_data = part_data,
+};
+
+static void sha_of(const uint8_t *data, size_t len, uint8_t out[32]) {
+  mbedtls_sha256(data, len, out, 0);
+}
+
+static uint32_t nvs_checkpoint_writes(void) {
+  return host_nvs_writes("checkpoint");
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_checkpoint_store(void) {
+  ota_checkpoint_t cp, saved;
+  uint8_t digest[OTA_SHA256_LEN];
+  sha_of(image_a, 4 * SPI_FLASH_SEC_SIZE, digest);
+
+  ota_resume_init(&cp, URL, part.label);
+  CHECK_EQ(cp.version, OTA_RESUME_VERSION);
+  CHECK_STR(cp.label, "ota_0");
+  CHECK(!ota_resume_load(&cp, &saved)); // Nothing stored
+
+  cp.total = IMAGE_SIZE;
+  strcpy(cp.validator, "\"v1\"");
+  CHECK(ota_resume_save(&cp, 4 * SPI_FLASH_SEC_SIZE, digest));
+  CHECK(ota_resume_load(&cp, &saved));
+  CHECK_EQ(saved.offset, 4 * SPI_FLASH_SEC_SIZE);
+  CHECK_EQ(saved.total, IMAGE_SIZE);
+  CHECK_STR(saved.validator, "\"v1\"");
+  CHECK(memcmp(saved.prefix_sha, digest, OTA_SHA256_LEN) == 0);
+
+  // Inside a sector: esp_ota_resume() would erase part of the prefix
+  uint32_t writes = nvs_checkpoint_writes();
+  CHECK(!ota_resume_save(&cp, 4 * SPI_FLASH_SEC_SIZE + 512, digest));
+  CHECK_EQ(nvs_checkpoint_writes(), writes);
+  CHECK(ota_resume_load(&cp, &saved));
+  CHECK_EQ(saved.offset, 4 * SPI_FLASH_SEC_SIZE);
+
+  // Another URL or slot does not continue it
+  ota_checkpoint_t other;
+  ota_resume_init(&other, URL "?v=2", part.label);
+  CHECK(!ota_resume_load(&other, &saved));
+  ota_resume_init(&other, URL, "ota_1");
+  CHECK(!ota_resume_load(&other, &saved));
+
+  // Nothing to send as If-Range, or nothing left to download
+  cp.validator[0] = '\0';
+  ota_resume_save(&cp, 4 * SPI_FLASH_SEC_SIZE, digest);
+  CHECK(!ota_resume_load(&cp, &saved));
+  strcpy(cp.validator, "\"v1\"");
+  cp.total = 4 * SPI_FLASH_SEC_SIZE;
+  ota_resume_save(&cp, 4 * SPI_FLASH_SEC_SIZE, digest);
+  CHECK(!ota_resume_load(&cp, &saved));
+
+  // A checkpoint written by an older firmware is ignored
+  cp.total = IMAGE_SIZE;
+  cp.version = OTA_RESUME_VERSION - 1;
+  ota_resume_save(&cp, 4 * SPI_FLASH_SEC_SIZE, digest);
+  CHECK(!ota_resume_load(&cp, &saved));
+  CHECK_EQ(saved.offset, 0);
+
+  nvs_handle_t h;
+  CHECK_EQ(nvs_open("ota_resume", NVS_READWRITE, &h), ESP_OK);
+  CHECK_EQ(nvs_set_blob(h, "checkpoint", "short", 5), ESP_OK);
+  nvs_close(h);
+  CHECK(!ota_resume_load(&cp, &saved));
+
+  ota_resume_clear();
+  ota_resume_clear(); // Twice is harmless
+  CHECK(!ota_resume_load(&cp, &saved));
+}
+
+static void test_verify_prefix(void) {
+  const uint32_t at = 32 * SPI_FLASH_SEC_SIZE;
+  memcpy(part_data, image_a, at);
+  ota_checkpoint_t cp;
+  ota_resume_init(&cp, URL, part.label);
+  cp.offset = at;
+  sha_of(image_a, at, cp.prefix_sha);
+
+  // The prefix state carries on to the hash of the whole image
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  CHECK(ota_resume_verify(&part, &cp, &sha));
+  mbedtls_sha256_update(&sha, image_a + at, IMAGE_SIZE - at);
+  uint8_t digest[32], expect[32];
+  mbedtls_sha256_finish(&sha, digest);
+  sha_of(image_a, IMAGE_SIZE, expect);
+  CHECK(memcmp(digest, expect, 32) == 0);
+
+  // One flipped bit anywhere in the prefix
+  part_data[at / 3] ^= 0x10;
+  CHECK(!ota_resume_verify(&part, &cp, &sha));
+  part_data[at / 3] ^= 0x10;
+  CHECK(ota_resume_verify(&part, &cp, &sha));
+
+  cp.offset = PART_SIZE + SPI_FLASH_SEC_SIZE;
+  CHECK(!ota_resume_verify(&part, &cp, &sha));
+  mbedtls_sha256_free(&sha);
+}
+
+static void test_validator_headers(void) {
+  char v[OTA_RESUME_VALIDATOR_LEN] = "";
+  ota_resume_note_header(v, "Content-Length", "123");
+  CHECK_STR(v, "");
+  ota_resume_note_header(v, "ETag", "W/\"weak\"");
+  CHECK_STR(v, "");
+  ota_resume_note_header(v, "last-modified", "Sat, 17 Oct 2026 06:00:00 GMT");
+  CHECK_STR(v, "Sat, 17 Oct 2026 06:00:00 GMT");
+  ota_resume_note_header(v, "etag", "\"abc\"");
+  CHECK_STR(v, "\"abc\"");
+  // A strong ETag is kept whatever follows
+  ota_resume_note_header(v, "Last-Modified", "Sun, 18 Oct 2026 06:00:00 GMT");
+  ota_resume_note_header(v, "ETag", "\"other\"");
+  CHECK_STR(v, "\"abc\"");
+
+  char longer[OTA_RESUME_VALIDATOR_LEN + 8];
+  memset(longer, 'x', sizeof(longer) - 1);
+  longer[0] = '"';
+  longer[sizeof(longer) - 1] = '\0';
+  v[0] = '\0';
+  ota_resume_note_header(v, "ETag", longer);
+  CHECK_STR(v, ""); // Cut, it would never match
+}
+
+static void test_continues(void) {
+  ota_checkpoint_t cp = {.total = IMAGE_SIZE};
+  strcpy(cp.validator, "\"v1\"");
+  CHECK(ota_resume_continues(&cp, 4096, true, IMAGE_SIZE, "\"v1\""));
+  CHECK(ota_resume_continues(&cp, 4096, true, IMAGE_SIZE, NULL));
+  CHECK(ota_resume_continues(&cp, 0, false, IMAGE_SIZE, NULL));
+  // 200 to a Range: the whole image again
+  CHECK(!ota_resume_continues(&cp, 4096, false, IMAGE_SIZE, "\"v1\""));
+  // 206 of another image
+  CHECK(!ota_resume_continues(&cp, 4096, true, IMAGE_SIZE + 1, "\"v1\""));
+  CHECK(!ota_resume_continues(&cp, 4096, true, IMAGE_SIZE, "\"v2\""));
+}
+
+// -----------------------------------------------------------------------------
+// A local HTTP server honouring Range and If-Range that cuts every
+// connection after a random number of body bytes
+
+static struct {
+  pthread_mutex_t lock;
+  const uint8_t *image;
+  char etag[16];
+  uint32_t cut_min, cut_max; ///< Body bytes per connection, 0 = never cut
+  unsigned seed;
+  // Seen by the server
+  int connections;
+  int partial;               ///< 206 answers
+  int whole;                 ///< 200 answers
+  uint32_t first_range;      ///< Range start of the first request
+  uint64_t body_bytes;
+} srv = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int listen_fd = -1;
+static uint16_t port;
+static pthread_t server_thread;
+
+static void serve(int fd) {
+  char req[1024];
+  size_t n = 0;
+  while (n < sizeof(req) - 1 && recv(fd, req + n, 1, 0) == 1) {
+    n++;
+    if (n >= 4 && memcmp(req + n - 4, "\r\n\r\n", 4) == 0) {
+      break;
+    }
+  }
+  req[n] = '\0';
+
+  long from = -1;
+  char if_range[OTA_RESUME_VALIDATOR_LEN] = "";
+  const char *h = strstr(req, "\r\nRange: bytes=");
+  if (h) {
+    from = strtol(h + 15, NULL, 10);
+  }
+  h = strstr(req, "\r\nIf-Range: ");
+  if (h) {
+    sscanf(h + 12, "%79[^\r]", if_range);
+  }
+
+  pthread_mutex_lock(&srv.lock);
+  const uint8_t *image = srv.image;
+  char etag[16];
+  strcpy(etag, srv.etag);
+  bool ranged = from > 0 && from < IMAGE_SIZE &&
+                (if_range[0] == '\0' || strcmp(if_range, etag) == 0);
+  uint32_t cut = srv.cut_max ? srv.cut_min + rand_r(&srv.seed) %
+                                   (srv.cut_max - srv.cut_min + 1)
+                             : UINT32_MAX;
+  if (srv.connections++ == 0) {
+    srv.first_range = from > 0 ? (uint32_t)from : 0;
+  }
+  ranged ? srv.partial++ : srv.whole++;
+  pthread_mutex_unlock(&srv.lock);
+
+  uint32_t start = ranged ? (uint32_t)from : 0;
+  char hdr[256];
+  int len;
+  if (ranged) {
+    len = snprintf(hdr, sizeof(hdr),
+                   "HTTP/1.1 206 Partial Content\r\nETag: %s\r\n"
+                   "Content-Range: bytes %u-%u/%u\r\n"
+                   "Content-Length: %u\r\n\r\n",
+                   etag, start, IMAGE_SIZE - 1, IMAGE_SIZE,
+                   IMAGE_SIZE - start);
+  } else {
+    len = snprintf(hdr, sizeof(hdr),
+                   "HTTP/1.1 200 OK\r\nETag: %s\r\nContent-Length: %u\r\n\r\n",
+                   etag, IMAGE_SIZE);
+  }
+  send(fd, hdr, len, MSG_NOSIGNAL);
+
+  uint32_t body = IMAGE_SIZE - start < cut ? IMAGE_SIZE - start : cut;
+  uint32_t sent = 0;
+  while (sent < body) {
+    ssize_t k = send(fd, image + start + sent,
+                     body - sent < 16384 ? body - sent : 16384, MSG_NOSIGNAL);
+    if (k <= 0) {
+      break;
+    }
+    sent += (uint32_t)k;
+  }
+  pthread_mutex_lock(&srv.lock);
+  srv.body_bytes += sent;
+  pthread_mutex_unlock(&srv.lock);
+  close(fd);
+}
+
+static void *server_main(void *arg) {
+  (void)arg;
+  int fd;
+  while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+    serve(fd);
+  }
+  return NULL;
+}
+
+static void server_start(void) {
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET};
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t alen = sizeof(addr);
+  CHECK_EQ(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+  CHECK_EQ(listen(listen_fd, 4), 0);
+  getsockname(listen_fd, (struct sockaddr *)&addr, &alen);
+  port = ntohs(addr.sin_port);
+  pthread_create(&server_thread, NULL, server_main, NULL);
+}
+
+static void server_stop(void) {
+  shutdown(listen_fd, SHUT_RDWR);
+  close(listen_fd);
+  pthread_join(server_thread, NULL);
+}
+
+/** Serve @p image under @p etag, cutting after cut_min..cut_max bytes */
+static void server_set(const uint8_t *image, const char *etag,
+                       uint32_t cut_min, uint32_t cut_max) {
+  pthread_mutex_lock(&srv.lock);
+  srv.image = image;
+  strcpy(srv.etag, etag);
+  srv.cut_min = cut_min;
+  srv.cut_max = cut_max;
+  srv.connections = srv.partial = srv.whole = 0;
+  srv.first_range = 0;
+  srv.body_bytes = 0;
+  pthread_mutex_unlock(&srv.lock);
+}
+
+// -----------------------------------------------------------------------------
+// The download side, as ota_update_task drives it
+
+typedef struct {
+  int fd;
+  bool ranged;
+  uint32_t total;
+  char validator[OTA_RESUME_VALIDATOR_LEN];
+} conn_t;
+
+/** GET from @p at with If-Range @p if_range; headers go to the validator */
+static bool http_open(uint32_t at, const char *if_range, conn_t *c) {
+  memset(c, 0, sizeof(*c));
+  c->fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(c->fd);
+    return false;
+  }
+  char req[256];
+  int len = snprintf(req, sizeof(req),
+                     "GET /firmware.bin HTTP/1.1\r\nHost: ota.local\r\n");
+  if (at > 0) {
+    len += snprintf(req + len, sizeof(req) - len, "Range: bytes=%u-\r\n", at);
+    if (if_range[0] != '\0') {
+      len += snprintf(req + len, sizeof(req) - len, "If-Range: %s\r\n",
+                      if_range);
+    }
+  }
+  len += snprintf(req + len, sizeof(req) - len, "\r\n");
+  send(c->fd, req, len, MSG_NOSIGNAL);
+
+  // Header lines byte by byte, so no body is consumed
+  char line[256];
+  int status = 0;
+  uint32_t content_length = 0;
+  for (;;) {
+    size_t n = 0;
+    while (n < sizeof(line) - 1 && recv(c->fd, line + n, 1, 0) == 1 &&
+           line[n] != '\n') {
+      n++;
+    }
+    line[n > 0 && line[n - 1] == '\r' ? n - 1 : n] = '\0';
+    if (line[0] == '\0') {
+      break;
+    }
+    char *colon = strchr(line, ':');
+    if (status == 0) {
+      sscanf(line, "HTTP/1.1 %d", &status);
+    } else if (colon) {
+      *colon = '\0';
+      const char *value = colon + 2;
+      if (strcasecmp(line, "Content-Length") == 0) {
+        content_length = (uint32_t)strtoul(value, NULL, 10);
+      }
+      ota_resume_note_header(c->validator, line, value);
+    }
+  }
+  c->ranged = at > 0 && status == 206;
+  c->total = content_length + (c->ranged ? at : 0);
+  if (status != 200 && !c->ranged) {
+    close(c->fd);
+    return false;
+  }
+  return true;
+}
+
+/** esp_ota_begin/esp_ota_resume and esp_ota_write on part_data */
+static uint32_t flash_pos;
+
+static esp_err_t flash_begin(void *ctx, size_t image_size) {
+  flash_pos = *(uint32_t *)ctx;
+  return ESP_OK;
+}
+
+static esp_err_t flash_write(void *ctx, const void *data, size_t len) {
+  CHECK(flash_pos + len <= PART_SIZE);
+  memcpy(part_data + flash_pos, data, len);
+  flash_pos += len;
+  return ESP_OK;
+}
+
+static void on_checkpoint(void *ctx, uint32_t offset,
+                          const uint8_t digest[OTA_SHA256_LEN]) {
+  ota_resume_save((ota_checkpoint_t *)ctx, offset, digest);
+}
+
+typedef struct {
+  bool ok;
+  bool resumed;
+  uint32_t resumed_at;
+  uint32_t received;  ///< Bytes downloaded by this run
+  int reconnects;
+  uint8_t digest[OTA_SHA256_LEN];
+} run_t;
+
+/**
+ * One OTA run. @p power_loss_at cuts it short once that many bytes are
+ * received, leaving flash and NVS as a reset would.
+ */
+static run_t run_update(uint32_t power_loss_at) {
+  run_t r = {0};
+  ota_checkpoint_t cp, saved;
+  mbedtls_sha256_context prefix;
+  mbedtls_sha256_init(&prefix);
+  uint32_t offset = 0;
+
+  ota_resume_init(&cp, URL, part.label);
+  if (ota_resume_load(&cp, &saved) &&
+      ota_resume_verify(&part, &saved, &prefix)) {
+    offset = saved.offset;
+  } else {
+    ota_resume_clear();
+  }
+
+  conn_t c;
+  CHECK(http_open(offset, saved.validator, &c));
+  if (offset > 0 &&
+      !ota_resume_continues(&saved, offset, c.ranged, c.total, c.validator)) {
+    ota_resume_clear();
+    offset = 0;
+    if (c.ranged) {
+      close(c.fd);
+      CHECK(http_open(0, "", &c));
+    }
+  }
+  r.resumed = offset > 0;
+  r.resumed_at = offset;
+  cp.total = c.total;
+  strcpy(cp.validator, c.validator);
+
+  uint32_t begin_at = offset;
+  const ota_sink_t sink = {
+      .begin = flash_begin, .write = flash_write, .ctx = &begin_at};
+  const ota_pipeline_config_t cfg = {
+      .image_size = cp.total,
+      .offset = offset,
+      .prefix_sha = offset > 0 ? &prefix : NULL,
+      .checkpoint = on_checkpoint,
+      .checkpoint_ctx = &cp,
+      .checkpoint_bytes = CHECKPOINT_BYTES,
+  };
+  CHECK_EQ(ota_pipeline_start(&sink, &cfg), ESP_OK);
+  mbedtls_sha256_free(&prefix);
+
+  uint32_t received = offset;
+  while (received < cp.total) {
+    uint8_t *slot = ota_pipeline_acquire(5000);
+    CHECK(slot != NULL);
+    int fill = 0;
+    while (fill < OTA_PIPELINE_SLOT_SIZE && received + fill < cp.total) {
+      ssize_t n = recv(c.fd, slot + fill, OTA_PIPELINE_SLOT_SIZE - fill, 0);
+      if (n > 0) {
+        fill += (int)n;
+        continue;
+      }
+      // Dropped: continue where it stopped
+      close(c.fd);
+      uint32_t at = received + fill;
+      r.reconnects++;
+      CHECK(r.reconnects < 200);
+      if (!http_open(at, cp.validator, &c) ||
+          !ota_resume_continues(&cp, at, c.ranged, c.total, NULL)) {
+        ota_pipeline_submit(slot, 0);
+        ota_pipeline_abort();
+        return r;
+      }
+    }
+    CHECK_EQ(ota_pipeline_submit(slot, fill), ESP_OK);
+    received += fill;
+    r.received = received - offset;
+    if (power_loss_at && r.received >= power_loss_at) {
+      // Whatever the flash task had not written yet is lost
+      close(c.fd);
+      ota_pipeline_abort();
+      return r;
+    }
+  }
+  close(c.fd);
+  r.ok = ota_pipeline_finish(r.digest) == ESP_OK && received == cp.total;
+  ota_resume_clear();
+  return r;
+}
+
+static void check_image(const run_t *r, const uint8_t *image) {
+  uint8_t expect[32];
+  sha_of(image, IMAGE_SIZE, expect);
+  CHECK(r->ok);
+  CHECK(memcmp(r->digest, expect, 32) == 0);
+  CHECK(memcmp(part_data, image, IMAGE_SIZE) == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_drops_at_random_offsets(void) {
+  ota_resume_clear();
+  memset(part_data, 0xff, sizeof(part_data));
+  server_set(image_a, "\"a1\"", 10 * 1024, 120 * 1024);
+
+  run_t r = run_update(0);
+  check_image(&r, image_a);
+  CHECK(!r.resumed);
+  CHECK(r.reconnects >= 8);
+  CHECK_EQ(r.received, IMAGE_SIZE);
+  // Every reconnect continued, nothing was fetched twice
+  CHECK_EQ(srv.whole, 1);
+  CHECK_EQ(srv.partial, r.reconnects);
+  CHECK_EQ(srv.body_bytes, IMAGE_SIZE);
+  printf("%d drops, %d connections\n", r.reconnects, srv.connections);
+}
+
+static void test_resume_after_reboot(void) {
+  ota_resume_clear();
+  memset(part_data, 0xff, sizeof(part_data));
+  server_set(image_a, "\"a1\"", 30 * 1024, 200 * 1024);
+
+  run_t first = run_update(400 * 1024);
+  CHECK(!first.ok);
+
+  // The next boot continues from a verified checkpoint with a Range
+  server_set(image_a, "\"a1\"", 30 * 1024, 200 * 1024);
+  run_t r = run_update(0);
+  check_image(&r, image_a);
+  CHECK(r.resumed);
+  CHECK_EQ(r.resumed_at % SPI_FLASH_SEC_SIZE, 0);
+  CHECK(r.resumed_at >= CHECKPOINT_BYTES);
+  CHECK(r.resumed_at <= first.received);
+  CHECK_EQ(srv.first_range, r.resumed_at);
+  CHECK_EQ(srv.whole, 0);
+  CHECK_EQ(r.received, IMAGE_SIZE - r.resumed_at);
+  CHECK_EQ(srv.body_bytes, IMAGE_SIZE - r.resumed_at);
+
+  ota_checkpoint_t cp, saved;
+  ota_resume_init(&cp, URL, part.label);
+  CHECK(!ota_resume_load(&cp, &saved)); // Cleared once complete
+}
+
+static void test_corrupt_prefix_starts_over(void) {
+  ota_resume_clear();
+  memset(part_data, 0xff, sizeof(part_data));
+  server_set(image_a, "\"a1\"", 0, 0);
+  run_t first = run_update(300 * 1024);
+  CHECK(!first.ok);
+
+  part_data[1000] ^= 1; // The slot was touched since
+  server_set(image_a, "\"a1\"", 0, 0);
+  run_t r = run_update(0);
+  check_image(&r, image_a);
+  CHECK(!r.resumed);
+  CHECK_EQ(srv.first_range, 0);
+  CHECK_EQ(srv.body_bytes, IMAGE_SIZE);
+}
+
+static void test_changed_image_starts_over(void) {
+  ota_resume_clear();
+  memset(part_data, 0xff, sizeof(part_data));
+  server_set(image_a, "\"a1\"", 0, 0);
+  run_t first = run_update(300 * 1024);
+  CHECK(!first.ok);
+
+  // A new build went up meanwhile: If-Range fails and the server sends it
+  // whole, which becomes the fresh download
+  server_set(image_b, "\"b1\"", 50 * 1024, 150 * 1024);
+  run_t r = run_update(0);
+  check_image(&r, image_b);
+  CHECK(!r.resumed);
+  CHECK(srv.first_range > 0);
+  CHECK_EQ(srv.whole, 1);
+  CHECK_EQ(srv.partial, r.reconnects);
+  CHECK_EQ(srv.body_bytes, IMAGE_SIZE);
+}
+
+int main(void) {
+  srand(63);
+  for (size_t i = 0; i < IMAGE_SIZE; i++) {
+    image_a[i] = (uint8_t)rand();
+    image_b[i] = (uint8_t)rand();
+  }
+  srv.seed = 63;
+
+  RUN(test_checkpoint_store);
+  RUN(test_verify_prefix);
+  RUN(test_validator_headers);
+  RUN(test_continues);
+
+  server_start();
+  RUN(test_drops_at_random_offsets);
+  RUN(test_resume_after_reboot);
+  RUN(test_corrupt_prefix_starts_over);
+  RUN(test_changed_image_starts_over);
+  server_stop();
+  return TEST_RESULT();
+}
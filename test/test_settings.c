@@ -0,0 +1,383 @@
+/**
+ * @file test_settings.c
+ * @brief settings_manager: schema defaults and clamping, migration of older
+ * and newer NVS layouts, and the coalesced, debounced commit, including a
+ * replay of slider drags reporting the NVS writes it saves
+ *
+ * The manager keeps its cache in statics and initializes once, so each case
+ * runs in its own process on an empty in-memory NVS.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host.h"
+#include "nvs.h"
+#include "settings_manager.h"
+#include "test_util.h"
+#include <limits.h>
+#include <math.h>
+
+#define NS "sys_config"
+
+// Every key in the schema, in setting_id_t order
+static const char *const keys[SETTING_COUNT] = {
+    "wifi_ssid", "wifi_pass", "ha_host",   "ha_port",   "ha_token",
+    "ha_ssl",    "mqtt_uri",  "mqtt_user", "mqtt_pass", "mqtt_id",
+    "out_vol",   "ota_url",   "wwd_thr",   "vad_thr",   "vad_sil",
+    "vad_min",   "vad_max",   "agc_en",    "agc_tgt",   "led_bri",
+};
+
+static nvs_handle_t ns(void) {
+  nvs_handle_t h = 0;
+  CHECK_EQ(nvs_open(NS, NVS_READWRITE, &h), ESP_OK);
+  return h;
+}
+
+/** Stored i32, INT_MIN if absent */
+static int32_t stored_i32(const char *key) {
+  int32_t v;
+  return nvs_get_i32(ns(), key, &v) == ESP_OK ? v : INT_MIN;
+}
+
+static int stored_version(void) {
+  uint8_t v;
+  return nvs_get_u8(ns(), "schema_ver", &v) == ESP_OK ? v : -1;
+}
+
+static uint32_t setting_writes(void) {
+  uint32_t n = 0;
+  for (int i = 0; i < SETTING_COUNT; i++) {
+    n += host_nvs_writes(keys[i]);
+  }
+  return n;
+}
+
+static app_settings_t loaded(void) {
+  app_settings_t s;
+  CHECK_EQ(settings_manager_load(&s), ESP_OK);
+  return s;
+}
+
+/** Wait up to @p ms for @p key to have been written @p n times */
+static bool wait_writes(const char *key, uint32_t n, uint32_t ms) {
+  for (uint32_t t = 0; t < ms && host_nvs_writes(key) < n; t += 20) {
+    vTaskDelay(pdMS_TO_TICKS(20));
+  }
+  return host_nvs_writes(key) >= n;
+}
+
+// ---------------------------------------------------------------------------
+
+static void test_fresh(void) {
+  CHECK_EQ(settings_manager_init(), ESP_OK);
+  CHECK_EQ(settings_manager_init(), ESP_OK);
+  CHECK_EQ(stored_version(), SETTINGS_SCHEMA_VERSION);
+  CHECK_EQ(host_nvs_writes("schema_ver"), 1);
+  CHECK_EQ(setting_writes(), 0); // Defaults are not written out
+
+  app_settings_t s = loaded();
+  CHECK_EQ(s.output_volume, 60);
+  CHECK_EQ(s.led_brightness, 100);
+  CHECK_EQ(lroundf(s.wwd_threshold * 1000), 500);
+  CHECK_EQ(s.vad_silence_ms, 1800);
+  CHECK(s.agc_enabled);
+  CHECK_STR(s.ota_url, "");
+  CHECK_STR(s.mqtt_username, ""); // NULL in config.h
+
+  CHECK_EQ(settings_manager_flush(), ESP_OK);
+  CHECK_EQ(setting_writes(), 0);
+}
+
+static void test_migrate_v1(void) {
+  // An unversioned namespace as v1 firmware left it
+  nvs_handle_t h = ns();
+  nvs_set_str(h, "wifi_ssid", "old-ssid");
+  nvs_set_i32(h, "out_vol", 150);
+  nvs_set_i32(h, "led_bri", -5);
+  nvs_set_i32(h, "ha_port", 0);
+  nvs_set_i32(h, "vad_sil", 50);
+  nvs_set_i32(h, "vad_thr", 300);
+  nvs_set_i32(h, "wwd_thr", 2000);
+
+  CHECK_EQ(settings_manager_init(), ESP_OK);
+  CHECK_EQ(stored_version(), SETTINGS_SCHEMA_VERSION);
+  CHECK_EQ(stored_i32("out_vol"), 100);
+  CHECK_EQ(stored_i32("led_bri"), 0);
+  CHECK_EQ(stored_i32("ha_port"), 1);
+  CHECK_EQ(stored_i32("vad_sil"), 100);
+  // In range: not rewritten
+  CHECK_EQ(stored_i32("vad_thr"), 300);
+  CHECK_EQ(host_nvs_writes("vad_thr"), 1);
+  // Fixed point fields were never stored unchecked by v1
+  CHECK_EQ(stored_i32("wwd_thr"), 2000);
+
+  app_settings_t s = loaded();
+  CHECK_STR(s.wifi_ssid, "old-ssid");
+  CHECK_EQ(s.output_volume, 100);
+  CHECK_EQ(s.led_brightness, 0);
+  CHECK_EQ(s.ha_port, 1);
+  CHECK_EQ(s.vad_speech_threshold, 300);
+  CHECK_EQ(lroundf(s.wwd_threshold * 1000), 1000); // Clamped on read
+}
+
+static void test_newer_schema(void) {
+  nvs_handle_t h = ns();
+  nvs_set_u8(h, "schema_ver", SETTINGS_SCHEMA_VERSION + 1);
+  nvs_set_str(h, "wifi_ssid", "future-ssid");
+  nvs_set_i32(h, "out_vol", 150);
+
+  CHECK_EQ(settings_manager_init(), ESP_OK);
+  // Left for the firmware that wrote it
+  CHECK_EQ(stored_version(), SETTINGS_SCHEMA_VERSION + 1);
+  CHECK_EQ(stored_i32("out_vol"), 150);
+  CHECK_EQ(host_nvs_writes("out_vol"), 1);
+
+  app_settings_t s = loaded();
+  CHECK_STR(s.wifi_ssid, "future-ssid");
+  CHECK_EQ(s.output_volume, 100);
+}
+
+static void test_setters(void) {
+  CHECK_EQ(settings_manager_set_int(SETTING_OUTPUT_VOLUME, 250), ESP_OK);
+  CHECK_EQ(loaded().output_volume, 100);
+  CHECK_EQ(settings_manager_set_int(SETTING_OUTPUT_VOLUME, -3), ESP_OK);
+  CHECK_EQ(loaded().output_volume, 0);
+  CHECK_EQ(settings_manager_set_int(SETTING_HA_USE_SSL, 5), ESP_OK);
+  CHECK(loaded().ha_use_ssl);
+  CHECK_EQ(settings_manager_set_float(SETTING_WWD_THRESHOLD, 0.6667f),
+           ESP_OK);
+  CHECK_EQ(lroundf(loaded().wwd_threshold * 1000), 667);
+  CHECK_EQ(settings_manager_set_str(SETTING_MQTT_USERNAME, NULL), ESP_OK);
+  CHECK_STR(loaded().mqtt_username, "");
+
+  // Wrong type or id
+  CHECK_EQ(settings_manager_set_int(SETTING_WIFI_SSID, 1),
+           ESP_ERR_INVALID_ARG);
+  CHECK_EQ(settings_manager_set_int(SETTING_COUNT, 1), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(settings_manager_set_float(SETTING_OUTPUT_VOLUME, 1.0f),
+           ESP_ERR_INVALID_ARG);
+  CHECK_EQ(settings_manager_set_str(SETTING_HA_PORT, "80"),
+           ESP_ERR_INVALID_ARG);
+
+  // Truncated to the field; the same long value again is not a change
+  const char *ssid = "a-network-name-longer-than-thirty-one-bytes";
+  CHECK_EQ(settings_manager_set_str(SETTING_WIFI_SSID, ssid), ESP_OK);
+  app_settings_t s = loaded();
+  CHECK_EQ(strlen(s.wifi_ssid), sizeof(s.wifi_ssid) - 1);
+  CHECK(strncmp(s.wifi_ssid, ssid, sizeof(s.wifi_ssid) - 1) == 0);
+
+  CHECK_EQ(settings_manager_flush(), ESP_OK);
+  CHECK_EQ(stored_i32("out_vol"), 0);
+  CHECK_EQ(stored_i32("wwd_thr"), 667);
+  CHECK_EQ(host_nvs_writes("wifi_ssid"), 1);
+
+  CHECK_EQ(settings_manager_set_str(SETTING_WIFI_SSID, ssid), ESP_OK);
+  CHECK_EQ(settings_manager_set_int(SETTING_OUTPUT_VOLUME, 0), ESP_OK);
+  CHECK_EQ(settings_manager_set_float(SETTING_WWD_THRESHOLD, 0.6668f),
+           ESP_OK);
+  CHECK_EQ(settings_manager_flush(), ESP_OK);
+  CHECK_EQ(host_nvs_writes("wifi_ssid"), 1);
+  CHECK_EQ(host_nvs_writes("out_vol"), 1);
+  CHECK_EQ(host_nvs_writes("wwd_thr"), 1);
+}
+
+static void test_save_writes_changes_only(void) {
+  app_settings_t s = loaded();
+  s.output_volume = 70;
+  s.agc_enabled = !s.agc_enabled;
+  strcpy(s.ota_url, "http://ota.local/fw.bin");
+  CHECK_EQ(settings_manager_save(&s), ESP_OK);
+  CHECK_EQ(settings_manager_flush(), ESP_OK);
+
+  CHECK_EQ(host_nvs_writes("out_vol"), 1);
+  CHECK_EQ(host_nvs_writes("agc_en"), 1);
+  CHECK_EQ(host_nvs_writes("ota_url"), 1);
+  CHECK_EQ(setting_writes(), 3);
+
+  // Saving what is already there writes nothing
+  CHECK_EQ(settings_manager_save(&s), ESP_OK);
+  CHECK_EQ(settings_manager_flush(), ESP_OK);
+  CHECK_EQ(setting_writes(), 3);
+
+  // Out of range values are clamped like set_int()
+  s.output_volume = 500;
+  CHECK_EQ(settings_manager_save(&s), ESP_OK);
+  CHECK_EQ(loaded().output_volume, 100);
+  CHECK_EQ(settings_manager_save(NULL), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(settings_manager_load(NULL), ESP_ERR_INVALID_ARG);
+}
+
+static void test_failed_flush_is_retried(void) {
+  CHECK_EQ(settings_manager_init(), ESP_OK);
+  host_nvs_fail(ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+  settings_manager_set_int(SETTING_OUTPUT_VOLUME, 33);
+  settings_manager_set_str(SETTING_OTA_URL, "http://ota.local/fw.bin");
+  CHECK_EQ(settings_manager_flush(), ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+  CHECK_EQ(setting_writes(), 0);
+
+  host_nvs_fail(ESP_OK);
+  CHECK_EQ(settings_manager_flush(), ESP_OK);
+  CHECK_EQ(stored_i32("out_vol"), 33);
+  CHECK_EQ(setting_writes(), 2);
+  CHECK_EQ(settings_manager_flush(), ESP_OK);
+  CHECK_EQ(setting_writes(), 2);
+}
+
+static void test_debounced_commit(void) {
+  CHECK_EQ(settings_manager_init(), ESP_OK);
+  uint32_t commits = host_nvs_commits();
+
+  // A slider drag: ten changes in a second end in one write
+  for (int i = 0; i < 10; i++) {
+    settings_manager_set_int(SETTING_OUTPUT_VOLUME, 10 + i);
+    vTaskDelay(pdMS_TO_TICKS(100));
+  }
+  vTaskDelay(pdMS_TO_TICKS(1000)); // Still inside the delay of the last one
+  CHECK_EQ(host_nvs_writes("out_vol"), 0);
+
+  CHECK(wait_writes("out_vol", 1, SETTINGS_COMMIT_DELAY_MS + 1000));
+  vTaskDelay(pdMS_TO_TICKS(100));
+  CHECK_EQ(host_nvs_writes("out_vol"), 1);
+  CHECK_EQ(stored_i32("out_vol"), 19);
+  CHECK_EQ(host_nvs_commits(), commits + 1);
+}
+
+static void test_max_delay(void) {
+  CHECK_EQ(settings_manager_init(), ESP_OK);
+  settings_manager_set_int(SETTING_OUTPUT_VOLUME, 1);
+  // The first change is now older than the max delay: later ones no longer
+  // push the commit back
+  host_time_advance_ms(SETTINGS_COMMIT_MAX_DELAY_MS);
+  uint32_t written_after_ms = 0;
+  for (int i = 0; i < 12; i++) {
+    vTaskDelay(pdMS_TO_TICKS(250));
+    settings_manager_set_int(SETTING_OUTPUT_VOLUME, 2 + i);
+    if (written_after_ms == 0 && host_nvs_writes("out_vol") > 0) {
+      written_after_ms = (i + 1) * 250;
+    }
+  }
+  CHECK(written_after_ms > 0);
+  CHECK(written_after_ms <= SETTINGS_COMMIT_DELAY_MS + 500);
+
+  CHECK_EQ(settings_manager_flush(), ESP_OK);
+  CHECK_EQ(stored_i32("out_vol"), 13);
+}
+
+/** One recorded drag of an MQTT number slider */
+typedef struct {
+  const char *name;
+  setting_id_t id;
+  int32_t from, to, step; ///< Thousandths for the wake word threshold
+  uint32_t interval_ms;   ///< Between MQTT messages
+} slider_drag_t;
+
+/**
+ * As voice_pipeline_update_config() persists: every field of the config,
+ * with only the moved one differing from what is stored
+ */
+static void persist_voice_config(const app_settings_t *c) {
+  settings_manager_set_float(SETTING_WWD_THRESHOLD, c->wwd_threshold);
+  settings_manager_set_int(SETTING_VAD_SPEECH_THRESHOLD,
+                           c->vad_speech_threshold);
+  settings_manager_set_int(SETTING_VAD_SILENCE_MS, c->vad_silence_ms);
+  settings_manager_set_int(SETTING_VAD_MIN_SPEECH_MS, c->vad_min_speech_ms);
+  settings_manager_set_int(SETTING_VAD_MAX_RECORDING_MS,
+                           c->vad_max_recording_ms);
+  settings_manager_set_int(SETTING_AGC_ENABLED, c->agc_enabled);
+  settings_manager_set_int(SETTING_AGC_TARGET_LEVEL, c->agc_target_level);
+}
+
+static void test_slider_replay(void) {
+  static const slider_drag_t drags[] = {
+      {"vad_thr", SETTING_VAD_SPEECH_THRESHOLD, 180, 260, 2, 25},
+      {"led_bri", SETTING_LED_BRIGHTNESS, 100, 20, -1, 12},
+      {"out_vol", SETTING_OUTPUT_VOLUME, 60, 90, 1, 33},
+      {"wwd_thr", SETTING_WWD_THRESHOLD, 500, 700, 5, 25},
+  };
+  CHECK_EQ(settings_manager_init(), ESP_OK);
+
+  uint32_t events_total = 0;
+  uint32_t writes_total = 0;
+  for (size_t d = 0; d < sizeof(drags) / sizeof(drags[0]); d++) {
+    const slider_drag_t *drag = &drags[d];
+    uint32_t writes = setting_writes();
+    uint32_t commits = host_nvs_commits();
+    uint32_t events = 0;
+
+    for (int32_t v = drag->from;; v += drag->step) {
+      app_settings_t c = loaded();
+      if (drag->id == SETTING_VAD_SPEECH_THRESHOLD) {
+        c.vad_speech_threshold = v;
+        persist_voice_config(&c);
+      } else if (drag->id == SETTING_WWD_THRESHOLD) {
+        c.wwd_threshold = v / 1000.0f;
+        persist_voice_config(&c);
+      } else {
+        settings_manager_set_int(drag->id, v);
+      }
+      events++;
+      if (v == drag->to) {
+        break;
+      }
+      vTaskDelay(pdMS_TO_TICKS(drag->interval_ms));
+    }
+
+    CHECK(wait_writes(drag->name, 1, SETTINGS_COMMIT_DELAY_MS + 1000));
+    vTaskDelay(pdMS_TO_TICKS(100));
+    uint32_t written = setting_writes() - writes;
+    printf("%-8s %3u events over %4u ms -> %u NVS write(s), %u saved\n",
+           drag->name, (unsigned)events,
+           (unsigned)((events - 1) * drag->interval_ms), (unsigned)written,
+           (unsigned)(events - written));
+    // One write of the final position, nothing else touched
+    CHECK_EQ(written, 1);
+    CHECK_EQ(stored_i32(drag->name), drag->to);
+    CHECK_EQ(host_nvs_commits() - commits, 1);
+    events_total += events;
+    writes_total += written;
+  }
+  printf("total    %3u events -> %u NVS writes, %u saved\n",
+         (unsigned)events_total, (unsigned)writes_total,
+         (unsigned)(events_total - writes_total));
+}
+
+static void test_flush_on_shutdown(void) {
+  CHECK_EQ(settings_manager_init(), ESP_OK);
+  settings_manager_set_int(SETTING_LED_BRIGHTNESS, 42);
+  CHECK_EQ(stored_i32("led_bri"), INT_MIN);
+  host_shutdown();
+  CHECK_EQ(stored_i32("led_bri"), 42);
+}
+
+static void test_reset_defaults(void) {
+  settings_manager_set_int(SETTING_OUTPUT_VOLUME, 10);
+  CHECK_EQ(settings_manager_flush(), ESP_OK);
+  CHECK_EQ(stored_i32("out_vol"), 10);
+
+  // A pending change is dropped with the rest
+  settings_manager_set_int(SETTING_LED_BRIGHTNESS, 5);
+  CHECK_EQ(settings_manager_reset_defaults(), ESP_OK);
+  CHECK_EQ(stored_i32("out_vol"), INT_MIN);
+  CHECK_EQ(stored_version(), SETTINGS_SCHEMA_VERSION);
+  CHECK_EQ(loaded().output_volume, 60);
+  CHECK_EQ(loaded().led_brightness, 100);
+  CHECK_EQ(settings_manager_flush(), ESP_OK);
+  CHECK_EQ(setting_writes(), 0);
+}
+
+int main(int argc, char **argv) {
+  static const test_case_t cases[] = {
+      {"fresh", test_fresh},
+      {"migrate_v1", test_migrate_v1},
+      {"newer_schema", test_newer_schema},
+      {"setters", test_setters},
+      {"save", test_save_writes_changes_only},
+      {"failed_flush", test_failed_flush_is_retried},
+      {"debounce", test_debounced_commit},
+      {"max_delay", test_max_delay},
+      {"slider_replay", test_slider_replay},
+      {"shutdown", test_flush_on_shutdown},
+      {"reset", test_reset_defaults},
+  };
+  return run_case(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
@@ -0,0 +1,167 @@
+/**
+ * @file test_task_profiler.c
+ * @brief task_profiler: CPU shares and core load from run-time counter
+ * deltas, stack minima kept per name, and more tasks than the per-task
+ * table holds (listed up to the cap, counted in the summary)
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host.h"
+#include "task_profiler.h"
+#include "test_util.h"
+#include <stdio.h>
+
+#define TASKS (TASK_PROFILER_MAX_TASKS + 10)
+
+static TaskStatus_t list[TASKS];
+static char handles[TASKS]; // Addresses only
+static char names[TASKS][configMAX_TASK_NAME_LEN];
+
+static void task_set(size_t i, const char *name, uint32_t stack_free) {
+  snprintf(names[i], sizeof(names[i]), "%s", name);
+  list[i] = (TaskStatus_t){.xHandle = (TaskHandle_t)&handles[i],
+                           .pcTaskName = names[i],
+                           .xTaskNumber = i + 1,
+                           .eCurrentState = eBlocked,
+                           .uxCurrentPriority = 5,
+                           .usStackHighWaterMark = stack_free,
+                           .xCoreID = tskNO_AFFINITY};
+}
+
+// Waits for the profiler task to publish sample @p samples
+static task_profile_summary_t wait_sample(uint32_t samples) {
+  task_profile_summary_t sum = {0};
+  for (int i = 0; i < 500; i++) {
+    task_profiler_get(NULL, 0, &sum);
+    if (sum.tasks_total > 0 && sum.samples >= samples) {
+      break;
+    }
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+  CHECK(sum.samples >= samples);
+  return sum;
+}
+
+static const task_profile_t *find(const task_profile_t *tasks, size_t n,
+                                  const char *name) {
+  for (size_t i = 0; i < n; i++) {
+    if (strcmp(tasks[i].name, name) == 0) {
+      return &tasks[i];
+    }
+  }
+  return NULL;
+}
+
+static bool near(uint32_t value, uint32_t expected) {
+  return value + 20 >= expected && value <= expected + 20;
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_before_start(void) {
+  task_profile_summary_t sum;
+  memset(&sum, 0xff, sizeof(sum));
+  task_profile_t out[1];
+  CHECK_EQ(task_profiler_get(out, 1, &sum), 0);
+  CHECK_EQ(sum.samples, 0);
+  CHECK_EQ(sum.tasks_total, 0);
+}
+
+static void test_cpu_and_stack(void) {
+  task_set(0, "IDLE0", 1000);
+  list[0].xHandle = xTaskGetIdleTaskHandleForCore(0);
+  task_set(1, "IDLE1", 1000);
+  list[1].xHandle = xTaskGetIdleTaskHandleForCore(1);
+  task_set(2, "afe_feed", 2048);
+  task_set(3, "tts", 300);
+  host_task_list_set(list, 4);
+
+  CHECK_EQ(task_profiler_start(1000), ESP_OK);
+  wait_sample(0); // Baseline
+  // Over the ~1 s period: core 0 75% busy, core 1 10%
+  list[0].ulRunTimeCounter += 250000;
+  list[1].ulRunTimeCounter += 900000;
+  list[2].ulRunTimeCounter += 500000;
+  list[3].ulRunTimeCounter += 100000;
+  host_task_list_set(list, 4);
+
+  task_profile_summary_t sum = wait_sample(1);
+  task_profile_t tasks[TASK_PROFILER_MAX_TASKS];
+  size_t n = task_profiler_get(tasks, TASK_PROFILER_MAX_TASKS, &sum);
+  CHECK_EQ(n, 4);
+  CHECK_EQ(sum.tasks_total, 4);
+  CHECK_EQ(sum.tasks_listed, 4);
+  CHECK_EQ(sum.truncated, 0);
+  CHECK(sum.period_ms >= 1000 && sum.period_ms < 1100);
+  CHECK(near(sum.core_load_permille[0], 750));
+  CHECK(near(sum.core_load_permille[1], 100));
+  const task_profile_t *afe = find(tasks, n, "afe_feed");
+  const task_profile_t *tts = find(tasks, n, "tts");
+  CHECK(afe != NULL && tts != NULL);
+  if (afe && tts) {
+    CHECK(near(afe->cpu_permille, 500));
+    CHECK(near(tts->cpu_permille, 100));
+    CHECK(tts->low_stack);
+    CHECK(!afe->low_stack);
+  }
+  CHECK_EQ(sum.low_stack_count, 1);
+  CHECK_STR(sum.tightest_task, "tts");
+  CHECK_EQ(sum.tightest_free, 300);
+}
+
+// Tasks past the table still count towards core load and stack warnings
+static void test_more_tasks_than_table(void) {
+  uint32_t idle0 = list[0].ulRunTimeCounter;
+  uint32_t idle1 = list[1].ulRunTimeCounter;
+  // Idle tasks and the tightest stack last, past the table
+  for (size_t i = 0; i < TASKS; i++) {
+    char name[configMAX_TASK_NAME_LEN];
+    snprintf(name, sizeof(name), "wq_%u", (unsigned)i);
+    task_set(i, name, 4096);
+  }
+  task_set(TASKS - 3, "IDLE0", 1000);
+  list[TASKS - 3].xHandle = xTaskGetIdleTaskHandleForCore(0);
+  list[TASKS - 3].ulRunTimeCounter = idle0;
+  task_set(TASKS - 2, "IDLE1", 1000);
+  list[TASKS - 2].xHandle = xTaskGetIdleTaskHandleForCore(1);
+  list[TASKS - 2].ulRunTimeCounter = idle1;
+  task_set(TASKS - 1, "late", 100);
+  task_profile_summary_t sum;
+  task_profiler_get(NULL, 0, &sum);
+  uint32_t samples = sum.samples;
+  host_task_list_set(list, TASKS);
+
+  // First sample sets the marks of the new tasks
+  wait_sample(samples + 1);
+  list[TASKS - 3].ulRunTimeCounter += 500000;
+  list[TASKS - 2].ulRunTimeCounter += 500000;
+  host_task_list_set(list, TASKS);
+  wait_sample(samples + 2);
+
+  static task_profile_t tasks[TASKS];
+  size_t n = task_profiler_get(tasks, TASKS, &sum);
+  CHECK_EQ(n, TASK_PROFILER_MAX_TASKS);
+  CHECK_EQ(sum.tasks_total, TASKS);
+  CHECK_EQ(sum.tasks_listed, TASK_PROFILER_MAX_TASKS);
+  CHECK_EQ(sum.truncated, 2);
+  CHECK(find(tasks, n, "late") == NULL);
+  CHECK(near(sum.core_load_permille[0], 500));
+  CHECK(near(sum.core_load_permille[1], 500));
+  // "tts" is gone, its minimum is kept but not reported
+  CHECK_EQ(sum.low_stack_count, 1);
+  CHECK_STR(sum.tightest_task, "late");
+  CHECK_EQ(sum.tightest_free, 100);
+  fprintf(stderr, "%u tasks: %u listed, %u samples truncated\n",
+          (unsigned)sum.tasks_total, (unsigned)sum.tasks_listed,
+          (unsigned)sum.truncated);
+}
+
+// -----------------------------------------------------------------------------
+
+int main(void) {
+  RUN(test_before_start);
+  RUN(test_cpu_and_stack);
+  RUN(test_more_tasks_than_table);
+  return TEST_RESULT();
+}
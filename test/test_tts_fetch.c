@@ -0,0 +1,366 @@
+/**
+ * @file test_tts_fetch.c
+ * @brief tts_fetch against a local HTTP stand-in for Home Assistant: time
+ * to first audio from the run-start stream vs tts-end, the tts-end
+ * fallback, and early streams abandoned by a timer, a new run or the run's
+ * end
+ */
+
+#include "dns_cache.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host.h"
+#include "metrics.h"
+#include "test_util.h"
+#include "tts_fetch.h"
+#include "work_queue.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// HA's timeline after run-start: STT and intent, then synthesis. A
+// streamed response starts with the first sentence; tts-end comes once
+// all of it is synthesised.
+#define FIRST_AUDIO_MS 400
+#define CHUNK_EVERY_MS 50
+#define TTS_END_MS 1200
+#define AUDIO_CHUNKS 16
+#define AUDIO_CHUNK 1024
+#define AUDIO_BYTES (AUDIO_CHUNKS * AUDIO_CHUNK)
+
+#define STREAM_URL "/api/tts_proxy/stream.mp3"
+#define FULL_URL "/api/tts_proxy/full.mp3"
+#define MISSING_URL "/api/tts_proxy/missing.mp3"
+#define SILENT_URL "/api/tts_proxy/silent.mp3"
+
+static uint8_t audio[AUDIO_BYTES];
+
+// -----------------------------------------------------------------------------
+// HA stand-in, one request at a time like the media lane
+
+static int listen_fd = -1;
+static uint16_t port;
+static pthread_t server_thread;
+static atomic_int requests_stream = 0;
+static atomic_int requests_full = 0;
+static atomic_int requests_silent = 0;
+static atomic_int silent_closed = 0; // Client hung up on a silent stream
+static char host_header[128];
+
+static void send_all(int fd, const void *data, size_t len) {
+  send(fd, data, len, MSG_NOSIGNAL);
+}
+
+static void serve(int fd) {
+  char req[1024];
+  size_t n = 0;
+  while (n < sizeof(req) - 1 && recv(fd, req + n, 1, 0) == 1) {
+    n++;
+    if (n >= 4 && memcmp(req + n - 4, "\r\n\r\n", 4) == 0) {
+      break;
+    }
+  }
+  req[n] = '\0';
+  const char *h = strstr(req, "\r\nHost: ");
+  if (h) {
+    sscanf(h + 8, "%127[^\r]", host_header);
+  }
+
+  char hdr[128];
+  if (strncmp(req, "GET " STREAM_URL " ", strlen(STREAM_URL) + 5) == 0) {
+    // Streamed while synthesising: no length, closed at the end
+    atomic_fetch_add(&requests_stream, 1);
+    send_all(fd, "HTTP/1.1 200 OK\r\nContent-Type: audio/mpeg\r\n\r\n", 45);
+    usleep(FIRST_AUDIO_MS * 1000);
+    for (int i = 0; i < AUDIO_CHUNKS; i++) {
+      if (i > 0) {
+        usleep(CHUNK_EVERY_MS * 1000);
+      }
+      send_all(fd, audio + i * AUDIO_CHUNK, AUDIO_CHUNK);
+    }
+  } else if (strncmp(req, "GET " FULL_URL " ", strlen(FULL_URL) + 5) == 0) {
+    atomic_fetch_add(&requests_full, 1);
+    int len = snprintf(hdr, sizeof(hdr),
+                       "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n",
+                       AUDIO_BYTES);
+    send_all(fd, hdr, len);
+    send_all(fd, audio, AUDIO_BYTES);
+  } else if (strncmp(req, "GET " SILENT_URL " ", strlen(SILENT_URL) + 5) ==
+             0) {
+    // Accepted, but nothing is ever synthesised
+    atomic_fetch_add(&requests_silent, 1);
+    send_all(fd, "HTTP/1.1 200 OK\r\n\r\n", 19);
+    struct timeval tv = {.tv_sec = 10};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char c;
+    if (recv(fd, &c, 1, 0) == 0) {
+      atomic_fetch_add(&silent_closed, 1);
+    }
+  } else {
+    send_all(fd, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n", 45);
+  }
+  close(fd);
+}
+
+static void *server_main(void *arg) {
+  (void)arg;
+  int fd;
+  while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+    serve(fd);
+  }
+  return NULL;
+}
+
+static void server_start(void) {
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET};
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t alen = sizeof(addr);
+  CHECK_EQ(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+  CHECK_EQ(listen(listen_fd, 4), 0);
+  getsockname(listen_fd, (struct sockaddr *)&addr, &alen);
+  port = ntohs(addr.sin_port);
+  pthread_create(&server_thread, NULL, server_main, NULL);
+}
+
+static void server_stop(void) {
+  shutdown(listen_fd, SHUT_RDWR);
+  close(listen_fd);
+  pthread_join(server_thread, NULL);
+}
+
+// -----------------------------------------------------------------------------
+// Player side
+
+static pthread_mutex_t player_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t played[2 * AUDIO_BYTES];
+static size_t played_len = 0;
+static int ends = 0;
+static int64_t first_audio_us = 0;
+static int64_t run_start_us = 0;
+
+static void on_audio(const uint8_t *data, size_t len) {
+  pthread_mutex_lock(&player_lock);
+  if (data == NULL) {
+    ends++;
+  } else {
+    if (played_len == 0) {
+      first_audio_us = esp_timer_get_time();
+    }
+    CHECK(played_len + len <= sizeof(played));
+    memcpy(played + played_len, data, len);
+    played_len += len;
+  }
+  pthread_mutex_unlock(&player_lock);
+}
+
+static void player_reset(void) {
+  pthread_mutex_lock(&player_lock);
+  played_len = 0;
+  ends = 0;
+  first_audio_us = 0;
+  pthread_mutex_unlock(&player_lock);
+  atomic_store(&requests_stream, 0);
+  atomic_store(&requests_full, 0);
+  atomic_store(&requests_silent, 0);
+  atomic_store(&silent_closed, 0);
+  host_metrics_reset();
+}
+
+static int player_ends(void) {
+  pthread_mutex_lock(&player_lock);
+  int n = ends;
+  pthread_mutex_unlock(&player_lock);
+  return n;
+}
+
+static bool wait_for(atomic_int *v, int n, uint32_t ms) {
+  for (uint32_t i = 0; i < ms && atomic_load(v) < n; i++) {
+    vTaskDelay(1);
+  }
+  return atomic_load(v) >= n;
+}
+
+static bool wait_end(uint32_t ms) {
+  for (uint32_t i = 0; i < ms && player_ends() == 0; i++) {
+    vTaskDelay(1);
+  }
+  return player_ends() > 0;
+}
+
+static void run_start(const char *stream_url) {
+  run_start_us = esp_timer_get_time();
+  tts_fetch_run_start(stream_url);
+}
+
+static void sleep_until_ms(int64_t ms) {
+  int64_t left = run_start_us / 1000 + ms - esp_timer_get_time() / 1000;
+  if (left > 0) {
+    vTaskDelay(pdMS_TO_TICKS(left));
+  }
+}
+
+static int64_t time_to_first_audio_ms(void) {
+  return (first_audio_us - run_start_us) / 1000;
+}
+
+/** Everything played once, in order, with one end marker */
+static void check_played(void) {
+  CHECK_EQ(played_len, AUDIO_BYTES);
+  CHECK(memcmp(played, audio, AUDIO_BYTES) == 0);
+  CHECK_EQ(player_ends(), 1);
+}
+
+// -----------------------------------------------------------------------------
+
+static int64_t early_ms = 0;
+static int64_t tts_end_ms = 0;
+
+static void test_early_stream(void) {
+  player_reset();
+  run_start(STREAM_URL);
+  sleep_until_ms(TTS_END_MS);
+  CHECK_EQ(tts_fetch_tts_end(FULL_URL), ESP_OK);
+  CHECK(wait_end(3000));
+  vTaskDelay(pdMS_TO_TICKS(50)); // tts-end job has run
+
+  check_played();
+  early_ms = time_to_first_audio_ms();
+  CHECK(early_ms >= FIRST_AUDIO_MS);
+  CHECK(early_ms < FIRST_AUDIO_MS + 200);
+  CHECK_EQ(atomic_load(&requests_stream), 1);
+  CHECK_EQ(atomic_load(&requests_full), 0); // Already played
+  CHECK_EQ(metrics_get(METRIC_HA_TTS_EARLY), 1);
+  CHECK_EQ(metrics_get(METRIC_HA_TTS_END), 0);
+  char expected_host[32]; // Connected by address, routed by name
+  snprintf(expected_host, sizeof(expected_host), "ha.local:%u", port);
+  CHECK_STR(host_header, expected_host);
+}
+
+static void test_tts_end_only(void) {
+  player_reset();
+  run_start(NULL); // Older HA: no stream offered
+  sleep_until_ms(TTS_END_MS);
+  CHECK_EQ(tts_fetch_tts_end(FULL_URL), ESP_OK);
+  CHECK(wait_end(3000));
+
+  check_played();
+  tts_end_ms = time_to_first_audio_ms();
+  CHECK(tts_end_ms >= TTS_END_MS);
+  CHECK_EQ(atomic_load(&requests_stream), 0);
+  CHECK_EQ(atomic_load(&requests_full), 1);
+  CHECK_EQ(metrics_get(METRIC_HA_TTS_END), 1);
+
+  CHECK(early_ms + 500 < tts_end_ms);
+  fprintf(stderr,
+          "time to first audio: run-start stream %lld ms, tts-end %lld ms "
+          "(%lld ms sooner)\n",
+          (long long)early_ms, (long long)tts_end_ms,
+          (long long)(tts_end_ms - early_ms));
+}
+
+static void test_fallback(void) {
+  player_reset();
+  run_start(MISSING_URL); // 404: nothing played
+  sleep_until_ms(TTS_END_MS);
+  CHECK_EQ(tts_fetch_tts_end(FULL_URL), ESP_OK);
+  CHECK(wait_end(3000));
+
+  check_played();
+  CHECK_EQ(atomic_load(&requests_full), 1);
+  CHECK_EQ(metrics_get(METRIC_HA_TTS_FALLBACK), 1);
+  CHECK_EQ(metrics_get(METRIC_HA_TTS_EARLY), 0);
+}
+
+/** The media worker is free again: a tts-end fetch plays at once */
+static void check_worker_free(uint32_t within_ms) {
+  player_reset();
+  run_start(NULL);
+  CHECK_EQ(tts_fetch_tts_end(FULL_URL), ESP_OK);
+  CHECK(wait_end(within_ms));
+  check_played();
+}
+
+static void test_timer_skips_tts(void) {
+  player_reset();
+  run_start(SILENT_URL);
+  CHECK(wait_for(&requests_silent, 1, 1000));
+  tts_fetch_skip(); // Timer intent
+  int64_t t0 = esp_timer_get_time();
+  CHECK(wait_for(&silent_closed, 1, 2 * TTS_FETCH_POLL_MS));
+  int64_t closed_ms = (esp_timer_get_time() - t0) / 1000;
+  CHECK(closed_ms <= TTS_FETCH_POLL_MS + 200);
+  tts_fetch_run_end();
+  CHECK_EQ(player_ends(), 0);
+  CHECK_EQ(played_len, 0);
+  check_worker_free(1000);
+}
+
+static void test_run_end_before_audio(void) {
+  player_reset();
+  run_start(SILENT_URL);
+  CHECK(wait_for(&requests_silent, 1, 1000));
+  tts_fetch_run_end(); // HA gave up, e.g. an intent error
+  CHECK(wait_for(&silent_closed, 1, 2 * TTS_FETCH_POLL_MS));
+  CHECK_EQ(player_ends(), 0);
+  check_worker_free(1000);
+}
+
+static void test_new_run_and_queued_stream(void) {
+  player_reset();
+  run_start(SILENT_URL);
+  CHECK(wait_for(&requests_silent, 1, 1000));
+  // The next run abandons the silent stream; its own one queues behind it
+  // and is dropped when that run ends first
+  run_start(STREAM_URL);
+  tts_fetch_run_end();
+  CHECK(wait_for(&silent_closed, 1, 2 * TTS_FETCH_POLL_MS));
+  vTaskDelay(pdMS_TO_TICKS(100));
+  CHECK_EQ(atomic_load(&requests_stream), 0);
+  CHECK_EQ(player_ends(), 0);
+  check_worker_free(1000);
+}
+
+static void test_playing_stream_drains(void) {
+  player_reset();
+  run_start(STREAM_URL);
+  sleep_until_ms(FIRST_AUDIO_MS + 3 * CHUNK_EVERY_MS);
+  tts_fetch_run_end(); // Already playing: left to finish
+  CHECK(wait_end(3000));
+  check_played();
+}
+
+// -----------------------------------------------------------------------------
+
+int main(void) {
+  for (size_t i = 0; i < sizeof(audio); i++) {
+    audio[i] = (uint8_t)(i * 13 + i / 251);
+  }
+  CHECK_EQ(work_queue_init(), ESP_OK);
+  CHECK_EQ(dns_cache_init(), ESP_OK);
+  server_start();
+  host_dns_set("ha.local", "127.0.0.1");
+  tts_fetch_configure(&(tts_fetch_config_t){
+      .hostname = "ha.local",
+      .port = port,
+      .use_ssl = false,
+      .on_audio = on_audio,
+  });
+
+  RUN(test_early_stream);
+  RUN(test_tts_end_only);
+  RUN(test_fallback);
+  RUN(test_timer_skips_tts);
+  RUN(test_run_end_before_audio);
+  RUN(test_new_run_and_queued_stream);
+  RUN(test_playing_stream_drains);
+
+  server_stop();
+  return TEST_RESULT();
+}
@@ -0,0 +1,73 @@
+/**
+ * @file test_util.h
+ * @brief Minimal assertions for the host tests
+ *
+ * A failed CHECK reports the location and the test keeps going; main()
+ * returns TEST_RESULT() so ctest sees every failure of a run at once.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      test_failures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                         \
+  do {                                                                         \
+    long long a_ = (long long)(a), b_ = (long long)(b);                        \
+    if (a_ != b_) {                                                            \
+      fprintf(stderr, "%s:%d: %s == %s failed: %lld != %lld\n", __FILE__,      \
+              __LINE__, #a, #b, a_, b_);                                       \
+      test_failures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_STR(a, b)                                                        \
+  do {                                                                         \
+    const char *a_ = (a), *b_ = (b);                                           \
+    if (strcmp(a_, b_) != 0) {                                                 \
+      fprintf(stderr, "%s:%d: %s == %s failed: \"%s\" != \"%s\"\n", __FILE__,  \
+              __LINE__, #a, #b, a_, b_);                                       \
+      test_failures++;                                                         \
+    }                                                                          \
+  } while (0)
+
+#define RUN(test)                                                              \
+  do {                                                                         \
+    int before_ = test_failures;                                               \
+    test();                                                                    \
+    fprintf(stderr, "%s %s\n", test_failures == before_ ? "PASS" : "FAIL",     \
+            #test);                                                            \
+  } while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? 0 : 1)
+
+typedef struct {
+  const char *name;
+  void (*fn)(void);
+} test_case_t;
+
+/** Run the case named by argv[1]: one per process, see host_test(CASES) */
+static inline int run_case(const test_case_t *cases, size_t count, int argc,
+                           char **argv) {
+  for (size_t i = 0; argc > 1 && i < count; i++) {
+    if (strcmp(argv[1], cases[i].name) == 0) {
+      int before = test_failures;
+      cases[i].fn();
+      fprintf(stderr, "%s %s\n", test_failures == before ? "PASS" : "FAIL",
+              cases[i].name);
+      return TEST_RESULT();
+    }
+  }
+  fprintf(stderr, "usage: %s <case>\n", argv[0]);
+  return 2;
+}
@@ -0,0 +1,320 @@
+/**
+ * @file test_work_queue.c
+ * @brief work_queue: lane ordering and parallelism, results through
+ * handles, cancellation, submit_once, pool exhaustion and stale handles
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host.h"
+#include "metrics.h"
+#include "test_util.h"
+#include "work_queue.h"
+#include <stdatomic.h>
+
+/** Holds a lane's worker until opened */
+typedef struct {
+  atomic_bool open;
+  atomic_bool entered;
+} gate_t;
+
+static atomic_int order[WORK_QUEUE_MAX_ITEMS];
+static atomic_int order_len = 0;
+static atomic_int calls = 0;
+static atomic_int running = 0;
+static atomic_int max_running = 0;
+
+static esp_err_t wait_gate(void *arg) {
+  gate_t *g = arg;
+  atomic_store(&g->entered, true);
+  int now = atomic_fetch_add(&running, 1) + 1;
+  int max = atomic_load(&max_running);
+  while (now > max && !atomic_compare_exchange_weak(&max_running, &max, now)) {
+  }
+  while (!atomic_load(&g->open)) {
+    vTaskDelay(1);
+  }
+  atomic_fetch_sub(&running, 1);
+  return ESP_OK;
+}
+
+static esp_err_t record(void *arg) {
+  atomic_fetch_add(&calls, 1);
+  order[atomic_fetch_add(&order_len, 1)] = (int)(intptr_t)arg;
+  return ESP_OK;
+}
+
+static esp_err_t return_arg(void *arg) {
+  atomic_fetch_add(&calls, 1);
+  return (esp_err_t)(intptr_t)arg;
+}
+
+/** Runs until cancelled; ESP_OK if it saw the cancel within 2 s */
+static esp_err_t until_cancelled(void *arg) {
+  atomic_store((atomic_bool *)arg, true);
+  for (int i = 0; i < 2000; i++) {
+    if (work_cancelled()) {
+      return ESP_OK;
+    }
+    vTaskDelay(1);
+  }
+  return ESP_FAIL;
+}
+
+static void block(work_lane_t lane, gate_t *g) {
+  atomic_store(&g->open, false);
+  atomic_store(&g->entered, false);
+  CHECK_EQ(work_submit(lane, "gate", wait_gate, g, NULL), ESP_OK);
+  for (int i = 0; i < 1000 && !atomic_load(&g->entered); i++) {
+    vTaskDelay(1);
+  }
+  CHECK(atomic_load(&g->entered));
+}
+
+static bool wait_true(atomic_bool *flag) {
+  for (int i = 0; i < 1000 && !atomic_load(flag); i++) {
+    vTaskDelay(1);
+  }
+  return atomic_load(flag);
+}
+
+// ---------------------------------------------------------------------------
+
+static void test_before_init(void) {
+  work_handle_t h = 123;
+  CHECK_EQ(work_submit(WORK_LANE_CONTROL, "x", record, NULL, &h),
+           ESP_ERR_INVALID_STATE);
+  CHECK_EQ(h, WORK_HANDLE_NONE);
+  CHECK_EQ(work_submit_once(&h, WORK_LANE_CONTROL, "x", record, NULL),
+           ESP_ERR_INVALID_STATE);
+  CHECK_EQ(work_wait(WORK_HANDLE_NONE, 0), ESP_ERR_INVALID_ARG);
+  CHECK(!work_busy(WORK_HANDLE_NONE));
+  CHECK(!work_cancelled());
+}
+
+static void test_bad_args(void) {
+  work_handle_t h;
+  CHECK_EQ(work_submit(WORK_LANE_COUNT, "x", record, NULL, &h),
+           ESP_ERR_INVALID_ARG);
+  CHECK_EQ(work_submit(WORK_LANE_CONTROL, "x", NULL, NULL, &h),
+           ESP_ERR_INVALID_ARG);
+  CHECK_EQ(work_submit_once(NULL, WORK_LANE_CONTROL, "x", record, NULL),
+           ESP_ERR_INVALID_ARG);
+  CHECK_EQ(work_cancel(WORK_HANDLE_NONE), ESP_ERR_INVALID_STATE);
+  work_release(WORK_HANDLE_NONE);
+}
+
+static void test_fifo_per_lane(void) {
+  gate_t gate;
+  work_handle_t last;
+  atomic_store(&order_len, 0);
+  uint32_t dispatched = host_metrics_observations(METRIC_HIST_WORK_DISPATCH);
+
+  block(WORK_LANE_CONTROL, &gate);
+  for (int i = 0; i < 9; i++) {
+    CHECK_EQ(work_submit(WORK_LANE_CONTROL, "rec", record, (void *)(intptr_t)i,
+                         NULL),
+             ESP_OK);
+  }
+  CHECK_EQ(work_submit(WORK_LANE_CONTROL, "rec", record, (void *)9, &last),
+           ESP_OK);
+  CHECK(work_busy(last));
+  vTaskDelay(pdMS_TO_TICKS(20));
+  CHECK_EQ(atomic_load(&order_len), 0);
+
+  atomic_store(&gate.open, true);
+  CHECK_EQ(work_wait(last, 1000), ESP_OK);
+  CHECK_EQ(atomic_load(&order_len), 10);
+  for (int i = 0; i < 10; i++) {
+    CHECK_EQ(order[i], i);
+  }
+  CHECK_EQ(host_metrics_observations(METRIC_HIST_WORK_DISPATCH) - dispatched,
+           11);
+  work_release(last);
+}
+
+static void test_lanes_run_independently(void) {
+  gate_t control, net_a, net_b;
+  work_handle_t h;
+  atomic_store(&max_running, 0);
+
+  // A stuck control lane does not hold up media
+  block(WORK_LANE_CONTROL, &control);
+  CHECK_EQ(work_submit(WORK_LANE_MEDIA, "media", return_arg, (void *)0, &h),
+           ESP_OK);
+  CHECK_EQ(work_wait(h, 1000), ESP_OK);
+  work_release(h);
+
+  // The network lane has two workers
+  block(WORK_LANE_NETWORK, &net_a);
+  block(WORK_LANE_NETWORK, &net_b);
+  CHECK_EQ(atomic_load(&max_running), 3);
+
+  atomic_store(&control.open, true);
+  atomic_store(&net_a.open, true);
+  atomic_store(&net_b.open, true);
+  vTaskDelay(pdMS_TO_TICKS(20));
+}
+
+static void test_wait_returns_result(void) {
+  work_handle_t h;
+  CHECK_EQ(work_submit(WORK_LANE_BACKGROUND, "res", return_arg,
+                       (void *)(intptr_t)ESP_ERR_NOT_FOUND, &h),
+           ESP_OK);
+  CHECK(h != WORK_HANDLE_NONE);
+  CHECK_EQ(work_wait(h, 1000), ESP_ERR_NOT_FOUND);
+  // Kept until released
+  CHECK_EQ(work_wait(h, 0), ESP_ERR_NOT_FOUND);
+  CHECK(!work_busy(h));
+  CHECK_EQ(work_cancel(h), ESP_ERR_INVALID_STATE);
+  work_release(h);
+  CHECK_EQ(work_wait(h, 0), ESP_ERR_INVALID_ARG);
+
+  // Timeout while the item is held up
+  gate_t gate;
+  block(WORK_LANE_BACKGROUND, &gate);
+  CHECK_EQ(work_submit(WORK_LANE_BACKGROUND, "res", return_arg, (void *)0, &h),
+           ESP_OK);
+  CHECK_EQ(work_wait(h, 50), ESP_ERR_TIMEOUT);
+  atomic_store(&gate.open, true);
+  CHECK_EQ(work_wait(h, 1000), ESP_OK);
+  work_release(h);
+}
+
+static void test_cancel_before_start(void) {
+  gate_t gate;
+  work_handle_t h;
+  int before = atomic_load(&calls);
+
+  block(WORK_LANE_CONTROL, &gate);
+  CHECK_EQ(work_submit(WORK_LANE_CONTROL, "x", return_arg, (void *)0, &h),
+           ESP_OK);
+  CHECK_EQ(work_cancel(h), ESP_OK);
+  CHECK_EQ(work_cancel(h), ESP_ERR_INVALID_STATE);
+  CHECK(!work_busy(h));
+
+  atomic_store(&gate.open, true);
+  CHECK_EQ(work_wait(h, 1000), ESP_ERR_INVALID_STATE);
+  CHECK_EQ(atomic_load(&calls), before);
+  work_release(h);
+}
+
+static void test_cancel_while_running(void) {
+  atomic_bool started = false;
+  work_handle_t h;
+
+  CHECK_EQ(work_submit(WORK_LANE_NETWORK, "loop", until_cancelled, &started,
+                       &h),
+           ESP_OK);
+  CHECK(wait_true(&started));
+  CHECK(work_busy(h));
+  // Too late to drop, but the function is told
+  CHECK_EQ(work_cancel(h), ESP_ERR_INVALID_STATE);
+  CHECK_EQ(work_wait(h, 3000), ESP_OK);
+  CHECK(!work_cancelled()); // Not on a worker
+  work_release(h);
+}
+
+static void test_submit_once(void) {
+  gate_t gate;
+  work_handle_t h = WORK_HANDLE_NONE;
+
+  block(WORK_LANE_CONTROL, &gate);
+  CHECK_EQ(work_submit_once(&h, WORK_LANE_CONTROL, "once", return_arg,
+                            (void *)0),
+           ESP_OK);
+  work_handle_t first = h;
+  CHECK_EQ(work_submit_once(&h, WORK_LANE_CONTROL, "once", return_arg,
+                            (void *)0),
+           ESP_ERR_INVALID_STATE);
+  CHECK_EQ(h, first);
+
+  // A cancelled one no longer counts as pending
+  CHECK_EQ(work_cancel(h), ESP_OK);
+  CHECK_EQ(work_submit_once(&h, WORK_LANE_CONTROL, "once", return_arg,
+                            (void *)(intptr_t)ESP_ERR_TIMEOUT),
+           ESP_OK);
+  CHECK(h != first);
+  atomic_store(&gate.open, true);
+  CHECK_EQ(work_wait(h, 1000), ESP_ERR_TIMEOUT);
+  // The first handle was released for us
+  CHECK_EQ(work_wait(first, 0), ESP_ERR_INVALID_ARG);
+
+  // Done: free to go again
+  CHECK_EQ(work_submit_once(&h, WORK_LANE_CONTROL, "once", return_arg,
+                            (void *)0),
+           ESP_OK);
+  CHECK_EQ(work_wait(h, 1000), ESP_OK);
+  work_release(h);
+}
+
+static void test_pool_exhaustion(void) {
+  gate_t gate;
+  work_handle_t last = WORK_HANDLE_NONE;
+  uint32_t rejected = metrics_get(METRIC_WORK_REJECTED);
+
+  block(WORK_LANE_CONTROL, &gate);
+  int queued = 0;
+  while (work_submit(WORK_LANE_CONTROL, "fill", return_arg, (void *)0,
+                     queued == WORK_QUEUE_MAX_ITEMS - 2 ? &last : NULL) ==
+         ESP_OK) {
+    queued++;
+    CHECK(queued < WORK_QUEUE_MAX_ITEMS);
+  }
+  // Everything but the gate item; nothing else is outstanding
+  CHECK_EQ(queued, WORK_QUEUE_MAX_ITEMS - 1);
+  CHECK_EQ(metrics_get(METRIC_WORK_REJECTED) - rejected, 1);
+
+  work_handle_t h = 99;
+  CHECK_EQ(work_submit_once(&h, WORK_LANE_CONTROL, "x", return_arg, NULL),
+           ESP_ERR_NO_MEM);
+  CHECK_EQ(h, WORK_HANDLE_NONE);
+
+  atomic_store(&gate.open, true);
+  CHECK_EQ(work_wait(last, 1000), ESP_OK);
+  work_release(last);
+  CHECK_EQ(work_submit(WORK_LANE_CONTROL, "x", return_arg, (void *)0, &h),
+           ESP_OK);
+  CHECK_EQ(work_wait(h, 1000), ESP_OK);
+  work_release(h);
+}
+
+static void test_stale_handles(void) {
+  work_handle_t old, h;
+  CHECK_EQ(work_submit(WORK_LANE_CONTROL, "a", return_arg, (void *)0, &old),
+           ESP_OK);
+  CHECK_EQ(work_wait(old, 1000), ESP_OK);
+  work_release(old);
+
+  // Cycle the pool so the slot comes back with a new generation
+  for (int i = 0; i < WORK_QUEUE_MAX_ITEMS; i++) {
+    CHECK_EQ(work_submit(WORK_LANE_CONTROL, "b", return_arg,
+                         (void *)(intptr_t)ESP_ERR_NOT_FOUND, &h),
+             ESP_OK);
+    CHECK(h != old);
+    CHECK_EQ(work_wait(h, 1000), ESP_ERR_NOT_FOUND);
+    // The old handle sees none of it
+    CHECK_EQ(work_wait(old, 0), ESP_ERR_INVALID_ARG);
+    CHECK(!work_busy(old));
+    work_release(old); // No effect on the new item
+    CHECK_EQ(work_wait(h, 0), ESP_ERR_NOT_FOUND);
+    work_release(h);
+  }
+}
+
+int main(void) {
+  RUN(test_before_init);
+  CHECK_EQ(work_queue_init(), ESP_OK);
+  CHECK_EQ(work_queue_init(), ESP_OK);
+  CHECK_EQ(host_tasks_running(), 5);
+  RUN(test_bad_args);
+  RUN(test_fifo_per_lane);
+  RUN(test_lanes_run_independently);
+  RUN(test_wait_returns_result);
+  RUN(test_cancel_before_start);
+  RUN(test_cancel_while_running);
+  RUN(test_submit_once);
+  RUN(test_pool_exhaustion);
+  RUN(test_stale_handles);
+  return TEST_RESULT();
+}